@@ -38,10 +38,14 @@
 #include "hardware.h"
 #include "hw_procs.h"
 #include "config.h"
+#include "log_ring.h"
 
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 const double PIx = 3.141592653589793;
 const double RADIUS_EARTH = 6371.0; // Mean radius of Earth in Km
@@ -67,9 +71,21 @@ static int s_logDisabledStdout = 1;
 static int s_logOnlyErrors = 0;
 
 static int s_logAddTime = 1;
-static char s_szTimeLog[64];
+// Per thread: the synchronous log functions can be called from multiple threads at the same time
+static __thread char s_szTimeLog[64];
 static char s_szAdditionalLogFile[128];
 
+#define LOG_ASYNC_FLUSH_INTERVAL_MS 20
+#define LOG_ASYNC_BUFFER_SIZE 16384
+#define LOG_ASYNC_FILE_CHECK_INTERVAL_MS 1000
+
+static int s_iLogAsync = 0;
+static pthread_t s_pThreadLogFlusher;
+static pthread_mutex_t s_MutexLogFlush = PTHREAD_MUTEX_INITIALIZER;
+static int s_iLogAsyncFd = -1;
+static u32 s_uLogAsyncLastFileCheckTime = 0;
+static u32 s_uLogAsyncLastDroppedCount = 0;
+
 const u32 crc32_table[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
 	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -160,17 +176,289 @@ void reset_counters(type_u32_couters* pCounters)
    pCounters->uValueNow = 0;
 }
 
-u32 base_compute_crc32(u8 *buf, int length)
+// CRC32 (IEEE 802.3, reflected polynomial 0xEDB88320). All the implementations give bit-identical results.
+// The fastest one supported by the CPU is selected on first use (or with base_crc32_select_implementation).
+// The internal helpers work on the raw crc register (no initial/final inversion).
+
+typedef u32 (*base_crc32_fn)(u32 crc, const u8* pBuffer, int iLength);
+
+static base_crc32_fn s_pCRC32Function = NULL;
+static int s_iCRC32Implementation = BASE_CRC32_IMPL_AUTO;
+static u32 s_uCRC32Slice8Table[8][256];
+static int s_iCRC32Slice8TableReady = 0;
+
+static const char* s_szCRC32ImplementationNames[BASE_CRC32_IMPL_COUNT] = { "auto", "table", "slice8", "pclmul", "armv8" };
+
+static u32 _base_crc32_table(u32 crc, const u8* pBuffer, int iLength)
 {
-   u8* p = buf;
-   u32 crc;
-   crc = ~0U;
+   while ( iLength-- > 0 )
+      crc = crc32_table[(crc ^ *pBuffer++) & 0xFF] ^ (crc >> 8);
+   return crc;
+}
+
+static void _base_crc32_init_slice8_table()
+{
+   if ( s_iCRC32Slice8TableReady )
+      return;
+   for( int i=0; i<256; i++ )
+   {
+      u32 crc = crc32_table[i];
+      s_uCRC32Slice8Table[0][i] = crc;
+      for( int k=1; k<8; k++ )
+      {
+         crc = crc32_table[crc & 0xFF] ^ (crc >> 8);
+         s_uCRC32Slice8Table[k][i] = crc;
+      }
+   }
+   s_iCRC32Slice8TableReady = 1;
+}
+
+// Slicing-by-8: 8 input bytes per step, using 8 derived tables (8 Kb)
 
-   while (length--)
+static u32 _base_crc32_slice8(u32 crc, const u8* pBuffer, int iLength)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+   while ( iLength >= 8 )
    {
-      crc = crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+      u32 uLow, uHigh;
+      memcpy(&uLow, pBuffer, sizeof(u32));
+      memcpy(&uHigh, pBuffer + 4, sizeof(u32));
+      uLow ^= crc;
+      crc = s_uCRC32Slice8Table[7][uLow & 0xFF] ^
+            s_uCRC32Slice8Table[6][(uLow >> 8) & 0xFF] ^
+            s_uCRC32Slice8Table[5][(uLow >> 16) & 0xFF] ^
+            s_uCRC32Slice8Table[4][uLow >> 24] ^
+            s_uCRC32Slice8Table[3][uHigh & 0xFF] ^
+            s_uCRC32Slice8Table[2][(uHigh >> 8) & 0xFF] ^
+            s_uCRC32Slice8Table[1][(uHigh >> 16) & 0xFF] ^
+            s_uCRC32Slice8Table[0][uHigh >> 24];
+      pBuffer += 8;
+      iLength -= 8;
    }
-   return crc ^ ~0U;
+#endif
+   return _base_crc32_table(crc, pBuffer, iLength);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE_CRC32_HAVE_PCLMUL
+#include <immintrin.h>
+
+// Carry-less multiply folding (Intel "Fast CRC Computation Using PCLMULQDQ"), 64 bytes per step.
+// The SSE4.2 crc32 instruction can't be used: it only does the Castagnoli polynomial.
+// Length must be at least 64 and a multiple of 16.
+
+__attribute__((target("pclmul,sse4.1")))
+static u32 _base_crc32_pclmul_blocks(u32 crc, const u8* pBuffer, int iLength)
+{
+   static const u64 __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+   static const u64 __attribute__((aligned(16))) k3k4[] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+   static const u64 __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124ULL, 0x0000000000ULL };
+   static const u64 __attribute__((aligned(16))) poly[] = { 0x01db710641ULL, 0x01f7011641ULL };
+
+   __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+   x1 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x00));
+   x2 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x10));
+   x3 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x20));
+   x4 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x30));
+   x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+   x0 = _mm_load_si128((const __m128i*)k1k2);
+   pBuffer += 64;
+   iLength -= 64;
+
+   // Fold 4 x 128 bits in parallel
+   while ( iLength >= 64 )
+   {
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+      x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+      x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+      x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+      x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+      x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+      y5 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x00));
+      y6 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x10));
+      y7 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x20));
+      y8 = _mm_loadu_si128((const __m128i*)(pBuffer + 0x30));
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+      x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+      x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+      x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+      pBuffer += 64;
+      iLength -= 64;
+   }
+
+   // Fold into 128 bits
+   x0 = _mm_load_si128((const __m128i*)k3k4);
+   x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+   x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+   x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+   x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+   x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+   x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+   x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+   x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+   x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+   // Remaining 16 bytes blocks
+   while ( iLength >= 16 )
+   {
+      x2 = _mm_loadu_si128((const __m128i*)pBuffer);
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+      pBuffer += 16;
+      iLength -= 16;
+   }
+
+   // Fold 128 bits to 64 bits
+   x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+   x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+   x1 = _mm_srli_si128(x1, 8);
+   x1 = _mm_xor_si128(x1, x2);
+   x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+   x2 = _mm_srli_si128(x1, 4);
+   x1 = _mm_and_si128(x1, x3);
+   x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+   x1 = _mm_xor_si128(x1, x2);
+
+   // Barrett reduction to 32 bits
+   x0 = _mm_load_si128((const __m128i*)poly);
+   x2 = _mm_and_si128(x1, x3);
+   x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+   x2 = _mm_and_si128(x2, x3);
+   x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+   x1 = _mm_xor_si128(x1, x2);
+
+   return (u32)_mm_extract_epi32(x1, 1);
+}
+
+static u32 _base_crc32_pclmul(u32 crc, const u8* pBuffer, int iLength)
+{
+   if ( iLength >= 64 )
+   {
+      int iBlocksLength = iLength & ~15;
+      crc = _base_crc32_pclmul_blocks(crc, pBuffer, iBlocksLength);
+      pBuffer += iBlocksLength;
+      iLength -= iBlocksLength;
+   }
+   return _base_crc32_slice8(crc, pBuffer, iLength);
+}
+#endif
+
+#if defined(__aarch64__)
+#define BASE_CRC32_HAVE_ARMV8
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+// ARMv8 crc32 instructions (not the crc32c ones) use the same polynomial
+
+__attribute__((target("+crc")))
+static u32 _base_crc32_armv8(u32 crc, const u8* pBuffer, int iLength)
+{
+   while ( iLength >= 8 )
+   {
+      u64 uData;
+      memcpy(&uData, pBuffer, sizeof(u64));
+      crc = __crc32d(crc, uData);
+      pBuffer += 8;
+      iLength -= 8;
+   }
+   if ( iLength >= 4 )
+   {
+      u32 uData;
+      memcpy(&uData, pBuffer, sizeof(u32));
+      crc = __crc32w(crc, uData);
+      pBuffer += 4;
+      iLength -= 4;
+   }
+   while ( iLength-- > 0 )
+      crc = __crc32b(crc, *pBuffer++);
+   return crc;
+}
+#endif
+
+int base_crc32_is_implementation_supported(int iImplementation)
+{
+   switch ( iImplementation )
+   {
+      case BASE_CRC32_IMPL_TABLE:
+      case BASE_CRC32_IMPL_SLICE8:
+         return 1;
+      #ifdef BASE_CRC32_HAVE_PCLMUL
+      case BASE_CRC32_IMPL_PCLMUL:
+         return (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) ? 1 : 0;
+      #endif
+      #ifdef BASE_CRC32_HAVE_ARMV8
+      case BASE_CRC32_IMPL_ARMV8:
+         return (getauxval(AT_HWCAP) & HWCAP_CRC32) ? 1 : 0;
+      #endif
+      default:
+         return 0;
+   }
+}
+
+int base_crc32_select_implementation(int iImplementation)
+{
+   if ( iImplementation == BASE_CRC32_IMPL_AUTO )
+   {
+      if ( base_crc32_is_implementation_supported(BASE_CRC32_IMPL_ARMV8) )
+         iImplementation = BASE_CRC32_IMPL_ARMV8;
+      else if ( base_crc32_is_implementation_supported(BASE_CRC32_IMPL_PCLMUL) )
+         iImplementation = BASE_CRC32_IMPL_PCLMUL;
+      else
+         iImplementation = BASE_CRC32_IMPL_SLICE8;
+   }
+   if ( ! base_crc32_is_implementation_supported(iImplementation) )
+      return 0;
+
+   // Tables used by the tails of the hardware implementations too
+   _base_crc32_init_slice8_table();
+
+   base_crc32_fn pFunction = _base_crc32_slice8;
+   if ( iImplementation == BASE_CRC32_IMPL_TABLE )
+      pFunction = _base_crc32_table;
+   #ifdef BASE_CRC32_HAVE_PCLMUL
+   if ( iImplementation == BASE_CRC32_IMPL_PCLMUL )
+      pFunction = _base_crc32_pclmul;
+   #endif
+   #ifdef BASE_CRC32_HAVE_ARMV8
+   if ( iImplementation == BASE_CRC32_IMPL_ARMV8 )
+      pFunction = _base_crc32_armv8;
+   #endif
+
+   // Other threads may already be computing CRCs: publish the function only after the tables are ready
+   __sync_synchronize();
+   s_iCRC32Implementation = iImplementation;
+   s_pCRC32Function = pFunction;
+   return 1;
+}
+
+int base_crc32_get_implementation()
+{
+   if ( NULL == s_pCRC32Function )
+      base_crc32_select_implementation(BASE_CRC32_IMPL_AUTO);
+   return s_iCRC32Implementation;
+}
+
+const char* base_crc32_get_implementation_name(int iImplementation)
+{
+   if ( (iImplementation < 0) || (iImplementation >= BASE_CRC32_IMPL_COUNT) )
+      return "unknown";
+   return s_szCRC32ImplementationNames[iImplementation];
+}
+
+u32 base_compute_crc32(u8 *buf, int length)
+{
+   if ( NULL == s_pCRC32Function )
+      base_crc32_select_implementation(BASE_CRC32_IMPL_AUTO);
+   if ( (NULL == buf) || (length <= 0) )
+      return 0;
+   return s_pCRC32Function(~0U, buf, length) ^ ~0U;
 } 
 
 u8 base_compute_crc8(u8* pBuffer, int iLength)
@@ -536,6 +824,190 @@ void log_format_time(u32 miliseconds, char* szOutTime)
    sprintf(szOutTime,"%d-%d:%02d:%02d.%03d", s_bootCount, (int)(miliseconds/1000/60/60), (int)(miliseconds/1000/60)%60, (int)((miliseconds/1000)%60), (int)(miliseconds%1000));
 }
 
+// The same arguments are printed to multiple outputs: each output gets its own copy of them
+static void _log_vfprintf(FILE* fd, const char* format, va_list args)
+{
+   va_list argsCopy;
+   va_copy(argsCopy, args);
+   vfprintf(fd, format, argsCopy);
+   va_end(argsCopy);
+}
+
+static void _log_async_get_file_name(char* szFile)
+{
+   strcpy(szFile, FOLDER_LOGS);
+   strcat(szFile, LOG_FILE_SYSTEM);
+}
+
+// Reopens the log file if it was rotated (by the logger service, the only one rotating the log files) or removed
+static void _log_async_check_file()
+{
+   char szFile[MAX_FILE_PATH_SIZE];
+   _log_async_get_file_name(szFile);
+
+   if ( s_iLogAsyncFd >= 0 )
+   {
+      struct stat statFd;
+      if ( 0 != fstat(s_iLogAsyncFd, &statFd) )
+      {
+         close(s_iLogAsyncFd);
+         s_iLogAsyncFd = -1;
+      }
+      else if ( get_current_timestamp_ms() >= s_uLogAsyncLastFileCheckTime + LOG_ASYNC_FILE_CHECK_INTERVAL_MS )
+      {
+         s_uLogAsyncLastFileCheckTime = get_current_timestamp_ms();
+         struct stat statFile;
+         if ( (0 != stat(szFile, &statFile)) || (statFile.st_ino != statFd.st_ino) || (statFile.st_dev != statFd.st_dev) )
+         {
+            close(s_iLogAsyncFd);
+            s_iLogAsyncFd = -1;
+         }
+      }
+   }
+
+   if ( s_iLogAsyncFd < 0 )
+   {
+      s_iLogAsyncFd = open(szFile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+      s_uLogAsyncLastFileCheckTime = get_current_timestamp_ms();
+   }
+}
+
+static void _log_async_write(char* pBuffer, int iLength)
+{
+   if ( iLength <= 0 )
+      return;
+
+   if ( ! s_logDisabledStdout )
+      fwrite(pBuffer, 1, iLength, stdout);
+
+   if ( 0 != s_szAdditionalLogFile[0] )
+   {
+      int fdAux = open(s_szAdditionalLogFile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+      if ( fdAux >= 0 )
+      {
+         if ( write(fdAux, pBuffer, iLength) < 0 ) {}
+         close(fdAux);
+      }
+   }
+
+   _log_async_check_file();
+   if ( s_iLogAsyncFd >= 0 )
+   if ( write(s_iLogAsyncFd, pBuffer, iLength) < 0 )
+   {
+      close(s_iLogAsyncFd);
+      s_iLogAsyncFd = -1;
+   }
+}
+
+static void _log_async_send_to_service(const char* szTime, const char* szText)
+{
+   type_log_message_buffer msg;
+   msg.type = 1;
+   snprintf(msg.text, MAX_SERVICE_LOG_ENTRY_LENGTH-1, "S%s %s: %s", szTime, sszComponentName, szText);
+   msg.text[MAX_SERVICE_LOG_ENTRY_LENGTH-1] = 0;
+   if ( ! s_logDisabledStdout )
+      printf("%s\n", msg.text+1);
+   msgsnd(s_logServiceMessageQueue, &msg, strlen(msg.text)+1, IPC_NOWAIT);
+}
+
+// Formats and writes all the pending entries of the log ring, in one write per batch.
+// Must not log anything itself (it runs with the flush mutex locked).
+static void _log_async_drain()
+{
+   static char s_szLogAsyncBuffer[LOG_ASYNC_BUFFER_SIZE];
+   char szText[MAX_SERVICE_LOG_ENTRY_LENGTH];
+   char szTime[64];
+   int iBufferPos = 0;
+   int iUseService = (s_logUseService && (s_logServiceMessageQueue >= 0)) ? 1 : 0;
+
+   while ( 1 )
+   {
+      u32 uTimeMs = 0;
+      int iLength = log_ring_read(szText, sizeof(szText), &uTimeMs);
+      if ( iLength < 0 )
+      {
+         u32 uDropped = log_ring_get_dropped_count();
+         if ( uDropped == s_uLogAsyncLastDroppedCount )
+            break;
+         snprintf(szText, sizeof(szText), "%u log lines dropped (log ring full).", uDropped - s_uLogAsyncLastDroppedCount);
+         s_uLogAsyncLastDroppedCount = uDropped;
+         uTimeMs = get_current_timestamp_ms();
+      }
+
+      szTime[0] = 0;
+      if ( s_logAddTime )
+         log_format_time(uTimeMs, szTime);
+
+      if ( iUseService )
+      {
+         _log_async_send_to_service(szTime, szText);
+         continue;
+      }
+
+      if ( iBufferPos > LOG_ASYNC_BUFFER_SIZE - MAX_SERVICE_LOG_ENTRY_LENGTH - 128 )
+      {
+         _log_async_write(s_szLogAsyncBuffer, iBufferPos);
+         iBufferPos = 0;
+      }
+      int iWritten = snprintf(s_szLogAsyncBuffer + iBufferPos, LOG_ASYNC_BUFFER_SIZE - iBufferPos, "%s %s: %s\n", szTime, sszComponentName, szText);
+      if ( iWritten > 0 )
+         iBufferPos += iWritten;
+      if ( iBufferPos > LOG_ASYNC_BUFFER_SIZE-1 )
+         iBufferPos = LOG_ASYNC_BUFFER_SIZE-1;
+   }
+   _log_async_write(s_szLogAsyncBuffer, iBufferPos);
+   if ( (! s_logDisabledStdout) && (iBufferPos > 0) )
+      fflush(stdout);
+}
+
+static void* _thread_log_flusher(void* pParam)
+{
+   while ( s_iLogAsync )
+   {
+      hardware_sleep_ms(LOG_ASYNC_FLUSH_INTERVAL_MS);
+      if ( log_ring_get_count() > 0 || (log_ring_get_dropped_count() != s_uLogAsyncLastDroppedCount) )
+         log_flush();
+   }
+   return NULL;
+}
+
+void log_enable_async()
+{
+   if ( s_iLogAsync || s_logDisabled )
+      return;
+   if ( ! log_ring_init() )
+   {
+      log_softerror_and_alarm("Failed to allocate the log ring. Using synchronous log.");
+      return;
+   }
+   s_iLogAsync = 1;
+   if ( 0 != pthread_create(&s_pThreadLogFlusher, NULL, &_thread_log_flusher, NULL) )
+   {
+      s_iLogAsync = 0;
+      log_softerror_and_alarm("Failed to create the log flusher thread. Using synchronous log.");
+      return;
+   }
+   pthread_detach(s_pThreadLogFlusher);
+   atexit(log_flush);
+   log_line("Using asynchronous log (ring of %d entries, flushed every %d ms).", LOG_RING_SLOTS, LOG_ASYNC_FLUSH_INTERVAL_MS);
+}
+
+void log_flush()
+{
+   if ( ! s_iLogAsync )
+      return;
+   pthread_mutex_lock(&s_MutexLogFlush);
+   _log_async_drain();
+   pthread_mutex_unlock(&s_MutexLogFlush);
+}
+
+u32 log_get_dropped_count()
+{
+   if ( ! log_ring_is_initialized() )
+      return 0;
+   return log_ring_get_dropped_count();
+}
+
 void log_line(const char* format, ...)
 {
    if ( s_logDisabled || s_logOnlyErrors )
@@ -544,6 +1016,13 @@ void log_line(const char* format, ...)
    va_list args;
    va_start(args, format);
 
+   if ( s_iLogAsync )
+   {
+      log_ring_add(get_current_timestamp_ms(), format, args);
+      va_end(args);
+      return;
+   }
+
    s_szTimeLog[0] = 0;
    if ( s_logAddTime )
       log_format_time(get_current_timestamp_ms(), s_szTimeLog);
@@ -583,15 +1062,15 @@ void log_line(const char* format, ...)
       FILE* fdAux = fopen(s_szAdditionalLogFile, "a+");
       if ( NULL != fdAux )
       {
-         vfprintf(fdAux, format, args);
+         _log_vfprintf(fdAux, format, args);
          fclose(fdAux);
       }
    }
 
    if ( NULL != fd )
-      vfprintf(fd, format, args);
+      _log_vfprintf(fd, format, args);
    if ( ! s_logDisabledStdout )
-      vprintf(format, args);
+      _log_vfprintf(stdout, format, args);
 
    if ( 0 != s_szAdditionalLogFile[0] )
    {
@@ -617,6 +1096,9 @@ void log_line(const char* format, ...)
 
 void log_line_forced_to_file(const char* format, ...)
 {
+   if ( s_iLogAsync )
+      log_flush();
+
    va_list args;
    va_start(args, format);
 
@@ -650,15 +1132,15 @@ void log_line_forced_to_file(const char* format, ...)
       FILE* fdAux = fopen(s_szAdditionalLogFile, "a+");
       if ( NULL != fdAux )
       {
-         vfprintf(fdAux, format, args);
+         _log_vfprintf(fdAux, format, args);
          fclose(fdAux);
       }
    }
 
    if ( NULL != fd )
-      vfprintf(fd, format, args);
+      _log_vfprintf(fd, format, args);
    if ( ! s_logDisabledStdout )
-      vprintf(format, args);
+      _log_vfprintf(stdout, format, args);
 
    if ( 0 != s_szAdditionalLogFile[0] )
    {
@@ -686,6 +1168,9 @@ void log_line_watchdog(const char* format, ...)
    if ( s_logDisabled || s_logOnlyErrors )
       return;
 
+   if ( s_iLogAsync )
+      log_flush();
+
    va_list args;
    va_start(args, format);
 
@@ -722,11 +1207,11 @@ void log_line_watchdog(const char* format, ...)
      fprintf(fd2, "%s %s: ", s_szTimeLog, sszComponentName);  
 
    if ( NULL != fd )
-      vfprintf(fd, format, args);
+      _log_vfprintf(fd, format, args);
    if ( NULL != fd2 )
-      vfprintf(fd2, format, args);
+      _log_vfprintf(fd2, format, args);
    if ( ! s_logDisabledStdout )
-      vprintf(format, args);
+      _log_vfprintf(stdout, format, args);
 
    if ( ! s_logDisabledStdout )
       printf("\n");
@@ -749,6 +1234,9 @@ void log_line_commands(const char* format, ...)
    if ( s_logDisabled || s_logOnlyErrors )
       return;
 
+   if ( s_iLogAsync )
+      log_flush();
+
    va_list args;
    va_start(args, format);
 
@@ -785,11 +1273,11 @@ void log_line_commands(const char* format, ...)
      fprintf(fd2, "%s %s: ", s_szTimeLog, sszComponentName);  
 
    if ( NULL != fd )
-      vfprintf(fd, format, args);
+      _log_vfprintf(fd, format, args);
    if ( NULL != fd2 )
-      vfprintf(fd2, format, args);
+      _log_vfprintf(fd2, format, args);
    if ( ! s_logDisabledStdout )
-      vprintf(format, args);
+      _log_vfprintf(stdout, format, args);
 
    if ( ! s_logDisabledStdout )
       printf("\n");
@@ -1093,6 +1581,9 @@ void log_error_and_alarm(const char* format, ...)
    if ( s_logDisabled )
       return;
 
+   if ( s_iLogAsync )
+      log_flush();
+
    va_list args;
    va_start(args, format);
 
@@ -1144,17 +1635,17 @@ void log_error_and_alarm(const char* format, ...)
       FILE* fdAux = fopen(s_szAdditionalLogFile, "a+");
       if ( NULL != fdAux )
       {
-         vfprintf(fdAux, format, args);
+         _log_vfprintf(fdAux, format, args);
          fclose(fdAux);
       }
    }
 
    if ( ! s_logDisabledStdout )
-      vprintf(format, args);
+      _log_vfprintf(stdout, format, args);
    if ( NULL != fd )
-      vfprintf(fd, format, args);
+      _log_vfprintf(fd, format, args);
    if ( NULL != fd2 )
-      vfprintf(fd2, format, args);
+      _log_vfprintf(fd2, format, args);
 
    if ( 0 != s_szAdditionalLogFile[0] )
    {
@@ -1191,6 +1682,9 @@ void log_softerror_and_alarm(const char* format, ...)
    if ( s_logDisabled )
       return;
 
+   if ( s_iLogAsync )
+      log_flush();
+
    va_list args;
    va_start(args, format);
 
@@ -1242,17 +1736,17 @@ void log_softerror_and_alarm(const char* format, ...)
       FILE* fdAux = fopen(s_szAdditionalLogFile, "a+");
       if ( NULL != fdAux )
       {
-         vfprintf(fdAux, format, args);
+         _log_vfprintf(fdAux, format, args);
          fclose(fdAux);
       }
    }
 
    if ( ! s_logDisabledStdout )
-      vprintf(format, args);
+      _log_vfprintf(stdout, format, args);
    if ( NULL != fd )
-      vfprintf(fd, format, args);
+      _log_vfprintf(fd, format, args);
    if ( NULL != fd2 )
-      vfprintf(fd2, format, args);
+      _log_vfprintf(fd2, format, args);
 
    if ( 0 != s_szAdditionalLogFile[0] )
    {
@@ -26,6 +26,7 @@
 #include "config_hw.h"
 
 
+typedef unsigned long long u64;
 typedef unsigned int u32;
 typedef unsigned short u16;
 typedef unsigned char u8;
@@ -35,6 +36,13 @@ typedef u32 __le32;
 #define MAX_VEHICLE_NAME_LENGTH 16
 #define MAX_SERVICE_LOG_ENTRY_LENGTH 300
 
+#define BASE_CRC32_IMPL_AUTO 0
+#define BASE_CRC32_IMPL_TABLE 1
+#define BASE_CRC32_IMPL_SLICE8 2
+#define BASE_CRC32_IMPL_PCLMUL 3
+#define BASE_CRC32_IMPL_ARMV8 4
+#define BASE_CRC32_IMPL_COUNT 5
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 #define le16_to_cpu(x) (x)
 #define le32_to_cpu(x) (x)
@@ -75,6 +83,11 @@ u32 revert_word(u32 input);
 void reset_counters(type_u32_couters* pCounters);
 
 u32 base_compute_crc32(u8 *buf, int length);
+// The CRC32 implementation is selected on first use (fastest one supported by the CPU); all give identical results
+int base_crc32_is_implementation_supported(int iImplementation);
+int base_crc32_select_implementation(int iImplementation);
+int base_crc32_get_implementation();
+const char* base_crc32_get_implementation_name(int iImplementation);
 u8 base_compute_crc8(u8* pBuffer, int iLength);
 int base_check_crc32(u8* pBuffer, int iLength);
 
@@ -97,6 +110,11 @@ void log_disable();
 void log_disable_stdout();
 void log_enable_stdout();
 void log_only_errors();
+// Asynchronous log: log_line() only stores the entry in a per process ring; a flusher thread formats
+// and writes the entries. Errors are still written right away (after the pending entries).
+void log_enable_async();
+void log_flush();
+u32 log_get_dropped_count();
 void log_format_time(u32 miliseconds, char* szOutTime);
 void log_line(const char* format, ...);
 void log_line_forced_to_file(const char* format, ...);
@@ -0,0 +1,458 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "base.h"
+#include "command_window.h"
+
+void command_window_init(type_command_window* pWindow, int iWindowSize)
+{
+   if ( NULL == pWindow )
+      return;
+   memset(pWindow, 0, sizeof(type_command_window));
+   if ( iWindowSize < 1 )
+      iWindowSize = 1;
+   if ( iWindowSize > COMMAND_WINDOW_MAX_COMMANDS )
+      iWindowSize = COMMAND_WINDOW_MAX_COMMANDS;
+   pWindow->iWindowSize = iWindowSize;
+   pWindow->uTimeoutMs = COMMAND_WINDOW_INITIAL_TIMEOUT_MS;
+}
+
+void command_window_reset(type_command_window* pWindow)
+{
+   if ( NULL == pWindow )
+      return;
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+      pWindow->entries[i].uState = COMMAND_WINDOW_STATE_FREE;
+   pWindow->iCountCommands = 0;
+   pWindow->iCountInFlight = 0;
+}
+
+// Higher priority first, then the older command
+static int _command_window_is_before(type_command_window_entry* pEntry, type_command_window_entry* pOther)
+{
+   if ( NULL == pOther )
+      return 1;
+   if ( pEntry->uPriority != pOther->uPriority )
+      return (pEntry->uPriority > pOther->uPriority)?1:0;
+   return ((int)(pEntry->uCommandCounter - pOther->uCommandCounter) < 0)?1:0;
+}
+
+static int _command_window_has_older_with_same_key(type_command_window* pWindow, type_command_window_entry* pEntry)
+{
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+   {
+      type_command_window_entry* pOther = &pWindow->entries[i];
+      if ( (pOther == pEntry) || (COMMAND_WINDOW_STATE_FREE == pOther->uState) )
+         continue;
+      if ( pOther->uOrderKey != pEntry->uOrderKey )
+         continue;
+      if ( (int)(pOther->uCommandCounter - pEntry->uCommandCounter) < 0 )
+         return 1;
+   }
+   return 0;
+}
+
+static type_command_window_entry* _command_window_find_in_flight(type_command_window* pWindow, u32 uCommandCounter)
+{
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+   {
+      if ( COMMAND_WINDOW_STATE_IN_FLIGHT != pWindow->entries[i].uState )
+         continue;
+      if ( pWindow->entries[i].uCommandCounter == uCommandCounter )
+         return &pWindow->entries[i];
+   }
+   return NULL;
+}
+
+static u32 _command_window_get_entry_timeout(type_command_window* pWindow, type_command_window_entry* pEntry)
+{
+   if ( pWindow->uTimeoutMs < pEntry->uMinTimeoutMs )
+      return pEntry->uMinTimeoutMs;
+   return pWindow->uTimeoutMs;
+}
+
+// Smoothed RTT and RTT variation as in TCP (gains 1/8 and 1/4), timeout = SRTT + 4 x RTTVAR
+static void _command_window_add_rtt_sample(type_command_window* pWindow, u32 uRTTMs)
+{
+   if ( 0 == uRTTMs )
+      uRTTMs = 1;
+   if ( 0 == pWindow->uSmoothedRTTx8 )
+   {
+      pWindow->uSmoothedRTTx8 = uRTTMs * 8;
+      pWindow->uRTTVariationx4 = uRTTMs * 2;
+   }
+   else
+   {
+      int iDelta = (int)uRTTMs - (int)(pWindow->uSmoothedRTTx8/8);
+      pWindow->uSmoothedRTTx8 = (u32)((int)pWindow->uSmoothedRTTx8 + iDelta);
+      if ( iDelta < 0 )
+         iDelta = -iDelta;
+      pWindow->uRTTVariationx4 = pWindow->uRTTVariationx4 - pWindow->uRTTVariationx4/4 + (u32)iDelta;
+   }
+
+   u32 uTimeout = pWindow->uSmoothedRTTx8/8 + pWindow->uRTTVariationx4;
+   if ( uTimeout < COMMAND_WINDOW_MIN_TIMEOUT_MS )
+      uTimeout = COMMAND_WINDOW_MIN_TIMEOUT_MS;
+   if ( uTimeout > COMMAND_WINDOW_MAX_TIMEOUT_MS )
+      uTimeout = COMMAND_WINDOW_MAX_TIMEOUT_MS;
+   pWindow->uTimeoutMs = uTimeout;
+}
+
+// The commands in flight without a response, sent before the acknowledged one, are lost
+// (the command, or its response if the vehicle has it): resend them now
+static void _command_window_process_ack(type_command_window* pWindow, type_command_window_entry* pAcked, u32 uAckBitmap)
+{
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+   {
+      type_command_window_entry* pEntry = &pWindow->entries[i];
+      if ( (pEntry == pAcked) || (COMMAND_WINDOW_STATE_IN_FLIGHT != pEntry->uState) || pEntry->bResendNow )
+         continue;
+      int iDelta = (int)(pAcked->uCommandCounter - pEntry->uCommandCounter);
+      if ( (iDelta <= 0) || (iDelta > COMMAND_WINDOW_ACK_BITS) )
+         continue;
+      // Resent after the acknowledged command was sent: its response can still come
+      if ( (int)(pEntry->uLastSendIndex - pAcked->uLastSendIndex) > 0 )
+         continue;
+
+      pEntry->bResendNow = 1;
+      if ( uAckBitmap & (((u32)1) << (iDelta-1)) )
+      {
+         pEntry->bReceivedByVehicle = 1;
+         pWindow->stats.uLostResponses++;
+      }
+      else
+         pWindow->stats.uLostCommands++;
+   }
+}
+
+type_command_window_entry* command_window_add(type_command_window* pWindow, u32 uCommandCounter, u16 uCommandType, u32 uCommandParam, u8* pData, int iDataLength, u8 uPriority, u16 uOrderKey, u32 uMinTimeoutMs, u8 uMaxResendCounter, u32 uTimeNow)
+{
+   if ( (NULL == pWindow) || (iDataLength < 0) || (iDataLength > COMMAND_WINDOW_MAX_DATA_LENGTH) )
+      return NULL;
+   if ( (iDataLength > 0) && (NULL == pData) )
+      return NULL;
+   if ( pWindow->iCountCommands >= COMMAND_WINDOW_MAX_COMMANDS )
+      return NULL;
+
+   type_command_window_entry* pEntry = NULL;
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+   {
+      if ( COMMAND_WINDOW_STATE_FREE == pWindow->entries[i].uState )
+      {
+         pEntry = &pWindow->entries[i];
+         break;
+      }
+   }
+   if ( NULL == pEntry )
+      return NULL;
+
+   pEntry->uCommandCounter = uCommandCounter;
+   pEntry->uCommandType = uCommandType;
+   pEntry->uCommandParam = uCommandParam;
+   pEntry->uState = COMMAND_WINDOW_STATE_QUEUED;
+   pEntry->uPriority = uPriority;
+   pEntry->uOrderKey = uOrderKey;
+   pEntry->uResendCounter = 0;
+   pEntry->uMaxResendCounter = uMaxResendCounter;
+   pEntry->bResendNow = 0;
+   pEntry->bReceivedByVehicle = 0;
+   pEntry->uMinTimeoutMs = uMinTimeoutMs;
+   pEntry->uTimeoutMs = 0;
+   pEntry->uQueuedTime = uTimeNow;
+   pEntry->uFirstSendTime = 0;
+   pEntry->uLastSendTime = 0;
+   pEntry->uLastSendIndex = 0;
+   pEntry->iDataLength = iDataLength;
+   if ( iDataLength > 0 )
+      memcpy(pEntry->uData, pData, iDataLength);
+
+   pWindow->iCountCommands++;
+   pWindow->stats.uCommandsQueued++;
+   return pEntry;
+}
+
+type_command_window_entry* command_window_get_next_to_send(type_command_window* pWindow, u32 uTimeNow)
+{
+   if ( (NULL == pWindow) || (0 == pWindow->iCountCommands) )
+      return NULL;
+
+   // Resends first
+   type_command_window_entry* pNext = NULL;
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+   {
+      type_command_window_entry* pEntry = &pWindow->entries[i];
+      if ( COMMAND_WINDOW_STATE_IN_FLIGHT != pEntry->uState )
+         continue;
+      if ( pEntry->uResendCounter >= pEntry->uMaxResendCounter )
+         continue;
+      if ( (! pEntry->bResendNow) && (uTimeNow < pEntry->uLastSendTime + pEntry->uTimeoutMs) )
+         continue;
+      if ( _command_window_is_before(pEntry, pNext) )
+         pNext = pEntry;
+   }
+
+   if ( NULL != pNext )
+   {
+      if ( pNext->bResendNow )
+         pWindow->stats.uResendsOnAck++;
+      else
+      {
+         pWindow->stats.uResendsOnTimeout++;
+         pNext->uTimeoutMs *= 2;
+         if ( pNext->uTimeoutMs > COMMAND_WINDOW_MAX_TIMEOUT_MS )
+            pNext->uTimeoutMs = COMMAND_WINDOW_MAX_TIMEOUT_MS;
+         if ( pNext->uTimeoutMs < pNext->uMinTimeoutMs )
+            pNext->uTimeoutMs = pNext->uMinTimeoutMs;
+      }
+      pNext->bResendNow = 0;
+      pNext->uResendCounter++;
+      pNext->uLastSendTime = uTimeNow;
+      pNext->uLastSendIndex = ++pWindow->uSendIndex;
+      return pNext;
+   }
+
+   // New commands
+   if ( pWindow->iCountInFlight >= pWindow->iWindowSize )
+      return NULL;
+
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+   {
+      type_command_window_entry* pEntry = &pWindow->entries[i];
+      if ( COMMAND_WINDOW_STATE_QUEUED != pEntry->uState )
+         continue;
+      if ( ! _command_window_is_before(pEntry, pNext) )
+         continue;
+      if ( _command_window_has_older_with_same_key(pWindow, pEntry) )
+         continue;
+      pNext = pEntry;
+   }
+   if ( NULL == pNext )
+      return NULL;
+
+   pNext->uState = COMMAND_WINDOW_STATE_IN_FLIGHT;
+   pNext->uResendCounter = 0;
+   pNext->uTimeoutMs = _command_window_get_entry_timeout(pWindow, pNext);
+   pNext->uFirstSendTime = uTimeNow;
+   pNext->uLastSendTime = uTimeNow;
+   pNext->uLastSendIndex = ++pWindow->uSendIndex;
+   pWindow->iCountInFlight++;
+   if ( (u32)pWindow->iCountInFlight > pWindow->stats.uMaxInFlight )
+      pWindow->stats.uMaxInFlight = (u32)pWindow->iCountInFlight;
+   return pNext;
+}
+
+type_command_window_entry* command_window_on_response(type_command_window* pWindow, u32 uCommandCounter, u8 uResendCounter, int bHasAck, u32 uAckBitmap, u32 uTimeNow)
+{
+   if ( NULL == pWindow )
+      return NULL;
+   type_command_window_entry* pEntry = _command_window_find_in_flight(pWindow, uCommandCounter);
+   if ( NULL == pEntry )
+   {
+      pWindow->stats.uDuplicateResponses++;
+      return NULL;
+   }
+
+   // Only the response to the last transmission tells the round trip time and what was sent before it
+   if ( uResendCounter == pEntry->uResendCounter )
+   {
+      if ( 0 == pEntry->uMinTimeoutMs )
+         _command_window_add_rtt_sample(pWindow, uTimeNow - pEntry->uLastSendTime);
+      if ( bHasAck )
+         _command_window_process_ack(pWindow, pEntry, uAckBitmap);
+   }
+   pWindow->stats.uCommandsCompleted++;
+   return pEntry;
+}
+
+type_command_window_entry* command_window_get_timed_out(type_command_window* pWindow, u32 uTimeNow)
+{
+   if ( NULL == pWindow )
+      return NULL;
+   for( int i=0; i<COMMAND_WINDOW_MAX_COMMANDS; i++ )
+   {
+      type_command_window_entry* pEntry = &pWindow->entries[i];
+      if ( COMMAND_WINDOW_STATE_IN_FLIGHT != pEntry->uState )
+         continue;
+      if ( pEntry->uResendCounter < pEntry->uMaxResendCounter )
+         continue;
+      if ( uTimeNow < pEntry->uLastSendTime + pEntry->uTimeoutMs )
+         continue;
+      pWindow->stats.uCommandsTimedOut++;
+      return pEntry;
+   }
+   return NULL;
+}
+
+void command_window_remove(type_command_window* pWindow, type_command_window_entry* pEntry)
+{
+   if ( (NULL == pWindow) || (NULL == pEntry) || (COMMAND_WINDOW_STATE_FREE == pEntry->uState) )
+      return;
+   if ( COMMAND_WINDOW_STATE_IN_FLIGHT == pEntry->uState )
+      pWindow->iCountInFlight--;
+   pEntry->uState = COMMAND_WINDOW_STATE_FREE;
+   pWindow->iCountCommands--;
+}
+
+int command_window_is_empty(type_command_window* pWindow)
+{
+   if ( NULL == pWindow )
+      return 1;
+   return (0 == pWindow->iCountCommands)?1:0;
+}
+
+int command_window_is_full(type_command_window* pWindow)
+{
+   if ( NULL == pWindow )
+      return 1;
+   return (pWindow->iCountCommands >= COMMAND_WINDOW_MAX_COMMANDS)?1:0;
+}
+
+u32 command_window_get_rtt_ms(type_command_window* pWindow)
+{
+   if ( NULL == pWindow )
+      return 0;
+   return pWindow->uSmoothedRTTx8/8;
+}
+
+u32 command_window_get_timeout_ms(type_command_window* pWindow)
+{
+   if ( NULL == pWindow )
+      return COMMAND_WINDOW_INITIAL_TIMEOUT_MS;
+   return pWindow->uTimeoutMs;
+}
+
+
+void command_window_rx_reset(type_command_window_rx* pRx)
+{
+   if ( NULL == pRx )
+      return;
+   pRx->uSourceId = 0;
+   pRx->iNextEntry = 0;
+   for( int i=0; i<COMMAND_WINDOW_RX_HISTORY; i++ )
+   {
+      pRx->entries[i].uReceivedTime = 0;
+      pRx->entries[i].bHasResponse = 0;
+   }
+}
+
+static int _command_window_rx_is_valid(type_command_window_rx_entry* pEntry, u32 uTimeNow)
+{
+   if ( 0 == pEntry->uReceivedTime )
+      return 0;
+   if ( uTimeNow >= pEntry->uReceivedTime + COMMAND_WINDOW_RX_HISTORY_MS )
+      return 0;
+   return 1;
+}
+
+type_command_window_rx_entry* command_window_rx_find(type_command_window_rx* pRx, u32 uSourceId, u32 uCommandCounter, u32 uTimeNow)
+{
+   if ( (NULL == pRx) || (uSourceId != pRx->uSourceId) )
+      return NULL;
+   for( int i=0; i<COMMAND_WINDOW_RX_HISTORY; i++ )
+   {
+      if ( pRx->entries[i].uCommandCounter != uCommandCounter )
+         continue;
+      if ( _command_window_rx_is_valid(&pRx->entries[i], uTimeNow) )
+         return &pRx->entries[i];
+   }
+   return NULL;
+}
+
+void command_window_rx_add(type_command_window_rx* pRx, u32 uSourceId, u32 uCommandCounter, u32 uTimeNow)
+{
+   if ( NULL == pRx )
+      return;
+   if ( uSourceId != pRx->uSourceId )
+   {
+      command_window_rx_reset(pRx);
+      pRx->uSourceId = uSourceId;
+   }
+   if ( 0 == uTimeNow )
+      uTimeNow = 1;
+
+   type_command_window_rx_entry* pEntry = &pRx->entries[pRx->iNextEntry];
+   pRx->iNextEntry = (pRx->iNextEntry + 1) % COMMAND_WINDOW_RX_HISTORY;
+   pEntry->uCommandCounter = uCommandCounter;
+   pEntry->uReceivedTime = uTimeNow;
+   pEntry->bHasResponse = 0;
+   pEntry->uResponseFlags = 0;
+   pEntry->uResponseParam = 0;
+   pEntry->iReplyLength = 0;
+}
+
+void command_window_rx_set_response(type_command_window_rx* pRx, u32 uCommandCounter, u8 uResponseFlags, u32 uResponseParam, u8* pReply, int iReplyLength)
+{
+   if ( NULL == pRx )
+      return;
+
+   // The last one added for this counter
+   type_command_window_rx_entry* pEntry = NULL;
+   for( int i=1; i<=COMMAND_WINDOW_RX_HISTORY; i++ )
+   {
+      int iIndex = (pRx->iNextEntry - i + COMMAND_WINDOW_RX_HISTORY) % COMMAND_WINDOW_RX_HISTORY;
+      if ( (0 != pRx->entries[iIndex].uReceivedTime) && (pRx->entries[iIndex].uCommandCounter == uCommandCounter) )
+      {
+         pEntry = &pRx->entries[iIndex];
+         break;
+      }
+   }
+   if ( NULL == pEntry )
+      return;
+
+   // Can't keep it: a resend of the command will be processed as a new command
+   if ( (iReplyLength < 0) || (iReplyLength > (int)sizeof(pEntry->uReply)) || ((iReplyLength > 0) && (NULL == pReply)) )
+   {
+      pEntry->uReceivedTime = 0;
+      return;
+   }
+   pEntry->bHasResponse = 1;
+   pEntry->uResponseFlags = uResponseFlags;
+   pEntry->uResponseParam = uResponseParam;
+   pEntry->iReplyLength = iReplyLength;
+   if ( iReplyLength > 0 )
+      memcpy(pEntry->uReply, pReply, iReplyLength);
+}
+
+u32 command_window_rx_get_ack_bitmap(type_command_window_rx* pRx, u32 uCommandCounter, u32 uTimeNow)
+{
+   if ( NULL == pRx )
+      return 0;
+   u32 uBitmap = 0;
+   for( int i=0; i<COMMAND_WINDOW_RX_HISTORY; i++ )
+   {
+      if ( ! _command_window_rx_is_valid(&pRx->entries[i], uTimeNow) )
+         continue;
+      int iDelta = (int)(uCommandCounter - pRx->entries[i].uCommandCounter);
+      if ( (iDelta > 0) && (iDelta <= COMMAND_WINDOW_ACK_BITS) )
+         uBitmap |= ((u32)1) << (iDelta-1);
+   }
+   return uBitmap;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+
+// Commands window: more than one command in flight from the controller to the vehicle.
+//
+// Controller (type_command_window): a command gets its sequence number (the command counter) when it's queued
+// and it's sent as soon as the window allows it, highest priority first, then oldest first.
+// A command is not sent while an older command with the same order key is queued or in flight, so the vehicle
+// (and the controller, on the responses) applies the changes of the same settings in the order they were made.
+// Commands that must run alone (radio links changes, reboot, file transfers, ...) are not queued here,
+// they use the stop-and-wait command path of the controller.
+// Each response acknowledges its command and carries, in response_counter, the bitmap of the
+// COMMAND_WINDOW_ACK_BITS commands before it that the vehicle received (selective ack). Commands still without
+// a response that were sent before the acknowledged one are resent right away (the command or its response was lost),
+// without waiting for their resend timeout.
+// The resend timeout adapts to the round trip time of the commands: smoothed RTT + 4 x RTT variation,
+// doubled on each resend of the same command (measured only on the transmission the response is for).
+//
+// Vehicle (type_command_window_rx): keeps the last received commands and their responses, so a resent command is
+// answered with the same response and never applied twice, even when it arrives after newer commands.
+
+#define COMMAND_WINDOW_SIZE 8 // max commands in flight
+#define COMMAND_WINDOW_MAX_COMMANDS 32 // queued and in flight
+#define COMMAND_WINDOW_MAX_DATA_LENGTH MAX_PACKET_PAYLOAD
+#define COMMAND_WINDOW_ACK_BITS 32
+
+#define COMMAND_WINDOW_INITIAL_TIMEOUT_MS 50
+#define COMMAND_WINDOW_MIN_TIMEOUT_MS 20
+#define COMMAND_WINDOW_MAX_TIMEOUT_MS 1000
+
+#define COMMAND_WINDOW_PRIORITY_LOW 0
+#define COMMAND_WINDOW_PRIORITY_NORMAL 1
+#define COMMAND_WINDOW_PRIORITY_HIGH 2
+
+#define COMMAND_WINDOW_STATE_FREE 0
+#define COMMAND_WINDOW_STATE_QUEUED 1
+#define COMMAND_WINDOW_STATE_IN_FLIGHT 2
+
+// Vehicle: received commands history
+#define COMMAND_WINDOW_RX_HISTORY 32
+// Older commands are treated as new ones (i.e. the controller restarted and reused the command counters)
+#define COMMAND_WINDOW_RX_HISTORY_MS 10000
+
+typedef struct
+{
+   u32 uCommandCounter;
+   u16 uCommandType;
+   u32 uCommandParam;
+   u8  uState;
+   u8  uPriority;
+   u16 uOrderKey;
+   u8  uResendCounter; // of the last transmission
+   u8  uMaxResendCounter;
+   u8  bResendNow; // lost, from a selective ack
+   u8  bReceivedByVehicle; // from a selective ack
+   u32 uMinTimeoutMs; // commands that take long on the vehicle: lower limit of the resend timeout, no RTT samples
+   u32 uTimeoutMs;
+   u32 uQueuedTime;
+   u32 uFirstSendTime;
+   u32 uLastSendTime;
+   u32 uLastSendIndex; // transmissions order, to find the commands sent before an acknowledged one
+   int iDataLength;
+   u8  uData[COMMAND_WINDOW_MAX_DATA_LENGTH];
+} type_command_window_entry;
+
+typedef struct
+{
+   u32 uCommandsQueued;
+   u32 uCommandsCompleted;
+   u32 uCommandsTimedOut; // all resends used, no response
+   u32 uResendsOnTimeout;
+   u32 uResendsOnAck; // found lost from a selective ack, before their timeout
+   u32 uLostCommands; // of the resends on ack: the vehicle did not receive the command
+   u32 uLostResponses; // of the resends on ack: the vehicle received the command, its response was lost
+   u32 uDuplicateResponses;
+   u32 uMaxInFlight;
+} type_command_window_stats;
+
+typedef struct
+{
+   type_command_window_entry entries[COMMAND_WINDOW_MAX_COMMANDS];
+   int iWindowSize;
+   int iCountCommands;
+   int iCountInFlight;
+   u32 uSendIndex;
+   // RTT estimate, in 1/8 ms (smoothed RTT) and 1/4 ms (RTT variation), 0: no samples yet
+   u32 uSmoothedRTTx8;
+   u32 uRTTVariationx4;
+   u32 uTimeoutMs;
+   type_command_window_stats stats;
+} type_command_window;
+
+typedef struct
+{
+   u32 uCommandCounter;
+   u32 uReceivedTime; // 0: empty slot
+   u8  bHasResponse;
+   u8  uResponseFlags;
+   u32 uResponseParam;
+   int iReplyLength;
+   u8  uReply[MAX_PACKET_PAYLOAD];
+} type_command_window_rx_entry;
+
+typedef struct
+{
+   u32 uSourceId;
+   int iNextEntry;
+   type_command_window_rx_entry entries[COMMAND_WINDOW_RX_HISTORY];
+} type_command_window_rx;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Controller
+
+void command_window_init(type_command_window* pWindow, int iWindowSize);
+// Drops all the commands, keeps the RTT estimate
+void command_window_reset(type_command_window* pWindow);
+
+// Returns the queued command, NULL if the window is full or the data is too large
+type_command_window_entry* command_window_add(type_command_window* pWindow, u32 uCommandCounter, u16 uCommandType, u32 uCommandParam, u8* pData, int iDataLength, u8 uPriority, u16 uOrderKey, u32 uMinTimeoutMs, u8 uMaxResendCounter, u32 uTimeNow);
+// Returns the next command to send now (a resend or a new command) and marks it as sent, NULL if none.
+// The caller sends it with the returned uResendCounter.
+type_command_window_entry* command_window_get_next_to_send(type_command_window* pWindow, u32 uTimeNow);
+// Returns the command the response is for, NULL if it's not in flight (i.e. a duplicate response).
+// The caller handles the response, then removes the command.
+type_command_window_entry* command_window_on_response(type_command_window* pWindow, u32 uCommandCounter, u8 uResendCounter, int bHasAck, u32 uAckBitmap, u32 uTimeNow);
+// Returns a command in flight that used all its resends without a response, NULL if none.
+// The caller handles the timeout, then removes the command.
+type_command_window_entry* command_window_get_timed_out(type_command_window* pWindow, u32 uTimeNow);
+void command_window_remove(type_command_window* pWindow, type_command_window_entry* pEntry);
+
+int command_window_is_empty(type_command_window* pWindow);
+int command_window_is_full(type_command_window* pWindow);
+u32 command_window_get_rtt_ms(type_command_window* pWindow);
+u32 command_window_get_timeout_ms(type_command_window* pWindow);
+
+// Vehicle
+
+void command_window_rx_reset(type_command_window_rx* pRx);
+// Returns the history entry of an already received command, NULL if the command is new
+type_command_window_rx_entry* command_window_rx_find(type_command_window_rx* pRx, u32 uSourceId, u32 uCommandCounter, u32 uTimeNow);
+void command_window_rx_add(type_command_window_rx* pRx, u32 uSourceId, u32 uCommandCounter, u32 uTimeNow);
+// Keeps the (last) response sent for the command, to answer the resends of the command
+void command_window_rx_set_response(type_command_window_rx* pRx, u32 uCommandCounter, u8 uResponseFlags, u32 uResponseParam, u8* pReply, int iReplyLength);
+// Bit i: command uCommandCounter-1-i was received
+u32 command_window_rx_get_ack_bitmap(type_command_window_rx* pRx, u32 uCommandCounter, u32 uTimeNow);
+
+#ifdef __cplusplus
+}
+#endif
@@ -174,7 +174,9 @@ typedef struct
 //    wifi guard delay (0..100)
 //  byte 3:
 //    bit 0..3: radio interfaces graph refresh interval: 1...6, same translation to miliseconds as for nGraphRadioRefreshInterval: 10,20,50,100,200,500 ms
+// extra data (optional): t_model_sync_request: the version of the model settings the controller has (see model_sync.h)
 //
+// Response param: 0 - tar file, 1 - tar+gzip file, 2 - changes of the model settings (model_sync.h), always in a single response
 // Response has one of two types:
 //   * the zip model settings, if single packet mode was set (more than 150 bytes)
 //   * segments of the zip model settings, if multiple small segments response was requested (smaller than 150 bytes)
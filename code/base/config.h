@@ -92,6 +92,7 @@
 #define DEFAULT_RADIO_DATARATE_LOWEST 2000000
 
 #define DEFAULT_USE_PPCAP_FOR_TX 0
+#define DEFAULT_USE_MMAP_RING_FOR_RX 0
 #define DEFAULT_BYPASS_SOCKET_BUFFERS 1
 #define DEFAULT_RADIO_TX_POWER_CONTROLLER 20
 #define DEFAULT_RADIO_TX_POWER 20
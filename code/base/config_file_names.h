@@ -36,9 +36,13 @@
 #define FILE_CONFIG_ACTIVE_CONTROLLER_MODEL "controller_active_model.cfg"
 #define FILE_CONFIG_CURRENT_VEHICLE_MODEL "current_vehicle.mdl"
 #define FILE_CONFIG_CURRENT_VEHICLE_MODEL_BACKUP "current_vehicle.bak"
+#define FILE_CONFIG_CURRENT_VEHICLE_MODEL_BINARY "current_vehicle.mdb"
+#define FILE_CONFIG_MODEL_SYNC_SENT_BASE "model_sync_sent_%d.mdl"
+#define FILE_CONFIG_MODEL_SYNC_RECEIVED_BASE "model_sync_vehicle_%u.mdl"
 #define FILE_CONFIG_CURRENT_VEHICLE_COUNT "current_vehicle_count.cfg"
 #define FILE_CONFIG_CURRENT_SEARCH_BAND "current_search_band.cfg"
 #define FILE_CONFIG_CURRENT_RADIO_HW_CONFIG "current_radios.cfg"
+#define FILE_CONFIG_VIRTUAL_RADIO "virtual_radio.cfg"
 #define FILE_CONFIG_HARDWARE_I2C_DEVICES "i2c_devices_settings.cfg"
 #define FILE_CONFIG_ENCRYPTION_PASS "current_pph.cfg"
 #define FILE_CONFIG_HW_SERIAL_PORTS "hw_serial.cfg"
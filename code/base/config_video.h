@@ -70,4 +70,10 @@
 
 #define MAX_BLOCKS_TO_OUTPUT_IF_AVAILABLE 20
 
-#define DEFAULT_LOCAL_VIDEO_PLAYER_UDP_PORT 7012
\ No newline at end of file
+#define DEFAULT_LOCAL_VIDEO_PLAYER_UDP_PORT 7012
+
+// Video input from majestic (UDP): datagrams read per recvmmsg call, socket receive buffer (0: system default), busy poll, GRO
+#define DEFAULT_VIDEO_UDP_INPUT_BATCH_SIZE 16
+#define DEFAULT_VIDEO_UDP_INPUT_RECV_BUFFER_KB 0
+#define DEFAULT_VIDEO_UDP_INPUT_BUSY_POLL_MICROS 0
+#define DEFAULT_VIDEO_UDP_INPUT_GRO 0
\ No newline at end of file
@@ -115,6 +115,7 @@ void reset_ControllerSettings()
    s_CtrlSettings.iRadioTxThreadPriority = DEFAULT_PRIORITY_THREAD_RADIO_TX;
    s_CtrlSettings.iRadioTxUsesPPCAP = DEFAULT_USE_PPCAP_FOR_TX;
    s_CtrlSettings.iRadioBypassSocketBuffers = DEFAULT_BYPASS_SOCKET_BUFFERS;
+   s_CtrlSettings.iRadioRxUsesMmapRing = DEFAULT_USE_MMAP_RING_FOR_RX;
 
    log_line("Reseted controller settings.");
 }
@@ -170,6 +171,7 @@ int save_ControllerSettings()
    fprintf(fd, "%d\n", s_CtrlSettings.iSiKPacketSize);
    fprintf(fd, "%d %d\n", s_CtrlSettings.iRadioRxThreadPriority, s_CtrlSettings.iRadioTxThreadPriority);
    fprintf(fd, "%d %d\n", s_CtrlSettings.iRadioTxUsesPPCAP, s_CtrlSettings.iRadioBypassSocketBuffers);
+   fprintf(fd, "%d\n", s_CtrlSettings.iRadioRxUsesMmapRing);
    fclose(fd);
 
    log_line("Saved controller settings to file: %s", szFile);
@@ -369,18 +371,15 @@ int load_ControllerSettings()
       s_CtrlSettings.iRadioTxThreadPriority = DEFAULT_PRIORITY_THREAD_RADIO_TX;
    }
 
-   if ( (!failed) && (2 != fscanf(fd, "%d %d", &s_CtrlSettings.iRadioRxThreadPriority, &s_CtrlSettings.iRadioTxThreadPriority)) )
-   {
-      s_CtrlSettings.iRadioRxThreadPriority = DEFAULT_PRIORITY_THREAD_RADIO_RX;
-      s_CtrlSettings.iRadioTxThreadPriority = DEFAULT_PRIORITY_THREAD_RADIO_TX;
-   }
-
    if ( (!failed) && (2 != fscanf(fd, "%d %d", &s_CtrlSettings.iRadioTxUsesPPCAP, &s_CtrlSettings.iRadioBypassSocketBuffers)) )
    {
       s_CtrlSettings.iRadioTxUsesPPCAP = DEFAULT_USE_PPCAP_FOR_TX;
       s_CtrlSettings.iRadioBypassSocketBuffers = DEFAULT_BYPASS_SOCKET_BUFFERS;
    }
 
+   if ( (!failed) && (1 != fscanf(fd, "%d", &s_CtrlSettings.iRadioRxUsesMmapRing)) )
+      s_CtrlSettings.iRadioRxUsesMmapRing = DEFAULT_USE_MMAP_RING_FOR_RX;
+
    fclose(fd);
 
    //--------------------------------------------------------
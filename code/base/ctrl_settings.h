@@ -79,6 +79,7 @@ typedef struct
    int iRadioTxThreadPriority;
    int iRadioTxUsesPPCAP;
    int iRadioBypassSocketBuffers;
+   int iRadioRxUsesMmapRing;
 } ControllerSettings;
 
 int save_ControllerSettings();
@@ -40,6 +40,9 @@
 u8 s_epp[MAX_PASS_LENGTH+1];
 u8 s_eppl = 0;
 
+static void _encr_aead_derive_key();
+static void _encr_aead_clear_key();
+
 int lpp(char* szOutputBuffer, int maxLength)
 {
    char szFile[128];
@@ -90,6 +93,7 @@ int lpp(char* szOutputBuffer, int maxLength)
    s_eppl = pos;
    strncpy((char*)s_epp, szBuffer, MAX_PASS_LENGTH);
    s_epp[MAX_PASS_LENGTH] = 0;
+   _encr_aead_derive_key();
 
    if ( NULL != szOutputBuffer )
       strncpy(szOutputBuffer, szBuffer, maxLength);
@@ -109,9 +113,7 @@ int spp(char* szBuffer)
    if ( NULL == fd )
       return 0;
 
-   s_eppl = strlen(szBuffer);
-   strncpy((char*)s_epp, szBuffer, MAX_PASS_LENGTH);
-   s_epp[MAX_PASS_LENGTH] = 0;
+   upp(szBuffer);
 
    u8 sBlockSeed[ENC_BLOCK_SIZE];
    u8 sBlockInput[ENC_BLOCK_SIZE];
@@ -160,10 +162,22 @@ int spp(char* szBuffer)
    return 1;
 }
 
+int upp(char* szBuffer)
+{
+   if ( NULL == szBuffer || 0 == szBuffer[0] )
+      return 0;
+   s_eppl = strlen(szBuffer);
+   strncpy((char*)s_epp, szBuffer, MAX_PASS_LENGTH);
+   s_epp[MAX_PASS_LENGTH] = 0;
+   _encr_aead_derive_key();
+   return 1;
+}
+
 void rpp()
 {
    s_eppl = 0;
    s_epp[0] = 0;
+   _encr_aead_clear_key();
 }
 
 u8* gpp(int* pLen)
@@ -211,3 +225,627 @@ int dpp(u8* pData, int len)
    }
    return 1;
 }
+
+//------------------------------------------------------------------
+// ChaCha20-Poly1305 (RFC 8439) authenticated packet encryption.
+// The key is derived from the pass phrase each time the pass phrase is loaded or saved.
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#define ENCR_HAVE_SSE2_CHACHA20
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define ENCR_HAVE_NEON_CHACHA20
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+#endif
+#endif
+
+#define ENCR_ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define ENCR_U8TO32_LE(p) (((u32)((p)[0])) | ((u32)((p)[1]) << 8) | ((u32)((p)[2]) << 16) | ((u32)((p)[3]) << 24))
+#define ENCR_U32TO8_LE(p, v) { (p)[0] = (u8)(v); (p)[1] = (u8)((v) >> 8); (p)[2] = (u8)((v) >> 16); (p)[3] = (u8)((v) >> 24); }
+
+#define ENCR_CHACHA20_QR(a,b,c,d) \
+   a += b; d ^= a; d = ENCR_ROTL32(d,16); \
+   c += d; b ^= c; b = ENCR_ROTL32(b,12); \
+   a += b; d ^= a; d = ENCR_ROTL32(d,8); \
+   c += d; b ^= c; b = ENCR_ROTL32(b,7);
+
+static u8 s_uAEADKey[ENCR_AEAD_KEY_LENGTH];
+static int s_iAEADKeyValid = 0;
+static u32 s_uAEADNonceSalt = 0;
+static u32 s_uAEADNonceCounter = 0;
+static int s_iChaCha20Implementation = ENCR_CHACHA20_IMPL_AUTO;
+
+static void _chacha20_init_state(u32* pState, const u8* pKey, const u8* pNonce, u32 uCounter)
+{
+   pState[0] = 0x61707865;
+   pState[1] = 0x3320646e;
+   pState[2] = 0x79622d32;
+   pState[3] = 0x6b206574;
+   for( int i=0; i<8; i++ )
+      pState[4+i] = ENCR_U8TO32_LE(pKey + 4*i);
+   pState[12] = uCounter;
+   pState[13] = ENCR_U8TO32_LE(pNonce);
+   pState[14] = ENCR_U8TO32_LE(pNonce + 4);
+   pState[15] = ENCR_U8TO32_LE(pNonce + 8);
+}
+
+static void _chacha20_rounds(u32* x)
+{
+   for( int i=0; i<10; i++ )
+   {
+      ENCR_CHACHA20_QR(x[0], x[4], x[8],  x[12]);
+      ENCR_CHACHA20_QR(x[1], x[5], x[9],  x[13]);
+      ENCR_CHACHA20_QR(x[2], x[6], x[10], x[14]);
+      ENCR_CHACHA20_QR(x[3], x[7], x[11], x[15]);
+      ENCR_CHACHA20_QR(x[0], x[5], x[10], x[15]);
+      ENCR_CHACHA20_QR(x[1], x[6], x[11], x[12]);
+      ENCR_CHACHA20_QR(x[2], x[7], x[8],  x[13]);
+      ENCR_CHACHA20_QR(x[3], x[4], x[9],  x[14]);
+   }
+}
+
+// One 64 bytes keystream block; increments the block counter
+
+static void _chacha20_block(u32* pState, u8* pOutput)
+{
+   u32 x[16];
+   memcpy(x, pState, sizeof(x));
+   _chacha20_rounds(x);
+   for( int i=0; i<16; i++ )
+      ENCR_U32TO8_LE(pOutput + 4*i, x[i] + pState[i]);
+   pState[12]++;
+}
+
+// XORs 4 consecutive keystream blocks (256 bytes) into pData, 4 blocks computed in parallel (one block per vector lane).
+
+#ifdef ENCR_HAVE_SSE2_CHACHA20
+
+#define ENCR_SSE2_ROTL32(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32-(n)))
+#define ENCR_SSE2_QR(a,b,c,d) \
+   a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ENCR_SSE2_ROTL32(d, 16); \
+   c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ENCR_SSE2_ROTL32(b, 12); \
+   a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ENCR_SSE2_ROTL32(d, 8); \
+   c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ENCR_SSE2_ROTL32(b, 7);
+
+static void _chacha20_xor_blocks4_sse2(u32* pState, u8* pData)
+{
+   __m128i s[16];
+   __m128i x[16];
+   for( int i=0; i<16; i++ )
+      s[i] = _mm_set1_epi32((int)pState[i]);
+   s[12] = _mm_add_epi32(s[12], _mm_setr_epi32(0, 1, 2, 3));
+   for( int i=0; i<16; i++ )
+      x[i] = s[i];
+
+   for( int i=0; i<10; i++ )
+   {
+      ENCR_SSE2_QR(x[0], x[4], x[8],  x[12]);
+      ENCR_SSE2_QR(x[1], x[5], x[9],  x[13]);
+      ENCR_SSE2_QR(x[2], x[6], x[10], x[14]);
+      ENCR_SSE2_QR(x[3], x[7], x[11], x[15]);
+      ENCR_SSE2_QR(x[0], x[5], x[10], x[15]);
+      ENCR_SSE2_QR(x[1], x[6], x[11], x[12]);
+      ENCR_SSE2_QR(x[2], x[7], x[8],  x[13]);
+      ENCR_SSE2_QR(x[3], x[4], x[9],  x[14]);
+   }
+
+   for( int i=0; i<16; i++ )
+      x[i] = _mm_add_epi32(x[i], s[i]);
+
+   // Transpose each group of 4 words: from one vector per word (4 blocks) to one vector per block (4 words)
+   for( int g=0; g<4; g++ )
+   {
+      __m128i t0 = _mm_unpacklo_epi32(x[4*g], x[4*g+1]);
+      __m128i t1 = _mm_unpacklo_epi32(x[4*g+2], x[4*g+3]);
+      __m128i t2 = _mm_unpackhi_epi32(x[4*g], x[4*g+1]);
+      __m128i t3 = _mm_unpackhi_epi32(x[4*g+2], x[4*g+3]);
+      __m128i r[4];
+      r[0] = _mm_unpacklo_epi64(t0, t1);
+      r[1] = _mm_unpackhi_epi64(t0, t1);
+      r[2] = _mm_unpacklo_epi64(t2, t3);
+      r[3] = _mm_unpackhi_epi64(t2, t3);
+      for( int b=0; b<4; b++ )
+      {
+         __m128i* p = (__m128i*)(pData + 64*b + 16*g);
+         _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), r[b]));
+      }
+   }
+   pState[12] += 4;
+}
+#endif
+
+#ifdef ENCR_HAVE_NEON_CHACHA20
+
+#define ENCR_NEON_ROTL32(v, n) vsriq_n_u32(vshlq_n_u32(v, n), v, 32-(n))
+#define ENCR_NEON_ROTL32_16(v) vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(v)))
+#define ENCR_NEON_QR(a,b,c,d) \
+   a = vaddq_u32(a, b); d = veorq_u32(d, a); d = ENCR_NEON_ROTL32_16(d); \
+   c = vaddq_u32(c, d); b = veorq_u32(b, c); b = ENCR_NEON_ROTL32(b, 12); \
+   a = vaddq_u32(a, b); d = veorq_u32(d, a); d = ENCR_NEON_ROTL32(d, 8); \
+   c = vaddq_u32(c, d); b = veorq_u32(b, c); b = ENCR_NEON_ROTL32(b, 7);
+
+static void _chacha20_xor_blocks4_neon(u32* pState, u8* pData)
+{
+   static const u32 s_uLanes[4] = { 0, 1, 2, 3 };
+   uint32x4_t s[16];
+   uint32x4_t x[16];
+   for( int i=0; i<16; i++ )
+      s[i] = vdupq_n_u32(pState[i]);
+   s[12] = vaddq_u32(s[12], vld1q_u32(s_uLanes));
+   for( int i=0; i<16; i++ )
+      x[i] = s[i];
+
+   for( int i=0; i<10; i++ )
+   {
+      ENCR_NEON_QR(x[0], x[4], x[8],  x[12]);
+      ENCR_NEON_QR(x[1], x[5], x[9],  x[13]);
+      ENCR_NEON_QR(x[2], x[6], x[10], x[14]);
+      ENCR_NEON_QR(x[3], x[7], x[11], x[15]);
+      ENCR_NEON_QR(x[0], x[5], x[10], x[15]);
+      ENCR_NEON_QR(x[1], x[6], x[11], x[12]);
+      ENCR_NEON_QR(x[2], x[7], x[8],  x[13]);
+      ENCR_NEON_QR(x[3], x[4], x[9],  x[14]);
+   }
+
+   for( int i=0; i<16; i++ )
+      x[i] = vaddq_u32(x[i], s[i]);
+
+   for( int g=0; g<4; g++ )
+   {
+      uint32x4x2_t ab = vtrnq_u32(x[4*g], x[4*g+1]);
+      uint32x4x2_t cd = vtrnq_u32(x[4*g+2], x[4*g+3]);
+      uint32x4_t r[4];
+      r[0] = vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0]));
+      r[1] = vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1]));
+      r[2] = vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0]));
+      r[3] = vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1]));
+      for( int b=0; b<4; b++ )
+      {
+         u8* p = pData + 64*b + 16*g;
+         vst1q_u8(p, veorq_u8(vld1q_u8(p), vreinterpretq_u8_u32(r[b])));
+      }
+   }
+   pState[12] += 4;
+}
+#endif
+
+int encr_chacha20_is_implementation_supported(int iImplementation)
+{
+   switch ( iImplementation )
+   {
+      case ENCR_CHACHA20_IMPL_AUTO:
+      case ENCR_CHACHA20_IMPL_PORTABLE:
+         return 1;
+      case ENCR_CHACHA20_IMPL_SIMD:
+         #if defined(ENCR_HAVE_SSE2_CHACHA20)
+         return 1;
+         #elif defined(ENCR_HAVE_NEON_CHACHA20) && defined(__aarch64__)
+         return 1;
+         #elif defined(ENCR_HAVE_NEON_CHACHA20)
+         return (getauxval(AT_HWCAP) & HWCAP_NEON) ? 1 : 0;
+         #else
+         return 0;
+         #endif
+   }
+   return 0;
+}
+
+void encr_chacha20_select_implementation(int iImplementation)
+{
+   if ( (iImplementation == ENCR_CHACHA20_IMPL_AUTO) || (! encr_chacha20_is_implementation_supported(iImplementation)) )
+   {
+      iImplementation = ENCR_CHACHA20_IMPL_PORTABLE;
+      if ( encr_chacha20_is_implementation_supported(ENCR_CHACHA20_IMPL_SIMD) )
+         iImplementation = ENCR_CHACHA20_IMPL_SIMD;
+   }
+   s_iChaCha20Implementation = iImplementation;
+}
+
+int encr_chacha20_get_implementation()
+{
+   if ( s_iChaCha20Implementation == ENCR_CHACHA20_IMPL_AUTO )
+      encr_chacha20_select_implementation(ENCR_CHACHA20_IMPL_AUTO);
+   return s_iChaCha20Implementation;
+}
+
+const char* encr_chacha20_get_implementation_name(int iImplementation)
+{
+   switch ( iImplementation )
+   {
+      case ENCR_CHACHA20_IMPL_AUTO: return "auto";
+      case ENCR_CHACHA20_IMPL_PORTABLE: return "portable";
+      case ENCR_CHACHA20_IMPL_SIMD:
+         #if defined(ENCR_HAVE_SSE2_CHACHA20)
+         return "sse2";
+         #elif defined(ENCR_HAVE_NEON_CHACHA20)
+         return "neon";
+         #else
+         return "simd";
+         #endif
+   }
+   return "unknown";
+}
+
+void encr_chacha20_xor(const u8* pKey, const u8* pNonce, u32 uCounter, u8* pData, int iLength)
+{
+   if ( (NULL == pKey) || (NULL == pNonce) || (NULL == pData) || (iLength <= 0) )
+      return;
+
+   u32 uState[16];
+   _chacha20_init_state(uState, pKey, pNonce, uCounter);
+
+   #if defined(ENCR_HAVE_SSE2_CHACHA20) || defined(ENCR_HAVE_NEON_CHACHA20)
+   if ( encr_chacha20_get_implementation() == ENCR_CHACHA20_IMPL_SIMD )
+   {
+      while ( iLength >= 256 )
+      {
+         #if defined(ENCR_HAVE_SSE2_CHACHA20)
+         _chacha20_xor_blocks4_sse2(uState, pData);
+         #else
+         _chacha20_xor_blocks4_neon(uState, pData);
+         #endif
+         pData += 256;
+         iLength -= 256;
+      }
+      // Tail longer than a block: still faster to do 4 blocks at once on a copy
+      if ( iLength > 64 )
+      {
+         u8 uTail[256];
+         memcpy(uTail, pData, iLength);
+         #if defined(ENCR_HAVE_SSE2_CHACHA20)
+         _chacha20_xor_blocks4_sse2(uState, uTail);
+         #else
+         _chacha20_xor_blocks4_neon(uState, uTail);
+         #endif
+         memcpy(pData, uTail, iLength);
+         return;
+      }
+   }
+   #endif
+
+   u8 uKeyStream[64];
+   while ( iLength > 0 )
+   {
+      _chacha20_block(uState, uKeyStream);
+      int iCount = (iLength < 64)?iLength:64;
+      for( int i=0; i<iCount; i++ )
+         pData[i] ^= uKeyStream[i];
+      pData += iCount;
+      iLength -= iCount;
+   }
+}
+
+// HChaCha20: 32 bytes key + 16 bytes input -> 32 bytes output
+
+static void _hchacha20(const u8* pKey, const u8* pInput, u8* pOutput)
+{
+   u32 x[16];
+   _chacha20_init_state(x, pKey, pInput+4, ENCR_U8TO32_LE(pInput));
+   _chacha20_rounds(x);
+   for( int i=0; i<4; i++ )
+   {
+      ENCR_U32TO8_LE(pOutput + 4*i, x[i]);
+      ENCR_U32TO8_LE(pOutput + 16 + 4*i, x[12+i]);
+   }
+}
+
+// Poly1305, 26 bits limbs (32 bits multiplies only, fast enough on ARMv7 too)
+
+typedef struct
+{
+   u32 r[5];
+   u32 h[5];
+   u32 pad[4];
+   u8 buffer[16];
+   int iLeftover;
+} t_encr_poly1305;
+
+static void _poly1305_init(t_encr_poly1305* pCtx, const u8* pKey)
+{
+   pCtx->r[0] = (ENCR_U8TO32_LE(pKey + 0)) & 0x3ffffff;
+   pCtx->r[1] = (ENCR_U8TO32_LE(pKey + 3) >> 2) & 0x3ffff03;
+   pCtx->r[2] = (ENCR_U8TO32_LE(pKey + 6) >> 4) & 0x3ffc0ff;
+   pCtx->r[3] = (ENCR_U8TO32_LE(pKey + 9) >> 6) & 0x3f03fff;
+   pCtx->r[4] = (ENCR_U8TO32_LE(pKey + 12) >> 8) & 0x00fffff;
+   for( int i=0; i<5; i++ )
+      pCtx->h[i] = 0;
+   for( int i=0; i<4; i++ )
+      pCtx->pad[i] = ENCR_U8TO32_LE(pKey + 16 + 4*i);
+   pCtx->iLeftover = 0;
+}
+
+static void _poly1305_blocks(t_encr_poly1305* pCtx, const u8* pData, int iLength, u32 uHiBit)
+{
+   const u32 r0 = pCtx->r[0], r1 = pCtx->r[1], r2 = pCtx->r[2], r3 = pCtx->r[3], r4 = pCtx->r[4];
+   const u32 s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+   u32 h0 = pCtx->h[0], h1 = pCtx->h[1], h2 = pCtx->h[2], h3 = pCtx->h[3], h4 = pCtx->h[4];
+
+   while ( iLength >= 16 )
+   {
+      h0 += (ENCR_U8TO32_LE(pData + 0)) & 0x3ffffff;
+      h1 += (ENCR_U8TO32_LE(pData + 3) >> 2) & 0x3ffffff;
+      h2 += (ENCR_U8TO32_LE(pData + 6) >> 4) & 0x3ffffff;
+      h3 += (ENCR_U8TO32_LE(pData + 9) >> 6) & 0x3ffffff;
+      h4 += (ENCR_U8TO32_LE(pData + 12) >> 8) | uHiBit;
+
+      u64 d0 = (u64)h0*r0 + (u64)h1*s4 + (u64)h2*s3 + (u64)h3*s2 + (u64)h4*s1;
+      u64 d1 = (u64)h0*r1 + (u64)h1*r0 + (u64)h2*s4 + (u64)h3*s3 + (u64)h4*s2;
+      u64 d2 = (u64)h0*r2 + (u64)h1*r1 + (u64)h2*r0 + (u64)h3*s4 + (u64)h4*s3;
+      u64 d3 = (u64)h0*r3 + (u64)h1*r2 + (u64)h2*r1 + (u64)h3*r0 + (u64)h4*s4;
+      u64 d4 = (u64)h0*r4 + (u64)h1*r3 + (u64)h2*r2 + (u64)h3*r1 + (u64)h4*r0;
+
+      u32 c = (u32)(d0 >> 26); h0 = (u32)d0 & 0x3ffffff;
+      d1 += c; c = (u32)(d1 >> 26); h1 = (u32)d1 & 0x3ffffff;
+      d2 += c; c = (u32)(d2 >> 26); h2 = (u32)d2 & 0x3ffffff;
+      d3 += c; c = (u32)(d3 >> 26); h3 = (u32)d3 & 0x3ffffff;
+      d4 += c; c = (u32)(d4 >> 26); h4 = (u32)d4 & 0x3ffffff;
+      h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+      h1 += c;
+
+      pData += 16;
+      iLength -= 16;
+   }
+
+   pCtx->h[0] = h0; pCtx->h[1] = h1; pCtx->h[2] = h2; pCtx->h[3] = h3; pCtx->h[4] = h4;
+}
+
+static void _poly1305_update(t_encr_poly1305* pCtx, const u8* pData, int iLength)
+{
+   if ( pCtx->iLeftover > 0 )
+   {
+      int iCount = 16 - pCtx->iLeftover;
+      if ( iCount > iLength )
+         iCount = iLength;
+      memcpy(pCtx->buffer + pCtx->iLeftover, pData, iCount);
+      pCtx->iLeftover += iCount;
+      pData += iCount;
+      iLength -= iCount;
+      if ( pCtx->iLeftover < 16 )
+         return;
+      _poly1305_blocks(pCtx, pCtx->buffer, 16, 1<<24);
+      pCtx->iLeftover = 0;
+   }
+   if ( iLength >= 16 )
+   {
+      int iFull = iLength & (~15);
+      _poly1305_blocks(pCtx, pData, iFull, 1<<24);
+      pData += iFull;
+      iLength -= iFull;
+   }
+   if ( iLength > 0 )
+   {
+      memcpy(pCtx->buffer, pData, iLength);
+      pCtx->iLeftover = iLength;
+   }
+}
+
+// Pads the data processed so far to a 16 bytes boundary, as the AEAD construction requires
+
+static void _poly1305_pad16(t_encr_poly1305* pCtx)
+{
+   static const u8 s_uZeros[16] = { 0 };
+   if ( pCtx->iLeftover > 0 )
+      _poly1305_update(pCtx, s_uZeros, 16 - pCtx->iLeftover);
+}
+
+static void _poly1305_finish(t_encr_poly1305* pCtx, u8* pTag)
+{
+   if ( pCtx->iLeftover > 0 )
+   {
+      pCtx->buffer[pCtx->iLeftover] = 1;
+      for( int i=pCtx->iLeftover+1; i<16; i++ )
+         pCtx->buffer[i] = 0;
+      _poly1305_blocks(pCtx, pCtx->buffer, 16, 0);
+   }
+
+   u32 h0 = pCtx->h[0], h1 = pCtx->h[1], h2 = pCtx->h[2], h3 = pCtx->h[3], h4 = pCtx->h[4];
+   u32 c;
+   c = h1 >> 26; h1 &= 0x3ffffff;
+   h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+   h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+   h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+   h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+   h1 += c;
+
+   // h - p, selected in constant time if h >= p
+   u32 g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+   u32 g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+   u32 g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+   u32 g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+   u32 g4 = h4 + c - (1 << 26);
+
+   u32 uMask = (g4 >> 31) - 1;
+   g0 &= uMask; g1 &= uMask; g2 &= uMask; g3 &= uMask; g4 &= uMask;
+   uMask = ~uMask;
+   h0 = (h0 & uMask) | g0;
+   h1 = (h1 & uMask) | g1;
+   h2 = (h2 & uMask) | g2;
+   h3 = (h3 & uMask) | g3;
+   h4 = (h4 & uMask) | g4;
+
+   h0 = (h0) | (h1 << 26);
+   h1 = (h1 >> 6) | (h2 << 20);
+   h2 = (h2 >> 12) | (h3 << 14);
+   h3 = (h3 >> 18) | (h4 << 8);
+
+   u64 f;
+   f = (u64)h0 + pCtx->pad[0]; h0 = (u32)f;
+   f = (u64)h1 + pCtx->pad[1] + (f >> 32); h1 = (u32)f;
+   f = (u64)h2 + pCtx->pad[2] + (f >> 32); h2 = (u32)f;
+   f = (u64)h3 + pCtx->pad[3] + (f >> 32); h3 = (u32)f;
+
+   ENCR_U32TO8_LE(pTag + 0, h0);
+   ENCR_U32TO8_LE(pTag + 4, h1);
+   ENCR_U32TO8_LE(pTag + 8, h2);
+   ENCR_U32TO8_LE(pTag + 12, h3);
+}
+
+void encr_poly1305(const u8* pKey, const u8* pData, int iLength, u8* pTag)
+{
+   t_encr_poly1305 ctx;
+   _poly1305_init(&ctx, pKey);
+   if ( (NULL != pData) && (iLength > 0) )
+      _poly1305_update(&ctx, pData, iLength);
+   _poly1305_finish(&ctx, pTag);
+}
+
+static void _chacha20poly1305_compute_tag(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, const u8* pCipherText, int iLength, u8* pTag)
+{
+   // One time Poly1305 key: first half of the keystream block 0
+   u32 uState[16];
+   u8 uBlock0[64];
+   _chacha20_init_state(uState, pKey, pNonce, 0);
+   _chacha20_block(uState, uBlock0);
+
+   t_encr_poly1305 ctx;
+   _poly1305_init(&ctx, uBlock0);
+   if ( iAADLength > 0 )
+   {
+      _poly1305_update(&ctx, pAAD, iAADLength);
+      _poly1305_pad16(&ctx);
+   }
+   if ( iLength > 0 )
+   {
+      _poly1305_update(&ctx, pCipherText, iLength);
+      _poly1305_pad16(&ctx);
+   }
+   u8 uLengths[16];
+   ENCR_U32TO8_LE(uLengths, (u32)iAADLength);
+   ENCR_U32TO8_LE(uLengths + 4, 0);
+   ENCR_U32TO8_LE(uLengths + 8, (u32)iLength);
+   ENCR_U32TO8_LE(uLengths + 12, 0);
+   _poly1305_update(&ctx, uLengths, 16);
+   _poly1305_finish(&ctx, pTag);
+}
+
+int encr_chacha20poly1305_seal(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, u8* pTag)
+{
+   if ( (NULL == pKey) || (NULL == pNonce) || (NULL == pTag) || (iLength < 0) || (iAADLength < 0) )
+      return 0;
+   if ( (iLength > 0) && (NULL == pData) )
+      return 0;
+   if ( (iAADLength > 0) && (NULL == pAAD) )
+      return 0;
+
+   encr_chacha20_xor(pKey, pNonce, 1, pData, iLength);
+   _chacha20poly1305_compute_tag(pKey, pNonce, pAAD, iAADLength, pData, iLength, pTag);
+   return 1;
+}
+
+int encr_chacha20poly1305_open(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, const u8* pTag)
+{
+   if ( (NULL == pKey) || (NULL == pNonce) || (NULL == pTag) || (iLength < 0) || (iAADLength < 0) )
+      return 0;
+   if ( (iLength > 0) && (NULL == pData) )
+      return 0;
+   if ( (iAADLength > 0) && (NULL == pAAD) )
+      return 0;
+
+   u8 uTag[ENCR_AEAD_TAG_LENGTH];
+   _chacha20poly1305_compute_tag(pKey, pNonce, pAAD, iAADLength, pData, iLength, uTag);
+   u8 uDiff = 0;
+   for( int i=0; i<ENCR_AEAD_TAG_LENGTH; i++ )
+      uDiff |= uTag[i] ^ pTag[i];
+   if ( 0 != uDiff )
+      return 0;
+
+   encr_chacha20_xor(pKey, pNonce, 1, pData, iLength);
+   return 1;
+}
+
+static void _encr_aead_new_nonce_salt()
+{
+   u32 uSalt = 0;
+   FILE* fd = fopen("/dev/urandom", "rb");
+   if ( NULL != fd )
+   {
+      if ( 1 != fread(&uSalt, sizeof(u32), 1, fd) )
+         uSalt = 0;
+      fclose(fd);
+   }
+   if ( 0 == uSalt )
+      uSalt = get_current_timestamp_micros() ^ ((u32)getpid() << 16) ^ (u32)rand();
+   s_uAEADNonceSalt = uSalt;
+   s_uAEADNonceCounter = 0;
+}
+
+// Key = HChaCha20 chained over the pass phrase (16 bytes at a time), then over its length.
+// Not a password hash: the pass phrase is required to be long (see the controller encryption menu).
+
+static void _encr_aead_derive_key()
+{
+   static const char s_szKeyLabel[ENCR_AEAD_KEY_LENGTH] = "RubyFPV radio link AEAD key v1";
+   u8 uKey[ENCR_AEAD_KEY_LENGTH];
+   u8 uBlock[16];
+   memcpy(uKey, s_szKeyLabel, ENCR_AEAD_KEY_LENGTH);
+
+   for( int iPos=0; iPos<(int)s_eppl; iPos += 16 )
+   {
+      memset(uBlock, 0, sizeof(uBlock));
+      int iCount = (int)s_eppl - iPos;
+      if ( iCount > 16 )
+         iCount = 16;
+      memcpy(uBlock, s_epp + iPos, iCount);
+      _hchacha20(uKey, uBlock, uKey);
+   }
+   memset(uBlock, 0xFF, sizeof(uBlock));
+   uBlock[0] = s_eppl;
+   _hchacha20(uKey, uBlock, uKey);
+
+   memcpy(s_uAEADKey, uKey, ENCR_AEAD_KEY_LENGTH);
+   memset(uKey, 0, sizeof(uKey));
+   s_iAEADKeyValid = (s_eppl > 0)?1:0;
+   if ( s_iAEADKeyValid && (0 == s_uAEADNonceSalt) )
+      _encr_aead_new_nonce_salt();
+}
+
+static void _encr_aead_clear_key()
+{
+   memset(s_uAEADKey, 0, sizeof(s_uAEADKey));
+   s_iAEADKeyValid = 0;
+}
+
+int hppa()
+{
+   return s_iAEADKeyValid;
+}
+
+int eppa(const u8* pAAD, int iAADLength, u8* pData, int len, u32 uNonceSeed, u8* pTrailer)
+{
+   if ( (NULL == pData) || (len < 0) || (NULL == pTrailer) )
+      return 0;
+   if ( ! s_iAEADKeyValid )
+      return 0;
+
+   // Nonce: 32 bits salt (random, per process) + 32 bits packets counter, both sent in clear, + the caller seed (not sent)
+   u32 uCounter = __sync_fetch_and_add(&s_uAEADNonceCounter, 1);
+   if ( uCounter == 0xFFFFFFFF )
+      _encr_aead_new_nonce_salt();
+
+   u8 uNonce[12];
+   ENCR_U32TO8_LE(uNonce, s_uAEADNonceSalt);
+   ENCR_U32TO8_LE(uNonce + 4, uCounter);
+   ENCR_U32TO8_LE(uNonce + 8, uNonceSeed);
+   memcpy(pTrailer, uNonce, ENCR_AEAD_NONCE_LENGTH);
+   return encr_chacha20poly1305_seal(s_uAEADKey, uNonce, pAAD, iAADLength, pData, len, pTrailer + ENCR_AEAD_NONCE_LENGTH);
+}
+
+int dppa(const u8* pAAD, int iAADLength, u8* pData, int len, u32 uNonceSeed, const u8* pTrailer)
+{
+   if ( (NULL == pData) || (len < 0) || (NULL == pTrailer) )
+      return 0;
+   if ( ! s_iAEADKeyValid )
+      return 0;
+
+   u8 uNonce[12];
+   memcpy(uNonce, pTrailer, ENCR_AEAD_NONCE_LENGTH);
+   ENCR_U32TO8_LE(uNonce + 8, uNonceSeed);
+   return encr_chacha20poly1305_open(s_uAEADKey, uNonce, pAAD, iAADLength, pData, len, pTrailer + ENCR_AEAD_NONCE_LENGTH);
+}
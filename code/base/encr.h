@@ -6,6 +6,16 @@
 
 #define MAX_PASS_LENGTH 64
 
+#define ENCR_AEAD_KEY_LENGTH 32
+#define ENCR_AEAD_NONCE_LENGTH 8
+#define ENCR_AEAD_TAG_LENGTH 16
+#define ENCR_AEAD_OVERHEAD (ENCR_AEAD_NONCE_LENGTH + ENCR_AEAD_TAG_LENGTH)
+
+#define ENCR_CHACHA20_IMPL_AUTO 0
+#define ENCR_CHACHA20_IMPL_PORTABLE 1
+#define ENCR_CHACHA20_IMPL_SIMD 2 // SSE2 or NEON, 4 blocks at once
+#define ENCR_CHACHA20_IMPL_COUNT 3
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,6 +24,8 @@ extern "C" {
 // Load and saves pass phrases
 int lpp(char* szOutputBuffer, int maxLength);
 int spp(char* szBuffer);
+// Uses the pass phrase without saving it
+int upp(char* szBuffer);
 
 void rpp();
 u8* gpp(int* pLen);
@@ -22,6 +34,25 @@ int hpp();
 int epp(u8* pData, int len);
 int dpp(u8* pData, int len);
 
+// Authenticated encryption (ChaCha20-Poly1305, RFC 8439), keyed from the pass phrase.
+// Each encrypted buffer gets a trailer: explicit nonce (ENCR_AEAD_NONCE_LENGTH) + tag (ENCR_AEAD_TAG_LENGTH).
+// The caller nonce seed is part of the nonce but is not sent (it must be known by the receiver, i.e. from the packet header).
+// dppa verifies the tag before decrypting; returns 0 (data untouched) if the tag does not match.
+int hppa();
+int eppa(const u8* pAAD, int iAADLength, u8* pData, int len, u32 uNonceSeed, u8* pTrailer);
+int dppa(const u8* pAAD, int iAADLength, u8* pData, int len, u32 uNonceSeed, const u8* pTrailer);
+
+// Primitives, exposed for tests and benchmarks
+void encr_chacha20_xor(const u8* pKey, const u8* pNonce, u32 uCounter, u8* pData, int iLength);
+void encr_poly1305(const u8* pKey, const u8* pData, int iLength, u8* pTag);
+int encr_chacha20poly1305_seal(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, u8* pTag);
+int encr_chacha20poly1305_open(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, const u8* pTag);
+
+int encr_chacha20_is_implementation_supported(int iImplementation);
+void encr_chacha20_select_implementation(int iImplementation);
+int encr_chacha20_get_implementation();
+const char* encr_chacha20_get_implementation_name(int iImplementation);
+
 #ifdef __cplusplus
 }  
 #endif 
\ No newline at end of file
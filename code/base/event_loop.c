@@ -0,0 +1,368 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "base.h"
+#include "event_loop.h"
+
+void latency_histogram_reset(type_latency_histogram* pHistogram)
+{
+   if ( NULL != pHistogram )
+      memset(pHistogram, 0, sizeof(type_latency_histogram));
+}
+
+void latency_histogram_add(type_latency_histogram* pHistogram, u32 uMicros)
+{
+   if ( NULL == pHistogram )
+      return;
+   int iBucket = 0;
+   u32 uLimit = 16;
+   while ( (iBucket < LATENCY_HISTOGRAM_BUCKETS-1) && (uMicros >= uLimit) )
+   {
+      iBucket++;
+      uLimit <<= 1;
+   }
+   pHistogram->uBuckets[iBucket]++;
+   pHistogram->uCount++;
+   pHistogram->uTotalMicros += uMicros;
+   if ( uMicros > pHistogram->uMaxMicros )
+      pHistogram->uMaxMicros = uMicros;
+}
+
+u32 latency_histogram_get_percentile(type_latency_histogram* pHistogram, int iPercent)
+{
+   if ( (NULL == pHistogram) || (0 == pHistogram->uCount) )
+      return 0;
+   u32 uTarget = (u32)(((u64)pHistogram->uCount * (u64)iPercent + 99) / 100);
+   u32 uSum = 0;
+   for( int i=0; i<LATENCY_HISTOGRAM_BUCKETS-1; i++ )
+   {
+      uSum += pHistogram->uBuckets[i];
+      if ( uSum >= uTarget )
+         return ((u32)16) << i;
+   }
+   return pHistogram->uMaxMicros;
+}
+
+void latency_histogram_log(type_latency_histogram* pHistogram, const char* szName)
+{
+   if ( (NULL == pHistogram) || (0 == pHistogram->uCount) )
+      return;
+   char szBuckets[256];
+   szBuckets[0] = 0;
+   for( int i=0; i<LATENCY_HISTOGRAM_BUCKETS; i++ )
+   {
+      char szTmp[24];
+      sprintf(szTmp, "%s%u", (0 == i)?"":" ", pHistogram->uBuckets[i]);
+      strcat(szBuckets, szTmp);
+   }
+   log_line("[Latency] %s: %u samples, avg %u us, p50 < %u us, p99 < %u us, max %u us, buckets (16us..): %s",
+      szName, pHistogram->uCount, (u32)(pHistogram->uTotalMicros/pHistogram->uCount),
+      latency_histogram_get_percentile(pHistogram, 50), latency_histogram_get_percentile(pHistogram, 99),
+      pHistogram->uMaxMicros, szBuckets);
+}
+
+int event_loop_init(type_event_loop* pLoop)
+{
+   if ( NULL == pLoop )
+      return 0;
+   memset(pLoop, 0, sizeof(type_event_loop));
+   pLoop->iCurrentSource = -1;
+   pLoop->iEpollFd = epoll_create1(EPOLL_CLOEXEC);
+   if ( pLoop->iEpollFd < 0 )
+   {
+      log_softerror_and_alarm("[EventLoop] Failed to create epoll set, error: %d (%s)", errno, strerror(errno));
+      return 0;
+   }
+   return 1;
+}
+
+void event_loop_uninit(type_event_loop* pLoop)
+{
+   if ( NULL == pLoop )
+      return;
+   for( int i=0; i<pLoop->iCountSources; i++ )
+   {
+      if ( pLoop->sources[i].iIsTimer && (pLoop->sources[i].iFd >= 0) )
+         close(pLoop->sources[i].iFd);
+      pLoop->sources[i].iFd = -1;
+   }
+   pLoop->iCountSources = 0;
+   if ( pLoop->iEpollFd >= 0 )
+      close(pLoop->iEpollFd);
+   pLoop->iEpollFd = -1;
+}
+
+static int _event_loop_add_source(type_event_loop* pLoop, const char* szName, int iFd, int iIsTimer, int iPriority, u32 uFlags, event_loop_callback pCallback, void* pContext)
+{
+   if ( (NULL == pLoop) || (pLoop->iEpollFd < 0) || (NULL == pCallback) )
+      return -1;
+   if ( pLoop->iCountSources >= EVENT_LOOP_MAX_SOURCES )
+   {
+      log_softerror_and_alarm("[EventLoop] Too many sources, can't add %s.", szName);
+      return -1;
+   }
+
+   int iIndex = pLoop->iCountSources;
+   type_event_loop_source* pSource = &pLoop->sources[iIndex];
+   memset(pSource, 0, sizeof(type_event_loop_source));
+   strncpy(pSource->szName, (NULL != szName)?szName:"", sizeof(pSource->szName)-1);
+   pSource->iFd = iFd;
+   pSource->iIsTimer = iIsTimer;
+   pSource->iPriority = iPriority;
+   pSource->uFlags = uFlags;
+   pSource->pCallback = pCallback;
+   pSource->pContext = pContext;
+
+   if ( iFd >= 0 )
+   {
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.u32 = (u32)iIndex;
+      if ( 0 != epoll_ctl(pLoop->iEpollFd, EPOLL_CTL_ADD, iFd, &event) )
+      {
+         log_softerror_and_alarm("[EventLoop] Failed to add source %s (fd %d), error: %d (%s)", pSource->szName, iFd, errno, strerror(errno));
+         return -1;
+      }
+   }
+   pLoop->iCountSources++;
+   log_line("[EventLoop] Added source %s (fd %d, priority %d%s).", pSource->szName, iFd, iPriority, iIsTimer?", timer":"");
+   return iIndex;
+}
+
+int event_loop_add_fd(type_event_loop* pLoop, const char* szName, int iFd, int iPriority, u32 uFlags, event_loop_callback pCallback, void* pContext)
+{
+   return _event_loop_add_source(pLoop, szName, iFd, 0, iPriority, uFlags, pCallback, pContext);
+}
+
+int event_loop_set_fd(type_event_loop* pLoop, int iSourceIndex, int iFd)
+{
+   if ( (NULL == pLoop) || (iSourceIndex < 0) || (iSourceIndex >= pLoop->iCountSources) )
+      return 0;
+   type_event_loop_source* pSource = &pLoop->sources[iSourceIndex];
+   if ( pSource->iIsTimer )
+      return 0;
+
+   struct epoll_event event;
+   memset(&event, 0, sizeof(event));
+   event.events = EPOLLIN;
+   event.data.u32 = (u32)iSourceIndex;
+
+   // Same fd: it could have been closed (that removes it from the epoll set) and reopened with the same number
+   if ( (iFd >= 0) && (iFd == pSource->iFd) )
+   {
+      if ( 0 == epoll_ctl(pLoop->iEpollFd, EPOLL_CTL_MOD, iFd, &event) )
+         return 1;
+      if ( ENOENT != errno )
+         return 0;
+   }
+   else if ( pSource->iFd >= 0 )
+      epoll_ctl(pLoop->iEpollFd, EPOLL_CTL_DEL, pSource->iFd, NULL);
+
+   if ( iFd != pSource->iFd )
+      log_line("[EventLoop] Source %s fd changed from %d to %d.", pSource->szName, pSource->iFd, iFd);
+   pSource->iFd = iFd;
+   if ( iFd < 0 )
+      return 1;
+   if ( 0 != epoll_ctl(pLoop->iEpollFd, EPOLL_CTL_ADD, iFd, &event) )
+   {
+      log_softerror_and_alarm("[EventLoop] Failed to add source %s (fd %d), error: %d (%s)", pSource->szName, iFd, errno, strerror(errno));
+      pSource->iFd = -1;
+      return 0;
+   }
+   return 1;
+}
+
+int event_loop_add_timer(type_event_loop* pLoop, const char* szName, u32 uIntervalMicros, int iPriority, event_loop_callback pCallback, void* pContext)
+{
+   int iFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if ( iFd < 0 )
+   {
+      log_softerror_and_alarm("[EventLoop] Failed to create timer %s, error: %d (%s)", szName, errno, strerror(errno));
+      return -1;
+   }
+   int iIndex = _event_loop_add_source(pLoop, szName, iFd, 1, iPriority, 0, pCallback, pContext);
+   if ( iIndex < 0 )
+   {
+      close(iFd);
+      return -1;
+   }
+   if ( ! event_loop_set_timer_interval(pLoop, iIndex, uIntervalMicros) )
+   {
+      epoll_ctl(pLoop->iEpollFd, EPOLL_CTL_DEL, iFd, NULL);
+      close(iFd);
+      pLoop->iCountSources--;
+      return -1;
+   }
+   return iIndex;
+}
+
+int event_loop_set_timer_interval(type_event_loop* pLoop, int iSourceIndex, u32 uIntervalMicros)
+{
+   if ( (NULL == pLoop) || (iSourceIndex < 0) || (iSourceIndex >= pLoop->iCountSources) )
+      return 0;
+   type_event_loop_source* pSource = &pLoop->sources[iSourceIndex];
+   if ( ! pSource->iIsTimer )
+      return 0;
+   if ( uIntervalMicros < 100 )
+      uIntervalMicros = 100;
+
+   struct itimerspec timerSpec;
+   timerSpec.it_interval.tv_sec = uIntervalMicros / 1000000;
+   timerSpec.it_interval.tv_nsec = (uIntervalMicros % 1000000) * 1000;
+   timerSpec.it_value = timerSpec.it_interval;
+   pSource->uIntervalMicros = uIntervalMicros;
+   pSource->uTimeNextExpireMicros = get_current_timestamp_micros() + uIntervalMicros;
+   if ( 0 != timerfd_settime(pSource->iFd, 0, &timerSpec, NULL) )
+   {
+      log_softerror_and_alarm("[EventLoop] Failed to set timer %s interval, error: %d (%s)", pSource->szName, errno, strerror(errno));
+      return 0;
+   }
+   return 1;
+}
+
+int event_loop_run_once(type_event_loop* pLoop, int iTimeoutMs)
+{
+   if ( (NULL == pLoop) || (pLoop->iEpollFd < 0) )
+      return -1;
+
+   struct epoll_event events[EVENT_LOOP_MAX_SOURCES];
+   int iCount = epoll_wait(pLoop->iEpollFd, events, EVENT_LOOP_MAX_SOURCES, iTimeoutMs);
+   if ( iCount < 0 )
+   {
+      if ( EINTR == errno )
+         return 0;
+      log_softerror_and_alarm("[EventLoop] Failed to wait for events, error: %d (%s)", errno, strerror(errno));
+      return -1;
+   }
+   if ( 0 == iCount )
+      return 0;
+
+   pLoop->uCountWakeups++;
+   u32 uTimeReady = get_current_timestamp_micros();
+   pLoop->uTimeLastWakeupMicros = uTimeReady;
+
+   // Dispatch in priority order (few sources: a simple insertion sort is enough)
+   int iReady[EVENT_LOOP_MAX_SOURCES];
+   for( int i=0; i<iCount; i++ )
+   {
+      int iIndex = (int)events[i].data.u32;
+      int k = i;
+      while ( (k > 0) && (pLoop->sources[iReady[k-1]].iPriority > pLoop->sources[iIndex].iPriority) )
+      {
+         iReady[k] = iReady[k-1];
+         k--;
+      }
+      iReady[k] = iIndex;
+   }
+
+   for( int i=0; i<iCount; i++ )
+   {
+      type_event_loop_source* pSource = &pLoop->sources[iReady[i]];
+      u32 uTimeNow = get_current_timestamp_micros();
+      if ( pSource->iIsTimer )
+      {
+         u64 uExpirations = event_loop_drain_fd(pSource->iFd);
+         if ( 0 == uExpirations )
+            continue;
+         // Time since the latest expiration
+         u32 uLatest = pSource->uTimeNextExpireMicros + (u32)(uExpirations-1) * pSource->uIntervalMicros;
+         if ( (int)(uTimeNow - uLatest) >= 0 )
+            latency_histogram_add(&pSource->latency, uTimeNow - uLatest);
+         pSource->uTimeNextExpireMicros = uLatest + pSource->uIntervalMicros;
+         // Fell behind by more than a period? Resync to now
+         if ( (int)(uTimeNow - pSource->uTimeNextExpireMicros) > 0 )
+            pSource->uTimeNextExpireMicros = uTimeNow + pSource->uIntervalMicros;
+      }
+      else if ( ! (pSource->uFlags & EVENT_LOOP_FLAG_CUSTOM_LATENCY) )
+         latency_histogram_add(&pSource->latency, uTimeNow - uTimeReady);
+
+      pSource->uDispatchCount++;
+      pLoop->iCurrentSource = iReady[i];
+      pSource->pCallback(pSource->pContext);
+      pLoop->iCurrentSource = -1;
+
+      u32 uRunMicros = get_current_timestamp_micros() - uTimeNow;
+      pSource->uTotalRunMicros += uRunMicros;
+      if ( uRunMicros > pSource->uMaxRunMicros )
+         pSource->uMaxRunMicros = uRunMicros;
+   }
+   return iCount;
+}
+
+void event_loop_add_latency_sample(type_event_loop* pLoop, u32 uMicros)
+{
+   if ( (NULL == pLoop) || (pLoop->iCurrentSource < 0) )
+      return;
+   latency_histogram_add(&pLoop->sources[pLoop->iCurrentSource].latency, uMicros);
+}
+
+void event_loop_log_stats(type_event_loop* pLoop)
+{
+   if ( NULL == pLoop )
+      return;
+   log_line("[EventLoop] %u wakeups, %d sources:", pLoop->uCountWakeups, pLoop->iCountSources);
+   for( int i=0; i<pLoop->iCountSources; i++ )
+   {
+      type_event_loop_source* pSource = &pLoop->sources[i];
+      log_line("[EventLoop] Source %s: %u dispatches, run time avg %u us, max %u us.", pSource->szName, pSource->uDispatchCount,
+         (pSource->uDispatchCount > 0)?(u32)(pSource->uTotalRunMicros/pSource->uDispatchCount):0, pSource->uMaxRunMicros);
+      latency_histogram_log(&pSource->latency, pSource->szName);
+   }
+}
+
+void event_loop_reset_stats(type_event_loop* pLoop)
+{
+   if ( NULL == pLoop )
+      return;
+   pLoop->uCountWakeups = 0;
+   for( int i=0; i<pLoop->iCountSources; i++ )
+   {
+      pLoop->sources[i].uDispatchCount = 0;
+      pLoop->sources[i].uMaxRunMicros = 0;
+      pLoop->sources[i].uTotalRunMicros = 0;
+      latency_histogram_reset(&pLoop->sources[i].latency);
+   }
+}
+
+u64 event_loop_drain_fd(int iFd)
+{
+   u64 uCount = 0;
+   if ( iFd < 0 )
+      return 0;
+   if ( sizeof(uCount) != read(iFd, &uCount, sizeof(uCount)) )
+      return 0;
+   return uCount;
+}
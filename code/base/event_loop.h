@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../base/base.h"
+
+// Event loop (reactor) for the router processes: one epoll set of sources, each with a callback.
+// Sources are file descriptors (sockets, pipes, eventfds signaled by other threads) and timers (timerfd).
+// When more sources are ready at once, they are dispatched in priority order
+// (EVENT_LOOP_PRIORITY_HIGHEST first), so urgent work never waits behind housekeeping.
+//
+// Each source has a dispatch latency histogram:
+//    timers: time between the timer expiration and the callback start;
+//    fd sources: time between epoll reporting it ready and the callback start,
+//    or, for sources added with EVENT_LOOP_FLAG_CUSTOM_LATENCY, the samples the callback adds
+//    itself with event_loop_add_latency_sample() (i.e. packet enqueue time to dispatch).
+
+#define EVENT_LOOP_MAX_SOURCES 16
+#define EVENT_LOOP_PRIORITY_HIGHEST 0
+#define EVENT_LOOP_PRIORITY_HIGH 1
+#define EVENT_LOOP_PRIORITY_NORMAL 2
+#define EVENT_LOOP_PRIORITY_LOW 3
+
+#define EVENT_LOOP_FLAG_CUSTOM_LATENCY ((u32)0x01)
+
+// Buckets: [0] < 16 us, [i] < 16 << i us, last one: everything above
+#define LATENCY_HISTOGRAM_BUCKETS 14
+
+typedef struct
+{
+   u32 uBuckets[LATENCY_HISTOGRAM_BUCKETS];
+   u32 uCount;
+   u64 uTotalMicros;
+   u32 uMaxMicros;
+} type_latency_histogram;
+
+typedef void (*event_loop_callback)(void* pContext);
+
+typedef struct
+{
+   char szName[24];
+   int iFd;
+   int iIsTimer;
+   int iPriority;
+   u32 uFlags;
+   u32 uIntervalMicros;
+   u32 uTimeNextExpireMicros;
+   event_loop_callback pCallback;
+   void* pContext;
+   u32 uDispatchCount;
+   u32 uMaxRunMicros;
+   u64 uTotalRunMicros;
+   type_latency_histogram latency;
+} type_event_loop_source;
+
+typedef struct
+{
+   int iEpollFd;
+   int iCountSources;
+   type_event_loop_source sources[EVENT_LOOP_MAX_SOURCES];
+   int iCurrentSource; // source being dispatched, -1 outside callbacks
+   u32 uCountWakeups;
+   u32 uTimeLastWakeupMicros;
+} type_event_loop;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void latency_histogram_reset(type_latency_histogram* pHistogram);
+void latency_histogram_add(type_latency_histogram* pHistogram, u32 uMicros);
+// Returns the upper bound of the bucket that holds the given percentile, in microseconds
+u32 latency_histogram_get_percentile(type_latency_histogram* pHistogram, int iPercent);
+void latency_histogram_log(type_latency_histogram* pHistogram, const char* szName);
+
+// All return 1 on success, 0 on failure
+int event_loop_init(type_event_loop* pLoop);
+void event_loop_uninit(type_event_loop* pLoop);
+
+// Returns the source index or -1 on failure. The fd stays owned by the caller; it's not closed by the event loop.
+// iFd can be -1: the source stays inactive until an fd is set with event_loop_set_fd().
+int event_loop_add_fd(type_event_loop* pLoop, const char* szName, int iFd, int iPriority, u32 uFlags, event_loop_callback pCallback, void* pContext);
+// Changes the fd of a source (-1 to disable it). Setting the same fd again registers it again
+// (i.e. if it was closed and reopened with the same number).
+int event_loop_set_fd(type_event_loop* pLoop, int iSourceIndex, int iFd);
+int event_loop_add_timer(type_event_loop* pLoop, const char* szName, u32 uIntervalMicros, int iPriority, event_loop_callback pCallback, void* pContext);
+int event_loop_set_timer_interval(type_event_loop* pLoop, int iSourceIndex, u32 uIntervalMicros);
+
+// Waits for ready sources (at most iTimeoutMs, -1 for no timeout) and dispatches them.
+// Returns the number of sources dispatched, or -1 on error.
+int event_loop_run_once(type_event_loop* pLoop, int iTimeoutMs);
+
+// To be called from a callback of a source added with EVENT_LOOP_FLAG_CUSTOM_LATENCY
+void event_loop_add_latency_sample(type_event_loop* pLoop, u32 uMicros);
+void event_loop_log_stats(type_event_loop* pLoop);
+void event_loop_reset_stats(type_event_loop* pLoop);
+
+// Reads and discards the pending count of an eventfd/timerfd. Returns the count read.
+u64 event_loop_drain_fd(int iFd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -44,6 +44,8 @@
 #define MODEL_ENC_FLAG_ENC_DATA   ((u32)(((u32)0x01)<<1))
 #define MODEL_ENC_FLAG_ENC_VIDEO  ((u32)(((u32)0x01)<<2))
 #define MODEL_ENC_FLAG_ENC_ALL    ((u32)(((u32)0x01)<<3))
+// Use ChaCha20-Poly1305 (authenticated) instead of the XOR encryption for the streams selected above
+#define MODEL_ENC_FLAG_AEAD       ((u32)(((u32)0x01)<<4))
 
 // raspivid commands
 #define RASPIVID_COMMAND_ID_BRIGHTNESS 1
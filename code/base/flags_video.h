@@ -45,6 +45,7 @@
 #define VIDEO_STATUS_FLAGS2_HAS_DEBUG_TIMESTAMPS ((u32)(((u32)0x01)<<8))
 #define VIDEO_STATUS_FLAGS2_IS_IFRAME ((u32)(((u32)0x01)<<9))
 #define VIDEO_STATUS_FLAGS2_IS_ON_LOWER_BITRATE ((u32)(((u32)0x01)<<10))
+#define VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK ((u32)(((u32)0x01)<<11))
 
 
 // Highest bit in video bitrate field tells if vehicle adjusted the videobitrate
@@ -58,3 +59,5 @@
 #define VIDEO_FLAG_RETRANSMISSIONS_FAST      ((u32)(((u32)0x01)<<3))
 #define VIDEO_FLAG_GENERATE_H265             ((u32)(((u32)0x01)<<4))
 #define VIDEO_FLAG_NEW_ADAPTIVE_ALGORITHM    ((u32)(((u32)0x01)<<5))
+#define VIDEO_FLAG_MULTITHREADED_PIPELINE    ((u32)(((u32)0x01)<<6))
+#define VIDEO_FLAG_FRAME_ALIGNED_BLOCKS      ((u32)(((u32)0x01)<<7))
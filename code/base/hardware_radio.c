@@ -47,6 +47,7 @@
 #include "config.h"
 #include "hardware.h"
 #include "hardware_radio.h"
+#include "hardware_radio_virtual.h"
 #include "hardware_serial.h"
 #include "hardware_radio_sik.h"
 #include "hw_procs.h"
@@ -91,6 +92,10 @@ void hardware_log_radio_info()
 
 void hardware_save_radio_info()
 {
+   // Virtual radio interfaces are recreated by each process on enumeration; keep the info of the real radios
+   if ( hardware_radio_virtual_is_enabled() )
+      return;
+
    char szFile[MAX_FILE_PATH_SIZE];
    strcpy(szFile, FOLDER_CONFIG);
    strcat(szFile, FILE_CONFIG_CURRENT_RADIO_HW_CONFIG);
@@ -975,6 +980,17 @@ int hardware_enumerate_radio_interfaces_step(int iStep)
    log_line("=================================================================");
    log_line("[HardwareRadio] Enumerating radios (step %d)...", iStep);
 
+   // Virtual radio interfaces replace all the hardware ones; nothing is saved, so the real radios are enumerated again once disabled
+   if ( hardware_radio_virtual_is_enabled() )
+   {
+      s_iHwRadiosCount = 0;
+      s_iHwRadiosSupportedCount = hardware_radio_virtual_add_interfaces();
+      s_HardwareRadiosEnumeratedOnce = 1;
+      hardware_log_radio_info();
+      log_line("=================================================================");
+      return (s_iHwRadiosCount > 0)?1:0;
+   }
+
    if( iStep == -1 || iStep == 0 )
    {
       char szFile[MAX_FILE_PATH_SIZE];
@@ -1303,12 +1319,22 @@ int hardware_radio_is_wifi_radio(radio_hw_info_t* pRadioInfo)
    if ( pRadioInfo->iRadioType == RADIO_TYPE_RALINK ||
         pRadioInfo->iRadioType == RADIO_TYPE_ATHEROS ||
         pRadioInfo->iRadioType == RADIO_TYPE_REALTEK ||
-        pRadioInfo->iRadioType == RADIO_TYPE_MEDIATEK )
+        pRadioInfo->iRadioType == RADIO_TYPE_MEDIATEK ||
+        pRadioInfo->iRadioType == RADIO_TYPE_VIRTUAL )
       return 1;
 
    return 0;
 }
 
+int hardware_radio_is_virtual_radio(radio_hw_info_t* pRadioInfo)
+{
+   if ( NULL == pRadioInfo )
+      return 0;
+   if ( pRadioInfo->iRadioType == RADIO_TYPE_VIRTUAL )
+      return 1;
+   return 0;
+}
+
 int hardware_radio_is_serial_radio(radio_hw_info_t* pRadioInfo)
 {
    if ( NULL == pRadioInfo )
@@ -13,6 +13,7 @@
 #define RADIO_TYPE_MEDIATEK 4
 #define RADIO_TYPE_SIK 5
 #define RADIO_TYPE_SERIAL 6
+#define RADIO_TYPE_VIRTUAL 7
 
 #define RADIO_HW_DRIVER_ATHEROS 1       // ath9k_htc
 #define RADIO_HW_DRIVER_RALINK 2        // rt2800usb, only 2.4Ghz band
@@ -24,6 +25,7 @@
 #define RADIO_HW_DRIVER_SERIAL_SIK 8
 #define RADIO_HW_DRIVER_SERIAL 9
 #define RADIO_HW_DRIVER_REALTEK_8812EU 10          // 88x2eu
+#define RADIO_HW_DRIVER_VIRTUAL 11                 // simulated link over loopback udp (see hardware_radio_virtual.h)
 
 
 // 0 is generic card model
@@ -46,6 +48,7 @@
 #define CARD_MODEL_SIK_RADIO 100
 #define CARD_MODEL_SERIAL_RADIO 101
 #define CARD_MODEL_SERIAL_RADIO_ELRS 102
+#define CARD_MODEL_VIRTUAL_RADIO 103
 
 
 #define RADIO_HW_SUPPORTED_BAND_23 1
@@ -181,6 +184,7 @@ int hardware_radio_is_wifi_radio(radio_hw_info_t* pRadioInfo);
 int hardware_radio_is_serial_radio(radio_hw_info_t* pRadioInfo);
 int hardware_radio_is_elrs_radio(radio_hw_info_t* pRadioInfo);
 int hardware_radio_is_sik_radio(radio_hw_info_t* pRadioInfo);
+int hardware_radio_is_virtual_radio(radio_hw_info_t* pRadioInfo);
 int hardware_radio_index_is_serial_radio(int iHWInterfaceIndex);
 int hardware_radio_index_is_elrs_radio(int iHWInterfaceIndex);
 int hardware_radio_index_is_sik_radio(int iHWInterfaceIndex);
@@ -0,0 +1,657 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "base.h"
+#include "config.h"
+#include "hardware.h"
+#include "hardware_radio.h"
+#include "hardware_radio_virtual.h"
+
+typedef struct
+{
+   u64 uDueMicros;
+   int iLength;
+   u8 uData[MAX_PACKET_TOTAL_SIZE];
+} type_radio_virtual_frame;
+
+typedef struct
+{
+   int iSocketRead;
+   int iSocketWrite;
+   struct sockaddr_in addrPeer;
+   type_radio_virtual_stats stats;
+
+   // Link simulation on the tx side
+   u32 uRandomState;
+   int iLossBurstActive;
+   u64 uLinkFreeMicros;
+   u64 uLastDueMicros;
+
+   // Delay line, used only if latency, jitter or rate cap are set
+   type_radio_virtual_frame* pQueue;
+   int iQueueHead;
+   int iQueueCount;
+   int iThreadStarted;
+   int iThreadStop;
+   pthread_t pThread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+} type_radio_virtual_state;
+
+static type_radio_virtual_config s_RadioVirtualConfig;
+static int s_iRadioVirtualConfigLoaded = 0;
+static type_radio_virtual_state s_RadioVirtualStates[MAX_RADIO_INTERFACES];
+static int s_iRadioVirtualStatesInitialized = 0;
+
+// Loss model probabilities, in parts per million
+static u32 s_uRadioVirtualLossPPM = 0;
+static u32 s_uRadioVirtualEnterBurstPPM = 0;
+static u32 s_uRadioVirtualExitBurstPPM = 0;
+
+static u64 _radio_virtual_now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static u32 _radio_virtual_random(type_radio_virtual_state* pState)
+{
+   // xorshift32: cheap and the same sequence on every platform for a given seed
+   u32 x = pState->uRandomState;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   pState->uRandomState = x;
+   return x;
+}
+
+static void _radio_virtual_update_loss_model()
+{
+   s_uRadioVirtualLossPPM = 0;
+   s_uRadioVirtualEnterBurstPPM = 0;
+   s_uRadioVirtualExitBurstPPM = 0;
+   if ( s_RadioVirtualConfig.iLossPercent <= 0 )
+      return;
+   if ( s_RadioVirtualConfig.iLossPercent >= 100 )
+   {
+      s_uRadioVirtualLossPPM = 1000000;
+      return;
+   }
+   s_uRadioVirtualLossPPM = s_RadioVirtualConfig.iLossPercent * 10000;
+   if ( s_RadioVirtualConfig.iBurstLength <= 1 )
+      return;
+
+   // Two states (Gilbert) model: all frames are lost while in a burst.
+   // Leaving a burst has probability 1/burst; entering one is chosen so that the average loss is the configured one:
+   // loss = enter / (enter + exit)
+   double fLoss = (double)s_RadioVirtualConfig.iLossPercent / 100.0;
+   double fExit = 1.0 / (double)s_RadioVirtualConfig.iBurstLength;
+   double fEnter = fLoss * fExit / (1.0 - fLoss);
+   if ( fEnter > 1.0 )
+      fEnter = 1.0;
+   s_uRadioVirtualExitBurstPPM = (u32)(fExit * 1000000.0);
+   s_uRadioVirtualEnterBurstPPM = (u32)(fEnter * 1000000.0);
+}
+
+static int _radio_virtual_is_frame_lost(type_radio_virtual_state* pState)
+{
+   if ( 0 == s_uRadioVirtualLossPPM )
+      return 0;
+   if ( s_uRadioVirtualLossPPM >= 1000000 )
+      return 1;
+   u32 uRand = _radio_virtual_random(pState) % 1000000;
+   if ( 0 == s_uRadioVirtualExitBurstPPM )
+      return (uRand < s_uRadioVirtualLossPPM)?1:0;
+
+   if ( pState->iLossBurstActive )
+   {
+      if ( uRand < s_uRadioVirtualExitBurstPPM )
+         pState->iLossBurstActive = 0;
+   }
+   else if ( uRand < s_uRadioVirtualEnterBurstPPM )
+      pState->iLossBurstActive = 1;
+   return pState->iLossBurstActive;
+}
+
+static void _radio_virtual_init_states()
+{
+   if ( s_iRadioVirtualStatesInitialized )
+      return;
+   memset(s_RadioVirtualStates, 0, sizeof(s_RadioVirtualStates));
+   for( int i=0; i<MAX_RADIO_INTERFACES; i++ )
+   {
+      s_RadioVirtualStates[i].iSocketRead = -1;
+      s_RadioVirtualStates[i].iSocketWrite = -1;
+   }
+   s_iRadioVirtualStatesInitialized = 1;
+}
+
+static int _radio_virtual_get_side()
+{
+   if ( s_RadioVirtualConfig.iSide >= 0 )
+      return s_RadioVirtualConfig.iSide;
+   return hardware_is_vehicle()?VIRTUAL_RADIO_SIDE_VEHICLE:VIRTUAL_RADIO_SIDE_STATION;
+}
+
+// Virtual interface N of a side receives on port base+2*N+side and sends to the same interface of the other side
+
+static int _radio_virtual_get_port(int iVirtualIndex, int iSide)
+{
+   return s_RadioVirtualConfig.iBasePort + 2*iVirtualIndex + iSide;
+}
+
+void hardware_radio_virtual_get_default_config(type_radio_virtual_config* pConfig)
+{
+   if ( NULL == pConfig )
+      return;
+   memset(pConfig, 0, sizeof(type_radio_virtual_config));
+   pConfig->iCount = 0;
+   pConfig->iSide = -1;
+   pConfig->iBasePort = VIRTUAL_RADIO_DEFAULT_BASE_PORT;
+   pConfig->iLossPercent = 0;
+   pConfig->iBurstLength = 1;
+   pConfig->uMaxQueueMicros = 100000;
+   pConfig->iDbm = -50;
+   pConfig->uSeed = 1;
+}
+
+int hardware_radio_virtual_parse_config(const char* szConfig, type_radio_virtual_config* pConfig)
+{
+   if ( (NULL == szConfig) || (NULL == pConfig) )
+      return 0;
+
+   char szBuff[256];
+   strncpy(szBuff, szConfig, sizeof(szBuff)-1);
+   szBuff[sizeof(szBuff)-1] = 0;
+
+   char* pSavePtr = NULL;
+   char* pToken = strtok_r(szBuff, ", \t\r\n", &pSavePtr);
+   while ( NULL != pToken )
+   {
+      char* pValue = strchr(pToken, '=');
+      if ( NULL == pValue )
+      {
+         log_softerror_and_alarm("[HardwareRadioVirtual] Invalid config parameter: [%s]", pToken);
+         pToken = strtok_r(NULL, ", \t\r\n", &pSavePtr);
+         continue;
+      }
+      *pValue = 0;
+      pValue++;
+      long lValue = atol(pValue);
+
+      if ( 0 == strcmp(pToken, "count") )
+         pConfig->iCount = (int)lValue;
+      else if ( 0 == strcmp(pToken, "side") )
+      {
+         if ( 0 == strcmp(pValue, "vehicle") )
+            pConfig->iSide = VIRTUAL_RADIO_SIDE_VEHICLE;
+         else if ( (0 == strcmp(pValue, "station")) || (0 == strcmp(pValue, "controller")) )
+            pConfig->iSide = VIRTUAL_RADIO_SIDE_STATION;
+         else
+            log_softerror_and_alarm("[HardwareRadioVirtual] Invalid side: [%s]", pValue);
+      }
+      else if ( 0 == strcmp(pToken, "port") )
+         pConfig->iBasePort = (int)lValue;
+      else if ( 0 == strcmp(pToken, "loss") )
+         pConfig->iLossPercent = (int)lValue;
+      else if ( 0 == strcmp(pToken, "burst") )
+         pConfig->iBurstLength = (int)lValue;
+      else if ( 0 == strcmp(pToken, "latency") )
+         pConfig->uLatencyMicros = (u32)lValue;
+      else if ( 0 == strcmp(pToken, "jitter") )
+         pConfig->uJitterMicros = (u32)lValue;
+      else if ( 0 == strcmp(pToken, "rate") )
+         pConfig->uRateBPS = (u32)lValue;
+      else if ( 0 == strcmp(pToken, "queue") )
+         pConfig->uMaxQueueMicros = (u32)lValue;
+      else if ( 0 == strcmp(pToken, "dbm") )
+         pConfig->iDbm = (int)lValue;
+      else if ( 0 == strcmp(pToken, "seed") )
+         pConfig->uSeed = (u32)lValue;
+      else
+         log_softerror_and_alarm("[HardwareRadioVirtual] Unknown config parameter: [%s]", pToken);
+      pToken = strtok_r(NULL, ", \t\r\n", &pSavePtr);
+   }
+
+   if ( pConfig->iCount < 0 )
+      pConfig->iCount = 0;
+   if ( pConfig->iCount > MAX_RADIO_INTERFACES )
+      pConfig->iCount = MAX_RADIO_INTERFACES;
+   if ( pConfig->iLossPercent < 0 )
+      pConfig->iLossPercent = 0;
+   if ( pConfig->iLossPercent > 100 )
+      pConfig->iLossPercent = 100;
+   if ( pConfig->iBurstLength < 1 )
+      pConfig->iBurstLength = 1;
+   return 1;
+}
+
+void hardware_radio_virtual_set_config(type_radio_virtual_config* pConfig)
+{
+   if ( NULL == pConfig )
+      return;
+   memcpy(&s_RadioVirtualConfig, pConfig, sizeof(type_radio_virtual_config));
+   s_iRadioVirtualConfigLoaded = 1;
+   _radio_virtual_update_loss_model();
+}
+
+static void _radio_virtual_load_config()
+{
+   s_iRadioVirtualConfigLoaded = 1;
+   hardware_radio_virtual_get_default_config(&s_RadioVirtualConfig);
+
+   char szConfig[256];
+   szConfig[0] = 0;
+   char szFile[MAX_FILE_PATH_SIZE];
+   strcpy(szFile, FOLDER_CONFIG);
+   strcat(szFile, FILE_CONFIG_VIRTUAL_RADIO);
+   FILE* fd = fopen(szFile, "r");
+   if ( NULL != fd )
+   {
+      if ( NULL == fgets(szConfig, sizeof(szConfig)-1, fd) )
+         szConfig[0] = 0;
+      fclose(fd);
+   }
+   const char* szEnv = getenv("RUBY_VIRTUAL_RADIO");
+   if ( (NULL != szEnv) && (0 != szEnv[0]) )
+   {
+      strncpy(szConfig, szEnv, sizeof(szConfig)-1);
+      szConfig[sizeof(szConfig)-1] = 0;
+   }
+   if ( 0 == szConfig[0] )
+      return;
+
+   hardware_radio_virtual_parse_config(szConfig, &s_RadioVirtualConfig);
+   _radio_virtual_update_loss_model();
+   log_line("[HardwareRadioVirtual] Config: [%s]", szConfig);
+}
+
+type_radio_virtual_config* hardware_radio_virtual_get_config()
+{
+   if ( ! s_iRadioVirtualConfigLoaded )
+      _radio_virtual_load_config();
+   return &s_RadioVirtualConfig;
+}
+
+int hardware_radio_virtual_is_enabled()
+{
+   return (hardware_radio_virtual_get_config()->iCount > 0)?1:0;
+}
+
+int hardware_radio_virtual_add_interfaces()
+{
+   type_radio_virtual_config* pConfig = hardware_radio_virtual_get_config();
+   int iAdded = 0;
+   for( int i=0; i<pConfig->iCount; i++ )
+   {
+      radio_hw_info_t radioInfo;
+      memset(&radioInfo, 0, sizeof(radio_hw_info_t));
+      radioInfo.phy_index = i;
+      radioInfo.iCardModel = CARD_MODEL_VIRTUAL_RADIO;
+      radioInfo.isSupported = 1;
+      radioInfo.isEnabled = 1;
+      radioInfo.isConfigurable = 1;
+      radioInfo.isTxCapable = 1;
+      radioInfo.isHighCapacityInterface = 1;
+      radioInfo.supportedBands = RADIO_HW_SUPPORTED_BAND_23 | RADIO_HW_SUPPORTED_BAND_24 | RADIO_HW_SUPPORTED_BAND_25 | RADIO_HW_SUPPORTED_BAND_58;
+      sprintf(radioInfo.szName, "vradio%d", i);
+      strcpy(radioInfo.szDescription, "Virtual");
+      strcpy(radioInfo.szDriver, "virtual");
+      sprintf(radioInfo.szMAC, "VRADIO%d", i);
+      snprintf(radioInfo.szUSBPort, sizeof(radioInfo.szUSBPort), "V%d", i);
+      radioInfo.iRadioType = RADIO_TYPE_VIRTUAL;
+      radioInfo.iRadioDriver = RADIO_HW_DRIVER_VIRTUAL;
+      radioInfo.monitor_interface_read.selectable_fd = -1;
+      radioInfo.monitor_interface_write.selectable_fd = -1;
+      if ( ! hardware_add_radio_interface_info(&radioInfo) )
+         break;
+      iAdded++;
+   }
+   log_line("[HardwareRadioVirtual] Added %d virtual radio interfaces (%s side), base port %d, loss: %d%% (burst %d), latency: %u us, jitter: %u us, rate: %u bps",
+      iAdded, (_radio_virtual_get_side() == VIRTUAL_RADIO_SIDE_VEHICLE)?"vehicle":"station",
+      pConfig->iBasePort, pConfig->iLossPercent, pConfig->iBurstLength, pConfig->uLatencyMicros, pConfig->uJitterMicros, pConfig->uRateBPS);
+   return iAdded;
+}
+
+static type_radio_virtual_state* _radio_virtual_get_state(int iInterfaceIndex, int* piVirtualIndex)
+{
+   if ( (iInterfaceIndex < 0) || (iInterfaceIndex >= MAX_RADIO_INTERFACES) )
+      return NULL;
+   radio_hw_info_t* pRadioHWInfo = hardware_get_radio_info(iInterfaceIndex);
+   if ( ! hardware_radio_is_virtual_radio(pRadioHWInfo) )
+      return NULL;
+   _radio_virtual_init_states();
+   if ( NULL != piVirtualIndex )
+      *piVirtualIndex = pRadioHWInfo->phy_index;
+   return &s_RadioVirtualStates[iInterfaceIndex];
+}
+
+int hardware_radio_virtual_open_for_read(int iInterfaceIndex)
+{
+   int iVirtualIndex = 0;
+   type_radio_virtual_state* pState = _radio_virtual_get_state(iInterfaceIndex, &iVirtualIndex);
+   if ( NULL == pState )
+      return -1;
+   if ( pState->iSocketRead >= 0 )
+      return pState->iSocketRead;
+
+   int iPort = _radio_virtual_get_port(iVirtualIndex, _radio_virtual_get_side());
+   pState->iSocketRead = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( pState->iSocketRead < 0 )
+   {
+      log_softerror_and_alarm("[HardwareRadioVirtual] Failed to create rx socket, error: %d (%s)", errno, strerror(errno));
+      return -1;
+   }
+   int iVal = 1;
+   setsockopt(pState->iSocketRead, SOL_SOCKET, SO_REUSEADDR, &iVal, sizeof(iVal));
+   // Roughly what a radio rx queue holds; frames above it are dropped by the kernel, as on a real interface
+   iVal = 1024 * 1024;
+   setsockopt(pState->iSocketRead, SOL_SOCKET, SO_RCVBUF, &iVal, sizeof(iVal));
+
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port = htons(iPort);
+   if ( 0 != bind(pState->iSocketRead, (struct sockaddr*)&addr, sizeof(addr)) )
+   {
+      log_softerror_and_alarm("[HardwareRadioVirtual] Failed to bind rx socket to port %d, error: %d (%s)", iPort, errno, strerror(errno));
+      close(pState->iSocketRead);
+      pState->iSocketRead = -1;
+      return -1;
+   }
+   fcntl(pState->iSocketRead, F_SETFL, fcntl(pState->iSocketRead, F_GETFL, 0) | O_NONBLOCK);
+
+   log_line("[HardwareRadioVirtual] Opened virtual radio %d for read on port %d, fd=%d", iVirtualIndex, iPort, pState->iSocketRead);
+   return pState->iSocketRead;
+}
+
+void hardware_radio_virtual_close_for_read(int iInterfaceIndex)
+{
+   type_radio_virtual_state* pState = _radio_virtual_get_state(iInterfaceIndex, NULL);
+   if ( (NULL == pState) || (pState->iSocketRead < 0) )
+      return;
+   close(pState->iSocketRead);
+   pState->iSocketRead = -1;
+}
+
+static int _radio_virtual_send(type_radio_virtual_state* pState, u8* pData, int iLength)
+{
+   int iRes = sendto(pState->iSocketWrite, pData, iLength, 0, (struct sockaddr*)&pState->addrPeer, sizeof(pState->addrPeer));
+   if ( iRes != iLength )
+      return 0;
+   pState->stats.uFramesDelivered++;
+   pState->stats.uBytesDelivered += iLength;
+   return 1;
+}
+
+static void* _thread_radio_virtual_delay_line(void *argument)
+{
+   type_radio_virtual_state* pState = (type_radio_virtual_state*) argument;
+
+   pthread_mutex_lock(&pState->mutex);
+   while ( ! pState->iThreadStop )
+   {
+      if ( 0 == pState->iQueueCount )
+      {
+         pthread_cond_wait(&pState->cond, &pState->mutex);
+         continue;
+      }
+      type_radio_virtual_frame* pFrame = &pState->pQueue[pState->iQueueHead];
+      u64 uNow = _radio_virtual_now_micros();
+      if ( pFrame->uDueMicros > uNow )
+      {
+         struct timespec ts;
+         ts.tv_sec = (time_t)(pFrame->uDueMicros / 1000000LL);
+         ts.tv_nsec = (long)(pFrame->uDueMicros % 1000000LL) * 1000L;
+         pthread_cond_timedwait(&pState->cond, &pState->mutex, &ts);
+         continue;
+      }
+      // The frame slot is not reused while it is the queue head, so it can be sent without the lock
+      pthread_mutex_unlock(&pState->mutex);
+      int iSent = sendto(pState->iSocketWrite, pFrame->uData, pFrame->iLength, 0, (struct sockaddr*)&pState->addrPeer, sizeof(pState->addrPeer));
+      pthread_mutex_lock(&pState->mutex);
+      if ( iSent == pFrame->iLength )
+      {
+         pState->stats.uFramesDelivered++;
+         pState->stats.uBytesDelivered += pFrame->iLength;
+      }
+      pState->iQueueHead = (pState->iQueueHead + 1) % VIRTUAL_RADIO_MAX_QUEUED_FRAMES;
+      pState->iQueueCount--;
+   }
+   pthread_mutex_unlock(&pState->mutex);
+   return NULL;
+}
+
+int hardware_radio_virtual_open_for_write(int iInterfaceIndex)
+{
+   int iVirtualIndex = 0;
+   type_radio_virtual_state* pState = _radio_virtual_get_state(iInterfaceIndex, &iVirtualIndex);
+   if ( NULL == pState )
+      return -1;
+   if ( pState->iSocketWrite >= 0 )
+      return pState->iSocketWrite;
+
+   int iSide = _radio_virtual_get_side();
+   int iPort = _radio_virtual_get_port(iVirtualIndex, 1-iSide);
+
+   // Not connected: a peer that is not running yet must not make the sends fail (ECONNREFUSED)
+   pState->iSocketWrite = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( pState->iSocketWrite < 0 )
+   {
+      log_softerror_and_alarm("[HardwareRadioVirtual] Failed to create tx socket, error: %d (%s)", errno, strerror(errno));
+      return -1;
+   }
+   memset(&pState->addrPeer, 0, sizeof(pState->addrPeer));
+   pState->addrPeer.sin_family = AF_INET;
+   pState->addrPeer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   pState->addrPeer.sin_port = htons(iPort);
+
+   memset(&pState->stats, 0, sizeof(type_radio_virtual_stats));
+   pState->uRandomState = s_RadioVirtualConfig.uSeed * 2654435761u + (u32)(iVirtualIndex*2 + iSide) * 40503u + 1;
+   pState->iLossBurstActive = 0;
+   pState->uLinkFreeMicros = 0;
+   pState->uLastDueMicros = 0;
+   pState->iQueueHead = 0;
+   pState->iQueueCount = 0;
+   pState->iThreadStarted = 0;
+   pState->iThreadStop = 0;
+
+   if ( (0 != s_RadioVirtualConfig.uLatencyMicros) || (0 != s_RadioVirtualConfig.uJitterMicros) || (0 != s_RadioVirtualConfig.uRateBPS) )
+   {
+      pState->pQueue = (type_radio_virtual_frame*) malloc(VIRTUAL_RADIO_MAX_QUEUED_FRAMES * sizeof(type_radio_virtual_frame));
+      pthread_condattr_t attrCond;
+      pthread_condattr_init(&attrCond);
+      pthread_condattr_setclock(&attrCond, CLOCK_MONOTONIC);
+      pthread_cond_init(&pState->cond, &attrCond);
+      pthread_condattr_destroy(&attrCond);
+      pthread_mutex_init(&pState->mutex, NULL);
+      if ( (NULL == pState->pQueue) || (0 != pthread_create(&pState->pThread, NULL, &_thread_radio_virtual_delay_line, pState)) )
+      {
+         log_softerror_and_alarm("[HardwareRadioVirtual] Failed to create the delay line for virtual radio %d. Latency and rate cap are disabled.", iVirtualIndex);
+         if ( NULL != pState->pQueue )
+            free(pState->pQueue);
+         pState->pQueue = NULL;
+         pthread_cond_destroy(&pState->cond);
+         pthread_mutex_destroy(&pState->mutex);
+      }
+      else
+         pState->iThreadStarted = 1;
+   }
+
+   log_line("[HardwareRadioVirtual] Opened virtual radio %d for write to port %d, fd=%d, delay line: %s", iVirtualIndex, iPort, pState->iSocketWrite, pState->iThreadStarted?"yes":"no");
+   return pState->iSocketWrite;
+}
+
+void hardware_radio_virtual_close_for_write(int iInterfaceIndex)
+{
+   type_radio_virtual_state* pState = _radio_virtual_get_state(iInterfaceIndex, NULL);
+   if ( (NULL == pState) || (pState->iSocketWrite < 0) )
+      return;
+
+   if ( pState->iThreadStarted )
+   {
+      pthread_mutex_lock(&pState->mutex);
+      pState->iThreadStop = 1;
+      pthread_cond_signal(&pState->cond);
+      pthread_mutex_unlock(&pState->mutex);
+      pthread_join(pState->pThread, NULL);
+      pthread_cond_destroy(&pState->cond);
+      pthread_mutex_destroy(&pState->mutex);
+      if ( pState->iQueueCount > 0 )
+         log_line("[HardwareRadioVirtual] Discarded %d frames still in the delay line of radio interface %d.", pState->iQueueCount, iInterfaceIndex+1);
+      free(pState->pQueue);
+      pState->pQueue = NULL;
+      pState->iQueueCount = 0;
+      pState->iThreadStarted = 0;
+   }
+
+   log_line("[HardwareRadioVirtual] Closed virtual radio interface %d for write. Frames sent: %u, delivered: %u, lost: %u, queue drops: %u",
+      iInterfaceIndex+1, pState->stats.uFramesSent, pState->stats.uFramesDelivered, pState->stats.uFramesLost, pState->stats.uFramesQueueDrop);
+   close(pState->iSocketWrite);
+   pState->iSocketWrite = -1;
+}
+
+int hardware_radio_virtual_read(int iInterfaceIndex, u8* pBuffer, int iMaxLength)
+{
+   type_radio_virtual_state* pState = _radio_virtual_get_state(iInterfaceIndex, NULL);
+   if ( (NULL == pState) || (pState->iSocketRead < 0) || (NULL == pBuffer) )
+      return -1;
+
+   int iRes = recv(pState->iSocketRead, pBuffer, iMaxLength, MSG_DONTWAIT);
+   if ( iRes < 0 )
+   {
+      if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) )
+         return 0;
+      return -1;
+   }
+   pState->stats.uFramesReceived++;
+   return iRes;
+}
+
+int hardware_radio_virtual_write(int iInterfaceIndex, u8* pHeader, int iHeaderLength, u8* pData, int iDataLength)
+{
+   type_radio_virtual_state* pState = _radio_virtual_get_state(iInterfaceIndex, NULL);
+   if ( (NULL == pState) || (pState->iSocketWrite < 0) || (NULL == pData) )
+      return 0;
+   if ( NULL == pHeader )
+      iHeaderLength = 0;
+   int iLength = iHeaderLength + iDataLength;
+   if ( (iDataLength <= 0) || (iLength > MAX_PACKET_TOTAL_SIZE) )
+      return 0;
+
+   if ( ! pState->iThreadStarted )
+   {
+      pState->stats.uFramesSent++;
+      if ( _radio_virtual_is_frame_lost(pState) )
+      {
+         pState->stats.uFramesLost++;
+         return 1;
+      }
+      if ( 0 == iHeaderLength )
+         return _radio_virtual_send(pState, pData, iDataLength);
+      u8 uFrame[MAX_PACKET_TOTAL_SIZE];
+      memcpy(uFrame, pHeader, iHeaderLength);
+      memcpy(uFrame + iHeaderLength, pData, iDataLength);
+      return _radio_virtual_send(pState, uFrame, iLength);
+   }
+
+   u64 uNow = _radio_virtual_now_micros();
+   pthread_mutex_lock(&pState->mutex);
+   pState->stats.uFramesSent++;
+
+   // Link capacity: the frame waits for the previous ones to be on air, then takes its own air time.
+   // A frame that would wait more than the max queue time is tail dropped.
+   u64 uOnAirEnd = uNow;
+   if ( 0 != s_RadioVirtualConfig.uRateBPS )
+   {
+      if ( pState->uLinkFreeMicros > uNow + s_RadioVirtualConfig.uMaxQueueMicros )
+      {
+         pState->stats.uFramesQueueDrop++;
+         pthread_mutex_unlock(&pState->mutex);
+         return 1;
+      }
+      u64 uStart = (pState->uLinkFreeMicros > uNow)?pState->uLinkFreeMicros:uNow;
+      uOnAirEnd = uStart + ((u64)iLength * 8LL * 1000000LL) / (u64)s_RadioVirtualConfig.uRateBPS;
+      pState->uLinkFreeMicros = uOnAirEnd;
+   }
+
+   // Lost frames still took their air time
+   if ( _radio_virtual_is_frame_lost(pState) )
+   {
+      pState->stats.uFramesLost++;
+      pthread_mutex_unlock(&pState->mutex);
+      return 1;
+   }
+   if ( pState->iQueueCount >= VIRTUAL_RADIO_MAX_QUEUED_FRAMES )
+   {
+      pState->stats.uFramesQueueDrop++;
+      pthread_mutex_unlock(&pState->mutex);
+      return 1;
+   }
+
+   u64 uDue = uOnAirEnd + s_RadioVirtualConfig.uLatencyMicros;
+   if ( 0 != s_RadioVirtualConfig.uJitterMicros )
+      uDue += _radio_virtual_random(pState) % (s_RadioVirtualConfig.uJitterMicros + 1);
+   // Radio links do not reorder frames
+   if ( uDue < pState->uLastDueMicros )
+      uDue = pState->uLastDueMicros;
+   pState->uLastDueMicros = uDue;
+
+   type_radio_virtual_frame* pFrame = &pState->pQueue[(pState->iQueueHead + pState->iQueueCount) % VIRTUAL_RADIO_MAX_QUEUED_FRAMES];
+   pFrame->uDueMicros = uDue;
+   pFrame->iLength = iLength;
+   if ( 0 != iHeaderLength )
+      memcpy(pFrame->uData, pHeader, iHeaderLength);
+   memcpy(pFrame->uData + iHeaderLength, pData, iDataLength);
+   pState->iQueueCount++;
+   if ( 1 == pState->iQueueCount )
+      pthread_cond_signal(&pState->cond);
+   pthread_mutex_unlock(&pState->mutex);
+   return 1;
+}
+
+type_radio_virtual_stats* hardware_radio_virtual_get_stats(int iInterfaceIndex)
+{
+   type_radio_virtual_state* pState = _radio_virtual_get_state(iInterfaceIndex, NULL);
+   if ( NULL == pState )
+      return NULL;
+   return &pState->stats;
+}
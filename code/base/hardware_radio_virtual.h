@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware_radio.h"
+
+// Virtual radio interfaces: simulated 2.4/5.8 radio links carried over loopback UDP,
+// so that a vehicle and a controller (ruby_rt_vehicle, ruby_rt_station) can run on the same host
+// without any Wi-Fi hardware and give reproducible link results.
+//
+// Enabled by the config file FOLDER_CONFIG/FILE_CONFIG_VIRTUAL_RADIO or by the environment variable
+// RUBY_VIRTUAL_RADIO (takes precedence), both containing a single line of comma separated parameters:
+//    count=1,side=vehicle,port=7400,loss=5,burst=3,latency=2000,jitter=500,rate=6000000,queue=100000,dbm=-55,seed=1
+//
+//    count   - number of virtual radio interfaces (vradio0...); interface N of the vehicle talks to interface N of the controller
+//    side    - vehicle or station; default: from the system type of the device
+//    port    - base loopback UDP port; interface N uses ports port+2*N (vehicle) and port+2*N+1 (controller)
+//    loss    - average frame loss, in percents (0..100), applied on each tx side
+//    burst   - average number of consecutive frames lost in a loss event (Gilbert model); 1: independent losses
+//    latency - one way latency, in microseconds
+//    jitter  - max extra random latency, in microseconds (frames are still delivered in order)
+//    rate    - link capacity in bits/second (0 - no cap); frames are serialized at this rate
+//    queue   - max time, in microseconds, a frame can wait for the link before it is tail dropped
+//    dbm     - rx signal level reported for received frames
+//    seed    - seed of the loss/jitter generators (same seed and traffic: same losses)
+
+#define VIRTUAL_RADIO_DEFAULT_BASE_PORT 7400
+#define VIRTUAL_RADIO_MAX_QUEUED_FRAMES 1024
+#define VIRTUAL_RADIO_SIDE_VEHICLE 0
+#define VIRTUAL_RADIO_SIDE_STATION 1
+
+typedef struct
+{
+   int iCount;
+   int iSide;
+   int iBasePort;
+   int iLossPercent;
+   int iBurstLength;
+   u32 uLatencyMicros;
+   u32 uJitterMicros;
+   u32 uRateBPS;
+   u32 uMaxQueueMicros;
+   int iDbm;
+   u32 uSeed;
+} type_radio_virtual_config;
+
+typedef struct
+{
+   u32 uFramesSent;       // frames given to the virtual interface for tx
+   u32 uFramesDelivered;  // frames that reached the peer socket
+   u32 uFramesLost;       // dropped by the loss model
+   u32 uFramesQueueDrop;  // tail dropped: link capacity exceeded
+   u32 uFramesReceived;
+   u64 uBytesDelivered;
+} type_radio_virtual_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void hardware_radio_virtual_get_default_config(type_radio_virtual_config* pConfig);
+// Returns 1 if the string was parsed (unknown parameters are logged and ignored)
+int hardware_radio_virtual_parse_config(const char* szConfig, type_radio_virtual_config* pConfig);
+// Overwrites the config loaded from the config file/environment (used by tests)
+void hardware_radio_virtual_set_config(type_radio_virtual_config* pConfig);
+type_radio_virtual_config* hardware_radio_virtual_get_config();
+int hardware_radio_virtual_is_enabled();
+
+// Adds the virtual radio interfaces to the list of hardware radio interfaces. Returns the number added.
+int hardware_radio_virtual_add_interfaces();
+
+// Both return the selectable fd or -1 on failure
+int hardware_radio_virtual_open_for_read(int iInterfaceIndex);
+int hardware_radio_virtual_open_for_write(int iInterfaceIndex);
+void hardware_radio_virtual_close_for_read(int iInterfaceIndex);
+void hardware_radio_virtual_close_for_write(int iInterfaceIndex);
+
+// Returns the length of the received frame, 0 if there is nothing to read, -1 on error. Does not block.
+int hardware_radio_virtual_read(int iInterfaceIndex, u8* pBuffer, int iMaxLength);
+// pHeader is optional. Returns 1 if the frame was accepted (it can still be lost by the link simulation), 0 on error.
+int hardware_radio_virtual_write(int iInterfaceIndex, u8* pHeader, int iHeaderLength, u8* pData, int iDataLength);
+
+type_radio_virtual_stats* hardware_radio_virtual_get_stats(int iInterfaceIndex);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
@@ -622,4 +626,33 @@ int hw_increase_current_thread_priority(const char* szLogPrefix, int iNewPriorit
    log_line("%s Current new thread policy/priority: %d/%d", szPrefix, policy, params.sched_priority);
 
    return iRetValue;
-}
\ No newline at end of file
+}
+// Pins only the calling thread (not the whole process) to the cores range [iCoreStart, iCoreEnd] (1 based)
+
+int hw_set_current_thread_affinity(const char* szLogPrefix, int iCoreStart, int iCoreEnd)
+{
+   char szTmp[2];
+   szTmp[0] = 0;
+   char* szPrefix = szTmp;
+   if ( (NULL != szLogPrefix) && (0 != szLogPrefix[0]) )
+     szPrefix = (char*)szLogPrefix;
+
+   if ( (iCoreStart < 1) || (iCoreEnd < iCoreStart) || (iCoreEnd > CPU_SETSIZE) )
+   {
+      log_softerror_and_alarm("%s Invalid thread affinity cores: %d-%d", szPrefix, iCoreStart, iCoreEnd);
+      return 0;
+   }
+
+   cpu_set_t cpuSet;
+   CPU_ZERO(&cpuSet);
+   for( int i=iCoreStart; i<=iCoreEnd; i++ )
+      CPU_SET(i-1, &cpuSet);
+
+   if ( 0 != sched_setaffinity(0, sizeof(cpuSet), &cpuSet) )
+   {
+      log_softerror_and_alarm("%s Failed to set thread affinity to cores %d-%d, error: %d, %s", szPrefix, iCoreStart, iCoreEnd, errno, strerror(errno));
+      return 0;
+   }
+   log_line("%s Set thread affinity to cores %d-%d", szPrefix, iCoreStart, iCoreEnd);
+   return 1;
+}
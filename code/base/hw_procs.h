@@ -20,6 +20,8 @@ void hw_set_proc_priority(const char* szProgName, int nice, int ionice, int wait
 void hw_get_proc_priority(const char* szProgName, char* szOutput);
 
 void hw_set_proc_affinity(const char* szProgName, int iCoreStart, int iCoreEnd);
+// Returns 1 on success
+int hw_set_current_thread_affinity(const char* szLogPrefix, int iCoreStart, int iCoreEnd);
 
 int hw_execute_bash_command(const char* command, char* outBuffer);
 int hw_execute_bash_command_raw(const char* command, char* outBuffer);
@@ -0,0 +1,385 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "base.h"
+#include "hardware.h"
+#include "ipc_shm_ring.h"
+
+typedef struct
+{
+   volatile u32 uSequence; // position: free, position+1: committed, position+slots count: free for the next round
+   u32 uPosition; // set by the writer that reserved it
+   u16 uLength;
+   u8 uMessageId;
+   u8 uUnused[5];
+} type_ipc_shm_ring_slot;
+
+static type_ipc_shm_ring_slot* _ipc_shm_ring_get_slot(type_ipc_shm_ring* pRing, u32 uPosition)
+{
+   return (type_ipc_shm_ring_slot*)(pRing->pSlots + (uPosition & pRing->uMask) * pRing->pHeader->uSlotStride);
+}
+
+static int _ipc_shm_ring_open_doorbell(type_ipc_shm_ring* pRing, const char* szDoorbellFifo)
+{
+   if ( (NULL == szDoorbellFifo) || (0 == szDoorbellFifo[0]) )
+      return 1;
+   if ( (0 != mkfifo(szDoorbellFifo, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)) && (errno != EEXIST) )
+   {
+      log_softerror_and_alarm("[IPCRing] %s: Failed to create the doorbell FIFO %s, error: %s", pRing->szName, szDoorbellFifo, strerror(errno));
+      return 0;
+   }
+   // Read-write: the open never fails or blocks because the other end is not opened yet
+   pRing->iDoorbellFd = open(szDoorbellFifo, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+   if ( pRing->iDoorbellFd < 0 )
+   {
+      log_softerror_and_alarm("[IPCRing] %s: Failed to open the doorbell FIFO %s, error: %s", pRing->szName, szDoorbellFifo, strerror(errno));
+      return 0;
+   }
+   return 1;
+}
+
+static void _ipc_shm_ring_ring_doorbell(type_ipc_shm_ring* pRing)
+{
+   if ( 0 == __atomic_load_n(&pRing->pHeader->uReaderWaiting, __ATOMIC_RELAXED) )
+      return;
+   if ( 0 == __atomic_exchange_n(&pRing->pHeader->uReaderWaiting, 0, __ATOMIC_ACQ_REL) )
+      return;
+   __atomic_add_fetch(&pRing->pHeader->uCountDoorbells, 1, __ATOMIC_RELAXED);
+   if ( pRing->iDoorbellFd >= 0 )
+   {
+      u8 uByte = 1;
+      if ( write(pRing->iDoorbellFd, &uByte, 1) < 0 )
+         log_softerror_and_alarm("[IPCRing] %s: Failed to ring the doorbell, error: %s", pRing->szName, strerror(errno));
+   }
+}
+
+int ipc_shm_ring_open(type_ipc_shm_ring* pRing, const char* szName, const char* szDoorbellFifo, int iSlotsCount, int iMaxMessageSize)
+{
+   if ( NULL == pRing )
+      return 0;
+   memset(pRing, 0, sizeof(type_ipc_shm_ring));
+   pRing->iShmFd = -1;
+   pRing->iDoorbellFd = -1;
+   if ( (NULL == szName) || (iSlotsCount < 2) || (iMaxMessageSize <= 0) || (iMaxMessageSize > 0xFFFF) )
+      return 0;
+   strncpy(pRing->szName, szName, sizeof(pRing->szName)-1);
+
+   u32 uSlotsCount = 2;
+   while ( uSlotsCount < (u32)iSlotsCount )
+      uSlotsCount <<= 1;
+   u32 uSlotStride = (IPC_SHM_RING_SLOT_HEADER_SIZE + (u32)iMaxMessageSize + IPC_SHM_RING_CACHE_LINE - 1) & ~(IPC_SHM_RING_CACHE_LINE - 1);
+   pRing->uMemorySize = sizeof(type_ipc_shm_ring_header) + uSlotsCount * uSlotStride;
+   pRing->uMask = uSlotsCount - 1;
+
+   int bCreated = 1;
+   pRing->iShmFd = shm_open(szName, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+   if ( (pRing->iShmFd < 0) && (errno == EEXIST) )
+   {
+      bCreated = 0;
+      pRing->iShmFd = shm_open(szName, O_RDWR, S_IRUSR | S_IWUSR);
+   }
+   if ( pRing->iShmFd < 0 )
+   {
+      log_softerror_and_alarm("[IPCRing] %s: Failed to open the shared memory, error: %s", szName, strerror(errno));
+      return 0;
+   }
+
+   if ( bCreated )
+   {
+      if ( 0 != ftruncate(pRing->iShmFd, pRing->uMemorySize) )
+      {
+         log_softerror_and_alarm("[IPCRing] %s: Failed to set the shared memory size (%u bytes), error: %s", szName, pRing->uMemorySize, strerror(errno));
+         ipc_shm_ring_close(pRing);
+         shm_unlink(szName);
+         return 0;
+      }
+   }
+   else
+   {
+      // The creator may still be sizing it
+      struct stat st;
+      int iRetries = 50;
+      while ( (0 == fstat(pRing->iShmFd, &st)) && ((u32)st.st_size < pRing->uMemorySize) && (iRetries > 0) )
+      {
+         hardware_sleep_ms(2);
+         iRetries--;
+      }
+      if ( (u32)st.st_size < pRing->uMemorySize )
+      {
+         log_softerror_and_alarm("[IPCRing] %s: Existing shared memory is too small (%u bytes, expected %u bytes).", szName, (u32)st.st_size, pRing->uMemorySize);
+         ipc_shm_ring_close(pRing);
+         return 0;
+      }
+   }
+
+   void* pMemory = mmap(NULL, pRing->uMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED, pRing->iShmFd, 0);
+   if ( MAP_FAILED == pMemory )
+   {
+      log_softerror_and_alarm("[IPCRing] %s: Failed to map %u bytes of shared memory, error: %s", szName, pRing->uMemorySize, strerror(errno));
+      ipc_shm_ring_close(pRing);
+      return 0;
+   }
+   pRing->pMemory = (u8*)pMemory;
+   pRing->pHeader = (type_ipc_shm_ring_header*)pMemory;
+   pRing->pSlots = pRing->pMemory + sizeof(type_ipc_shm_ring_header);
+
+   if ( bCreated )
+   {
+      pRing->pHeader->uVersion = IPC_SHM_RING_VERSION;
+      pRing->pHeader->uSlotsCount = uSlotsCount;
+      pRing->pHeader->uSlotStride = uSlotStride;
+      pRing->pHeader->uMaxMessageSize = (u32)iMaxMessageSize;
+      for( u32 u=0; u<uSlotsCount; u++ )
+         _ipc_shm_ring_get_slot(pRing, u)->uSequence = u;
+      pRing->pHeader->uReaderWaiting = 1;
+      __atomic_store_n(&pRing->pHeader->uMagic, IPC_SHM_RING_MAGIC, __ATOMIC_RELEASE);
+   }
+   else
+   {
+      int iRetries = 50;
+      while ( (IPC_SHM_RING_MAGIC != __atomic_load_n(&pRing->pHeader->uMagic, __ATOMIC_ACQUIRE)) && (iRetries > 0) )
+      {
+         hardware_sleep_ms(2);
+         iRetries--;
+      }
+      if ( (IPC_SHM_RING_MAGIC != pRing->pHeader->uMagic) || (IPC_SHM_RING_VERSION != pRing->pHeader->uVersion) ||
+           (uSlotsCount != pRing->pHeader->uSlotsCount) || (uSlotStride != pRing->pHeader->uSlotStride) )
+      {
+         log_softerror_and_alarm("[IPCRing] %s: Existing shared memory has a different layout (version %u, %u slots of %u bytes).",
+            szName, pRing->pHeader->uVersion, pRing->pHeader->uSlotsCount, pRing->pHeader->uSlotStride);
+         ipc_shm_ring_close(pRing);
+         return 0;
+      }
+   }
+
+   if ( ! _ipc_shm_ring_open_doorbell(pRing, szDoorbellFifo) )
+   {
+      ipc_shm_ring_close(pRing);
+      return 0;
+   }
+   log_line("[IPCRing] %s: %s ring of %u slots of %u bytes (%u bytes), %d messages pending.",
+      szName, bCreated?"Created":"Attached to", uSlotsCount, uSlotStride, pRing->uMemorySize, ipc_shm_ring_get_count(pRing));
+   return 1;
+}
+
+void ipc_shm_ring_close(type_ipc_shm_ring* pRing)
+{
+   if ( NULL == pRing )
+      return;
+   if ( NULL != pRing->pMemory )
+      munmap(pRing->pMemory, pRing->uMemorySize);
+   if ( pRing->iShmFd >= 0 )
+      close(pRing->iShmFd);
+   if ( pRing->iDoorbellFd >= 0 )
+      close(pRing->iDoorbellFd);
+   pRing->pMemory = NULL;
+   pRing->pHeader = NULL;
+   pRing->pSlots = NULL;
+   pRing->iShmFd = -1;
+   pRing->iDoorbellFd = -1;
+}
+
+void ipc_shm_ring_unlink(const char* szName, const char* szDoorbellFifo)
+{
+   if ( NULL != szName )
+      shm_unlink(szName);
+   if ( (NULL != szDoorbellFifo) && (0 != szDoorbellFifo[0]) )
+      unlink(szDoorbellFifo);
+}
+
+int ipc_shm_ring_is_open(type_ipc_shm_ring* pRing)
+{
+   return ((NULL != pRing) && (NULL != pRing->pHeader))?1:0;
+}
+
+u8* ipc_shm_ring_reserve(type_ipc_shm_ring* pRing, int iMaxLength)
+{
+   if ( (iMaxLength < 0) || ((u32)iMaxLength > pRing->pHeader->uMaxMessageSize) )
+      return NULL;
+
+   u32 uPosition = __atomic_load_n(&pRing->pHeader->uHead, __ATOMIC_RELAXED);
+   while ( 1 )
+   {
+      type_ipc_shm_ring_slot* pSlot = _ipc_shm_ring_get_slot(pRing, uPosition);
+      u32 uSequence = __atomic_load_n(&pSlot->uSequence, __ATOMIC_ACQUIRE);
+      int iDiff = (int)(uSequence - uPosition);
+      if ( 0 == iDiff )
+      {
+         // Free slot for this round: take it, unless another writer was faster
+         if ( __atomic_compare_exchange_n(&pRing->pHeader->uHead, &uPosition, uPosition+1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+         {
+            pSlot->uPosition = uPosition;
+            return ((u8*)pSlot) + IPC_SHM_RING_SLOT_HEADER_SIZE;
+         }
+      }
+      else if ( iDiff < 0 )
+      {
+         // Not yet read in the previous round: full
+         __atomic_add_fetch(&pRing->pHeader->uCountFull, 1, __ATOMIC_RELAXED);
+         return NULL;
+      }
+      else
+         uPosition = __atomic_load_n(&pRing->pHeader->uHead, __ATOMIC_RELAXED);
+   }
+   return NULL;
+}
+
+int ipc_shm_ring_commit(type_ipc_shm_ring* pRing, u8* pMessage, int iLength, u8 uMessageId)
+{
+   type_ipc_shm_ring_slot* pSlot = (type_ipc_shm_ring_slot*)(pMessage - IPC_SHM_RING_SLOT_HEADER_SIZE);
+   u32 uPosition = pSlot->uPosition;
+
+   // Too late: the reader skipped the slot (it can be reserved again by now)
+   if ( __atomic_load_n(&pSlot->uSequence, __ATOMIC_ACQUIRE) != uPosition )
+   {
+      log_softerror_and_alarm("[IPCRing] %s: Message committed after the reader skipped its slot (position %u). Dropped.", pRing->szName, uPosition);
+      return 0;
+   }
+   pSlot->uLength = (u16)iLength;
+   pSlot->uMessageId = uMessageId;
+   u32 uExpected = uPosition;
+   if ( ! __atomic_compare_exchange_n(&pSlot->uSequence, &uExpected, uPosition + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+   {
+      log_softerror_and_alarm("[IPCRing] %s: Message committed after the reader skipped its slot (position %u). Dropped.", pRing->szName, uPosition);
+      return 0;
+   }
+   __atomic_add_fetch(&pRing->pHeader->uCountWritten, 1, __ATOMIC_RELAXED);
+
+   // Pairs with the reader: it sets the waiting flag, then checks for messages again
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   _ipc_shm_ring_ring_doorbell(pRing);
+   return 1;
+}
+
+int ipc_shm_ring_write(type_ipc_shm_ring* pRing, u8* pMessage, int iLength, u8 uMessageId)
+{
+   u8* pBuffer = ipc_shm_ring_reserve(pRing, iLength);
+   if ( NULL == pBuffer )
+      return 0;
+   memcpy(pBuffer, pMessage, iLength);
+   return ipc_shm_ring_commit(pRing, pBuffer, iLength, uMessageId);
+}
+
+// The slot at the tail is reserved by a writer but not committed. Skips it (frees it for the next round)
+// if it stays so for too long: its writer died or is stuck. Returns 1 if it was skipped
+static int _ipc_shm_ring_check_stalled_slot(type_ipc_shm_ring* pRing, type_ipc_shm_ring_slot* pSlot, u32 uTail)
+{
+   if ( (int)(__atomic_load_n(&pRing->pHeader->uHead, __ATOMIC_ACQUIRE) - uTail) <= 0 )
+   {
+      pRing->uStalledSinceTime = 0;
+      return 0;
+   }
+   u32 uTimeNow = get_current_timestamp_ms();
+   if ( (0 == pRing->uStalledSinceTime) || (pRing->uStalledPosition != uTail) )
+   {
+      pRing->uStalledPosition = uTail;
+      pRing->uStalledSinceTime = uTimeNow;
+      return 0;
+   }
+   if ( uTimeNow < pRing->uStalledSinceTime + IPC_SHM_RING_STALLED_SLOT_TIMEOUT_MS )
+      return 0;
+
+   // The writer can still commit it right now
+   u32 uExpected = uTail;
+   if ( ! __atomic_compare_exchange_n(&pSlot->uSequence, &uExpected, uTail + pRing->uMask + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+      return 0;
+   __atomic_store_n(&pRing->pHeader->uTail, uTail + 1, __ATOMIC_RELEASE);
+   pRing->uStalledSinceTime = 0;
+   pRing->uCountSkipped++;
+   log_softerror_and_alarm("[IPCRing] %s: Skipped a slot reserved and not committed for more than %d ms (position %u, %u skipped so far).",
+      pRing->szName, IPC_SHM_RING_STALLED_SLOT_TIMEOUT_MS, uTail, pRing->uCountSkipped);
+   return 1;
+}
+
+u8* ipc_shm_ring_peek(type_ipc_shm_ring* pRing, int* piLength, u8* puMessageId)
+{
+   u32 uTail = pRing->pHeader->uTail;
+   type_ipc_shm_ring_slot* pSlot = _ipc_shm_ring_get_slot(pRing, uTail);
+   while ( (__atomic_load_n(&pSlot->uSequence, __ATOMIC_ACQUIRE) != uTail + 1) && _ipc_shm_ring_check_stalled_slot(pRing, pSlot, uTail) )
+   {
+      uTail = pRing->pHeader->uTail;
+      pSlot = _ipc_shm_ring_get_slot(pRing, uTail);
+   }
+   if ( __atomic_load_n(&pSlot->uSequence, __ATOMIC_ACQUIRE) != uTail + 1 )
+   {
+      // Empty (or the next one not committed yet): drain the doorbell, ask the writers to ring it, then check again
+      if ( pRing->iDoorbellFd >= 0 )
+      {
+         u8 uBuffer[64];
+         while ( read(pRing->iDoorbellFd, uBuffer, sizeof(uBuffer)) > 0 ) {}
+      }
+      __atomic_store_n(&pRing->pHeader->uReaderWaiting, 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if ( __atomic_load_n(&pSlot->uSequence, __ATOMIC_ACQUIRE) != uTail + 1 )
+         return NULL;
+   }
+   if ( NULL != piLength )
+      *piLength = pSlot->uLength;
+   if ( NULL != puMessageId )
+      *puMessageId = pSlot->uMessageId;
+   return ((u8*)pSlot) + IPC_SHM_RING_SLOT_HEADER_SIZE;
+}
+
+void ipc_shm_ring_release(type_ipc_shm_ring* pRing)
+{
+   u32 uTail = pRing->pHeader->uTail;
+   type_ipc_shm_ring_slot* pSlot = _ipc_shm_ring_get_slot(pRing, uTail);
+   __atomic_store_n(&pSlot->uSequence, uTail + pRing->uMask + 1, __ATOMIC_RELEASE);
+   __atomic_store_n(&pRing->pHeader->uTail, uTail + 1, __ATOMIC_RELEASE);
+}
+
+int ipc_shm_ring_get_doorbell_fd(type_ipc_shm_ring* pRing)
+{
+   if ( NULL == pRing )
+      return -1;
+   return pRing->iDoorbellFd;
+}
+
+void ipc_shm_ring_arm_doorbell(type_ipc_shm_ring* pRing)
+{
+   if ( ! ipc_shm_ring_is_open(pRing) )
+      return;
+   __atomic_store_n(&pRing->pHeader->uReaderWaiting, 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   if ( ipc_shm_ring_get_count(pRing) > 0 )
+      _ipc_shm_ring_ring_doorbell(pRing);
+}
+
+int ipc_shm_ring_get_count(type_ipc_shm_ring* pRing)
+{
+   if ( ! ipc_shm_ring_is_open(pRing) )
+      return 0;
+   u32 uTail = __atomic_load_n(&pRing->pHeader->uTail, __ATOMIC_ACQUIRE);
+   u32 uHead = __atomic_load_n(&pRing->pHeader->uHead, __ATOMIC_ACQUIRE);
+   return (int)(uHead - uTail);
+}
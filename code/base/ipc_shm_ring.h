@@ -0,0 +1,92 @@
+#pragma once
+
+#include "../base/base.h"
+
+// Message ring in shared memory, used by the IPC channels between the Ruby processes.
+// Fixed size slots; any number of writers (processes or threads), one reader.
+// Writers reserve a slot (lock-free, on the ring head), fill it in place and commit it;
+// the reader gets the committed messages in place, in order, and releases them. No syscalls and no
+// kernel copies on the data path.
+// The reader can wait for messages on a doorbell fd (a FIFO, so that any process can open it by name and
+// poll/epoll can wait on it). Writers ring it only when the reader found the ring empty and is waiting,
+// so a busy reader costs no syscalls either.
+// Each slot keeps the IPC message framing: message id and message length, before the message.
+// The ring outlives the processes: a writer that dies (or stalls) between reserve and commit would block
+// the reader forever. The reader skips a slot that stays reserved and not committed for
+// IPC_SHM_RING_STALLED_SLOT_TIMEOUT_MS; a late commit to a skipped slot is dropped.
+// The first process that opens a ring creates and initializes it; the others attach to it.
+
+#define IPC_SHM_RING_MAGIC 0x52494E47
+#define IPC_SHM_RING_VERSION 1
+#define IPC_SHM_RING_CACHE_LINE 64
+#define IPC_SHM_RING_SLOT_HEADER_SIZE 16 // sequence (u32), position (u32), message length (u16), message id (u8), unused
+#define IPC_SHM_RING_STALLED_SLOT_TIMEOUT_MS 1000
+
+typedef struct
+{
+   u32 uMagic; // set last, when the ring is initialized
+   u32 uVersion;
+   u32 uSlotsCount;
+   u32 uSlotStride;
+   u32 uMaxMessageSize;
+   u32 uCountWritten;
+   u32 uCountFull; // failed writes, ring full
+   u32 uCountDoorbells;
+   u8 uPadding0[IPC_SHM_RING_CACHE_LINE - 8*sizeof(u32)];
+   volatile u32 uHead; // next position to reserve, written by the writers
+   u8 uPadding1[IPC_SHM_RING_CACHE_LINE - sizeof(u32)];
+   volatile u32 uTail; // next position to read, written by the reader only
+   volatile u32 uReaderWaiting; // 1: the reader found the ring empty, writers must ring the doorbell
+   u8 uPadding2[IPC_SHM_RING_CACHE_LINE - 2*sizeof(u32)];
+} type_ipc_shm_ring_header;
+
+typedef struct
+{
+   char szName[64];
+   int iShmFd;
+   int iDoorbellFd;
+   u8* pMemory;
+   u32 uMemorySize;
+   type_ipc_shm_ring_header* pHeader;
+   u8* pSlots;
+   u32 uMask;
+   // Reader: the reserved, not committed slot it's waiting for
+   u32 uStalledPosition;
+   u32 uStalledSinceTime; // 0: none
+   u32 uCountSkipped;
+} type_ipc_shm_ring;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Creates the ring or attaches to an existing one. iSlotsCount is rounded up to a power of 2.
+// Returns 1 on success, 0 on failure
+int ipc_shm_ring_open(type_ipc_shm_ring* pRing, const char* szName, const char* szDoorbellFifo, int iSlotsCount, int iMaxMessageSize);
+void ipc_shm_ring_close(type_ipc_shm_ring* pRing);
+// Removes the ring and its doorbell from the system (processes that have it opened keep their mapping)
+void ipc_shm_ring_unlink(const char* szName, const char* szDoorbellFifo);
+int ipc_shm_ring_is_open(type_ipc_shm_ring* pRing);
+
+// Writer side. Reserve returns a buffer for a message of up to iMaxLength bytes, NULL if the ring is full.
+// A reserved slot must be committed (the reader waits for it, up to IPC_SHM_RING_STALLED_SLOT_TIMEOUT_MS).
+u8* ipc_shm_ring_reserve(type_ipc_shm_ring* pRing, int iMaxLength);
+// Returns 1 on success, 0 if the reader already skipped the slot (the message is dropped)
+int ipc_shm_ring_commit(type_ipc_shm_ring* pRing, u8* pMessage, int iLength, u8 uMessageId);
+// Reserve, copy and commit. Returns 1 on success, 0 if the ring is full
+int ipc_shm_ring_write(type_ipc_shm_ring* pRing, u8* pMessage, int iLength, u8 uMessageId);
+
+// Reader side. Returns the next message in place (and its length and id), NULL if none is committed yet.
+// The message stays valid until it's released.
+u8* ipc_shm_ring_peek(type_ipc_shm_ring* pRing, int* piLength, u8* puMessageId);
+void ipc_shm_ring_release(type_ipc_shm_ring* pRing);
+// Becomes readable when messages are written after the reader found the ring empty
+int ipc_shm_ring_get_doorbell_fd(type_ipc_shm_ring* pRing);
+// Called by the reader before it starts waiting on the doorbell: rings it if messages are already pending
+void ipc_shm_ring_arm_doorbell(type_ipc_shm_ring* pRing);
+
+int ipc_shm_ring_get_count(type_ipc_shm_ring* pRing);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,503 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "base.h"
+#include "log_ring.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#define LOG_ARG_INT 0
+#define LOG_ARG_LONG 1
+#define LOG_ARG_LLONG 2
+#define LOG_ARG_SIZE 3
+#define LOG_ARG_INTMAX 4
+#define LOG_ARG_PTRDIFF 5
+#define LOG_ARG_DOUBLE 6
+#define LOG_ARG_PTR 7
+#define LOG_ARG_STRING 8
+
+#define LOG_RING_NULL_STRING 0xFFFFFFFFFFFFFFFFULL
+#define LOG_RING_MAX_STATIC_RANGES 8
+
+typedef struct
+{
+   volatile u32 uSequence;
+   u32 uTimeMs;
+   const char* szFormat;
+   u16 uDataLength;
+   u8 uArgsCount;
+   u8 uIsText; // 1: data is the formatted text
+   u8 uArgTypes[LOG_RING_MAX_ARGS];
+   u64 uArgs[LOG_RING_MAX_ARGS]; // strings: offset in data
+} type_log_ring_entry_header;
+
+typedef struct
+{
+   type_log_ring_entry_header header;
+   char data[LOG_RING_SLOT_SIZE - sizeof(type_log_ring_entry_header)];
+} type_log_ring_entry;
+
+static type_log_ring_entry* s_pLogRingEntries = NULL;
+static volatile u32 s_uLogRingHead = 0;
+static u32 s_uLogRingTail = 0;
+static volatile u32 s_uLogRingDropped = 0;
+
+// Read-only mappings of the executable: format strings in them never change
+static uintptr_t s_uLogRingStaticStart[LOG_RING_MAX_STATIC_RANGES];
+static uintptr_t s_uLogRingStaticEnd[LOG_RING_MAX_STATIC_RANGES];
+static int s_iLogRingStaticRangesCount = 0;
+
+static void _log_ring_load_static_ranges()
+{
+   s_iLogRingStaticRangesCount = 0;
+   char szExe[256];
+   int iLen = readlink("/proc/self/exe", szExe, sizeof(szExe)-1);
+   if ( iLen <= 0 )
+      return;
+   szExe[iLen] = 0;
+
+   FILE* fd = fopen("/proc/self/maps", "r");
+   if ( NULL == fd )
+      return;
+   char szLine[512];
+   while ( (s_iLogRingStaticRangesCount < LOG_RING_MAX_STATIC_RANGES) && (NULL != fgets(szLine, sizeof(szLine), fd)) )
+   {
+      unsigned long long uStart = 0, uEnd = 0;
+      char szPerms[8];
+      if ( 3 != sscanf(szLine, "%llx-%llx %7s", &uStart, &uEnd, szPerms) )
+         continue;
+      if ( (szPerms[0] != 'r') || (szPerms[1] == 'w') )
+         continue;
+      char* szPath = strchr(szLine, '/');
+      if ( NULL == szPath )
+         continue;
+      szPath[strcspn(szPath, "\r\n")] = 0;
+      if ( 0 != strcmp(szPath, szExe) )
+         continue;
+      s_uLogRingStaticStart[s_iLogRingStaticRangesCount] = (uintptr_t)uStart;
+      s_uLogRingStaticEnd[s_iLogRingStaticRangesCount] = (uintptr_t)uEnd;
+      s_iLogRingStaticRangesCount++;
+   }
+   fclose(fd);
+}
+
+static int _log_ring_is_static(const char* szText)
+{
+   uintptr_t uAddress = (uintptr_t)szText;
+   for( int i=0; i<s_iLogRingStaticRangesCount; i++ )
+      if ( (uAddress >= s_uLogRingStaticStart[i]) && (uAddress < s_uLogRingStaticEnd[i]) )
+         return 1;
+   return 0;
+}
+
+// Parses the conversion spec at szSpec (starts with '%'). Returns its length, 0 if it's not supported.
+// *piStars: width/precision arguments ('*'), *piType: argument type, -1 for "%%"
+static int _log_ring_parse_spec(const char* szSpec, int* piStars, int* piType)
+{
+   const char* p = szSpec + 1;
+   *piStars = 0;
+   *piType = -1;
+   if ( *p == '%' )
+      return 2;
+
+   while ( (0 != *p) && (NULL != strchr("-+ #0'", *p)) )
+      p++;
+   if ( *p == '*' )
+   {
+      (*piStars)++;
+      p++;
+   }
+   else
+      while ( isdigit((unsigned char)*p) )
+         p++;
+   if ( *p == '.' )
+   {
+      p++;
+      if ( *p == '*' )
+      {
+         (*piStars)++;
+         p++;
+      }
+      else
+         while ( isdigit((unsigned char)*p) )
+            p++;
+   }
+
+   int iType = LOG_ARG_INT;
+   int bLongDouble = 0;
+   int bLong = 0;
+   if ( *p == 'h' )
+   {
+      p++;
+      if ( *p == 'h' )
+         p++;
+   }
+   else if ( *p == 'l' )
+   {
+      p++;
+      bLong = 1;
+      iType = LOG_ARG_LONG;
+      if ( *p == 'l' )
+      {
+         p++;
+         iType = LOG_ARG_LLONG;
+      }
+   }
+   else if ( *p == 'q' )
+   {
+      p++;
+      iType = LOG_ARG_LLONG;
+   }
+   else if ( *p == 'z' )
+   {
+      p++;
+      iType = LOG_ARG_SIZE;
+   }
+   else if ( *p == 'j' )
+   {
+      p++;
+      iType = LOG_ARG_INTMAX;
+   }
+   else if ( *p == 't' )
+   {
+      p++;
+      iType = LOG_ARG_PTRDIFF;
+   }
+   else if ( *p == 'L' )
+   {
+      p++;
+      bLongDouble = 1;
+   }
+
+   switch ( *p )
+   {
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+         if ( bLongDouble )
+            return 0;
+         *piType = iType;
+         break;
+      case 'c':
+         // %lc takes a wint_t, passed as an int
+         if ( bLongDouble || ((iType != LOG_ARG_INT) && (! bLong)) )
+            return 0;
+         *piType = LOG_ARG_INT;
+         break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+         if ( bLongDouble || ((iType != LOG_ARG_INT) && (iType != LOG_ARG_LONG)) )
+            return 0;
+         *piType = LOG_ARG_DOUBLE;
+         break;
+      case 's':
+         if ( bLongDouble || bLong || (iType != LOG_ARG_INT) )
+            return 0;
+         *piType = LOG_ARG_STRING;
+         break;
+      case 'p':
+         *piType = LOG_ARG_PTR;
+         break;
+      default:
+         return 0;
+   }
+   return (int)(p - szSpec) + 1;
+}
+
+static int _log_ring_copy_to_data(type_log_ring_entry* pEntry, const char* szText)
+{
+   int iLen = strlen(szText) + 1;
+   if ( pEntry->header.uDataLength + iLen > (int)sizeof(pEntry->data) )
+      return -1;
+   int iOffset = pEntry->header.uDataLength;
+   memcpy(pEntry->data + iOffset, szText, iLen);
+   pEntry->header.uDataLength += iLen;
+   return iOffset;
+}
+
+// Stores the format and the raw arguments; formats the text right away if that's not possible
+static void _log_ring_store(type_log_ring_entry* pEntry, const char* szFormat, va_list args)
+{
+   va_list argsCopy;
+   va_copy(argsCopy, args);
+
+   pEntry->header.uArgsCount = 0;
+   pEntry->header.uDataLength = 0;
+   pEntry->header.uIsText = 0;
+   pEntry->header.szFormat = szFormat;
+
+   int bOk = 1;
+   if ( ! _log_ring_is_static(szFormat) )
+   {
+      int iOffset = _log_ring_copy_to_data(pEntry, szFormat);
+      if ( iOffset < 0 )
+         bOk = 0;
+      else
+         pEntry->header.szFormat = pEntry->data + iOffset;
+   }
+
+   const char* p = szFormat;
+   while ( bOk && (0 != *p) )
+   {
+      if ( *p != '%' )
+      {
+         p++;
+         continue;
+      }
+      int iStars = 0;
+      int iType = -1;
+      int iLen = _log_ring_parse_spec(p, &iStars, &iType);
+      if ( 0 == iLen )
+      {
+         bOk = 0;
+         break;
+      }
+      p += iLen;
+      if ( iType < 0 )
+         continue;
+      if ( pEntry->header.uArgsCount + iStars + 1 > LOG_RING_MAX_ARGS )
+      {
+         bOk = 0;
+         break;
+      }
+      for( int i=0; i<iStars; i++ )
+      {
+         pEntry->header.uArgTypes[pEntry->header.uArgsCount] = LOG_ARG_INT;
+         pEntry->header.uArgs[pEntry->header.uArgsCount] = (u64)(long long)va_arg(args, int);
+         pEntry->header.uArgsCount++;
+      }
+
+      u64 uValue = 0;
+      switch ( iType )
+      {
+         case LOG_ARG_INT: uValue = (u64)(long long)va_arg(args, int); break;
+         case LOG_ARG_LONG: uValue = (u64)(long long)va_arg(args, long); break;
+         case LOG_ARG_LLONG: uValue = (u64)va_arg(args, long long); break;
+         case LOG_ARG_SIZE: uValue = (u64)va_arg(args, size_t); break;
+         case LOG_ARG_INTMAX: uValue = (u64)va_arg(args, intmax_t); break;
+         case LOG_ARG_PTRDIFF: uValue = (u64)(long long)va_arg(args, ptrdiff_t); break;
+         case LOG_ARG_PTR: uValue = (u64)(uintptr_t)va_arg(args, void*); break;
+         case LOG_ARG_DOUBLE:
+         {
+            double fValue = va_arg(args, double);
+            memcpy(&uValue, &fValue, sizeof(double));
+            break;
+         }
+         case LOG_ARG_STRING:
+         {
+            const char* szValue = va_arg(args, const char*);
+            uValue = LOG_RING_NULL_STRING;
+            if ( NULL != szValue )
+            {
+               int iOffset = _log_ring_copy_to_data(pEntry, szValue);
+               if ( iOffset < 0 )
+                  bOk = 0;
+               uValue = (u64)iOffset;
+            }
+            break;
+         }
+      }
+      pEntry->header.uArgTypes[pEntry->header.uArgsCount] = (u8)iType;
+      pEntry->header.uArgs[pEntry->header.uArgsCount] = uValue;
+      pEntry->header.uArgsCount++;
+   }
+
+   if ( ! bOk )
+   {
+      vsnprintf(pEntry->data, sizeof(pEntry->data), szFormat, argsCopy);
+      pEntry->data[sizeof(pEntry->data)-1] = 0;
+      pEntry->header.uIsText = 1;
+   }
+   va_end(argsCopy);
+}
+
+#define LOG_RING_FORMAT_ARG(value) \
+   ((0 == iStars) ? snprintf(szOutput, iMaxLength, szSpec, value) : \
+    (1 == iStars) ? snprintf(szOutput, iMaxLength, szSpec, piStars[0], value) : \
+    snprintf(szOutput, iMaxLength, szSpec, piStars[0], piStars[1], value))
+
+static int _log_ring_format_arg(type_log_ring_entry* pEntry, char* szOutput, int iMaxLength, const char* szSpec, int iStars, int* piStars, int iType, u64 uValue)
+{
+   switch ( iType )
+   {
+      case LOG_ARG_INT: return LOG_RING_FORMAT_ARG((int)(long long)uValue);
+      case LOG_ARG_LONG: return LOG_RING_FORMAT_ARG((long)(long long)uValue);
+      case LOG_ARG_LLONG: return LOG_RING_FORMAT_ARG((long long)uValue);
+      case LOG_ARG_SIZE: return LOG_RING_FORMAT_ARG((size_t)uValue);
+      case LOG_ARG_INTMAX: return LOG_RING_FORMAT_ARG((intmax_t)uValue);
+      case LOG_ARG_PTRDIFF: return LOG_RING_FORMAT_ARG((ptrdiff_t)(long long)uValue);
+      case LOG_ARG_PTR: return LOG_RING_FORMAT_ARG((void*)(uintptr_t)uValue);
+      case LOG_ARG_DOUBLE:
+      {
+         double fValue = 0.0;
+         memcpy(&fValue, &uValue, sizeof(double));
+         return LOG_RING_FORMAT_ARG(fValue);
+      }
+      case LOG_ARG_STRING:
+      {
+         const char* szValue = "(null)";
+         if ( LOG_RING_NULL_STRING != uValue )
+            szValue = pEntry->data + uValue;
+         return LOG_RING_FORMAT_ARG(szValue);
+      }
+   }
+   return 0;
+}
+
+static int _log_ring_format(type_log_ring_entry* pEntry, char* szOutput, int iMaxLength)
+{
+   if ( pEntry->header.uIsText )
+   {
+      strncpy(szOutput, pEntry->data, iMaxLength-1);
+      szOutput[iMaxLength-1] = 0;
+      return strlen(szOutput);
+   }
+
+   int iPos = 0;
+   int iArg = 0;
+   const char* p = pEntry->header.szFormat;
+   while ( (0 != *p) && (iPos < iMaxLength-1) )
+   {
+      if ( *p != '%' )
+      {
+         szOutput[iPos++] = *p++;
+         continue;
+      }
+      int iStars = 0;
+      int iType = -1;
+      int iLen = _log_ring_parse_spec(p, &iStars, &iType);
+      if ( iType < 0 )
+      {
+         szOutput[iPos++] = '%';
+         p += 2;
+         continue;
+      }
+      char szSpec[32];
+      if ( (iLen >= (int)sizeof(szSpec)) || (iArg + iStars >= pEntry->header.uArgsCount) )
+         break;
+      memcpy(szSpec, p, iLen);
+      szSpec[iLen] = 0;
+      p += iLen;
+
+      int iStarValues[2] = { 0, 0 };
+      for( int i=0; i<iStars; i++ )
+         iStarValues[i] = (int)(long long)pEntry->header.uArgs[iArg++];
+      int iWritten = _log_ring_format_arg(pEntry, szOutput + iPos, iMaxLength - iPos, szSpec, iStars, iStarValues, pEntry->header.uArgTypes[iArg], pEntry->header.uArgs[iArg]);
+      iArg++;
+      if ( iWritten < 0 )
+         break;
+      iPos += iWritten;
+      if ( iPos > iMaxLength-1 )
+         iPos = iMaxLength-1;
+   }
+   szOutput[iPos] = 0;
+   return iPos;
+}
+
+int log_ring_init()
+{
+   if ( NULL != s_pLogRingEntries )
+      return 1;
+   type_log_ring_entry* pEntries = (type_log_ring_entry*) malloc(LOG_RING_SLOTS * sizeof(type_log_ring_entry));
+   if ( NULL == pEntries )
+      return 0;
+   for( u32 u=0; u<LOG_RING_SLOTS; u++ )
+      pEntries[u].header.uSequence = u;
+   s_uLogRingHead = 0;
+   s_uLogRingTail = 0;
+   s_uLogRingDropped = 0;
+   _log_ring_load_static_ranges();
+   __atomic_store_n(&s_pLogRingEntries, pEntries, __ATOMIC_RELEASE);
+   return 1;
+}
+
+int log_ring_is_initialized()
+{
+   return (NULL != __atomic_load_n(&s_pLogRingEntries, __ATOMIC_ACQUIRE)) ? 1 : 0;
+}
+
+int log_ring_add(u32 uTimeMs, const char* szFormat, va_list args)
+{
+   type_log_ring_entry* pEntries = __atomic_load_n(&s_pLogRingEntries, __ATOMIC_ACQUIRE);
+   if ( (NULL == pEntries) || (NULL == szFormat) )
+      return 0;
+
+   type_log_ring_entry* pEntry = NULL;
+   u32 uPos = __atomic_load_n(&s_uLogRingHead, __ATOMIC_RELAXED);
+   while ( 1 )
+   {
+      pEntry = &pEntries[uPos & (LOG_RING_SLOTS-1)];
+      u32 uSequence = __atomic_load_n(&pEntry->header.uSequence, __ATOMIC_ACQUIRE);
+      int iDiff = (int)(uSequence - uPos);
+      if ( 0 == iDiff )
+      {
+         if ( __atomic_compare_exchange_n(&s_uLogRingHead, &uPos, uPos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+            break;
+      }
+      else if ( iDiff < 0 )
+      {
+         __atomic_add_fetch(&s_uLogRingDropped, 1, __ATOMIC_RELAXED);
+         return 0;
+      }
+      else
+         uPos = __atomic_load_n(&s_uLogRingHead, __ATOMIC_RELAXED);
+   }
+
+   pEntry->header.uTimeMs = uTimeMs;
+   _log_ring_store(pEntry, szFormat, args);
+   __atomic_store_n(&pEntry->header.uSequence, uPos+1, __ATOMIC_RELEASE);
+   return 1;
+}
+
+int log_ring_read(char* szOutput, int iMaxLength, u32* puTimeMs)
+{
+   type_log_ring_entry* pEntries = __atomic_load_n(&s_pLogRingEntries, __ATOMIC_ACQUIRE);
+   if ( (NULL == pEntries) || (NULL == szOutput) || (iMaxLength <= 0) )
+      return -1;
+   type_log_ring_entry* pEntry = &pEntries[s_uLogRingTail & (LOG_RING_SLOTS-1)];
+   if ( __atomic_load_n(&pEntry->header.uSequence, __ATOMIC_ACQUIRE) != s_uLogRingTail + 1 )
+      return -1;
+
+   if ( NULL != puTimeMs )
+      *puTimeMs = pEntry->header.uTimeMs;
+   int iLength = _log_ring_format(pEntry, szOutput, iMaxLength);
+   __atomic_store_n(&pEntry->header.uSequence, s_uLogRingTail + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+   s_uLogRingTail++;
+   return iLength;
+}
+
+int log_ring_get_count()
+{
+   return (int)(__atomic_load_n(&s_uLogRingHead, __ATOMIC_RELAXED) - s_uLogRingTail);
+}
+
+u32 log_ring_get_dropped_count()
+{
+   return __atomic_load_n(&s_uLogRingDropped, __ATOMIC_RELAXED);
+}
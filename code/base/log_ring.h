@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../base/base.h"
+#include <stdarg.h>
+
+// Per process ring of log entries, for the asynchronous log (see log_enable_async()).
+// The logging threads store only the format pointer and the raw arguments (lock-free, any number of
+// threads); the formatting is deferred to the single consumer (the log flusher thread).
+// Format strings that are not in the read-only memory of the executable (i.e. built at runtime) and the
+// string arguments are copied into the entry. Entries that can't be stored in binary form
+// (too many arguments, unsupported conversions, too long strings) are formatted right away,
+// truncated to the slot size (like the entries sent to the logger service).
+// When the ring is full the entry is dropped and counted.
+
+#define LOG_RING_SLOTS 512 // power of 2
+#define LOG_RING_SLOT_SIZE 512
+#define LOG_RING_MAX_ARGS 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int log_ring_init();
+int log_ring_is_initialized();
+
+// Producers. Returns 1 if the entry was stored, 0 if it was dropped (ring full)
+int log_ring_add(u32 uTimeMs, const char* szFormat, va_list args);
+
+// Consumer (single thread at a time). Formats the next entry into szOutput.
+// Returns the length of the formatted text, -1 if there are no entries.
+int log_ring_read(char* szOutput, int iMaxLength, u32* puTimeMs);
+
+int log_ring_get_count();
+u32 log_ring_get_dropped_count();
+
+#ifdef __cplusplus
+}
+#endif
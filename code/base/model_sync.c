@@ -0,0 +1,541 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <sys/stat.h>
+#include <utime.h>
+#include "base.h"
+#include "config.h"
+#include "model_sync.h"
+
+#define MODEL_SYNC_OP_COPY 0
+#define MODEL_SYNC_OP_SKIP 1
+#define MODEL_SYNC_OP_INSERT 2
+#define MODEL_SYNC_OP_PATCH 3
+#define MODEL_SYNC_MAX_OP_COUNT 64
+#define MODEL_SYNC_HEADER_SIZE (2*sizeof(u32) + sizeof(u16))
+// How far to look for the next common lines, when lines were added or removed
+#define MODEL_SYNC_LOOKAHEAD_LINES 16
+
+typedef struct
+{
+   u8* pText;
+   int iCount;
+   u16 uStart[MODEL_SYNC_MAX_LINES];
+   u8 uLength[MODEL_SYNC_MAX_LINES];
+} type_model_sync_lines;
+
+typedef struct
+{
+   u8* pOutput;
+   int iMaxLength;
+   int iLength;
+   int iLastOpPos;
+   int iLastOpType;
+   int iLastOpCount;
+   int iFailed;
+} type_model_sync_writer;
+
+u32 model_sync_get_hash(u8* pData, int iLength)
+{
+   return base_compute_crc32(pData, iLength);
+}
+
+// The text after the last line end is a line too, if it's not empty
+static int _model_sync_split_lines(u8* pText, int iLength, type_model_sync_lines* pLines)
+{
+   pLines->pText = pText;
+   pLines->iCount = 0;
+   if ( (iLength < 0) || (iLength > MODEL_SYNC_MAX_FILE_SIZE) )
+      return 0;
+   if ( (NULL == pText) && (iLength > 0) )
+      return 0;
+
+   int iStart = 0;
+   for( int i=0; i<=iLength; i++ )
+   {
+      if ( (i < iLength) && (pText[i] != '\n') )
+         continue;
+      if ( (i == iLength) && (i == iStart) )
+         break;
+      if ( (pLines->iCount >= MODEL_SYNC_MAX_LINES) || (i - iStart > MODEL_SYNC_MAX_LINE_LENGTH) )
+         return 0;
+      pLines->uStart[pLines->iCount] = (u16)iStart;
+      pLines->uLength[pLines->iCount] = (u8)(i - iStart);
+      pLines->iCount++;
+      iStart = i+1;
+   }
+   return 1;
+}
+
+static int _model_sync_lines_equal(type_model_sync_lines* pLinesA, int iLineA, type_model_sync_lines* pLinesB, int iLineB)
+{
+   if ( pLinesA->uLength[iLineA] != pLinesB->uLength[iLineB] )
+      return 0;
+   if ( 0 != memcmp(pLinesA->pText + pLinesA->uStart[iLineA], pLinesB->pText + pLinesB->uStart[iLineB], pLinesA->uLength[iLineA]) )
+      return 0;
+   return 1;
+}
+
+// Two common lines in a row (model files have many short lines with the same text, i.e. "0"),
+// or the last line of both files
+static int _model_sync_lines_resync(type_model_sync_lines* pLinesA, int iLineA, type_model_sync_lines* pLinesB, int iLineB)
+{
+   if ( (iLineA >= pLinesA->iCount) || (iLineB >= pLinesB->iCount) )
+      return 0;
+   if ( ! _model_sync_lines_equal(pLinesA, iLineA, pLinesB, iLineB) )
+      return 0;
+   if ( (iLineA+1 == pLinesA->iCount) && (iLineB+1 == pLinesB->iCount) )
+      return 1;
+   if ( (iLineA+1 >= pLinesA->iCount) || (iLineB+1 >= pLinesB->iCount) )
+      return 0;
+   return _model_sync_lines_equal(pLinesA, iLineA+1, pLinesB, iLineB+1);
+}
+
+static void _model_sync_add_bytes(type_model_sync_writer* pWriter, u8* pData, int iLength)
+{
+   if ( pWriter->iLength + iLength > pWriter->iMaxLength )
+   {
+      pWriter->iFailed = 1;
+      return;
+   }
+   memcpy(pWriter->pOutput + pWriter->iLength, pData, iLength);
+   pWriter->iLength += iLength;
+}
+
+// Consecutive ops of the same type are merged (the data of each line follows the data of the previous one)
+static void _model_sync_add_op(type_model_sync_writer* pWriter, int iOpType)
+{
+   if ( (pWriter->iLastOpPos >= 0) && (pWriter->iLastOpType == iOpType) && (pWriter->iLastOpCount < MODEL_SYNC_MAX_OP_COUNT) )
+   {
+      pWriter->iLastOpCount++;
+      pWriter->pOutput[pWriter->iLastOpPos] = (u8)((iOpType << 6) | (pWriter->iLastOpCount-1));
+      return;
+   }
+   u8 uOp = (u8)(iOpType << 6);
+   pWriter->iLastOpPos = pWriter->iLength;
+   pWriter->iLastOpType = iOpType;
+   pWriter->iLastOpCount = 1;
+   _model_sync_add_bytes(pWriter, &uOp, 1);
+   if ( pWriter->iFailed )
+      pWriter->iLastOpPos = -1;
+}
+
+static void _model_sync_add_insert(type_model_sync_writer* pWriter, type_model_sync_lines* pLines, int iLine)
+{
+   u8 uLength = pLines->uLength[iLine];
+   _model_sync_add_op(pWriter, MODEL_SYNC_OP_INSERT);
+   _model_sync_add_bytes(pWriter, &uLength, 1);
+   _model_sync_add_bytes(pWriter, pLines->pText + pLines->uStart[iLine], uLength);
+}
+
+static void _model_sync_add_patch(type_model_sync_writer* pWriter, type_model_sync_lines* pLinesBase, int iLineBase, type_model_sync_lines* pLinesTarget, int iLineTarget)
+{
+   u8* pBase = pLinesBase->pText + pLinesBase->uStart[iLineBase];
+   u8* pTarget = pLinesTarget->pText + pLinesTarget->uStart[iLineTarget];
+   int iLengthBase = pLinesBase->uLength[iLineBase];
+   int iLengthTarget = pLinesTarget->uLength[iLineTarget];
+
+   int iPrefix = 0;
+   while ( (iPrefix < iLengthBase) && (iPrefix < iLengthTarget) && (pBase[iPrefix] == pTarget[iPrefix]) )
+      iPrefix++;
+   int iSuffix = 0;
+   while ( (iSuffix < iLengthBase - iPrefix) && (iSuffix < iLengthTarget - iPrefix) && (pBase[iLengthBase-1-iSuffix] == pTarget[iLengthTarget-1-iSuffix]) )
+      iSuffix++;
+
+   u8 uHeader[3];
+   uHeader[0] = (u8)iPrefix;
+   uHeader[1] = (u8)iSuffix;
+   uHeader[2] = (u8)(iLengthTarget - iPrefix - iSuffix);
+   _model_sync_add_op(pWriter, MODEL_SYNC_OP_PATCH);
+   _model_sync_add_bytes(pWriter, uHeader, 3);
+   _model_sync_add_bytes(pWriter, pTarget + iPrefix, uHeader[2]);
+}
+
+int model_sync_encode_delta(u8* pBase, int iBaseLength, u8* pTarget, int iTargetLength, u8* pOutput, int iMaxLength)
+{
+   if ( (NULL == pOutput) || (iMaxLength < (int)MODEL_SYNC_HEADER_SIZE) )
+      return -1;
+
+   type_model_sync_lines linesBase;
+   type_model_sync_lines linesTarget;
+   if ( (! _model_sync_split_lines(pBase, iBaseLength, &linesBase)) || (! _model_sync_split_lines(pTarget, iTargetLength, &linesTarget)) )
+      return -1;
+
+   u32 uBaseHash = model_sync_get_hash(pBase, iBaseLength);
+   u32 uTargetHash = model_sync_get_hash(pTarget, iTargetLength);
+   u16 uTargetLength = (u16)iTargetLength;
+   memcpy(pOutput, &uBaseHash, sizeof(u32));
+   memcpy(pOutput + sizeof(u32), &uTargetHash, sizeof(u32));
+   memcpy(pOutput + 2*sizeof(u32), &uTargetLength, sizeof(u16));
+
+   type_model_sync_writer writer;
+   writer.pOutput = pOutput;
+   writer.iMaxLength = iMaxLength;
+   writer.iLength = MODEL_SYNC_HEADER_SIZE;
+   writer.iLastOpPos = -1;
+   writer.iLastOpType = -1;
+   writer.iLastOpCount = 0;
+   writer.iFailed = 0;
+
+   int iLineBase = 0;
+   int iLineTarget = 0;
+   while ( ((iLineBase < linesBase.iCount) || (iLineTarget < linesTarget.iCount)) && (! writer.iFailed) )
+   {
+      if ( (iLineBase < linesBase.iCount) && (iLineTarget < linesTarget.iCount) )
+      if ( _model_sync_lines_equal(&linesBase, iLineBase, &linesTarget, iLineTarget) )
+      {
+         _model_sync_add_op(&writer, MODEL_SYNC_OP_COPY);
+         iLineBase++;
+         iLineTarget++;
+         continue;
+      }
+      if ( iLineTarget >= linesTarget.iCount )
+      {
+         _model_sync_add_op(&writer, MODEL_SYNC_OP_SKIP);
+         iLineBase++;
+         continue;
+      }
+      if ( iLineBase >= linesBase.iCount )
+      {
+         _model_sync_add_insert(&writer, &linesTarget, iLineTarget);
+         iLineTarget++;
+         continue;
+      }
+
+      // Changed lines are more likely than added/removed ones (and model files have repeated groups of lines, i.e. camera profiles)
+      int iPatch = 1;
+      int iSkip = 0;
+      int iInsert = 0;
+      for( int i=1; i<=MODEL_SYNC_LOOKAHEAD_LINES; i++ )
+      {
+         if ( (iLineBase+i >= linesBase.iCount) || (iLineTarget+i >= linesTarget.iCount) || _model_sync_lines_resync(&linesBase, iLineBase+i, &linesTarget, iLineTarget+i) )
+         {
+            iPatch = i;
+            break;
+         }
+         if ( _model_sync_lines_resync(&linesBase, iLineBase+i, &linesTarget, iLineTarget) )
+         {
+            iSkip = i;
+            break;
+         }
+         if ( _model_sync_lines_resync(&linesBase, iLineBase, &linesTarget, iLineTarget+i) )
+         {
+            iInsert = i;
+            break;
+         }
+      }
+
+      if ( iSkip > 0 )
+      {
+         for( int i=0; i<iSkip; i++ )
+            _model_sync_add_op(&writer, MODEL_SYNC_OP_SKIP);
+         iLineBase += iSkip;
+      }
+      else if ( iInsert > 0 )
+      {
+         for( int i=0; i<iInsert; i++ )
+            _model_sync_add_insert(&writer, &linesTarget, iLineTarget+i);
+         iLineTarget += iInsert;
+      }
+      else
+      {
+         for( int i=0; i<iPatch; i++ )
+            _model_sync_add_patch(&writer, &linesBase, iLineBase+i, &linesTarget, iLineTarget+i);
+         iLineBase += iPatch;
+         iLineTarget += iPatch;
+      }
+   }
+
+   if ( writer.iFailed )
+      return -1;
+
+   // Check the delta before it's sent
+   u8* pCheck = (u8*) malloc(iTargetLength+1);
+   if ( NULL == pCheck )
+      return -1;
+   int iCheckLength = model_sync_apply_delta(pBase, iBaseLength, pOutput, writer.iLength, pCheck, iTargetLength+1);
+   free(pCheck);
+   if ( iCheckLength != iTargetLength )
+   {
+      log_softerror_and_alarm("[ModelSync] Failed to check the encoded delta (%d bytes).", writer.iLength);
+      return -1;
+   }
+   return writer.iLength;
+}
+
+// Each line gets a line end; the one after the last line is dropped if the file does not have it
+static int _model_sync_append(u8* pOutput, int* piLength, int iMaxLength, u8* pData, int iLength, int bLineEnd)
+{
+   if ( *piLength + iLength > iMaxLength )
+      return 0;
+   if ( iLength > 0 )
+      memcpy(pOutput + *piLength, pData, iLength);
+   *piLength += iLength;
+   if ( bLineEnd )
+   {
+      if ( *piLength < iMaxLength )
+         pOutput[*piLength] = '\n';
+      (*piLength)++;
+   }
+   return 1;
+}
+
+int model_sync_apply_delta(u8* pBase, int iBaseLength, u8* pDelta, int iDeltaLength, u8* pOutput, int iMaxLength)
+{
+   if ( (NULL == pDelta) || (NULL == pOutput) || (iDeltaLength < (int)MODEL_SYNC_HEADER_SIZE) )
+      return -1;
+
+   u32 uBaseHash = 0;
+   u32 uTargetHash = 0;
+   u16 uTargetLength = 0;
+   memcpy(&uBaseHash, pDelta, sizeof(u32));
+   memcpy(&uTargetHash, pDelta + sizeof(u32), sizeof(u32));
+   memcpy(&uTargetLength, pDelta + 2*sizeof(u32), sizeof(u16));
+   if ( ((int)uTargetLength > iMaxLength) || (uBaseHash != model_sync_get_hash(pBase, iBaseLength)) )
+      return -1;
+
+   type_model_sync_lines linesBase;
+   if ( ! _model_sync_split_lines(pBase, iBaseLength, &linesBase) )
+      return -1;
+
+   int iPos = MODEL_SYNC_HEADER_SIZE;
+   int iLine = 0;
+   int iLength = 0;
+   while ( iPos < iDeltaLength )
+   {
+      int iOpType = pDelta[iPos] >> 6;
+      int iCount = (pDelta[iPos] & 0x3F) + 1;
+      iPos++;
+      for( int i=0; i<iCount; i++ )
+      {
+         if ( iOpType == MODEL_SYNC_OP_INSERT )
+         {
+            if ( iPos + 1 > iDeltaLength )
+               return -1;
+            int iLineLength = pDelta[iPos];
+            if ( iPos + 1 + iLineLength > iDeltaLength )
+               return -1;
+            if ( ! _model_sync_append(pOutput, &iLength, iMaxLength, pDelta + iPos + 1, iLineLength, 1) )
+               return -1;
+            iPos += 1 + iLineLength;
+            continue;
+         }
+
+         if ( iLine >= linesBase.iCount )
+            return -1;
+         u8* pLine = linesBase.pText + linesBase.uStart[iLine];
+         int iLineLength = linesBase.uLength[iLine];
+         iLine++;
+
+         if ( iOpType == MODEL_SYNC_OP_COPY )
+         {
+            if ( ! _model_sync_append(pOutput, &iLength, iMaxLength, pLine, iLineLength, 1) )
+               return -1;
+         }
+         else if ( iOpType == MODEL_SYNC_OP_PATCH )
+         {
+            if ( iPos + 3 > iDeltaLength )
+               return -1;
+            int iPrefix = pDelta[iPos];
+            int iSuffix = pDelta[iPos+1];
+            int iMiddle = pDelta[iPos+2];
+            if ( (iPrefix + iSuffix > iLineLength) || (iPos + 3 + iMiddle > iDeltaLength) )
+               return -1;
+            if ( ! _model_sync_append(pOutput, &iLength, iMaxLength, pLine, iPrefix, 0) )
+               return -1;
+            if ( ! _model_sync_append(pOutput, &iLength, iMaxLength, pDelta + iPos + 3, iMiddle, 0) )
+               return -1;
+            if ( ! _model_sync_append(pOutput, &iLength, iMaxLength, pLine + iLineLength - iSuffix, iSuffix, 1) )
+               return -1;
+            iPos += 3 + iMiddle;
+         }
+      }
+   }
+
+   if ( (iLine != linesBase.iCount) || (iLength < (int)uTargetLength) )
+      return -1;
+   iLength = uTargetLength;
+   if ( model_sync_get_hash(pOutput, iLength) != uTargetHash )
+      return -1;
+   return iLength;
+}
+
+u32 model_sync_get_delta_base_hash(u8* pDelta, int iDeltaLength)
+{
+   u32 uBaseHash = 0;
+   if ( (NULL != pDelta) && (iDeltaLength >= (int)MODEL_SYNC_HEADER_SIZE) )
+      memcpy(&uBaseHash, pDelta, sizeof(u32));
+   return uBaseHash;
+}
+
+int model_sync_read_file(const char* szFile, u8* pOutput, int iMaxLength)
+{
+   if ( (NULL == szFile) || (NULL == pOutput) )
+      return -1;
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return -1;
+   int iLength = (int)fread(pOutput, 1, iMaxLength, fd);
+   // Larger files are not supported
+   if ( (iLength == iMaxLength) && (EOF != fgetc(fd)) )
+      iLength = -1;
+   fclose(fd);
+   return iLength;
+}
+
+static int _model_sync_write_file(const char* szFile, u8* pData, int iLength)
+{
+   FILE* fd = fopen(szFile, "wb");
+   if ( NULL == fd )
+   {
+      log_softerror_and_alarm("[ModelSync] Failed to write file [%s].", szFile);
+      return 0;
+   }
+   int iWritten = (int)fwrite(pData, 1, iLength, fd);
+   fclose(fd);
+   if ( iWritten != iLength )
+   {
+      log_softerror_and_alarm("[ModelSync] Failed to write file [%s] (%d of %d bytes written).", szFile, iWritten, iLength);
+      unlink(szFile);
+      return 0;
+   }
+   return 1;
+}
+
+static void _model_sync_get_sent_base_file_name(int iIndex, char* szFile)
+{
+   char szFormat[MAX_FILE_PATH_SIZE];
+   strcpy(szFormat, FOLDER_CONFIG);
+   strcat(szFormat, FILE_CONFIG_MODEL_SYNC_SENT_BASE);
+   sprintf(szFile, szFormat, iIndex);
+}
+
+static void _model_sync_get_received_base_file_name(u32 uVehicleId, char* szFile)
+{
+   char szFormat[MAX_FILE_PATH_SIZE];
+   strcpy(szFormat, FOLDER_CONFIG);
+   strcat(szFormat, FILE_CONFIG_MODEL_SYNC_RECEIVED_BASE);
+   sprintf(szFile, szFormat, uVehicleId);
+}
+
+// Returns the index of the sent base with the given hash, -1 if it's not found
+static int _model_sync_find_sent_base(u32 uHash, u8* pBuffer, int iMaxLength, int* piLength)
+{
+   char szFile[MAX_FILE_PATH_SIZE];
+   for( int i=0; i<MODEL_SYNC_MAX_SENT_BASES; i++ )
+   {
+      _model_sync_get_sent_base_file_name(i, szFile);
+      int iLength = model_sync_read_file(szFile, pBuffer, iMaxLength);
+      if ( (iLength < 0) || (model_sync_get_hash(pBuffer, iLength) != uHash) )
+         continue;
+      if ( NULL != piLength )
+         *piLength = iLength;
+      return i;
+   }
+   return -1;
+}
+
+void model_sync_save_sent_base(u8* pData, int iLength)
+{
+   if ( (NULL == pData) || (iLength <= 0) || (iLength > MODEL_SYNC_MAX_FILE_SIZE) )
+      return;
+   u8* pBuffer = (u8*) malloc(MODEL_SYNC_MAX_FILE_SIZE);
+   if ( NULL == pBuffer )
+      return;
+
+   char szFile[MAX_FILE_PATH_SIZE];
+   u32 uHash = model_sync_get_hash(pData, iLength);
+   int iIndex = _model_sync_find_sent_base(uHash, pBuffer, MODEL_SYNC_MAX_FILE_SIZE, NULL);
+   free(pBuffer);
+   if ( iIndex >= 0 )
+   {
+      // Keep it as the most recent one
+      _model_sync_get_sent_base_file_name(iIndex, szFile);
+      utime(szFile, NULL);
+      return;
+   }
+
+   // Replace the oldest one
+   iIndex = 0;
+   time_t timeOldest = 0;
+   for( int i=0; i<MODEL_SYNC_MAX_SENT_BASES; i++ )
+   {
+      struct stat statFile;
+      _model_sync_get_sent_base_file_name(i, szFile);
+      if ( 0 != stat(szFile, &statFile) )
+      {
+         iIndex = i;
+         break;
+      }
+      if ( (0 == i) || (statFile.st_mtime < timeOldest) )
+      {
+         iIndex = i;
+         timeOldest = statFile.st_mtime;
+      }
+   }
+   _model_sync_get_sent_base_file_name(iIndex, szFile);
+   if ( _model_sync_write_file(szFile, pData, iLength) )
+      log_line("[ModelSync] Saved sent model settings version %08X (%d bytes) as base %d.", uHash, iLength, iIndex);
+}
+
+int model_sync_load_sent_base(u32 uHash, u8* pOutput, int iMaxLength)
+{
+   if ( NULL == pOutput )
+      return -1;
+   int iLength = -1;
+   if ( _model_sync_find_sent_base(uHash, pOutput, iMaxLength, &iLength) < 0 )
+      return -1;
+   return iLength;
+}
+
+void model_sync_save_received_base(u32 uVehicleId, u8* pData, int iLength)
+{
+   if ( (NULL == pData) || (iLength <= 0) || (iLength > MODEL_SYNC_MAX_FILE_SIZE) )
+      return;
+   char szFile[MAX_FILE_PATH_SIZE];
+   _model_sync_get_received_base_file_name(uVehicleId, szFile);
+   if ( _model_sync_write_file(szFile, pData, iLength) )
+      log_line("[ModelSync] Saved received model settings version %08X (%d bytes) for VID %u.", model_sync_get_hash(pData, iLength), iLength, uVehicleId);
+}
+
+int model_sync_load_received_base(u32 uVehicleId, u8* pOutput, int iMaxLength)
+{
+   char szFile[MAX_FILE_PATH_SIZE];
+   _model_sync_get_received_base_file_name(uVehicleId, szFile);
+   return model_sync_read_file(szFile, pOutput, iMaxLength);
+}
+
+void model_sync_delete_received_base(u32 uVehicleId)
+{
+   char szFile[MAX_FILE_PATH_SIZE];
+   _model_sync_get_received_base_file_name(uVehicleId, szFile);
+   unlink(szFile);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../base/base.h"
+
+// Model settings sync: the vehicle sends to the controller only the changes of its model file
+// against a version of the file the controller already has (the base), identified by its hash (CRC32).
+// The controller sends the hash of its base with the COMMAND_ID_GET_ALL_PARAMS_ZIP command; if the vehicle
+// still has that version of the file (it keeps the last MODEL_SYNC_MAX_SENT_BASES versions it sent),
+// it replies with a delta, otherwise with the full (tar+gzip) model file, as before.
+//
+// The delta is computed on the lines of the text model file (one setting or group of settings on each line):
+//   header: u32 base hash, u32 target hash, u16 target length
+//   ops: one byte: bits 6..7 the op type, bits 0..5 the count of lines - 1, followed by the op data:
+//      copy   - the next count lines of the base are unchanged;
+//      skip   - the next count lines of the base are removed;
+//      insert - count new lines, each: u8 length, text (without the line end);
+//      patch  - the next count lines of the base changed, each: u8 length of the unchanged start,
+//               u8 length of the unchanged end, u8 length of the new text in between, new text.
+// The rebuilt file must have the target hash, otherwise the delta is rejected.
+
+#define MODEL_SYNC_MAX_FILE_SIZE 16000
+#define MODEL_SYNC_MAX_LINES 1024
+#define MODEL_SYNC_MAX_LINE_LENGTH 255
+#define MODEL_SYNC_MAX_SENT_BASES 4
+// Larger deltas are not worth it (the compressed full model file is about this size)
+#define MODEL_SYNC_MAX_DELTA_SIZE 600
+
+#define MODEL_SYNC_REQUEST_MAGIC 0x4D535943
+// command_response_param of a COMMAND_ID_GET_ALL_PARAMS_ZIP response with a delta (1: tar+gzip model file)
+#define MODEL_SYNC_RESPONSE_PARAM_DELTA 2
+
+// Extra data of the COMMAND_ID_GET_ALL_PARAMS_ZIP command, sent by controllers that can apply deltas
+typedef struct
+{
+   u32 uMagic;
+   u32 uBaseHash; // 0: the controller has no base for this vehicle
+} __attribute__((packed)) t_model_sync_request;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+u32 model_sync_get_hash(u8* pData, int iLength);
+
+// Returns the length of the delta, -1 if it can't be encoded or it's larger than iMaxLength
+int model_sync_encode_delta(u8* pBase, int iBaseLength, u8* pTarget, int iTargetLength, u8* pOutput, int iMaxLength);
+// Returns the length of the rebuilt file, -1 if the delta is invalid or it's not for this base
+int model_sync_apply_delta(u8* pBase, int iBaseLength, u8* pDelta, int iDeltaLength, u8* pOutput, int iMaxLength);
+u32 model_sync_get_delta_base_hash(u8* pDelta, int iDeltaLength);
+
+// Returns the file length, -1 on failure
+int model_sync_read_file(const char* szFile, u8* pOutput, int iMaxLength);
+
+// Vehicle: the versions of the model file sent to the controller
+void model_sync_save_sent_base(u8* pData, int iLength);
+// Returns the length of the base with the given hash, -1 if it's not found
+int model_sync_load_sent_base(u32 uHash, u8* pOutput, int iMaxLength);
+
+// Controller: the last model file received from each vehicle
+void model_sync_save_received_base(u32 uVehicleId, u8* pData, int iLength);
+int model_sync_load_received_base(u32 uVehicleId, u8* pOutput, int iMaxLength);
+void model_sync_delete_received_base(u32 uVehicleId);
+
+#ifdef __cplusplus
+}
+#endif
@@ -45,6 +45,9 @@
 #include "../common/string_utils.h"
 #include "../radio/radiopackets2.h"
 #include "../radio/radiolink.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define MODEL_FILE_STAMP_ID "vVIII.3stamp"
 
@@ -184,6 +187,7 @@ Model::Model(void)
    memset((u8*)&m_Stats, 0, sizeof(type_vehicle_stats_info));
 
    iSaveCount = 0;
+   memset((u8*)&m_LoadedFileSignature, 0, sizeof(type_model_file_signature));
    b_mustSyncFromVehicle = false;
    iCameraCount = 0;
    iCurrentCamera = -1;
@@ -229,25 +233,335 @@ bool Model::isRunningOnOpenIPCHardware()
    return false;
 }
 
+// Binary copy of the model file: the in memory structures of the model, as sections (u32 size + data),
+// after a header. It's valid only for the software version that wrote it (same structures) and for the
+// text model file it was written for (the header has the text file signature); otherwise the text file
+// is loaded and the binary file is written again.
+
+#define MODEL_BINARY_FILE_MAGIC 0x42444D52
+#define MODEL_BINARY_FILE_FORMAT_VERSION 1
+#define MODEL_BINARY_FILE_MAX_SECTIONS 40
+#define MODEL_BINARY_FILE_MAX_SIZE (256*1024)
+// Modification times of files can have 1 second (or worse) granularity
+#define MODEL_FILE_MTIME_GRANULARITY_SEC 2
+
+typedef struct
+{
+   u32 uMagic;
+   u32 uFormatVersion;
+   u32 uSoftwareVersion; // of the process that wrote the file
+   u32 uTotalSize;
+   u32 uSectionsCount;
+   u32 uSaveCount;
+   type_model_file_signature textFileSignature;
+   u32 uCRC; // of everything after the header
+   u32 uReserved;
+} type_model_binary_file_header;
+
+#define MODEL_BINARY_SECTION(member) \
+   { pSections[iCount] = (u8*)&(member); puSizes[iCount] = sizeof(member); iCount++; }
+
+static u32 _model_get_current_sw_version()
+{
+   return (SYSTEM_SW_VERSION_MAJOR * 256 + SYSTEM_SW_VERSION_MINOR) | (SYSTEM_SW_BUILD_NUMBER<<16);
+}
+
+static void _model_get_binary_file_name(const char* szFileName, char* szOutput)
+{
+   strcpy(szOutput, szFileName);
+   int iLen = strlen(szOutput);
+   if ( iLen > 3 )
+      strcpy(szOutput + iLen - 3, "mdb");
+   else
+      strcat(szOutput, ".mdb");
+}
+
+static bool _model_get_file_signature(const char* szFileName, type_model_file_signature* pSignature)
+{
+   struct stat statFile;
+   memset(pSignature, 0, sizeof(type_model_file_signature));
+   if ( 0 != stat(szFileName, &statFile) )
+      return false;
+   pSignature->uSize = (u64)statFile.st_size;
+   pSignature->uInode = (u64)statFile.st_ino;
+   pSignature->iMTimeSec = (long long)statFile.st_mtim.tv_sec;
+   pSignature->iMTimeNsec = (long long)statFile.st_mtim.tv_nsec;
+   return true;
+}
+
+static bool _model_is_valid_binary_file_header(type_model_binary_file_header* pHeader, type_model_file_signature* pTextFileSignature)
+{
+   if ( (pHeader->uMagic != MODEL_BINARY_FILE_MAGIC) || (pHeader->uFormatVersion != MODEL_BINARY_FILE_FORMAT_VERSION) )
+      return false;
+   if ( pHeader->uSoftwareVersion != _model_get_current_sw_version() )
+      return false;
+   if ( 0 != memcmp(&pHeader->textFileSignature, pTextFileSignature, sizeof(type_model_file_signature)) )
+      return false;
+   return true;
+}
+
+// Returns the save counter of the model file, -1 on failure. Uses the binary file header, if it's valid
+static int _model_read_save_count(const char* szFileName, type_model_file_signature* pSignature)
+{
+   char szFileBinary[MAX_FILE_PATH_SIZE];
+   _model_get_binary_file_name(szFileName, szFileBinary);
+   int fd = open(szFileBinary, O_RDONLY);
+   if ( fd >= 0 )
+   {
+      type_model_binary_file_header header;
+      int iRead = read(fd, &header, sizeof(header));
+      close(fd);
+      if ( (iRead == (int)sizeof(header)) && _model_is_valid_binary_file_header(&header, pSignature) )
+         return (int)header.uSaveCount;
+   }
+
+   FILE* pFile = fopen(szFileName, "r");
+   if ( NULL == pFile )
+      return -1;
+   // Version line, stamp line, save counter line
+   int iVersion = 0, iSaveCountFile = -1;
+   if ( 1 == fscanf(pFile, "%*s %d", &iVersion) )
+   if ( 0 == fscanf(pFile, "%*s") )
+   if ( 1 != fscanf(pFile, "%*s %d", &iSaveCountFile) )
+      iSaveCountFile = -1;
+   fclose(pFile);
+   return iSaveCountFile;
+}
+
+int Model::getBinaryFileSections(u8** pSections, u32* puSizes)
+{
+   int iCount = 0;
+   MODEL_BINARY_SECTION(bDeveloperMode);
+   MODEL_BINARY_SECTION(uDeveloperFlags);
+   MODEL_BINARY_SECTION(uModelFlags);
+   MODEL_BINARY_SECTION(hwCapabilities);
+   MODEL_BINARY_SECTION(vehicle_name);
+   MODEL_BINARY_SECTION(uVehicleId);
+   MODEL_BINARY_SECTION(uControllerId);
+   MODEL_BINARY_SECTION(sw_version);
+   MODEL_BINARY_SECTION(is_spectator);
+   MODEL_BINARY_SECTION(vehicle_type);
+   MODEL_BINARY_SECTION(rxtx_sync_type);
+   MODEL_BINARY_SECTION(alarms);
+   MODEL_BINARY_SECTION(m_iRadioInterfacesGraphRefreshInterval);
+   MODEL_BINARY_SECTION(hardwareInterfacesInfo);
+   MODEL_BINARY_SECTION(processesPriorities);
+   MODEL_BINARY_SECTION(radioInterfacesParams);
+   MODEL_BINARY_SECTION(radioLinksParams);
+   MODEL_BINARY_SECTION(loggingParams);
+   MODEL_BINARY_SECTION(enableDHCP);
+   MODEL_BINARY_SECTION(camera_rc_channels);
+   MODEL_BINARY_SECTION(enc_flags);
+   MODEL_BINARY_SECTION(m_Stats);
+   MODEL_BINARY_SECTION(iGPSCount);
+   MODEL_BINARY_SECTION(camera_params);
+   MODEL_BINARY_SECTION(iCameraCount);
+   MODEL_BINARY_SECTION(iCurrentCamera);
+   MODEL_BINARY_SECTION(video_params);
+   MODEL_BINARY_SECTION(video_link_profiles);
+   MODEL_BINARY_SECTION(osd_params);
+   MODEL_BINARY_SECTION(rc_params);
+   MODEL_BINARY_SECTION(telemetry_params);
+   MODEL_BINARY_SECTION(audio_params);
+   MODEL_BINARY_SECTION(functions_params);
+   MODEL_BINARY_SECTION(relay_params);
+   MODEL_BINARY_SECTION(alarms_params);
+   return iCount;
+}
+
+bool Model::loadFromBinaryFile(const char* filename)
+{
+   type_model_file_signature signature;
+   if ( ! _model_get_file_signature(filename, &signature) )
+      return false;
+
+   char szFileBinary[MAX_FILE_PATH_SIZE];
+   _model_get_binary_file_name(filename, szFileBinary);
+   int fd = open(szFileBinary, O_RDONLY);
+   if ( fd < 0 )
+      return false;
+
+   struct stat statFile;
+   if ( (0 != fstat(fd, &statFile)) || (statFile.st_size < (off_t)sizeof(type_model_binary_file_header)) || (statFile.st_size > MODEL_BINARY_FILE_MAX_SIZE) )
+   {
+      close(fd);
+      return false;
+   }
+   int iSize = (int)statFile.st_size;
+   u8* pBuffer = (u8*) malloc(iSize);
+   if ( NULL == pBuffer )
+   {
+      close(fd);
+      return false;
+   }
+   int iRead = read(fd, pBuffer, iSize);
+   close(fd);
+
+   type_model_binary_file_header* pHeader = (type_model_binary_file_header*)pBuffer;
+   bool bValid = (iRead == iSize);
+   if ( bValid )
+      bValid = _model_is_valid_binary_file_header(pHeader, &signature);
+   if ( bValid )
+      bValid = (pHeader->uTotalSize == (u32)iSize) && (pHeader->uCRC == base_compute_crc32(pBuffer + sizeof(type_model_binary_file_header), iSize - (int)sizeof(type_model_binary_file_header)));
+
+   u8* pSections[MODEL_BINARY_FILE_MAX_SECTIONS];
+   u32 uSizes[MODEL_BINARY_FILE_MAX_SECTIONS];
+   int iCountSections = getBinaryFileSections(pSections, uSizes);
+   if ( bValid )
+      bValid = (pHeader->uSectionsCount == (u32)iCountSections);
+
+   // Check all the sections before changing the model
+   int iPos = sizeof(type_model_binary_file_header);
+   for( int i=0; bValid && (i<iCountSections); i++ )
+   {
+      u32 uSize = 0;
+      if ( iPos + (int)sizeof(u32) > iSize )
+      {
+         bValid = false;
+         break;
+      }
+      memcpy(&uSize, pBuffer + iPos, sizeof(u32));
+      if ( (uSize != uSizes[i]) || (iPos + (int)sizeof(u32) + (int)uSize > iSize) )
+         bValid = false;
+      iPos += sizeof(u32) + uSize;
+   }
+
+   if ( ! bValid )
+   {
+      log_line("Model binary file %s is invalid or out of date.", szFileBinary);
+      free(pBuffer);
+      return false;
+   }
+
+   iPos = sizeof(type_model_binary_file_header);
+   for( int i=0; i<iCountSections; i++ )
+   {
+      memcpy(pSections[i], pBuffer + iPos + sizeof(u32), uSizes[i]);
+      iPos += sizeof(u32) + uSizes[i];
+   }
+   iSaveCount = (int)pHeader->uSaveCount;
+   free(pBuffer);
+
+   vehicle_name[MAX_VEHICLE_NAME_LENGTH-1] = 0;
+   if ( hardware_is_vehicle() )
+      sw_version = _model_get_current_sw_version();
+   return true;
+}
+
+bool Model::saveToBinaryFile(const char* filename)
+{
+   type_model_file_signature signature;
+   if ( ! _model_get_file_signature(filename, &signature) )
+      return false;
+
+   u8* pSections[MODEL_BINARY_FILE_MAX_SECTIONS];
+   u32 uSizes[MODEL_BINARY_FILE_MAX_SECTIONS];
+   int iCountSections = getBinaryFileSections(pSections, uSizes);
+   int iSize = sizeof(type_model_binary_file_header);
+   for( int i=0; i<iCountSections; i++ )
+      iSize += sizeof(u32) + uSizes[i];
+
+   u8* pBuffer = (u8*) malloc(iSize);
+   if ( NULL == pBuffer )
+      return false;
+
+   int iPos = sizeof(type_model_binary_file_header);
+   for( int i=0; i<iCountSections; i++ )
+   {
+      memcpy(pBuffer + iPos, &uSizes[i], sizeof(u32));
+      memcpy(pBuffer + iPos + sizeof(u32), pSections[i], uSizes[i]);
+      iPos += sizeof(u32) + uSizes[i];
+   }
+
+   type_model_binary_file_header* pHeader = (type_model_binary_file_header*)pBuffer;
+   memset(pHeader, 0, sizeof(type_model_binary_file_header));
+   pHeader->uMagic = MODEL_BINARY_FILE_MAGIC;
+   pHeader->uFormatVersion = MODEL_BINARY_FILE_FORMAT_VERSION;
+   pHeader->uSoftwareVersion = _model_get_current_sw_version();
+   pHeader->uTotalSize = (u32)iSize;
+   pHeader->uSectionsCount = (u32)iCountSections;
+   pHeader->uSaveCount = (u32)iSaveCount;
+   memcpy(&pHeader->textFileSignature, &signature, sizeof(type_model_file_signature));
+   pHeader->uCRC = base_compute_crc32(pBuffer + sizeof(type_model_binary_file_header), iSize - (int)sizeof(type_model_binary_file_header));
+
+   // Write it to a temporary file and rename it, so that other processes never see a partial file
+   char szFileBinary[MAX_FILE_PATH_SIZE];
+   char szFileTmp[MAX_FILE_PATH_SIZE+16];
+   _model_get_binary_file_name(filename, szFileBinary);
+   snprintf(szFileTmp, sizeof(szFileTmp), "%s.%d", szFileBinary, (int)getpid());
+
+   bool bOk = false;
+   int fd = open(szFileTmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if ( fd >= 0 )
+   {
+      bOk = (write(fd, pBuffer, iSize) == iSize);
+      close(fd);
+      if ( bOk )
+         bOk = (0 == rename(szFileTmp, szFileBinary));
+      if ( ! bOk )
+         unlink(szFileTmp);
+   }
+   free(pBuffer);
+   if ( ! bOk )
+      log_line("Failed to write model binary file: %s", szFileBinary);
+   return bOk;
+}
+
 bool Model::reloadIfChanged(bool bLoadStats)
 {
    char szFile[MAX_FILE_PATH_SIZE];
    strcpy(szFile, FOLDER_CONFIG);
    strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL);
-   FILE* fd = fopen(szFile, "r");
+   return reloadFromFileIfChanged(szFile, bLoadStats);
+}
+
+bool Model::reloadFromFileIfChanged(const char* filename, bool bLoadStats)
+{
+   type_model_file_signature signature;
+   if ( ! _model_get_file_signature(filename, &signature) )
+      return false;
+
+   // Same file as the one loaded/saved and old enough for the modification time to be reliable
+   if ( 0 == memcmp(&signature, &m_LoadedFileSignature, sizeof(type_model_file_signature)) )
+   if ( signature.iMTimeSec + MODEL_FILE_MTIME_GRANULARITY_SEC < (long long)time(NULL) )
+      return true;
+
+   int iSaveCountFile = _model_read_save_count(filename, &signature);
+   if ( (iSaveCountFile < 0) || (iSaveCountFile == iSaveCount) )
+   {
+      if ( iSaveCountFile >= 0 )
+         memcpy(&m_LoadedFileSignature, &signature, sizeof(type_model_file_signature));
+      return true;
+   }
+   return loadFromFile(filename, bLoadStats);
+}
+
+bool Model::loadFromTextFile(const char* filename)
+{
+   FILE* fd = fopen(filename, "r");
    if ( NULL == fd )
       return false;
 
-   int iV, iS = 0;
-   if ( 1 == fscanf(fd, "%*s %d", &iV) )
-   if ( 1 == fscanf(fd, "%*s %d", &iS) )
-   if ( iS != iSaveCount )
+   bool bLoadedOk = false;
+   int iVersion = 0;
+   if ( 1 != fscanf(fd, "%*s %d", &iVersion) )
+      log_softerror_and_alarm("Load model: Error on version line. Invalid vehicle configuration file: %s", filename);
+   else
    {
-      fclose(fd);
-      return loadFromFile(szFile, bLoadStats);
+      //log_line("Found model file version: %d.", iVersion);
+      if ( 8 == iVersion )
+         bLoadedOk = loadVersion8(fd);
+      if ( 9 == iVersion )
+         bLoadedOk = loadVersion9(fd);
+      if ( 10 == iVersion )
+         bLoadedOk = loadVersion10(fd);
+      if ( bLoadedOk )
+         iLoadedFileVersion = iVersion;
+      else
+         log_softerror_and_alarm("Invalid vehicle configuration file: %s", filename);
    }
    fclose(fd);
-   return true;
+   return bLoadedOk;
 }
 
 bool Model::loadFromFile(const char* filename, bool bLoadStats)
@@ -263,45 +577,30 @@ bool Model::loadFromFile(const char* filename, bool bLoadStats)
 
    bool bMainFileLoadedOk = false;
    bool bBackupFileLoadedOk = false;
+   bool bLoadedFromBinary = false;
 
    type_vehicle_stats_info stats;
    memcpy((u8*)&stats, (u8*)&m_Stats, sizeof(type_vehicle_stats_info));
 
    u32 timeStart = get_current_timestamp_ms();
 
-   int iVersionMain = 0;
-   int iVersionBackup = 0;
-   FILE* fd = fopen(szFileNormal, "r");
-   if ( NULL != fd )
+   if ( loadFromBinaryFile(szFileNormal) )
    {
-      if ( 1 != fscanf(fd, "%*s %d", &iVersionMain) )
-      {
-         log_softerror_and_alarm("Load model: Error on version line. Invalid vehicle configuration file: %s", szFileNormal);
-         bMainFileLoadedOk = false;
-      }
-      else
-      {
-         //log_line("Found model file version: %d.", iVersion);
-         if ( 8 == iVersionMain )
-            bMainFileLoadedOk = loadVersion8(fd);
-         if ( 9 == iVersionMain )
-            bMainFileLoadedOk = loadVersion9(fd);
-         if ( 10 == iVersionMain )
-            bMainFileLoadedOk = loadVersion10(fd);
-         if ( bMainFileLoadedOk )
-         {
-            iLoadedFileVersion = iVersionMain;
-         }
-         else
-            log_softerror_and_alarm("Invalid vehicle configuration file: %s",szFileNormal);
-      }
-      fclose(fd);
+      bMainFileLoadedOk = true;
+      bLoadedFromBinary = true;
+      iLoadedFileVersion = 10;
    }
    else
-      bMainFileLoadedOk = false;
+   {
+      bMainFileLoadedOk = loadFromTextFile(szFileNormal);
+      // Text only model file (or written by a different software version): add the binary copy of it
+      if ( bMainFileLoadedOk )
+         saveToBinaryFile(szFileNormal);
+   }
 
    if ( bMainFileLoadedOk )
    {
+      _model_get_file_signature(szFileNormal, &m_LoadedFileSignature);
       if ( ! bLoadStats ) 
          memcpy((u8*)&m_Stats, (u8*)&stats, sizeof(type_vehicle_stats_info));
       validate_settings();
@@ -316,43 +615,15 @@ bool Model::loadFromFile(const char* filename, bool bLoadStats)
       //log_line("Loaded vehicle successfully (%u ms) from file: %s; version %d, save count: %d, vehicle name: [%s], vehicle id: %u, software: %d.%d (b%d), is in control mode: %s, is in developer mode: %s, %d radio links, 1st link: %s, 2nd link: %s, 3rd link: %s",
       // timeStart, filename, iLoadedFileVersion, iSaveCount, vehicle_name, uVehicleId, (sw_version >> 8) & 0xFF, sw_version & 0xFF, sw_version>>16, is_spectator?"no (is spectator)":"yes", (bDeveloperMode?"yes":"no"), radioLinksParams.links_count, szFreq1, szFreq2, szFreq3);
 
-      log_line("Loaded vehicle (%s) successfully from file: %s; name: [%s], VID: %u, software: %d.%d (b%d), on time: %02d:%02d",
+      log_line("Loaded vehicle (%s) successfully from file: %s (%s); name: [%s], VID: %u, software: %d.%d (b%d), on time: %02d:%02d",
          bLoadStats?"with stats":"without stats",
-         filename, vehicle_name, uVehicleId, (sw_version >> 8) & 0xFF, sw_version & 0xFF, sw_version>>16,
+         filename, bLoadedFromBinary?"binary":"text", vehicle_name, uVehicleId, (sw_version >> 8) & 0xFF, sw_version & 0xFF, sw_version>>16,
          m_Stats.uCurrentOnTime/60, m_Stats.uCurrentOnTime%60);
       constructLongName();
       return true;
    }
 
-
-   fd = fopen(szFileBackup, "r");
-   if ( NULL != fd )
-   {
-      if ( 1 != fscanf(fd, "%*s %d", &iVersionBackup) )
-      {
-         log_softerror_and_alarm("Load model: Error on version line. Invalid vehicle configuration file: %s", szFileBackup);
-         bBackupFileLoadedOk = false;
-      }
-      else
-      {
-         //log_line("Found model file version: %d.", iVersion);
-         if ( 8 == iVersionBackup )
-            bBackupFileLoadedOk = loadVersion8(fd);
-         if ( 9 == iVersionBackup )
-            bBackupFileLoadedOk = loadVersion9(fd);
-         if ( 10 == iVersionBackup )
-            bBackupFileLoadedOk = loadVersion10(fd);
-         if ( bBackupFileLoadedOk )
-         {
-            iLoadedFileVersion = iVersionBackup;
-         }
-         else
-            log_softerror_and_alarm("Invalid vehicle configuration file: %s",szFileBackup);
-      }
-      fclose(fd);
-   }
-   else
-      bBackupFileLoadedOk = false;
+   bBackupFileLoadedOk = loadFromTextFile(szFileBackup);
 
    if ( !bBackupFileLoadedOk )
    {
@@ -372,12 +643,14 @@ bool Model::loadFromFile(const char* filename, bool bLoadStats)
 
    constructLongName();
    
-   fd = fopen(szFileNormal, "w");
+   FILE* fd = fopen(szFileNormal, "w");
    if ( NULL != fd )
    {
       saveVersion10(fd, false);
       fclose(fd);
       log_line("Restored main model file from backup model file.");
+      saveToBinaryFile(szFileNormal);
+      _model_get_file_signature(szFileNormal, &m_LoadedFileSignature);
    }
    else
       log_softerror_and_alarm("Failed to write main model file from backup model file.");
@@ -2202,6 +2475,9 @@ bool Model::saveToFile(const char* filename, bool isOnController)
       fclose(fd);
    }
 
+   saveToBinaryFile(filename);
+   _model_get_file_signature(filename, &m_LoadedFileSignature);
+
    /*
    timeStart = get_current_timestamp_ms() - timeStart;
    char szLog[512];
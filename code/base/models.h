@@ -460,6 +460,15 @@ typedef struct
    u32 dummyhwc2[3];
 } type_hardware_capabilities;
 
+// Identifies a version of a model file on disk (without reading it)
+typedef struct
+{
+   u64 uSize;
+   u64 uInode;
+   long long iMTimeSec;
+   long long iMTimeNsec;
+} type_model_file_signature;
+
 class Model
 {
    public:
@@ -546,8 +555,13 @@ class Model
       type_alarms_parameters alarms_params;
 
       bool reloadIfChanged(bool bLoadStats);
+      bool reloadFromFileIfChanged(const char* filename, bool bLoadStats);
       bool loadFromFile(const char* filename, bool bLoadStats = false);
       bool saveToFile(const char* filename, bool isOnController);
+      bool loadFromTextFile(const char* filename);
+      // Binary copy of a model file (<file>.mdb), written next to the text file when saving it
+      bool loadFromBinaryFile(const char* filename);
+      bool saveToBinaryFile(const char* filename);
       int  getLoadedFileVersion();
       bool isRunningOnOpenIPCHardware();
       void populateHWInfo();
@@ -644,12 +658,14 @@ class Model
       char vehicle_long_name[256];
       int iLoadedFileVersion;
       int iSaveCount;
+      type_model_file_signature m_LoadedFileSignature;
 
       void generateUID();
       bool loadVersion8(FILE* fd);
       bool loadVersion9(FILE* fd); // from 7.4
       bool loadVersion10(FILE* fd); // from 7.6
       bool saveVersion10(FILE* fd, bool isOnController); // from 7.6
+      int getBinaryFileSections(u8** pSections, u32* puSizes);
 };
 
 const char* model_getShortFlightMode(u8 mode);
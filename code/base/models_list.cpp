@@ -32,6 +32,7 @@
 #include "base.h"
 #include "hardware.h"
 #include "models.h"
+#include "model_sync.h"
 
 Model* s_pModelsSpectator[MAX_MODELS_SPECTATOR];
 int s_iModelsSpectatorCount = 0;
@@ -432,6 +433,8 @@ Model* deleteModel(Model* pModel)
       return s_pCurrentModel;
    }
 
+   model_sync_delete_received_base(pModel->uVehicleId);
+
    char szFile[MAX_FILE_PATH_SIZE];      
    bool bDeletedController = false;
    bool bDeletedSpectator = false;
@@ -451,6 +454,9 @@ Model* deleteModel(Model* pModel)
          strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL_BACKUP);
          unlink(szFile);
          strcpy(szFile, FOLDER_CONFIG);
+         strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL_BINARY);
+         unlink(szFile);
+         strcpy(szFile, FOLDER_CONFIG);
          strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL);
          unlink(szFile);
          log_line("Deleted current vehicle (VID %u, ptr: %X) model file: %s", s_pCurrentModel->uVehicleId, s_pCurrentModel, szFile);
@@ -469,6 +475,9 @@ Model* deleteModel(Model* pModel)
       szFile[strlen(szFile)-3] = 0;
       strcat(szFile, "bak");
       unlink(szFile);
+      szFile[strlen(szFile)-3] = 0;
+      strcat(szFile, "mdb");
+      unlink(szFile);
       
       log_line("Saving %d controller models.", s_iModelsCount);
       strcpy(szFile, FOLDER_CONFIG);
@@ -500,6 +509,9 @@ Model* deleteModel(Model* pModel)
          strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL_BACKUP);
          unlink(szFile);
          strcpy(szFile, FOLDER_CONFIG);
+         strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL_BINARY);
+         unlink(szFile);
+         strcpy(szFile, FOLDER_CONFIG);
          strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL);
          unlink(szFile);
          log_line("Deleted current vehicle (VID %u, ptr: %X) model file: %s", s_pCurrentModel->uVehicleId, s_pCurrentModel, szFile);
@@ -518,6 +530,9 @@ Model* deleteModel(Model* pModel)
       szFile[strlen(szFile)-3] = 0;
       strcat(szFile, "bak");
       unlink(szFile);
+      szFile[strlen(szFile)-3] = 0;
+      strcat(szFile, "mdb");
+      unlink(szFile);
       
       log_line("Saving %d spectator models.", s_iModelsSpectatorCount);
       for( int i=pos; i<s_iModelsSpectatorCount; i++ )
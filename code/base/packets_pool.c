@@ -0,0 +1,242 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <sys/mman.h>
+#include "base.h"
+#include "packets_pool.h"
+
+#define PACKETS_POOL_HUGE_PAGE_SIZE (2*1024*1024)
+
+int packets_pool_init(type_packets_pool* pPool, const char* szName, int iBufferSize, int iCount, u32 uFlags)
+{
+   if ( NULL == pPool )
+      return 0;
+   memset(pPool, 0, sizeof(type_packets_pool));
+   if ( (iBufferSize <= 0) || (iCount <= 0) )
+      return 0;
+
+   strncpy(pPool->szName, (NULL != szName)?szName:"", sizeof(pPool->szName)-1);
+   pPool->iBufferSize = iBufferSize;
+   pPool->iStride = (iBufferSize + PACKETS_POOL_CACHE_LINE - 1) & ~(PACKETS_POOL_CACHE_LINE - 1);
+   pPool->iCount = iCount;
+
+   u32 uSize = (u32)pPool->iStride * (u32)iCount;
+   void* pMemory = MAP_FAILED;
+
+   #ifdef MAP_HUGETLB
+   if ( uFlags & PACKETS_POOL_FLAG_HUGE_PAGES )
+   {
+      u32 uHugeSize = (uSize + PACKETS_POOL_HUGE_PAGE_SIZE - 1) & ~(PACKETS_POOL_HUGE_PAGE_SIZE - 1);
+      pMemory = mmap(NULL, uHugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if ( MAP_FAILED != pMemory )
+      {
+         uSize = uHugeSize;
+         pPool->stats.iHugePages = 1;
+      }
+   }
+   #endif
+
+   if ( MAP_FAILED == pMemory )
+   {
+      pMemory = mmap(NULL, uSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if ( MAP_FAILED == pMemory )
+      {
+         log_error_and_alarm("[PacketsPool] %s: Failed to map %u bytes for %d buffers of %d bytes.", pPool->szName, uSize, iCount, iBufferSize);
+         return 0;
+      }
+      #ifdef MADV_HUGEPAGE
+      if ( uFlags & PACKETS_POOL_FLAG_HUGE_PAGES )
+         madvise(pMemory, uSize, MADV_HUGEPAGE);
+      #endif
+   }
+
+   pPool->pFreeList = (int*) malloc(iCount * sizeof(int));
+   pPool->pRefCounts = (volatile int*) malloc(iCount * sizeof(int));
+   if ( (NULL == pPool->pFreeList) || (NULL == pPool->pRefCounts) )
+   {
+      log_error_and_alarm("[PacketsPool] %s: Failed to allocate pool state.", pPool->szName);
+      munmap(pMemory, uSize);
+      free(pPool->pFreeList);
+      free((void*)pPool->pRefCounts);
+      pPool->pFreeList = NULL;
+      pPool->pRefCounts = NULL;
+      return 0;
+   }
+
+   // Lowest buffers are handed out first, so only the used part of the mapping gets touched
+   for( int i=0; i<iCount; i++ )
+   {
+      pPool->pFreeList[i] = iCount - 1 - i;
+      pPool->pRefCounts[i] = 0;
+   }
+   pPool->iFreeCount = iCount;
+   pthread_mutex_init(&pPool->mutex, NULL);
+   pPool->stats.uBytesMapped = uSize;
+   pPool->pMemory = (u8*)pMemory;
+
+   log_line("[PacketsPool] %s: Mapped %u bytes for %d buffers of %d bytes (stride %d bytes), huge pages: %s.",
+      pPool->szName, uSize, iCount, iBufferSize, pPool->iStride,
+      pPool->stats.iHugePages?"yes":((uFlags & PACKETS_POOL_FLAG_HUGE_PAGES)?"transparent":"no"));
+   return 1;
+}
+
+void packets_pool_uninit(type_packets_pool* pPool)
+{
+   if ( (NULL == pPool) || (NULL == pPool->pMemory) )
+      return;
+   if ( pPool->stats.iInUse > 0 )
+      log_softerror_and_alarm("[PacketsPool] %s: Releasing pool with %d buffers still in use.", pPool->szName, pPool->stats.iInUse);
+   munmap(pPool->pMemory, pPool->stats.uBytesMapped);
+   free(pPool->pFreeList);
+   free((void*)pPool->pRefCounts);
+   pthread_mutex_destroy(&pPool->mutex);
+   pPool->pMemory = NULL;
+   pPool->pFreeList = NULL;
+   pPool->pRefCounts = NULL;
+   pPool->iFreeCount = 0;
+}
+
+int packets_pool_is_initialized(type_packets_pool* pPool)
+{
+   if ( (NULL == pPool) || (NULL == pPool->pMemory) )
+      return 0;
+   return 1;
+}
+
+static int _packets_pool_get_index(type_packets_pool* pPool, u8* pPointer)
+{
+   if ( (NULL == pPool) || (NULL == pPool->pMemory) || (NULL == pPointer) )
+      return -1;
+   if ( pPointer < pPool->pMemory )
+      return -1;
+   u32 uOffset = (u32)(pPointer - pPool->pMemory);
+   if ( uOffset >= (u32)pPool->iStride * (u32)pPool->iCount )
+      return -1;
+   return (int)(uOffset / (u32)pPool->iStride);
+}
+
+u8* packets_pool_alloc(type_packets_pool* pPool)
+{
+   if ( (NULL == pPool) || (NULL == pPool->pMemory) )
+      return NULL;
+
+   pthread_mutex_lock(&pPool->mutex);
+   if ( 0 == pPool->iFreeCount )
+   {
+      pPool->stats.uFailedAllocs++;
+      pthread_mutex_unlock(&pPool->mutex);
+      return NULL;
+   }
+   pPool->iFreeCount--;
+   int iIndex = pPool->pFreeList[pPool->iFreeCount];
+   pPool->stats.uAllocs++;
+   pPool->stats.iInUse++;
+   if ( pPool->stats.iInUse > pPool->stats.iMaxInUse )
+      pPool->stats.iMaxInUse = pPool->stats.iInUse;
+   pthread_mutex_unlock(&pPool->mutex);
+
+   __atomic_store_n(&pPool->pRefCounts[iIndex], 1, __ATOMIC_RELEASE);
+   return pPool->pMemory + iIndex * pPool->iStride;
+}
+
+u8* packets_pool_ref(type_packets_pool* pPool, u8* pPointer)
+{
+   int iIndex = _packets_pool_get_index(pPool, pPointer);
+   if ( iIndex < 0 )
+      return NULL;
+   __atomic_add_fetch(&pPool->pRefCounts[iIndex], 1, __ATOMIC_ACQ_REL);
+   __atomic_add_fetch(&pPool->stats.uRefs, 1, __ATOMIC_RELAXED);
+   return pPool->pMemory + iIndex * pPool->iStride;
+}
+
+u8* packets_pool_get_buffer_start(type_packets_pool* pPool, u8* pPointer)
+{
+   int iIndex = _packets_pool_get_index(pPool, pPointer);
+   if ( iIndex < 0 )
+      return NULL;
+   return pPool->pMemory + iIndex * pPool->iStride;
+}
+
+void packets_pool_release(type_packets_pool* pPool, u8* pPointer)
+{
+   int iIndex = _packets_pool_get_index(pPool, pPointer);
+   if ( iIndex < 0 )
+      return;
+
+   int iRefs = __atomic_sub_fetch(&pPool->pRefCounts[iIndex], 1, __ATOMIC_ACQ_REL);
+   if ( iRefs > 0 )
+      return;
+   if ( iRefs < 0 )
+   {
+      __atomic_store_n(&pPool->pRefCounts[iIndex], 0, __ATOMIC_RELEASE);
+      log_softerror_and_alarm("[PacketsPool] %s: Buffer %d released more times than referenced.", pPool->szName, iIndex);
+      return;
+   }
+
+   pthread_mutex_lock(&pPool->mutex);
+   pPool->pFreeList[pPool->iFreeCount] = iIndex;
+   pPool->iFreeCount++;
+   pPool->stats.uFrees++;
+   pPool->stats.iInUse--;
+   pthread_mutex_unlock(&pPool->mutex);
+}
+
+int packets_pool_get_ref_count(type_packets_pool* pPool, u8* pPointer)
+{
+   int iIndex = _packets_pool_get_index(pPool, pPointer);
+   if ( iIndex < 0 )
+      return 0;
+   return __atomic_load_n(&pPool->pRefCounts[iIndex], __ATOMIC_ACQUIRE);
+}
+
+int packets_pool_get_free_count(type_packets_pool* pPool)
+{
+   if ( (NULL == pPool) || (NULL == pPool->pMemory) )
+      return 0;
+   return __atomic_load_n(&pPool->iFreeCount, __ATOMIC_RELAXED);
+}
+
+type_packets_pool_stats* packets_pool_get_stats(type_packets_pool* pPool)
+{
+   if ( NULL == pPool )
+      return NULL;
+   return &pPool->stats;
+}
+
+void packets_pool_log_stats(type_packets_pool* pPool)
+{
+   if ( (NULL == pPool) || (NULL == pPool->pMemory) )
+      return;
+   log_line("[PacketsPool] %s: %d/%d buffers in use (max %d), allocs: %u, frees: %u, refs: %u, failed allocs: %u, mapped: %u bytes%s.",
+      pPool->szName, pPool->stats.iInUse, pPool->iCount, pPool->stats.iMaxInUse,
+      pPool->stats.uAllocs, pPool->stats.uFrees, pPool->stats.uRefs, pPool->stats.uFailedAllocs,
+      pPool->stats.uBytesMapped, pPool->stats.iHugePages?" (huge pages)":"");
+}
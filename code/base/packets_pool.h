@@ -0,0 +1,69 @@
+#pragma once
+
+#include <pthread.h>
+#include "../base/base.h"
+
+// Fixed size packet buffers pool.
+// All the buffers live in a single memory mapping (explicit huge pages if requested and available,
+// regular pages with transparent huge pages advised otherwise). Each buffer starts on a cache line.
+// Pages are only touched (and count in RSS) when a buffer is used for the first time;
+// free buffers are reused last in, first out so that the hot ones stay in cache.
+//
+// A buffer pointer is the buffer handle. Each buffer has a reference count: alloc returns it with
+// one reference, ref adds one, release drops one and gives the buffer back to the pool on the last one.
+// Ref/release accept any pointer inside a buffer (i.e. a packet payload inside a received radio packet).
+// Alloc/ref/release are thread safe.
+
+#define PACKETS_POOL_CACHE_LINE 64
+#define PACKETS_POOL_FLAG_HUGE_PAGES ((u32)0x01)
+
+typedef struct
+{
+   u32 uAllocs;
+   u32 uFrees;
+   u32 uFailedAllocs;
+   u32 uRefs;
+   int iInUse;
+   int iMaxInUse;
+   u32 uBytesMapped;
+   int iHugePages; // 1: backed by explicit huge pages (MAP_HUGETLB)
+} type_packets_pool_stats;
+
+typedef struct
+{
+   char szName[32];
+   u8* pMemory;
+   int iBufferSize;
+   int iStride;
+   int iCount;
+   int* pFreeList;
+   int iFreeCount;
+   volatile int* pRefCounts;
+   pthread_mutex_t mutex;
+   type_packets_pool_stats stats;
+} type_packets_pool;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns 1 on success, 0 on failure
+int packets_pool_init(type_packets_pool* pPool, const char* szName, int iBufferSize, int iCount, u32 uFlags);
+void packets_pool_uninit(type_packets_pool* pPool);
+int packets_pool_is_initialized(type_packets_pool* pPool);
+
+// Returns NULL if the pool is exhausted
+u8* packets_pool_alloc(type_packets_pool* pPool);
+// Both return the start of the buffer that contains pPointer, or NULL if it's not a buffer of this pool
+u8* packets_pool_ref(type_packets_pool* pPool, u8* pPointer);
+u8* packets_pool_get_buffer_start(type_packets_pool* pPool, u8* pPointer);
+void packets_pool_release(type_packets_pool* pPool, u8* pPointer);
+int packets_pool_get_ref_count(type_packets_pool* pPool, u8* pPointer);
+
+int packets_pool_get_free_count(type_packets_pool* pPool);
+type_packets_pool_stats* packets_pool_get_stats(type_packets_pool* pPool);
+void packets_pool_log_stats(type_packets_pool* pPool);
+
+#ifdef __cplusplus
+}
+#endif
@@ -32,6 +32,90 @@
 #include "base.h"
 #include "parser_h264.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PARSER_H26X_HAVE_SSE2
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PARSER_H26X_HAVE_NEON
+#endif
+
+// Finds the 01 byte of a 00 00 01 start code: position q >= iStart, q >= 2, with pData[q-2] == pData[q-1] == 0
+
+static int _parser_h26x_find_start_code_end(const u8* pData, int iStart, int iDataLength)
+{
+   if ( iStart < 2 )
+      iStart = 2;
+   int q = iStart;
+
+#if defined(PARSER_H26X_HAVE_SSE2)
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i one = _mm_set1_epi8(1);
+   while ( q + 16 <= iDataLength )
+   {
+      __m128i v0 = _mm_loadu_si128((const __m128i*)(pData + q));
+      __m128i v1 = _mm_loadu_si128((const __m128i*)(pData + q - 1));
+      __m128i v2 = _mm_loadu_si128((const __m128i*)(pData + q - 2));
+      __m128i m = _mm_and_si128(_mm_cmpeq_epi8(v0, one), _mm_and_si128(_mm_cmpeq_epi8(v1, zero), _mm_cmpeq_epi8(v2, zero)));
+      int iMask = _mm_movemask_epi8(m);
+      if ( 0 != iMask )
+         return q + __builtin_ctz(iMask);
+      q += 16;
+   }
+#elif defined(PARSER_H26X_HAVE_NEON)
+   const uint8x16_t zero = vdupq_n_u8(0);
+   const uint8x16_t one = vdupq_n_u8(1);
+   while ( q + 16 <= iDataLength )
+   {
+      uint8x16_t v0 = vld1q_u8(pData + q);
+      uint8x16_t v1 = vld1q_u8(pData + q - 1);
+      uint8x16_t v2 = vld1q_u8(pData + q - 2);
+      uint8x16_t m = vandq_u8(vceqq_u8(v0, one), vandq_u8(vceqq_u8(v1, zero), vceqq_u8(v2, zero)));
+      uint8x8_t m8 = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+      if ( 0 != vget_lane_u64(vreinterpret_u64_u8(m8), 0) )
+      {
+         for( int i=0; i<16; i++ )
+         {
+            if ( (pData[q+i] == 1) && (pData[q+i-1] == 0) && (pData[q+i-2] == 0) )
+               return q+i;
+         }
+      }
+      q += 16;
+   }
+#else
+   // memchr skips a word at a time to the next 01 byte
+   while ( q < iDataLength )
+   {
+      const u8* pOne = (const u8*) memchr(pData + q, 1, iDataLength - q);
+      if ( NULL == pOne )
+         return -1;
+      q = (int)(pOne - pData);
+      if ( (pData[q-1] == 0) && (pData[q-2] == 0) )
+         return q;
+      q++;
+   }
+#endif
+
+   while ( q < iDataLength )
+   {
+      if ( (pData[q] == 1) && (pData[q-1] == 0) && (pData[q-2] == 0) )
+         return q;
+      q++;
+   }
+   return -1;
+}
+
+int parser_h26x_find_next_nalu(const u8* pData, int iStartIndex, int iDataLength)
+{
+   if ( (NULL == pData) || (iDataLength < 3) )
+      return -1;
+   // The 01 byte is at least 2 bytes after the start index
+   int q = _parser_h26x_find_start_code_end(pData, iStartIndex + 2, iDataLength);
+   if ( q < 0 )
+      return -1;
+   return q+1;
+}
+
 
 ParserH264::ParserH264()
 {
@@ -42,8 +126,9 @@ ParserH264::~ParserH264()
 {
 }
 
-void ParserH264::init(int iExpectedISlices)
+void ParserH264::init(int iExpectedISlices, bool bH265)
 {
+   m_bH265 = bH265;
    m_iExpectedISlices = iExpectedISlices;
    m_iDetectedISlices = 1;
    m_uStateCurrentToken = MAX_U32;
@@ -61,96 +146,217 @@ void ParserH264::init(int iExpectedISlices)
    m_uSizeLastFrame = 0;
    m_uCurrentDetectedKeyframeIntervalMs = 0;
    m_uFramesSinceLastKeyframe = 0;
+   m_uLastAnyNALUType = 0;
+   m_uParamSetsCount = 0;
+   m_uPendingH265NALUType = 0;
+   m_iPendingH265Bytes = 0;
 
    m_uDebugFramesCounter = 0;
    m_uDebugTimeStartFramesCounter = 0;
    m_uDebugDetectedFPS = 0;
 }
 
+void ParserH264::setCodec(bool bH265)
+{
+   if ( bH265 == m_bH265 )
+      return;
+   init(m_iExpectedISlices, bH265);
+}
+
+bool ParserH264::isH265()
+{
+   return m_bH265;
+}
+
 // Returns true if an start of a new frame was found
+// The start codes are searched 16 bytes at a time; only the start codes that span two
+// buffers (and H265 slice headers split from their NAL header) are checked byte by byte.
+
 bool ParserH264::parseData(u8* pData, int iDataLength, u32 uTimeNowMs)
 {
    if ( (NULL == pData) || (iDataLength <= 0) )
       return false;
 
    bool bFoundFrameStart = false;
+   int iPos = 0;
+
+   while ( iPos < iDataLength )
+   {
+      if ( (iPos < 3) || (m_iPendingH265Bytes > 0) )
+      {
+         if ( _parseByte(pData[iPos], uTimeNowMs) )
+            bFoundFrameStart = true;
+         iPos++;
+         continue;
+      }
+
+      int iNALUPos = parser_h26x_find_next_nalu(pData, iPos-3, iDataLength);
+      if ( (iNALUPos < 0) || (iNALUPos >= iDataLength) )
+      {
+         m_uSizeCurrentFrame += iDataLength - iPos;
+         iPos = iDataLength;
+         break;
+      }
+      // Same size accounting as parsing byte by byte: the NAL header byte is counted in the previous frame
+      m_uSizeCurrentFrame += iNALUPos + 1 - iPos;
+      if ( _onNALUHeader(pData, iNALUPos, iDataLength, uTimeNowMs, &iPos) )
+         bFoundFrameStart = true;
+   }
+
+   if ( iDataLength >= 4 )
+      m_uStateCurrentToken = ((u32)pData[iDataLength-4] << 24) | ((u32)pData[iDataLength-3] << 16) | ((u32)pData[iDataLength-2] << 8) | (u32)pData[iDataLength-1];
+   return bFoundFrameStart;
+}
+
+// Parses one byte with the start code state machine
+
+bool ParserH264::_parseByte(u8 uByte, u32 uTimeNowMs)
+{
+   m_uStateCurrentToken = (m_uStateCurrentToken<<8) | uByte;
+   m_uSizeCurrentFrame++;
+
+   if ( m_iPendingH265Bytes > 0 )
+   {
+      m_iPendingH265Bytes--;
+      if ( 0 == m_iPendingH265Bytes )
+         return _onH265NALU(m_uPendingH265NALUType, (uByte & 0x80)?true:false, uTimeNowMs);
+   }
+
+   if ( (m_uStateCurrentToken & 0xFFFFFF00) != 0x0100 )
+      return false;
+
+   if ( ! m_bH265 )
+      return _onH264NALU(uByte & 0b11111, uTimeNowMs);
+
+   // H265: the first slice in picture flag is the first bit after the 2 bytes NAL header
+   m_uPendingH265NALUType = (uByte >> 1) & 0x3F;
+   m_iPendingH265Bytes = 2;
+   return false;
+}
+
+// A NAL header was found at iPos in the buffer; sets the position to continue parsing from
+
+bool ParserH264::_onNALUHeader(u8* pData, int iPos, int iDataLength, u32 uTimeNowMs, int* piNextPos)
+{
+   *piNextPos = iPos+1;
+   if ( ! m_bH265 )
+      return _onH264NALU(pData[iPos] & 0b11111, uTimeNowMs);
+
+   u32 uNALUType = (pData[iPos] >> 1) & 0x3F;
+   if ( iPos + 2 < iDataLength )
+      return _onH265NALU(uNALUType, (pData[iPos+2] & 0x80)?true:false, uTimeNowMs);
+
+   // The slice header is in the next buffer
+   m_uPendingH265NALUType = uNALUType;
+   m_iPendingH265Bytes = 2;
+   return false;
+}
+
+bool ParserH264::_onH264NALU(u32 uNALUType, u32 uTimeNowMs)
+{
+   m_uLastAnyNALUType = uNALUType;
+   if ( (uNALUType == 7) || (uNALUType == 8) )
+      m_uParamSetsCount++;
+
+   m_uCurrentNALUType = uNALUType;
+
+   // P-frame is 1, I-frame is 5
+   if ( (m_uCurrentNALUType != 1) && (m_uCurrentNALUType != 5) )
+      return false;
+
+   // We started a P or I frame slice
+
+   if ( m_uCurrentNALUType != m_uLastNALUType )
+   {
+      if ( m_uLastNALUType == 5 )
+      {
+         m_iDetectedISlices = (int)m_uConsecutiveNALUs;
+      }
+      m_uConsecutiveNALUs = 0;
+      m_uLastNALUType = m_uCurrentNALUType;
+   }
+
+   m_uConsecutiveNALUs++;
 
-   while ( iDataLength > 0 )
+   if ( m_uCurrentNALUType == 5 )
+      m_bStateIsInsideIFrame = true;
+   else
+      m_bStateIsInsideIFrame = false;
+
+   // P or I frame just started. Compute info
+
+   bool bFoundFrameStart = false;
+   if ( 0 == m_iStateCurrentParsedSlices )
    {
-       m_uStateCurrentToken = (m_uStateCurrentToken<<8) | (*pData);
-       pData++;
-       iDataLength--;
-       m_uSizeCurrentFrame++;
-
-       if ( (m_uStateCurrentToken & 0xFFFFFF00) != 0x0100 )
-          continue;
-
-       m_uCurrentNALUType = m_uStateCurrentToken & 0b11111;
-
-       // P-frame is 1, I-frame is 5
-       if ( (m_uCurrentNALUType != 1) && (m_uCurrentNALUType != 5) )
-          continue;
-
-       // We started a P or I frame slice
-
-       if ( m_uCurrentNALUType != m_uLastNALUType )
-       {
-          if ( m_uLastNALUType == 5 )
-          {
-             m_iDetectedISlices = (int)m_uConsecutiveNALUs;
-          }
-          m_uConsecutiveNALUs = 0;
-          m_uLastNALUType = m_uCurrentNALUType;
-       }
-
-       m_uConsecutiveNALUs++;
-
-       if ( m_uCurrentNALUType == 5 )
-          m_bStateIsInsideIFrame = true;
-       else
-          m_bStateIsInsideIFrame = false;
-
-       // P or I frame just started. Compute info
-
-       if ( 0 == m_iStateCurrentParsedSlices )
-       {
-          bFoundFrameStart = true;
-          
-          m_uDebugFramesCounter++;
-          if ( uTimeNowMs >= m_uDebugTimeStartFramesCounter + 5000 )
-          {
-             m_uDebugTimeStartFramesCounter = uTimeNowMs;
-             m_uDebugDetectedFPS = m_uDebugFramesCounter/5;
-             m_uDebugFramesCounter = 0;
-          }
-          m_uLastFrameType = m_uCurrentFrameType;
-          m_uCurrentFrameType = m_uCurrentNALUType;
-          m_uTimeDurationOfLastFrame = uTimeNowMs - m_uTimeStartOfCurrentFrame;
-          m_uTimeStartOfCurrentFrame = uTimeNowMs;
-          m_uFramesSinceLastKeyframe++;
-          m_uSizeLastFrame = m_uSizeCurrentFrame;
-          m_uSizeCurrentFrame = 0;
-
-          if ( m_uCurrentNALUType == 5 )
-          {
-             m_uCurrentDetectedKeyframeIntervalMs = uTimeNowMs - m_uTimeLastStartOfIFrame;
-             m_uTimeLastStartOfIFrame = uTimeNowMs;
-             m_uFramesSinceLastKeyframe = 0;
-          }
-       }
-
-       m_iStateCurrentParsedSlices++;
-       if ( m_iStateCurrentParsedSlices >= m_iDetectedISlices )
-       {
-          m_iStateCurrentParsedSlices = 0;
-
-          // Last NALU slice ended for current frame. Compute info for it
-       }
+      bFoundFrameStart = true;
+      _onFrameStart(m_uCurrentNALUType == 5, uTimeNowMs);
    }
 
+   m_iStateCurrentParsedSlices++;
+   if ( m_iStateCurrentParsedSlices >= m_iDetectedISlices )
+   {
+      m_iStateCurrentParsedSlices = 0;
+
+      // Last NALU slice ended for current frame. Compute info for it
+   }
    return bFoundFrameStart;
 }
 
+// H265 slices carry a first slice in picture flag, so frame starts don't depend on the slices count.
+// The frame types are reported with the H264 values (5 for I-frames, 1 for the others).
+
+bool ParserH264::_onH265NALU(u32 uNALUType, bool bFirstSliceInPicture, u32 uTimeNowMs)
+{
+   m_uLastAnyNALUType = uNALUType;
+   if ( (uNALUType >= H265_NALU_TYPE_VPS) && (uNALUType <= H265_NALU_TYPE_PPS) )
+      m_uParamSetsCount++;
+
+   // Only the VCL (slice) NAL units: TRAIL/TSA/STSA/RADL/RASL and IRAP (BLA/IDR/CRA)
+   bool bIRAP = (uNALUType >= H265_NALU_TYPE_BLA_W_LP) && (uNALUType <= H265_NALU_TYPE_IRAP_LAST);
+   if ( (uNALUType > H265_NALU_TYPE_RASL_R) && (! bIRAP) )
+      return false;
+
+   m_uCurrentNALUType = bIRAP?5:1;
+   m_bStateIsInsideIFrame = bIRAP;
+
+   if ( ! bFirstSliceInPicture )
+   {
+      m_uConsecutiveNALUs++;
+      return false;
+   }
+
+   if ( (m_uLastNALUType == 5) && (m_uConsecutiveNALUs > 0) )
+      m_iDetectedISlices = (int)m_uConsecutiveNALUs;
+   m_uLastNALUType = m_uCurrentNALUType;
+   m_uConsecutiveNALUs = 1;
+   _onFrameStart(bIRAP, uTimeNowMs);
+   return true;
+}
+
+void ParserH264::_onFrameStart(bool bIFrame, u32 uTimeNowMs)
+{
+   m_uDebugFramesCounter++;
+   if ( uTimeNowMs >= m_uDebugTimeStartFramesCounter + 5000 )
+   {
+      m_uDebugTimeStartFramesCounter = uTimeNowMs;
+      m_uDebugDetectedFPS = m_uDebugFramesCounter/5;
+      m_uDebugFramesCounter = 0;
+   }
+   m_uLastFrameType = m_uCurrentFrameType;
+   m_uCurrentFrameType = bIFrame?5:1;
+   m_uTimeDurationOfLastFrame = uTimeNowMs - m_uTimeStartOfCurrentFrame;
+   m_uTimeStartOfCurrentFrame = uTimeNowMs;
+   m_uFramesSinceLastKeyframe++;
+   m_uSizeLastFrame = m_uSizeCurrentFrame;
+   m_uSizeCurrentFrame = 0;
+
+   if ( bIFrame )
+   {
+      m_uCurrentDetectedKeyframeIntervalMs = uTimeNowMs - m_uTimeLastStartOfIFrame;
+      m_uTimeLastStartOfIFrame = uTimeNowMs;
+      m_uFramesSinceLastKeyframe = 0;
+   }
+}
 u32 ParserH264::getStartTimeOfCurrentFrame()
 {
    return m_uTimeStartOfCurrentFrame;
@@ -199,4 +405,14 @@ u32 ParserH264::getFramesSinceLastKeyframe()
 u32 ParserH264::getDetectedFPS()
 {
    return m_uDebugDetectedFPS;
-}
\ No newline at end of file
+}
+
+u32 ParserH264::getLastNALUType()
+{
+   return m_uLastAnyNALUType;
+}
+
+u32 ParserH264::getParamSetsCount()
+{
+   return m_uParamSetsCount;
+}
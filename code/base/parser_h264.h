@@ -1,13 +1,34 @@
 #pragma once
 #include "base.h"
 
+// H265 NAL unit types
+#define H265_NALU_TYPE_TRAIL_N 0
+#define H265_NALU_TYPE_RASL_R 9
+#define H265_NALU_TYPE_BLA_W_LP 16
+#define H265_NALU_TYPE_IDR_W_RADL 19
+#define H265_NALU_TYPE_IDR_N_LP 20
+#define H265_NALU_TYPE_CRA 21
+#define H265_NALU_TYPE_IRAP_LAST 23
+#define H265_NALU_TYPE_VPS 32
+#define H265_NALU_TYPE_SPS 33
+#define H265_NALU_TYPE_PPS 34
+#define H265_NALU_TYPE_AUD 35
+
+// Returns the position of the first byte after the next 00 00 01 start code (the NAL header) found
+// at or after iStartIndex, or -1 if there is none. The returned position can be iDataLength.
+// Uses SSE2/NEON when available (16 bytes per step), memchr otherwise.
+int parser_h26x_find_next_nalu(const u8* pData, int iStartIndex, int iDataLength);
+
 class ParserH264
 {
    public:
       ParserH264();
       virtual ~ParserH264();
       
-      void init(int iExpectedISlices);
+      void init(int iExpectedISlices, bool bH265 = false);
+      // Resets the parser state if the codec changed
+      void setCodec(bool bH265);
+      bool isH265();
 
       // Returns true if an start of a new frame was found
       bool parseData(u8* pData, int iDataLength, u32 uTimeNowMs);
@@ -22,8 +43,23 @@ class ParserH264
       bool IsInsideIFrame();
       u32 getFramesSinceLastKeyframe();
       u32 getDetectedFPS();
+      // Last NAL unit type found (any type, H264 or H265 values)
+      u32 getLastNALUType();
+      u32 getParamSetsCount();
 
    protected:
+      bool _parseByte(u8 uByte, u32 uTimeNowMs);
+      bool _onNALUHeader(u8* pData, int iPos, int iDataLength, u32 uTimeNowMs, int* piNextPos);
+      bool _onH264NALU(u32 uNALUType, u32 uTimeNowMs);
+      bool _onH265NALU(u32 uNALUType, bool bFirstSliceInPicture, u32 uTimeNowMs);
+      void _onFrameStart(bool bIFrame, u32 uTimeNowMs);
+
+      bool m_bH265;
+      u32 m_uLastAnyNALUType;
+      u32 m_uParamSetsCount;
+      u32 m_uPendingH265NALUType;
+      int m_iPendingH265Bytes; // bytes to skip before the H265 slice header first byte, when it's in the next buffer
+
       int m_iExpectedISlices;
       int m_iDetectedISlices;
       int m_iStateCurrentParsedSlices;
@@ -0,0 +1,177 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "base.h"
+#include "retransmissions_index.h"
+
+static u32 _retransmissions_index_hash(u32 uVideoBlockIndex, u8 uVideoPacketIndex)
+{
+   u32 uHash = (uVideoBlockIndex * 64 + (u32)uVideoPacketIndex) * 2654435761u;
+   return (uHash >> 16) & (RETRANSMISSIONS_INDEX_SEGMENTS_SLOTS-1);
+}
+
+void retransmissions_index_reset(type_retransmissions_index* pIndex)
+{
+   if ( NULL == pIndex )
+      return;
+   memset(pIndex, 0, sizeof(type_retransmissions_index));
+   for( int i=0; i<RETRANSMISSIONS_INDEX_BLOCKS_SLOTS; i++ )
+   {
+      pIndex->uBlocksVideoIndex[i] = MAX_U32;
+      pIndex->iBlocksBufferIndex[i] = -1;
+   }
+}
+
+void retransmissions_index_reset_segments(type_retransmissions_index* pIndex)
+{
+   if ( NULL == pIndex )
+      return;
+   memset(pIndex->segments, 0, sizeof(pIndex->segments));
+   pIndex->iCountSegments = 0;
+   memset(&pIndex->stats, 0, sizeof(type_retransmissions_index_stats));
+}
+
+void retransmissions_index_set_block(type_retransmissions_index* pIndex, u32 uVideoBlockIndex, int iBufferIndex)
+{
+   u32 uSlot = uVideoBlockIndex & (RETRANSMISSIONS_INDEX_BLOCKS_SLOTS-1);
+   pIndex->uBlocksVideoIndex[uSlot] = uVideoBlockIndex;
+   pIndex->iBlocksBufferIndex[uSlot] = iBufferIndex;
+}
+
+int retransmissions_index_find_block(type_retransmissions_index* pIndex, u32 uVideoBlockIndex)
+{
+   u32 uSlot = uVideoBlockIndex & (RETRANSMISSIONS_INDEX_BLOCKS_SLOTS-1);
+   if ( pIndex->uBlocksVideoIndex[uSlot] != uVideoBlockIndex )
+      return -1;
+   return pIndex->iBlocksBufferIndex[uSlot];
+}
+
+type_retransmissions_index_segment* retransmissions_index_add_request(type_retransmissions_index* pIndex, u32 uVideoBlockIndex, u8 uVideoPacketIndex, u32 uTimeNow, int* pbIsNew)
+{
+   if ( NULL != pbIsNew )
+      *pbIsNew = 0;
+   if ( 0 == uTimeNow )
+      uTimeNow = 1;
+
+   u32 uSlot = _retransmissions_index_hash(uVideoBlockIndex, uVideoPacketIndex);
+   u32 uProbes = 0;
+   while ( 0 != pIndex->segments[uSlot].uReceiveTime )
+   {
+      type_retransmissions_index_segment* pSegment = &pIndex->segments[uSlot];
+      if ( (pSegment->uVideoBlockIndex == uVideoBlockIndex) && (pSegment->uVideoPacketIndex == uVideoPacketIndex) )
+      {
+         if ( pSegment->uRepeatCount < 255 )
+            pSegment->uRepeatCount++;
+         if ( 1 == pSegment->uRepeatCount )
+            pIndex->stats.uSegmentsRetried++;
+         return pSegment;
+      }
+      uSlot = (uSlot + 1) & (RETRANSMISSIONS_INDEX_SEGMENTS_SLOTS-1);
+      uProbes++;
+   }
+   if ( uProbes > pIndex->stats.uMaxProbes )
+      pIndex->stats.uMaxProbes = uProbes;
+
+   if ( pIndex->iCountSegments >= RETRANSMISSIONS_INDEX_MAX_SEGMENTS )
+   {
+      pIndex->stats.uSegmentsDropped++;
+      return NULL;
+   }
+
+   type_retransmissions_index_segment* pSegment = &pIndex->segments[uSlot];
+   pSegment->uVideoBlockIndex = uVideoBlockIndex;
+   pSegment->uVideoPacketIndex = uVideoPacketIndex;
+   pSegment->uReceiveTime = uTimeNow;
+   pSegment->uLastResendTime = 0;
+   pSegment->uRepeatCount = 0;
+   pIndex->iCountSegments++;
+   pIndex->stats.uSegmentsUnique++;
+   if ( NULL != pbIsNew )
+      *pbIsNew = 1;
+   return pSegment;
+}
+
+int retransmissions_index_should_resend(type_retransmissions_index* pIndex, type_retransmissions_index_segment* pSegment, u32 uTimeNow)
+{
+   if ( NULL == pSegment )
+      return 1;
+   if ( 0 == uTimeNow )
+      uTimeNow = 1;
+   if ( (0 != pSegment->uLastResendTime) && (uTimeNow < pSegment->uLastResendTime + RETRANSMISSIONS_INDEX_RESEND_DEDUP_MS) )
+   {
+      pIndex->stats.uResendsDeduplicated++;
+      return 0;
+   }
+   pSegment->uLastResendTime = uTimeNow;
+   return 1;
+}
+
+int retransmissions_index_expire(type_retransmissions_index* pIndex, u32 uTimeNow, int* piCountRetried)
+{
+   // Removing entries from a linear probing table breaks the probe chains: rebuild the table with the segments still in the window
+   type_retransmissions_index_segment live[RETRANSMISSIONS_INDEX_MAX_SEGMENTS];
+   int iCountLive = 0;
+   int iCountRetried = 0;
+   for( int i=0; i<RETRANSMISSIONS_INDEX_SEGMENTS_SLOTS; i++ )
+   {
+      type_retransmissions_index_segment* pSegment = &pIndex->segments[i];
+      if ( 0 == pSegment->uReceiveTime )
+         continue;
+      if ( pSegment->uReceiveTime + RETRANSMISSIONS_INDEX_HISTORY_MS >= uTimeNow )
+      if ( iCountLive < RETRANSMISSIONS_INDEX_MAX_SEGMENTS )
+      {
+         memcpy(&live[iCountLive], pSegment, sizeof(type_retransmissions_index_segment));
+         iCountLive++;
+         if ( pSegment->uRepeatCount > 0 )
+            iCountRetried++;
+      }
+      pSegment->uReceiveTime = 0;
+   }
+
+   for( int i=0; i<iCountLive; i++ )
+   {
+      u32 uSlot = _retransmissions_index_hash(live[i].uVideoBlockIndex, live[i].uVideoPacketIndex);
+      while ( 0 != pIndex->segments[uSlot].uReceiveTime )
+         uSlot = (uSlot + 1) & (RETRANSMISSIONS_INDEX_SEGMENTS_SLOTS-1);
+      memcpy(&pIndex->segments[uSlot], &live[i], sizeof(type_retransmissions_index_segment));
+   }
+   pIndex->iCountSegments = iCountLive;
+   if ( NULL != piCountRetried )
+      *piCountRetried = iCountRetried;
+   return iCountLive;
+}
+
+type_retransmissions_index_stats* retransmissions_index_get_stats(type_retransmissions_index* pIndex)
+{
+   if ( NULL == pIndex )
+      return NULL;
+   return &pIndex->stats;
+}
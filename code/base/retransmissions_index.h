@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../base/base.h"
+
+// Indexes used by the vehicle to answer retransmission requests in constant time:
+//  - blocks ring: video block index -> tx blocks buffer index (slot = block index modulo the ring size);
+//  - requested segments: (video block index, video packet index) -> request info, in an open addressing
+//    hash table. It counts the unique/retried requested segments and de-duplicates the resends:
+//    a segment is not resent again while a previous resend of it is still in flight.
+// Entries older than the history window are dropped by retransmissions_index_expire().
+
+#define RETRANSMISSIONS_INDEX_BLOCKS_SLOTS 256 // power of 2, more than the max tx blocks buffers
+#define RETRANSMISSIONS_INDEX_SEGMENTS_SLOTS 1024 // power of 2
+#define RETRANSMISSIONS_INDEX_MAX_SEGMENTS 512 // keeps the table at most half full
+#define RETRANSMISSIONS_INDEX_HISTORY_MS 500
+// The controller re-requests missing packets at 10 ms intervals or more,
+// requests for the same segment received sooner than this are duplicates (i.e. received on multiple radio links)
+#define RETRANSMISSIONS_INDEX_RESEND_DEDUP_MS 5
+
+typedef struct
+{
+   u32 uVideoBlockIndex;
+   u32 uReceiveTime; // first request for this segment, 0: empty slot
+   u32 uLastResendTime;
+   u8 uVideoPacketIndex;
+   u8 uRepeatCount;
+} type_retransmissions_index_segment;
+
+typedef struct
+{
+   u32 uSegmentsUnique;
+   u32 uSegmentsRetried; // of the unique ones, requested again
+   u32 uResendsDeduplicated;
+   u32 uSegmentsDropped; // table full
+   u32 uMaxProbes;
+} type_retransmissions_index_stats;
+
+typedef struct
+{
+   u32 uBlocksVideoIndex[RETRANSMISSIONS_INDEX_BLOCKS_SLOTS];
+   int iBlocksBufferIndex[RETRANSMISSIONS_INDEX_BLOCKS_SLOTS];
+   type_retransmissions_index_segment segments[RETRANSMISSIONS_INDEX_SEGMENTS_SLOTS];
+   int iCountSegments;
+   type_retransmissions_index_stats stats;
+} type_retransmissions_index;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void retransmissions_index_reset(type_retransmissions_index* pIndex);
+// Clears only the requested segments history and stats, the blocks ring is kept
+void retransmissions_index_reset_segments(type_retransmissions_index* pIndex);
+
+void retransmissions_index_set_block(type_retransmissions_index* pIndex, u32 uVideoBlockIndex, int iBufferIndex);
+// Returns the tx buffer index that stores the video block, or -1. The caller still has to check that the buffer was not reused.
+int retransmissions_index_find_block(type_retransmissions_index* pIndex, u32 uVideoBlockIndex);
+
+// Records a request for a segment. Returns the segment info (NULL if the table is full).
+// *pbIsNew is set to 1 if it's the first request for this segment in the history window.
+type_retransmissions_index_segment* retransmissions_index_add_request(type_retransmissions_index* pIndex, u32 uVideoBlockIndex, u8 uVideoPacketIndex, u32 uTimeNow, int* pbIsNew);
+// Returns 1 if the segment should be resent now (and marks it as resent), 0 if a resend of it is still in flight
+int retransmissions_index_should_resend(type_retransmissions_index* pIndex, type_retransmissions_index_segment* pSegment, u32 uTimeNow);
+
+// Drops the segments older than the history window. Returns the number of segments left;
+// *piCountRetried (optional) gets how many of them were requested more than once.
+int retransmissions_index_expire(type_retransmissions_index* pIndex, u32 uTimeNow, int* piCountRetried);
+
+type_retransmissions_index_stats* retransmissions_index_get_stats(type_retransmissions_index* pIndex);
+
+#ifdef __cplusplus
+}
+#endif
@@ -35,6 +35,7 @@
 #include "hw_procs.h"
 #include "../common/string_utils.h"
 #include "../radio/radiopackets2.h"
+#include "ipc_shm_ring.h"
 
 #include <sys/types.h>
 #include <sys/ipc.h>
@@ -42,7 +43,13 @@
 #include <errno.h>
 
 //#define RUBY_USE_FIFO_PIPES 1
-#define RUBY_USES_MSGQUEUES 1
+//#define RUBY_USES_MSGQUEUES 1
+#define RUBY_USES_SHM_RINGS 1
+
+// Shared memory rings: one per channel type, plus a doorbell FIFO the reader can wait on
+#define IPC_SHM_RING_NAME_PREFIX "/RUBY_IPC_RING_"
+#define IPC_SHM_RING_DOORBELL_PREFIX "/tmp/ruby/fifoipcbell"
+#define IPC_SHM_RING_SLOTS 64
 
 #define FIFO_RUBY_ROUTER_TO_CENTRAL "/tmp/ruby/fiforoutercentral"
 #define FIFO_RUBY_CENTRAL_TO_ROUTER "/tmp/ruby/fifocentralrouter"
@@ -64,6 +71,14 @@ int s_iRubyIPCChannelsFd[MAX_CHANNELS];
 int s_iRubyIPCChannelsType[MAX_CHANNELS];
 u8  s_uRubyIPCChannelsMsgId[MAX_CHANNELS];
 key_t s_uRubyIPCChannelsKeys[MAX_CHANNELS];
+#ifdef RUBY_USES_SHM_RINGS
+type_ipc_shm_ring s_RubyIPCChannelsRings[MAX_CHANNELS];
+#endif
+// Used by the zero copy send/read calls on the transports that can't do zero copy
+u8 s_uRubyIPCTmpReserveBuffer[ICP_CHANNEL_MAX_MSG_SIZE];
+u8 s_uRubyIPCTmpPeekBuffer[ICP_CHANNEL_MAX_MSG_SIZE];
+u8 s_uRubyIPCTmpPeekPipeBuffer[MAX_PACKET_TOTAL_SIZE];
+int s_iRubyIPCTmpPeekPipeBufferPos = 0;
 
 static int s_iRubyIPCChannelsUniqueIdCounter = 1;
 
@@ -148,6 +163,27 @@ char* _ruby_ipc_get_pipe_name(int nChannelType )
 }
 
 
+#ifdef RUBY_USES_SHM_RINGS
+void _ruby_ipc_get_ring_names(int nChannelType, char* szRingName, char* szDoorbellName)
+{
+   sprintf(szRingName, "%s%d", IPC_SHM_RING_NAME_PREFIX, nChannelType);
+   sprintf(szDoorbellName, "%s%d", IPC_SHM_RING_DOORBELL_PREFIX, nChannelType);
+}
+
+int _ruby_ipc_open_ring(int iChannelIndex, int nChannelType)
+{
+   char szRingName[64];
+   char szDoorbellName[128];
+   _ruby_ipc_get_ring_names(nChannelType, szRingName, szDoorbellName);
+   if ( ! ipc_shm_ring_open(&s_RubyIPCChannelsRings[iChannelIndex], szRingName, szDoorbellName, IPC_SHM_RING_SLOTS, ICP_CHANNEL_MAX_MSG_SIZE) )
+   {
+      log_softerror_and_alarm("[IPC] Failed to open IPC shared memory ring for channel %s", _ruby_ipc_get_channel_name(nChannelType));
+      return -1;
+   }
+   return s_RubyIPCChannelsRings[iChannelIndex].iShmFd;
+}
+#endif
+
 void _ruby_ipc_log_channels()
 {
    log_line("[IPC] Currently opened channels: %d:", s_iRubyIPCChannelsCount);
@@ -163,6 +199,19 @@ void _ruby_ipc_log_channel_info(int iChannelType, int iChannelId, int iChannelFd
 {
    if ( iChannelFd < 0 )
       return;
+   #ifdef RUBY_USES_SHM_RINGS
+   for( int i=0; i<s_iRubyIPCChannelsCount; i++ )
+   {
+      if ( s_iRubyIPCChannelsUniqueIds[i] != iChannelId )
+         continue;
+      type_ipc_shm_ring_header* pHeader = s_RubyIPCChannelsRings[i].pHeader;
+      if ( NULL != pHeader )
+         log_line("[IPC] Channel %s (id: %d, fd: %d) info: %d pending messages, %u slots, %u messages written, %u failed writes (full)",
+            _ruby_ipc_get_channel_name(iChannelType), iChannelId, iChannelFd, ipc_shm_ring_get_count(&s_RubyIPCChannelsRings[i]),
+            pHeader->uSlotsCount, pHeader->uCountWritten, pHeader->uCountFull);
+   }
+   return;
+   #endif
    struct msqid_ds msg_stats;
    if ( 0 != msgctl(iChannelFd, IPC_STAT, &msg_stats) )
       log_softerror_and_alarm("[IPC] Failed to get statistics on ICP message queue %s, id %d, fd %d",
@@ -257,6 +306,20 @@ void ruby_clear_all_ipc_channels()
 
    #endif
 
+   #ifdef RUBY_USES_SHM_RINGS
+
+   for( int i=0; i<s_iRubyIPCChannelsCount; i++ )
+   {
+      char szRingName[64];
+      char szDoorbellName[128];
+      _ruby_ipc_get_ring_names(s_iRubyIPCChannelsType[i], szRingName, szDoorbellName);
+      ipc_shm_ring_close(&s_RubyIPCChannelsRings[i]);
+      ipc_shm_ring_unlink(szRingName, szDoorbellName);
+   }
+   s_iRubyIPCChannelsCount = 0;
+
+   #endif
+
    log_line("[IPC] Done clearing all IPC channels.");
 }
 
@@ -337,6 +400,12 @@ int ruby_open_ipc_channel_write_endpoint(int nChannelType)
 
    #endif
 
+   #ifdef RUBY_USES_SHM_RINGS
+   s_iRubyIPCChannelsFd[s_iRubyIPCChannelsCount] = _ruby_ipc_open_ring(s_iRubyIPCChannelsCount, nChannelType);
+   if ( s_iRubyIPCChannelsFd[s_iRubyIPCChannelsCount] < 0 )
+      return -1;
+   #endif
+
    s_iRubyIPCChannelsUniqueIds[s_iRubyIPCChannelsCount] = s_iRubyIPCChannelsUniqueIdCounter;
    s_iRubyIPCChannelsUniqueIdCounter++;
 
@@ -423,6 +492,12 @@ int ruby_open_ipc_channel_read_endpoint(int nChannelType)
    //   log_line("[IPC] IPC channels pools max: %u bytes, max msg size: %u bytes, max msg queue total size: %u bytes", (u32)msg_info.msgpool, (u32)msg_info.msgmax, (u32)msg_info.msgmnb);
    #endif
 
+   #ifdef RUBY_USES_SHM_RINGS
+   s_iRubyIPCChannelsFd[s_iRubyIPCChannelsCount] = _ruby_ipc_open_ring(s_iRubyIPCChannelsCount, nChannelType);
+   if ( s_iRubyIPCChannelsFd[s_iRubyIPCChannelsCount] < 0 )
+      return -1;
+   #endif
+
    s_iRubyIPCChannelsUniqueIds[s_iRubyIPCChannelsCount] = s_iRubyIPCChannelsUniqueIdCounter;
    s_iRubyIPCChannelsUniqueIdCounter++;
 
@@ -470,6 +545,11 @@ int ruby_close_ipc_channel(int iChannelUniqueId)
       msgctl(fdToClose,IPC_RMID,NULL);
    #endif
 
+   // The ring stays in the system (the other end can still use it), only this process mapping is closed
+   #ifdef RUBY_USES_SHM_RINGS
+   ipc_shm_ring_close(&s_RubyIPCChannelsRings[iChannelIndex]);
+   #endif
+
 
    log_line("[IPC] Closed IPC channel %s, channel index %d, unique id %d, fd %d",
        _ruby_ipc_get_channel_name(s_iRubyIPCChannelsType[iChannelIndex]),
@@ -481,6 +561,9 @@ int ruby_close_ipc_channel(int iChannelUniqueId)
       s_iRubyIPCChannelsType[k] = s_iRubyIPCChannelsType[k+1];
       s_iRubyIPCChannelsUniqueIds[k] = s_iRubyIPCChannelsUniqueIds[k+1];
       s_uRubyIPCChannelsMsgId[k] = s_uRubyIPCChannelsMsgId[k+1];
+      #ifdef RUBY_USES_SHM_RINGS
+      memcpy(&s_RubyIPCChannelsRings[k], &s_RubyIPCChannelsRings[k+1], sizeof(type_ipc_shm_ring));
+      #endif
 
    }
    s_iRubyIPCChannelsCount--;
@@ -644,12 +727,29 @@ int ruby_ipc_channel_send_message(int iChannelUniqueId, u8* pMessage, int iLengt
    } while (iRetryCounter > 0);
    #endif
 
+   #ifdef RUBY_USES_SHM_RINGS
+   int iRetryCounter = 2;
+   do
+   {
+      if ( ipc_shm_ring_write(&s_RubyIPCChannelsRings[iFoundIndex], pMessage, iLength, s_uRubyIPCChannelsMsgId[iFoundIndex]) )
+      {
+         res = iLength;
+         break;
+      }
+      res = 0;
+      log_softerror_and_alarm("[IPC] Failed to write to IPC %s, ring is full (%d pending messages). Retry write operation only (%d)...",
+         _ruby_ipc_get_channel_name(s_iRubyIPCChannelsType[iFoundIndex]), ipc_shm_ring_get_count(&s_RubyIPCChannelsRings[iFoundIndex]), iRetryCounter);
+      iRetryCounter--;
+      hardware_sleep_ms(10);
+   } while (iRetryCounter > 0);
+   #endif
+
    #ifdef PROFILE_IPC
    u32 uTimeTotal = get_current_timestamp_ms() - uTimeStart;
    if ( uTimeTotal > PROFILE_IPC_MAX_TIME )
    {
       t_packet_header* pPH = (t_packet_header*)pMessage;
-      log_softerror_and_alarm("[IPC] Write message (id: %d, %d bytes) on channel %s took too long (%u ms) (Message component: %d, msg type: %d, msg length:%d).", msg.data[4], iLength, _ruby_ipc_get_channel_name(s_iRubyIPCChannelsType[iFoundIndex]), uTimeTotal, (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE), pPH->packet_type, pPH->total_length);
+      log_softerror_and_alarm("[IPC] Write message (id: %d, %d bytes) on channel %s took too long (%u ms) (Message component: %d, msg type: %d, msg length:%d).", s_uRubyIPCChannelsMsgId[iFoundIndex], iLength, _ruby_ipc_get_channel_name(s_iRubyIPCChannelsType[iFoundIndex]), uTimeTotal, (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE), pPH->packet_type, pPH->total_length);
    }
    #endif
 
@@ -666,13 +766,17 @@ u8* ruby_ipc_try_read_message(int iChannelUniqueId, u8* pTempBuffer, int* pTempB
    }
 
    int iFoundIndex = -1;
+   #if defined(RUBY_USE_FIFO_PIPES) || defined(RUBY_USES_MSGQUEUES)
    int iChannelFd = 0;
+   #endif
    int iChannelType = 0;
    for( int i=0; i<s_iRubyIPCChannelsCount; i++ )
    {
       if ( s_iRubyIPCChannelsUniqueIds[i] == iChannelUniqueId )
       {
+         #if defined(RUBY_USE_FIFO_PIPES) || defined(RUBY_USES_MSGQUEUES)
          iChannelFd = s_iRubyIPCChannelsFd[i];
+         #endif
          iChannelType = s_iRubyIPCChannelsType[i];
          iFoundIndex = i;
          break;
@@ -692,7 +796,9 @@ u8* ruby_ipc_try_read_message(int iChannelUniqueId, u8* pTempBuffer, int* pTempB
    }
 
    u8* pReturn = NULL;
+   #if defined(RUBY_USES_MSGQUEUES) || defined(PROFILE_IPC)
    int lenReadIPCMsgQueue = 0;
+   #endif
 
    #ifdef PROFILE_IPC
    u32 uTimeStart = get_current_timestamp_ms();
@@ -805,6 +911,28 @@ u8* ruby_ipc_try_read_message(int iChannelUniqueId, u8* pTempBuffer, int* pTempB
 
    #endif
 
+   #ifdef RUBY_USES_SHM_RINGS
+
+   int iMsgLen = 0;
+   u8 uMsgId = 0;
+   u8* pMessage = ipc_shm_ring_peek(&s_RubyIPCChannelsRings[iFoundIndex], &iMsgLen, &uMsgId);
+   if ( NULL != pMessage )
+   {
+      #ifdef PROFILE_IPC
+      lenReadIPCMsgQueue = iMsgLen;
+      #endif
+      if ( iMsgLen <= 0 || iMsgLen >= ICP_CHANNEL_MAX_MSG_SIZE - 6 )
+         log_softerror_and_alarm("[IPC] Received invalid message on channel %s, id: %d, length: %d", _ruby_ipc_get_channel_name(iChannelType), uMsgId, iMsgLen );
+      else
+      {
+         memcpy(pOutputBuffer, pMessage, iMsgLen);
+         pReturn = pOutputBuffer;
+      }
+      ipc_shm_ring_release(&s_RubyIPCChannelsRings[iFoundIndex]);
+   }
+
+   #endif
+
    #ifdef PROFILE_IPC
    u32 uTimeTotal = get_current_timestamp_ms() - uTimeStart;
    if ( (uTimeTotal > PROFILE_IPC_MAX_TIME + timeoutMicrosec/1000) || uTimeTotal >= 50 )
@@ -822,6 +950,108 @@ u8* ruby_ipc_try_read_message(int iChannelUniqueId, u8* pTempBuffer, int* pTempB
    return pReturn;
 }
 
+int ruby_ipc_get_pollable_fd(int iChannelUniqueId)
+{
+   // Message queues can't be waited on with poll/epoll
+   #ifdef RUBY_USE_FIFO_PIPES
+   for( int i=0; i<s_iRubyIPCChannelsCount; i++ )
+      if ( s_iRubyIPCChannelsUniqueIds[i] == iChannelUniqueId )
+         return s_iRubyIPCChannelsFd[i];
+   #endif
+   #ifdef RUBY_USES_SHM_RINGS
+   for( int i=0; i<s_iRubyIPCChannelsCount; i++ )
+      if ( s_iRubyIPCChannelsUniqueIds[i] == iChannelUniqueId )
+      {
+         ipc_shm_ring_arm_doorbell(&s_RubyIPCChannelsRings[i]);
+         return ipc_shm_ring_get_doorbell_fd(&s_RubyIPCChannelsRings[i]);
+      }
+   #endif
+   return -1;
+}
+
+static int _ruby_ipc_get_channel_index(int iChannelUniqueId)
+{
+   for( int i=0; i<s_iRubyIPCChannelsCount; i++ )
+      if ( s_iRubyIPCChannelsUniqueIds[i] == iChannelUniqueId )
+         return i;
+   return -1;
+}
+
+u8* ruby_ipc_channel_reserve_message(int iChannelUniqueId, int iMaxLength)
+{
+   int iIndex = _ruby_ipc_get_channel_index(iChannelUniqueId);
+   if ( (-1 == iIndex) || (iMaxLength <= 0) || (iMaxLength >= ICP_CHANNEL_MAX_MSG_SIZE-6) )
+   {
+      log_softerror_and_alarm("[IPC] Tried to reserve a message of %d bytes on an invalid channel (unique id %d)", iMaxLength, iChannelUniqueId);
+      return NULL;
+   }
+   #ifdef RUBY_USES_SHM_RINGS
+   u8* pBuffer = ipc_shm_ring_reserve(&s_RubyIPCChannelsRings[iIndex], iMaxLength);
+   if ( NULL == pBuffer )
+      log_softerror_and_alarm("[IPC] Failed to reserve a message on IPC %s, ring is full (%d pending messages).",
+         _ruby_ipc_get_channel_name(s_iRubyIPCChannelsType[iIndex]), ipc_shm_ring_get_count(&s_RubyIPCChannelsRings[iIndex]));
+   return pBuffer;
+   #else
+   return s_uRubyIPCTmpReserveBuffer;
+   #endif
+}
+
+int ruby_ipc_channel_commit_message(int iChannelUniqueId, u8* pMessage, int iLength)
+{
+   #ifdef RUBY_USES_SHM_RINGS
+   int iIndex = _ruby_ipc_get_channel_index(iChannelUniqueId);
+   if ( (-1 == iIndex) || (NULL == pMessage) )
+      return 0;
+   u32 crc = base_compute_crc32(pMessage + sizeof(u32), iLength-sizeof(u32));
+   memcpy(pMessage, &crc, sizeof(u32));
+   s_uRubyIPCChannelsMsgId[iIndex]++;
+   if ( ! ipc_shm_ring_commit(&s_RubyIPCChannelsRings[iIndex], pMessage, iLength, s_uRubyIPCChannelsMsgId[iIndex]) )
+      return 0;
+   return iLength;
+   #else
+   return ruby_ipc_channel_send_message(iChannelUniqueId, pMessage, iLength);
+   #endif
+}
+
+u8* ruby_ipc_channel_peek_message(int iChannelUniqueId, int* piLength)
+{
+   int iIndex = _ruby_ipc_get_channel_index(iChannelUniqueId);
+   if ( -1 == iIndex )
+      return NULL;
+   #ifdef RUBY_USES_SHM_RINGS
+   while ( 1 )
+   {
+      int iMsgLen = 0;
+      u8 uMsgId = 0;
+      u8* pMessage = ipc_shm_ring_peek(&s_RubyIPCChannelsRings[iIndex], &iMsgLen, &uMsgId);
+      if ( NULL == pMessage )
+         return NULL;
+      if ( (iMsgLen > 0) && (iMsgLen < ICP_CHANNEL_MAX_MSG_SIZE - 6) )
+      {
+         if ( NULL != piLength )
+            *piLength = iMsgLen;
+         return pMessage;
+      }
+      log_softerror_and_alarm("[IPC] Received invalid message on channel %s, id: %d, length: %d", _ruby_ipc_get_channel_name(s_iRubyIPCChannelsType[iIndex]), uMsgId, iMsgLen );
+      ipc_shm_ring_release(&s_RubyIPCChannelsRings[iIndex]);
+   }
+   #else
+   u8* pMessage = ruby_ipc_try_read_message(iChannelUniqueId, s_uRubyIPCTmpPeekPipeBuffer, &s_iRubyIPCTmpPeekPipeBufferPos, s_uRubyIPCTmpPeekBuffer);
+   if ( (NULL != pMessage) && (NULL != piLength) )
+      *piLength = ((t_packet_header*)pMessage)->total_length;
+   return pMessage;
+   #endif
+}
+
+void ruby_ipc_channel_release_message(int iChannelUniqueId)
+{
+   #ifdef RUBY_USES_SHM_RINGS
+   int iIndex = _ruby_ipc_get_channel_index(iChannelUniqueId);
+   if ( -1 != iIndex )
+      ipc_shm_ring_release(&s_RubyIPCChannelsRings[iIndex]);
+   #endif
+}
+
 int ruby_ipc_get_read_continous_error_count()
 {
    return s_iRubyIPCCountReadErrors;
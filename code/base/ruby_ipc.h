@@ -32,6 +32,19 @@ int ruby_close_ipc_channel(int iChannelUniqueId);
 int ruby_ipc_channel_send_message(int iChannelUniqueId, u8* pMessage, int iLength);
 u8* ruby_ipc_try_read_message(int iChannelUniqueId, u8* pTempBuffer, int* pTempBufferPos, u8* pOutputBuffer);
 
+// Returns the fd to wait on for new messages (poll/epoll), or -1 if the channel type can't be waited on.
+// Call it before waiting on the channel: messages already pending make the fd readable.
+int ruby_ipc_get_pollable_fd(int iChannelUniqueId);
+
+// Zero copy send: build the message in place in the reserved buffer, then commit it (with its final length).
+// Every reserved message must be committed, and promptly: the reader skips a slot left uncommitted for
+// IPC_SHM_RING_STALLED_SLOT_TIMEOUT_MS (commit returns 0 then). Without shared memory rings the message is copied on commit.
+u8* ruby_ipc_channel_reserve_message(int iChannelUniqueId, int iMaxLength);
+int ruby_ipc_channel_commit_message(int iChannelUniqueId, u8* pMessage, int iLength);
+// Zero copy read: returns the next message in place, NULL if none. It stays valid until it's released.
+u8* ruby_ipc_channel_peek_message(int iChannelUniqueId, int* piLength);
+void ruby_ipc_channel_release_message(int iChannelUniqueId);
+
 int ruby_ipc_get_read_continous_error_count();
 
 #ifdef __cplusplus
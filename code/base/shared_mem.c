@@ -32,6 +32,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <sched.h>
+#include <time.h>
 #include "base.h"
 #include "shared_mem.h"
 #include "../radio/radiopackets2.h"
@@ -91,16 +93,104 @@ void* open_shared_mem_for_read(const char* name, int size)
    return open_shared_mem(name, size, 1);
 }
 
+void* open_shared_mem_block(const char* name, int size, int readOnly)
+{
+   u8* pMemory = (u8*) open_shared_mem(name, size + sizeof(shared_mem_block_header), readOnly);
+   if ( NULL == pMemory )
+      return NULL;
+   // Each writer starts a new range of generations, so that readers don't take a recreated block as unchanged
+   if ( ! readOnly )
+   {
+      ((shared_mem_block_header*)pMemory)->uBlockSize = (u32)size;
+      ((shared_mem_block_header*)pMemory)->uSequence = ((u32)time(NULL)) << 1;
+   }
+   return pMemory + sizeof(shared_mem_block_header);
+}
+
+void close_shared_mem_block(void* pBlock, int size)
+{
+   if ( NULL != pBlock )
+      munmap((u8*)pBlock - sizeof(shared_mem_block_header), size + sizeof(shared_mem_block_header));
+}
+
+static shared_mem_block_header* _shared_mem_block_get_header(const void* pBlock)
+{
+   return (shared_mem_block_header*)((u8*)pBlock - sizeof(shared_mem_block_header));
+}
+
+void shared_mem_block_begin_write(void* pBlock)
+{
+   if ( NULL == pBlock )
+      return;
+   shared_mem_block_header* pHeader = _shared_mem_block_get_header(pBlock);
+   __atomic_store_n(&pHeader->uSequence, pHeader->uSequence + 1, __ATOMIC_RELAXED);
+   // The block changes must not be seen before the sequence is odd
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void shared_mem_block_end_write(void* pBlock)
+{
+   if ( NULL == pBlock )
+      return;
+   shared_mem_block_header* pHeader = _shared_mem_block_get_header(pBlock);
+   __atomic_store_n(&pHeader->uSequence, pHeader->uSequence + 1, __ATOMIC_RELEASE);
+}
+
+void shared_mem_block_write(void* pBlock, const void* pSource, int iSize)
+{
+   if ( (NULL == pBlock) || (NULL == pSource) )
+      return;
+   shared_mem_block_begin_write(pBlock);
+   memcpy(pBlock, pSource, iSize);
+   shared_mem_block_end_write(pBlock);
+}
+
+int shared_mem_block_read(const void* pBlock, void* pDest, int iSize, u32* puGeneration)
+{
+   if ( (NULL == pBlock) || (NULL == pDest) )
+      return SHARED_MEM_BLOCK_READ_FAILED;
+   shared_mem_block_header* pHeader = _shared_mem_block_get_header(pBlock);
+
+   // Writers hold a block only for a memcpy: retry a few times, then give up until the next read
+   for( int iRetry=0; iRetry<20; iRetry++ )
+   {
+      u32 uSequence = __atomic_load_n(&pHeader->uSequence, __ATOMIC_ACQUIRE);
+      if ( uSequence & 0x01 )
+      {
+         if ( iRetry > 2 )
+            sched_yield();
+         continue;
+      }
+      if ( (NULL != puGeneration) && (uSequence == *puGeneration) )
+         return SHARED_MEM_BLOCK_UNCHANGED;
+      memcpy(pDest, pBlock, iSize);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if ( uSequence != __atomic_load_n(&pHeader->uSequence, __ATOMIC_RELAXED) )
+         continue;
+      if ( NULL != puGeneration )
+         *puGeneration = uSequence;
+      return SHARED_MEM_BLOCK_UPDATED;
+   }
+   return SHARED_MEM_BLOCK_READ_FAILED;
+}
+
+u32 shared_mem_block_get_generation(const void* pBlock)
+{
+   if ( NULL == pBlock )
+      return 0;
+   return __atomic_load_n(&_shared_mem_block_get_header(pBlock)->uSequence, __ATOMIC_ACQUIRE) & (~0x01);
+}
+
 shared_mem_process_stats* shared_mem_process_stats_open_read(const char* szName)
 {
-   void *retVal =  open_shared_mem(szName, sizeof(shared_mem_process_stats), 1);
+   void *retVal =  open_shared_mem_block(szName, sizeof(shared_mem_process_stats), 1);
    shared_mem_process_stats *tretval = (shared_mem_process_stats*)retVal;
    return tretval;
 }
 
 shared_mem_process_stats* shared_mem_process_stats_open_write(const char* szName)
 {
-   void *retVal =  open_shared_mem(szName, sizeof(shared_mem_process_stats), 0);
+   void *retVal =  open_shared_mem_block(szName, sizeof(shared_mem_process_stats), 0);
    shared_mem_process_stats *tretval = (shared_mem_process_stats*)retVal;
    memset( tretval, 0, sizeof(shared_mem_process_stats));
    return tretval;
@@ -108,8 +198,7 @@ shared_mem_process_stats* shared_mem_process_stats_open_write(const char* szName
 
 void shared_mem_process_stats_close(const char* szName, shared_mem_process_stats* pAddress)
 {
-   if ( NULL != pAddress )
-      munmap(pAddress, sizeof(shared_mem_process_stats));
+   close_shared_mem_block(pAddress, sizeof(shared_mem_process_stats));
    //shm_unlink(szName);
 }
 
@@ -118,11 +207,13 @@ void process_stats_reset(shared_mem_process_stats* pStats, u32 timeNow)
    if ( NULL == pStats )
       return;
 
+   shared_mem_block_begin_write(pStats);
    pStats->lastActiveTime = timeNow;
    pStats->lastRadioTxTime = timeNow;
    pStats->lastRadioRxTime = timeNow;
    pStats->lastIPCIncomingTime = timeNow;
    pStats->lastIPCOutgoingTime = timeNow;
+   shared_mem_block_end_write(pStats);
 }
 
 void process_stats_mark_active(shared_mem_process_stats* pStats, u32 timeNow)
@@ -136,20 +227,19 @@ void process_stats_mark_active(shared_mem_process_stats* pStats, u32 timeNow)
 
 shared_mem_radio_stats* shared_mem_radio_stats_open_for_read()
 {
-   void *retVal = open_shared_mem_for_read(SHARED_MEM_RADIO_STATS, sizeof(shared_mem_radio_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_RADIO_STATS, sizeof(shared_mem_radio_stats), 1);
    return (shared_mem_radio_stats*)retVal;
 }
 
 shared_mem_radio_stats* shared_mem_radio_stats_open_for_write()
 {
-   void *retVal = open_shared_mem_for_write(SHARED_MEM_RADIO_STATS, sizeof(shared_mem_radio_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_RADIO_STATS, sizeof(shared_mem_radio_stats), 0);
    return (shared_mem_radio_stats*)retVal;
 }
 
 void shared_mem_radio_stats_close(shared_mem_radio_stats* pAddress)
 {
-   if ( NULL != pAddress )
-      munmap(pAddress, sizeof(shared_mem_radio_stats));
+   close_shared_mem_block(pAddress, sizeof(shared_mem_radio_stats));
    //shm_unlink(szName);
 }
 
@@ -173,75 +263,71 @@ void shared_mem_radio_stats_rx_hist_close(shared_mem_radio_stats_rx_hist* pAddre
 
 shared_mem_video_info_stats* shared_mem_video_info_stats_open_for_read()
 {
-   void *retVal = open_shared_mem_for_read(SHARED_MEM_VIDEO_STREAM_INFO_STATS , sizeof(shared_mem_video_info_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_STREAM_INFO_STATS, sizeof(shared_mem_video_info_stats), 1);
    return (shared_mem_video_info_stats*)retVal;
 }
 
 shared_mem_video_info_stats* shared_mem_video_info_stats_open_for_write()
 {
-   void *retVal = open_shared_mem_for_write(SHARED_MEM_VIDEO_STREAM_INFO_STATS , sizeof(shared_mem_video_info_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_STREAM_INFO_STATS, sizeof(shared_mem_video_info_stats), 0);
    return (shared_mem_video_info_stats*)retVal;
 }
 
 void shared_mem_video_info_stats_close(shared_mem_video_info_stats* pAddress)
 {
-   if ( NULL != pAddress )
-      munmap(pAddress, sizeof(shared_mem_video_info_stats));
+   close_shared_mem_block(pAddress, sizeof(shared_mem_video_info_stats));
 }
 
 
 shared_mem_video_info_stats* shared_mem_video_info_stats_radio_in_open_for_read()
 {
-   void *retVal = open_shared_mem_for_read(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_IN , sizeof(shared_mem_video_info_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_IN, sizeof(shared_mem_video_info_stats), 1);
    return (shared_mem_video_info_stats*)retVal;
 }
 
 shared_mem_video_info_stats* shared_mem_video_info_stats_radio_in_open_for_write()
 {
-   void *retVal = open_shared_mem_for_write(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_IN , sizeof(shared_mem_video_info_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_IN, sizeof(shared_mem_video_info_stats), 0);
    return (shared_mem_video_info_stats*)retVal;
 }
 
 void shared_mem_video_info_stats_radio_in_close(shared_mem_video_info_stats* pAddress)
 {
-   if ( NULL != pAddress )
-      munmap(pAddress, sizeof(shared_mem_video_info_stats));
+   close_shared_mem_block(pAddress, sizeof(shared_mem_video_info_stats));
 }
 
 shared_mem_video_info_stats* shared_mem_video_info_stats_radio_out_open_for_read()
 {
-   void *retVal = open_shared_mem_for_read(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_OUT , sizeof(shared_mem_video_info_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_OUT, sizeof(shared_mem_video_info_stats), 1);
    return (shared_mem_video_info_stats*)retVal;
 }
 
 shared_mem_video_info_stats* shared_mem_video_info_stats_radio_out_open_for_write()
 {
-   void *retVal = open_shared_mem_for_write(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_OUT , sizeof(shared_mem_video_info_stats));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_STREAM_INFO_STATS_RADIO_OUT, sizeof(shared_mem_video_info_stats), 0);
    return (shared_mem_video_info_stats*)retVal;
 }
 
 void shared_mem_video_info_stats_radio_out_close(shared_mem_video_info_stats* pAddress)
 {
-   if ( NULL != pAddress )
-      munmap(pAddress, sizeof(shared_mem_video_info_stats));
+   close_shared_mem_block(pAddress, sizeof(shared_mem_video_info_stats));
 }
 
 shared_mem_video_link_stats_and_overwrites* shared_mem_video_link_stats_open_for_read()
 {
-   void *retVal = open_shared_mem_for_read(SHARED_MEM_VIDEO_LINK_STATS , sizeof(shared_mem_video_link_stats_and_overwrites));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_LINK_STATS, sizeof(shared_mem_video_link_stats_and_overwrites), 1);
    return (shared_mem_video_link_stats_and_overwrites*)retVal;
 }
 
 shared_mem_video_link_stats_and_overwrites* shared_mem_video_link_stats_open_for_write()
 {
-   void *retVal = open_shared_mem_for_write(SHARED_MEM_VIDEO_LINK_STATS , sizeof(shared_mem_video_link_stats_and_overwrites));
+   void *retVal = open_shared_mem_block(SHARED_MEM_VIDEO_LINK_STATS, sizeof(shared_mem_video_link_stats_and_overwrites), 0);
    return (shared_mem_video_link_stats_and_overwrites*)retVal;
 }
 
 void shared_mem_video_link_stats_close(shared_mem_video_link_stats_and_overwrites* pAddress)
 {
-   if ( NULL != pAddress )
-      munmap(pAddress, sizeof(shared_mem_video_link_stats_and_overwrites));
+   close_shared_mem_block(pAddress, sizeof(shared_mem_video_link_stats_and_overwrites));
 }
 
 shared_mem_video_link_graphs* shared_mem_video_link_graphs_open_for_read()
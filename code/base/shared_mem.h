@@ -227,6 +227,35 @@ void* open_shared_mem(const char* name, int size, int readOnly);
 void* open_shared_mem_for_write(const char* name, int size);
 void* open_shared_mem_for_read(const char* name, int size);
 
+// Versioned shared memory blocks (radio stats, video info stats, video link stats, process stats):
+// a seqlock header is placed in the shared memory object just before the block; the open functions
+// return the block itself, so its layout and the code that uses it directly are unchanged.
+// Writers publish a whole block with shared_mem_block_write(), or wrap in place updates in begin/end write;
+// readers get consistent copies with shared_mem_block_read(), that also skips the blocks not changed
+// since the last read.
+
+typedef struct
+{
+   volatile u32 uSequence; // odd while the block is being written; the even values are the block generations
+   u32 uBlockSize;
+   u32 uReserved[2];
+} shared_mem_block_header;
+
+#define SHARED_MEM_BLOCK_READ_FAILED -1
+#define SHARED_MEM_BLOCK_UNCHANGED 0
+#define SHARED_MEM_BLOCK_UPDATED 1
+
+void* open_shared_mem_block(const char* name, int size, int readOnly);
+void close_shared_mem_block(void* pBlock, int size);
+void shared_mem_block_begin_write(void* pBlock);
+void shared_mem_block_end_write(void* pBlock);
+void shared_mem_block_write(void* pBlock, const void* pSource, int iSize);
+// Copies the block to pDest if it changed since *puGeneration (always, if puGeneration is NULL).
+// Returns SHARED_MEM_BLOCK_UPDATED, SHARED_MEM_BLOCK_UNCHANGED or SHARED_MEM_BLOCK_READ_FAILED (the writer
+// kept it busy, pDest is left as it was)
+int shared_mem_block_read(const void* pBlock, void* pDest, int iSize, u32* puGeneration);
+u32 shared_mem_block_get_generation(const void* pBlock);
+
 shared_mem_process_stats* shared_mem_process_stats_open_read(const char* szName);
 shared_mem_process_stats* shared_mem_process_stats_open_write(const char* szName);
 void shared_mem_process_stats_close(const char* szName, shared_mem_process_stats* pAddress);
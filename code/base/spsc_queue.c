@@ -0,0 +1,107 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "base.h"
+#include "spsc_queue.h"
+
+int spsc_queue_init(type_spsc_queue* pQueue, int iCapacity)
+{
+   if ( NULL == pQueue )
+      return 0;
+   memset(pQueue, 0, sizeof(type_spsc_queue));
+   if ( (iCapacity < 2) || (iCapacity > (1<<20)) )
+   {
+      log_softerror_and_alarm("[SPSCQueue] Invalid capacity: %d", iCapacity);
+      return 0;
+   }
+   u32 uSize = 2;
+   while ( uSize < (u32)iCapacity )
+      uSize <<= 1;
+
+   pQueue->pItems = (void**) malloc(uSize * sizeof(void*));
+   if ( NULL == pQueue->pItems )
+   {
+      log_softerror_and_alarm("[SPSCQueue] Failed to allocate %u items.", uSize);
+      return 0;
+   }
+   memset(pQueue->pItems, 0, uSize * sizeof(void*));
+   pQueue->uMask = uSize - 1;
+   return 1;
+}
+
+void spsc_queue_uninit(type_spsc_queue* pQueue)
+{
+   if ( NULL == pQueue )
+      return;
+   if ( NULL != pQueue->pItems )
+      free(pQueue->pItems);
+   pQueue->pItems = NULL;
+   pQueue->uMask = 0;
+}
+
+int spsc_queue_push(type_spsc_queue* pQueue, void* pItem)
+{
+   u32 uHead = __atomic_load_n(&pQueue->uHead, __ATOMIC_RELAXED);
+   u32 uTail = __atomic_load_n(&pQueue->uTail, __ATOMIC_ACQUIRE);
+   if ( uHead - uTail > pQueue->uMask )
+   {
+      pQueue->uCountFull++;
+      return 0;
+   }
+   pQueue->pItems[uHead & pQueue->uMask] = pItem;
+   __atomic_store_n(&pQueue->uHead, uHead + 1, __ATOMIC_RELEASE);
+   if ( uHead + 1 - uTail > pQueue->uMaxUsed )
+      pQueue->uMaxUsed = uHead + 1 - uTail;
+   return 1;
+}
+
+void* spsc_queue_pop(type_spsc_queue* pQueue)
+{
+   u32 uTail = __atomic_load_n(&pQueue->uTail, __ATOMIC_RELAXED);
+   u32 uHead = __atomic_load_n(&pQueue->uHead, __ATOMIC_ACQUIRE);
+   if ( uHead == uTail )
+      return NULL;
+   void* pItem = pQueue->pItems[uTail & pQueue->uMask];
+   __atomic_store_n(&pQueue->uTail, uTail + 1, __ATOMIC_RELEASE);
+   return pItem;
+}
+
+int spsc_queue_get_count(type_spsc_queue* pQueue)
+{
+   u32 uTail = __atomic_load_n(&pQueue->uTail, __ATOMIC_ACQUIRE);
+   u32 uHead = __atomic_load_n(&pQueue->uHead, __ATOMIC_ACQUIRE);
+   return (int)(uHead - uTail);
+}
+
+int spsc_queue_get_capacity(type_spsc_queue* pQueue)
+{
+   return (int)(pQueue->uMask + 1);
+}
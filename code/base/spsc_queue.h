@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../base/base.h"
+
+// Bounded lock-free queue of pointers, for exactly one producer thread and one consumer thread.
+// Push and pop never block; push fails when the queue is full, pop returns NULL when it's empty.
+// The capacity is rounded up to a power of 2.
+// Producer and consumer indexes are on separate cache lines so the two threads don't share one.
+
+#define SPSC_QUEUE_CACHE_LINE 64
+
+typedef struct
+{
+   void** pItems;
+   u32 uMask;
+   u32 uMaxUsed; // updated by the producer
+   u32 uCountFull; // failed pushes, updated by the producer
+   u8 uPadding0[SPSC_QUEUE_CACHE_LINE];
+   volatile u32 uHead; // written by the producer only
+   u8 uPadding1[SPSC_QUEUE_CACHE_LINE - sizeof(u32)];
+   volatile u32 uTail; // written by the consumer only
+   u8 uPadding2[SPSC_QUEUE_CACHE_LINE - sizeof(u32)];
+} type_spsc_queue;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns 1 on success, 0 on failure
+int spsc_queue_init(type_spsc_queue* pQueue, int iCapacity);
+void spsc_queue_uninit(type_spsc_queue* pQueue);
+
+// Producer side. Returns 1 if the item was added, 0 if the queue is full
+int spsc_queue_push(type_spsc_queue* pQueue, void* pItem);
+// Consumer side. Returns NULL if the queue is empty
+void* spsc_queue_pop(type_spsc_queue* pQueue);
+
+int spsc_queue_get_count(type_spsc_queue* pQueue);
+int spsc_queue_get_capacity(type_spsc_queue* pQueue);
+
+#ifdef __cplusplus
+}
+#endif
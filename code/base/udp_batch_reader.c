@@ -0,0 +1,343 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+         * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+       * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "base.h"
+#include "udp_batch_reader.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#define UDP_BATCH_READER_CONTROL_SIZE (CMSG_SPACE(sizeof(u32)) + CMSG_SPACE(sizeof(int)))
+
+void udp_batch_reader_get_default_config(type_udp_batch_reader_config* pConfig)
+{
+   if ( NULL == pConfig )
+      return;
+   memset(pConfig, 0, sizeof(type_udp_batch_reader_config));
+   pConfig->iBatchSize = 16;
+   pConfig->iBufferSize = UDP_BATCH_READER_DEFAULT_BUFFER_SIZE;
+   pConfig->iRecvBufferKb = 0;
+   pConfig->iBusyPollMicros = 0;
+   pConfig->iGRO = 0;
+}
+
+static void _udp_batch_reader_set_socket_options(type_udp_batch_reader* pReader)
+{
+   int iValue = 1;
+   if ( 0 != setsockopt(pReader->iSocket, SOL_SOCKET, SO_RXQ_OVFL, &iValue, sizeof(iValue)) )
+      log_softerror_and_alarm("[UDPBatchReader] Unable to set SO_RXQ_OVFL: %s", strerror(errno));
+
+   if ( pReader->config.iRecvBufferKb > 0 )
+   {
+      iValue = pReader->config.iRecvBufferKb * 1024;
+      // SO_RCVBUFFORCE is not limited by rmem_max, but needs CAP_NET_ADMIN
+      if ( 0 != setsockopt(pReader->iSocket, SOL_SOCKET, SO_RCVBUFFORCE, &iValue, sizeof(iValue)) )
+      if ( 0 != setsockopt(pReader->iSocket, SOL_SOCKET, SO_RCVBUF, &iValue, sizeof(iValue)) )
+         log_softerror_and_alarm("[UDPBatchReader] Unable to set SO_RCVBUF to %d kb: %s", pReader->config.iRecvBufferKb, strerror(errno));
+   }
+   int iRecvBuffer = 0;
+   socklen_t iLen = sizeof(iRecvBuffer);
+   if ( 0 == getsockopt(pReader->iSocket, SOL_SOCKET, SO_RCVBUF, &iRecvBuffer, &iLen) )
+      log_line("[UDPBatchReader] Socket receive buffer: %d bytes", iRecvBuffer);
+
+   if ( pReader->config.iBusyPollMicros > 0 )
+   {
+      iValue = pReader->config.iBusyPollMicros;
+      if ( 0 != setsockopt(pReader->iSocket, SOL_SOCKET, SO_BUSY_POLL, &iValue, sizeof(iValue)) )
+         log_softerror_and_alarm("[UDPBatchReader] Unable to set SO_BUSY_POLL: %s", strerror(errno));
+   }
+
+   if ( pReader->config.iGRO )
+   {
+      iValue = 1;
+      if ( 0 != setsockopt(pReader->iSocket, SOL_UDP, UDP_GRO, &iValue, sizeof(iValue)) )
+      {
+         log_softerror_and_alarm("[UDPBatchReader] Unable to set UDP_GRO: %s", strerror(errno));
+         pReader->config.iGRO = 0;
+      }
+   }
+}
+
+int udp_batch_reader_init(type_udp_batch_reader* pReader, int iSocket, type_udp_batch_reader_config* pConfig)
+{
+   if ( NULL == pReader )
+      return 0;
+   memset(pReader, 0, sizeof(type_udp_batch_reader));
+   pReader->iSocket = iSocket;
+   if ( NULL != pConfig )
+      memcpy(&pReader->config, pConfig, sizeof(type_udp_batch_reader_config));
+   else
+      udp_batch_reader_get_default_config(&pReader->config);
+
+   if ( pReader->config.iBatchSize < 1 )
+      pReader->config.iBatchSize = 1;
+   if ( pReader->config.iBatchSize > UDP_BATCH_READER_MAX_BATCH )
+      pReader->config.iBatchSize = UDP_BATCH_READER_MAX_BATCH;
+   if ( pReader->config.iBufferSize < 64 )
+      pReader->config.iBufferSize = UDP_BATCH_READER_DEFAULT_BUFFER_SIZE;
+
+   if ( iSocket < 0 )
+      return 0;
+   _udp_batch_reader_set_socket_options(pReader);
+
+   int iCount = pReader->config.iBatchSize;
+   pReader->iBufferSize = pReader->config.iGRO?UDP_BATCH_READER_GRO_BUFFER_SIZE:pReader->config.iBufferSize;
+   pReader->pBuffers = (u8*) malloc(iCount * pReader->iBufferSize);
+   pReader->pControl = (u8*) malloc(iCount * UDP_BATCH_READER_CONTROL_SIZE);
+   pReader->pMessages = (struct mmsghdr*) malloc(iCount * sizeof(struct mmsghdr));
+   pReader->pIOVecs = (struct iovec*) malloc(iCount * sizeof(struct iovec));
+   pReader->piSegmentSizes = (int*) malloc(iCount * sizeof(int));
+   if ( (NULL == pReader->pBuffers) || (NULL == pReader->pControl) || (NULL == pReader->pMessages) || (NULL == pReader->pIOVecs) || (NULL == pReader->piSegmentSizes) )
+   {
+      log_softerror_and_alarm("[UDPBatchReader] Failed to allocate buffers for %d datagrams of %d bytes.", iCount, pReader->iBufferSize);
+      udp_batch_reader_uninit(pReader);
+      return 0;
+   }
+   memset(pReader->pMessages, 0, iCount * sizeof(struct mmsghdr));
+   for( int i=0; i<iCount; i++ )
+   {
+      pReader->pIOVecs[i].iov_base = pReader->pBuffers + i * pReader->iBufferSize;
+      pReader->pIOVecs[i].iov_len = pReader->iBufferSize;
+      pReader->pMessages[i].msg_hdr.msg_iov = &pReader->pIOVecs[i];
+      pReader->pMessages[i].msg_hdr.msg_iovlen = 1;
+   }
+   log_line("[UDPBatchReader] Initialized on socket %d: batch of %d datagrams, %d bytes buffers, recv buffer: %d kb, busy poll: %d us, GRO: %s",
+      iSocket, iCount, pReader->iBufferSize, pReader->config.iRecvBufferKb, pReader->config.iBusyPollMicros, pReader->config.iGRO?"yes":"no");
+   return 1;
+}
+
+void udp_batch_reader_uninit(type_udp_batch_reader* pReader)
+{
+   if ( NULL == pReader )
+      return;
+   if ( NULL != pReader->pBuffers )
+      free(pReader->pBuffers);
+   if ( NULL != pReader->pControl )
+      free(pReader->pControl);
+   if ( NULL != pReader->pMessages )
+      free(pReader->pMessages);
+   if ( NULL != pReader->pIOVecs )
+      free(pReader->pIOVecs);
+   if ( NULL != pReader->piSegmentSizes )
+      free(pReader->piSegmentSizes);
+   pReader->pBuffers = NULL;
+   pReader->pControl = NULL;
+   pReader->pMessages = NULL;
+   pReader->pIOVecs = NULL;
+   pReader->piSegmentSizes = NULL;
+   pReader->iCountMessages = 0;
+   pReader->iCurrentMessage = 0;
+   pReader->iCurrentOffset = 0;
+}
+
+static void _udp_batch_reader_parse_control(type_udp_batch_reader* pReader, int iMessage)
+{
+   struct msghdr* pMsg = &pReader->pMessages[iMessage].msg_hdr;
+   pReader->piSegmentSizes[iMessage] = 0;
+   for( struct cmsghdr* pCMsg = CMSG_FIRSTHDR(pMsg); NULL != pCMsg; pCMsg = CMSG_NXTHDR(pMsg, pCMsg) )
+   {
+      if ( (pCMsg->cmsg_level == SOL_SOCKET) && (pCMsg->cmsg_type == SO_RXQ_OVFL) )
+      {
+         // Total datagrams dropped on this socket so far
+         u32 uOverflow = 0;
+         memcpy(&uOverflow, CMSG_DATA(pCMsg), sizeof(u32));
+         if ( pReader->iHasRxqOverflow && (uOverflow != pReader->uLastRxqOverflow) )
+            pReader->stats.uKernelDrops += uOverflow - pReader->uLastRxqOverflow;
+         else if ( ! pReader->iHasRxqOverflow )
+            pReader->stats.uKernelDrops += uOverflow;
+         pReader->uLastRxqOverflow = uOverflow;
+         pReader->iHasRxqOverflow = 1;
+      }
+      else if ( (pCMsg->cmsg_level == SOL_UDP) && (pCMsg->cmsg_type == UDP_GRO) )
+      {
+         int iSegmentSize = 0;
+         memcpy(&iSegmentSize, CMSG_DATA(pCMsg), sizeof(int));
+         pReader->piSegmentSizes[iMessage] = iSegmentSize;
+      }
+   }
+}
+
+// Returns the number of messages read, 0 if none, -1 on error
+
+static int _udp_batch_reader_recv(type_udp_batch_reader* pReader)
+{
+   for( int i=0; i<pReader->config.iBatchSize; i++ )
+   {
+      pReader->pMessages[i].msg_hdr.msg_control = pReader->pControl + i * UDP_BATCH_READER_CONTROL_SIZE;
+      pReader->pMessages[i].msg_hdr.msg_controllen = UDP_BATCH_READER_CONTROL_SIZE;
+      pReader->pMessages[i].msg_hdr.msg_flags = 0;
+      pReader->pMessages[i].msg_len = 0;
+   }
+
+   u32 uTimeStart = get_current_timestamp_micros();
+   int iCount = recvmmsg(pReader->iSocket, pReader->pMessages, pReader->config.iBatchSize, MSG_DONTWAIT, NULL);
+   pReader->stats.uRecvMicros += get_current_timestamp_micros() - uTimeStart;
+   pReader->stats.uRecvCalls++;
+   if ( iCount < 0 )
+   {
+      if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) )
+      {
+         pReader->stats.uRecvCallsEmpty++;
+         return 0;
+      }
+      log_softerror_and_alarm("[UDPBatchReader] Failed to read from UDP socket, error: %d (%s)", errno, strerror(errno));
+      return -1;
+   }
+   if ( 0 == iCount )
+   {
+      pReader->stats.uRecvCallsEmpty++;
+      return 0;
+   }
+   for( int i=0; i<iCount; i++ )
+      _udp_batch_reader_parse_control(pReader, i);
+   if ( (u32)iCount > pReader->stats.uMaxBatch )
+      pReader->stats.uMaxBatch = iCount;
+   pReader->iCountMessages = iCount;
+   pReader->iCurrentMessage = 0;
+   pReader->iCurrentOffset = 0;
+   return iCount;
+}
+
+static int _udp_batch_reader_get_next(type_udp_batch_reader* pReader, u8** ppData)
+{
+   while ( pReader->iCurrentMessage < pReader->iCountMessages )
+   {
+      int iMessage = pReader->iCurrentMessage;
+      int iLength = pReader->pMessages[iMessage].msg_len;
+      if ( iLength > pReader->iBufferSize )
+         iLength = pReader->iBufferSize;
+      int iSegmentSize = pReader->piSegmentSizes[iMessage];
+      if ( (iSegmentSize <= 0) || (iSegmentSize >= iLength) )
+         iSegmentSize = iLength;
+
+      if ( pReader->iCurrentOffset >= iLength )
+      {
+         pReader->iCurrentMessage++;
+         pReader->iCurrentOffset = 0;
+         continue;
+      }
+      int iSize = iLength - pReader->iCurrentOffset;
+      if ( iSize > iSegmentSize )
+         iSize = iSegmentSize;
+      *ppData = pReader->pBuffers + iMessage * pReader->iBufferSize + pReader->iCurrentOffset;
+      pReader->iCurrentOffset += iSize;
+      if ( pReader->iCurrentOffset >= iLength )
+      {
+         pReader->iCurrentMessage++;
+         pReader->iCurrentOffset = 0;
+      }
+      pReader->stats.uDatagrams++;
+      pReader->stats.uBytes += iSize;
+      return iSize;
+   }
+   pReader->iCountMessages = 0;
+   pReader->iCurrentMessage = 0;
+   pReader->iCurrentOffset = 0;
+   return 0;
+}
+
+int udp_batch_reader_read(type_udp_batch_reader* pReader, int iTimeoutMs, u8** ppData)
+{
+   if ( (NULL == pReader) || (NULL == ppData) || (NULL == pReader->pBuffers) || (pReader->iSocket < 0) )
+      return -1;
+   *ppData = NULL;
+
+   int iSize = _udp_batch_reader_get_next(pReader, ppData);
+   if ( iSize > 0 )
+      return iSize;
+
+   // Read first, as under load there is data most of the time, then wait if there was nothing
+   int iRes = _udp_batch_reader_recv(pReader);
+   if ( iRes < 0 )
+      return -1;
+   if ( (0 == iRes) && (iTimeoutMs > 0) )
+   {
+      struct pollfd fds;
+      fds.fd = pReader->iSocket;
+      fds.events = POLLIN;
+      fds.revents = 0;
+      pReader->stats.uPollCalls++;
+      iRes = poll(&fds, 1, iTimeoutMs);
+      if ( iRes < 0 )
+      {
+         if ( errno == EINTR )
+            return 0;
+         log_softerror_and_alarm("[UDPBatchReader] Failed to poll UDP socket, error: %d (%s)", errno, strerror(errno));
+         return -1;
+      }
+      if ( fds.revents & (POLLERR | POLLNVAL) )
+      {
+         log_softerror_and_alarm("[UDPBatchReader] Socket error polling.");
+         return -1;
+      }
+      if ( (0 == iRes) || (! (fds.revents & POLLIN)) )
+         return 0;
+      if ( _udp_batch_reader_recv(pReader) <= 0 )
+         return 0;
+   }
+   return _udp_batch_reader_get_next(pReader, ppData);
+}
+
+int udp_batch_reader_has_pending(type_udp_batch_reader* pReader)
+{
+   if ( NULL == pReader )
+      return 0;
+   return (pReader->iCurrentMessage < pReader->iCountMessages)?1:0;
+}
+
+type_udp_batch_reader_stats* udp_batch_reader_get_stats(type_udp_batch_reader* pReader)
+{
+   if ( NULL == pReader )
+      return NULL;
+   return &pReader->stats;
+}
+
+void udp_batch_reader_reset_stats(type_udp_batch_reader* pReader)
+{
+   if ( NULL == pReader )
+      return;
+   memset(&pReader->stats, 0, sizeof(type_udp_batch_reader_stats));
+}
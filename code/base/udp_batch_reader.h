@@ -0,0 +1,77 @@
+#pragma once
+
+#include "../base/base.h"
+#include <sys/socket.h>
+
+// Reads datagrams from an UDP socket in batches (one recvmmsg call for up to iBatchSize datagrams),
+// into preallocated buffers, then hands them out one by one without more syscalls.
+// With GRO enabled the kernel can coalesce datagrams of the same size into one buffer;
+// they are split back into the original datagrams.
+// The reader does not own the socket, it only sets the socket options from the config.
+
+#define UDP_BATCH_READER_MAX_BATCH 64
+#define UDP_BATCH_READER_DEFAULT_BUFFER_SIZE 2048
+#define UDP_BATCH_READER_GRO_BUFFER_SIZE 65536
+
+typedef struct
+{
+   int iBatchSize; // datagrams read by one recvmmsg call
+   int iBufferSize; // size of each datagram buffer, when GRO is not used
+   int iRecvBufferKb; // socket receive buffer size, 0 for system default
+   int iBusyPollMicros; // SO_BUSY_POLL, 0 to disable
+   int iGRO; // UDP_GRO
+} type_udp_batch_reader_config;
+
+typedef struct
+{
+   u32 uPollCalls;
+   u32 uRecvCalls; // recvmmsg calls
+   u32 uRecvCallsEmpty; // recvmmsg calls that returned nothing
+   u32 uDatagrams;
+   u32 uBytes;
+   u32 uMaxBatch; // most datagrams read by one recvmmsg call
+   u32 uKernelDrops; // datagrams dropped by the kernel (socket receive buffer full)
+   u32 uRecvMicros; // time spent in recvmmsg calls
+} type_udp_batch_reader_stats;
+
+typedef struct
+{
+   int iSocket;
+   type_udp_batch_reader_config config;
+   int iBufferSize;
+   u8* pBuffers;
+   u8* pControl;
+   struct mmsghdr* pMessages;
+   struct iovec* pIOVecs;
+   int* piSegmentSizes; // GRO segment size of each message, 0 if not coalesced
+   int iCountMessages;
+   int iCurrentMessage;
+   int iCurrentOffset;
+   u32 uLastRxqOverflow;
+   int iHasRxqOverflow;
+   type_udp_batch_reader_stats stats;
+} type_udp_batch_reader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void udp_batch_reader_get_default_config(type_udp_batch_reader_config* pConfig);
+
+// Returns 1 on success, 0 on failure
+int udp_batch_reader_init(type_udp_batch_reader* pReader, int iSocket, type_udp_batch_reader_config* pConfig);
+void udp_batch_reader_uninit(type_udp_batch_reader* pReader);
+
+// Returns the length of the next datagram (and sets *ppData to it), 0 if nothing was received
+// in iTimeoutMs (0: don't wait), -1 on socket errors.
+// The datagram stays valid until the next read call.
+int udp_batch_reader_read(type_udp_batch_reader* pReader, int iTimeoutMs, u8** ppData);
+// Datagrams already read from the socket and not handed out yet
+int udp_batch_reader_has_pending(type_udp_batch_reader* pReader);
+
+type_udp_batch_reader_stats* udp_batch_reader_get_stats(type_udp_batch_reader* pReader);
+void udp_batch_reader_reset_stats(type_udp_batch_reader* pReader);
+
+#ifdef __cplusplus
+}
+#endif
@@ -967,6 +967,10 @@ bool radio_utils_set_interface_frequency(Model* pModel, int iRadioIndex, int iAs
             continue;
          }
       }
+      else if ( hardware_radio_is_virtual_radio(pRadioInfo) )
+      {
+         // Nothing to configure, frequency is just reported
+      }
       else if ( hardware_radio_is_wifi_radio(pRadioInfo) )
       {
          bool bTryHT40 = false;
@@ -43,6 +43,10 @@ void reset_VehicleSettings()
 {
    memset(&s_VehicleSettings, 0, sizeof(s_VehicleSettings));
    s_VehicleSettings.iDevRxLoopTimeout = DEFAULT_MAX_RX_LOOP_TIMEOUT_MILISECONDS;
+   s_VehicleSettings.iVideoUDPInputBatchSize = DEFAULT_VIDEO_UDP_INPUT_BATCH_SIZE;
+   s_VehicleSettings.iVideoUDPInputRecvBufferKb = DEFAULT_VIDEO_UDP_INPUT_RECV_BUFFER_KB;
+   s_VehicleSettings.iVideoUDPInputBusyPollMicros = DEFAULT_VIDEO_UDP_INPUT_BUSY_POLL_MICROS;
+   s_VehicleSettings.iVideoUDPInputGRO = DEFAULT_VIDEO_UDP_INPUT_GRO;
    
    log_line("Reseted vehicle settings.");
 }
@@ -60,6 +64,7 @@ int save_VehicleSettings()
    }
    fprintf(fd, "%s\n", VEHICLE_SETTINGS_STAMP_ID);
    fprintf(fd, "%d\n", s_VehicleSettings.iDevRxLoopTimeout);
+   fprintf(fd, "%d %d %d %d\n", s_VehicleSettings.iVideoUDPInputBatchSize, s_VehicleSettings.iVideoUDPInputRecvBufferKb, s_VehicleSettings.iVideoUDPInputBusyPollMicros, s_VehicleSettings.iVideoUDPInputGRO);
    fclose(fd);
 
    log_line("Saved vehicle settings to file: %s", szFile);
@@ -105,8 +110,22 @@ int load_VehicleSettings()
       failed = 1;
    }
 
+   // Added later: older files don't have them, keep the other settings
+   bool bUpdated = false;
+   if ( (!failed) && (4 != fscanf(fd, "%d %d %d %d", &s_VehicleSettings.iVideoUDPInputBatchSize, &s_VehicleSettings.iVideoUDPInputRecvBufferKb, &s_VehicleSettings.iVideoUDPInputBusyPollMicros, &s_VehicleSettings.iVideoUDPInputGRO)) )
+   {
+      s_VehicleSettings.iVideoUDPInputBatchSize = DEFAULT_VIDEO_UDP_INPUT_BATCH_SIZE;
+      s_VehicleSettings.iVideoUDPInputRecvBufferKb = DEFAULT_VIDEO_UDP_INPUT_RECV_BUFFER_KB;
+      s_VehicleSettings.iVideoUDPInputBusyPollMicros = DEFAULT_VIDEO_UDP_INPUT_BUSY_POLL_MICROS;
+      s_VehicleSettings.iVideoUDPInputGRO = DEFAULT_VIDEO_UDP_INPUT_GRO;
+      bUpdated = true;
+   }
+
    fclose(fd);
 
+   if ( (!failed) && bUpdated )
+      save_VehicleSettings();
+
    if ( failed )
    {
       log_line("Incomplete/Invalid settings file %s, error code: %d. Reseted to default.", szFile, failed);
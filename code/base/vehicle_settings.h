@@ -8,6 +8,10 @@
 typedef struct
 {
    int iDevRxLoopTimeout;
+   int iVideoUDPInputBatchSize;
+   int iVideoUDPInputRecvBufferKb;
+   int iVideoUDPInputBusyPollMicros;
+   int iVideoUDPInputGRO;
 } VehicleSettings;
 
 int save_VehicleSettings();
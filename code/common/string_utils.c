@@ -899,6 +899,8 @@ const char* str_get_radio_type_description(int iRadioType)
       strcpy(sszNICTypeDescription, "SiK-Radio");
    if ( iRadioType == RADIO_TYPE_SERIAL )
       strcpy(sszNICTypeDescription, "Serial-Radio");
+   if ( iRadioType == RADIO_TYPE_VIRTUAL )
+      strcpy(sszNICTypeDescription, "Virtual");
    return sszNICTypeDescription;
 }
 
@@ -925,6 +927,8 @@ const char* str_get_radio_driver_description(int iDriverType)
       strcpy(sszNICDriverDescription, "SiK");
    if ( iDriverType == RADIO_HW_DRIVER_SERIAL )
       strcpy(sszNICDriverDescription, "Serial");
+   if ( iDriverType == RADIO_HW_DRIVER_VIRTUAL )
+      strcpy(sszNICDriverDescription, "virtual");
    return sszNICDriverDescription;
 }
 
@@ -954,6 +958,7 @@ const char* str_get_radio_card_model_string(int cardModel)
    if ( cardModel == CARD_MODEL_SIK_RADIO )         strcpy(s_szCardModelDescription, "SiK-Radio");
    if ( cardModel == CARD_MODEL_SERIAL_RADIO )      strcpy(s_szCardModelDescription, "Serial-Radio");
    if ( cardModel == CARD_MODEL_SERIAL_RADIO_ELRS ) strcpy(s_szCardModelDescription, "ELRS-Radio");
+   if ( cardModel == CARD_MODEL_VIRTUAL_RADIO )     strcpy(s_szCardModelDescription, "Virtual-Radio");
 
    return s_szCardModelDescription;
 }
@@ -985,6 +990,7 @@ const char* str_get_radio_card_model_string_short(int cardModel)
    if ( cardModel == CARD_MODEL_SIK_RADIO )         strcpy(s_szCardModelDescription, "SiK-Radio");
    if ( cardModel == CARD_MODEL_SERIAL_RADIO )      strcpy(s_szCardModelDescription, "Serial-Radio");
    if ( cardModel == CARD_MODEL_SERIAL_RADIO_ELRS ) strcpy(s_szCardModelDescription, "ELRS");
+   if ( cardModel == CARD_MODEL_VIRTUAL_RADIO )     strcpy(s_szCardModelDescription, "Virtual");
 
    return s_szCardModelDescription;
 }
@@ -32,6 +32,8 @@
 #include <pthread.h>
 //#include "../base/radio_utils.h"
 #include "../base/ctrl_settings.h"
+#include "../base/model_sync.h"
+#include "../base/command_window.h"
 #include "../common/models_connect_frequencies.h"
 #include "../common/string_utils.h"
 #include "handle_commands.h"
@@ -71,6 +73,8 @@ static bool s_bHasToSyncCorePluginsInfoFromVehicle = true;
 static bool s_bHasReceivedVehicleCorePluginsInfo = false;
 
 #define MAX_COM_SEND_RETRY 5
+// About the same time as the stop-and-wait commands (40 resends, 50 ms timeout growing by 10 ms) with the doubled timeouts
+#define MAX_COM_WINDOW_SEND_RETRY 12
 
 static u32 s_CommandCounter = 0;
 static u32 s_CommandLastProcessedResponseToCommandCounter = MAX_U32;
@@ -79,6 +83,7 @@ static u32 s_CommandStartTime = 0;
 static u32 s_CommandTimeout = 20;
 static u32 s_CommandTargetVehicleId = 0;
 static u32 s_CommandType = 0;
+static u16 s_CommandTypeFlags = 0;
 static u32 s_CommandParam = 0;
 static u8  s_CommandResendCounter = 0;
 static u8  s_CommandMaxResendCounter = 20;
@@ -90,7 +95,54 @@ static int s_CommandBufferLength = 0;
 static u8 s_CommandReplyBuffer[MAX_PACKET_TOTAL_SIZE];
 static int s_CommandReplyLength = 0;
 
+// Settings commands that can be in flight at the same time (see base/command_window.h).
+// All other commands use the stop-and-wait path above (one command at a time).
+// The vehicle supports it if it acknowledges the commands sent with COMMAND_TYPE_FLAG_WINDOWED.
+typedef struct
+{
+   u8  uCommandType;
+   u8  uPriority;
+   u16 uOrderKey; // commands changing the same settings are applied in order
+   u32 uMinTimeoutMs; // commands that take long on the vehicle
+} type_windowed_command_info;
+
+static const type_windowed_command_info s_WindowedCommands[] =
+{
+   { COMMAND_ID_SET_TX_POWERS, COMMAND_WINDOW_PRIORITY_HIGH, COMMAND_ID_SET_TX_POWERS, 0 },
+   { COMMAND_ID_SET_RC_PARAMS, COMMAND_WINDOW_PRIORITY_HIGH, COMMAND_ID_SET_RC_PARAMS, 0 },
+   { COMMAND_ID_SET_FUNCTIONS_TRIGGERS_PARAMS, COMMAND_WINDOW_PRIORITY_HIGH, COMMAND_ID_SET_FUNCTIONS_TRIGGERS_PARAMS, 0 },
+
+   { COMMAND_ID_SET_CAMERA_PARAMETERS, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_CAMERA_PARAMETERS, 250 },
+   { COMMAND_ID_SET_CAMERA_PROFILE, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_CAMERA_PARAMETERS, 250 },
+   { COMMAND_ID_SET_CURRENT_CAMERA, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_CAMERA_PARAMETERS, 250 },
+   { COMMAND_ID_SET_VIDEO_PARAMS, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_VIDEO_PARAMS, 250 },
+   { COMMAND_ID_UPDATE_VIDEO_LINK_PROFILES, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_VIDEO_PARAMS, 250 },
+   { COMMAND_ID_SET_VIDEO_H264_QUANTIZATION, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_VIDEO_PARAMS, 250 },
+   { COMMAND_ID_SET_OSD_PARAMS, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_OSD_PARAMS, 0 },
+   { COMMAND_ID_SET_ALARMS_PARAMS, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_ALARMS_PARAMS, 0 },
+   { COMMAND_ID_SET_GPS_INFO, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_GPS_INFO, 0 },
+   { COMMAND_ID_SET_TELEMETRY_PARAMETERS, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_TELEMETRY_PARAMETERS, 0 },
+   { COMMAND_ID_SET_SERIAL_PORTS_INFO, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_TELEMETRY_PARAMETERS, 0 },
+   { COMMAND_ID_SET_VEHICLE_NAME, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_VEHICLE_NAME, 0 },
+   { COMMAND_ID_SET_VEHICLE_TYPE, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_VEHICLE_NAME, 0 },
+   { COMMAND_ID_SET_MODEL_FLAGS, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_MODEL_FLAGS, 0 },
+   { COMMAND_ID_SET_RC_CAMERA_PARAMS, COMMAND_WINDOW_PRIORITY_NORMAL, COMMAND_ID_SET_RC_CAMERA_PARAMS, 0 },
+
+   { COMMAND_ID_SET_NICE_VALUES, COMMAND_WINDOW_PRIORITY_LOW, COMMAND_ID_SET_NICE_VALUES, 0 },
+   { COMMAND_ID_SET_NICE_VALUE_TELEMETRY, COMMAND_WINDOW_PRIORITY_LOW, COMMAND_ID_SET_NICE_VALUES, 0 },
+   { COMMAND_ID_SET_IONICE_VALUES, COMMAND_WINDOW_PRIORITY_LOW, COMMAND_ID_SET_NICE_VALUES, 0 },
+   { COMMAND_ID_SET_THREADS_PRIORITIES, COMMAND_WINDOW_PRIORITY_LOW, COMMAND_ID_SET_NICE_VALUES, 0 },
+   { COMMAND_ID_SET_OVERCLOCKING_PARAMS, COMMAND_WINDOW_PRIORITY_LOW, COMMAND_ID_SET_OVERCLOCKING_PARAMS, 0 },
+   { COMMAND_ID_ENABLE_LIVE_LOG, COMMAND_WINDOW_PRIORITY_LOW, COMMAND_ID_ENABLE_LIVE_LOG, 0 },
+   { COMMAND_ID_SET_ENABLE_DHCP, COMMAND_WINDOW_PRIORITY_LOW, COMMAND_ID_SET_ENABLE_DHCP, 0 }
+};
+
+static type_command_window s_CommandsWindow;
+static bool s_bCommandsWindowSupported = false;
+
 static int s_iCountRetriesToGetModelSettingsCommand = 0;
+static u8 s_uModelSyncBaseBuffer[MODEL_SYNC_MAX_FILE_SIZE];
+static u8 s_uModelSyncFileBuffer[MODEL_SYNC_MAX_FILE_SIZE];
 static int s_RetryGetCorePluginsCounter = 0;
 
 
@@ -120,6 +172,35 @@ void update_processes_priorities()
    hw_set_proc_priority("ruby_central", pCS->iNiceCentral, 0, 1 );
 }
 
+// Rebuilds the vehicle model file from the received changes and the last model file received from the vehicle
+static bool _apply_received_model_settings_delta(u32 uVehicleId, u8* pData, int iLength)
+{
+   int iBaseLength = model_sync_load_received_base(uVehicleId, s_uModelSyncBaseBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+   int iModelLength = -1;
+   if ( iBaseLength >= 0 )
+      iModelLength = model_sync_apply_delta(s_uModelSyncBaseBuffer, iBaseLength, pData, iLength, s_uModelSyncFileBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iModelLength < 0 )
+   {
+      log_softerror_and_alarm("[Commands] Failed to apply received model settings changes (%d bytes, from version %08X) for VID %u. Request all model settings.",
+         iLength, model_sync_get_delta_base_hash(pData, iLength), uVehicleId);
+      model_sync_delete_received_base(uVehicleId);
+      return false;
+   }
+   log_line("[Commands] Applied received model settings changes (%d bytes, from version %08X): model file size: %d bytes", iLength, model_sync_get_delta_base_hash(pData, iLength), iModelLength);
+
+   char szFile[MAX_FILE_PATH_SIZE];
+   sprintf(szFile, "%s/model.mdl", FOLDER_RUBY_TEMP);
+   FILE* fd = fopen(szFile, "wb");
+   if ( NULL == fd )
+   {
+      log_softerror_and_alarm("Failed to write received model settings to temporary model file [%s].", szFile);
+      return false;
+   }
+   fwrite(s_uModelSyncFileBuffer, 1, iModelLength, fd);
+   fclose(fd);
+   return true;
+}
+
 int handle_commands_on_full_model_settings_received(u32 uVehicleId, int iResponseParam, u8* pData, int iLength)
 {
    if ( (NULL == pData) || (iLength <= 0) )
@@ -173,35 +254,49 @@ int handle_commands_on_full_model_settings_received(u32 uVehicleId, int iRespons
    }
 
    char szComm[256];
-   sprintf(szComm, "rm -rf %s/model.mdl", FOLDER_RUBY_TEMP);
-   hw_execute_bash_command(szComm, NULL);
-   char szRecvFile[MAX_FILE_PATH_SIZE];
-   sprintf(szRecvFile, "%s/last_recv_model.tar", FOLDER_RUBY_TEMP);
-   if ( iResponseParam != 0 )
-      sprintf(szRecvFile, "%s/last_recv_model.tar.gz", FOLDER_RUBY_TEMP);
-
-   FILE* fd = fopen(szRecvFile, "wb");
-   if ( NULL == fd )
-   {
-      log_softerror_and_alarm("Failed to write received model settings to temporary model file [%s].", szRecvFile);
-      return -1;
-   }
-
-   fwrite(pData, 1, iLength, fd);
-   fclose(fd);
-   fd = NULL;
-
-   if ( 0 == iResponseParam )
+   FILE* fd = NULL;
+   if ( iResponseParam == MODEL_SYNC_RESPONSE_PARAM_DELTA )
    {
-      sprintf(szComm, "tar -C %s -zxf %s/last_recv_model.tar 2>&1", FOLDER_RUBY_TEMP, FOLDER_RUBY_TEMP);
-      hw_execute_bash_command(szComm, NULL);
+      if ( ! _apply_received_model_settings_delta(uVehicleId, pData, iLength) )
+      {
+         // Request the model settings again (all of them)
+         s_CommandType = 0;
+         s_bHasCommandInProgress = false;
+         return -1;
+      }
    }
    else
    {
-      sprintf(szComm, "gzip -df %s/last_recv_model.tar.gz 2>&1", FOLDER_RUBY_TEMP);
+      sprintf(szComm, "rm -rf %s/model.mdl", FOLDER_RUBY_TEMP);
       hw_execute_bash_command(szComm, NULL);
-      sprintf(szComm, "tar -C %s -xf %s/last_recv_model.tar 2>&1", FOLDER_RUBY_TEMP, FOLDER_RUBY_TEMP);
-      hw_execute_bash_command(szComm, NULL);    
+      char szRecvFile[MAX_FILE_PATH_SIZE];
+      sprintf(szRecvFile, "%s/last_recv_model.tar", FOLDER_RUBY_TEMP);
+      if ( iResponseParam != 0 )
+         sprintf(szRecvFile, "%s/last_recv_model.tar.gz", FOLDER_RUBY_TEMP);
+
+      fd = fopen(szRecvFile, "wb");
+      if ( NULL == fd )
+      {
+         log_softerror_and_alarm("Failed to write received model settings to temporary model file [%s].", szRecvFile);
+         return -1;
+      }
+
+      fwrite(pData, 1, iLength, fd);
+      fclose(fd);
+      fd = NULL;
+
+      if ( 0 == iResponseParam )
+      {
+         sprintf(szComm, "tar -C %s -zxf %s/last_recv_model.tar 2>&1", FOLDER_RUBY_TEMP, FOLDER_RUBY_TEMP);
+         hw_execute_bash_command(szComm, NULL);
+      }
+      else
+      {
+         sprintf(szComm, "gzip -df %s/last_recv_model.tar.gz 2>&1", FOLDER_RUBY_TEMP);
+         hw_execute_bash_command(szComm, NULL);
+         sprintf(szComm, "tar -C %s -xf %s/last_recv_model.tar 2>&1", FOLDER_RUBY_TEMP, FOLDER_RUBY_TEMP);
+         hw_execute_bash_command(szComm, NULL);    
+      }
    }
 
    char szFile[MAX_FILE_PATH_SIZE];
@@ -237,6 +332,11 @@ int handle_commands_on_full_model_settings_received(u32 uVehicleId, int iRespons
    }
    log_line("[Commands] Received full model settings for vehicle id %u.", modelTemp.uVehicleId);
 
+   // Base for the next model settings changes sent by this vehicle
+   int iModelFileLength = model_sync_read_file(szFile, s_uModelSyncFileBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iModelFileLength > 0 )
+      model_sync_save_received_base(uVehicleId, s_uModelSyncFileBuffer, iModelFileLength);
+
    bool bFoundVehicle = false;
    for( int i=0; i<MAX_CONCURENT_VEHICLES; i++ )
    {
@@ -355,6 +455,14 @@ void _handle_received_command_response_to_get_all_params_zip(u8* pPacket, int iL
    }
 
    
+   // Model settings changes are always sent in a single response
+   if ( pPHCR->command_response_param == MODEL_SYNC_RESPONSE_PARAM_DELTA )
+   {
+      log_line("[Commands] Received model settings changes response (from VID %u), %d bytes.", pPH->vehicle_id_src, iDataLength);
+      handle_commands_on_full_model_settings_received(pPH->vehicle_id_src, pPHCR->command_response_param, pDataBuffer, iDataLength);
+      return;
+   }
+
    // Did we a full, complete, single zip response?
    if ( iDataLength > 500 )
    {
@@ -472,7 +580,7 @@ void handle_commands_send_current_command()
    PH.total_length = sizeof(t_packet_header)+sizeof(t_packet_header_command) + s_CommandBufferLength;
    
 
-   PHC.command_type = s_CommandType;
+   PHC.command_type = s_CommandType | s_CommandTypeFlags;
    PHC.command_counter = s_CommandCounter;
    PHC.command_param = s_CommandParam;
    PHC.command_resend_counter = s_CommandResendCounter;
@@ -487,6 +595,84 @@ void handle_commands_send_current_command()
    log_line_commands("[Commands] [Sent] to vId %u, cmd nb. %d, retry %d, type [%s], param: %u, buff len: %d]", g_pCurrentModel->uVehicleId, s_CommandCounter, s_CommandResendCounter, commands_get_description(s_CommandType), s_CommandParam, s_CommandBufferLength);
 }
 
+static int _commands_get_windowed_command_index(u8 uCommandType)
+{
+   for( int i=0; i<(int)(sizeof(s_WindowedCommands)/sizeof(s_WindowedCommands[0])); i++ )
+      if ( s_WindowedCommands[i].uCommandType == uCommandType )
+         return i;
+   return -1;
+}
+
+// Stop-and-wait commands and windowed commands are never in flight at the same time
+static bool _commands_has_pending()
+{
+   return (s_bHasCommandInProgress || (! command_window_is_empty(&s_CommandsWindow)));
+}
+
+// Windowed commands use the same globals as the stop-and-wait command while their response or timeout is handled
+static void _commands_load_window_entry(type_command_window_entry* pEntry)
+{
+   s_CommandType = pEntry->uCommandType;
+   s_CommandParam = pEntry->uCommandParam;
+   s_CommandResendCounter = pEntry->uResendCounter;
+   s_CommandBufferLength = pEntry->iDataLength;
+   if ( pEntry->iDataLength > 0 )
+      memcpy(s_CommandBuffer, pEntry->uData, pEntry->iDataLength);
+}
+
+static void _commands_send_window_commands()
+{
+   if ( (NULL == g_pCurrentModel) || s_bHasCommandInProgress )
+      return;
+
+   type_command_window_entry* pEntry = NULL;
+   while ( NULL != (pEntry = command_window_get_next_to_send(&s_CommandsWindow, g_TimeNow)) )
+   {
+      t_packet_header PH;
+      t_packet_header_command PHC;
+
+      radio_packet_init(&PH, PACKET_COMPONENT_COMMANDS, PACKET_TYPE_COMMAND, STREAM_ID_DATA);
+      PH.vehicle_id_src = g_uControllerId;
+      PH.vehicle_id_dest = g_pCurrentModel->uVehicleId;
+      PH.total_length = sizeof(t_packet_header)+sizeof(t_packet_header_command) + pEntry->iDataLength;
+
+      PHC.command_type = pEntry->uCommandType | COMMAND_TYPE_FLAG_WINDOWED;
+      PHC.command_counter = pEntry->uCommandCounter;
+      PHC.command_param = pEntry->uCommandParam;
+      PHC.command_resend_counter = pEntry->uResendCounter;
+
+      u8 buffer[MAX_PACKET_TOTAL_SIZE];
+      memcpy(buffer, (u8*)&PH, sizeof(t_packet_header));
+      memcpy(buffer+sizeof(t_packet_header), (u8*)&PHC, sizeof(t_packet_header_command));
+      memcpy(buffer+sizeof(t_packet_header)+sizeof(t_packet_header_command), pEntry->uData, pEntry->iDataLength);
+      send_packet_to_router(buffer, PH.total_length);
+
+      log_line_commands("[Commands] [Sent] windowed to vId %u, cmd nb. %d, retry %d, type [%s], param: %u, buff len: %d, in flight: %d, timeout: %u ms]", g_pCurrentModel->uVehicleId, pEntry->uCommandCounter, pEntry->uResendCounter, commands_get_description(pEntry->uCommandType), pEntry->uCommandParam, pEntry->iDataLength, s_CommandsWindow.iCountInFlight, pEntry->uTimeoutMs);
+   }
+}
+
+static bool _commands_add_to_window(int iWindowedIndex, u8 commandType, u32 param, u8* pBuffer, int length)
+{
+   if ( command_window_is_full(&s_CommandsWindow) )
+   {
+      log_line_commands( "[Commands] [Send] to vId %u, type [%s], param: %u] Tried to send a new command while the commands window is full.", g_pCurrentModel->uVehicleId, commands_get_description(commandType), param);
+      handle_commands_show_popup_progress();
+      return false;
+   }
+
+   const type_windowed_command_info* pInfo = &s_WindowedCommands[iWindowedIndex];
+   if ( NULL == command_window_add(&s_CommandsWindow, s_CommandCounter+1, commandType, param, pBuffer, length, pInfo->uPriority, pInfo->uOrderKey, pInfo->uMinTimeoutMs, MAX_COM_WINDOW_SEND_RETRY, g_TimeNow) )
+   {
+      log_softerror_and_alarm("[Commands] Failed to queue command %s (%d bytes).", commands_get_description(commandType), length);
+      return false;
+   }
+   s_CommandCounter++;
+   s_CommandTargetVehicleId = g_pCurrentModel->uVehicleId;
+   popup_log_add_entry("Sending command %s to vehicle...", commands_get_description(commandType));
+   _commands_send_window_commands();
+   return true;
+}
+
 
 bool handle_commands_start_on_pairing()
 {
@@ -502,6 +688,9 @@ bool handle_commands_start_on_pairing()
    s_bHasToSyncCorePluginsInfoFromVehicle = true;
    s_bHasReceivedVehicleCorePluginsInfo = false;
 
+   command_window_init(&s_CommandsWindow, COMMAND_WINDOW_SIZE);
+   s_bCommandsWindowSupported = false;
+
    s_uFileIdToDownload = 0;
    s_uFileToDownloadState = 0xFF;
    s_uCountFileSegmentsToDownload = 0;
@@ -1960,7 +2149,7 @@ bool _commands_check_send_get_settings()
    //           g_TimeNow, g_RouterIsReadyTimestamp, s_iCountRetriesToGetModelSettingsCommand);
 
    if ( ! g_bIsReinit )
-   if ( ! s_bHasCommandInProgress )
+   if ( ! _commands_has_pending() )
    if ( (NULL != g_pCurrentModel) && (g_pCurrentModel->b_mustSyncFromVehicle || g_bIsFirstConnectionToCurrentVehicle ) && (!g_pCurrentModel->is_spectator))
    if ( g_pCurrentModel->getVehicleFirmwareType() == MODEL_FIRMWARE_TYPE_RUBY )
    if ( ! g_bSearching )
@@ -2020,7 +2209,16 @@ bool _commands_check_send_get_settings()
 
       log_line("[Commands] Send request to router to request model settings from vehicle.");
       reset_model_settings_download_buffers(g_pCurrentModel->uVehicleId);
-      return handle_commands_send_to_vehicle(COMMAND_ID_GET_ALL_PARAMS_ZIP, flags, NULL, 0);
+
+      // Ask only for the changes against the last model settings received from this vehicle
+      t_model_sync_request syncRequest;
+      syncRequest.uMagic = MODEL_SYNC_REQUEST_MAGIC;
+      syncRequest.uBaseHash = 0;
+      int iBaseLength = model_sync_load_received_base(g_pCurrentModel->uVehicleId, s_uModelSyncBaseBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+      if ( iBaseLength > 0 )
+         syncRequest.uBaseHash = model_sync_get_hash(s_uModelSyncBaseBuffer, iBaseLength);
+      log_line("[Commands] Has model settings version %08X from vehicle (%d bytes).", syncRequest.uBaseHash, iBaseLength);
+      return handle_commands_send_to_vehicle(COMMAND_ID_GET_ALL_PARAMS_ZIP, flags, (u8*)&syncRequest, sizeof(t_model_sync_request));
    }
 
    if ( (NULL != g_pCurrentModel) && (g_pCurrentModel->b_mustSyncFromVehicle || g_bIsFirstConnectionToCurrentVehicle ) && (!g_pCurrentModel->is_spectator))
@@ -2032,7 +2230,7 @@ bool _commands_check_send_get_settings()
          s_uLastTimeErrorVehicleSync = g_TimeNow;
          log_line("[Commands] Must sync vehicle settings for VID %u, but checks fail: command in progress: %s, searching: %s, reinit: %s, is receiving main telemetry: %s; is vehicle online: %s; retry sync counter: %d, is router ready: %s, paired: %s",
             g_pCurrentModel->uVehicleId,
-            s_bHasCommandInProgress?"yes":"no",
+            _commands_has_pending()?"yes":"no",
             g_bSearching?"yes":"no",
             g_bIsReinit?"yes":"no",
             link_has_received_main_vehicle_ruby_telemetry()?"yes":"no",
@@ -2055,7 +2253,7 @@ bool _commands_check_send_get_settings()
    if ( get_CorePluginsCount() > 0 )
    if ( s_bHasToSyncCorePluginsInfoFromVehicle )
    if ( ! g_bIsReinit )
-   if ( ! s_bHasCommandInProgress )
+   if ( ! _commands_has_pending() )
    if ( NULL != g_pCurrentModel && (!g_pCurrentModel->is_spectator))
    if ( ! g_pCurrentModel->b_mustSyncFromVehicle )
    if ( ! g_bSearching )
@@ -2074,7 +2272,7 @@ bool _commands_check_send_get_settings()
 
 bool _commands_check_download_file_segments()
 {
-   if ( s_bHasCommandInProgress )
+   if ( _commands_has_pending() )
       return false;
    
    if ( s_uFileIdToDownload == 0 )
@@ -2108,7 +2306,7 @@ bool _commands_check_download_file_segments()
 
 bool _commands_check_upload_file_segments()
 {
-   if ( s_bHasCommandInProgress )
+   if ( _commands_has_pending() )
       return false;
    
    if ( ! g_bHasFileUploadInProgress )
@@ -2214,6 +2412,19 @@ void handle_commands_loop()
    if ( _commands_check_send_get_settings() )
       return;
 
+   // Windowed commands: timed out ones, then resends and new ones
+
+   type_command_window_entry* pEntry = NULL;
+   while ( NULL != (pEntry = command_window_get_timed_out(&s_CommandsWindow, g_TimeNow)) )
+   {
+      log_softerror_and_alarm("[Commands] Windowed command nb. %d did not complete (timed out waiting for a response).", pEntry->uCommandCounter);
+      popup_log_add_entry("Command timed out (No response from vehicle).");
+      _commands_load_window_entry(pEntry);
+      command_window_remove(&s_CommandsWindow, pEntry);
+      _handle_commands_on_command_timeout();
+   }
+   _commands_send_window_commands();
+
    // Check for out of bound responses (not expected responses)
 
    if ( ! s_bHasCommandInProgress )
@@ -2252,48 +2463,9 @@ void handle_commands_loop()
    }
 }
 
-void handle_commands_on_response_received(u8* pPacketBuffer, int iLength)
+// Response flags, then the command result
+static void _handle_commands_response(t_packet_header_command_response* pPHCR)
 {
-   s_CommandReplyLength = 0;
-
-   t_packet_header* pPH = (t_packet_header*) pPacketBuffer;
-
-   if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) != PACKET_COMPONENT_COMMANDS ) 
-      return;
-   if ( pPH->packet_type != PACKET_TYPE_COMMAND_RESPONSE )
-      return;
-   
-   t_packet_header_command_response* pPHCR = (t_packet_header_command_response*)(pPacketBuffer + sizeof(t_packet_header));
-   log_line_commands( "[Commands] [Recv] Response from VID %u, cmd resp nb. %d, origin cmd nb. %d, origin retry %d, type [%s], response flags: %s, extra info len. %d]", pPH->vehicle_id_src, pPHCR->response_counter, pPHCR->origin_command_counter, pPHCR->origin_command_resend_counter, commands_get_description(pPHCR->origin_command_type), str_get_command_response_flags_string(pPHCR->command_response_flags), pPH->total_length-sizeof(t_packet_header)-sizeof(t_packet_header_command_response));
-
-   s_CommandLastResponseReceivedTime = g_TimeNow;
-
-   if ( pPHCR->origin_command_type == COMMAND_ID_DOWNLOAD_FILE_SEGMENT )
-   {
-      s_bLastCommandSucceeded = true;
-      memcpy( s_CommandReplyBuffer, pPacketBuffer, pPH->total_length );
-      s_CommandReplyLength = pPH->total_length;
-      _handle_download_file_segment_response();
-      return;
-   }
-
-   if ( s_CommandLastProcessedResponseToCommandCounter == s_CommandCounter )
-   if ( s_CommandType != COMMAND_ID_GET_ALL_PARAMS_ZIP )
-   {
-      log_line_commands( "[Commands] [Ignoring duplicate response] of vId %u, cmd nb. %d, retry %d, type [%s], param: %u]", g_pCurrentModel->uVehicleId, s_CommandCounter, s_CommandResendCounter, commands_get_description(s_CommandType), s_CommandParam);
-      return;
-   }
-   s_CommandLastProcessedResponseToCommandCounter = s_CommandCounter;
-   
-   if ( pPHCR->origin_command_counter != s_CommandCounter )
-   {
-      log_line_commands( "[Commands] [Recv] Ignore out of bound response from vId %u, cmd resp nb. %d, origin cmd nb. %d, origin retry %d, type [%s], flags %d, extra info length: %d]", pPH->vehicle_id_src, pPHCR->response_counter, pPHCR->origin_command_counter, pPHCR->origin_command_resend_counter, commands_get_description(pPHCR->origin_command_type), pPHCR->command_response_flags, pPH->total_length-sizeof(t_packet_header)-sizeof(t_packet_header_command_response));
-      return;
-   }
-
-   memcpy( s_CommandReplyBuffer, pPacketBuffer, pPH->total_length );
-   s_CommandReplyLength = pPH->total_length;
-
    if ( (pPHCR->command_response_flags & COMMAND_RESPONSE_FLAGS_UNKNOWN_COMMAND) ||
         (pPHCR->command_response_flags & COMMAND_RESPONSE_FLAGS_FAILED_INVALID_PARAMS) )
    {
@@ -2360,6 +2532,93 @@ void handle_commands_on_response_received(u8* pPacketBuffer, int iLength)
       s_bHasCommandInProgress = false;
 }
 
+// Response to a windowed command: selective ack of the commands before it, then the same handling as a stop-and-wait command
+static void _handle_commands_window_response(u8* pPacketBuffer)
+{
+   t_packet_header* pPH = (t_packet_header*) pPacketBuffer;
+   t_packet_header_command_response* pPHCR = (t_packet_header_command_response*)(pPacketBuffer + sizeof(t_packet_header));
+
+   type_command_window_entry* pEntry = command_window_on_response(&s_CommandsWindow, pPHCR->origin_command_counter, pPHCR->origin_command_resend_counter,
+       (pPHCR->origin_command_type & COMMAND_TYPE_FLAG_WINDOW_ACK)?1:0, pPHCR->response_counter, g_TimeNow);
+   if ( NULL == pEntry )
+   {
+      log_line_commands( "[Commands] [Ignoring duplicate response] to windowed cmd nb. %d, retry %d, type [%s]", pPHCR->origin_command_counter, pPHCR->origin_command_resend_counter, commands_get_description(pPHCR->origin_command_type));
+      return;
+   }
+
+   _commands_load_window_entry(pEntry);
+   s_CommandLastProcessedResponseToCommandCounter = pEntry->uCommandCounter;
+   command_window_remove(&s_CommandsWindow, pEntry);
+
+   memcpy( s_CommandReplyBuffer, pPacketBuffer, pPH->total_length );
+   s_CommandReplyLength = pPH->total_length;
+
+   _handle_commands_response(pPHCR);
+   s_bHasCommandInProgress = false;
+
+   _commands_send_window_commands();
+}
+
+void handle_commands_on_response_received(u8* pPacketBuffer, int iLength)
+{
+   s_CommandReplyLength = 0;
+
+   t_packet_header* pPH = (t_packet_header*) pPacketBuffer;
+
+   if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) != PACKET_COMPONENT_COMMANDS ) 
+      return;
+   if ( pPH->packet_type != PACKET_TYPE_COMMAND_RESPONSE )
+      return;
+   
+   t_packet_header_command_response* pPHCR = (t_packet_header_command_response*)(pPacketBuffer + sizeof(t_packet_header));
+   log_line_commands( "[Commands] [Recv] Response from VID %u, cmd resp nb. %d, origin cmd nb. %d, origin retry %d, type [%s], response flags: %s, extra info len. %d]", pPH->vehicle_id_src, pPHCR->response_counter, pPHCR->origin_command_counter, pPHCR->origin_command_resend_counter, commands_get_description(pPHCR->origin_command_type), str_get_command_response_flags_string(pPHCR->command_response_flags), pPH->total_length-sizeof(t_packet_header)-sizeof(t_packet_header_command_response));
+
+   s_CommandLastResponseReceivedTime = g_TimeNow;
+
+   if ( pPHCR->origin_command_type == COMMAND_ID_DOWNLOAD_FILE_SEGMENT )
+   {
+      s_bLastCommandSucceeded = true;
+      memcpy( s_CommandReplyBuffer, pPacketBuffer, pPH->total_length );
+      s_CommandReplyLength = pPH->total_length;
+      _handle_download_file_segment_response();
+      return;
+   }
+
+   if ( pPHCR->origin_command_type & COMMAND_TYPE_FLAG_WINDOW_ACK )
+   if ( (NULL != g_pCurrentModel) && (pPH->vehicle_id_src == g_pCurrentModel->uVehicleId) )
+   if ( ! s_bCommandsWindowSupported )
+   {
+      log_line("[Commands] Vehicle supports windowed commands.");
+      s_bCommandsWindowSupported = true;
+   }
+
+   if ( pPHCR->origin_command_type & COMMAND_TYPE_FLAG_WINDOWED )
+   if ( (! s_bHasCommandInProgress) || (pPHCR->origin_command_counter != s_CommandCounter) )
+   {
+      _handle_commands_window_response(pPacketBuffer);
+      return;
+   }
+
+   if ( s_CommandLastProcessedResponseToCommandCounter == s_CommandCounter )
+   if ( s_CommandType != COMMAND_ID_GET_ALL_PARAMS_ZIP )
+   {
+      log_line_commands( "[Commands] [Ignoring duplicate response] of vId %u, cmd nb. %d, retry %d, type [%s], param: %u]", g_pCurrentModel->uVehicleId, s_CommandCounter, s_CommandResendCounter, commands_get_description(s_CommandType), s_CommandParam);
+      return;
+   }
+   s_CommandLastProcessedResponseToCommandCounter = s_CommandCounter;
+   
+   if ( pPHCR->origin_command_counter != s_CommandCounter )
+   {
+      log_line_commands( "[Commands] [Recv] Ignore out of bound response from vId %u, cmd resp nb. %d, origin cmd nb. %d, origin retry %d, type [%s], flags %d, extra info length: %d]", pPH->vehicle_id_src, pPHCR->response_counter, pPHCR->origin_command_counter, pPHCR->origin_command_resend_counter, commands_get_description(pPHCR->origin_command_type), pPHCR->command_response_flags, pPH->total_length-sizeof(t_packet_header)-sizeof(t_packet_header_command_response));
+      return;
+   }
+
+   memcpy( s_CommandReplyBuffer, pPacketBuffer, pPH->total_length );
+   s_CommandReplyLength = pPH->total_length;
+
+   _handle_commands_response(pPHCR);
+}
+
 u32  handle_commands_get_last_command_id_response_received()
 {
    return s_CommandLastProcessedResponseToCommandCounter;
@@ -2385,6 +2644,22 @@ bool handle_commands_send_to_vehicle(u8 commandType, u32 param, u8* pBuffer, int
    if ( ! link_has_received_main_vehicle_ruby_telemetry() )
       return false;
 
+   int iWindowedIndex = _commands_get_windowed_command_index(commandType);
+   if ( (iWindowedIndex >= 0) && s_bCommandsWindowSupported )
+      return _commands_add_to_window(iWindowedIndex, commandType, param, pBuffer, length);
+
+   if ( ! command_window_is_empty(&s_CommandsWindow) )
+   {
+      log_line_commands( "[Commands] [Send] to vId %u, type [%s], param: %u] Tried to send a new command while %d windowed commands are in progress.", g_pCurrentModel->uVehicleId, commands_get_description(commandType), param, s_CommandsWindow.iCountCommands);
+      handle_commands_show_popup_progress();
+      return false;
+   }
+
+   // Until the vehicle acknowledges a windowed command, the windowed commands are sent one at a time
+   s_CommandTypeFlags = 0;
+   if ( iWindowedIndex >= 0 )
+      s_CommandTypeFlags = COMMAND_TYPE_FLAG_WINDOWED;
+
    s_CommandTargetVehicleId = g_pCurrentModel->uVehicleId;
    s_CommandBufferLength = length;
    if ( NULL != pBuffer )
@@ -2491,7 +2766,7 @@ bool handle_commands_send_command_once_to_vehicle(u8 commandType, u8 resendCount
    if ( NULL == g_pCurrentModel )
       return false;
 
-   if ( s_bHasCommandInProgress )
+   if ( _commands_has_pending() )
    {
       log_line_commands( "[Commands] [Send] to vId %u, cmd nb. %d, retry: %d, type [%s], param: %u] Tried to send a new command while another one (nb %d) was in progress.", g_pCurrentModel->uVehicleId, s_CommandCounter+1, resendCounter, commands_get_description(commandType), param, s_CommandCounter);
       handle_commands_show_popup_progress();
@@ -2504,6 +2779,7 @@ bool handle_commands_send_command_once_to_vehicle(u8 commandType, u8 resendCount
    if ( NULL != pBuffer )
       memcpy(s_CommandBuffer, pBuffer, s_CommandBufferLength );
    s_CommandType = commandType;
+   s_CommandTypeFlags = 0;
    s_CommandParam = param;
    s_CommandResendCounter = resendCounter;
 
@@ -2614,11 +2890,12 @@ void handle_commands_abandon_command()
 {
    s_CommandType = 0;
    s_bHasCommandInProgress = false;
+   command_window_reset(&s_CommandsWindow);
 }
 
 bool handle_commands_is_command_in_progress()
 {
-   return (s_bHasCommandInProgress || link_is_reconfiguring_radiolink());
+   return (s_bHasCommandInProgress || command_window_is_full(&s_CommandsWindow) || link_is_reconfiguring_radiolink());
 }
 
 void handle_commands_show_popup_progress()
@@ -82,6 +82,13 @@ void MenuControllerDev::addItems()
 
    m_IndexPCAPRadioTx = addMenuItem(m_pItemsSelect[9]);
 
+   m_pItemsSelect[10] = new MenuItemSelect("Controller Radio Rx Type", "What method the controller uses for receiving radio packets. Memory mapped ring reads multiple packets per wakeup and uses less CPU.");
+   m_pItemsSelect[10]->addSelection("PPCAP");
+   m_pItemsSelect[10]->addSelection("Memory mapped ring");
+   m_pItemsSelect[10]->setIsEditable();
+   m_pItemsSelect[10]->setSelectedIndex(pCS->iRadioRxUsesMmapRing?1:0);
+   m_IndexMmapRadioRx = addMenuItem(m_pItemsSelect[10]);
+
    m_pItemsSelect[6] = new MenuItemSelect("Bypass kernel sockets buffers", "Skip kernel's qdisc (traffic control) layer (PACKET_QDISC_BYPASS).");
    m_pItemsSelect[6]->addSelection("No");
    m_pItemsSelect[6]->addSelection("Yes");
@@ -178,6 +185,7 @@ void MenuControllerDev::onReturnFromChild(int iChildMenuId, int returnValue)
       pCS->nRetryRetransmissionAfterTimeoutMS = DEFAULT_VIDEO_RETRANS_MINIMUM_RETRY_INTERVAL;
       pCS->nRequestRetransmissionsOnVideoSilenceMs = DEFAULT_VIDEO_RETRANS_REQUEST_ON_VIDEO_SILENCE_MS;
       pCS->iRadioTxUsesPPCAP = DEFAULT_USE_PPCAP_FOR_TX;
+      pCS->iRadioRxUsesMmapRing = DEFAULT_USE_MMAP_RING_FOR_RX;
       save_ControllerSettings();
       save_Preferences();
       valuesToUI();
@@ -223,6 +231,12 @@ void MenuControllerDev::onSelectItem()
       bUpdatedController = true;
    }
 
+   if ( m_IndexMmapRadioRx == m_SelectedIndex )
+   {
+      pCS->iRadioRxUsesMmapRing = m_pItemsSelect[10]->getSelectedIndex();
+      bUpdatedController = true;
+   }
+
    if ( m_IndexBypassSocketBuffers == m_SelectedIndex )
    {
       pCS->iRadioBypassSocketBuffers = m_pItemsSelect[6]->getSelectedIndex();
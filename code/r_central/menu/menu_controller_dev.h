@@ -20,6 +20,7 @@ class MenuControllerDev: public Menu
 
       int m_IndexMaxPacketSize;
       int m_IndexPCAPRadioTx;
+      int m_IndexMmapRadioRx;
       int m_IndexBypassSocketBuffers;
       int m_IndexPingClockSpeed;
       int m_IndexWiFiChangeDelay;
@@ -300,6 +300,12 @@ void MenuVehicleRadioConfig::populate()
    m_pItemsSelect[2]->addSelection("All Streams and Data");
    m_pItemsSelect[2]->setIsEditable();
    m_IndexEncryption = addMenuItem(m_pItemsSelect[2]);
+
+   m_pItemsSelect[5] = new MenuItemSelect("Encryption Cipher", "Legacy is the fast XOR cipher compatible with older vehicles. ChaCha20-Poly1305 also authenticates each radio packet (forged or altered packets are dropped) and adds 24 bytes to each radio packet.");
+   m_pItemsSelect[5]->addSelection("Legacy");
+   m_pItemsSelect[5]->addSelection("ChaCha20-Poly1305");
+   m_pItemsSelect[5]->setIsEditable();
+   m_IndexEncryptionCipher = addMenuItem(m_pItemsSelect[5]);
 }
 
 void MenuVehicleRadioConfig::valuesToUI()
@@ -334,10 +340,16 @@ void MenuVehicleRadioConfig::valuesToUI()
    if ( g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_ENC_ALL )
       m_pItemsSelect[2]->setSelectedIndex(4); 
 
+   m_pItemsSelect[5]->setSelectedIndex(0);
+   if ( g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_AEAD )
+      m_pItemsSelect[5]->setSelectedIndex(1);
+   m_pItemsSelect[5]->setEnabled(0 != m_pItemsSelect[2]->getSelectedIndex());
+
    if ( ! m_bControllerHasKey )
    {
       m_pItemsSelect[2]->setSelectedIndex(0);
       m_pItemsSelect[2]->setEnabled(false);
+      m_pItemsSelect[5]->setEnabled(false);
    }
 
    if ( -1 != m_IndexTxPowerRTL8812AU )
@@ -455,7 +467,7 @@ void MenuVehicleRadioConfig::onSelectItem()
          valuesToUI();
    }
 
-   if ( m_IndexEncryption == m_SelectedIndex )
+   if ( (m_IndexEncryption == m_SelectedIndex) || (m_IndexEncryptionCipher == m_SelectedIndex) )
    {
       if ( ! m_bControllerHasKey )
       {
@@ -479,6 +491,9 @@ void MenuVehicleRadioConfig::onSelectItem()
          params[0] = MODEL_ENC_FLAG_ENC_VIDEO | MODEL_ENC_FLAG_ENC_DATA;
       if ( 4 == m_pItemsSelect[2]->getSelectedIndex() )
          params[0] = MODEL_ENC_FLAG_ENC_ALL;
+      if ( 0 != m_pItemsSelect[2]->getSelectedIndex() )
+      if ( 1 == m_pItemsSelect[5]->getSelectedIndex() )
+         params[0] |= MODEL_ENC_FLAG_AEAD;
 
       if ( 0 != m_pItemsSelect[2]->getSelectedIndex() )
       {
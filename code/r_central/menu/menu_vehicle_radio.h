@@ -20,6 +20,7 @@ class MenuVehicleRadioConfig: public Menu
       int m_IndexPrioritizeUplink;
       int m_IndexDisableUplink;
       int m_IndexEncryption;
+      int m_IndexEncryptionCipher;
       int m_IndexTxPowerRTL8812AU;
       int m_IndexTxPowerRTL8812EU;
       int m_IndexTxPowerAtheros;
@@ -66,6 +66,18 @@ MenuVehicleVideoEncodings::MenuVehicleVideoEncodings(void)
    m_pItemsSelect[1]->setIsEditable();
    m_IndexHDMIOutput = addMenuItem(m_pItemsSelect[1]);
 
+   m_pItemsSelect[20] = new MenuItemSelect("Multi-threaded Video Pipeline", "Reads, encodes and transmits the video on separate threads (CPU cores). Lowers the video latency at high bitrates on multi-core vehicles.");
+   m_pItemsSelect[20]->addSelection("Off");
+   m_pItemsSelect[20]->addSelection("On");
+   m_pItemsSelect[20]->setIsEditable();
+   m_IndexMultiThreadedPipeline = addMenuItem(m_pItemsSelect[20]);
+
+   m_pItemsSelect[21] = new MenuItemSelect("Frame Aligned Video Blocks", "Sends the end of each video frame right away, in a shorter video block, instead of waiting for the next frame to fill the block. Lowers the video latency, but sends more EC packets (short blocks keep all their EC packets).");
+   m_pItemsSelect[21]->addSelection("Off");
+   m_pItemsSelect[21]->addSelection("On");
+   m_pItemsSelect[21]->setIsEditable();
+   m_IndexFrameAlignedBlocks = addMenuItem(m_pItemsSelect[21]);
+
    addMenuItem(new MenuItemSection("Data & Error Correction Settings"));
 
    m_pItemsSelect[16] = new MenuItemSelect("Radio Data Rate for Video", "Actual radio data rate to use for this video profile for video data transmission.");
@@ -199,6 +211,8 @@ void MenuVehicleVideoEncodings::valuesToUI()
    m_pItemsSelect[19]->setSelectedIndex((int) uECSpread);
 
    m_pItemsSelect[4]->setSelectedIndex((g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_ENABLE_LOCAL_HDMI_OUTPUT)?1:0);
+   m_pItemsSelect[20]->setSelectedIndex((g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_MULTITHREADED_PIPELINE)?1:0);
+   m_pItemsSelect[21]->setSelectedIndex((g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_FRAME_ALIGNED_BLOCKS)?1:0);
 
    log_line("MenuVideoEncodings: Current video profile: %d, %s, current video datarate: %u",
       g_pCurrentModel->video_params.user_selected_video_link_profile,
@@ -472,6 +486,42 @@ void MenuVehicleVideoEncodings::onSelectItem()
       return;
    }
 
+   if ( m_IndexMultiThreadedPipeline == m_SelectedIndex )
+   {
+      video_parameters_t paramsOld;
+      memcpy(&paramsOld, &g_pCurrentModel->video_params, sizeof(video_parameters_t));
+      if ( 0 == m_pItemsSelect[20]->getSelectedIndex() )
+         g_pCurrentModel->video_params.uVideoExtraFlags &= ~(VIDEO_FLAG_MULTITHREADED_PIPELINE);
+      else
+         g_pCurrentModel->video_params.uVideoExtraFlags |= VIDEO_FLAG_MULTITHREADED_PIPELINE;
+
+      video_parameters_t paramsNew;
+      memcpy(&paramsNew, &g_pCurrentModel->video_params, sizeof(video_parameters_t));
+      memcpy(&g_pCurrentModel->video_params, &paramsOld, sizeof(video_parameters_t));
+
+      if ( ! handle_commands_send_to_vehicle(COMMAND_ID_SET_VIDEO_PARAMS, 0, (u8*)&paramsNew, sizeof(video_parameters_t)) )
+         valuesToUI();
+      return;
+   }
+
+   if ( m_IndexFrameAlignedBlocks == m_SelectedIndex )
+   {
+      video_parameters_t paramsOld;
+      memcpy(&paramsOld, &g_pCurrentModel->video_params, sizeof(video_parameters_t));
+      if ( 0 == m_pItemsSelect[21]->getSelectedIndex() )
+         g_pCurrentModel->video_params.uVideoExtraFlags &= ~(VIDEO_FLAG_FRAME_ALIGNED_BLOCKS);
+      else
+         g_pCurrentModel->video_params.uVideoExtraFlags |= VIDEO_FLAG_FRAME_ALIGNED_BLOCKS;
+
+      video_parameters_t paramsNew;
+      memcpy(&paramsNew, &g_pCurrentModel->video_params, sizeof(video_parameters_t));
+      memcpy(&g_pCurrentModel->video_params, &paramsOld, sizeof(video_parameters_t));
+
+      if ( ! handle_commands_send_to_vehicle(COMMAND_ID_SET_VIDEO_PARAMS, 0, (u8*)&paramsNew, sizeof(video_parameters_t)) )
+         valuesToUI();
+      return;
+   }
+
    if ( m_IndexH264Profile == m_SelectedIndex )
       sendVideoLinkProfile();
    if ( m_IndexH264Level == m_SelectedIndex )
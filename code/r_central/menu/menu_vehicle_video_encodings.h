@@ -25,6 +25,8 @@ class MenuVehicleVideoEncodings: public Menu
       int m_IndexEnableAdaptiveQuantization;
       int m_IndexAdaptiveH264QuantizationStrength;
       int m_IndexHDMIOutput;
+      int m_IndexMultiThreadedPipeline;
+      int m_IndexFrameAlignedBlocks;
 
       bool m_ShowBitrateWarning;
       MenuItemSlider* m_pItemsSlider[25];
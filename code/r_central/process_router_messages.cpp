@@ -767,7 +767,7 @@ int _process_received_message_from_router(u8* pPacketBuffer)
       g_bSwitchingRadioLink = false;
 
       if ( NULL != g_pSM_RadioStats )
-         memcpy((u8*)&g_SM_RadioStats, (u8*)g_pSM_RadioStats, sizeof(shared_mem_radio_stats));
+         shared_mem_block_read(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats), NULL);
 
       log_line("Received response from router to switch to vehicle radio link %d: succeeded: %d", iLink+1, iSucceeded);
       warnings_remove_switching_radio_link(iLink, uFreqKhz, (bool) iSucceeded);
@@ -1906,6 +1906,12 @@ void packets_scope_input_loop()
    }
 }
 
+// Last generation read from each versioned shared mem block
+static u32 s_uSMGenerationRadioStats = 0;
+static u32 s_uSMGenerationVideoInfoStatsOutput = 0;
+static u32 s_uSMGenerationVideoInfoStatsRadioIn = 0;
+static u32 s_uSMGenerationVideoLinkStats = 0;
+
 void synchronize_shared_mems()
 {
    if ( ! pairing_isStarted() )
@@ -1967,12 +1973,13 @@ void synchronize_shared_mems()
    if ( g_bFreezeOSD )
       return;
 
+   // Process stats are updated in place, field by field: always copied
    if ( NULL != g_pProcessStatsRouter )
-      memcpy((u8*)&g_ProcessStatsRouter, g_pProcessStatsRouter, sizeof(shared_mem_process_stats));
+      shared_mem_block_read(g_pProcessStatsRouter, &g_ProcessStatsRouter, sizeof(shared_mem_process_stats), NULL);
    if ( NULL != g_pProcessStatsTelemetry )
-      memcpy((u8*)&g_ProcessStatsTelemetry, g_pProcessStatsTelemetry, sizeof(shared_mem_process_stats));
+      shared_mem_block_read(g_pProcessStatsTelemetry, &g_ProcessStatsTelemetry, sizeof(shared_mem_process_stats), NULL);
    if ( NULL != g_pProcessStatsRC )
-      memcpy((u8*)&g_ProcessStatsRC, g_pProcessStatsRC, sizeof(shared_mem_process_stats));
+      shared_mem_block_read(g_pProcessStatsRC, &g_ProcessStatsRC, sizeof(shared_mem_process_stats), NULL);
 
    if ( NULL != g_pSM_DownstreamInfoRC )
       memcpy((u8*)&g_SM_DownstreamInfoRC, g_pSM_DownstreamInfoRC, sizeof(t_packet_header_rc_info_downstream));
@@ -1980,7 +1987,7 @@ void synchronize_shared_mems()
    if ( NULL != g_pSM_RouterVehiclesRuntimeInfo )
       memcpy((u8*)&g_SM_RouterVehiclesRuntimeInfo, g_pSM_RouterVehiclesRuntimeInfo, sizeof(shared_mem_router_vehicles_runtime_info));
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)&g_SM_RadioStats, g_pSM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_read(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats), &s_uSMGenerationRadioStats);
 
    if ( NULL != g_pSM_RadioStatsInterfaceRxGraph )
       memcpy((u8*)&g_SM_RadioStatsInterfaceRxGraph, g_pSM_RadioStatsInterfaceRxGraph, sizeof(shared_mem_radio_stats_interfaces_rx_graph));
@@ -1994,11 +2001,9 @@ void synchronize_shared_mems()
    if ( g_pCurrentModel->osd_params.osd_flags[g_pCurrentModel->osd_params.layout] & OSD_FLAG_SHOW_STATS_VIDEO_KEYFRAMES_INFO)
    {
       if ( NULL != g_pSM_VideoInfoStatsOutput )
-      if ( g_TimeNow >= g_SM_VideoInfoStatsOutput.uTimeLastUpdate + 200 )
-         memcpy((u8*)&g_SM_VideoInfoStatsOutput, g_pSM_VideoInfoStatsOutput, sizeof(shared_mem_video_info_stats));
+         shared_mem_block_read(g_pSM_VideoInfoStatsOutput, &g_SM_VideoInfoStatsOutput, sizeof(shared_mem_video_info_stats), &s_uSMGenerationVideoInfoStatsOutput);
       if ( NULL != g_pSM_VideoInfoStatsRadioIn )
-      if ( g_TimeNow >= g_SM_VideoInfoStatsRadioIn.uTimeLastUpdate + 200 )
-         memcpy((u8*)&g_SM_VideoInfoStatsRadioIn, g_pSM_VideoInfoStatsRadioIn, sizeof(shared_mem_video_info_stats));
+         shared_mem_block_read(g_pSM_VideoInfoStatsRadioIn, &g_SM_VideoInfoStatsRadioIn, sizeof(shared_mem_video_info_stats), &s_uSMGenerationVideoInfoStatsRadioIn);
    }
 
    if ( NULL != g_pSM_VideoDecodeStats )
@@ -2010,7 +2015,7 @@ void synchronize_shared_mems()
    if ( NULL != g_pSM_RadioRxQueueInfo )
       memcpy((u8*)&g_SM_RadioRxQueueInfo, g_pSM_RadioRxQueueInfo, sizeof(shared_mem_radio_rx_queue_info));
    if ( NULL != g_pSM_VideoLinkStats )
-      memcpy((u8*)&g_SM_VideoLinkStats, g_pSM_VideoLinkStats, sizeof(shared_mem_video_link_stats_and_overwrites));
+      shared_mem_block_read(g_pSM_VideoLinkStats, &g_SM_VideoLinkStats, sizeof(shared_mem_video_link_stats_and_overwrites), &s_uSMGenerationVideoLinkStats);
    if ( NULL != g_pSM_VideoLinkGraphs )
       memcpy((u8*)&g_SM_VideoLinkGraphs, g_pSM_VideoLinkGraphs, sizeof(shared_mem_video_link_graphs));
    if ( NULL != g_pSM_RCIn )
@@ -212,6 +212,15 @@ bool _configure_radio_interface(int iInterfaceIndex, u32 uDelayMS)
    }
 
    pRadioHWInfo->iCurrentDataRateBPS = 0;
+   if ( hardware_radio_is_virtual_radio(pRadioHWInfo) )
+   {
+      log_line("Radio interface %d (%s) is a virtual radio interface. Nothing to configure.", iInterfaceIndex+1, pRadioHWInfo->szName);
+      pRadioHWInfo->uCurrentFrequencyKhz = DEFAULT_FREQUENCY58;
+      pRadioHWInfo->lastFrequencySetFailed = 0;
+      pRadioHWInfo->uFailedFrequencyKhz = 0;
+      return true;
+   }
+
    //sprintf(szComm, "ifconfig %s mtu 2304 2>&1", pRadioHWInfo->szName );
    sprintf(szComm, "ip link set dev %s mtu 1400", pRadioHWInfo->szName);
    hw_execute_bash_command(szComm, szOutput);
@@ -694,7 +694,7 @@ int r_start_vehicle(int argc, char *argv[])
       {
          uTimeToAdjustAffinities = 0;
          log_line("Current vehicle has veye camera: %s, camera type: %d", modelVehicle.isActiveCameraVeye()?"Yes":"No", (int)modelVehicle.getActiveCameraType());
-         vehicle_check_update_processes_affinities(true, modelVehicle.isActiveCameraVeye());
+         vehicle_check_update_processes_affinities(true, modelVehicle.isActiveCameraVeye(), (modelVehicle.video_params.uVideoExtraFlags & VIDEO_FLAG_MULTITHREADED_PIPELINE)?true:false);
       }
       if ( access(szFileUpdate, R_OK) != -1 )
       {
@@ -422,10 +422,23 @@ bool _send_packet_to_wifi_radio_interface(int iLocalRadioLinkId, int iRadioInter
    int be = 0;
    if ( (g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_ENC_DATA) || (g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_ENC_ALL) )
    if ( hpp() )
-      be = 1;
+   {
+      be = RADIO_PACKET_ENCRYPTION_XOR;
+      if ( g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_AEAD )
+      if ( hppa() )
+         be = RADIO_PACKET_ENCRYPTION_AEAD;
+   }
+
+   int iWriteResult = 0;
+   if ( be )
+   {
+      int totalLength = radio_build_new_raw_packet(iLocalRadioLinkId, s_RadioRawPacket, pPacketData, nPacketLength, RADIO_PORT_ROUTER_UPLINK, be, 0, NULL);
+      iWriteResult = radio_write_raw_packet(iRadioInterfaceIndex, s_RadioRawPacket, totalLength);
+   }
+   else
+      iWriteResult = radio_write_packet_with_header_template(iLocalRadioLinkId, iRadioInterfaceIndex, pPacketData, nPacketLength, RADIO_PORT_ROUTER_UPLINK);
 
-   int totalLength = radio_build_new_raw_packet(iLocalRadioLinkId, s_RadioRawPacket, pPacketData, nPacketLength, RADIO_PORT_ROUTER_UPLINK, be, 0, NULL);
-   if ( radio_write_raw_packet(iRadioInterfaceIndex, s_RadioRawPacket, totalLength) )
+   if ( iWriteResult )
    {
       radio_stats_update_on_packet_sent_on_radio_interface(&g_SM_RadioStats, g_TimeNow, iRadioInterfaceIndex, nPacketLength);
       radio_stats_set_tx_radio_datarate_for_packet(&g_SM_RadioStats, iRadioInterfaceIndex, iLocalRadioLinkId, nRateTx, 0);
@@ -147,7 +147,7 @@ bool _switch_to_vehicle_radio_link(int iVehicleRadioLinkId)
    // Update the radio state to reflect the new assigned radio links to local radio interfaces
 
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    return true;
 }
 
@@ -291,7 +291,7 @@ void _process_local_notification_model_changed(t_packet_header* pPH, u8 uChangeT
 
       // Update the radio state to reflect the new radio links
       if ( NULL != g_pSM_RadioStats )
-         memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+         shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    
       return;
    }
@@ -737,6 +737,7 @@ void process_local_control_packet(t_packet_header* pPH)
       g_pControllerSettings = get_ControllerSettings();
       int iOldTxMode = g_pControllerSettings->iRadioTxUsesPPCAP;
       int iOldSocketBuffers = g_pControllerSettings->iRadioBypassSocketBuffers;
+      int iOldRxMode = g_pControllerSettings->iRadioRxUsesMmapRing;
 
       hw_serial_port_info_t oldSerialPorts[MAX_SERIAL_PORTS];
       for( int i=0; i<hardware_get_serial_ports_count(); i++ )
@@ -763,6 +764,11 @@ void process_local_control_packet(t_packet_header* pPH)
          log_line("Radio bypass socket buffers changed. Reinit radio interfaces...");
          reasign_radio_links(true);       
       }
+      if ( g_pControllerSettings->iRadioRxUsesMmapRing != iOldRxMode )
+      {
+         log_line("Radio Rx mode (PPCAP/Memory mapped ring) changed. Reinit radio interfaces...");
+         reasign_radio_links(true);
+      }
 
       if ( NULL != g_pControllerSettings )
          radio_rx_set_timeout_interval(g_pControllerSettings->iDevRxLoopTimeout);
@@ -833,7 +839,7 @@ void process_local_control_packet(t_packet_header* pPH)
       }
 
       if ( NULL != g_pSM_RadioStats )
-         memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+         shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
 
       if ( g_pCurrentModel->hasCamera() )
          rx_video_output_on_controller_settings_changed();
@@ -130,7 +130,7 @@ void _process_extra_data_from_packet(u8 dataType, u8 dataSize, u8* pExtraData)
       hardware_save_radio_info();
 
       if ( NULL != g_pSM_RadioStats )
-         memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+         shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
 
       g_pCurrentModel->radioLinksParams.link_frequency_khz[nLink] = freqNew;
       saveControllerModel(g_pCurrentModel);
@@ -546,9 +546,15 @@ void _parse_single_packet_h264_data(u8* pPacketData, bool bIsRelayed)
 
    t_packet_header* pPH = (t_packet_header*)pPacketData;
    t_packet_header_video_full_77* pPHVF = (t_packet_header_video_full_77*) (pPacketData+sizeof(t_packet_header));
-   int iVideoDataLength = pPHVF->video_data_length;    
+   // The last packet of a block closed at a frame end can be shorter
+   int iVideoDataLength = pPH->total_length - sizeof(t_packet_header) - sizeof(t_packet_header_video_full_77);
+   if ( iVideoDataLength > pPHVF->video_data_length )
+      iVideoDataLength = pPHVF->video_data_length;
+   if ( iVideoDataLength <= 0 )
+      return;
    u8* pData = pPacketData + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77);
 
+   s_ParserH264RadioInput.setCodec(((pPHVF->video_stream_and_type >> 4) & 0x0F) == VIDEO_TYPE_H265);
    bool bStartOfFrameDetected = s_ParserH264RadioInput.parseData(pData, iVideoDataLength, g_TimeNow);
    if ( ! bStartOfFrameDetected )
       return;
@@ -704,7 +710,7 @@ int _process_received_video_data_packet(int iInterfaceIndex, u8* pPacket, int iP
 
    if ( ! ( pPH->packet_flags & PACKET_FLAGS_BIT_RETRANSMITED) )
    if ( pPHVF->video_block_packet_index < pPHVF->block_packets )
-   if ( uVideoStreamType == VIDEO_TYPE_H264 )
+   if ( (uVideoStreamType == VIDEO_TYPE_H264) || (uVideoStreamType == VIDEO_TYPE_H265) )
    if ( pModel->osd_params.osd_flags[pModel->osd_params.layout] & OSD_FLAG_SHOW_STATS_VIDEO_KEYFRAMES_INFO )
    if ( get_ControllerSettings()->iShowVideoStreamInfoCompactType == 0 )
       _parse_single_packet_h264_data(pPacket, bIsRelayedPacket);
@@ -1140,7 +1146,7 @@ int process_received_single_radio_packet(int interfaceIndex, u8* pData, int leng
       if ( pPH->packet_type == PACKET_TYPE_RUBY_TELEMETRY_VIDEO_LINK_DEV_STATS )
       if ( NULL != g_pSM_VideoLinkStats )
       if ( pPH->total_length == sizeof(t_packet_header) + sizeof(shared_mem_video_link_stats_and_overwrites) )
-         memcpy(g_pSM_VideoLinkStats, pData+sizeof(t_packet_header), sizeof(shared_mem_video_link_stats_and_overwrites) );
+         shared_mem_block_write(g_pSM_VideoLinkStats, pData+sizeof(t_packet_header), sizeof(shared_mem_video_link_stats_and_overwrites));
 
       if ( pPH->packet_type == PACKET_TYPE_RUBY_TELEMETRY_VIDEO_LINK_DEV_GRAPHS )
       if ( NULL != g_pSM_VideoLinkGraphs )
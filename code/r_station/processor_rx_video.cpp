@@ -60,6 +60,7 @@
 #include "../radio/radiolink.h"
 #include "../radio/radiopackets2.h"
 #include "../radio/radiopacketsqueue.h"
+#include "../radio/radio_rx.h"
 
 #include "shared_vars.h"
 #include "shared_vars_state.h"
@@ -139,6 +140,7 @@ ProcessorRxVideo::ProcessorRxVideo(u32 uVehicleId, u32 uVideoStreamIndex)
    m_uTimeLastReceivedVideoPacket = 0;
    for( int i=0; i<MAX_RXTX_BLOCKS_BUFFER; i++ )
       m_pRXBlocksStack[i] = NULL;
+   memset(&m_PacketsPool, 0, sizeof(type_packets_pool));
 
    m_bPaused = false;
 }
@@ -152,11 +154,13 @@ ProcessorRxVideo::~ProcessorRxVideo()
 
       for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
       {
-         if ( NULL != m_pRXBlocksStack[i]->packetsInfo[k].pData )
-            free(m_pRXBlocksStack[i]->packetsInfo[k].pData);
+         if ( NULL != m_pRXBlocksStack[i]->packetsInfo[k].pRefBuffer )
+            radio_rx_release_packet_buffer(m_pRXBlocksStack[i]->packetsInfo[k].pRefBuffer);
       }
       free(m_pRXBlocksStack[i]);
    }
+   packets_pool_log_stats(&m_PacketsPool);
+   packets_pool_uninit(&m_PacketsPool);
    log("[VideoRx] Video processor deleted for VID %u, video stream %u", m_uVehicleId, m_uVideoStreamIndex);
 
    m_siInstancesCount--;
@@ -183,6 +187,7 @@ bool ProcessorRxVideo::init()
    {
       fec_init();
       m_sbFECInitialized = true;
+      log("[VideoRx] Using FEC kernel: %s", fec_get_kernel_name(fec_get_kernel()));
    }
 
    m_iRXBlocksStackTopIndex = -1;
@@ -257,11 +262,34 @@ bool ProcessorRxVideo::init()
    m_SM_RetransmissionsStats.uGraphRefreshIntervalMs = g_pControllerSettings->nGraphVideoRefreshInterval;
    log("[VideoRx] Using graphs slice interval of %d miliseconds.", m_SM_VideoDecodeStatsHistory.outputHistoryIntervalMs);
 
+   // Each packet slot owns one buffer of the pool; a buffer page is only touched when a packet is first copied to it.
+   // No huge pages: most slots are never used (or the video data is referenced from the radio rx buffers)
+   if ( ! packets_pool_is_initialized(&m_PacketsPool) )
+   if ( ! packets_pool_init(&m_PacketsPool, "VideoRx", MAX_PACKET_PAYLOAD+1, MAX_RXTX_BLOCKS_BUFFER*MAX_TOTAL_PACKETS_IN_BLOCK, 0) )
+   {
+      log_softerror_and_alarm("[VideoRx] Failed to allocate rx video buffers.");
+      m_bInitialized = false;
+      return false;
+   }
+
    for( int i=0; i<MAX_RXTX_BLOCKS_BUFFER; i++ )
    {
-      m_pRXBlocksStack[i] = (type_received_block_info*)malloc(sizeof(type_received_block_info));
-      for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
-         m_pRXBlocksStack[i]->packetsInfo[k].pData = (u8*)malloc(MAX_PACKET_PAYLOAD+1);
+      // Blocks are kept if the processor is initialized again
+      if ( NULL == m_pRXBlocksStack[i] )
+      {
+         m_pRXBlocksStack[i] = (type_received_block_info*)malloc(sizeof(type_received_block_info));
+         for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
+         {
+            m_pRXBlocksStack[i]->packetsInfo[k].pOwnData = packets_pool_alloc(&m_PacketsPool);
+            m_pRXBlocksStack[i]->packetsInfo[k].pData = m_pRXBlocksStack[i]->packetsInfo[k].pOwnData;
+            m_pRXBlocksStack[i]->packetsInfo[k].pRefBuffer = NULL;
+         }
+         m_pRXBlocksStack[i]->iReferencedBuffers = 0;
+      }
+      // Any block of the ring can end up above the top of the stack, so all of them start empty
+      m_pRXBlocksStack[i]->data_packets = MAX_TOTAL_PACKETS_IN_BLOCK;
+      m_pRXBlocksStack[i]->fec_packets = 0;
+      resetReceiveBuffersBlock(i);
    }
    log("[VideoRx] Allocated %u Mb for rx video caching (%d max blocks in buffers)", (u32)MAX_RXTX_BLOCKS_BUFFER*(u32)MAX_TOTAL_PACKETS_IN_BLOCK*(u32)MAX_PACKET_PAYLOAD/(u32)1000/(u32)1000, MAX_RXTX_BLOCKS_BUFFER);
    
@@ -428,8 +456,23 @@ void ProcessorRxVideo::resetReceiveBuffersBlock(int rx_buffer_block_index)
       m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[k].packet_length = 0;
    }
 
+   // Give back the referenced radio packets buffers (can be past the block packets count if the block scheme changed)
+   if ( m_pRXBlocksStack[rx_buffer_block_index]->iReferencedBuffers > 0 )
+   {
+      for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
+      {
+         if ( NULL == m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[k].pRefBuffer )
+            continue;
+         radio_rx_release_packet_buffer(m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[k].pRefBuffer);
+         m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[k].pRefBuffer = NULL;
+         m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[k].pData = m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[k].pOwnData;
+      }
+      m_pRXBlocksStack[rx_buffer_block_index]->iReferencedBuffers = 0;
+   }
+
    m_pRXBlocksStack[rx_buffer_block_index]->video_block_index = MAX_U32;
    m_pRXBlocksStack[rx_buffer_block_index]->video_data_length = 0;
+   m_pRXBlocksStack[rx_buffer_block_index]->bIsFrameEndBlock = false;
    m_pRXBlocksStack[rx_buffer_block_index]->data_packets = 0;
    m_pRXBlocksStack[rx_buffer_block_index]->fec_packets = 0;
    m_pRXBlocksStack[rx_buffer_block_index]->received_data_packets = 0;
@@ -560,6 +603,8 @@ void ProcessorRxVideo::logCurrentRxBuffers(bool bIncludeRetransmissions)
       strcat(szBuff, "]");
    }
    log_line(szBuff);
+   packets_pool_log_stats(&m_PacketsPool);
+   radio_rx_log_packets_pool_stats();
 
    if ( bIncludeRetransmissions )
    {
@@ -751,18 +796,8 @@ void ProcessorRxVideo::pushIncompleteBlocksOut(int iStackIndexToDiscardTo, bool
    }
    else
    {
-      // Rotate the outputed blocks (first countToPush blocks are moved to the end of the circular buffer, the others are sifhted to the begining of the buffer )
-      type_received_block_info* tmpBlocksStack[MAX_RXTX_BLOCKS_BUFFER];
-      memcpy((u8*)&(tmpBlocksStack[0]), (u8*)&(m_pRXBlocksStack[0]), (m_iRXBlocksStackTopIndex+1)*sizeof(type_received_block_info*));
-      
-      // Move blocks to the begining
-      for( int i=iStackIndexToDiscardTo; i<=m_iRXBlocksStackTopIndex; i++ )
-         m_pRXBlocksStack[i-iStackIndexToDiscardTo] = tmpBlocksStack[i];
-
-      // Move the first N to the end of circular buffer
-      for( int i=0; i<iStackIndexToDiscardTo; i++ )
-         m_pRXBlocksStack[m_iRXBlocksStackTopIndex-iStackIndexToDiscardTo+i+1] = tmpBlocksStack[i];
-      
+      // The outputed blocks (already reset) go to the end of the circular stack
+      m_pRXBlocksStack.popBottom(iStackIndexToDiscardTo);
       m_iRXBlocksStackTopIndex -= iStackIndexToDiscardTo;
    }
    m_SM_VideoDecodeStats.total_DiscardedSegments++;
@@ -848,14 +883,9 @@ void ProcessorRxVideo::pushFirstBlockOut()
    
    resetReceiveBuffersBlock(0);
 
-   // Shift the rx blocks buffers by one block
+   // Move the rx blocks stack by one block
    if ( m_iRXBlocksStackTopIndex > 0 )
-   {
-      type_received_block_info* pFirstBlock = m_pRXBlocksStack[0];
-      for( int i=0; i<m_iRXBlocksStackTopIndex; i++ )
-         m_pRXBlocksStack[i] = m_pRXBlocksStack[i+1];
-      m_pRXBlocksStack[m_iRXBlocksStackTopIndex] = pFirstBlock;
-   }
+      m_pRXBlocksStack.popBottom(1);
    if ( m_iRXBlocksStackTopIndex >= 0 )
       m_iRXBlocksStackTopIndex--;
 
@@ -1482,6 +1512,8 @@ void ProcessorRxVideo::reconstructBlock(int rx_buffer_block_index)
    fec_decode(m_pRXBlocksStack[rx_buffer_block_index]->video_data_length, s_FECInfo.fec_decode_data_packets_pointers, m_pRXBlocksStack[rx_buffer_block_index]->data_packets, s_FECInfo.fec_decode_fec_packets_pointers, s_FECInfo.fec_decode_fec_indexes, s_FECInfo.fec_decode_missing_packets_indexes, s_FECInfo.missing_packets_count );
          
    // Mark all data packets reconstructed as received, set the right data in them
+   // (a reconstructed shorter last packet of a block closed at a frame end keeps its zero padding:
+   // zero bytes after the last NAL unit are valid trailing zero bytes in a H264/H265 byte stream)
    for( u32 i=0; i<s_FECInfo.missing_packets_count; i++ )
    {
       m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[s_FECInfo.fec_decode_missing_packets_indexes[i]].uState |= RX_PACKET_STATE_RECEIVED;
@@ -2044,19 +2076,59 @@ void ProcessorRxVideo::addPacketToReceivedBlocksBuffers(u8* pBuffer, int length,
       m_pRXBlocksStack[rx_buffer_block_index]->uTimeFirstPacketReceived = g_TimeNow;
 
 
+   // Blocks closed early at a frame end: the packets sent before the block was closed have the encoding scheme block size
+   if ( uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK )
+      m_pRXBlocksStack[rx_buffer_block_index]->bIsFrameEndBlock = true;
+   if ( (uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK) || (! m_pRXBlocksStack[rx_buffer_block_index]->bIsFrameEndBlock) )
+   {
+      m_pRXBlocksStack[rx_buffer_block_index]->data_packets = pPHVF->block_packets;
+      m_pRXBlocksStack[rx_buffer_block_index]->fec_packets = pPHVF->block_fecs;
+   }
+
+   // The last data packet of a block closed at a frame end can be shorter than the block's video data length
+   int iVideoDataLength = pPH->total_length - sizeof(t_packet_header) - sizeof(t_packet_header_video_full_77);
+   if ( iVideoDataLength > pPHVF->video_data_length )
+      iVideoDataLength = pPHVF->video_data_length;
+
    m_pRXBlocksStack[rx_buffer_block_index]->video_block_index = pPHVF->video_block_index;
    m_pRXBlocksStack[rx_buffer_block_index]->video_data_length = pPHVF->video_data_length;
-   m_pRXBlocksStack[rx_buffer_block_index]->data_packets = pPHVF->block_packets;
-   m_pRXBlocksStack[rx_buffer_block_index]->fec_packets = pPHVF->block_fecs;
    m_pRXBlocksStack[rx_buffer_block_index]->uTimeLastUpdated = g_TimeNow;
    m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[pPHVF->video_block_packet_index].uState |= RX_PACKET_STATE_RECEIVED;
-   m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[pPHVF->video_block_packet_index].video_data_length = pPHVF->video_data_length;
+   m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[pPHVF->video_block_packet_index].video_data_length = iVideoDataLength;
    m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[pPHVF->video_block_packet_index].packet_length = length;
 
-   if ( length < 100 || length > MAX_PACKET_TOTAL_SIZE )
+   if ( (length < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77))) || (iVideoDataLength < 0) || (length > MAX_PACKET_TOTAL_SIZE) )
       log_softerror_and_alarm("Invalid video data size to copy (%d bytes)", length);
    else
-      memcpy(m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[video_block_packet_index].pData, pBuffer+sizeof(t_packet_header)+sizeof(t_packet_header_video_full_77), length - sizeof(t_packet_header) - sizeof(t_packet_header_video_full_77));
+   {
+      // Keep a reference to the received radio packet instead of copying the video data, if it's in a rx queue buffer
+      // (not for a shorter packet: it's zero padded to the block's video data length, for the EC)
+      type_received_block_packet_info* pPacketInfo = &(m_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[video_block_packet_index]);
+      u8* pVideoData = pBuffer+sizeof(t_packet_header)+sizeof(t_packet_header_video_full_77);
+
+      // Same packet received again: drop the reference to the previous copy first
+      if ( NULL != pPacketInfo->pRefBuffer )
+      {
+         radio_rx_release_packet_buffer(pPacketInfo->pRefBuffer);
+         pPacketInfo->pRefBuffer = NULL;
+         m_pRXBlocksStack[rx_buffer_block_index]->iReferencedBuffers--;
+      }
+      pPacketInfo->pData = pPacketInfo->pOwnData;
+
+      if ( iVideoDataLength == pPHVF->video_data_length )
+         pPacketInfo->pRefBuffer = radio_rx_ref_packet_buffer(pVideoData);
+      if ( NULL != pPacketInfo->pRefBuffer )
+      {
+         pPacketInfo->pData = pVideoData;
+         m_pRXBlocksStack[rx_buffer_block_index]->iReferencedBuffers++;
+      }
+      else
+      {
+         memcpy(pPacketInfo->pData, pVideoData, length - sizeof(t_packet_header) - sizeof(t_packet_header_video_full_77));
+         if ( iVideoDataLength < pPHVF->video_data_length )
+            memset(pPacketInfo->pData + iVideoDataLength, 0, pPHVF->video_data_length - iVideoDataLength);
+      }
+   }
 
    if ( video_block_packet_index < m_pRXBlocksStack[rx_buffer_block_index]->data_packets )
       m_pRXBlocksStack[rx_buffer_block_index]->received_data_packets++;
@@ -2088,13 +2160,7 @@ int ProcessorRxVideo::processRetransmittedVideoPacket(u8* pBuffer, int length)
    video_block_index = pPHVF->video_block_index;
    video_block_packet_index = pPHVF->video_block_packet_index;
 
-   if ( video_block_index < m_pRXBlocksStack[0]->video_block_index )
-      return -1;
-   
-   if ( video_block_index > m_pRXBlocksStack[m_iRXBlocksStackTopIndex]->video_block_index )
-      return -1;
-
-   int dest_stack_index = (video_block_index-m_pRXBlocksStack[0]->video_block_index);
+   int dest_stack_index = m_pRXBlocksStack.findBlock(video_block_index, m_iRXBlocksStackTopIndex);
    if ( (dest_stack_index < 0) || (dest_stack_index >= m_iRXMaxBlocksToBuffer) )
       return -1;
 
@@ -2212,10 +2278,20 @@ int ProcessorRxVideo::processReceivedVideoPacket(u8* pBuffer, int length)
    }
 
    // Add the packet to the buffer
+   int iPrevStackTopIndex = m_iRXBlocksStackTopIndex;
    addPacketToReceivedBlocksBuffers(pBuffer, length, stackIndex, false);
    
    // Add info about any missing blocks in the stack: video block indexes, data scheme, last update time for any skipped blocks
-   for( u32 i=0; i<stackIndex; i++ )
+   // (only blocks above the previous top of the stack can be missing, the ones below were already filled in)
+   u32 uFirstSkipped = (iPrevStackTopIndex < 0)?0:(u32)(iPrevStackTopIndex+1);
+   // (a block closed at a frame end is smaller, assume the encoding scheme block size for the missing ones)
+   if ( pPHVF->uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK )
+   if ( 0 != m_SM_VideoDecodeStats.data_packets_per_block )
+   {
+      block_packets = m_SM_VideoDecodeStats.data_packets_per_block;
+      block_fecs = m_SM_VideoDecodeStats.fec_packets_per_block;
+   }
+   for( u32 i=uFirstSkipped; i<stackIndex; i++ )
       if ( 0 == m_pRXBlocksStack[i]->uTimeLastUpdated )
       {
          m_pRXBlocksStack[i]->uTimeLastUpdated = g_TimeNow;
@@ -2459,6 +2535,14 @@ int ProcessorRxVideo::preProcessReceivedVideoPacket(int interfaceNb, u8* pBuffer
       if ( gap > m_SM_VideoDecodeStatsHistory.outputHistoryBlocksMaxPacketsGapPerPeriod[0] )
          m_SM_VideoDecodeStatsHistory.outputHistoryBlocksMaxPacketsGapPerPeriod[0] = (gap>255) ? 255:gap;
    }
+   // A block closed at a frame end has fewer packets than the encoding scheme, it's not an encoding change
+   if ( pPHVF->uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK )
+   if ( 0 != m_SM_VideoDecodeStats.data_packets_per_block )
+   {
+      block_packets = m_SM_VideoDecodeStats.data_packets_per_block;
+      block_fecs = m_SM_VideoDecodeStats.fec_packets_per_block;
+   }
+
    // Check video resolution change
 
    int width = 0;
@@ -2,6 +2,7 @@
 #include "../base/base.h"
 #include "../base/models.h"
 #include "../base/shared_mem_controller_only.h"
+#include "../base/packets_pool.h"
 
 #define MAX_RETRANSMISSION_BUFFER_HISTORY_LENGTH 20
 
@@ -38,7 +39,9 @@ typedef struct
    u8 uRetrySentCount;
    u32 uTimeFirstRetrySent;
    u32 uTimeLastRetrySent;
-   u8* pData;
+   u8* pData;      // Video data: points to pOwnData or inside pRefBuffer
+   u8* pOwnData;   // Buffer of this packet slot
+   u8* pRefBuffer; // Referenced received radio packet buffer, NULL if the video data was copied to pOwnData
 }
 type_received_block_packet_info;
 
@@ -56,10 +59,58 @@ typedef struct
    u32 uTimeFirstRetrySent;
    u32 uTimeLastRetrySent;
    u32 uTimeLastUpdated; //0 for none
+   int iReferencedBuffers;
+   bool bIsFrameEndBlock; // closed early by the vehicle at a video frame end: data_packets/fec_packets are final
    type_received_block_packet_info packetsInfo[MAX_TOTAL_PACKETS_IN_BLOCK];
 
 } type_received_block_info;
 
+// Circular stack of rx blocks, ordered by video block index: index 0 is always the oldest block in the stack.
+// Removing blocks from the bottom of the stack only moves the start of the ring, no blocks are moved around,
+// and the stack index of a video block is just its offset from the video block index of the bottom block
+// (the blocks in the stack have consecutive video block indexes), so looking up a block is O(1).
+
+class RxBlocksStack
+{
+   public:
+      RxBlocksStack() { m_iStart = 0; }
+
+      type_received_block_info*& operator[](int iStackIndex)
+      {
+         int iIndex = m_iStart + iStackIndex;
+         if ( iIndex >= MAX_RXTX_BLOCKS_BUFFER )
+            iIndex -= MAX_RXTX_BLOCKS_BUFFER;
+         return m_pBlocks[iIndex];
+      }
+
+      // Returns the stack index (0...iTopIndex) of the block with the given video block index, -1 if it's not in the stack.
+      // The block found at the computed offset is checked against the key.
+      int findBlock(u32 uVideoBlockIndex, int iTopIndex)
+      {
+         if ( iTopIndex < 0 )
+            return -1;
+         u32 uBottomVideoBlockIndex = (*this)[0]->video_block_index;
+         if ( (MAX_U32 == uBottomVideoBlockIndex) || (uVideoBlockIndex < uBottomVideoBlockIndex) )
+            return -1;
+         u32 uOffset = uVideoBlockIndex - uBottomVideoBlockIndex;
+         if ( uOffset > (u32)iTopIndex )
+            return -1;
+         if ( (*this)[(int)uOffset]->video_block_index != uVideoBlockIndex )
+            return -1;
+         return (int)uOffset;
+      }
+
+      // Moves the first iCount blocks (already reset) to the top end of the ring
+      void popBottom(int iCount)
+      {
+         m_iStart = (m_iStart + iCount) % MAX_RXTX_BLOCKS_BUFFER;
+      }
+
+   protected:
+      type_received_block_info* m_pBlocks[MAX_RXTX_BLOCKS_BUFFER];
+      int m_iStart;
+};
+
 
 class ProcessorRxVideo
 {
@@ -161,7 +212,8 @@ class ProcessorRxVideo
 
       // Video blocks are stored in right expected order in the stack (based on video block index)
 
-      type_received_block_info* m_pRXBlocksStack[MAX_RXTX_BLOCKS_BUFFER];
+      RxBlocksStack m_pRXBlocksStack;
+      type_packets_pool m_PacketsPool;
       int m_iRXBlocksStackTopIndex;
       int m_iRXMaxBlocksToBuffer;
 
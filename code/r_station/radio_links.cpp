@@ -212,7 +212,7 @@ void radio_links_close_rxtx_radio_interfaces()
       g_SM_RadioStats.radio_interfaces[i].openedForWrite = 0;
    }
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    log_line("Closed all radio interfaces (rx/tx)."); 
 }
 
@@ -309,7 +309,7 @@ void radio_links_open_rxtx_radio_interfaces_for_search( u32 uSearchFreq )
    }
    
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    log_line("Opening RX radio interfaces for search complete. %d interfaces opened for RX:", iCountOpenRead);
    
    for( int i=0; i<hardware_get_radio_interfaces_count(); i++ )
@@ -466,7 +466,7 @@ void radio_links_open_rxtx_radio_interfaces()
    }
 
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    log_line("Opening RX/TX radio interfaces complete. %d interfaces opened for RX, %d interfaces opened for TX:", totalCountForRead, totalCountForWrite);
 
    if ( totalCountForRead == 0 )
@@ -540,7 +540,7 @@ void radio_links_open_rxtx_radio_interfaces()
    }
 
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    log_line("Finished opening RX/TX radio interfaces.");
    log_line("OPEN RADIO INTERFACES END ===========================================================");
    log_line("");
@@ -583,7 +583,7 @@ bool radio_links_apply_settings(Model* pModel, int iRadioLink, type_radio_links_
 
       hardware_save_radio_info();
       if ( NULL != g_pSM_RadioStats )
-         memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+         shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    }
 
    // Apply data rates
@@ -625,6 +625,8 @@ void radio_links_set_monitor_mode()
          continue;
       if ( ! hardware_radio_is_wifi_radio(pRadioHWInfo) )
          continue;
+      if ( hardware_radio_is_virtual_radio(pRadioHWInfo) )
+         continue;
 
       #ifdef HW_PLATFORM_RADXA_ZERO3
       //sprintf(szComm, "iwconfig %s mode monitor 2>&1", pRadioHWInfo->szName );
@@ -46,6 +46,7 @@
 #include "../base/hw_procs.h"
 #include "../base/ruby_ipc.h"
 #include "../base/parse_fc_telemetry.h"
+#include "../base/event_loop.h"
 #include "../common/string_utils.h"
 #include "../common/radio_stats.h"
 #include "../radio/radiolink.h"
@@ -105,6 +106,21 @@ u32 s_uTimeLastTryReadIPCMessages = 0;
 #define MAX_RADIO_PACKETS_TO_CACHE_LOCALLY 20
 type_received_radio_packet s_ReceivedRadioPacketsBuffer[MAX_RADIO_PACKETS_TO_CACHE_LOCALLY];
 
+// Event driven main loop: wakes up on new radio rx packets (eventfd signaled by the rx thread),
+// on IPC messages (timer when the IPC channels can't be waited on) and on the periodic timer.
+// The video processors checks and the pending radio tx packets are handled after each of these wake ups,
+// so there is no dedicated timer for them: an idle station wakes up just for the periodic timer.
+// Falls back to the polling main loop if it can't be set up.
+
+#define ROUTER_TIMER_PERIODIC_MICROS 10000
+#define ROUTER_TIMER_IPC_MICROS 10000
+#define ROUTER_LATENCY_LOG_INTERVAL_MS 20000
+
+type_event_loop s_RouterEventLoop;
+bool s_bUseEventLoop = false;
+type_latency_histogram s_RadioRxDispatchLatency;
+u32 s_uTimeLastLatencyLog = 0;
+
 void _broadcast_radio_interface_init_failed(int iInterfaceIndex)
 {
    t_packet_header PH;
@@ -333,7 +349,7 @@ void _compute_radio_interfaces_assignment()
       iCountAssignedVehicleRadioLinks = 1;
       g_SM_RadioStats.countLocalRadioLinks = 1;
       if ( NULL != g_pSM_RadioStats )
-         memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+         shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
       if ( 0 == iCountAssignedVehicleRadioLinks )
          send_alarm_to_central(ALARM_ID_CONTROLLER_NO_INTERFACES_FOR_RADIO_LINK,iConnectFirstUsableRadioLinkId, 0);
       
@@ -502,7 +518,7 @@ void _compute_radio_interfaces_assignment()
    log_line("Assigned %d controller local radio links to vehicle radio links (vehicle has %d active radio links)", iCountAssignedVehicleRadioLinks, iCountVehicleActiveUsableRadioLinks);
    
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
 
    //---------------------------------------------------------------
    // Log errors
@@ -662,7 +678,7 @@ bool links_set_cards_frequencies_for_search( u32 uSearchFreq, bool bSiKSearch, i
    }
 
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
    log_line("Links: Set all cards frequencies for search mode to %s. Completed.", str_format_frequency(uSearchFreq));
    return true;
 }
@@ -779,7 +795,7 @@ bool links_set_cards_frequencies_and_params(int iVehicleLinkId)
    }
 
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
 
    hardware_save_radio_info();
 
@@ -807,6 +823,11 @@ void reasign_radio_links(bool bSilent)
    else
       radio_set_bypass_socket_buffers(0);
 
+   if ( g_pControllerSettings->iRadioRxUsesMmapRing )
+      radio_set_use_mmap_ring_for_rx(1);
+   else
+      radio_set_use_mmap_ring_for_rx(0);
+
    _compute_radio_interfaces_assignment();
    links_set_cards_frequencies_and_params(-1);
    radio_links_open_rxtx_radio_interfaces();
@@ -1408,7 +1429,7 @@ void init_shared_memory_objects()
    radio_stats_reset(&g_SM_RadioStats, g_pControllerSettings->nGraphRadioRefreshInterval);
 
    if ( NULL != g_pSM_RadioStats )
-      memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+      shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
 
 
    if ( (NULL != g_pCurrentModel) && g_pCurrentModel->audio_params.has_audio_device && g_pCurrentModel->audio_params.enabled )
@@ -1670,6 +1691,16 @@ int _consume_radio_rx_packets()
 
    int iCount = radio_rx_get_received_packets(iReceivedAnyPackets, s_ReceivedRadioPacketsBuffer);
 
+   // Time the packets waited in the rx queue
+   u32 uTimeNowMicros = get_current_timestamp_micros();
+   for( int i=0; i<iCount; i++ )
+   {
+      u32 uLatency = uTimeNowMicros - s_ReceivedRadioPacketsBuffer[i].uTimeReceivedMicros;
+      latency_histogram_add(&s_RadioRxDispatchLatency, uLatency);
+      if ( s_bUseEventLoop )
+         event_loop_add_latency_sample(&s_RouterEventLoop, uLatency);
+   }
+
    for( int i=0; i<iCount; i++ )
    {
       if ( g_bQuit )
@@ -1697,6 +1728,7 @@ int _consume_radio_rx_packets()
          _read_ipc_pipes(uTime);
       }
    }
+   radio_rx_release_received_packets();
    return iCount;
 }
 
@@ -1819,7 +1851,7 @@ void _router_periodic_loop()
       {
          s_uTimeLastRadioStatsSharedMemSync = g_TimeNow;
          if ( NULL != g_pSM_RadioStats )
-            memcpy((u8*)g_pSM_RadioStats, (u8*)&g_SM_RadioStats, sizeof(shared_mem_radio_stats));
+            shared_mem_block_write(g_pSM_RadioStats, &g_SM_RadioStats, sizeof(shared_mem_radio_stats));
          if ( NULL != g_pSM_RadioStatsInterfacesRxGraph )
             memcpy((u8*)g_pSM_RadioStatsInterfacesRxGraph, (u8*)&g_SM_RadioStatsInterfacesRxGraph, sizeof(shared_mem_radio_stats_interfaces_rx_graph));
       }
@@ -1979,9 +2011,9 @@ void _synchronize_shared_mems()
       update_shared_mem_video_info_stats( &g_SM_VideoInfoStatsRadioIn, g_TimeNow);
 
       if ( NULL != g_pSM_VideoInfoStatsOutput )
-         memcpy((u8*)g_pSM_VideoInfoStatsOutput, (u8*)&g_SM_VideoInfoStatsOutput, sizeof(shared_mem_video_info_stats));
+         shared_mem_block_write(g_pSM_VideoInfoStatsOutput, &g_SM_VideoInfoStatsOutput, sizeof(shared_mem_video_info_stats));
       if ( NULL != g_pSM_VideoInfoStatsRadioIn )
-         memcpy((u8*)g_pSM_VideoInfoStatsRadioIn, (u8*)&g_SM_VideoInfoStatsRadioIn, sizeof(shared_mem_video_info_stats));
+         shared_mem_block_write(g_pSM_VideoInfoStatsRadioIn, &g_SM_VideoInfoStatsRadioIn, sizeof(shared_mem_video_info_stats));
    }
 
    static u32 s_uTimeLastRxHistorySync = 0;
@@ -1994,6 +2026,8 @@ void _synchronize_shared_mems()
 }
 
 void _main_loop();
+bool _router_event_loop_init();
+void _router_event_loop_run();
 
 void handle_sigint(int sig) 
 { 
@@ -2018,6 +2052,7 @@ int main(int argc, char *argv[])
    }
       
    log_init("Router");
+   log_enable_async();
    
    g_bSearching = false;
    g_uSearchFrequency = 0;
@@ -2091,6 +2126,11 @@ int main(int argc, char *argv[])
    else
       radio_set_bypass_socket_buffers(0);
 
+   if ( g_pControllerSettings->iRadioRxUsesMmapRing )
+      radio_set_use_mmap_ring_for_rx(1);
+   else
+      radio_set_use_mmap_ring_for_rx(0);
+
    if ( g_pControllerSettings->iRadioTxUsesPPCAP )
       radio_set_use_pcap_for_tx(1);
    else
@@ -2244,9 +2284,6 @@ int main(int argc, char *argv[])
          send_alarm_to_central(ALARM_ID_FIRMWARE_OLD, i, 0);
    }
 
-   for( int i=0; i<MAX_RADIO_PACKETS_TO_CACHE_LOCALLY; i++ )
-      s_ReceivedRadioPacketsBuffer[i].pPacketData = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
-
    hw_increase_current_thread_priority("Main thread", DEFAULT_PRIORITY_THREAD_ROUTER);
 
    log_line("");
@@ -2260,6 +2297,9 @@ int main(int argc, char *argv[])
    // -----------------------------------------------------------
    // Main loop here
    
+   latency_histogram_reset(&s_RadioRxDispatchLatency);
+   s_bUseEventLoop = _router_event_loop_init();
+
    while ( !g_bQuit )
    {
       g_TimeNow = get_current_timestamp_ms();
@@ -2268,11 +2308,17 @@ int main(int argc, char *argv[])
          g_pProcessStats->uLoopCounter++;
          g_pProcessStats->lastActiveTime = g_TimeNow;
       }
-      _main_loop();
+      if ( s_bUseEventLoop )
+         _router_event_loop_run();
+      else
+         _main_loop();
       if ( g_bQuit )
          break;
    }
 
+   if ( s_bUseEventLoop )
+      event_loop_uninit(&s_RouterEventLoop);
+
    // End main loop
    //------------------------------------------------------------
 
@@ -2372,35 +2418,39 @@ void video_processors_cleanup()
       rx_video_output_uninit();
 }
 
-void _main_loop()
+void _log_main_loop_latency_stats()
 {
-   static u32 uMaxLoopTime = DEFAULT_MAX_LOOP_TIME_MILISECONDS;
-
-   //hardware_sleep_ms(1);
-   //hardware_sleep_micros(300);
-
-   g_TimeNow = get_current_timestamp_ms();
-   g_TimeNowMicros = get_current_timestamp_micros();
-   u32 tTime0 = g_TimeNow;
+   if ( g_TimeNow < s_uTimeLastLatencyLog + ROUTER_LATENCY_LOG_INTERVAL_MS )
+      return;
+   s_uTimeLastLatencyLog = g_TimeNow;
 
-   if ( (g_pProcessStats->uLoopCounter % 10) == 0 )
+   log_line("Main loop: %s", s_bUseEventLoop?"event driven":"polling");
+   latency_histogram_log(&s_RadioRxDispatchLatency, "Radio rx queue to dispatch");
+   latency_histogram_reset(&s_RadioRxDispatchLatency);
+   if ( s_bUseEventLoop )
    {
-      _router_periodic_loop();
-      _synchronize_shared_mems();
-      _check_rx_loop_consistency();
-      _check_send_or_queue_ping();
+      event_loop_log_stats(&s_RouterEventLoop);
+      event_loop_reset_stats(&s_RouterEventLoop);
    }
+}
 
-   u32 tTime1 = get_current_timestamp_ms();
-
-   if ( (g_pProcessStats->uLoopCounter % 5) == 0 )
-   {
-      _read_ipc_pipes(tTime1);
-      _consume_ipc_messages();
-   }
+void _main_loop_periodic()
+{
+   _router_periodic_loop();
+   _synchronize_shared_mems();
+   _check_rx_loop_consistency();
+   _check_send_or_queue_ping();
+   _log_main_loop_latency_stats();
+}
 
-   u32 tTime2 = get_current_timestamp_ms();
+void _main_loop_ipc(u32 uTimeNow)
+{
+   _read_ipc_pipes(uTimeNow);
+   _consume_ipc_messages();
+}
 
+int _main_loop_consume_radio_rx()
+{
    int iCounter = 4;
    int iRxPackets = 0;
    while ( iCounter > 0 )
@@ -2411,34 +2461,11 @@ void _main_loop()
          break;
       iRxPackets += k;
    }
-   if ( iRxPackets == 0 )
-      hardware_sleep_ms(1);
-
-   u32 tTime3 = get_current_timestamp_ms();
-   
-   int nEndOfVideoBlock = 0;
-   /*
-   for( int i=0; i<6; i++ )
-   {
-      if ( receivedAny > 0 )
-         nEndOfVideoBlock |= process_received_radio_packets();
-      else
-         break;
-      receivedAny = try_receive_radio_packets(200);
-   }
-   */
-   u32 tTime4 = get_current_timestamp_ms();
-   
-   if ( g_bSearching )
-   {
-      u32 tNow = get_current_timestamp_ms();
-      if ( tNow > g_TimeNow + uMaxLoopTime )
-         log_softerror_and_alarm("Router loop took too long to complete (%d milisec)!!!", tNow - g_TimeNow);
-      else
-         s_iCountCPULoopOverflows = 0;
-      return;
-   }
+   return iRxPackets;
+}
 
+void _main_loop_video_periodic()
+{
    for( int i=0; i<MAX_VIDEO_PROCESSORS; i++ )
    {
       if ( g_pVideoProcessorRxList[i] == NULL )
@@ -2452,9 +2479,10 @@ void _main_loop()
       video_link_adaptive_periodic_loop();
       video_link_keyframe_periodic_loop();
    }
+}
 
-   u32 tTime5 = get_current_timestamp_ms();
-
+void _main_loop_check_send_packets(int nEndOfVideoBlock)
+{
    int iCountHighPriorityPackets = 0;   
    for( int i=0; i<packets_queue_has_packets(&s_QueueRadioPackets); i++ )
    {
@@ -2494,20 +2522,33 @@ void _main_loop()
 
    if ( bSendNow )
       _process_and_send_packets();
+}
 
-   u32 tTime6 = get_current_timestamp_ms();
-   if ( (g_TimeNow > g_TimeStart + 10000) && (tTime6 > tTime0 + uMaxLoopTime) )
+// pStageTimes: start time of each stage of the loop and the end time of the last one (ms)
+
+void _main_loop_update_loop_time(u32* pStageTimes, int iCountStages)
+{
+   u32 uLoopTime = pStageTimes[iCountStages] - pStageTimes[0];
+   if ( (g_TimeNow > g_TimeStart + 10000) && (uLoopTime > DEFAULT_MAX_LOOP_TIME_MILISECONDS) )
    {
-      log_softerror_and_alarm("Router loop took too long to complete (%d milisec: %u + %u + %u + %u + %u + %u), repeat count: %u!!!", tTime6 - tTime0, tTime1-tTime0, tTime2-tTime1, tTime3-tTime2, tTime4-tTime3, tTime5-tTime4, tTime6-tTime5, s_iCountCPULoopOverflows+1);
+      char szStages[128];
+      szStages[0] = 0;
+      for( int i=0; i<iCountStages; i++ )
+      {
+         char szTmp[24];
+         sprintf(szTmp, "%s%u", (0 == i)?"":" + ", pStageTimes[i+1] - pStageTimes[i]);
+         strcat(szStages, szTmp);
+      }
+      log_softerror_and_alarm("Router loop took too long to complete (%d milisec: %s), repeat count: %u!!!", uLoopTime, szStages, s_iCountCPULoopOverflows+1);
 
       s_iCountCPULoopOverflows++;
       if ( s_iCountCPULoopOverflows > 5 )
       if ( g_TimeNow > g_TimeLastSetRadioFlagsCommandSent + 5000 )
-         send_alarm_to_central(ALARM_ID_CONTROLLER_CPU_LOOP_OVERLOAD,(tTime6-tTime0), 0);
+         send_alarm_to_central(ALARM_ID_CONTROLLER_CPU_LOOP_OVERLOAD, uLoopTime, 0);
 
-      if ( tTime6 >= tTime0 + 300 )
+      if ( uLoopTime >= 300 )
       if ( g_TimeNow > g_TimeLastSetRadioFlagsCommandSent + 5000 )
-         send_alarm_to_central(ALARM_ID_CONTROLLER_CPU_LOOP_OVERLOAD,(tTime6-tTime0)<<16, 0);
+         send_alarm_to_central(ALARM_ID_CONTROLLER_CPU_LOOP_OVERLOAD, uLoopTime<<16, 0);
    }
    else
    {
@@ -2516,10 +2557,172 @@ void _main_loop()
 
    if ( NULL != g_pProcessStats )
    {
-      if ( g_pProcessStats->uMaxLoopTimeMs < tTime6 - tTime0 )
-         g_pProcessStats->uMaxLoopTimeMs = tTime6 - tTime0;
-      g_pProcessStats->uTotalLoopTime += tTime6 - tTime0;
+      if ( g_pProcessStats->uMaxLoopTimeMs < uLoopTime )
+         g_pProcessStats->uMaxLoopTimeMs = uLoopTime;
+      g_pProcessStats->uTotalLoopTime += uLoopTime;
       if ( 0 != g_pProcessStats->uLoopCounter )
          g_pProcessStats->uAverageLoopTimeMs = g_pProcessStats->uTotalLoopTime / g_pProcessStats->uLoopCounter;
    }
-}
\ No newline at end of file
+}
+
+// Polling main loop
+
+void _main_loop()
+{
+   static u32 uMaxLoopTime = DEFAULT_MAX_LOOP_TIME_MILISECONDS;
+
+   //hardware_sleep_ms(1);
+   //hardware_sleep_micros(300);
+
+   g_TimeNow = get_current_timestamp_ms();
+   g_TimeNowMicros = get_current_timestamp_micros();
+   u32 uStageTimes[7];
+   uStageTimes[0] = g_TimeNow;
+
+   if ( (g_pProcessStats->uLoopCounter % 10) == 0 )
+      _main_loop_periodic();
+
+   uStageTimes[1] = get_current_timestamp_ms();
+
+   if ( (g_pProcessStats->uLoopCounter % 5) == 0 )
+      _main_loop_ipc(uStageTimes[1]);
+
+   uStageTimes[2] = get_current_timestamp_ms();
+
+   int iRxPackets = _main_loop_consume_radio_rx();
+   if ( iRxPackets == 0 )
+      hardware_sleep_ms(1);
+
+   uStageTimes[3] = get_current_timestamp_ms();
+   
+   int nEndOfVideoBlock = 0;
+   /*
+   for( int i=0; i<6; i++ )
+   {
+      if ( receivedAny > 0 )
+         nEndOfVideoBlock |= process_received_radio_packets();
+      else
+         break;
+      receivedAny = try_receive_radio_packets(200);
+   }
+   */
+   uStageTimes[4] = get_current_timestamp_ms();
+   
+   if ( g_bSearching )
+   {
+      u32 tNow = get_current_timestamp_ms();
+      if ( tNow > g_TimeNow + uMaxLoopTime )
+         log_softerror_and_alarm("Router loop took too long to complete (%d milisec)!!!", tNow - g_TimeNow);
+      else
+         s_iCountCPULoopOverflows = 0;
+      return;
+   }
+
+   _main_loop_video_periodic();
+
+   uStageTimes[5] = get_current_timestamp_ms();
+
+   _main_loop_check_send_packets(nEndOfVideoBlock);
+
+   uStageTimes[6] = get_current_timestamp_ms();
+   _main_loop_update_loop_time(uStageTimes, 6);
+}
+
+// Event driven main loop
+
+void _router_on_radio_rx_event(void* pContext)
+{
+   g_TimeNow = get_current_timestamp_ms();
+   g_TimeNowMicros = get_current_timestamp_micros();
+   event_loop_drain_fd(radio_rx_get_event_fd());
+   _main_loop_consume_radio_rx();
+}
+
+void _router_on_ipc_event(void* pContext)
+{
+   g_TimeNow = get_current_timestamp_ms();
+   _main_loop_ipc(g_TimeNow);
+}
+
+void _router_on_periodic_timer(void* pContext)
+{
+   g_TimeNow = get_current_timestamp_ms();
+   _main_loop_periodic();
+}
+
+bool _router_event_loop_init()
+{
+   if ( radio_rx_get_event_fd() < 0 )
+   {
+      log_softerror_and_alarm("No radio rx event fd. Using polling main loop.");
+      return false;
+   }
+   if ( ! event_loop_init(&s_RouterEventLoop) )
+      return false;
+
+   bool bOk = true;
+   if ( event_loop_add_fd(&s_RouterEventLoop, "radio_rx", radio_rx_get_event_fd(), EVENT_LOOP_PRIORITY_HIGHEST, EVENT_LOOP_FLAG_CUSTOM_LATENCY, _router_on_radio_rx_event, NULL) < 0 )
+      bOk = false;
+
+   // IPC channels are waited on by their doorbell fd; the ones that can't be (message queues, FIFOs) are polled on a timer
+   bool bIPCNeedsTimer = false;
+   int iIPCChannels[3] = { g_fIPCFromCentral, g_fIPCFromTelemetry, g_fIPCFromRC };
+   const char* szIPCNames[3] = { "ipc_central", "ipc_telemetry", "ipc_rc" };
+   for( int i=0; i<3; i++ )
+   {
+      int iFd = ruby_ipc_get_pollable_fd(iIPCChannels[i]);
+      if ( iFd < 0 )
+         bIPCNeedsTimer = true;
+      else if ( event_loop_add_fd(&s_RouterEventLoop, szIPCNames[i], iFd, EVENT_LOOP_PRIORITY_HIGH, 0, _router_on_ipc_event, NULL) < 0 )
+         bOk = false;
+   }
+   if ( bIPCNeedsTimer )
+   if ( event_loop_add_timer(&s_RouterEventLoop, "ipc", ROUTER_TIMER_IPC_MICROS, EVENT_LOOP_PRIORITY_HIGH, _router_on_ipc_event, NULL) < 0 )
+      bOk = false;
+
+   if ( event_loop_add_timer(&s_RouterEventLoop, "periodic", ROUTER_TIMER_PERIODIC_MICROS, EVENT_LOOP_PRIORITY_NORMAL, _router_on_periodic_timer, NULL) < 0 )
+      bOk = false;
+
+   if ( ! bOk )
+   {
+      log_softerror_and_alarm("Failed to setup the event driven main loop. Using polling main loop.");
+      event_loop_uninit(&s_RouterEventLoop);
+      return false;
+   }
+   log_line("Using event driven main loop.");
+   return true;
+}
+
+void _router_event_loop_run()
+{
+   u32 uTimeWorkStartMicros = 0;
+   if ( radio_rx_arm_event_fd() )
+   {
+      // Packets are already waiting: consume them now, then handle the other ready sources, without waiting
+      uTimeWorkStartMicros = get_current_timestamp_micros();
+      g_TimeNowMicros = uTimeWorkStartMicros;
+      g_TimeNow = get_current_timestamp_ms();
+      _main_loop_consume_radio_rx();
+      event_loop_run_once(&s_RouterEventLoop, 0);
+   }
+   else
+   {
+      if ( event_loop_run_once(&s_RouterEventLoop, 100) <= 0 )
+         return;
+      uTimeWorkStartMicros = s_RouterEventLoop.uTimeLastWakeupMicros;
+   }
+
+   g_TimeNow = get_current_timestamp_ms();
+   g_TimeNowMicros = get_current_timestamp_micros();
+   if ( g_bSearching )
+      return;
+
+   u32 uStageTimes[4];
+   uStageTimes[0] = g_TimeNow - (g_TimeNowMicros - uTimeWorkStartMicros)/1000;
+   uStageTimes[1] = g_TimeNow;
+   _main_loop_video_periodic();
+   uStageTimes[2] = get_current_timestamp_ms();
+   _main_loop_check_send_packets(0);
+   uStageTimes[3] = get_current_timestamp_ms();
+   _main_loop_update_loop_time(uStageTimes, 3);
+}
@@ -852,10 +852,11 @@ void rx_video_output_video_data(u32 uVehicleId, u8 uVideoStreamType, int width,
    }
 
    if ( NULL != g_pCurrentModel )
-   if ( uVideoStreamType == VIDEO_TYPE_H264 )
+   if ( (uVideoStreamType == VIDEO_TYPE_H264) || (uVideoStreamType == VIDEO_TYPE_H265) )
    if ( g_pCurrentModel->osd_params.osd_flags[g_pCurrentModel->osd_params.layout] & OSD_FLAG_SHOW_STATS_VIDEO_KEYFRAMES_INFO)
    if ( get_ControllerSettings()->iShowVideoStreamInfoCompactType == 0 )
    {
+      s_ParserH264Output.setCodec(uVideoStreamType == VIDEO_TYPE_H265);
       _processor_rx_video_forward_parse_h264_stream(pBuffer, video_data_length);
    }
 
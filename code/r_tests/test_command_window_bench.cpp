@@ -0,0 +1,473 @@
+/*
+   Commands window benchmark.
+   Sends bursts of settings commands (as a menu does when a few settings are changed one after another)
+   from a controller to a vehicle over a virtual radio link (both sides are in this process), in two ways:
+      stop-and-wait: one command at a time, 50 ms resend timeout growing by 10 ms on each resend,
+                     as the controller sends the commands that are not windowed (handle_commands.cpp);
+      window:        up to COMMAND_WINDOW_SIZE commands in flight, selective acks and adaptive resend timeout
+                     (command_window.h), the vehicle answering resent commands from its received commands history.
+   For a few link profiles reports the latency of the commands (from the time they are queued to their response),
+   the time to complete a burst, the packets sent by the controller and the resends, and checks that the vehicle
+   applied each command exactly once and that all the commands completed.
+
+   Usage: test_command_window_bench [-p base port] [-n bursts]
+*/
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/commands.h"
+#include "../base/command_window.h"
+#include "../base/hardware.h"
+#include "../base/hardware_radio.h"
+#include "../base/hardware_radio_virtual.h"
+#include "../radio/radiopackets2.h"
+
+#include <time.h>
+#include <sys/select.h>
+
+#define BENCH_VEHICLE_ID 0x5EB0C001
+#define BENCH_CONTROLLER_ID 0x5EB0C002
+#define BENCH_BURST_COMMANDS 5
+#define BENCH_MAX_BURSTS 200
+#define BENCH_MAX_COMMANDS (BENCH_MAX_BURSTS*BENCH_BURST_COMMANDS)
+#define BENCH_COMMAND_DATA_LENGTH 120
+#define BENCH_MAX_RESENDS_STOP_AND_WAIT 40
+#define BENCH_MAX_RESENDS_WINDOW 12
+#define BENCH_BURST_TIMEOUT_MS 20000
+
+// Virtual interfaces: 0 - vehicle to controller, 1 - controller to vehicle
+#define BENCH_IFACE_DOWNLINK 0
+#define BENCH_IFACE_UPLINK 1
+
+int g_iBasePort = 7480;
+int g_iBursts = 40;
+
+typedef struct
+{
+   const char* szName;
+   const char* szConfig;
+} type_link_profile;
+
+typedef struct
+{
+   int iCommands;
+   int iCompleted;
+   int iTimedOut;
+   int iPacketsSent;
+   int iResends;
+   int iResponses;
+   u32 uLatencyMs[BENCH_MAX_COMMANDS];
+   u32 uBurstMs[BENCH_MAX_BURSTS];
+   int iBursts;
+   bool bAppliedOnce;
+} type_bench_result;
+
+static const u8 s_uBurstCommandTypes[BENCH_BURST_COMMANDS] = { COMMAND_ID_SET_CAMERA_PARAMETERS, COMMAND_ID_SET_OSD_PARAMS, COMMAND_ID_SET_ALARMS_PARAMS, COMMAND_ID_SET_TX_POWERS, COMMAND_ID_SET_VIDEO_PARAMS };
+
+static int s_iFdControllerRead = -1;
+static int s_iFdVehicleRead = -1;
+static u32 s_uPacketIndex = 0;
+
+// Vehicle state
+static int s_iAppliedCount[BENCH_MAX_COMMANDS+1];
+static type_command_window_rx s_VehicleRx;
+static u32 s_uVehicleLastCommandCounter = 0;
+static u8 s_uVehicleLastResponseFlags = 0;
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static u32 _now_ms()
+{
+   return (u32)(_now_micros()/1000);
+}
+
+static bool _open_link(const char* szConfig)
+{
+   type_radio_virtual_config config;
+   hardware_radio_virtual_get_default_config(&config);
+   hardware_radio_virtual_parse_config(szConfig, &config);
+   config.iCount = 2;
+   config.iBasePort = g_iBasePort;
+
+   // The side is taken when each interface is opened
+   config.iSide = VIRTUAL_RADIO_SIDE_VEHICLE;
+   hardware_radio_virtual_set_config(&config);
+   hardware_reset_radio_enumerated_flag();
+   hardware_enumerate_radio_interfaces();
+   if ( hardware_radio_virtual_open_for_write(BENCH_IFACE_DOWNLINK) < 0 )
+      return false;
+   s_iFdVehicleRead = hardware_radio_virtual_open_for_read(BENCH_IFACE_UPLINK);
+
+   config.iSide = VIRTUAL_RADIO_SIDE_STATION;
+   hardware_radio_virtual_set_config(&config);
+   if ( hardware_radio_virtual_open_for_write(BENCH_IFACE_UPLINK) < 0 )
+      return false;
+   s_iFdControllerRead = hardware_radio_virtual_open_for_read(BENCH_IFACE_DOWNLINK);
+   return (s_iFdVehicleRead >= 0) && (s_iFdControllerRead >= 0);
+}
+
+static void _close_link()
+{
+   hardware_radio_virtual_close_for_read(BENCH_IFACE_UPLINK);
+   hardware_radio_virtual_close_for_read(BENCH_IFACE_DOWNLINK);
+   hardware_radio_virtual_close_for_write(BENCH_IFACE_UPLINK);
+   hardware_radio_virtual_close_for_write(BENCH_IFACE_DOWNLINK);
+   s_iFdVehicleRead = -1;
+   s_iFdControllerRead = -1;
+}
+
+static void _controller_send_command(u16 uCommandType, u32 uCommandCounter, u8 uResendCounter, type_bench_result* pResult)
+{
+   t_packet_header PH;
+   t_packet_header_command PHC;
+   radio_packet_init(&PH, PACKET_COMPONENT_COMMANDS, PACKET_TYPE_COMMAND, STREAM_ID_DATA);
+   PH.vehicle_id_src = BENCH_CONTROLLER_ID;
+   PH.vehicle_id_dest = BENCH_VEHICLE_ID;
+   PH.stream_packet_idx = s_uPacketIndex++;
+   PH.total_length = sizeof(t_packet_header) + sizeof(t_packet_header_command) + BENCH_COMMAND_DATA_LENGTH;
+   memset(&PHC, 0, sizeof(t_packet_header_command));
+   PHC.command_type = uCommandType;
+   PHC.command_counter = uCommandCounter;
+   PHC.command_resend_counter = uResendCounter;
+
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   memset(packet, 0, PH.total_length);
+   memcpy(packet, &PH, sizeof(t_packet_header));
+   memcpy(packet + sizeof(t_packet_header), &PHC, sizeof(t_packet_header_command));
+   hardware_radio_virtual_write(BENCH_IFACE_UPLINK, NULL, 0, packet, PH.total_length);
+   pResult->iPacketsSent++;
+   if ( uResendCounter > 0 )
+      pResult->iResends++;
+}
+
+static void _vehicle_send_response(u16 uCommandType, u32 uCommandCounter, u8 uResendCounter, u8 uFlags)
+{
+   t_packet_header PH;
+   t_packet_header_command_response PHCR;
+   radio_packet_init(&PH, PACKET_COMPONENT_COMMANDS, PACKET_TYPE_COMMAND_RESPONSE, STREAM_ID_DATA);
+   PH.vehicle_id_src = BENCH_VEHICLE_ID;
+   PH.vehicle_id_dest = BENCH_CONTROLLER_ID;
+   PH.stream_packet_idx = s_uPacketIndex++;
+   PH.total_length = sizeof(t_packet_header) + sizeof(t_packet_header_command_response);
+   memset(&PHCR, 0, sizeof(t_packet_header_command_response));
+   PHCR.origin_command_type = uCommandType;
+   PHCR.origin_command_counter = uCommandCounter;
+   PHCR.origin_command_resend_counter = uResendCounter;
+   PHCR.command_response_flags = uFlags;
+   if ( uCommandType & COMMAND_TYPE_FLAG_WINDOWED )
+   {
+      PHCR.origin_command_type |= COMMAND_TYPE_FLAG_WINDOW_ACK;
+      PHCR.response_counter = command_window_rx_get_ack_bitmap(&s_VehicleRx, uCommandCounter, _now_ms());
+   }
+
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   memcpy(packet, &PH, sizeof(t_packet_header));
+   memcpy(packet + sizeof(t_packet_header), &PHCR, sizeof(t_packet_header_command_response));
+   hardware_radio_virtual_write(BENCH_IFACE_DOWNLINK, NULL, 0, packet, PH.total_length);
+}
+
+// Vehicle: as on_received_command() in ruby_rx_commands.cpp
+static void _vehicle_process_packets()
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   int iLength = 0;
+   while ( (iLength = hardware_radio_virtual_read(BENCH_IFACE_UPLINK, packet, sizeof(packet))) > 0 )
+   {
+      if ( iLength < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_command)) )
+         continue;
+      t_packet_header_command* pPHC = (t_packet_header_command*)(packet + sizeof(t_packet_header));
+      u32 uTimeNow = _now_ms();
+
+      if ( pPHC->command_type & COMMAND_TYPE_FLAG_WINDOWED )
+      {
+         type_command_window_rx_entry* pEntry = command_window_rx_find(&s_VehicleRx, BENCH_CONTROLLER_ID, pPHC->command_counter, uTimeNow);
+         if ( NULL != pEntry )
+         {
+            if ( pEntry->bHasResponse )
+               _vehicle_send_response(pPHC->command_type, pPHC->command_counter, pPHC->command_resend_counter, pEntry->uResponseFlags);
+            continue;
+         }
+         command_window_rx_add(&s_VehicleRx, BENCH_CONTROLLER_ID, pPHC->command_counter, uTimeNow);
+      }
+      else if ( pPHC->command_counter == s_uVehicleLastCommandCounter )
+      {
+         _vehicle_send_response(pPHC->command_type, pPHC->command_counter, pPHC->command_resend_counter, s_uVehicleLastResponseFlags);
+         continue;
+      }
+
+      if ( pPHC->command_counter <= BENCH_MAX_COMMANDS )
+         s_iAppliedCount[pPHC->command_counter]++;
+      s_uVehicleLastCommandCounter = pPHC->command_counter;
+      s_uVehicleLastResponseFlags = COMMAND_RESPONSE_FLAGS_OK;
+      if ( pPHC->command_type & COMMAND_TYPE_FLAG_WINDOWED )
+         command_window_rx_set_response(&s_VehicleRx, pPHC->command_counter, COMMAND_RESPONSE_FLAGS_OK, 0, NULL, 0);
+      _vehicle_send_response(pPHC->command_type, pPHC->command_counter, pPHC->command_resend_counter, COMMAND_RESPONSE_FLAGS_OK);
+   }
+}
+
+// Waits up to 1 ms for a packet on any side
+static void _wait_for_packets()
+{
+   fd_set readSet;
+   FD_ZERO(&readSet);
+   FD_SET(s_iFdVehicleRead, &readSet);
+   FD_SET(s_iFdControllerRead, &readSet);
+   struct timeval tv;
+   tv.tv_sec = 0;
+   tv.tv_usec = 1000;
+   select(((s_iFdVehicleRead > s_iFdControllerRead)?s_iFdVehicleRead:s_iFdControllerRead)+1, &readSet, NULL, NULL, &tv);
+}
+
+// Returns the next response received by the controller, false if none
+static bool _controller_read_response(t_packet_header_command_response* pPHCR)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   int iLength = 0;
+   while ( (iLength = hardware_radio_virtual_read(BENCH_IFACE_DOWNLINK, packet, sizeof(packet))) > 0 )
+   {
+      if ( iLength < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_command_response)) )
+         continue;
+      memcpy(pPHCR, packet + sizeof(t_packet_header), sizeof(t_packet_header_command_response));
+      return true;
+   }
+   return false;
+}
+
+// Lets the link deliver (and drop) what is still on the way
+static void _drain_link()
+{
+   u32 uEnd = _now_ms() + 300;
+   t_packet_header_command_response PHCR;
+   while ( _now_ms() < uEnd )
+   {
+      _wait_for_packets();
+      _vehicle_process_packets();
+      while ( _controller_read_response(&PHCR) );
+   }
+}
+
+// Stop-and-wait: as handle_commands_send_to_vehicle() and handle_commands_loop()
+static void _run_stop_and_wait_burst(u32 uFirstCounter, u32 uBurstStart, type_bench_result* pResult)
+{
+   for( int i=0; i<BENCH_BURST_COMMANDS; i++ )
+   {
+      u32 uCounter = uFirstCounter + i;
+      u16 uType = s_uBurstCommandTypes[i];
+      u32 uTimeout = 50;
+      u8 uResendCounter = 0;
+      u32 uSendTime = _now_ms();
+      bool bDone = false;
+      _controller_send_command(uType, uCounter, 0, pResult);
+      while ( ! bDone )
+      {
+         _wait_for_packets();
+         _vehicle_process_packets();
+         t_packet_header_command_response PHCR;
+         while ( _controller_read_response(&PHCR) )
+         {
+            pResult->iResponses++;
+            if ( PHCR.origin_command_counter != uCounter )
+               continue;
+            pResult->uLatencyMs[pResult->iCompleted++] = _now_ms() - uBurstStart;
+            bDone = true;
+            break;
+         }
+         if ( bDone )
+            break;
+         u32 uTimeNow = _now_ms();
+         if ( uTimeNow > uSendTime + uTimeout )
+         {
+            if ( uResendCounter >= BENCH_MAX_RESENDS_STOP_AND_WAIT )
+            {
+               pResult->iTimedOut++;
+               break;
+            }
+            if ( uTimeout < 300 )
+               uTimeout += 10;
+            uResendCounter++;
+            uSendTime = uTimeNow;
+            _controller_send_command(uType, uCounter, uResendCounter, pResult);
+         }
+      }
+   }
+}
+
+static void _run_window_burst(type_command_window* pWindow, u32 uFirstCounter, u32 uBurstStart, type_bench_result* pResult)
+{
+   for( int i=0; i<BENCH_BURST_COMMANDS; i++ )
+   {
+      u8 uData[BENCH_COMMAND_DATA_LENGTH];
+      memset(uData, 0, sizeof(uData));
+      u8 uPriority = COMMAND_WINDOW_PRIORITY_NORMAL;
+      if ( s_uBurstCommandTypes[i] == COMMAND_ID_SET_TX_POWERS )
+         uPriority = COMMAND_WINDOW_PRIORITY_HIGH;
+      command_window_add(pWindow, uFirstCounter + i, s_uBurstCommandTypes[i], 0, uData, sizeof(uData), uPriority, s_uBurstCommandTypes[i], 0, BENCH_MAX_RESENDS_WINDOW, _now_ms());
+   }
+
+   while ( ! command_window_is_empty(pWindow) )
+   {
+      type_command_window_entry* pEntry = NULL;
+      while ( NULL != (pEntry = command_window_get_next_to_send(pWindow, _now_ms())) )
+         _controller_send_command(pEntry->uCommandType | COMMAND_TYPE_FLAG_WINDOWED, pEntry->uCommandCounter, pEntry->uResendCounter, pResult);
+
+      _wait_for_packets();
+      _vehicle_process_packets();
+
+      t_packet_header_command_response PHCR;
+      while ( _controller_read_response(&PHCR) )
+      {
+         pResult->iResponses++;
+         pEntry = command_window_on_response(pWindow, PHCR.origin_command_counter, PHCR.origin_command_resend_counter,
+            (PHCR.origin_command_type & COMMAND_TYPE_FLAG_WINDOW_ACK)?1:0, PHCR.response_counter, _now_ms());
+         if ( NULL == pEntry )
+            continue;
+         pResult->uLatencyMs[pResult->iCompleted++] = _now_ms() - uBurstStart;
+         command_window_remove(pWindow, pEntry);
+      }
+
+      while ( NULL != (pEntry = command_window_get_timed_out(pWindow, _now_ms())) )
+      {
+         pResult->iTimedOut++;
+         command_window_remove(pWindow, pEntry);
+      }
+      if ( _now_ms() > uBurstStart + BENCH_BURST_TIMEOUT_MS )
+         break;
+   }
+}
+
+static void _run(bool bWindow, type_bench_result* pResult)
+{
+   memset(pResult, 0, sizeof(type_bench_result));
+   memset(s_iAppliedCount, 0, sizeof(s_iAppliedCount));
+   command_window_rx_reset(&s_VehicleRx);
+   s_uVehicleLastCommandCounter = 0;
+
+   type_command_window window;
+   command_window_init(&window, COMMAND_WINDOW_SIZE);
+
+   u32 uCounter = 1;
+   for( int b=0; b<g_iBursts; b++ )
+   {
+      u32 uBurstStart = _now_ms();
+      if ( bWindow )
+         _run_window_burst(&window, uCounter, uBurstStart, pResult);
+      else
+         _run_stop_and_wait_burst(uCounter, uBurstStart, pResult);
+      pResult->uBurstMs[pResult->iBursts++] = _now_ms() - uBurstStart;
+      uCounter += BENCH_BURST_COMMANDS;
+      pResult->iCommands += BENCH_BURST_COMMANDS;
+
+      // The user changes some other settings a bit later
+      u32 uPauseEnd = _now_ms() + 20;
+      t_packet_header_command_response PHCR;
+      while ( _now_ms() < uPauseEnd )
+      {
+         _wait_for_packets();
+         _vehicle_process_packets();
+         while ( _controller_read_response(&PHCR) )
+            pResult->iResponses++;
+      }
+   }
+   _drain_link();
+
+   pResult->bAppliedOnce = true;
+   for( u32 u=1; u<uCounter; u++ )
+      if ( s_iAppliedCount[u] != 1 )
+         pResult->bAppliedOnce = false;
+}
+
+static int _compare_u32(const void* p1, const void* p2)
+{
+   u32 u1 = *(const u32*)p1;
+   u32 u2 = *(const u32*)p2;
+   return (u1 < u2)?-1:((u1 > u2)?1:0);
+}
+
+static u32 _percentile(u32* pValues, int iCount, int iPercent)
+{
+   if ( iCount <= 0 )
+      return 0;
+   qsort(pValues, iCount, sizeof(u32), _compare_u32);
+   int iIndex = (iCount * iPercent) / 100;
+   if ( iIndex >= iCount )
+      iIndex = iCount-1;
+   return pValues[iIndex];
+}
+
+static void _print_result(const char* szProfile, const char* szMode, type_bench_result* pResult)
+{
+   u32 uBurstSum = 0;
+   for( int i=0; i<pResult->iBursts; i++ )
+      uBurstSum += pResult->uBurstMs[i];
+   u32 uBurstAvg = (pResult->iBursts > 0)?(uBurstSum/pResult->iBursts):0;
+   u32 uBurstMax = _percentile(pResult->uBurstMs, pResult->iBursts, 100);
+   u32 uP50 = _percentile(pResult->uLatencyMs, pResult->iCompleted, 50);
+   u32 uP90 = _percentile(pResult->uLatencyMs, pResult->iCompleted, 90);
+   u32 uP99 = _percentile(pResult->uLatencyMs, pResult->iCompleted, 99);
+   printf("   %-6s %-13s latency p50 %4u ms, p90 %4u ms, p99 %4u ms, burst avg %4u ms, max %5u ms, packets %4d, resends %4d, completed %d/%d, timed out %d, applied once: %s\n",
+      szProfile, szMode, uP50, uP90, uP99, uBurstAvg, uBurstMax, pResult->iPacketsSent, pResult->iResends,
+      pResult->iCompleted, pResult->iCommands, pResult->iTimedOut, pResult->bAppliedOnce?"yes":"NO");
+}
+
+int main(int argc, char *argv[])
+{
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-p") && i < argc-1 )
+         g_iBasePort = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iBursts = atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-p base port] [-n bursts]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iBursts < 1 )
+      g_iBursts = 1;
+   if ( g_iBursts > BENCH_MAX_BURSTS )
+      g_iBursts = BENCH_MAX_BURSTS;
+
+   log_init_local_only("TestCommandWindowBench");
+   log_disable_stdout();
+
+   type_link_profile profiles[] = {
+      { "fast", "latency=1000" },
+      { "slow", "rate=250000,latency=20000,jitter=5000" },
+      { "lossy", "rate=250000,latency=20000,jitter=5000,loss=15,seed=5" },
+   };
+   int iProfilesCount = sizeof(profiles)/sizeof(profiles[0]);
+
+   printf("%d bursts of %d commands (%d bytes each), 20 ms between bursts, window size %d\n", g_iBursts, BENCH_BURST_COMMANDS, BENCH_COMMAND_DATA_LENGTH, COMMAND_WINDOW_SIZE);
+
+   static type_bench_result s_Result;
+   int iFailed = 0;
+   for( int p=0; p<iProfilesCount; p++ )
+   {
+      for( int m=0; m<2; m++ )
+      {
+         if ( ! _open_link(profiles[p].szConfig) )
+         {
+            printf("Failed to open the virtual radio interfaces (base port %d): %s\n", g_iBasePort, strerror(errno));
+            return 1;
+         }
+         _run(m == 1, &s_Result);
+         _print_result(profiles[p].szName, (m == 1)?"window":"stop-and-wait", &s_Result);
+         if ( (s_Result.iCompleted != s_Result.iCommands) || (! s_Result.bAppliedOnce) )
+            iFailed++;
+         _close_link();
+      }
+   }
+
+   if ( iFailed )
+   {
+      printf("Commands window benchmark: %d runs failed!\n", iFailed);
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,147 @@
+/*
+   CRC32 benchmark.
+   Checks that all the CRC32 implementations supported by the CPU give the same
+   results as the byte table one (all lengths up to 512 bytes, at all 16 byte
+   alignments, plus known vectors), then reports throughput and ns per call
+   for buffer sizes from 16 bytes to 64 Kb.
+
+   Usage: test_crc_bench [-i implementation|all] [-t ms per test] [-o out.csv]
+*/
+
+#include "../base/base.h"
+
+#include <time.h>
+#include <unistd.h>
+
+int g_iTimePerTestMs = 200;
+volatile u32 g_uSink = 0;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static int _check_implementation(int iImpl, u8* pBuffer, int iMaxLength)
+{
+   // Standard check value for "123456789"
+   u8 szCheck[] = "123456789";
+   base_crc32_select_implementation(iImpl);
+   if ( base_compute_crc32(szCheck, 9) != 0xCBF43926 )
+      return 1;
+
+   int iErrors = 0;
+   for( int iOffset=0; iOffset<16; iOffset++ )
+   for( int iLength=0; iLength+iOffset<=iMaxLength; iLength++ )
+   {
+      base_crc32_select_implementation(BASE_CRC32_IMPL_TABLE);
+      u32 uRef = base_compute_crc32(pBuffer + iOffset, iLength);
+      base_crc32_select_implementation(iImpl);
+      if ( base_compute_crc32(pBuffer + iOffset, iLength) != uRef )
+         iErrors++;
+   }
+   return iErrors;
+}
+
+static void _run_implementation(int iImpl, u8* pBuffer, FILE* fdOut)
+{
+   base_crc32_select_implementation(iImpl);
+   for( int iSize=16; iSize<=65536; iSize *= 2 )
+   {
+      // Calibrate the number of calls to about the requested time per test
+      int iCalls = 16;
+      u64 uTime = 0;
+      while ( true )
+      {
+         u64 uStart = _now_ns();
+         for( int i=0; i<iCalls; i++ )
+            g_uSink ^= base_compute_crc32(pBuffer, iSize);
+         uTime = _now_ns() - uStart;
+         if ( (uTime >= (u64)g_iTimePerTestMs * 1000000LL) || (iCalls >= (1<<28)) )
+            break;
+         if ( uTime < 1000000 )
+            iCalls *= 8;
+         else
+            iCalls = (int)((double)iCalls * (double)g_iTimePerTestMs * 1000000.0 / (double)uTime) + 1;
+      }
+      double fNsPerCall = (double)uTime / (double)iCalls;
+      double fMBps = (double)iSize * (double)iCalls / ((double)uTime / 1000000000.0) / (1024.0*1024.0);
+      fprintf(fdOut, "%s,%d,%.1f,%.2f\n", base_crc32_get_implementation_name(iImpl), iSize, fMBps, fNsPerCall);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+   int iImpl = BASE_CRC32_IMPL_AUTO;
+   bool bAll = false;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iTimePerTestMs = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-i") && i < argc-1 )
+      {
+         i++;
+         if ( 0 == strcmp(argv[i], "all") )
+            bAll = true;
+         for( int k=0; k<BASE_CRC32_IMPL_COUNT; k++ )
+            if ( 0 == strcmp(argv[i], base_crc32_get_implementation_name(k)) )
+               iImpl = k;
+      }
+      else
+      {
+         printf("Usage: %s [-i auto|table|slice8|pclmul|armv8|all] [-t ms per test] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iTimePerTestMs < 10 )
+      g_iTimePerTestMs = 10;
+
+   srand(1);
+   int iBufferSize = 65536 + 64;
+   u8* pBuffer = (u8*) malloc(iBufferSize);
+   for( int i=0; i<iBufferSize; i++ )
+      pBuffer[i] = rand() % 256;
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   base_crc32_select_implementation(BASE_CRC32_IMPL_AUTO);
+   int iAutoImpl = base_crc32_get_implementation();
+   fprintf(fdOut, "# CRC32 benchmark, auto selected implementation: %s\n", base_crc32_get_implementation_name(iAutoImpl));
+   fprintf(fdOut, "impl,size,mbps,ns_per_call\n");
+
+   int iFailed = 0;
+   for( int k=BASE_CRC32_IMPL_TABLE; k<BASE_CRC32_IMPL_COUNT; k++ )
+   {
+      if ( ! base_crc32_is_implementation_supported(k) )
+         continue;
+      if ( (! bAll) && (k != BASE_CRC32_IMPL_TABLE) && (k != ((iImpl == BASE_CRC32_IMPL_AUTO)?iAutoImpl:iImpl)) )
+         continue;
+      int iErrors = _check_implementation(k, pBuffer, 512);
+      if ( iErrors )
+      {
+         printf("CRC32 implementation %s: %d results differ from the table implementation!\n", base_crc32_get_implementation_name(k), iErrors);
+         iFailed++;
+         continue;
+      }
+      _run_implementation(k, pBuffer, fdOut);
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+   free(pBuffer);
+   return iFailed ? 1 : 0;
+}
@@ -0,0 +1,276 @@
+/*
+   Radio packets encryption benchmark: legacy per byte XOR (epp/dpp) vs ChaCha20-Poly1305.
+   Checks the ChaCha20, Poly1305 and AEAD implementations against the RFC 8439 test vectors,
+   checks that AEAD radio packets round trip through radio_build_new_raw_packet + packet_process_and_check
+   (and that altered packets are rejected), then reports throughput and ns per packet for payload sizes
+   up to a full radio packet.
+
+   Usage: test_crypto_bench [-n packets] [-o out.csv]
+*/
+
+#include "../base/base.h"
+#include "../base/encr.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+
+#include <time.h>
+#include <unistd.h>
+
+int g_iPacketsPerTest = 100000;
+volatile u32 g_uSink = 0;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static void _hex_to_bytes(const char* szHex, u8* pOut)
+{
+   for( int i=0; szHex[2*i] && szHex[2*i+1]; i++ )
+   {
+      unsigned int uByte = 0;
+      sscanf(szHex + 2*i, "%02x", &uByte);
+      pOut[i] = (u8)uByte;
+   }
+}
+
+// RFC 8439 sections 2.4.2, 2.5.2 and 2.8.2
+
+static int _check_test_vectors()
+{
+   int iErrors = 0;
+   u8 uKey[32];
+   u8 uNonce[12];
+   u8 uExpected[128];
+   u8 uBuffer[128];
+
+   for( int i=0; i<32; i++ )
+      uKey[i] = i;
+   _hex_to_bytes("000000000000004a00000000", uNonce);
+   const char* szPlain = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+   int iPlainLength = strlen(szPlain);
+   memcpy(uBuffer, szPlain, iPlainLength);
+   encr_chacha20_xor(uKey, uNonce, 1, uBuffer, iPlainLength);
+   _hex_to_bytes("6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d807ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab77937365af90bbf74a35be6b40b8eedf2785e42874d", uExpected);
+   if ( 0 != memcmp(uBuffer, uExpected, iPlainLength) )
+      iErrors++;
+
+   u8 uTag[16];
+   _hex_to_bytes("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b", uKey);
+   const char* szMessage = "Cryptographic Forum Research Group";
+   encr_poly1305(uKey, (const u8*)szMessage, strlen(szMessage), uTag);
+   _hex_to_bytes("a8061dc1305136c6c22b8baf0c0127a9", uExpected);
+   if ( 0 != memcmp(uTag, uExpected, 16) )
+      iErrors++;
+
+   u8 uAAD[12];
+   for( int i=0; i<32; i++ )
+      uKey[i] = 0x80 + i;
+   _hex_to_bytes("070000004041424344454647", uNonce);
+   _hex_to_bytes("50515253c0c1c2c3c4c5c6c7", uAAD);
+   memcpy(uBuffer, szPlain, iPlainLength);
+   encr_chacha20poly1305_seal(uKey, uNonce, uAAD, 12, uBuffer, iPlainLength, uTag);
+   _hex_to_bytes("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d63dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b3692ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc3ff4def08e4b7a9de576d26586cec64b6116", uExpected);
+   if ( 0 != memcmp(uBuffer, uExpected, iPlainLength) )
+      iErrors++;
+   _hex_to_bytes("1ae10b594f09e26a7e902ecbd0600691", uExpected);
+   if ( 0 != memcmp(uTag, uExpected, 16) )
+      iErrors++;
+   if ( ! encr_chacha20poly1305_open(uKey, uNonce, uAAD, 12, uBuffer, iPlainLength, uTag) )
+      iErrors++;
+   if ( 0 != memcmp(uBuffer, szPlain, iPlainLength) )
+      iErrors++;
+   uAAD[0] ^= 1;
+   if ( encr_chacha20poly1305_open(uKey, uNonce, uAAD, 12, uBuffer, iPlainLength, uTag) )
+      iErrors++;
+   return iErrors;
+}
+
+static void _build_packet(u8* pPacket, int iLength)
+{
+   t_packet_header PH;
+   radio_packet_init(&PH, PACKET_COMPONENT_TELEMETRY, PACKET_TYPE_RUBY_TELEMETRY_EXTENDED, STREAM_ID_DATA);
+   PH.vehicle_id_src = 1;
+   PH.vehicle_id_dest = 0;
+   PH.total_length = iLength;
+   PH.stream_packet_idx = rand();
+   for( int i=0; i<iLength; i++ )
+      pPacket[i] = rand() % 256;
+   memcpy(pPacket, (u8*)&PH, sizeof(t_packet_header));
+}
+
+// Full radio packets: build (CRC + encryption) and process (decryption + CRC) must give back the packet
+
+static int _check_radio_packets_round_trip(int iEncryption)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   int iErrors = 0;
+   for( int iLength=sizeof(t_packet_header); iLength<=MAX_PACKET_PAYLOAD; iLength += 7 )
+   {
+      _build_packet(packet, iLength);
+      int iHeaders = radio_build_new_raw_packet(0, rawPacket, packet, iLength, 0, 0, 0, NULL) - iLength;
+      int iTotal = radio_build_new_raw_packet(0, rawPacket, packet, iLength, 0, iEncryption, 0, NULL);
+      u8* pData = rawPacket + iHeaders;
+      int bCRCOk = 0;
+      int iProcessed = packet_process_and_check(0, pData, iTotal - iHeaders, &bCRCOk);
+      t_packet_header* pPH = (t_packet_header*)pData;
+      if ( (iProcessed != iTotal - iHeaders) || (! bCRCOk) || (pPH->total_length != iLength) )
+         iErrors++;
+      // Compare all but the CRC, flags and radio link packet index (set by the builder)
+      else if ( 0 != memcmp(pData + 5, packet + 5, 9) )
+         iErrors++;
+      else if ( 0 != memcmp(pData + 16, packet + 16, iLength - 16) )
+         iErrors++;
+
+      // Altered payload with a valid CRC: must fail the authentication
+      if ( iEncryption != RADIO_PACKET_ENCRYPTION_AEAD )
+         continue;
+      iTotal = radio_build_new_raw_packet(0, rawPacket, packet, iLength, 0, iEncryption, 0, NULL);
+      pData[sizeof(t_packet_header) + (rand() % (iLength - sizeof(t_packet_header) + 1))] ^= 0x10;
+      radio_packet_compute_crc(pData, pPH->total_length);
+      if ( 0 != packet_process_and_check(0, pData, iTotal - iHeaders, &bCRCOk) )
+         iErrors++;
+      else if ( get_last_processing_error_code() != RADIO_PROCESSING_ERROR_CODE_AUTHENTICATION_FAILED )
+         iErrors++;
+   }
+   return iErrors;
+}
+
+#define BENCH_XOR 0
+#define BENCH_CHACHA20_PORTABLE 1
+#define BENCH_CHACHA20_SIMD 2
+#define BENCH_AEAD 3
+#define BENCH_RADIO_PACKET_XOR 4
+#define BENCH_RADIO_PACKET_AEAD 5
+#define BENCH_COUNT 6
+
+static const char* s_szBenchNames[BENCH_COUNT] = { "xor", "chacha20-portable", "chacha20-simd", "chacha20poly1305", "radio-packet-xor", "radio-packet-aead" };
+
+static void _run_test(int iBench, int iLength, FILE* fdOut)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   u8 uKey[32];
+   u8 uNonce[12];
+   u8 uTrailer[ENCR_AEAD_OVERHEAD];
+   for( int i=0; i<32; i++ )
+      uKey[i] = rand() % 256;
+   memset(uNonce, 0, sizeof(uNonce));
+   _build_packet(packet, iLength);
+
+   encr_chacha20_select_implementation((iBench == BENCH_CHACHA20_PORTABLE)?ENCR_CHACHA20_IMPL_PORTABLE:ENCR_CHACHA20_IMPL_AUTO);
+   int iHeaders = radio_build_new_raw_packet(0, rawPacket, packet, iLength, 0, 0, 0, NULL) - iLength;
+
+   u64 uTimeStart = _now_ns();
+   for( int i=0; i<g_iPacketsPerTest; i++ )
+   {
+      switch ( iBench )
+      {
+         case BENCH_XOR:
+            epp(packet, iLength);
+            dpp(packet, iLength);
+            break;
+         case BENCH_CHACHA20_PORTABLE:
+         case BENCH_CHACHA20_SIMD:
+            uNonce[0] = i;
+            encr_chacha20_xor(uKey, uNonce, 1, packet, iLength);
+            encr_chacha20_xor(uKey, uNonce, 1, packet, iLength);
+            break;
+         case BENCH_AEAD:
+            eppa(packet, 12, packet + 16, iLength - 16, i, uTrailer);
+            g_uSink += dppa(packet, 12, packet + 16, iLength - 16, i, uTrailer);
+            break;
+         case BENCH_RADIO_PACKET_XOR:
+         case BENCH_RADIO_PACKET_AEAD:
+         {
+            int iTotal = radio_build_new_raw_packet(0, rawPacket, packet, iLength, 0, (iBench == BENCH_RADIO_PACKET_AEAD)?RADIO_PACKET_ENCRYPTION_AEAD:RADIO_PACKET_ENCRYPTION_XOR, 0, NULL);
+            g_uSink += packet_process_and_check(0, rawPacket + iHeaders, iTotal - iHeaders, NULL);
+            break;
+         }
+      }
+      g_uSink += packet[iLength-1];
+   }
+   u64 uTime = _now_ns() - uTimeStart;
+
+   // Each iteration is an encrypt + a decrypt
+   double fNsPerPacket = (double)uTime / (double)g_iPacketsPerTest / 2.0;
+   double fMBps = (double)iLength * 1000000000.0 / fNsPerPacket / (1024.0*1024.0);
+   fprintf(fdOut, "%s,%d,%.1f,%.1f\n", s_szBenchNames[iBench], iLength, fMBps, fNsPerPacket);
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iPacketsPerTest = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-n packets] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iPacketsPerTest < 100 )
+      g_iPacketsPerTest = 100;
+
+   log_init_local_only("TestCryptoBench");
+   log_disable_stdout();
+   srand(1);
+   radio_init_link_structures();
+   char szPass[] = "bench pass phrase for radio links";
+   upp(szPass);
+
+   int iFailed = 0;
+   for( int k=ENCR_CHACHA20_IMPL_PORTABLE; k<ENCR_CHACHA20_IMPL_COUNT; k++ )
+   {
+      if ( ! encr_chacha20_is_implementation_supported(k) )
+         continue;
+      encr_chacha20_select_implementation(k);
+      int iErrors = _check_test_vectors() + _check_radio_packets_round_trip(RADIO_PACKET_ENCRYPTION_AEAD);
+      if ( iErrors )
+      {
+         printf("ChaCha20 implementation %s: %d errors!\n", encr_chacha20_get_implementation_name(k), iErrors);
+         iFailed++;
+      }
+   }
+   if ( _check_radio_packets_round_trip(RADIO_PACKET_ENCRYPTION_XOR) )
+   {
+      printf("XOR encrypted radio packets do not round trip!\n");
+      iFailed++;
+   }
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   encr_chacha20_select_implementation(ENCR_CHACHA20_IMPL_AUTO);
+   fprintf(fdOut, "# Radio packets encryption benchmark, %d packets per test, ChaCha20 implementation: %s\n", g_iPacketsPerTest, encr_chacha20_get_implementation_name(encr_chacha20_get_implementation()));
+   fprintf(fdOut, "test,size,mbps,ns_per_packet\n");
+
+   int iSizes[] = { 64, 256, 1024, MAX_PACKET_PAYLOAD };
+   for( int s=0; s<(int)(sizeof(iSizes)/sizeof(iSizes[0])); s++ )
+   for( int b=0; b<BENCH_COUNT; b++ )
+   {
+      if ( (b == BENCH_CHACHA20_SIMD) && (! encr_chacha20_is_implementation_supported(ENCR_CHACHA20_IMPL_SIMD)) )
+         continue;
+      _run_test(b, iSizes[s], fdOut);
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+   return iFailed ? 1 : 0;
+}
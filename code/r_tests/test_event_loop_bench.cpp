@@ -0,0 +1,438 @@
+/*
+   Router main loop benchmark.
+   Receives radio packets sent through a virtual radio interface, using the radio rx thread,
+   and consumes them from the rx queue with the controller and vehicle router main loop models:
+      station_polling: the old controller loop (consume the rx queue, sleep 1 ms when there
+               is nothing, IPC checks every 5th iteration, periodic work every 10th iteration);
+      station_event: the controller event loop (wakes up on the rx queue eventfd, IPC and periodic timers);
+      vehicle_polling: the old vehicle loop (consume the rx queue, then read the video UDP
+               socket with a 1 ms poll timeout);
+      vehicle_event: the vehicle event loop (rx queue eventfd, video socket, IPC and periodic timers).
+   The vehicle models also get video UDP datagrams, as from majestic.
+   For each model it reports, idle (no packets) and under load (a packets rate):
+   the rx queue to dispatch latency and the video datagram sent to read latency (percentiles),
+   main loop wakeups per second and the CPU time used by the main loop thread.
+
+   Usage: test_event_loop_bench [-t seconds] [-r packets/sec] [-v video packets/sec] [-p base port] [-o out.csv]
+*/
+
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../base/hardware_radio.h"
+#include "../base/hardware_radio_virtual.h"
+#include "../base/event_loop.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+#include "../radio/radio_rx.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+
+int g_iTestSeconds = 4;
+int g_iPacketsPerSecond = 2000;
+int g_iBasePort = 7500;
+int g_iPayloadLength = 1024;
+int g_iVideoPacketsPerSecond = 1500;
+
+volatile int g_iSenderRate = 0;
+volatile int g_iSenderVideoRate = 0;
+volatile int g_iSenderQuit = 0;
+
+int g_iVideoSocketRead = -1;
+int g_iVideoSocketWrite = -1;
+struct sockaddr_in g_VideoAddress;
+
+type_received_radio_packet g_ReceivedPackets[20];
+type_latency_histogram g_Latency;
+type_latency_histogram g_VideoLatency;
+type_event_loop g_StationEventLoop;
+type_event_loop g_VehicleEventLoop;
+type_event_loop* g_pEventLoop = NULL;
+u32 g_uConsumedPackets = 0;
+u32 g_uLoopIterations = 0;
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static u64 _thread_cpu_micros()
+{
+   struct rusage usage;
+   getrusage(RUSAGE_THREAD, &usage);
+   return (u64)usage.ru_utime.tv_sec * 1000000LL + (u64)usage.ru_utime.tv_usec +
+          (u64)usage.ru_stime.tv_sec * 1000000LL + (u64)usage.ru_stime.tv_usec;
+}
+
+static void* _thread_video_sender(void* pParam)
+{
+   u8 packet[1400];
+   u64 uTimeStart = _now_micros();
+   int iCurrentRate = 0;
+   u32 uSentAtRate = 0;
+   memset(packet, 0, sizeof(packet));
+
+   while ( ! g_iSenderQuit )
+   {
+      if ( g_iSenderVideoRate != iCurrentRate )
+      {
+         iCurrentRate = g_iSenderVideoRate;
+         uTimeStart = _now_micros();
+         uSentAtRate = 0;
+      }
+      if ( 0 == iCurrentRate )
+      {
+         hardware_sleep_ms(5);
+         continue;
+      }
+      u64 uSendTime = uTimeStart + (u64)uSentAtRate * 1000000LL / (u64)iCurrentRate;
+      u64 uNow = _now_micros();
+      if ( uNow < uSendTime )
+      {
+         hardware_sleep_micros((u32)(uSendTime - uNow));
+         continue;
+      }
+      memcpy(packet, &uNow, sizeof(u64));
+      sendto(g_iVideoSocketWrite, packet, sizeof(packet), 0, (struct sockaddr*)&g_VideoAddress, sizeof(g_VideoAddress));
+      uSentAtRate++;
+   }
+   return NULL;
+}
+
+static bool _open_video_sockets()
+{
+   g_iVideoSocketRead = socket(AF_INET, SOCK_DGRAM, 0);
+   g_iVideoSocketWrite = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( (g_iVideoSocketRead < 0) || (g_iVideoSocketWrite < 0) )
+      return false;
+   memset(&g_VideoAddress, 0, sizeof(g_VideoAddress));
+   g_VideoAddress.sin_family = AF_INET;
+   g_VideoAddress.sin_addr.s_addr = inet_addr("127.0.0.1");
+   g_VideoAddress.sin_port = htons(g_iBasePort + 100);
+   if ( bind(g_iVideoSocketRead, (struct sockaddr*)&g_VideoAddress, sizeof(g_VideoAddress)) < 0 )
+      return false;
+   fcntl(g_iVideoSocketRead, F_SETFL, fcntl(g_iVideoSocketRead, F_GETFL, 0) | O_NONBLOCK);
+   return true;
+}
+
+// Same as the vehicle video source read: poll the socket (iTimeoutMs), then read one datagram
+
+static int _read_video(int iTimeoutMs)
+{
+   struct pollfd fds;
+   fds.fd = g_iVideoSocketRead;
+   fds.events = POLLIN;
+   fds.revents = 0;
+   if ( poll(&fds, 1, iTimeoutMs) <= 0 )
+      return 0;
+   u8 buffer[2048];
+   int iRead = recv(g_iVideoSocketRead, buffer, sizeof(buffer), 0);
+   if ( iRead < (int)sizeof(u64) )
+      return 0;
+   u64 uTimeSent = 0;
+   memcpy(&uTimeSent, buffer, sizeof(u64));
+   latency_histogram_add(&g_VideoLatency, (u32)(_now_micros() - uTimeSent));
+   return iRead;
+}
+
+static void* _thread_sender(void* pParam)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   u32 uIndex = 0;
+   u64 uTimeStart = _now_micros();
+   int iCurrentRate = 0;
+   u32 uSentAtRate = 0;
+
+   while ( ! g_iSenderQuit )
+   {
+      if ( g_iSenderRate != iCurrentRate )
+      {
+         iCurrentRate = g_iSenderRate;
+         uTimeStart = _now_micros();
+         uSentAtRate = 0;
+      }
+      if ( 0 == iCurrentRate )
+      {
+         hardware_sleep_ms(5);
+         continue;
+      }
+      u64 uSendTime = uTimeStart + (u64)uSentAtRate * 1000000LL / (u64)iCurrentRate;
+      u64 uNow = _now_micros();
+      if ( uNow < uSendTime )
+      {
+         hardware_sleep_micros((u32)(uSendTime - uNow));
+         continue;
+      }
+      t_packet_header PH;
+      radio_packet_init(&PH, PACKET_COMPONENT_VIDEO, PACKET_TYPE_VIDEO_DATA_FULL, STREAM_ID_VIDEO_1);
+      PH.vehicle_id_src = 1;
+      PH.vehicle_id_dest = 0;
+      PH.stream_packet_idx = uIndex;
+      PH.total_length = g_iPayloadLength;
+      memcpy(packet, (u8*)&PH, sizeof(t_packet_header));
+      memset(packet + sizeof(t_packet_header), 0, sizeof(t_packet_header_video_full_77));
+      for( int i=sizeof(t_packet_header)+sizeof(t_packet_header_video_full_77); i<g_iPayloadLength; i++ )
+         packet[i] = (u8)(uIndex + i);
+      int iLength = radio_build_new_raw_packet(0, rawPacket, packet, g_iPayloadLength, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+      radio_write_raw_packet(0, rawPacket, iLength);
+      uIndex++;
+      uSentAtRate++;
+   }
+   return NULL;
+}
+
+static int _consume_packets()
+{
+   int iCount = radio_rx_get_received_packets(20, g_ReceivedPackets);
+   u32 uTimeNow = get_current_timestamp_micros();
+   for( int i=0; i<iCount; i++ )
+   {
+      u32 uLatency = uTimeNow - g_ReceivedPackets[i].uTimeReceivedMicros;
+      latency_histogram_add(&g_Latency, uLatency);
+      if ( NULL != g_pEventLoop )
+         event_loop_add_latency_sample(g_pEventLoop, uLatency);
+   }
+   if ( iCount > 0 )
+      radio_rx_release_received_packets();
+   g_uConsumedPackets += iCount;
+   return iCount;
+}
+
+static int _consume_radio_rx()
+{
+   int iRxPackets = 0;
+   for( int i=0; i<4; i++ )
+   {
+      int k = _consume_packets();
+      if ( k <= 0 )
+         break;
+      iRxPackets += k;
+   }
+   return iRxPackets;
+}
+
+static void _run_station_polling(u64 uTimeEnd)
+{
+   u32 uCounter = 0;
+   while ( _now_micros() < uTimeEnd )
+   {
+      uCounter++;
+      g_uLoopIterations++;
+      if ( (uCounter % 10) == 0 )
+         get_current_timestamp_ms();
+      if ( (uCounter % 5) == 0 )
+         get_current_timestamp_ms();
+      if ( 0 == _consume_radio_rx() )
+         hardware_sleep_ms(1);
+   }
+}
+
+static void _run_vehicle_polling(u64 uTimeEnd)
+{
+   while ( _now_micros() < uTimeEnd )
+   {
+      g_uLoopIterations++;
+      _consume_packets();
+      _read_video(1);
+   }
+}
+
+static void _on_radio_rx(void* pContext)
+{
+   event_loop_drain_fd(radio_rx_get_event_fd());
+   _consume_radio_rx();
+}
+
+static void _on_video(void* pContext)
+{
+   _read_video(0);
+}
+
+static void _on_timer(void* pContext)
+{
+   get_current_timestamp_ms();
+}
+
+static void _run_event_loop(u64 uTimeEnd)
+{
+   while ( _now_micros() < uTimeEnd )
+   {
+      g_uLoopIterations++;
+      if ( radio_rx_arm_event_fd() )
+      {
+         _consume_radio_rx();
+         event_loop_run_once(g_pEventLoop, 0);
+      }
+      else
+         event_loop_run_once(g_pEventLoop, 100);
+   }
+}
+
+static void _run_test(const char* szLoop, int iRate, int iVideoRate, FILE* fdOut)
+{
+   bool bVehicle = (NULL != strstr(szLoop, "vehicle"));
+   bool bEventLoop = (NULL != strstr(szLoop, "event"));
+   g_pEventLoop = NULL;
+   if ( bEventLoop )
+      g_pEventLoop = bVehicle?&g_VehicleEventLoop:&g_StationEventLoop;
+   if ( NULL != g_pEventLoop )
+      event_loop_reset_stats(g_pEventLoop);
+   g_uLoopIterations = 0;
+   g_iSenderRate = iRate;
+   g_iSenderVideoRate = bVehicle?iVideoRate:0;
+   hardware_sleep_ms(100);
+   // Drop what was queued before the test
+   while ( _consume_radio_rx() > 0 ) {}
+   while ( _read_video(0) > 0 ) {}
+   latency_histogram_reset(&g_Latency);
+   latency_histogram_reset(&g_VideoLatency);
+   g_uConsumedPackets = 0;
+
+   u64 uTimeStart = _now_micros();
+   u64 uTimeEnd = uTimeStart + (u64)g_iTestSeconds * 1000000LL;
+   u64 uCPUStart = _thread_cpu_micros();
+   if ( bEventLoop )
+      _run_event_loop(uTimeEnd);
+   else if ( bVehicle )
+      _run_vehicle_polling(uTimeEnd);
+   else
+      _run_station_polling(uTimeEnd);
+   u64 uCPU = _thread_cpu_micros() - uCPUStart;
+   u64 uDuration = _now_micros() - uTimeStart;
+
+   fprintf(fdOut, "%s,%d,%d,%u,%u,%u,%u,%u,%u,%.1f,%.2f\n", szLoop, iRate, bVehicle?iVideoRate:0, g_uConsumedPackets,
+      latency_histogram_get_percentile(&g_Latency, 50), latency_histogram_get_percentile(&g_Latency, 99),
+      g_VideoLatency.uCount, latency_histogram_get_percentile(&g_VideoLatency, 50), latency_histogram_get_percentile(&g_VideoLatency, 99),
+      (double)g_uLoopIterations * 1000000.0 / (double)uDuration,
+      (double)uCPU * 100.0 / (double)uDuration);
+   fflush(fdOut);
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iTestSeconds = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-r") && i < argc-1 )
+         g_iPacketsPerSecond = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-v") && i < argc-1 )
+         g_iVideoPacketsPerSecond = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-p") && i < argc-1 )
+         g_iBasePort = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-t seconds] [-r packets/sec] [-v video packets/sec] [-p base port] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iTestSeconds < 1 )
+      g_iTestSeconds = 1;
+   if ( g_iPacketsPerSecond < 10 )
+      g_iPacketsPerSecond = 10;
+
+   log_init_local_only("TestEventLoopBench");
+
+   type_radio_virtual_config config;
+   hardware_radio_virtual_get_default_config(&config);
+   config.iCount = 1;
+   config.iBasePort = g_iBasePort;
+   config.iSide = VIRTUAL_RADIO_SIDE_VEHICLE;
+   hardware_radio_virtual_set_config(&config);
+   hardware_reset_radio_enumerated_flag();
+   hardware_enumerate_radio_interfaces();
+   radio_init_link_structures();
+   if ( radio_open_interface_for_write(0) < 0 )
+   {
+      printf("Failed to open the virtual radio interface for write.\n");
+      return 1;
+   }
+   config.iSide = VIRTUAL_RADIO_SIDE_STATION;
+   hardware_radio_virtual_set_config(&config);
+   if ( radio_open_interface_for_read(0, RADIO_PORT_ROUTER_DOWNLINK) < 0 )
+   {
+      printf("Failed to open the virtual radio interface for read.\n");
+      return 1;
+   }
+   if ( ! radio_rx_start_rx_thread(NULL, NULL, 0, MODEL_FIRMWARE_TYPE_RUBY) )
+   {
+      printf("Failed to start the radio rx thread.\n");
+      return 1;
+   }
+
+   if ( ! _open_video_sockets() )
+   {
+      printf("Failed to open the video UDP sockets.\n");
+      return 1;
+   }
+
+   if ( ! event_loop_init(&g_StationEventLoop) )
+      return 1;
+   event_loop_add_fd(&g_StationEventLoop, "radio_rx", radio_rx_get_event_fd(), EVENT_LOOP_PRIORITY_HIGHEST, EVENT_LOOP_FLAG_CUSTOM_LATENCY, _on_radio_rx, NULL);
+   event_loop_add_timer(&g_StationEventLoop, "ipc", 10000, EVENT_LOOP_PRIORITY_HIGH, _on_timer, NULL);
+   event_loop_add_timer(&g_StationEventLoop, "periodic", 10000, EVENT_LOOP_PRIORITY_NORMAL, _on_timer, NULL);
+
+   if ( ! event_loop_init(&g_VehicleEventLoop) )
+      return 1;
+   event_loop_add_fd(&g_VehicleEventLoop, "radio_rx", radio_rx_get_event_fd(), EVENT_LOOP_PRIORITY_HIGHEST, EVENT_LOOP_FLAG_CUSTOM_LATENCY, _on_radio_rx, NULL);
+   event_loop_add_fd(&g_VehicleEventLoop, "video", g_iVideoSocketRead, EVENT_LOOP_PRIORITY_HIGH, 0, _on_video, NULL);
+   event_loop_add_timer(&g_VehicleEventLoop, "ipc", 10000, EVENT_LOOP_PRIORITY_NORMAL, _on_timer, NULL);
+   event_loop_add_timer(&g_VehicleEventLoop, "periodic", 20000, EVENT_LOOP_PRIORITY_LOW, _on_timer, NULL);
+
+   pthread_t threadSender;
+   pthread_t threadVideoSender;
+   if ( 0 != pthread_create(&threadSender, NULL, &_thread_sender, NULL) )
+      return 1;
+   if ( 0 != pthread_create(&threadVideoSender, NULL, &_thread_video_sender, NULL) )
+      return 1;
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   fprintf(fdOut, "# Router main loop benchmark, %d seconds per test\n", g_iTestSeconds);
+   fprintf(fdOut, "loop,packets_per_sec,video_packets_per_sec,consumed,rx_to_dispatch_p50_us_below,rx_to_dispatch_p99_us_below,video_read,video_to_read_p50_us_below,video_to_read_p99_us_below,wakeups_per_sec,main_loop_cpu_percent\n");
+
+   static const char* s_szLoops[] = { "station_polling", "station_event", "vehicle_polling", "vehicle_event" };
+   for( int i=0; i<4; i++ )
+      _run_test(s_szLoops[i], 0, 0, fdOut);
+   for( int i=0; i<4; i++ )
+      _run_test(s_szLoops[i], g_iPacketsPerSecond, g_iVideoPacketsPerSecond, fdOut);
+
+   g_iSenderQuit = 1;
+   pthread_join(threadSender, NULL);
+   pthread_join(threadVideoSender, NULL);
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+
+   event_loop_uninit(&g_StationEventLoop);
+   event_loop_uninit(&g_VehicleEventLoop);
+   close(g_iVideoSocketRead);
+   close(g_iVideoSocketWrite);
+   radio_rx_stop_rx_thread();
+   radio_close_interface_for_read(0);
+   radio_close_interface_for_write(0);
+   return 0;
+}
@@ -90,6 +90,48 @@ int main(int argc, char *argv[])
    printf("\nDecoded data:\n");
    print_all();
 
+   // Check that every FEC kernel supported by this CPU gives the same output as the scalar one
+
+   printf("\nChecking FEC kernels (auto selected: %s):\n", fec_get_kernel_name(fec_get_kernel()));
+
+   int iTestLength = 1400+7;
+   u8* pTestData[MAX_PACKETS];
+   u8* pTestFECRef[MAX_PACKETS];
+   u8* pTestFEC[MAX_PACKETS];
+   for( int i=0; i<16; i++ )
+   {
+      pTestData[i] = (u8*)malloc(iTestLength);
+      pTestFECRef[i] = (u8*)malloc(iTestLength);
+      pTestFEC[i] = (u8*)malloc(iTestLength);
+      for( int j=0; j<iTestLength; j++ )
+         pTestData[i][j] = (u8)(rand() & 0xFF);
+   }
+
+   int iAutoKernel = fec_get_kernel();
+   fec_select_kernel(FEC_KERNEL_SCALAR);
+   fec_encode(iTestLength, pTestData, 16, pTestFECRef, 8);
+
+   int iFailed = 0;
+   for( int k=FEC_KERNEL_SCALAR; k<FEC_KERNEL_COUNT; k++ )
+   {
+      if ( ! fec_select_kernel(k) )
+      {
+         printf("  %s: not supported on this CPU\n", fec_get_kernel_name(k));
+         continue;
+      }
+      fec_encode(iTestLength, pTestData, 16, pTestFEC, 8);
+      bool bOk = true;
+      for( int i=0; i<8; i++ )
+         if ( 0 != memcmp(pTestFEC[i], pTestFECRef[i], iTestLength) )
+            bOk = false;
+      printf("  %s: %s\n", fec_get_kernel_name(k), bOk?"ok":"MISMATCH");
+      if ( ! bOk )
+         iFailed++;
+   }
+   fec_select_kernel(iAutoKernel);
+
+   if ( iFailed )
+      return 1;
 
    return (0);
 } 
@@ -0,0 +1,372 @@
+/*
+   FEC encode/decode benchmark.
+   Sweeps data/EC packets counts (up to MAX_TOTAL_PACKETS_IN_BLOCK), payload sizes
+   (up to MAX_PACKET_PAYLOAD) and erasure patterns, and reports throughput,
+   per block latency percentiles and CPU cycles per byte.
+
+   Usage: test_fec_bench [-k kernel|all] [-n blocks] [-o out.csv] [-c baseline.csv] [-quick]
+
+   The CSV output has one line per configuration, in a fixed order, so results
+   from two commits can be compared directly (-c prints the MB/s change against
+   a previous CSV output).
+*/
+
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/fec.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#define BENCH_PATTERN_NONE 0
+#define BENCH_PATTERN_FIRST 1
+#define BENCH_PATTERN_LAST 2
+#define BENCH_PATTERN_SPREAD 3
+#define BENCH_PATTERN_COUNT 4
+
+static const char* s_szPatternNames[BENCH_PATTERN_COUNT] = { "none", "first", "last", "spread" };
+
+int g_iBlocksPerTest = 400;
+int g_iWarmupBlocks = 20;
+bool g_bQuick = false;
+int g_fdPerfCycles = -1;
+
+u8* g_pDataBlocks[MAX_TOTAL_PACKETS_IN_BLOCK];
+u8* g_pDataBlocksRef[MAX_TOTAL_PACKETS_IN_BLOCK];
+u8* g_pFECBlocks[MAX_TOTAL_PACKETS_IN_BLOCK];
+u8* g_pFECBlocksDecode[MAX_TOTAL_PACKETS_IN_BLOCK];
+
+typedef struct
+{
+   double fMBps;
+   double fP50us;
+   double fP99us;
+   double fCyclesPerByte;
+} type_bench_result;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static void _open_cycles_counter()
+{
+   struct perf_event_attr pe;
+   memset(&pe, 0, sizeof(pe));
+   pe.type = PERF_TYPE_HARDWARE;
+   pe.size = sizeof(pe);
+   pe.config = PERF_COUNT_HW_CPU_CYCLES;
+   pe.disabled = 0;
+   pe.exclude_kernel = 1;
+   pe.exclude_hv = 1;
+   g_fdPerfCycles = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+// Returns 0 if no cycles counter is available on this system
+
+static u64 _read_cycles()
+{
+   if ( g_fdPerfCycles >= 0 )
+   {
+      u64 uValue = 0;
+      if ( sizeof(uValue) == read(g_fdPerfCycles, &uValue, sizeof(uValue)) )
+         return uValue;
+   }
+   #if defined(__x86_64__) || defined(__i386__)
+   u32 uLow, uHigh;
+   __asm__ __volatile__ ("rdtsc" : "=a" (uLow), "=d" (uHigh));
+   return ((u64)uHigh << 32) | uLow;
+   #else
+   return 0;
+   #endif
+}
+
+static void _compute_result(std::vector<u64>& samples, u64 uTotalNs, u64 uTotalCycles, u64 uTotalBytes, type_bench_result* pResult)
+{
+   std::sort(samples.begin(), samples.end());
+   pResult->fP50us = samples[samples.size()/2] / 1000.0;
+   pResult->fP99us = samples[(samples.size()*99)/100] / 1000.0;
+   pResult->fMBps = 0.0;
+   if ( uTotalNs > 0 )
+      pResult->fMBps = ((double)uTotalBytes / (1024.0*1024.0)) / ((double)uTotalNs / 1000000000.0);
+   pResult->fCyclesPerByte = -1.0;
+   if ( uTotalCycles > 0 && uTotalBytes > 0 )
+      pResult->fCyclesPerByte = (double)uTotalCycles / (double)uTotalBytes;
+}
+
+static void _fill_random(int iPayload, int iData)
+{
+   for( int i=0; i<iData; i++ )
+   for( int j=0; j<iPayload; j++ )
+      g_pDataBlocksRef[i][j] = (u8)(rand() & 0xFF);
+}
+
+static void _bench_encode(int iPayload, int iData, int iEC, type_bench_result* pResult)
+{
+   std::vector<u64> samples;
+   u64 uTotalNs = 0;
+   u64 uTotalCycles = 0;
+
+   for( int i=0; i<g_iWarmupBlocks + g_iBlocksPerTest; i++ )
+   {
+      u64 uCycles = _read_cycles();
+      u64 uStart = _now_ns();
+      fec_encode(iPayload, g_pDataBlocksRef, iData, g_pFECBlocks, iEC);
+      u64 uDelta = _now_ns() - uStart;
+      uCycles = _read_cycles() - uCycles;
+      if ( i < g_iWarmupBlocks )
+         continue;
+      samples.push_back(uDelta);
+      uTotalNs += uDelta;
+      uTotalCycles += uCycles;
+   }
+   _compute_result(samples, uTotalNs, uTotalCycles, (u64)iPayload * iData * g_iBlocksPerTest, pResult);
+}
+
+// Returns the number of erasures that were tested, or 0 if decode is not possible for this pattern
+
+static int _bench_decode(int iPayload, int iData, int iEC, int iPattern, type_bench_result* pResult, bool* pbCorrect)
+{
+   unsigned int uErased[MAX_TOTAL_PACKETS_IN_BLOCK];
+   unsigned int uFECNos[MAX_TOTAL_PACKETS_IN_BLOCK];
+   int iErasures = (iEC < iData)?iEC:iData;
+
+   for( int i=0; i<iErasures; i++ )
+   {
+      if ( iPattern == BENCH_PATTERN_FIRST )
+         uErased[i] = i;
+      else if ( iPattern == BENCH_PATTERN_LAST )
+         uErased[i] = iData - iErasures + i;
+      else
+         uErased[i] = (i*iData)/iErasures;
+      // Use the last EC packets, so the first ones are the ones "lost" too
+      uFECNos[i] = iEC - iErasures + i;
+   }
+
+   fec_encode(iPayload, g_pDataBlocksRef, iData, g_pFECBlocks, iEC);
+
+   std::vector<u64> samples;
+   u64 uTotalNs = 0;
+   u64 uTotalCycles = 0;
+   *pbCorrect = true;
+
+   for( int i=0; i<g_iWarmupBlocks + g_iBlocksPerTest; i++ )
+   {
+      for( int k=0; k<iData; k++ )
+         memcpy(g_pDataBlocks[k], g_pDataBlocksRef[k], iPayload);
+      for( int k=0; k<iErasures; k++ )
+      {
+         memset(g_pDataBlocks[uErased[k]], 0, iPayload);
+         memcpy(g_pFECBlocksDecode[k], g_pFECBlocks[uFECNos[k]], iPayload);
+      }
+
+      u64 uCycles = _read_cycles();
+      u64 uStart = _now_ns();
+      fec_decode(iPayload, g_pDataBlocks, iData, g_pFECBlocksDecode, uFECNos, uErased, iErasures);
+      u64 uDelta = _now_ns() - uStart;
+      uCycles = _read_cycles() - uCycles;
+
+      if ( i == 0 )
+      for( int k=0; k<iData; k++ )
+         if ( 0 != memcmp(g_pDataBlocks[k], g_pDataBlocksRef[k], iPayload) )
+            *pbCorrect = false;
+
+      if ( i < g_iWarmupBlocks )
+         continue;
+      samples.push_back(uDelta);
+      uTotalNs += uDelta;
+      uTotalCycles += uCycles;
+   }
+   _compute_result(samples, uTotalNs, uTotalCycles, (u64)iPayload * iData * g_iBlocksPerTest, pResult);
+   return iErasures;
+}
+
+static std::map<std::string, double> _load_baseline(const char* szFile)
+{
+   std::map<std::string, double> mapBaseline;
+   FILE* fd = fopen(szFile, "r");
+   if ( NULL == fd )
+   {
+      printf("Can't open baseline file %s\n", szFile);
+      return mapBaseline;
+   }
+   char szLine[512];
+   while ( NULL != fgets(szLine, sizeof(szLine), fd) )
+   {
+      if ( szLine[0] == '#' || 0 == strncmp(szLine, "kernel,", 7) )
+         continue;
+      // Key is everything up to the 7th comma (configuration), value is the MB/s column
+      int iCommas = 0;
+      char* p = szLine;
+      while ( *p && iCommas < 7 )
+      {
+         if ( *p == ',' )
+            iCommas++;
+         p++;
+      }
+      if ( iCommas < 7 )
+         continue;
+      std::string strKey(szLine, p - szLine);
+      mapBaseline[strKey] = atof(p);
+   }
+   fclose(fd);
+   return mapBaseline;
+}
+
+static int _run_kernel(int iKernel, FILE* fdOut, std::map<std::string, double>& mapBaseline)
+{
+   static const int s_iPayloads[] = { 64, 256, 512, 1024, MAX_PACKET_PAYLOAD };
+   static const int s_iCounts[] = { 1, 2, 4, 6, 8, 12, 16, 24, 32 };
+   int iFailed = 0;
+
+   if ( ! fec_select_kernel(iKernel) )
+   {
+      printf("Kernel %s is not supported on this CPU, skipping.\n", fec_get_kernel_name(iKernel));
+      return 0;
+   }
+
+   for( unsigned int p=0; p<sizeof(s_iPayloads)/sizeof(s_iPayloads[0]); p++ )
+   for( unsigned int d=0; d<sizeof(s_iCounts)/sizeof(s_iCounts[0]); d++ )
+   for( unsigned int e=0; e<sizeof(s_iCounts)/sizeof(s_iCounts[0]); e++ )
+   {
+      int iPayload = s_iPayloads[p];
+      int iData = s_iCounts[d];
+      int iEC = s_iCounts[e];
+      if ( iData > MAX_DATA_PACKETS_IN_BLOCK || iEC > MAX_FECS_PACKETS_IN_BLOCK )
+         continue;
+      if ( iData + iEC > MAX_TOTAL_PACKETS_IN_BLOCK )
+         continue;
+      if ( g_bQuick && (iEC > iData || (iPayload != 256 && iPayload != MAX_PACKET_PAYLOAD)) )
+         continue;
+
+      _fill_random(iPayload, iData);
+
+      for( int iPattern=0; iPattern<BENCH_PATTERN_COUNT; iPattern++ )
+      {
+         type_bench_result result;
+         bool bCorrect = true;
+         int iErasures = 0;
+         if ( iPattern == BENCH_PATTERN_NONE )
+            _bench_encode(iPayload, iData, iEC, &result);
+         else
+            iErasures = _bench_decode(iPayload, iData, iEC, iPattern, &result, &bCorrect);
+
+         char szKey[128];
+         snprintf(szKey, sizeof(szKey), "%s,%s,%d,%d,%d,%s,%d,", fec_get_kernel_name(iKernel),
+            (iPattern == BENCH_PATTERN_NONE)?"encode":"decode", iData, iEC, iPayload, s_szPatternNames[iPattern], iErasures);
+
+         fprintf(fdOut, "%s%.2f,%.3f,%.3f,%.2f,%s\n", szKey, result.fMBps, result.fP50us, result.fP99us, result.fCyclesPerByte, bCorrect?"ok":"fail");
+         if ( ! bCorrect )
+            iFailed++;
+
+         if ( mapBaseline.find(szKey) != mapBaseline.end() )
+         {
+            double fOld = mapBaseline[szKey];
+            if ( fOld > 0.0 )
+               printf("%s %.2f MB/s -> %.2f MB/s (%+.1f%%)\n", szKey, fOld, result.fMBps, 100.0*(result.fMBps-fOld)/fOld);
+         }
+      }
+   }
+   return iFailed;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+   const char* szBaselineFile = NULL;
+   int iKernel = FEC_KERNEL_AUTO;
+   bool bAllKernels = false;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-quick") )
+         g_bQuick = true;
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iBlocksPerTest = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-c") && i < argc-1 )
+         szBaselineFile = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-k") && i < argc-1 )
+      {
+         i++;
+         if ( 0 == strcmp(argv[i], "all") )
+            bAllKernels = true;
+         for( int k=0; k<FEC_KERNEL_COUNT; k++ )
+            if ( 0 == strcmp(argv[i], fec_get_kernel_name(k)) )
+               iKernel = k;
+      }
+      else
+      {
+         printf("Usage: %s [-k auto|scalar|word64|ssse3|avx2|neon|all] [-n blocks] [-o out.csv] [-c baseline.csv] [-quick]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iBlocksPerTest < 10 )
+      g_iBlocksPerTest = 10;
+
+   fec_init();
+   _open_cycles_counter();
+   srand(1);
+
+   for( int i=0; i<MAX_TOTAL_PACKETS_IN_BLOCK; i++ )
+   {
+      g_pDataBlocks[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+      g_pDataBlocksRef[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+      g_pFECBlocks[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+      g_pFECBlocksDecode[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+   }
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   std::map<std::string, double> mapBaseline;
+   if ( NULL != szBaselineFile )
+      mapBaseline = _load_baseline(szBaselineFile);
+
+   fprintf(fdOut, "# FEC benchmark: %d blocks per test, max packets in block: %d, cycles source: %s\n",
+      g_iBlocksPerTest, MAX_TOTAL_PACKETS_IN_BLOCK, (g_fdPerfCycles >= 0)?"perf":"tsc");
+   fprintf(fdOut, "kernel,op,data,ec,payload,pattern,erasures,mbps,p50_us,p99_us,cycles_per_byte,result\n");
+
+   int iFailed = 0;
+   if ( bAllKernels )
+   {
+      for( int k=FEC_KERNEL_SCALAR; k<FEC_KERNEL_COUNT; k++ )
+         iFailed += _run_kernel(k, fdOut, mapBaseline);
+   }
+   else
+   {
+      if ( iKernel == FEC_KERNEL_AUTO )
+         iKernel = fec_get_kernel();
+      iFailed += _run_kernel(iKernel, fdOut, mapBaseline);
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+   if ( g_fdPerfCycles >= 0 )
+      close(g_fdPerfCycles);
+
+   if ( iFailed )
+   {
+      printf("FEC benchmark: %d decode tests failed!\n", iFailed);
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,182 @@
+/*
+   Progressive FEC encoding benchmark.
+   Compares the two ways the vehicle video tx path can build the EC packets of a block:
+      block: fec_encode() of the whole block once its last data packet was read (old tx path);
+      progressive: fec_encode_add_block() for each data packet as it is read (current tx path).
+   For each configuration it checks that both give byte-identical EC packets and reports
+   the block end to EC packets ready latency (percentiles) and the total encode time per block.
+
+   Usage: test_fec_progressive_bench [-k kernel] [-n blocks] [-o out.csv]
+*/
+
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/fec.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+int g_iBlocksPerTest = 400;
+int g_iWarmupBlocks = 20;
+
+u8* g_pDataBlocks[MAX_TOTAL_PACKETS_IN_BLOCK];
+u8* g_pFECBlocks[MAX_TOTAL_PACKETS_IN_BLOCK];
+u8* g_pFECBlocksProgressive[MAX_TOTAL_PACKETS_IN_BLOCK];
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static double _percentile_us(std::vector<u64>& samples, int iPercent)
+{
+   if ( samples.empty() )
+      return 0.0;
+   std::sort(samples.begin(), samples.end());
+   size_t uIndex = (samples.size()-1) * iPercent / 100;
+   return (double)samples[uIndex] / 1000.0;
+}
+
+// Returns false if the progressive output differs from the whole block encode
+
+static bool _run_config(int iPayload, int iData, int iEC, FILE* fdOut)
+{
+   std::vector<u64> latencyBlock, latencyProgressive;
+   u64 uTotalBlockNs = 0;
+   u64 uTotalProgressiveNs = 0;
+   bool bCorrect = true;
+
+   for( int b=0; b<g_iWarmupBlocks + g_iBlocksPerTest; b++ )
+   {
+      for( int i=0; i<iData; i++ )
+      for( int j=0; j<iPayload; j++ )
+         g_pDataBlocks[i][j] = (u8)(rand() & 0xFF);
+
+      // Old path: all the encoding is done at block end
+
+      u64 uStart = _now_ns();
+      fec_encode(iPayload, g_pDataBlocks, iData, g_pFECBlocks, iEC);
+      u64 uBlockNs = _now_ns() - uStart;
+
+      // New path: each data packet is encoded as it is read; only the last one is left for block end
+
+      u64 uProgressiveNs = 0;
+      u64 uLastPacketNs = 0;
+      for( int i=0; i<iData; i++ )
+      {
+         uStart = _now_ns();
+         fec_encode_add_block(iPayload, g_pDataBlocks[i], i, g_pFECBlocksProgressive, iEC);
+         uLastPacketNs = _now_ns() - uStart;
+         uProgressiveNs += uLastPacketNs;
+      }
+
+      for( int i=0; i<iEC; i++ )
+         if ( 0 != memcmp(g_pFECBlocks[i], g_pFECBlocksProgressive[i], iPayload) )
+            bCorrect = false;
+
+      if ( b < g_iWarmupBlocks )
+         continue;
+      latencyBlock.push_back(uBlockNs);
+      latencyProgressive.push_back(uLastPacketNs);
+      uTotalBlockNs += uBlockNs;
+      uTotalProgressiveNs += uProgressiveNs;
+   }
+
+   double fBlockP50 = _percentile_us(latencyBlock, 50);
+   double fBlockP99 = _percentile_us(latencyBlock, 99);
+   double fProgP50 = _percentile_us(latencyProgressive, 50);
+   double fProgP99 = _percentile_us(latencyProgressive, 99);
+   fprintf(fdOut, "%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%s\n", iData, iEC, iPayload,
+      fBlockP50, fBlockP99, fProgP50, fProgP99,
+      (double)uTotalBlockNs / 1000.0 / g_iBlocksPerTest, (double)uTotalProgressiveNs / 1000.0 / g_iBlocksPerTest,
+      bCorrect?"ok":"fail");
+   return bCorrect;
+}
+
+int main(int argc, char *argv[])
+{
+   static const int s_iPayloads[] = { 256, 1024, MAX_PACKET_PAYLOAD };
+   static const int s_iSchemes[][2] = { {4,2}, {6,3}, {8,4}, {12,6}, {16,8}, {24,12}, {32,16} };
+   const char* szOutFile = NULL;
+   int iKernel = FEC_KERNEL_AUTO;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iBlocksPerTest = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-k") && i < argc-1 )
+      {
+         i++;
+         for( int k=0; k<FEC_KERNEL_COUNT; k++ )
+            if ( 0 == strcmp(argv[i], fec_get_kernel_name(k)) )
+               iKernel = k;
+      }
+      else
+      {
+         printf("Usage: %s [-k auto|scalar|word64|ssse3|avx2|neon] [-n blocks] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iBlocksPerTest < 10 )
+      g_iBlocksPerTest = 10;
+
+   fec_init();
+   if ( ! fec_select_kernel(iKernel) )
+   {
+      printf("Kernel %s is not supported on this CPU.\n", fec_get_kernel_name(iKernel));
+      return 1;
+   }
+   srand(1);
+
+   for( int i=0; i<MAX_TOTAL_PACKETS_IN_BLOCK; i++ )
+   {
+      g_pDataBlocks[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+      g_pFECBlocks[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+      g_pFECBlocksProgressive[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+   }
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   fprintf(fdOut, "# Progressive FEC encoding benchmark, kernel: %s\n", fec_get_kernel_name(fec_get_kernel()));
+   fprintf(fdOut, "data,ec,payload,block_end_to_ec_ready_p50_us,block_end_to_ec_ready_p99_us,progressive_end_to_ec_ready_p50_us,progressive_end_to_ec_ready_p99_us,block_encode_us,progressive_encode_us,result\n");
+
+   int iFailed = 0;
+   for( unsigned int p=0; p<sizeof(s_iPayloads)/sizeof(s_iPayloads[0]); p++ )
+   for( unsigned int s=0; s<sizeof(s_iSchemes)/sizeof(s_iSchemes[0]); s++ )
+   {
+      if ( s_iSchemes[s][0] > MAX_DATA_PACKETS_IN_BLOCK || s_iSchemes[s][1] > MAX_FECS_PACKETS_IN_BLOCK )
+         continue;
+      if ( s_iSchemes[s][0] + s_iSchemes[s][1] > MAX_TOTAL_PACKETS_IN_BLOCK )
+         continue;
+      if ( ! _run_config(s_iPayloads[p], s_iSchemes[s][0], s_iSchemes[s][1], fdOut) )
+         iFailed++;
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+
+   for( int i=0; i<MAX_TOTAL_PACKETS_IN_BLOCK; i++ )
+   {
+      free(g_pDataBlocks[i]);
+      free(g_pFECBlocks[i]);
+      free(g_pFECBlocksProgressive[i]);
+   }
+   if ( iFailed )
+      printf("%d configurations gave different EC packets!\n", iFailed);
+   return iFailed ? 1 : 0;
+}
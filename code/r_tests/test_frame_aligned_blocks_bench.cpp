@@ -0,0 +1,621 @@
+/*
+   Frame aligned video blocks benchmark.
+   Packetizes a simulated video stream (frames at a fixed fps, read from the encoder as RTP sized
+   chunks) into video blocks with EC packets, the way the vehicle does, sends them through a
+   virtual radio link and reassembles/reconstructs the blocks on the controller side, the way the
+   controller does (blocks closed at a frame end are smaller, their last data packet can be shorter).
+   Compares:
+      fixed: the blocks are sent when their data packets are full (frame boundaries are ignored);
+      aligned: the block is closed at the end of each frame (fewer data packets, same EC packets).
+   Reports per link profile: frames complete, frame completion latency (from the frame's last byte
+   given to the packetizer to the last block with the frame's data being received/reconstructed),
+   packets and bytes sent, and checks that all the reconstructed data is unchanged.
+
+   Usage: test_frame_aligned_blocks_bench [-f frames] [-fps fps] [-b bitrate] [-p base port] [-c "loss=5,..."] [-o out.csv]
+*/
+
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../base/hardware_radio.h"
+#include "../base/hardware_radio_virtual.h"
+#include "../base/flags_video.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+#include "../radio/radioflags.h"
+#include "../radio/fec.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <vector>
+#include <algorithm>
+
+int g_iFrames = 300;
+int g_iFPS = 60;
+int g_iBitrate = 8000000;
+int g_iKeyframeInterval = 60;
+int g_iBasePort = 7500;
+int g_iChunkSize = 1400;
+
+int g_iBlockPackets = 9;
+int g_iBlockECs = 4;
+int g_iVideoDataLength = 1250;
+
+#define BENCH_MAX_BLOCKS 20000
+
+typedef struct
+{
+   u32 uStreamOffset; // of the block's first data byte
+   u32 uDataBytes;
+   u64 uTimeComplete; // when the controller side got (or reconstructed) all its data packets, 0 if never
+} type_bench_block;
+
+typedef struct
+{
+   u32 uStreamEndOffset;
+   u64 uTimeEnd; // when its last byte was given to the packetizer
+   int iFirstBlock;
+   int iLastBlock;
+} type_bench_frame;
+
+type_bench_block* g_pBlocks = NULL;
+type_bench_frame* g_pFrames = NULL;
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static u8 _stream_byte(u32 uOffset)
+{
+   return (u8)((uOffset * 2654435761u) >> 24);
+}
+
+// ----------------------------------------------------
+// Vehicle side: the packetizer
+
+typedef struct
+{
+   bool bFrameAligned;
+   u32 uBlockIndex;
+   int iPacketIndex; // data packet being filled
+   int iFill;
+   int iBlockPackets; // of the current block (smaller if closed at a frame end)
+   int iBlockECs;
+   bool bFrameEndBlock;
+   u32 uStreamOffset;
+   u32 uStreamPacketIndex;
+   u8 data[MAX_TOTAL_PACKETS_IN_BLOCK][MAX_PACKET_TOTAL_SIZE];
+   u8 ec[MAX_FECS_PACKETS_IN_BLOCK][MAX_PACKET_TOTAL_SIZE];
+   int iPacketsSent;
+   u64 uBytesSent;
+} type_bench_packetizer;
+
+static void _send_video_packet(type_bench_packetizer* pTx, u8* pVideoData, int iPacketIndex, int iLength)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   t_packet_header* pPH = (t_packet_header*)packet;
+   t_packet_header_video_full_77* pPHVF = (t_packet_header_video_full_77*)(packet + sizeof(t_packet_header));
+   radio_packet_init(pPH, PACKET_COMPONENT_VIDEO, PACKET_TYPE_VIDEO_DATA_FULL, STREAM_ID_VIDEO_1);
+   pPH->vehicle_id_src = 1;
+   pPH->vehicle_id_dest = 0;
+   pPH->stream_packet_idx = pTx->uStreamPacketIndex++;
+   pPH->total_length = sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77) + iLength;
+   memset(pPHVF, 0, sizeof(t_packet_header_video_full_77));
+   pPHVF->video_block_index = pTx->uBlockIndex;
+   pPHVF->video_block_packet_index = (u8)iPacketIndex;
+   pPHVF->block_packets = (u8)pTx->iBlockPackets;
+   pPHVF->block_fecs = (u8)pTx->iBlockECs;
+   pPHVF->video_data_length = (u16)g_iVideoDataLength;
+   if ( pTx->bFrameEndBlock )
+      pPHVF->uVideoStatusFlags2 |= VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK;
+   memcpy(packet + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77), pVideoData, iLength);
+
+   int iRawLength = radio_build_new_raw_packet(0, rawPacket, packet, pPH->total_length, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+   if ( radio_write_raw_packet(0, rawPacket, iRawLength) > 0 )
+   {
+      pTx->iPacketsSent++;
+      pTx->uBytesSent += pPH->total_length;
+   }
+}
+
+static void _start_block(type_bench_packetizer* pTx)
+{
+   pTx->iPacketIndex = 0;
+   pTx->iFill = 0;
+   pTx->iBlockPackets = g_iBlockPackets;
+   pTx->iBlockECs = g_iBlockECs;
+   pTx->bFrameEndBlock = false;
+   if ( pTx->uBlockIndex < BENCH_MAX_BLOCKS )
+   {
+      g_pBlocks[pTx->uBlockIndex].uStreamOffset = pTx->uStreamOffset;
+      g_pBlocks[pTx->uBlockIndex].uDataBytes = 0;
+      g_pBlocks[pTx->uBlockIndex].uTimeComplete = 0;
+   }
+}
+
+// Same as the vehicle: a block closed at a frame end keeps its EC packets count, up to one per data packet
+
+static int _get_frame_end_block_ecs(int iDataPackets)
+{
+   if ( g_iBlockECs > iDataPackets )
+      return iDataPackets;
+   return g_iBlockECs;
+}
+
+// Same as the vehicle: each data packet is folded into the EC packets and sent as soon as it's read,
+// the EC packets are sent after the last data packet of the block
+
+static void _on_packet_read(type_bench_packetizer* pTx, bool bEndOfFrame)
+{
+   if ( bEndOfFrame )
+   {
+      pTx->iBlockPackets = pTx->iPacketIndex+1;
+      pTx->iBlockECs = _get_frame_end_block_ecs(pTx->iBlockPackets);
+      pTx->bFrameEndBlock = true;
+      memset(&pTx->data[pTx->iPacketIndex][pTx->iFill], 0, g_iVideoDataLength - pTx->iFill);
+   }
+
+   u8* pECs[MAX_FECS_PACKETS_IN_BLOCK];
+   for( int i=0; i<pTx->iBlockECs; i++ )
+      pECs[i] = pTx->ec[i];
+   if ( pTx->iBlockECs > 0 )
+      fec_encode_add_block(g_iVideoDataLength, pTx->data[pTx->iPacketIndex], pTx->iPacketIndex, pECs, pTx->iBlockECs);
+
+   _send_video_packet(pTx, pTx->data[pTx->iPacketIndex], pTx->iPacketIndex, bEndOfFrame?pTx->iFill:g_iVideoDataLength);
+   if ( pTx->uBlockIndex < BENCH_MAX_BLOCKS )
+      g_pBlocks[pTx->uBlockIndex].uDataBytes += pTx->iFill;
+   pTx->uStreamOffset += pTx->iFill;
+
+   pTx->iPacketIndex++;
+   pTx->iFill = 0;
+   if ( pTx->iPacketIndex < pTx->iBlockPackets )
+      return;
+
+   for( int i=0; i<pTx->iBlockECs; i++ )
+      _send_video_packet(pTx, pTx->ec[i], pTx->iBlockPackets + i, g_iVideoDataLength);
+   pTx->uBlockIndex++;
+   _start_block(pTx);
+}
+
+static void _packetize_chunk(type_bench_packetizer* pTx, u32 uChunkOffset, int iChunkSize)
+{
+   while ( iChunkSize > 0 )
+   {
+      int iCopy = g_iVideoDataLength - pTx->iFill;
+      if ( iCopy > iChunkSize )
+         iCopy = iChunkSize;
+      for( int i=0; i<iCopy; i++ )
+         pTx->data[pTx->iPacketIndex][pTx->iFill + i] = _stream_byte(uChunkOffset + i);
+      pTx->iFill += iCopy;
+      uChunkOffset += iCopy;
+      iChunkSize -= iCopy;
+      if ( pTx->iFill == g_iVideoDataLength )
+         _on_packet_read(pTx, false);
+   }
+}
+
+static void _on_end_of_frame(type_bench_packetizer* pTx)
+{
+   if ( ! pTx->bFrameAligned )
+      return;
+   if ( pTx->iFill > 0 )
+   {
+      _on_packet_read(pTx, true);
+      return;
+   }
+   if ( 0 == pTx->iPacketIndex )
+      return;
+   // Frame ended on a packet boundary: close the block with the data packets already sent
+   // (the EC rows only depend on the packet indexes, the first ones are valid for the smaller block)
+   pTx->iBlockPackets = pTx->iPacketIndex;
+   pTx->iBlockECs = _get_frame_end_block_ecs(pTx->iBlockPackets);
+   pTx->bFrameEndBlock = true;
+   for( int i=0; i<pTx->iBlockECs; i++ )
+      _send_video_packet(pTx, pTx->ec[i], pTx->iBlockPackets + i, g_iVideoDataLength);
+   pTx->uBlockIndex++;
+   _start_block(pTx);
+}
+
+// ----------------------------------------------------
+// Controller side: the blocks reassembly
+
+typedef struct
+{
+   u32 uBlockIndex;
+   int iDataPackets;
+   int iECs;
+   bool bFrameEndBlock;
+   bool bDone;
+   int iReceivedData;
+   int iReceivedEC;
+   u8 received[MAX_TOTAL_PACKETS_IN_BLOCK];
+   int iLength[MAX_TOTAL_PACKETS_IN_BLOCK];
+   u8 data[MAX_TOTAL_PACKETS_IN_BLOCK][MAX_PACKET_TOTAL_SIZE];
+} type_bench_rx_block;
+
+#define BENCH_RX_BLOCKS 64
+
+typedef struct
+{
+   type_bench_rx_block blocks[BENCH_RX_BLOCKS];
+   int iCorrupted;
+   int iReconstructed;
+} type_bench_receiver;
+
+static void _rx_check_block(type_bench_receiver* pRx, type_bench_rx_block* pBlock)
+{
+   if ( pBlock->bDone || (pBlock->iDataPackets <= 0) )
+      return;
+   if ( pBlock->iReceivedData + pBlock->iReceivedEC < pBlock->iDataPackets )
+      return;
+
+   if ( pBlock->iReceivedData < pBlock->iDataPackets )
+   {
+      u8* pData[MAX_TOTAL_PACKETS_IN_BLOCK];
+      u8* pFECs[MAX_FECS_PACKETS_IN_BLOCK];
+      unsigned int uFECIndexes[MAX_FECS_PACKETS_IN_BLOCK];
+      unsigned int uMissing[MAX_TOTAL_PACKETS_IN_BLOCK];
+      int iMissing = 0;
+      for( int i=0; i<pBlock->iDataPackets; i++ )
+      {
+         pData[i] = pBlock->data[i];
+         if ( ! pBlock->received[i] )
+            uMissing[iMissing++] = i;
+      }
+      int iFECs = 0;
+      for( int i=0; (i<pBlock->iECs) && (iFECs < iMissing); i++ )
+      {
+         if ( ! pBlock->received[pBlock->iDataPackets + i] )
+            continue;
+         pFECs[iFECs] = pBlock->data[pBlock->iDataPackets + i];
+         uFECIndexes[iFECs] = i;
+         iFECs++;
+      }
+      fec_decode(g_iVideoDataLength, pData, pBlock->iDataPackets, pFECs, uFECIndexes, uMissing, iMissing);
+      for( int i=0; i<iMissing; i++ )
+         pBlock->iLength[uMissing[i]] = g_iVideoDataLength;
+      pRx->iReconstructed++;
+   }
+   pBlock->bDone = true;
+
+   if ( pBlock->uBlockIndex >= BENCH_MAX_BLOCKS )
+      return;
+   g_pBlocks[pBlock->uBlockIndex].uTimeComplete = _now_micros();
+
+   // Check the data (a reconstructed short last packet keeps its zero padding)
+   u32 uOffset = g_pBlocks[pBlock->uBlockIndex].uStreamOffset;
+   u32 uEnd = uOffset + g_pBlocks[pBlock->uBlockIndex].uDataBytes;
+   for( int i=0; i<pBlock->iDataPackets; i++ )
+   {
+      for( int k=0; k<pBlock->iLength[i]; k++ )
+      {
+         u8 uExpected = (uOffset < uEnd)?_stream_byte(uOffset):0;
+         if ( pBlock->data[i][k] != uExpected )
+         {
+            pRx->iCorrupted++;
+            return;
+         }
+         if ( uOffset < uEnd )
+            uOffset++;
+      }
+   }
+   if ( uOffset != uEnd )
+      pRx->iCorrupted++;
+}
+
+static void _rx_on_packet(type_bench_receiver* pRx, u8* pPacket, int iLength)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   t_packet_header_video_full_77* pPHVF = (t_packet_header_video_full_77*)(pPacket + sizeof(t_packet_header));
+   if ( iLength < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77)) )
+      return;
+
+   type_bench_rx_block* pBlock = &pRx->blocks[pPHVF->video_block_index % BENCH_RX_BLOCKS];
+   if ( pBlock->uBlockIndex != pPHVF->video_block_index )
+   {
+      memset(pBlock->received, 0, sizeof(pBlock->received));
+      pBlock->uBlockIndex = pPHVF->video_block_index;
+      pBlock->bFrameEndBlock = false;
+      pBlock->bDone = false;
+      pBlock->iReceivedData = 0;
+      pBlock->iReceivedEC = 0;
+   }
+   int iIndex = pPHVF->video_block_packet_index;
+   if ( pBlock->received[iIndex] )
+      return;
+
+   // Same as the controller: packets sent before the block was closed at a frame end have the scheme block size
+   if ( pPHVF->uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK )
+      pBlock->bFrameEndBlock = true;
+   if ( (pPHVF->uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK) || (! pBlock->bFrameEndBlock) )
+   {
+      pBlock->iDataPackets = pPHVF->block_packets;
+      pBlock->iECs = pPHVF->block_fecs;
+   }
+
+   int iVideoDataLength = pPH->total_length - sizeof(t_packet_header) - sizeof(t_packet_header_video_full_77);
+   if ( iVideoDataLength > pPHVF->video_data_length )
+      iVideoDataLength = pPHVF->video_data_length;
+   memcpy(pBlock->data[iIndex], pPacket + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77), iVideoDataLength);
+   memset(pBlock->data[iIndex] + iVideoDataLength, 0, pPHVF->video_data_length - iVideoDataLength);
+   pBlock->iLength[iIndex] = iVideoDataLength;
+   pBlock->received[iIndex] = 1;
+   if ( iIndex < pBlock->iDataPackets )
+      pBlock->iReceivedData++;
+   else
+      pBlock->iReceivedEC++;
+   _rx_check_block(pRx, pBlock);
+}
+
+static void _rx_read(type_bench_receiver* pRx, int iFd, int iTimeoutMicros)
+{
+   fd_set readSet;
+   FD_ZERO(&readSet);
+   FD_SET(iFd, &readSet);
+   struct timeval tv;
+   tv.tv_sec = iTimeoutMicros / 1000000;
+   tv.tv_usec = iTimeoutMicros % 1000000;
+   if ( select(iFd+1, &readSet, NULL, NULL, &tv) <= 0 )
+      return;
+   while ( true )
+   {
+      int iLength = 0;
+      u8* pData = radio_process_wlan_data_in(0, &iLength);
+      if ( NULL == pData )
+         break;
+      _rx_on_packet(pRx, pData, iLength);
+   }
+}
+
+// ----------------------------------------------------
+
+typedef struct
+{
+   int iFramesMeasured;
+   int iFramesComplete;
+   double fAvgLatencyUs;
+   double fP90LatencyUs;
+   double fMaxLatencyUs;
+   int iPacketsSent;
+   u64 uBytesSent;
+   int iReconstructed;
+   int iCorrupted;
+} type_bench_result;
+
+static bool _run(const char* szConfig, bool bFrameAligned, type_bench_result* pResult)
+{
+   memset(pResult, 0, sizeof(type_bench_result));
+   memset(g_pBlocks, 0, sizeof(type_bench_block) * BENCH_MAX_BLOCKS);
+   memset(g_pFrames, 0, sizeof(type_bench_frame) * g_iFrames);
+
+   type_radio_virtual_config config;
+   hardware_radio_virtual_get_default_config(&config);
+   hardware_radio_virtual_parse_config(szConfig, &config);
+   config.iCount = 1;
+   config.iBasePort = g_iBasePort;
+   config.iSide = VIRTUAL_RADIO_SIDE_VEHICLE;
+   hardware_radio_virtual_set_config(&config);
+   hardware_reset_radio_enumerated_flag();
+   hardware_enumerate_radio_interfaces();
+   radio_init_link_structures();
+   if ( radio_open_interface_for_write(0) < 0 )
+      return false;
+   config.iSide = VIRTUAL_RADIO_SIDE_STATION;
+   hardware_radio_virtual_set_config(&config);
+   int iFdRead = radio_open_interface_for_read(0, RADIO_PORT_ROUTER_DOWNLINK);
+   if ( iFdRead < 0 )
+   {
+      radio_close_interface_for_write(0);
+      return false;
+   }
+
+   type_bench_packetizer* pTx = (type_bench_packetizer*) malloc(sizeof(type_bench_packetizer));
+   type_bench_receiver* pRx = (type_bench_receiver*) malloc(sizeof(type_bench_receiver));
+   memset(pTx, 0, sizeof(type_bench_packetizer));
+   memset(pRx, 0, sizeof(type_bench_receiver));
+   for( int i=0; i<BENCH_RX_BLOCKS; i++ )
+      pRx->blocks[i].uBlockIndex = MAX_U32;
+   pTx->bFrameAligned = bFrameAligned;
+   _start_block(pTx);
+
+   u32 uSeed = 17;
+   int iAvgFrameSize = g_iBitrate / 8 / g_iFPS;
+   u64 uTimeStart = _now_micros();
+   for( int f=0; f<g_iFrames; f++ )
+   {
+      u64 uFrameTime = uTimeStart + (u64)f * 1000000LL / (u64)g_iFPS;
+      u64 uNow = _now_micros();
+      while ( uNow < uFrameTime )
+      {
+         _rx_read(pRx, iFdRead, (int)(uFrameTime - uNow));
+         uNow = _now_micros();
+      }
+
+      uSeed = uSeed * 1103515245 + 12345;
+      int iFrameSize = iAvgFrameSize * 7 / 10 + (int)((uSeed >> 16) % (u32)(iAvgFrameSize * 6 / 10 + 1));
+      if ( 0 == (f % g_iKeyframeInterval) )
+         iFrameSize *= 4;
+
+      g_pFrames[f].iFirstBlock = (int)pTx->uBlockIndex;
+      u32 uOffset = pTx->uStreamOffset + (u32)pTx->iFill;
+      int iLeft = iFrameSize;
+      while ( iLeft > 0 )
+      {
+         int iChunk = (iLeft < g_iChunkSize)?iLeft:g_iChunkSize;
+         _packetize_chunk(pTx, uOffset, iChunk);
+         uOffset += iChunk;
+         iLeft -= iChunk;
+      }
+      g_pFrames[f].uStreamEndOffset = uOffset;
+      g_pFrames[f].uTimeEnd = _now_micros();
+      // The block that has the frame's last byte
+      g_pFrames[f].iLastBlock = (int)pTx->uBlockIndex;
+      if ( (0 == pTx->iFill) && (0 == pTx->iPacketIndex) && (pTx->uBlockIndex > 0) )
+         g_pFrames[f].iLastBlock--;
+      _on_end_of_frame(pTx);
+      _rx_read(pRx, iFdRead, 0);
+   }
+
+   // Drain the link
+   int iDrainMicros = (int)(config.uLatencyMicros + config.uJitterMicros + config.uMaxQueueMicros) + 50000;
+   u64 uDrainEnd = _now_micros() + iDrainMicros;
+   while ( _now_micros() < uDrainEnd )
+      _rx_read(pRx, iFdRead, 5000);
+
+   radio_close_interface_for_read(0);
+   radio_close_interface_for_write(0);
+
+   // The last frame's tail is never sent with fixed blocks (no next frame): measure all but the last frame
+   std::vector<double> latencies;
+   for( int f=0; f<g_iFrames-1; f++ )
+   {
+      pResult->iFramesMeasured++;
+      u64 uComplete = 0;
+      bool bComplete = true;
+      for( int b=g_pFrames[f].iFirstBlock; b<=g_pFrames[f].iLastBlock; b++ )
+      {
+         if ( (b >= BENCH_MAX_BLOCKS) || (0 == g_pBlocks[b].uTimeComplete) )
+         {
+            bComplete = false;
+            break;
+         }
+         if ( g_pBlocks[b].uTimeComplete > uComplete )
+            uComplete = g_pBlocks[b].uTimeComplete;
+      }
+      if ( ! bComplete )
+         continue;
+      pResult->iFramesComplete++;
+      double fLatency = (uComplete > g_pFrames[f].uTimeEnd)?(double)(uComplete - g_pFrames[f].uTimeEnd):0.0;
+      latencies.push_back(fLatency);
+   }
+   if ( ! latencies.empty() )
+   {
+      std::sort(latencies.begin(), latencies.end());
+      double fSum = 0;
+      for( size_t i=0; i<latencies.size(); i++ )
+         fSum += latencies[i];
+      pResult->fAvgLatencyUs = fSum / (double)latencies.size();
+      pResult->fP90LatencyUs = latencies[(latencies.size() * 9) / 10];
+      pResult->fMaxLatencyUs = latencies[latencies.size()-1];
+   }
+   pResult->iPacketsSent = pTx->iPacketsSent;
+   pResult->uBytesSent = pTx->uBytesSent;
+   pResult->iReconstructed = pRx->iReconstructed;
+   pResult->iCorrupted = pRx->iCorrupted;
+   free(pTx);
+   free(pRx);
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+   const char* szCustomConfig = NULL;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-f") && i < argc-1 )
+         g_iFrames = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-fps") && i < argc-1 )
+         g_iFPS = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-b") && i < argc-1 )
+         g_iBitrate = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-p") && i < argc-1 )
+         g_iBasePort = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-c") && i < argc-1 )
+         szCustomConfig = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-f frames] [-fps fps] [-b bitrate] [-p base port] [-c \"loss=5,burst=3,latency=2000,rate=24000000\"] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iFrames < 10 )
+      g_iFrames = 10;
+   if ( g_iFPS < 1 )
+      g_iFPS = 1;
+   if ( g_iBitrate < 100000 )
+      g_iBitrate = 100000;
+
+   log_init_local_only("TestFrameAlignedBlocksBench");
+   log_disable_stdout();
+   fec_init();
+
+   g_pBlocks = (type_bench_block*) malloc(sizeof(type_bench_block) * BENCH_MAX_BLOCKS);
+   g_pFrames = (type_bench_frame*) malloc(sizeof(type_bench_frame) * g_iFrames);
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   typedef struct
+   {
+      const char* szName;
+      const char* szConfig;
+   } type_link_profile;
+
+   type_link_profile profiles[] = {
+      { "clean", "latency=1000,rate=24000000,queue=100000" },
+      { "loss5", "loss=5,seed=3,latency=1000,rate=24000000,queue=100000" },
+   };
+   int iProfilesCount = sizeof(profiles)/sizeof(profiles[0]);
+   if ( NULL != szCustomConfig )
+   {
+      profiles[0].szName = "custom";
+      profiles[0].szConfig = szCustomConfig;
+      iProfilesCount = 1;
+   }
+
+   fprintf(fdOut, "# Frame aligned blocks benchmark: %d frames, %d fps, %d bps, blocks %d/%d x %d bytes\n", g_iFrames, g_iFPS, g_iBitrate, g_iBlockPackets, g_iBlockECs, g_iVideoDataLength);
+   fprintf(fdOut, "profile,blocks,frames,complete,avg_latency_us,p90_latency_us,max_latency_us,packets_sent,kbytes_sent,reconstructed_blocks,result\n");
+
+   int iFailed = 0;
+   for( int p=0; p<iProfilesCount; p++ )
+   {
+      for( int m=0; m<2; m++ )
+      {
+         type_bench_result result;
+         if ( ! _run(profiles[p].szConfig, (1 == m), &result) )
+         {
+            printf("Failed to open the virtual radio interfaces (base port %d): %s\n", g_iBasePort, strerror(errno));
+            return 1;
+         }
+         const char* szResult = "ok";
+         if ( result.iCorrupted > 0 )
+            szResult = "CORRUPTED";
+         else if ( (0 == strcmp(profiles[p].szName, "clean")) && (result.iFramesComplete != result.iFramesMeasured) )
+            szResult = "INCOMPLETE";
+         if ( 0 != strcmp(szResult, "ok") )
+            iFailed++;
+         fprintf(fdOut, "%s,%s,%d,%d,%.1f,%.1f,%.1f,%d,%.1f,%d,%s\n", profiles[p].szName, m?"aligned":"fixed",
+            result.iFramesMeasured, result.iFramesComplete, result.fAvgLatencyUs, result.fP90LatencyUs, result.fMaxLatencyUs,
+            result.iPacketsSent, (double)result.uBytesSent/1000.0, result.iReconstructed, szResult);
+         fflush(fdOut);
+      }
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+   free(g_pBlocks);
+   free(g_pFrames);
+
+   if ( iFailed )
+   {
+      printf("Frame aligned blocks benchmark: %d runs failed the checks!\n", iFailed);
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,349 @@
+/*
+   IPC channels benchmark.
+   Compares the transports of the IPC channels between two processes:
+      ring:  shared memory ring (zero copy: messages written and read in place), reader waits on the doorbell fd;
+      msgq:  SysV message queue, with the IPC message framing (CRC, message id, length), blocking msgrcv;
+      fifo:  pipe, whole packets written and read back, blocking read.
+   Each message is a packet with its CRC computed by the writer and checked by the reader.
+   Two tests:
+      ping-pong: a message goes to the other process and back, reports the round trip time (avg, p99);
+      throughput: one process writes messages as fast as it can, the other one reads them; reports the
+                  messages per second and the CPU time (both processes, user + system) per message.
+   Note: the channels polled on a timer (the old message queues in the router event loops) add on
+   average half of the timer period to the latency; the blocking reads here are the best case for them.
+
+   Usage: test_ipc_ring_bench [-n round trips] [-m throughput messages] [-s message size]
+*/
+
+#include "../base/base.h"
+#include "../base/ipc_shm_ring.h"
+#include "../base/ruby_ipc.h"
+#include "../radio/radiopackets2.h"
+
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <vector>
+#include <algorithm>
+
+#define BENCH_RING_A "/RUBY_BENCH_RING_A"
+#define BENCH_RING_B "/RUBY_BENCH_RING_B"
+#define BENCH_BELL_A "/tmp/ruby_bench_bell_a"
+#define BENCH_BELL_B "/tmp/ruby_bench_bell_b"
+#define BENCH_RING_SLOTS 64
+
+int g_iRoundTrips = 20000;
+int g_iMessages = 200000;
+int g_iMessageSize = 400;
+
+typedef struct
+{
+   long type;
+   u8 data[ICP_CHANNEL_MAX_MSG_SIZE];
+} type_bench_msgq_message;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static double _cpu_ms()
+{
+   struct rusage ruSelf, ruChildren;
+   getrusage(RUSAGE_SELF, &ruSelf);
+   getrusage(RUSAGE_CHILDREN, &ruChildren);
+   double f = 0;
+   f += ruSelf.ru_utime.tv_sec * 1000.0 + ruSelf.ru_utime.tv_usec / 1000.0;
+   f += ruSelf.ru_stime.tv_sec * 1000.0 + ruSelf.ru_stime.tv_usec / 1000.0;
+   f += ruChildren.ru_utime.tv_sec * 1000.0 + ruChildren.ru_utime.tv_usec / 1000.0;
+   f += ruChildren.ru_stime.tv_sec * 1000.0 + ruChildren.ru_stime.tv_usec / 1000.0;
+   return f;
+}
+
+// Packet: CRC (u32), sequence number (u32), payload
+static void _build_packet(u8* pPacket, u32 uSequence)
+{
+   memcpy(pPacket + sizeof(u32), &uSequence, sizeof(u32));
+   for( int i=2*sizeof(u32); i<g_iMessageSize; i++ )
+      pPacket[i] = (u8)(uSequence + i);
+   u32 uCRC = base_compute_crc32(pPacket + sizeof(u32), g_iMessageSize - sizeof(u32));
+   memcpy(pPacket, &uCRC, sizeof(u32));
+}
+
+static bool _check_packet(u8* pPacket, int iLength, u32 uSequence)
+{
+   if ( iLength != g_iMessageSize )
+      return false;
+   u32 uCRC = base_compute_crc32(pPacket + sizeof(u32), iLength - sizeof(u32));
+   u32 uSeq = 0;
+   memcpy(&uSeq, pPacket + sizeof(u32), sizeof(u32));
+   return (0 == memcmp(&uCRC, pPacket, sizeof(u32))) && (uSeq == uSequence);
+}
+
+// ----------------------------------------------------
+// Transports
+
+typedef struct
+{
+   int iType; // 0: ring, 1: msgq, 2: fifo
+   type_ipc_shm_ring ring;
+   int iMsgQueue;
+   int iPipe[2];
+   u8 uMsgId;
+} type_bench_channel;
+
+static const char* s_szTransports[3] = { "ring", "msgq", "fifo" };
+
+static void _channel_create(type_bench_channel* pChannel, int iType, int iIndex)
+{
+   memset(pChannel, 0, sizeof(type_bench_channel));
+   pChannel->iType = iType;
+   pChannel->iMsgQueue = -1;
+   pChannel->iPipe[0] = pChannel->iPipe[1] = -1;
+   if ( 1 == iType )
+      pChannel->iMsgQueue = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+   if ( 2 == iType )
+      pipe(pChannel->iPipe);
+   if ( 0 == iType )
+      ipc_shm_ring_unlink(iIndex ? BENCH_RING_B : BENCH_RING_A, iIndex ? BENCH_BELL_B : BENCH_BELL_A);
+}
+
+// Rings are opened after the fork, by each process, as the IPC channels do
+static void _channel_attach(type_bench_channel* pChannel, int iIndex)
+{
+   if ( 0 != pChannel->iType )
+      return;
+   if ( ! ipc_shm_ring_open(&pChannel->ring, iIndex ? BENCH_RING_B : BENCH_RING_A, iIndex ? BENCH_BELL_B : BENCH_BELL_A, BENCH_RING_SLOTS, ICP_CHANNEL_MAX_MSG_SIZE) )
+   {
+      printf("Failed to open the ring.\n");
+      exit(-1);
+   }
+   ipc_shm_ring_arm_doorbell(&pChannel->ring);
+}
+
+static void _channel_destroy(type_bench_channel* pChannel, int iIndex)
+{
+   if ( 0 == pChannel->iType )
+   {
+      ipc_shm_ring_close(&pChannel->ring);
+      ipc_shm_ring_unlink(iIndex ? BENCH_RING_B : BENCH_RING_A, iIndex ? BENCH_BELL_B : BENCH_BELL_A);
+   }
+   if ( 1 == pChannel->iType )
+      msgctl(pChannel->iMsgQueue, IPC_RMID, NULL);
+   if ( 2 == pChannel->iType )
+   {
+      close(pChannel->iPipe[0]);
+      close(pChannel->iPipe[1]);
+   }
+}
+
+static void _channel_write(type_bench_channel* pChannel, u32 uSequence)
+{
+   pChannel->uMsgId++;
+   if ( 0 == pChannel->iType )
+   {
+      u8* pSlot = NULL;
+      while ( NULL == (pSlot = ipc_shm_ring_reserve(&pChannel->ring, g_iMessageSize)) )
+         sched_yield();
+      _build_packet(pSlot, uSequence);
+      ipc_shm_ring_commit(&pChannel->ring, pSlot, g_iMessageSize, pChannel->uMsgId);
+      return;
+   }
+
+   u8 uPacket[ICP_CHANNEL_MAX_MSG_SIZE];
+   _build_packet(uPacket, uSequence);
+   if ( 1 == pChannel->iType )
+   {
+      type_bench_msgq_message msg;
+      msg.type = 1;
+      msg.data[4] = pChannel->uMsgId;
+      msg.data[5] = g_iMessageSize & 0xFF;
+      msg.data[6] = (g_iMessageSize >> 8) & 0xFF;
+      memcpy(&msg.data[7], uPacket, g_iMessageSize);
+      u32 uCRC = base_compute_crc32(&msg.data[4], g_iMessageSize + 3);
+      memcpy(&msg.data[0], &uCRC, sizeof(u32));
+      while ( 0 != msgsnd(pChannel->iMsgQueue, &msg, g_iMessageSize + 7, 0) )
+         if ( errno != EINTR )
+            exit(-1);
+      return;
+   }
+   if ( write(pChannel->iPipe[1], uPacket, g_iMessageSize) != g_iMessageSize )
+      exit(-1);
+}
+
+static bool _channel_read(type_bench_channel* pChannel, u32 uSequence)
+{
+   if ( 0 == pChannel->iType )
+   {
+      int iLength = 0;
+      u8 uMsgId = 0;
+      u8* pMessage = NULL;
+      while ( NULL == (pMessage = ipc_shm_ring_peek(&pChannel->ring, &iLength, &uMsgId)) )
+      {
+         struct pollfd pfd;
+         pfd.fd = ipc_shm_ring_get_doorbell_fd(&pChannel->ring);
+         pfd.events = POLLIN;
+         pfd.revents = 0;
+         poll(&pfd, 1, 1000);
+      }
+      bool bOk = _check_packet(pMessage, iLength, uSequence);
+      ipc_shm_ring_release(&pChannel->ring);
+      return bOk;
+   }
+   if ( 1 == pChannel->iType )
+   {
+      type_bench_msgq_message msg;
+      int iLen = msgrcv(pChannel->iMsgQueue, &msg, ICP_CHANNEL_MAX_MSG_SIZE, 0, MSG_NOERROR);
+      if ( iLen < 7 )
+         return false;
+      int iMsgLen = msg.data[5] | (((int)msg.data[6]) << 8);
+      u32 uCRC = base_compute_crc32(&msg.data[4], iMsgLen + 3);
+      if ( 0 != memcmp(&uCRC, &msg.data[0], sizeof(u32)) )
+         return false;
+      return _check_packet(&msg.data[7], iMsgLen, uSequence);
+   }
+   u8 uPacket[ICP_CHANNEL_MAX_MSG_SIZE];
+   int iPos = 0;
+   while ( iPos < g_iMessageSize )
+   {
+      int iCount = read(pChannel->iPipe[0], uPacket + iPos, g_iMessageSize - iPos);
+      if ( iCount <= 0 )
+         return false;
+      iPos += iCount;
+   }
+   return _check_packet(uPacket, iPos, uSequence);
+}
+
+// ----------------------------------------------------
+// Tests
+
+static void _test_ping_pong(int iType)
+{
+   type_bench_channel channelToChild, channelToParent;
+   _channel_create(&channelToChild, iType, 0);
+   _channel_create(&channelToParent, iType, 1);
+
+   fflush(stdout);
+   pid_t pid = fork();
+   if ( 0 == pid )
+   {
+      _channel_attach(&channelToChild, 0);
+      _channel_attach(&channelToParent, 1);
+      for( int i=0; i<g_iRoundTrips; i++ )
+      {
+         if ( ! _channel_read(&channelToChild, (u32)i) )
+            exit(1);
+         _channel_write(&channelToParent, (u32)i);
+      }
+      exit(0);
+   }
+
+   _channel_attach(&channelToChild, 0);
+   _channel_attach(&channelToParent, 1);
+   std::vector<u64> roundTripNs;
+   roundTripNs.reserve(g_iRoundTrips);
+   int iErrors = 0;
+   for( int i=0; i<g_iRoundTrips; i++ )
+   {
+      u64 uStart = _now_ns();
+      _channel_write(&channelToChild, (u32)i);
+      if ( ! _channel_read(&channelToParent, (u32)i) )
+         iErrors++;
+      roundTripNs.push_back(_now_ns() - uStart);
+   }
+   int iStatus = 0;
+   waitpid(pid, &iStatus, 0);
+   if ( (! WIFEXITED(iStatus)) || (0 != WEXITSTATUS(iStatus)) )
+      iErrors++;
+
+   std::sort(roundTripNs.begin(), roundTripNs.end());
+   double fSum = 0;
+   for( size_t i=0; i<roundTripNs.size(); i++ )
+      fSum += (double)roundTripNs[i];
+   printf("   %-5s round trip: avg %7.2f us, p50 %7.2f us, p99 %7.2f us, errors: %d\n", s_szTransports[iType],
+      fSum / (double)roundTripNs.size() / 1000.0,
+      (double)roundTripNs[roundTripNs.size()/2] / 1000.0,
+      (double)roundTripNs[(roundTripNs.size() * 99) / 100] / 1000.0, iErrors);
+
+   _channel_destroy(&channelToChild, 0);
+   _channel_destroy(&channelToParent, 1);
+}
+
+static void _test_throughput(int iType)
+{
+   type_bench_channel channel;
+   _channel_create(&channel, iType, 0);
+
+   double fCPUStart = _cpu_ms();
+   u64 uStart = _now_ns();
+   fflush(stdout);
+   pid_t pid = fork();
+   if ( 0 == pid )
+   {
+      _channel_attach(&channel, 0);
+      for( int i=0; i<g_iMessages; i++ )
+         _channel_write(&channel, (u32)i);
+      exit(0);
+   }
+
+   _channel_attach(&channel, 0);
+   int iErrors = 0;
+   for( int i=0; i<g_iMessages; i++ )
+      if ( ! _channel_read(&channel, (u32)i) )
+         iErrors++;
+   int iStatus = 0;
+   waitpid(pid, &iStatus, 0);
+   u64 uDuration = _now_ns() - uStart;
+   double fCPU = _cpu_ms() - fCPUStart;
+
+   printf("   %-5s throughput: %9.0f msg/s, %6.1f MB/s, CPU %6.2f us/msg, errors: %d\n", s_szTransports[iType],
+      (double)g_iMessages * 1000000000.0 / (double)uDuration,
+      (double)g_iMessages * (double)g_iMessageSize * 1000.0 / (double)uDuration,
+      fCPU * 1000.0 / (double)g_iMessages, iErrors);
+
+   _channel_destroy(&channel, 0);
+}
+
+int main(int argc, char *argv[])
+{
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iRoundTrips = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-m") && i < argc-1 )
+         g_iMessages = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-s") && i < argc-1 )
+         g_iMessageSize = atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-n round trips] [-m throughput messages] [-s message size]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iRoundTrips < 100 )
+      g_iRoundTrips = 100;
+   if ( g_iMessages < 1000 )
+      g_iMessages = 1000;
+   if ( g_iMessageSize < 16 )
+      g_iMessageSize = 16;
+   if ( g_iMessageSize > MAX_PACKET_TOTAL_SIZE )
+      g_iMessageSize = MAX_PACKET_TOTAL_SIZE;
+
+   log_init_local_only("TestIPCRingBench");
+   log_disable_stdout();
+
+   printf("IPC channels: %d round trips, %d messages of %d bytes\n", g_iRoundTrips, g_iMessages, g_iMessageSize);
+   printf("Ping-pong:\n");
+   for( int i=0; i<3; i++ )
+      _test_ping_pong(i);
+   printf("Throughput:\n");
+   for( int i=0; i<3; i++ )
+      _test_throughput(i);
+   return 0;
+}
@@ -0,0 +1,161 @@
+/*
+   Log benchmark: cost of a log_line() call, as seen by the calling thread.
+      sync:  the regular log (format, open, write and close the log file on each call);
+      async: log_enable_async(): the entry goes to the log ring, the flusher thread formats and writes it.
+   Each test runs with a number of threads logging at the same time, in two patterns:
+      burst: the threads log as fast as they can (the ring can fill up and drop entries);
+      paced: the threads log a line every 500 microseconds.
+   Reports the average and 99th percentile ns per call, the dropped entries and how many of the lines
+   reached the log file.
+
+   Usage: test_log_ring_bench [-t threads] [-n lines per thread]
+*/
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware.h"
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#define BENCH_MAX_THREADS 16
+
+int g_iThreads = 4;
+int g_iLinesPerThread = 10000;
+
+typedef struct
+{
+   int iThreadIndex;
+   int iPaceMicros;
+   const char* szMarker;
+   u32* pDurations;
+} type_bench_thread;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static void* _thread_logger(void* pParam)
+{
+   type_bench_thread* pThread = (type_bench_thread*) pParam;
+   for( int i=0; i<g_iLinesPerThread; i++ )
+   {
+      u64 uStart = _now_ns();
+      log_line("[%s] Thread %d, line %d, value %u, ratio %.2f, state %s", pThread->szMarker, pThread->iThreadIndex, i, (u32)i*7, (float)i/100.0, (i%2)?"on":"off");
+      pThread->pDurations[i] = (u32)(_now_ns() - uStart);
+      if ( pThread->iPaceMicros > 0 )
+         hardware_sleep_micros(pThread->iPaceMicros);
+   }
+   return NULL;
+}
+
+static void _get_log_file_name(char* szFile)
+{
+   strcpy(szFile, FOLDER_LOGS);
+   strcat(szFile, LOG_FILE_SYSTEM);
+}
+
+// Counts the lines of the test in the log file (only the logger service rotates it, it's not used here)
+static int _count_lines_in_log(const char* szMarker)
+{
+   char szTag[64];
+   snprintf(szTag, sizeof(szTag), "[%s]", szMarker);
+   int iCount = 0;
+   char szFile[MAX_FILE_PATH_SIZE];
+   _get_log_file_name(szFile);
+   FILE* fd = fopen(szFile, "r");
+   if ( NULL == fd )
+      return 0;
+   char szLine[1024];
+   while ( NULL != fgets(szLine, sizeof(szLine), fd) )
+      if ( NULL != strstr(szLine, szTag) )
+         iCount++;
+   fclose(fd);
+   return iCount;
+}
+
+// Truncates the log file (the async log keeps it opened)
+static void _reset_log_files()
+{
+   char szFile[MAX_FILE_PATH_SIZE];
+   _get_log_file_name(szFile);
+   if ( 0 != truncate(szFile, 0) )
+      unlink(szFile);
+}
+
+static void _run_test(const char* szMarker, int iPaceMicros)
+{
+   type_bench_thread threads[BENCH_MAX_THREADS];
+   pthread_t threadIds[BENCH_MAX_THREADS];
+   int iTotal = g_iThreads * g_iLinesPerThread;
+   u32* pDurations = (u32*) malloc(iTotal * sizeof(u32));
+   log_flush();
+   _reset_log_files();
+   u32 uDroppedStart = log_get_dropped_count();
+
+   u64 uStart = _now_ns();
+   for( int i=0; i<g_iThreads; i++ )
+   {
+      threads[i].iThreadIndex = i;
+      threads[i].iPaceMicros = iPaceMicros;
+      threads[i].szMarker = szMarker;
+      threads[i].pDurations = pDurations + i * g_iLinesPerThread;
+      pthread_create(&threadIds[i], NULL, &_thread_logger, &threads[i]);
+   }
+   for( int i=0; i<g_iThreads; i++ )
+      pthread_join(threadIds[i], NULL);
+   u64 uDuration = _now_ns() - uStart;
+   log_flush();
+
+   u64 uSum = 0;
+   for( int i=0; i<iTotal; i++ )
+      uSum += pDurations[i];
+   std::sort(pDurations, pDurations + iTotal);
+   u32 uDropped = log_get_dropped_count() - uDroppedStart;
+   int iWritten = _count_lines_in_log(szMarker);
+
+   printf("   %-12s %6d calls in %5d ms: avg %8.0f ns/call, p99 %8u ns/call, %5u dropped, %6d written (%s)\n",
+      szMarker, iTotal, (int)(uDuration/1000000), (double)uSum / (double)iTotal, pDurations[(iTotal*99)/100],
+      uDropped, iWritten, ((u32)iWritten + uDropped == (u32)iTotal) ? "ok" : "MISMATCH");
+   free(pDurations);
+}
+
+int main(int argc, char *argv[])
+{
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iThreads = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iLinesPerThread = atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-t threads] [-n lines per thread]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iThreads < 1 )
+      g_iThreads = 1;
+   if ( g_iThreads > BENCH_MAX_THREADS )
+      g_iThreads = BENCH_MAX_THREADS;
+   if ( g_iLinesPerThread < 100 )
+      g_iLinesPerThread = 100;
+
+   mkdir(FOLDER_LOGS, 0777);
+
+   log_init_local_only("TestLogRingBench");
+   log_disable_stdout();
+
+   printf("%d threads, %d lines per thread\n", g_iThreads, g_iLinesPerThread);
+   _run_test("sync-burst", 0);
+   _run_test("sync-paced", 500);
+   log_enable_async();
+   _run_test("async-burst", 0);
+   _run_test("async-paced", 500);
+   return 0;
+}
@@ -0,0 +1,182 @@
+/*
+   Model settings files benchmark.
+   Saves a default vehicle model to a test folder and measures, for the text model file (version 10)
+   and for its binary copy (.mdb):
+      save:   saveToFile() (text file, backup file and binary file) and the binary file alone;
+      load:   parsing the text file, loading the binary file, and loadFromFile();
+      reload: the old change check (open the text file and parse the save counter) and
+              reloadFromFileIfChanged() on an unchanged file.
+   Also checks that the model loaded from the binary file is the same as the one loaded from the text file.
+
+   Usage: test_model_settings_bench [-n iterations]
+*/
+
+#include "../base/base.h"
+#include "../base/models.h"
+
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define BENCH_FOLDER "/tmp/ruby_bench_model/"
+
+int g_iIterations = 2000;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static void _print_result(const char* szName, u64 uDurationNs, int iCount)
+{
+   printf("   %-34s %9.1f us/op\n", szName, (double)uDurationNs / 1000.0 / (double)iCount);
+}
+
+// Moves the modification time of the file in the past, as for a model file saved a while ago
+static void _set_old_mtime(const char* szFile)
+{
+   struct timeval times[2];
+   gettimeofday(&times[0], NULL);
+   times[0].tv_sec -= 60;
+   times[1] = times[0];
+   utimes(szFile, times);
+}
+
+// The change check done by Model::reloadIfChanged() before the binary model files
+// (it didn't skip the stamp line, so it never found the save counter of version 10 files)
+static int _old_reload_check(const char* szFile, int iSaveCount)
+{
+   FILE* fd = fopen(szFile, "r");
+   if ( NULL == fd )
+      return -1;
+   int iV = 0, iS = 0;
+   int iChanged = 0;
+   if ( 1 == fscanf(fd, "%*s %d", &iV) )
+   if ( 1 == fscanf(fd, "%*s %d", &iS) )
+   if ( iS != iSaveCount )
+      iChanged = 1;
+   fclose(fd);
+   return iChanged;
+}
+
+static bool _files_are_equal(const char* szFile1, const char* szFile2)
+{
+   char szComm[256];
+   snprintf(szComm, sizeof(szComm), "cmp -s %s %s", szFile1, szFile2);
+   return (0 == system(szComm));
+}
+
+int main(int argc, char *argv[])
+{
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iIterations = atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-n iterations]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iIterations < 10 )
+      g_iIterations = 10;
+
+   log_init_local_only("TestModelSettingsBench");
+   log_disable_stdout();
+
+   mkdir(BENCH_FOLDER, 0777);
+   const char* szFile = BENCH_FOLDER "vehicle.mdl";
+   const char* szFileText = BENCH_FOLDER "vehicle_text.mdl";
+   const char* szFileBinary = BENCH_FOLDER "vehicle_binary.mdl";
+
+   Model model;
+   model.resetToDefaults(true);
+   strcpy(model.vehicle_name, "Bench");
+   model.saveToFile(szFile, false);
+
+   struct stat statFile;
+   stat(szFile, &statFile);
+   int iTextSize = (int)statFile.st_size;
+   stat(BENCH_FOLDER "vehicle.mdb", &statFile);
+   printf("Model file: text %d bytes, binary %d bytes, %d iterations\n", iTextSize, (int)statFile.st_size, g_iIterations);
+
+   // Save
+
+   u64 uStart = _now_ns();
+   for( int i=0; i<g_iIterations; i++ )
+      model.saveToFile(szFile, false);
+   _print_result("save (text + backup + binary)", _now_ns() - uStart, g_iIterations);
+
+   uStart = _now_ns();
+   for( int i=0; i<g_iIterations; i++ )
+      model.saveToBinaryFile(szFile);
+   _print_result("save binary only", _now_ns() - uStart, g_iIterations);
+
+   _set_old_mtime(szFile);
+   model.saveToBinaryFile(szFile);
+
+   // Load
+
+   Model modelText;
+   Model modelBinary;
+   int iFailed = 0;
+   uStart = _now_ns();
+   for( int i=0; i<g_iIterations; i++ )
+      if ( ! modelText.loadFromTextFile(szFile) )
+         iFailed++;
+   _print_result("load text", _now_ns() - uStart, g_iIterations);
+
+   uStart = _now_ns();
+   for( int i=0; i<g_iIterations; i++ )
+      if ( ! modelBinary.loadFromBinaryFile(szFile) )
+         iFailed++;
+   _print_result("load binary", _now_ns() - uStart, g_iIterations);
+
+   Model modelLoad;
+   uStart = _now_ns();
+   for( int i=0; i<g_iIterations; i++ )
+      if ( ! modelLoad.loadFromFile(szFile, true) )
+         iFailed++;
+   _print_result("loadFromFile (binary, validated)", _now_ns() - uStart, g_iIterations);
+
+   // The model loaded from the binary file must be the same as the one loaded from the text file
+   Model modelCheck;
+   modelCheck.loadFromFile(szFile, true);
+   modelText.saveToFile(szFileText, false);
+   modelCheck.saveToFile(szFileBinary, false);
+   bool bSame = _files_are_equal(szFileText, szFileBinary);
+
+   // Reload checks
+
+   int iSaveCount = model.getSaveCount();
+   int iChanged = 0;
+   uStart = _now_ns();
+   for( int i=0; i<g_iIterations; i++ )
+      iChanged += _old_reload_check(szFile, iSaveCount);
+   _print_result("reload check, old (text parse)", _now_ns() - uStart, g_iIterations);
+
+   uStart = _now_ns();
+   for( int i=0; i<g_iIterations; i++ )
+      if ( ! modelLoad.reloadFromFileIfChanged(szFile, true) )
+         iFailed++;
+   _print_result("reload check, new (file signature)", _now_ns() - uStart, g_iIterations);
+
+   // A changed text file (i.e. written by some other process or software version) is detected
+   model.saveToFile(szFile, false);
+   FILE* fd = fopen(szFile, "a");
+   if ( NULL != fd )
+   {
+      fprintf(fd, "\n");
+      fclose(fd);
+   }
+   bool bStaleDetected = ! modelBinary.loadFromBinaryFile(szFile);
+   bool bReloaded = modelLoad.reloadFromFileIfChanged(szFile, true) && (modelLoad.getSaveCount() == model.getSaveCount());
+
+   printf("Failed operations: %d, old check changes: %d, binary load same as text load: %s, stale binary detected: %s, reload after change: %s\n",
+      iFailed, iChanged, bSame?"yes":"NO", bStaleDetected?"yes":"NO", bReloaded?"yes":"NO");
+
+   system("rm -rf " BENCH_FOLDER);
+   return 0;
+}
@@ -0,0 +1,427 @@
+/*
+   Model settings sync benchmark.
+   Sends the vehicle model settings to the controller, as the response to COMMAND_ID_GET_ALL_PARAMS_ZIP,
+   over a virtual radio link (the vehicle and the controller sides are in this process), in two ways:
+      full:  the model file as a tar+gzip archive (shell commands on both sides);
+      delta: the changes of the model file against the version the controller already has (model_sync.h).
+   For a few changes of the vehicle model settings (stats only, a few settings, many settings) and a few
+   link profiles, reports the response size, the packets and bytes sent on air (with the resends of the lost
+   packets), the time spent on the vehicle, on the link and on the controller (until the received model is
+   loaded) and checks that the controller got the same model file as the vehicle.
+   Uses the model sync base files in the config folder (the sent bases are restored at the end).
+
+   Usage: test_model_sync_bench [-p base port]
+*/
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/commands.h"
+#include "../base/hardware.h"
+#include "../base/hardware_radio.h"
+#include "../base/hardware_radio_virtual.h"
+#include "../base/hw_procs.h"
+#include "../base/models.h"
+#include "../base/model_sync.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+
+#define BENCH_VEHICLE_FOLDER "/tmp/ruby_bench_model_sync/vehicle/"
+#define BENCH_CONTROLLER_FOLDER "/tmp/ruby_bench_model_sync/controller/"
+#define BENCH_VEHICLE_MODEL_FILE BENCH_VEHICLE_FOLDER "current_vehicle.mdl"
+#define BENCH_VEHICLE_ID 0x5EB0C001
+#define BENCH_RESEND_TIMEOUT_MICROS 50000
+#define BENCH_MAX_SENDS 20
+
+int g_iBasePort = 7460;
+
+typedef struct
+{
+   const char* szName;
+   const char* szConfig;
+} type_link_profile;
+
+typedef struct
+{
+   int iResponseLength;
+   int iPacketsSent;
+   int iBytesOnAir;
+   u64 uVehicleMicros;
+   u64 uLinkMicros;
+   u64 uControllerMicros;
+   bool bSame;
+} type_bench_result;
+
+static const char* s_szChanges[] = { "stats", "settings", "many" };
+
+static int s_iFdRead = -1;
+static u32 s_uPacketIndex = 0;
+static u8 s_uVehicleModelFile[MODEL_SYNC_MAX_FILE_SIZE];
+static u8 s_uControllerModelFile[MODEL_SYNC_MAX_FILE_SIZE];
+static u8 s_uBuffer[MODEL_SYNC_MAX_FILE_SIZE];
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static void _execute(const char* szFormat, const char* szFolder)
+{
+   char szComm[256];
+   snprintf(szComm, sizeof(szComm), szFormat, szFolder, szFolder);
+   hw_execute_bash_command(szComm, NULL);
+}
+
+// Vehicle: the model file as tar+gzip, as the vehicle did before the model sync
+
+static int _vehicle_build_full(u8* pOutput)
+{
+   _execute("rm -rf %smodel.tar* 2>/dev/null", BENCH_VEHICLE_FOLDER);
+   _execute("rm -rf %smodel.mdl 2>/dev/null", BENCH_VEHICLE_FOLDER);
+   _execute("cp -rf " BENCH_VEHICLE_MODEL_FILE " %smodel.mdl 2>/dev/null", BENCH_VEHICLE_FOLDER);
+   _execute("tar -C %s -cf %smodel.tar model.mdl 2>&1", BENCH_VEHICLE_FOLDER);
+   _execute("gzip %smodel.tar 2>&1", BENCH_VEHICLE_FOLDER);
+   int iLength = model_sync_read_file(BENCH_VEHICLE_FOLDER "model.tar.gz", pOutput, MAX_PACKET_PAYLOAD);
+   _execute("rm -rf %smodel.tar*", BENCH_VEHICLE_FOLDER);
+   _execute("rm -rf %smodel.mdl", BENCH_VEHICLE_FOLDER);
+   return iLength;
+}
+
+// Vehicle: the changes against the version the controller has, as in ruby_rx_commands. -1 if it's not possible
+static int _vehicle_build_delta(u32 uBaseHash, u8* pOutput)
+{
+   int iLength = model_sync_read_file(BENCH_VEHICLE_MODEL_FILE, s_uVehicleModelFile, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iLength <= 0 )
+      return -1;
+   model_sync_save_sent_base(s_uVehicleModelFile, iLength);
+   if ( 0 == uBaseHash )
+      return -1;
+   int iBaseLength = model_sync_load_sent_base(uBaseHash, s_uBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iBaseLength < 0 )
+      return -1;
+   return model_sync_encode_delta(s_uBuffer, iBaseLength, s_uVehicleModelFile, iLength, pOutput, MODEL_SYNC_MAX_DELTA_SIZE);
+}
+
+// Controller: rebuilds the model file (tar+gzip archive or changes), loads it and keeps it as the base for the next changes.
+// Returns the length of the model file, -1 on failure
+static int _controller_receive(u8* pData, int iLength, int iResponseParam)
+{
+   if ( iResponseParam == MODEL_SYNC_RESPONSE_PARAM_DELTA )
+   {
+      int iBaseLength = model_sync_load_received_base(BENCH_VEHICLE_ID, s_uBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+      if ( iBaseLength < 0 )
+         return -1;
+      int iModelLength = model_sync_apply_delta(s_uBuffer, iBaseLength, pData, iLength, s_uControllerModelFile, MODEL_SYNC_MAX_FILE_SIZE);
+      if ( iModelLength < 0 )
+         return -1;
+      FILE* fd = fopen(BENCH_CONTROLLER_FOLDER "model.mdl", "wb");
+      if ( NULL == fd )
+         return -1;
+      fwrite(s_uControllerModelFile, 1, iModelLength, fd);
+      fclose(fd);
+   }
+   else
+   {
+      _execute("rm -rf %smodel.mdl", BENCH_CONTROLLER_FOLDER);
+      FILE* fd = fopen(BENCH_CONTROLLER_FOLDER "last_recv_model.tar.gz", "wb");
+      if ( NULL == fd )
+         return -1;
+      fwrite(pData, 1, iLength, fd);
+      fclose(fd);
+      _execute("gzip -df %slast_recv_model.tar.gz 2>&1", BENCH_CONTROLLER_FOLDER);
+      _execute("tar -C %s -xf %slast_recv_model.tar 2>&1", BENCH_CONTROLLER_FOLDER);
+   }
+
+   Model modelTemp;
+   if ( ! modelTemp.loadFromFile(BENCH_CONTROLLER_FOLDER "model.mdl", true) )
+      return -1;
+   int iModelLength = model_sync_read_file(BENCH_CONTROLLER_FOLDER "model.mdl", s_uControllerModelFile, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iModelLength > 0 )
+      model_sync_save_received_base(BENCH_VEHICLE_ID, s_uControllerModelFile, iModelLength);
+   return iModelLength;
+}
+
+static bool _open_link(const char* szConfig)
+{
+   type_radio_virtual_config config;
+   hardware_radio_virtual_get_default_config(&config);
+   hardware_radio_virtual_parse_config(szConfig, &config);
+   config.iCount = 1;
+   config.iBasePort = g_iBasePort;
+
+   // The tx side is opened as the vehicle, the rx side as the controller
+   config.iSide = VIRTUAL_RADIO_SIDE_VEHICLE;
+   hardware_radio_virtual_set_config(&config);
+   hardware_reset_radio_enumerated_flag();
+   hardware_enumerate_radio_interfaces();
+   radio_init_link_structures();
+   if ( radio_open_interface_for_write(0) < 0 )
+      return false;
+   config.iSide = VIRTUAL_RADIO_SIDE_STATION;
+   hardware_radio_virtual_set_config(&config);
+   s_iFdRead = radio_open_interface_for_read(0, RADIO_PORT_ROUTER_DOWNLINK);
+   if ( s_iFdRead < 0 )
+   {
+      radio_close_interface_for_write(0);
+      return false;
+   }
+   return true;
+}
+
+static void _close_link()
+{
+   radio_close_interface_for_read(0);
+   radio_close_interface_for_write(0);
+   s_iFdRead = -1;
+}
+
+// Sends the command response until the controller side receives it (as the controller resends the command).
+// Returns the length of the received response data, -1 if it was never received
+static int _send_over_link(u8* pData, int iLength, int iResponseParam, type_bench_result* pResult, u8* pReceived)
+{
+   t_packet_header PH;
+   radio_packet_init(&PH, PACKET_COMPONENT_COMMANDS, PACKET_TYPE_COMMAND_RESPONSE, STREAM_ID_DATA);
+   PH.vehicle_id_src = BENCH_VEHICLE_ID;
+   PH.vehicle_id_dest = 0;
+   PH.total_length = sizeof(t_packet_header) + sizeof(t_packet_header_command_response) + iLength;
+
+   t_packet_header_command_response PHCR;
+   memset(&PHCR, 0, sizeof(t_packet_header_command_response));
+   PHCR.origin_command_type = COMMAND_ID_GET_ALL_PARAMS_ZIP;
+   PHCR.command_response_flags = COMMAND_RESPONSE_FLAGS_OK;
+   PHCR.command_response_param = iResponseParam;
+
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   for( int iSend=0; iSend<BENCH_MAX_SENDS; iSend++ )
+   {
+      PH.stream_packet_idx = s_uPacketIndex++;
+      memcpy(packet, &PH, sizeof(t_packet_header));
+      memcpy(packet + sizeof(t_packet_header), &PHCR, sizeof(t_packet_header_command_response));
+      memcpy(packet + sizeof(t_packet_header) + sizeof(t_packet_header_command_response), pData, iLength);
+      int iRawLength = radio_build_new_raw_packet(0, rawPacket, packet, PH.total_length, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+      if ( radio_write_raw_packet(0, rawPacket, iRawLength) > 0 )
+      {
+         pResult->iPacketsSent++;
+         pResult->iBytesOnAir += iRawLength;
+      }
+
+      u64 uTimeEnd = _now_micros() + BENCH_RESEND_TIMEOUT_MICROS;
+      u64 uNow = _now_micros();
+      while ( uNow < uTimeEnd )
+      {
+         fd_set readSet;
+         FD_ZERO(&readSet);
+         FD_SET(s_iFdRead, &readSet);
+         struct timeval tv;
+         tv.tv_sec = 0;
+         tv.tv_usec = (int)(uTimeEnd - uNow);
+         if ( select(s_iFdRead+1, &readSet, NULL, NULL, &tv) > 0 )
+         while ( true )
+         {
+            int iPacketLength = 0;
+            u8* pPacket = radio_process_wlan_data_in(0, &iPacketLength);
+            if ( NULL == pPacket )
+               break;
+            t_packet_header* pPHRecv = (t_packet_header*)pPacket;
+            if ( pPHRecv->packet_type != PACKET_TYPE_COMMAND_RESPONSE )
+               continue;
+            int iDataLength = (int)pPHRecv->total_length - (int)sizeof(t_packet_header) - (int)sizeof(t_packet_header_command_response);
+            memcpy(pReceived, pPacket + sizeof(t_packet_header) + sizeof(t_packet_header_command_response), iDataLength);
+            return iDataLength;
+         }
+         uNow = _now_micros();
+      }
+   }
+   return -1;
+}
+
+static void _apply_changes(Model* pModel, int iChanges)
+{
+   pModel->m_Stats.uCurrentOnTime += 35;
+   pModel->m_Stats.uTotalOnTime += 35;
+   pModel->m_Stats.uTotalFlights++;
+   if ( iChanges < 1 )
+      return;
+   pModel->video_link_profiles[0].bitrate_fixed_bps = 7000000;
+   pModel->osd_params.layout = 2;
+   pModel->camera_params[0].profiles[0].brightness = 60;
+   if ( iChanges < 2 )
+      return;
+   strcpy(pModel->vehicle_name, "Bench Renamed");
+   for( int i=0; i<MAX_VIDEO_LINK_PROFILES; i++ )
+      pModel->video_link_profiles[i].bitrate_fixed_bps = 3000000 + i * 500000;
+   for( int i=0; i<MODEL_CAMERA_PROFILES; i++ )
+   {
+      pModel->camera_params[0].profiles[i].brightness = 40 + i;
+      pModel->camera_params[0].profiles[i].contrast = 60 + i;
+      pModel->camera_params[0].profiles[i].saturation = 110 + i;
+   }
+}
+
+// Runs one sync (full or delta) of the current vehicle model file to the controller
+static bool _run_sync(bool bDelta, type_bench_result* pResult)
+{
+   memset(pResult, 0, sizeof(type_bench_result));
+   u8 uResponse[MAX_PACKET_PAYLOAD];
+   u8 uReceived[MAX_PACKET_TOTAL_SIZE];
+
+   u32 uBaseHash = 0;
+   int iBaseLength = model_sync_load_received_base(BENCH_VEHICLE_ID, s_uBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iBaseLength > 0 )
+      uBaseHash = model_sync_get_hash(s_uBuffer, iBaseLength);
+
+   u64 uStart = _now_micros();
+   int iResponseParam = 1;
+   int iLength = -1;
+   if ( bDelta )
+      iLength = _vehicle_build_delta(uBaseHash, uResponse);
+   if ( iLength > 0 )
+      iResponseParam = MODEL_SYNC_RESPONSE_PARAM_DELTA;
+   else
+      iLength = _vehicle_build_full(uResponse);
+   u64 uLinkStart = _now_micros();
+   pResult->uVehicleMicros = uLinkStart - uStart;
+   pResult->iResponseLength = iLength;
+   if ( iLength <= 0 )
+      return false;
+
+   int iReceivedLength = _send_over_link(uResponse, iLength, iResponseParam, pResult, uReceived);
+   u64 uControllerStart = _now_micros();
+   pResult->uLinkMicros = uControllerStart - uLinkStart;
+   if ( iReceivedLength != iLength )
+      return false;
+
+   int iModelLength = _controller_receive(uReceived, iReceivedLength, iResponseParam);
+   pResult->uControllerMicros = _now_micros() - uControllerStart;
+
+   int iVehicleModelLength = model_sync_read_file(BENCH_VEHICLE_MODEL_FILE, s_uVehicleModelFile, MODEL_SYNC_MAX_FILE_SIZE);
+   pResult->bSame = (iModelLength > 0) && (iModelLength == iVehicleModelLength) && (0 == memcmp(s_uControllerModelFile, s_uVehicleModelFile, iModelLength));
+   return true;
+}
+
+static void _print_result(const char* szProfile, const char* szChanges, const char* szMode, type_bench_result* pResult)
+{
+   printf("   %-6s %-9s %-6s %5d bytes, %2d packets, %5d bytes on air, vehicle %7.2f ms, link %7.2f ms, controller %7.2f ms, total %7.2f ms %s\n",
+      szProfile, szChanges, szMode, pResult->iResponseLength, pResult->iPacketsSent, pResult->iBytesOnAir,
+      (double)pResult->uVehicleMicros/1000.0, (double)pResult->uLinkMicros/1000.0, (double)pResult->uControllerMicros/1000.0,
+      (double)(pResult->uVehicleMicros + pResult->uLinkMicros + pResult->uControllerMicros)/1000.0,
+      pResult->bSame ? "ok" : "MISMATCH");
+}
+
+int main(int argc, char *argv[])
+{
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-p") && i < argc-1 )
+         g_iBasePort = atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-p base port]\n", argv[0]);
+         return 0;
+      }
+   }
+
+   log_init_local_only("TestModelSyncBench");
+   log_disable_stdout();
+
+   hw_execute_bash_command("mkdir -p " BENCH_VEHICLE_FOLDER " " BENCH_CONTROLLER_FOLDER " " FOLDER_CONFIG, NULL);
+
+   // Keep the sent bases of this device
+   u8* pSentBases[MODEL_SYNC_MAX_SENT_BASES];
+   int iSentBasesLength[MODEL_SYNC_MAX_SENT_BASES];
+   char szFormat[MAX_FILE_PATH_SIZE];
+   char szFile[MAX_FILE_PATH_SIZE];
+   strcpy(szFormat, FOLDER_CONFIG);
+   strcat(szFormat, FILE_CONFIG_MODEL_SYNC_SENT_BASE);
+   for( int i=0; i<MODEL_SYNC_MAX_SENT_BASES; i++ )
+   {
+      pSentBases[i] = (u8*) malloc(MODEL_SYNC_MAX_FILE_SIZE);
+      sprintf(szFile, szFormat, i);
+      iSentBasesLength[i] = model_sync_read_file(szFile, pSentBases[i], MODEL_SYNC_MAX_FILE_SIZE);
+   }
+
+   type_link_profile profiles[] = {
+      { "fast", "" },
+      { "slow", "rate=250000,latency=5000" },
+      { "lossy", "rate=250000,latency=5000,loss=25,seed=3" },
+   };
+   int iProfilesCount = sizeof(profiles)/sizeof(profiles[0]);
+   int iChangesCount = sizeof(s_szChanges)/sizeof(s_szChanges[0]);
+
+   int iFailed = 0;
+   for( int p=0; p<iProfilesCount; p++ )
+   {
+      if ( ! _open_link(profiles[p].szConfig) )
+      {
+         printf("Failed to open the virtual radio interfaces (base port %d): %s\n", g_iBasePort, strerror(errno));
+         return 1;
+      }
+      for( int c=0; c<iChangesCount; c++ )
+      {
+         // Initial sync: the controller has no base yet
+         Model model;
+         model.resetToDefaults(true);
+         model.uVehicleId = BENCH_VEHICLE_ID;
+         strcpy(model.vehicle_name, "Bench");
+         model.saveToFile(BENCH_VEHICLE_MODEL_FILE, false);
+         model_sync_delete_received_base(BENCH_VEHICLE_ID);
+         type_bench_result result;
+         if ( (! _run_sync(true, &result)) || (! result.bSame) )
+         {
+            _print_result(profiles[p].szName, "initial", "full", &result);
+            iFailed++;
+            continue;
+         }
+         if ( 0 == c )
+            _print_result(profiles[p].szName, "initial", "full", &result);
+
+         _apply_changes(&model, c);
+         model.saveToFile(BENCH_VEHICLE_MODEL_FILE, false);
+
+         // Delta first: the full sync replaces the base of the controller
+         if ( ! _run_sync(true, &result) )
+            iFailed++;
+         else if ( ! result.bSame )
+            iFailed++;
+         _print_result(profiles[p].szName, s_szChanges[c], "delta", &result);
+
+         if ( ! _run_sync(false, &result) )
+            iFailed++;
+         else if ( ! result.bSame )
+            iFailed++;
+         _print_result(profiles[p].szName, s_szChanges[c], "full", &result);
+      }
+      _close_link();
+   }
+
+   model_sync_delete_received_base(BENCH_VEHICLE_ID);
+   for( int i=0; i<MODEL_SYNC_MAX_SENT_BASES; i++ )
+   {
+      sprintf(szFile, szFormat, i);
+      unlink(szFile);
+      if ( iSentBasesLength[i] >= 0 )
+      {
+         FILE* fd = fopen(szFile, "wb");
+         if ( NULL != fd )
+         {
+            fwrite(pSentBases[i], 1, iSentBasesLength[i], fd);
+            fclose(fd);
+         }
+      }
+      free(pSentBases[i]);
+   }
+   hw_execute_bash_command("rm -rf /tmp/ruby_bench_model_sync", NULL);
+
+   if ( iFailed )
+   {
+      printf("Model sync benchmark: %d syncs failed!\n", iFailed);
+      return 1;
+   }
+   return 0;
+}
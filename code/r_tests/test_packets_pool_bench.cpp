@@ -0,0 +1,357 @@
+/*
+   Packets pool benchmark.
+   Compares the video packets buffers allocated one by one with malloc (old tx/rx video buffers)
+   with the buffers of a packets pool (current tx/rx video buffers):
+      alloc: ns per buffer alloc+free, steady state (hot buffers);
+      tx set: the buffers of all the tx video blocks, all written by the tx path;
+      rx set: the buffers of all the rx video blocks stack slots, only the received packets slots
+              written (copied), or none of them when the packets are referenced from the rx queue buffers (zero copy).
+   Each set runs in its own child process and reports the RSS growth and the minor page faults
+   after allocating and after using the buffers, plus the time to store one received packet.
+
+   Usage: test_packets_pool_bench [-d data packets] [-e ec packets] [-s video data size] [-n iterations]
+*/
+
+#include "../base/base.h"
+#include "../base/packets_pool.h"
+#include "../radio/radiopackets2.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int g_iDataPackets = 12;
+int g_iECPackets = 6;
+int g_iVideoDataSize = 1024;
+int g_iIterations = 1000000;
+volatile u32 g_uSink = 0;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static long _get_rss_kb()
+{
+   long lPages = 0, lResident = 0;
+   FILE* fd = fopen("/proc/self/statm", "r");
+   if ( NULL == fd )
+      return 0;
+   if ( 2 != fscanf(fd, "%ld %ld", &lPages, &lResident) )
+      lResident = 0;
+   fclose(fd);
+   return lResident * (sysconf(_SC_PAGESIZE)/1024);
+}
+
+static long _get_minor_faults()
+{
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_minflt;
+}
+
+typedef struct
+{
+   long lRSSStart;
+   long lFaultsStart;
+   long lRSSAlloc;
+   long lFaultsAlloc;
+   long lRSSUse;
+   long lFaultsUse;
+} type_mem_sample;
+
+static void _sample_start(type_mem_sample* pSample)
+{
+   pSample->lRSSStart = _get_rss_kb();
+   pSample->lFaultsStart = _get_minor_faults();
+}
+
+static void _sample_alloc(type_mem_sample* pSample)
+{
+   pSample->lRSSAlloc = _get_rss_kb() - pSample->lRSSStart;
+   pSample->lFaultsAlloc = _get_minor_faults() - pSample->lFaultsStart;
+}
+
+static void _sample_use(type_mem_sample* pSample)
+{
+   pSample->lRSSUse = _get_rss_kb() - pSample->lRSSStart;
+   pSample->lFaultsUse = _get_minor_faults() - pSample->lFaultsStart;
+}
+
+static void _print_sample(const char* szName, int iBuffers, type_mem_sample* pSample, double fNsPerPacket)
+{
+   printf("%-22s %8d %12ld %12ld %12ld %12ld %10.1f\n", szName, iBuffers,
+      pSample->lRSSAlloc, pSample->lFaultsAlloc, pSample->lRSSUse, pSample->lFaultsUse, fNsPerPacket);
+   fflush(stdout);
+}
+
+static void _run_alloc_bench()
+{
+   // Keep a window of buffers alive, like the blocks of a video stack, and cycle through it
+   const int iWindow = g_iDataPackets + g_iECPackets;
+   u8* pBuffers[MAX_TOTAL_PACKETS_IN_BLOCK];
+   type_packets_pool pool;
+   packets_pool_init(&pool, "Bench", MAX_PACKET_TOTAL_SIZE, 4*MAX_TOTAL_PACKETS_IN_BLOCK, 0);
+
+   for( int iTest=0; iTest<2; iTest++ )
+   {
+      for( int i=0; i<iWindow; i++ )
+         pBuffers[i] = (0 == iTest) ? (u8*)malloc(MAX_PACKET_TOTAL_SIZE) : packets_pool_alloc(&pool);
+
+      u64 uStart = _now_ns();
+      for( int n=0; n<g_iIterations; n++ )
+      {
+         int i = n % iWindow;
+         if ( 0 == iTest )
+         {
+            free(pBuffers[i]);
+            pBuffers[i] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+         }
+         else
+         {
+            packets_pool_release(&pool, pBuffers[i]);
+            pBuffers[i] = packets_pool_alloc(&pool);
+         }
+         pBuffers[i][0] = (u8)n;
+      }
+      u64 uTime = _now_ns() - uStart;
+
+      for( int i=0; i<iWindow; i++ )
+      {
+         g_uSink += pBuffers[i][0];
+         if ( 0 == iTest )
+            free(pBuffers[i]);
+         else
+            packets_pool_release(&pool, pBuffers[i]);
+      }
+      printf("%-22s %10.1f ns per buffer alloc+free\n", (0 == iTest)?"malloc":"packets pool", (double)uTime/(double)g_iIterations);
+   }
+
+   // Reference count overhead: ref+release of a held buffer
+   u8* pBuffer = packets_pool_alloc(&pool);
+   u64 uStart = _now_ns();
+   for( int n=0; n<g_iIterations; n++ )
+   {
+      packets_pool_ref(&pool, pBuffer + 100);
+      packets_pool_release(&pool, pBuffer + 100);
+   }
+   u64 uTime = _now_ns() - uStart;
+   packets_pool_release(&pool, pBuffer);
+   printf("%-22s %10.1f ns per ref+release\n", "packets pool", (double)uTime/(double)g_iIterations);
+   packets_pool_log_stats(&pool);
+   type_packets_pool_stats* pStats = packets_pool_get_stats(&pool);
+   printf("Pool counters: allocs %u, frees %u, refs %u, failed allocs %u, max in use %d\n",
+      pStats->uAllocs, pStats->uFrees, pStats->uRefs, pStats->uFailedAllocs, pStats->iMaxInUse);
+   packets_pool_uninit(&pool);
+}
+
+// Tx: every slot of every block gets a full packet written, as the blocks cycle through the tx buffers
+
+static void _run_tx_set(int iMode)
+{
+   bool bPool = (0 != iMode);
+   int iSlots = g_iDataPackets + g_iECPackets;
+   if ( g_iDataPackets > g_iECPackets )
+      iSlots = 2*g_iDataPackets;
+   if ( iSlots > MAX_TOTAL_PACKETS_IN_BLOCK )
+      iSlots = MAX_TOTAL_PACKETS_IN_BLOCK;
+   int iCount = MAX_RXTX_BLOCKS_BUFFER * iSlots;
+   u8** pBuffers = (u8**) malloc(MAX_RXTX_BLOCKS_BUFFER * MAX_TOTAL_PACKETS_IN_BLOCK * sizeof(u8*));
+   u8 uPacket[MAX_PACKET_TOTAL_SIZE];
+   memset(uPacket, 0x55, sizeof(uPacket));
+   type_packets_pool pool;
+   type_mem_sample sample;
+   memset(&sample, 0, sizeof(type_mem_sample));
+
+   _sample_start(&sample);
+   if ( bPool )
+      packets_pool_init(&pool, "VideoTx", MAX_PACKET_TOTAL_SIZE, MAX_RXTX_BLOCKS_BUFFER*MAX_TOTAL_PACKETS_IN_BLOCK, (2 == iMode)?PACKETS_POOL_FLAG_HUGE_PAGES:0);
+   for( int i=0; i<iCount; i++ )
+      pBuffers[i] = bPool ? packets_pool_alloc(&pool) : (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+   _sample_alloc(&sample);
+
+   // First pass touches the buffers, second pass is the steady state timing
+   int iPacketSize = g_iVideoDataSize + (int)sizeof(t_packet_header) + (int)sizeof(t_packet_header_video_full_77);
+   u64 uTime = 0;
+   for( int iPass=0; iPass<2; iPass++ )
+   {
+      u64 uStart = _now_ns();
+      for( int i=0; i<iCount; i++ )
+         memcpy(pBuffers[i], uPacket, iPacketSize);
+      uTime = _now_ns() - uStart;
+      if ( 0 == iPass )
+         _sample_use(&sample);
+   }
+
+   const char* szNames[] = { "tx set, malloc", "tx set, pool", "tx set, pool huge pg" };
+   _print_sample(szNames[iMode], iCount, &sample, (double)uTime/(double)iCount);
+
+   for( int i=0; i<iCount; i++ )
+   {
+      if ( bPool )
+         packets_pool_release(&pool, pBuffers[i]);
+      else
+         free(pBuffers[i]);
+   }
+   if ( bPool )
+      packets_pool_uninit(&pool);
+   free(pBuffers);
+}
+
+// Rx: the stack has a buffer for each possible packet of each block; only the received packets slots are used
+
+static void _run_rx_set(int iMode)
+{
+   int iCount = MAX_RXTX_BLOCKS_BUFFER * MAX_TOTAL_PACKETS_IN_BLOCK;
+   int iUsedSlots = g_iDataPackets + g_iECPackets;
+   u8** pBuffers = (u8**) malloc(iCount * sizeof(u8*));
+   u8** pRefs = (u8**) malloc(iCount * sizeof(u8*));
+   type_packets_pool pool;
+   type_packets_pool poolRadioRx;
+   type_mem_sample sample;
+   memset(&sample, 0, sizeof(type_mem_sample));
+
+   // The received radio packets queue buffers exist in all cases; they are not measured
+   packets_pool_init(&poolRadioRx, "RadioRx", MAX_PACKET_TOTAL_SIZE, 50 + iCount, 0);
+   u8* pQueue[50];
+   for( int i=0; i<50; i++ )
+   {
+      pQueue[i] = packets_pool_alloc(&poolRadioRx);
+      memset(pQueue[i], 0x33, MAX_PACKET_TOTAL_SIZE);
+   }
+
+   _sample_start(&sample);
+   if ( 0 != iMode )
+      packets_pool_init(&pool, "VideoRx", MAX_PACKET_PAYLOAD+1, iCount, 0);
+   for( int i=0; i<iCount; i++ )
+   {
+      pBuffers[i] = (0 != iMode) ? packets_pool_alloc(&pool) : (u8*)malloc(MAX_PACKET_PAYLOAD+1);
+      pRefs[i] = NULL;
+   }
+   _sample_alloc(&sample);
+
+   // Receive a full stack: copy each received packet to its slot, or reference the queue buffer
+   // (and move the queue slot to a new buffer, as the rx thread does).
+   // First pass touches the buffers, second pass (after the stack was discarded) is the steady state timing.
+   int iHeaders = (int)sizeof(t_packet_header) + (int)sizeof(t_packet_header_video_full_77);
+   int iPackets = 0;
+   int iQueueIndex = 0;
+   u64 uTime = 0;
+   for( int iPass=0; iPass<2; iPass++ )
+   {
+      for( int i=0; i<iCount; i++ )
+      {
+         if ( NULL != pRefs[i] )
+            packets_pool_release(&poolRadioRx, pRefs[i]);
+         pRefs[i] = NULL;
+      }
+      iPackets = 0;
+      u64 uStart = _now_ns();
+      for( int b=0; b<MAX_RXTX_BLOCKS_BUFFER; b++ )
+      for( int k=0; k<iUsedSlots; k++ )
+      {
+         int iSlot = b*MAX_TOTAL_PACKETS_IN_BLOCK + k;
+         u8* pPacket = pQueue[iQueueIndex];
+         if ( 2 == iMode )
+         {
+            if ( packets_pool_get_ref_count(&poolRadioRx, pPacket) > 1 )
+            {
+               packets_pool_release(&poolRadioRx, pPacket);
+               pQueue[iQueueIndex] = packets_pool_alloc(&poolRadioRx);
+               pPacket = pQueue[iQueueIndex];
+            }
+            memset(pPacket, 0x33, iHeaders + g_iVideoDataSize);
+            pRefs[iSlot] = packets_pool_ref(&poolRadioRx, pPacket + iHeaders);
+         }
+         else
+         {
+            memset(pPacket, 0x33, iHeaders + g_iVideoDataSize);
+            memcpy(pBuffers[iSlot], pPacket + iHeaders, g_iVideoDataSize);
+         }
+         iQueueIndex = (iQueueIndex+1) % 50;
+         iPackets++;
+      }
+      uTime = _now_ns() - uStart;
+      if ( 0 == iPass )
+         _sample_use(&sample);
+   }
+
+   const char* szNames[] = { "rx set, malloc", "rx set, pool copy", "rx set, pool zero copy" };
+   _print_sample(szNames[iMode], iCount, &sample, (double)uTime/(double)iPackets);
+
+   for( int i=0; i<iCount; i++ )
+   {
+      if ( NULL != pRefs[i] )
+         packets_pool_release(&poolRadioRx, pRefs[i]);
+      if ( 0 != iMode )
+         packets_pool_release(&pool, pBuffers[i]);
+      else
+         free(pBuffers[i]);
+   }
+   for( int i=0; i<50; i++ )
+      packets_pool_release(&poolRadioRx, pQueue[i]);
+   if ( 0 != iMode )
+      packets_pool_uninit(&pool);
+   packets_pool_uninit(&poolRadioRx);
+   free(pBuffers);
+   free(pRefs);
+}
+
+static void _run_in_child(void (*pFunction)(int), int iParam)
+{
+   fflush(stdout);
+   pid_t pid = fork();
+   if ( 0 == pid )
+   {
+      pFunction(iParam);
+      exit(0);
+   }
+   waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[])
+{
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-d") && i < argc-1 )
+         g_iDataPackets = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-e") && i < argc-1 )
+         g_iECPackets = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-s") && i < argc-1 )
+         g_iVideoDataSize = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iIterations = atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-d data packets] [-e ec packets] [-s video data size] [-n iterations]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( (g_iDataPackets < 1) || (g_iECPackets < 0) || (g_iDataPackets + g_iECPackets > MAX_TOTAL_PACKETS_IN_BLOCK) )
+   {
+      printf("Invalid block scheme %d/%d (max %d packets in a block).\n", g_iDataPackets, g_iECPackets, MAX_TOTAL_PACKETS_IN_BLOCK);
+      return 1;
+   }
+   if ( (g_iVideoDataSize < 100) || (g_iVideoDataSize > MAX_PACKET_PAYLOAD) )
+      g_iVideoDataSize = 1024;
+   if ( g_iIterations < 1000 )
+      g_iIterations = 1000;
+
+   log_init("TestPacketsPool");
+   log_disable();
+
+   printf("Packets pool benchmark: %d blocks in buffers, block scheme %d/%d, %d bytes video data\n\n", MAX_RXTX_BLOCKS_BUFFER, g_iDataPackets, g_iECPackets, g_iVideoDataSize);
+   _run_alloc_bench();
+
+   printf("\n%-22s %8s %12s %12s %12s %12s %10s\n", "buffers set", "buffers", "alloc_rss_kb", "alloc_faults", "use_rss_kb", "use_faults", "ns/packet");
+   _run_in_child(_run_tx_set, 0);
+   _run_in_child(_run_tx_set, 1);
+   _run_in_child(_run_tx_set, 2);
+   _run_in_child(_run_rx_set, 0);
+   _run_in_child(_run_rx_set, 1);
+   _run_in_child(_run_rx_set, 2);
+   return 0;
+}
@@ -0,0 +1,325 @@
+/*
+   H264/H265 stream parser benchmark.
+   Parses an elementary stream (captured from a camera, or generated: -g) in chunks of the
+   size the vehicle reads them (RTP payloads / camera pipe reads), and compares:
+      bytewise: the previous parser (start codes checked one byte at a time, H264 only);
+      parser: the current ParserH264 (vectorized start codes search, H264 and H265);
+      scan_bytewise / scan: only counting the start codes, one byte at a time / with parser_h26x_find_next_nalu.
+   For each it reports the throughput (MB/sec), the start codes / frames / I-frames found.
+
+   Usage: test_parser_h26x_bench [-f stream.h264|stream.h265] [-c h264|h265] [-s chunk size] [-n repeats] [-o out.csv]
+*/
+
+#include "../base/base.h"
+#include "../base/parser_h264.h"
+
+#include <time.h>
+#include <vector>
+
+int g_iChunkSize = 1400;
+int g_iRepeats = 5;
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+// The previous parser, one byte at a time (only what's needed to count the frames)
+
+class ParserH264Bytewise
+{
+   public:
+      ParserH264Bytewise() { m_uToken = MAX_U32; m_iDetectedISlices = 1; m_iParsedSlices = 0; m_uLastNALUType = 0; m_uConsecutive = 0; m_uFrames = 0; m_uIFrames = 0; }
+      void parseData(u8* pData, int iDataLength)
+      {
+         while ( iDataLength > 0 )
+         {
+            m_uToken = (m_uToken<<8) | (*pData);
+            pData++;
+            iDataLength--;
+            if ( (m_uToken & 0xFFFFFF00) != 0x0100 )
+               continue;
+            u32 uNALUType = m_uToken & 0b11111;
+            if ( (uNALUType != 1) && (uNALUType != 5) )
+               continue;
+            if ( uNALUType != m_uLastNALUType )
+            {
+               if ( m_uLastNALUType == 5 )
+                  m_iDetectedISlices = (int)m_uConsecutive;
+               m_uConsecutive = 0;
+               m_uLastNALUType = uNALUType;
+            }
+            m_uConsecutive++;
+            if ( 0 == m_iParsedSlices )
+            {
+               m_uFrames++;
+               if ( uNALUType == 5 )
+                  m_uIFrames++;
+            }
+            m_iParsedSlices++;
+            if ( m_iParsedSlices >= m_iDetectedISlices )
+               m_iParsedSlices = 0;
+         }
+      }
+      u32 m_uToken;
+      int m_iDetectedISlices;
+      int m_iParsedSlices;
+      u32 m_uLastNALUType;
+      u32 m_uConsecutive;
+      u32 m_uFrames;
+      u32 m_uIFrames;
+};
+
+static void _add_nalu(std::vector<u8>& stream, u8* pHeader, int iHeaderLength, int iPayloadLength, u32* puSeed)
+{
+   stream.push_back(0); stream.push_back(0); stream.push_back(0); stream.push_back(1);
+   for( int i=0; i<iHeaderLength; i++ )
+      stream.push_back(pHeader[i]);
+   u8 uPrev = 0xFF;
+   for( int i=0; i<iPayloadLength; i++ )
+   {
+      *puSeed = (*puSeed) * 1103515245 + 12345;
+      u8 uByte = (u8)((*puSeed) >> 16);
+      // No start code emulation (as after the encoder's emulation prevention)
+      if ( (0 == uPrev) && (uByte <= 3) )
+         uByte = 0x55;
+      stream.push_back(uByte);
+      uPrev = uByte;
+   }
+}
+
+// Generates a stream like a camera does: parameter sets and I slices every keyframe, P slices otherwise
+
+static void _generate_stream(std::vector<u8>& stream, bool bH265, int iFrames, int iSlices, int iKeyframeInterval, u32* puFrames, u32* puIFrames)
+{
+   u32 uSeed = 1234;
+   *puFrames = 0;
+   *puIFrames = 0;
+   for( int f=0; f<iFrames; f++ )
+   {
+      bool bIFrame = (0 == (f % iKeyframeInterval));
+      int iFrameSize = bIFrame?80000:14000;
+      u8 header[3];
+      if ( bIFrame )
+      {
+         if ( bH265 )
+         {
+            for( u8 uType=H265_NALU_TYPE_VPS; uType<=H265_NALU_TYPE_PPS; uType++ )
+            {
+               header[0] = uType << 1; header[1] = 1;
+               _add_nalu(stream, header, 2, 24, &uSeed);
+            }
+         }
+         else
+         {
+            header[0] = 0x67; _add_nalu(stream, header, 1, 24, &uSeed);
+            header[0] = 0x68; _add_nalu(stream, header, 1, 6, &uSeed);
+         }
+      }
+      for( int s=0; s<iSlices; s++ )
+      {
+         // The first bit of the slice header: first_mb_in_slice == 0 (H264), first_slice_segment_in_pic_flag (H265)
+         u8 uSliceStart = (0 == s)?0x80:0x40;
+         if ( bH265 )
+         {
+            header[0] = (bIFrame?H265_NALU_TYPE_IDR_W_RADL:1) << 1; header[1] = 1; header[2] = uSliceStart;
+            _add_nalu(stream, header, 3, iFrameSize/iSlices, &uSeed);
+         }
+         else
+         {
+            header[0] = bIFrame?0x65:0x41; header[1] = uSliceStart;
+            _add_nalu(stream, header, 2, iFrameSize/iSlices, &uSeed);
+         }
+      }
+      (*puFrames)++;
+      if ( bIFrame )
+         (*puIFrames)++;
+   }
+}
+
+static int _count_start_codes_bytewise(u8* pData, int iLength)
+{
+   int iCount = 0;
+   u32 uToken = MAX_U32;
+   for( int i=0; i<iLength; i++ )
+   {
+      uToken = (uToken<<8) | pData[i];
+      if ( (uToken & 0xFFFFFF00) == 0x0100 )
+         iCount++;
+   }
+   return iCount;
+}
+
+static int _count_start_codes(u8* pData, int iLength)
+{
+   int iCount = 0;
+   int iPos = 0;
+   while ( iPos < iLength )
+   {
+      int iNALU = parser_h26x_find_next_nalu(pData, iPos, iLength);
+      if ( (iNALU < 0) || (iNALU >= iLength) )
+         break;
+      iCount++;
+      iPos = iNALU;
+   }
+   return iCount;
+}
+
+static void _run(const char* szStream, std::vector<u8>& stream, bool bH265, u32 uExpectedFrames, u32 uExpectedIFrames, FILE* fdOut)
+{
+   u8* pData = &stream[0];
+   int iLength = (int)stream.size();
+   double dMB = (double)iLength * (double)g_iRepeats / 1000000.0;
+
+   // Start codes only, on the whole stream
+   u64 uTime = _now_micros();
+   int iCount = 0;
+   for( int r=0; r<g_iRepeats; r++ )
+      iCount = _count_start_codes_bytewise(pData, iLength);
+   uTime = _now_micros() - uTime;
+   fprintf(fdOut, "%s,scan_bytewise,%d,%.1f,%d,,\n", szStream, iLength, dMB * 1000000.0 / (double)(uTime+1), iCount);
+
+   uTime = _now_micros();
+   for( int r=0; r<g_iRepeats; r++ )
+      iCount = _count_start_codes(pData, iLength);
+   uTime = _now_micros() - uTime;
+   fprintf(fdOut, "%s,scan,%d,%.1f,%d,,\n", szStream, iLength, dMB * 1000000.0 / (double)(uTime+1), iCount);
+
+   // Full parsers, in chunks
+   // (For H264 both parsers learn the slices per frame on the first I-frame, so they must find the same frames)
+   if ( ! bH265 )
+   {
+      ParserH264Bytewise* pOld = NULL;
+      uTime = _now_micros();
+      for( int r=0; r<g_iRepeats; r++ )
+      {
+         if ( NULL != pOld )
+            delete pOld;
+         pOld = new ParserH264Bytewise();
+         for( int i=0; i<iLength; i += g_iChunkSize )
+            pOld->parseData(pData + i, (iLength - i < g_iChunkSize)?(iLength - i):g_iChunkSize);
+      }
+      uTime = _now_micros() - uTime;
+      fprintf(fdOut, "%s,bytewise,%d,%.1f,,%u,%u\n", szStream, iLength, dMB * 1000000.0 / (double)(uTime+1), pOld->m_uFrames, pOld->m_uIFrames);
+      uExpectedFrames = pOld->m_uFrames;
+      uExpectedIFrames = pOld->m_uIFrames;
+      delete pOld;
+   }
+
+   u32 uFrames = 0;
+   u32 uIFrames = 0;
+   uTime = _now_micros();
+   for( int r=0; r<g_iRepeats; r++ )
+   {
+      ParserH264 parser;
+      parser.init(1, bH265);
+      uFrames = 0;
+      uIFrames = 0;
+      for( int i=0; i<iLength; i += g_iChunkSize )
+      {
+         if ( parser.parseData(pData + i, (iLength - i < g_iChunkSize)?(iLength - i):g_iChunkSize, (u32)(i/1000)) )
+         {
+            uFrames++;
+            if ( parser.IsInsideIFrame() )
+               uIFrames++;
+         }
+      }
+   }
+   uTime = _now_micros() - uTime;
+   fprintf(fdOut, "%s,parser,%d,%.1f,,%u,%u\n", szStream, iLength, dMB * 1000000.0 / (double)(uTime+1), uFrames, uIFrames);
+   if ( uExpectedFrames > 0 )
+   if ( (uFrames != uExpectedFrames) || (uIFrames != uExpectedIFrames) )
+      fprintf(fdOut, "# ERROR: %s: expected %u frames (%u I-frames), parser found %u (%u)\n", szStream, uExpectedFrames, uExpectedIFrames, uFrames, uIFrames);
+   fflush(fdOut);
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+   const char* szInFile = NULL;
+   bool bH265 = false;
+   bool bCodecSet = false;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-f") && i < argc-1 )
+         szInFile = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-c") && i < argc-1 )
+      {
+         bH265 = (0 == strcmp(argv[++i], "h265"));
+         bCodecSet = true;
+      }
+      else if ( 0 == strcmp(argv[i], "-s") && i < argc-1 )
+         g_iChunkSize = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iRepeats = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-f stream.h264|stream.h265] [-c h264|h265] [-s chunk size] [-n repeats] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iChunkSize < 1 )
+      g_iChunkSize = 1400;
+   if ( g_iRepeats < 1 )
+      g_iRepeats = 1;
+
+   log_init_local_only("TestParserH26xBench");
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+   fprintf(fdOut, "# H264/H265 parser benchmark, %d bytes chunks, %d repeats\n", g_iChunkSize, g_iRepeats);
+   fprintf(fdOut, "stream,method,bytes,mb_per_sec,start_codes,frames,iframes\n");
+
+   if ( NULL != szInFile )
+   {
+      FILE* fd = fopen(szInFile, "rb");
+      if ( NULL == fd )
+      {
+         printf("Can't open input stream %s\n", szInFile);
+         return 1;
+      }
+      std::vector<u8> stream;
+      u8 buffer[65536];
+      int iRead = 0;
+      while ( (iRead = (int)fread(buffer, 1, sizeof(buffer), fd)) > 0 )
+         stream.insert(stream.end(), buffer, buffer + iRead);
+      fclose(fd);
+      if ( (! bCodecSet) && ((NULL != strstr(szInFile, ".h265")) || (NULL != strstr(szInFile, ".hevc"))) )
+         bH265 = true;
+      if ( stream.size() < 4 )
+      {
+         printf("Input stream %s is too small.\n", szInFile);
+         return 1;
+      }
+      _run(bH265?"file_h265":"file_h264", stream, bH265, 0, 0, fdOut);
+   }
+   else
+   {
+      u32 uFrames = 0;
+      u32 uIFrames = 0;
+      std::vector<u8> streamH264;
+      _generate_stream(streamH264, false, 1200, 4, 30, &uFrames, &uIFrames);
+      _run("gen_h264", streamH264, false, 0, 0, fdOut);
+
+      std::vector<u8> streamH265;
+      _generate_stream(streamH265, true, 1200, 4, 30, &uFrames, &uIFrames);
+      _run("gen_h265", streamH265, true, uFrames, uIFrames, fdOut);
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+   return 0;
+}
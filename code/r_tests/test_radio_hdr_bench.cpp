@@ -0,0 +1,253 @@
+/*
+   Radio tx frame building benchmark: radio_build_new_raw_packet (radiotap + IEEE
+   headers and payload copied into a new buffer for each packet) vs the per
+   interface header templates sent with scatter-gather io (payload not copied).
+
+   Each packet switches between two datarates, as the vehicle does for video and
+   data packets. Frames are sent on a loopback UDP socket (unless -x is used) so
+   the syscall cost of a contiguous buffer vs a two entries iovec is included.
+
+   Usage: test_radio_hdr_bench [-n packets] [-x] [-o out.csv]
+
+   Reports per payload size and builder: bytes copied per packet, ns per packet
+   and if the frames produced by the two builders are identical.
+*/
+
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+#include "../radio/radioflags.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BENCH_BUILDER_COPY 0
+#define BENCH_BUILDER_TEMPLATE 1
+#define BENCH_BUILDER_COUNT 2
+
+static const char* s_szBuilderNames[BENCH_BUILDER_COUNT] = { "copy", "template" };
+
+int g_iPacketsPerTest = 200000;
+bool g_bSend = true;
+int g_iSocketTx = -1;
+int g_iSocketRx = -1;
+int g_iDataRates[2] = { -3, 6000000 };
+int g_iPort = 0;
+
+typedef struct
+{
+   double fBytesCopiedPerPacket;
+   double fNsPerPacket;
+} type_bench_result;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static bool _open_sockets()
+{
+   g_iSocketRx = socket(AF_INET, SOCK_DGRAM, 0);
+   g_iSocketTx = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( (g_iSocketRx < 0) || (g_iSocketTx < 0) )
+      return false;
+
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port = 0;
+   if ( 0 != bind(g_iSocketRx, (struct sockaddr*)&addr, sizeof(addr)) )
+      return false;
+   socklen_t len = sizeof(addr);
+   if ( 0 != getsockname(g_iSocketRx, (struct sockaddr*)&addr, &len) )
+      return false;
+   // Nobody reads the rx socket: once its buffer is full the frames are dropped by the kernel, the send still completes
+   if ( 0 != connect(g_iSocketTx, (struct sockaddr*)&addr, sizeof(addr)) )
+      return false;
+   return true;
+}
+
+static void _build_packet(u8* pPacket, int iLength)
+{
+   t_packet_header PH;
+   radio_packet_init(&PH, PACKET_COMPONENT_VIDEO, PACKET_TYPE_VIDEO_DATA_FULL, STREAM_ID_VIDEO_1);
+   PH.vehicle_id_src = 1;
+   PH.vehicle_id_dest = 0;
+   PH.total_length = iLength;
+   for( int i=0; i<iLength; i++ )
+      pPacket[i] = rand() % 256;
+   memcpy(pPacket, (u8*)&PH, sizeof(t_packet_header));
+}
+
+// Both builders must produce the same frame (except the IEEE seq number)
+
+static bool _check_same_output(int iLength)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 packetCopy[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   _build_packet(packet, iLength);
+   memcpy(packetCopy, packet, iLength);
+
+   bool bSame = true;
+   for( int r=0; r<2; r++ )
+   {
+      radio_init_link_structures();
+      radio_set_out_datarate(g_iDataRates[r]);
+      radio_set_frames_flags(RADIO_FLAGS_FRAME_TYPE_DATA | ((g_iDataRates[r] < 0)?RADIO_FLAG_LDPC_VEHICLE:0));
+
+      memcpy(packet, packetCopy, iLength);
+      int iTotal = radio_build_new_raw_packet(0, rawPacket, packet, iLength, g_iPort, 0, 0, NULL);
+
+      u8* pHeader = NULL;
+      radio_prepare_packets_for_tx(1, packet, iLength);
+      int iHeader = radio_get_tx_header_template(0, g_iPort, &pHeader);
+
+      if ( iHeader + iLength != iTotal )
+         return false;
+      for( int i=0; i<iHeader; i++ )
+      {
+         if ( (i == iHeader-2) || (i == iHeader-1) )
+            continue;
+         if ( pHeader[i] != rawPacket[i] )
+            bSame = false;
+      }
+      if ( 0 != memcmp(packet, rawPacket + iHeader, iLength) )
+         bSame = false;
+   }
+   return bSame;
+}
+
+static type_bench_result _run_test(int iBuilder, int iLength)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   _build_packet(packet, iLength);
+
+   radio_init_link_structures();
+   u64 uBytesCopied = 0;
+   u32 uTemplatesBuiltStart = radio_tx_get_batch_stats(0)->uHeaderTemplatesBuilt;
+   int iTemplateLength = 0;
+
+   u64 uTimeStart = _now_ns();
+   for( int i=0; i<g_iPacketsPerTest; i++ )
+   {
+      int iRate = g_iDataRates[i%2];
+      radio_set_out_datarate(iRate);
+      radio_set_frames_flags(RADIO_FLAGS_FRAME_TYPE_DATA | ((iRate < 0)?RADIO_FLAG_LDPC_VEHICLE:0));
+
+      if ( iBuilder == BENCH_BUILDER_COPY )
+      {
+         int iTotal = radio_build_new_raw_packet(0, rawPacket, packet, iLength, g_iPort, 0, 0, NULL);
+         uBytesCopied += iTotal;
+         if ( g_bSend )
+            send(g_iSocketTx, rawPacket, iTotal, MSG_DONTWAIT);
+      }
+      else
+      {
+         u8* pHeader = NULL;
+         radio_prepare_packets_for_tx(0, packet, iLength);
+         iTemplateLength = radio_get_tx_header_template(0, g_iPort, &pHeader);
+         uBytesCopied += 2; // IEEE seq number
+         if ( g_bSend )
+         {
+            struct iovec iov[2];
+            iov[0].iov_base = pHeader;
+            iov[0].iov_len = iTemplateLength;
+            iov[1].iov_base = packet;
+            iov[1].iov_len = iLength;
+            writev(g_iSocketTx, iov, 2);
+         }
+      }
+   }
+   u64 uTime = _now_ns() - uTimeStart;
+
+   if ( iBuilder == BENCH_BUILDER_TEMPLATE )
+      uBytesCopied += (u64)(radio_tx_get_batch_stats(0)->uHeaderTemplatesBuilt - uTemplatesBuiltStart) * iTemplateLength;
+
+   type_bench_result result;
+   result.fBytesCopiedPerPacket = (double)uBytesCopied / (double)g_iPacketsPerTest;
+   result.fNsPerPacket = (double)uTime / (double)g_iPacketsPerTest;
+   return result;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-x") )
+         g_bSend = false;
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iPacketsPerTest = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-n packets] [-x] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iPacketsPerTest < 100 )
+      g_iPacketsPerTest = 100;
+
+   log_init_local_only("TestRadioHdrBench");
+   log_disable_stdout();
+   srand(1);
+
+   if ( g_bSend && (! _open_sockets()) )
+   {
+      printf("Failed to open loopback sockets: %s\n", strerror(errno));
+      return 1;
+   }
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   fprintf(fdOut, "# Radio tx frame builder benchmark: %d packets per test, send: %s\n", g_iPacketsPerTest, g_bSend?"loopback udp":"no");
+   fprintf(fdOut, "builder,payload,bytes_copied_per_packet,ns_per_packet,result\n");
+
+   int iSizes[] = { 64, 256, 1024, MAX_PACKET_PAYLOAD };
+   int iFailed = 0;
+   for( int s=0; s<(int)(sizeof(iSizes)/sizeof(iSizes[0])); s++ )
+   {
+      bool bSame = _check_same_output(iSizes[s]);
+      if ( ! bSame )
+         iFailed++;
+      for( int b=0; b<BENCH_BUILDER_COUNT; b++ )
+      {
+         type_bench_result result = _run_test(b, iSizes[s]);
+         fprintf(fdOut, "%s,%d,%.1f,%.1f,%s\n", s_szBuilderNames[b], iSizes[s], result.fBytesCopiedPerPacket, result.fNsPerPacket, bSame?"ok":"MISMATCH");
+      }
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+   if ( g_iSocketTx >= 0 )
+      close(g_iSocketTx);
+   if ( g_iSocketRx >= 0 )
+      close(g_iSocketRx);
+
+   if ( iFailed )
+   {
+      printf("Radio header benchmark: %d payload sizes produced different frames!\n", iFailed);
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,369 @@
+/*
+   Retransmissions index benchmark.
+   Simulates the vehicle tx video blocks buffers and a controller that sends retransmission requests (NACKs)
+   for the lost video packets, and compares how the vehicle services the requests:
+      scan: the old history of requested segments (array scanned for each requested segment, compacted
+            when it expires), the block buffer computed from the current block, every request resent;
+      index: the retransmissions index (blocks ring + requested segments hash table), resends of the same
+            segment de-duplicated while in flight.
+   The simulation runs in 1 ms steps: one new video block every 4 ms, each packet lost with the given
+   probability (resent packets too), the controller requests up to 20 missing packets every 10 ms for
+   100 ms and sends each request on multiple radio links (the vehicle gets duplicated requests).
+   Reports, per profile: requests and segments serviced, resends sent, packets recovered,
+   ns per request (avg, p99, max) and the memory used by the history structures.
+
+   Usage: test_retransmissions_index_bench [-t simulated ms] [-l loss percent] [-c request copies] [-s seed]
+*/
+
+#include "../base/base.h"
+#include "../base/retransmissions_index.h"
+#include "../radio/radiopackets2.h"
+
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#define BENCH_MAX_REQUEST_SEGMENTS 20
+#define BENCH_OLD_MAX_HISTORY 200
+#define BENCH_PACKET_SIZE 1300
+
+int g_iSimulatedMs = 20000;
+int g_iBlockPackets = 12;
+int g_iBlockECs = 6;
+int g_iBlockIntervalMs = 4;
+int g_iRetransmissionWindowMs = 100;
+u32 g_uSeed = 1;
+volatile u32 g_uSink = 0;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static u32 s_uRandom = 1;
+static u32 _random()
+{
+   s_uRandom = s_uRandom * 1103515245 + 12345;
+   return (s_uRandom >> 16) & 0x7FFF;
+}
+
+// ----------------------------------------------------
+// Vehicle tx buffers
+
+typedef struct
+{
+   u32 uVideoBlockIndex;
+   u8 packets[MAX_TOTAL_PACKETS_IN_BLOCK][BENCH_PACKET_SIZE];
+} type_bench_tx_block;
+
+type_bench_tx_block* g_pTxBlocks = NULL;
+int g_iCurrentBuffer = 0;
+u32 g_uCurrentBlock = 0;
+u8 g_uSentPacket[BENCH_PACKET_SIZE];
+
+static void _resend(int iBuffer, int iPacket)
+{
+   memcpy(g_uSentPacket, g_pTxBlocks[iBuffer].packets[iPacket], BENCH_PACKET_SIZE);
+   g_uSink += g_uSentPacket[iPacket];
+}
+
+// ----------------------------------------------------
+// Old history: linear scan
+
+typedef struct
+{
+   u32 video_block_index;
+   u8 video_packet_index;
+   u32 uReceiveTime;
+   u8 uRepeatCount;
+} type_bench_old_history;
+
+type_bench_old_history g_OldHistory[BENCH_OLD_MAX_HISTORY];
+int g_iOldHistoryCount = 0;
+
+static bool _old_service_segment(u32 uBlock, u8 uPacket, u32 uTimeNow)
+{
+   int iDuplicate = -1;
+   for( int i=0; i<g_iOldHistoryCount; i++ )
+      if ( (g_OldHistory[i].video_block_index == uBlock) && (g_OldHistory[i].video_packet_index == uPacket) )
+      {
+         iDuplicate = i;
+         break;
+      }
+   if ( -1 != iDuplicate )
+      g_OldHistory[iDuplicate].uRepeatCount++;
+   else if ( g_iOldHistoryCount < BENCH_OLD_MAX_HISTORY )
+   {
+      g_OldHistory[g_iOldHistoryCount].video_block_index = uBlock;
+      g_OldHistory[g_iOldHistoryCount].video_packet_index = uPacket;
+      g_OldHistory[g_iOldHistoryCount].uRepeatCount = 0;
+      g_OldHistory[g_iOldHistoryCount].uReceiveTime = uTimeNow;
+      g_iOldHistoryCount++;
+   }
+
+   if ( uBlock > g_uCurrentBlock )
+      return false;
+   int diff = g_uCurrentBlock - uBlock;
+   if ( diff >= MAX_RXTX_BLOCKS_BUFFER )
+      return false;
+   int iBuffer = g_iCurrentBuffer - diff;
+   if ( iBuffer < 0 )
+      iBuffer += MAX_RXTX_BLOCKS_BUFFER;
+   if ( g_pTxBlocks[iBuffer].uVideoBlockIndex != uBlock )
+      return false;
+   _resend(iBuffer, uPacket);
+   return true;
+}
+
+static void _old_expire(u32 uTimeNow)
+{
+   for( int i=g_iOldHistoryCount-1; i>=0; i-- )
+   {
+      if ( (g_OldHistory[i].uReceiveTime == 0) || (g_OldHistory[i].uReceiveTime+500 < uTimeNow) )
+      {
+         for( int k=0; k<g_iOldHistoryCount-i-1; k++ )
+            memcpy((u8*)&(g_OldHistory[k]), (u8*)&(g_OldHistory[k+i+1]), sizeof(type_bench_old_history));
+         g_iOldHistoryCount = g_iOldHistoryCount-i-1;
+         break;
+      }
+   }
+}
+
+// ----------------------------------------------------
+// Retransmissions index
+
+type_retransmissions_index g_Index;
+
+static bool _index_service_segment(u32 uBlock, u8 uPacket, u32 uTimeNow)
+{
+   type_retransmissions_index_segment* pSegment = retransmissions_index_add_request(&g_Index, uBlock, uPacket, uTimeNow, NULL);
+   if ( uBlock > g_uCurrentBlock )
+      return false;
+   int iBuffer = retransmissions_index_find_block(&g_Index, uBlock);
+   if ( (iBuffer < 0) || (g_pTxBlocks[iBuffer].uVideoBlockIndex != uBlock) )
+      return false;
+   if ( ! retransmissions_index_should_resend(&g_Index, pSegment, uTimeNow) )
+      return false;
+   _resend(iBuffer, uPacket);
+   return true;
+}
+
+// ----------------------------------------------------
+// Controller side
+
+typedef struct
+{
+   u32 uBlock;
+   u8 uPacket;
+   u32 uTimeDelivered; // a resend of it is on the way, delivered at this time
+} type_bench_missing;
+
+typedef struct
+{
+   int iRequests;
+   int iSegments;
+   int iResends;
+   int iMissing;
+   int iRecovered;
+   double fAvgNs;
+   double fP99Ns;
+   double fMaxNs;
+   int iMemoryBytes;
+} type_bench_result;
+
+static void _run(bool bUseIndex, int iLossPercent, int iCopies, type_bench_result* pResult)
+{
+   memset(pResult, 0, sizeof(type_bench_result));
+   s_uRandom = g_uSeed;
+   g_iCurrentBuffer = 0;
+   g_uCurrentBlock = 0;
+   for( int i=0; i<MAX_RXTX_BLOCKS_BUFFER; i++ )
+      g_pTxBlocks[i].uVideoBlockIndex = MAX_U32;
+   g_iOldHistoryCount = 0;
+   retransmissions_index_reset(&g_Index);
+
+   std::vector<type_bench_missing> missing;
+   std::vector<u64> requestNs;
+   u32 uBlocksRequested[BENCH_MAX_REQUEST_SEGMENTS];
+   u8 uPacketsRequested[BENCH_MAX_REQUEST_SEGMENTS];
+
+   for( u32 uTime=1; uTime<=(u32)g_iSimulatedMs; uTime++ )
+   {
+      // New video block: the lost ones, the controller can't recover with the EC packets, are missing
+      if ( 0 == (uTime % g_iBlockIntervalMs) )
+      {
+         g_uCurrentBlock++;
+         g_iCurrentBuffer = (g_iCurrentBuffer + 1) % MAX_RXTX_BLOCKS_BUFFER;
+         g_pTxBlocks[g_iCurrentBuffer].uVideoBlockIndex = g_uCurrentBlock;
+         retransmissions_index_set_block(&g_Index, g_uCurrentBlock, g_iCurrentBuffer);
+         int iLost = 0;
+         u8 uLost[MAX_TOTAL_PACKETS_IN_BLOCK];
+         for( int i=0; i<g_iBlockPackets + g_iBlockECs; i++ )
+            if ( (int)(_random() % 100) < iLossPercent )
+               uLost[iLost++] = (u8)i;
+         if ( iLost > g_iBlockECs )
+         {
+            for( int i=0; i<iLost - g_iBlockECs; i++ )
+            {
+               type_bench_missing m = { g_uCurrentBlock, uLost[i], 0 };
+               missing.push_back(m);
+               pResult->iMissing++;
+            }
+         }
+      }
+
+      // Delivered resends; too old blocks are given up
+      for( size_t i=0; i<missing.size(); )
+      {
+         if ( ((0 != missing[i].uTimeDelivered) && (missing[i].uTimeDelivered <= uTime)) ||
+              ((missing[i].uBlock + (u32)(g_iRetransmissionWindowMs/g_iBlockIntervalMs)) < g_uCurrentBlock) )
+         {
+            if ( 0 != missing[i].uTimeDelivered )
+               pResult->iRecovered++;
+            missing[i] = missing.back();
+            missing.pop_back();
+            continue;
+         }
+         i++;
+      }
+
+      if ( 0 == (uTime % 500) )
+      {
+         if ( bUseIndex )
+            retransmissions_index_expire(&g_Index, uTime, NULL);
+         else
+            _old_expire(uTime);
+      }
+
+      if ( 0 != (uTime % 10) )
+         continue;
+
+      // Request: oldest missing first, sent on multiple radio links
+      int iCount = 0;
+      for( size_t i=0; (i<missing.size()) && (iCount < BENCH_MAX_REQUEST_SEGMENTS); i++ )
+      {
+         uBlocksRequested[iCount] = missing[i].uBlock;
+         uPacketsRequested[iCount] = missing[i].uPacket;
+         iCount++;
+      }
+      if ( 0 == iCount )
+         continue;
+
+      for( int c=0; c<iCopies; c++ )
+      {
+         u64 uStart = _now_ns();
+         bool bResent[BENCH_MAX_REQUEST_SEGMENTS];
+         for( int i=0; i<iCount; i++ )
+         {
+            if ( bUseIndex )
+               bResent[i] = _index_service_segment(uBlocksRequested[i], uPacketsRequested[i], uTime);
+            else
+               bResent[i] = _old_service_segment(uBlocksRequested[i], uPacketsRequested[i], uTime);
+         }
+         requestNs.push_back(_now_ns() - uStart);
+         pResult->iRequests++;
+         pResult->iSegments += iCount;
+
+         for( int i=0; i<iCount; i++ )
+         {
+            if ( ! bResent[i] )
+               continue;
+            pResult->iResends++;
+            if ( (int)(_random() % 100) < iLossPercent )
+               continue;
+            for( size_t k=0; k<missing.size(); k++ )
+               if ( (missing[k].uBlock == uBlocksRequested[i]) && (missing[k].uPacket == uPacketsRequested[i]) )
+               {
+                  if ( 0 == missing[k].uTimeDelivered )
+                     missing[k].uTimeDelivered = uTime + 2;
+                  break;
+               }
+         }
+      }
+   }
+
+   if ( ! requestNs.empty() )
+   {
+      std::sort(requestNs.begin(), requestNs.end());
+      double fSum = 0;
+      for( size_t i=0; i<requestNs.size(); i++ )
+         fSum += (double)requestNs[i];
+      pResult->fAvgNs = fSum / (double)requestNs.size();
+      pResult->fP99Ns = (double)requestNs[(requestNs.size() * 99) / 100];
+      pResult->fMaxNs = (double)requestNs[requestNs.size()-1];
+   }
+   pResult->iMemoryBytes = bUseIndex ? (int)sizeof(type_retransmissions_index) : (int)sizeof(g_OldHistory);
+}
+
+int main(int argc, char *argv[])
+{
+   int iCustomLoss = -1;
+   int iCustomCopies = -1;
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iSimulatedMs = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-l") && i < argc-1 )
+         iCustomLoss = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-c") && i < argc-1 )
+         iCustomCopies = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-s") && i < argc-1 )
+         g_uSeed = (u32)atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-t simulated ms] [-l loss percent] [-c request copies] [-s seed]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iSimulatedMs < 1000 )
+      g_iSimulatedMs = 1000;
+
+   log_init_local_only("TestRetransmissionsIndexBench");
+   log_disable_stdout();
+
+   g_pTxBlocks = (type_bench_tx_block*) malloc(sizeof(type_bench_tx_block) * MAX_RXTX_BLOCKS_BUFFER);
+   for( int i=0; i<MAX_RXTX_BLOCKS_BUFFER; i++ )
+   for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
+      memset(g_pTxBlocks[i].packets[k], i+k, BENCH_PACKET_SIZE);
+
+   typedef struct
+   {
+      const char* szName;
+      int iLossPercent;
+      int iCopies;
+   } type_storm_profile;
+
+   type_storm_profile profiles[] = {
+      { "light", 15, 1 },
+      { "storm", 30, 2 },
+      { "heavy", 50, 3 },
+   };
+   int iProfilesCount = sizeof(profiles)/sizeof(profiles[0]);
+   if ( (iCustomLoss >= 0) || (iCustomCopies > 0) )
+   {
+      profiles[0].szName = "custom";
+      if ( iCustomLoss >= 0 )
+         profiles[0].iLossPercent = iCustomLoss;
+      if ( iCustomCopies > 0 )
+         profiles[0].iCopies = iCustomCopies;
+      iProfilesCount = 1;
+   }
+
+   printf("# Retransmissions index benchmark: %d ms simulated, blocks %d/%d every %d ms, %d tx blocks buffers\n", g_iSimulatedMs, g_iBlockPackets, g_iBlockECs, g_iBlockIntervalMs, MAX_RXTX_BLOCKS_BUFFER);
+   printf("profile,history,requests,segments,resends,missing,recovered,avg_ns_per_request,p99_ns,max_ns,memory_bytes\n");
+   for( int p=0; p<iProfilesCount; p++ )
+   {
+      for( int m=0; m<2; m++ )
+      {
+         type_bench_result result;
+         _run((1 == m), profiles[p].iLossPercent, profiles[p].iCopies, &result);
+         printf("%s,%s,%d,%d,%d,%d,%d,%.0f,%.0f,%.0f,%d\n", profiles[p].szName, m?"index":"scan",
+            result.iRequests, result.iSegments, result.iResends, result.iMissing, result.iRecovered,
+            result.fAvgNs, result.fP99Ns, result.fMaxNs, result.iMemoryBytes);
+      }
+   }
+   free(g_pTxBlocks);
+   return 0;
+}
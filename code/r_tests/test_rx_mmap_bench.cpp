@@ -0,0 +1,339 @@
+/*
+   Radio rx path benchmark: pcap (one pcap_next call per frame) vs memory mapped
+   TPACKET_V3 ring (whole blocks of frames per wakeup).
+
+   Replays frames (from a pcap capture file, or synthesized Ruby radio frames)
+   on a tx interface and reads them back on a rx interface, using the same
+   select() + drain loop as the radio rx thread. Use a veth pair
+   (ip link add rb0 type veth peer name rb1) or a dummy interface (tx and rx
+   on the same interface) so no radio hardware is needed. Must run as root.
+
+   Usage: test_rx_mmap_bench -i rx_iface [-t tx_iface] [-f capture.pcap] [-n frames] [-m pcap|mmap|all] [-o out.csv]
+
+   Reports per backend: frames received, select() wakeups, frames per wakeup,
+   reader CPU time per frame and received packets per second.
+*/
+
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+#include "../radio/radio_rx_mmap.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+#include <vector>
+
+#define BENCH_BACKEND_PCAP 0
+#define BENCH_BACKEND_MMAP 1
+#define BENCH_BACKEND_COUNT 2
+
+static const char* s_szBackendNames[BENCH_BACKEND_COUNT] = { "pcap", "mmap" };
+
+const char* g_szRxInterface = NULL;
+const char* g_szTxInterface = NULL;
+int g_iFramesToSend = 200000;
+volatile int g_iSenderDone = 0;
+int g_iFramesSent = 0;
+volatile u32 g_uChecksum = 0;
+
+std::vector< std::vector<u8> > g_Frames;
+
+typedef struct
+{
+   int iFramesReceived;
+   int iWakeups;
+   double fCPUusPerFrame;
+   double fKpps;
+} type_bench_result;
+
+static u64 _now_us()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec/1000;
+}
+
+static u64 _thread_cpu_us()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec/1000;
+}
+
+static bool _load_frames_from_capture(const char* szFile)
+{
+   char szErrbuf[PCAP_ERRBUF_SIZE];
+   pcap_t* pPcap = pcap_open_offline(szFile, szErrbuf);
+   if ( NULL == pPcap )
+   {
+      printf("Failed to open capture file %s: %s\n", szFile, szErrbuf);
+      return false;
+   }
+   struct pcap_pkthdr* pHeader = NULL;
+   const u_char* pData = NULL;
+   while ( 1 == pcap_next_ex(pPcap, &pHeader, &pData) )
+   {
+      if ( (pHeader->caplen == 0) || (pHeader->caplen > MAX_PACKET_LENGTH_PCAP) )
+         continue;
+      g_Frames.push_back(std::vector<u8>(pData, pData + pHeader->caplen));
+   }
+   pcap_close(pPcap);
+   printf("Loaded %d frames from %s\n", (int)g_Frames.size(), szFile);
+   return g_Frames.size() > 0;
+}
+
+// Radiotap + 802.11 data header + a Ruby radio packet, sized like video packets
+
+static void _build_synthetic_frames()
+{
+   static const u8 s_uRadiotap[] = { 0x00, 0x00, 0x0c, 0x00, 0x04, 0x80, 0x00, 0x00, 0x0c, 0x08, 0x00, 0x00 };
+   static const u8 s_uIEEEHeader[] = { 0x08, 0x01, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0x13, 0x12, 0x34, 0x56, 0x78, 0x90, 0x13, 0x12, 0x34, 0x56, 0x78, 0x90, 0x00, 0x00 };
+
+   int iSizes[] = { MAX_PACKET_PAYLOAD, MAX_PACKET_PAYLOAD, MAX_PACKET_PAYLOAD, 200, 64 };
+   for( int i=0; i<(int)(sizeof(iSizes)/sizeof(iSizes[0])); i++ )
+   {
+      std::vector<u8> frame(s_uRadiotap, s_uRadiotap + sizeof(s_uRadiotap));
+      frame.insert(frame.end(), s_uIEEEHeader, s_uIEEEHeader + sizeof(s_uIEEEHeader));
+      for( int k=0; k<iSizes[i]; k++ )
+         frame.push_back((u8)(k*7+i));
+      g_Frames.push_back(frame);
+   }
+}
+
+static void* _thread_sender(void* pArg)
+{
+   int iSocket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+   if ( iSocket < 0 )
+   {
+      printf("Failed to create tx socket: %s\n", strerror(errno));
+      g_iSenderDone = 1;
+      return NULL;
+   }
+   struct ifreq ifr;
+   memset(&ifr, 0, sizeof(ifr));
+   strncpy(ifr.ifr_name, g_szTxInterface, IFNAMSIZ-1);
+   ioctl(iSocket, SIOCGIFINDEX, &ifr);
+
+   struct sockaddr_ll ll_addr;
+   memset(&ll_addr, 0, sizeof(ll_addr));
+   ll_addr.sll_family = AF_PACKET;
+   ll_addr.sll_protocol = htons(ETH_P_ALL);
+   ll_addr.sll_ifindex = ifr.ifr_ifindex;
+   if ( 0 != bind(iSocket, (struct sockaddr*)&ll_addr, sizeof(ll_addr)) )
+   {
+      printf("Failed to bind tx socket to %s: %s\n", g_szTxInterface, strerror(errno));
+      close(iSocket);
+      g_iSenderDone = 1;
+      return NULL;
+   }
+
+   g_iFramesSent = 0;
+   for( int i=0; i<g_iFramesToSend; i++ )
+   {
+      std::vector<u8>& frame = g_Frames[i % g_Frames.size()];
+      if ( write(iSocket, &frame[0], frame.size()) > 0 )
+         g_iFramesSent++;
+      else if ( errno == ENOBUFS )
+      {
+         hardware_sleep_micros(50);
+         i--;
+      }
+   }
+   close(iSocket);
+   g_iSenderDone = 1;
+   return NULL;
+}
+
+static bool _run_backend(int iBackend, type_bench_result* pResult)
+{
+   memset(pResult, 0, sizeof(type_bench_result));
+
+   pcap_t* pPcap = NULL;
+   t_radio_rx_mmap ring;
+   radio_rx_mmap_init(&ring);
+   int iFd = -1;
+
+   if ( iBackend == BENCH_BACKEND_PCAP )
+   {
+      char szErrbuf[PCAP_ERRBUF_SIZE];
+      pPcap = pcap_create(g_szRxInterface, szErrbuf);
+      if ( NULL == pPcap )
+      {
+         printf("Failed to open %s using pcap: %s\n", g_szRxInterface, szErrbuf);
+         return false;
+      }
+      pcap_set_snaplen(pPcap, 4096);
+      pcap_set_promisc(pPcap, 1);
+      pcap_set_timeout(pPcap, -1);
+      pcap_set_immediate_mode(pPcap, 1);
+      if ( pcap_activate(pPcap) != 0 )
+      {
+         printf("Failed to activate pcap on %s: %s\n", g_szRxInterface, pcap_geterr(pPcap));
+         pcap_close(pPcap);
+         return false;
+      }
+      pcap_setnonblock(pPcap, 1, szErrbuf);
+      iFd = pcap_get_selectable_fd(pPcap);
+   }
+   else
+      iFd = radio_rx_mmap_open(&ring, g_szRxInterface, NULL);
+
+   if ( iFd < 0 )
+      return false;
+
+   g_iSenderDone = 0;
+   pthread_t pThreadSender;
+   pthread_create(&pThreadSender, NULL, &_thread_sender, NULL);
+
+   u64 uTimeStart = _now_us();
+   u64 uCPUStart = _thread_cpu_us();
+   u64 uTimeLastRx = uTimeStart;
+
+   while ( 1 )
+   {
+      fd_set readSet;
+      FD_ZERO(&readSet);
+      FD_SET(iFd, &readSet);
+      struct timeval tv;
+      tv.tv_sec = 0;
+      tv.tv_usec = 20000;
+      int iRes = select(iFd+1, &readSet, NULL, NULL, &tv);
+      if ( iRes > 0 )
+      {
+         pResult->iWakeups++;
+         while ( 1 )
+         {
+            u8* pFrame = NULL;
+            int iLength = 0;
+            if ( NULL != pPcap )
+            {
+               struct pcap_pkthdr header;
+               pFrame = (u8*) pcap_next(pPcap, &header);
+               iLength = header.caplen;
+            }
+            else
+               pFrame = radio_rx_mmap_next_frame(&ring, &iLength, NULL);
+            if ( NULL == pFrame )
+               break;
+            // Touch the frame as the rx thread would when parsing the radiotap header
+            if ( iLength > 0 )
+               g_uChecksum += pFrame[0] + pFrame[iLength-1];
+            pResult->iFramesReceived++;
+         }
+         uTimeLastRx = _now_us();
+      }
+      if ( pResult->iFramesReceived >= g_iFramesToSend )
+         break;
+      if ( g_iFramesSent >= g_iFramesToSend || g_iSenderDone )
+      if ( _now_us() > uTimeLastRx + 500000 )
+         break;
+   }
+
+   u64 uCPU = _thread_cpu_us() - uCPUStart;
+   u64 uTime = _now_us() - uTimeStart;
+   pthread_join(pThreadSender, NULL);
+
+   if ( NULL != pPcap )
+      pcap_close(pPcap);
+   else
+   {
+      printf("mmap ring: %u blocks, kernel drops: %u\n", ring.uTotalBlocks, radio_rx_mmap_get_dropped_count(&ring));
+      radio_rx_mmap_close(&ring);
+   }
+
+   if ( pResult->iFramesReceived > 0 )
+      pResult->fCPUusPerFrame = (double)uCPU / (double)pResult->iFramesReceived;
+   if ( uTime > 0 )
+      pResult->fKpps = (double)pResult->iFramesReceived * 1000.0 / (double)uTime;
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szCaptureFile = NULL;
+   const char* szOutFile = NULL;
+   int iBackendFilter = -1;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-i") && i < argc-1 )
+         g_szRxInterface = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_szTxInterface = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-f") && i < argc-1 )
+         szCaptureFile = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iFramesToSend = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-m") && i < argc-1 )
+      {
+         i++;
+         for( int k=0; k<BENCH_BACKEND_COUNT; k++ )
+            if ( 0 == strcmp(argv[i], s_szBackendNames[k]) )
+               iBackendFilter = k;
+      }
+   }
+
+   if ( NULL == g_szRxInterface )
+   {
+      printf("Usage: %s -i rx_iface [-t tx_iface] [-f capture.pcap] [-n frames] [-m pcap|mmap|all] [-o out.csv]\n", argv[0]);
+      return -1;
+   }
+   if ( NULL == g_szTxInterface )
+      g_szTxInterface = g_szRxInterface;
+
+   log_init_local_only("TestRxMmapBench");
+   log_disable_stdout();
+
+   if ( NULL != szCaptureFile )
+   {
+      if ( ! _load_frames_from_capture(szCaptureFile) )
+         return -1;
+   }
+   else
+      _build_synthetic_frames();
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Failed to create output file %s\n", szOutFile);
+         return -1;
+      }
+   }
+
+   fprintf(fdOut, "backend,frames_sent,frames_rx,wakeups,frames_per_wakeup,cpu_us_per_frame,kpps\n");
+   for( int iBackend=0; iBackend<BENCH_BACKEND_COUNT; iBackend++ )
+   {
+      if ( (iBackendFilter != -1) && (iBackendFilter != iBackend) )
+         continue;
+      type_bench_result result;
+      if ( ! _run_backend(iBackend, &result) )
+      {
+         fprintf(fdOut, "%s,%d,0,0,0,0,0\n", s_szBackendNames[iBackend], g_iFramesToSend);
+         continue;
+      }
+      fprintf(fdOut, "%s,%d,%d,%d,%.2f,%.3f,%.1f\n", s_szBackendNames[iBackend], g_iFramesSent,
+         result.iFramesReceived, result.iWakeups,
+         (result.iWakeups > 0)?((double)result.iFramesReceived/(double)result.iWakeups):0.0,
+         result.fCPUusPerFrame, result.fKpps);
+      fflush(fdOut);
+   }
+
+   if ( stdout != fdOut )
+      fclose(fdOut);
+   return 0;
+}
@@ -0,0 +1,311 @@
+/*
+   Controller video rx replay benchmark.
+   Feeds a video packets trace through ProcessorRxVideo (the same path ruby_rt_station
+   uses for each received video packet: preprocess, add to the rx blocks stack,
+   reconstruct and output blocks) and reports the time spent per packet.
+
+   By default the trace is generated: a stream of data/EC blocks with random losses,
+   where lost data packets come back later as retransmitted packets (deep rx stack).
+   A trace can be saved (-w) and replayed later (-r), so the same packets can be run
+   against two builds.
+
+   Usage: test_rx_video_replay_bench [-b blocks] [-d data] [-e ec] [-l loss %] [-t retransmission delay ms]
+                                     [-i packet interval us] [-rw window ms] [-n runs] [-w trace] [-r trace]
+
+   Trace file: sequence of records: u32 receive time (ms), u16 packet length, packet bytes.
+
+   The rx state counters are printed at the end of each run: they must be the same
+   for the same trace on any build.
+*/
+
+#include "../base/base.h"
+#include "../base/models.h"
+#include "../base/models_list.h"
+#include "../base/ctrl_settings.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiopacketsqueue.h"
+#include "../r_station/processor_rx_video.h"
+#include "../r_station/shared_vars.h"
+#include "../r_station/timers.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#define BENCH_VEHICLE_ID 1234567
+
+typedef struct
+{
+   u32 uTimeMs;
+   u32 uOrder;
+   std::vector<u8> packet;
+}
+type_trace_packet;
+
+int g_iBlocks = 20000;
+int g_iDataPackets = 12;
+int g_iECPackets = 6;
+int g_iVideoDataLength = 1024;
+int g_iLossPercent = 10;
+int g_iRetransmissionDelayMs = 150;
+int g_iPacketIntervalMicros = 250;
+int g_iRetransmissionWindowMs = 500;
+
+std::vector<type_trace_packet> g_Trace;
+
+// Radio tx queue of ruby_rt_station (retransmission requests are queued here, never sent)
+t_packet_queue s_QueueRadioPackets;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static u32 _get_profile_encoding_flags()
+{
+   u32 uFlags = VIDEO_PROFILE_ENCODING_FLAG_ENABLE_RETRANSMISSIONS;
+   uFlags |= ((u32)(g_iRetransmissionWindowMs/5) << 8) & VIDEO_PROFILE_ENCODING_FLAG_MAX_RETRANSMISSION_WINDOW_MASK;
+   return uFlags;
+}
+
+static void _add_packet(u32 uTimeMs, u32 uBlockIndex, int iPacketIndex, bool bRetransmitted)
+{
+   type_trace_packet packet;
+   packet.uTimeMs = uTimeMs;
+   packet.uOrder = g_Trace.size();
+   int iLength = sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77) + g_iVideoDataLength;
+   packet.packet.resize(iLength);
+
+   t_packet_header* pPH = (t_packet_header*)&(packet.packet[0]);
+   t_packet_header_video_full_77* pPHVF = (t_packet_header_video_full_77*)(&(packet.packet[0]) + sizeof(t_packet_header));
+   radio_packet_init(pPH, PACKET_COMPONENT_VIDEO, PACKET_TYPE_VIDEO_DATA_FULL, STREAM_ID_VIDEO_1);
+   pPH->vehicle_id_src = BENCH_VEHICLE_ID;
+   pPH->vehicle_id_dest = 0;
+   pPH->total_length = iLength;
+   if ( bRetransmitted )
+      pPH->packet_flags |= PACKET_FLAGS_BIT_RETRANSMITED;
+
+   memset(pPHVF, 0, sizeof(t_packet_header_video_full_77));
+   pPHVF->video_link_profile = VIDEO_PROFILE_BEST_PERF | (VIDEO_PROFILE_BEST_PERF<<4);
+   pPHVF->video_stream_and_type = VIDEO_TYPE_H264 << 4;
+   pPHVF->uProfileEncodingFlags = _get_profile_encoding_flags();
+   pPHVF->video_width = 1280;
+   pPHVF->video_height = 720;
+   pPHVF->video_fps = 60;
+   pPHVF->block_packets = g_iDataPackets;
+   pPHVF->block_fecs = g_iECPackets;
+   pPHVF->video_data_length = g_iVideoDataLength;
+   pPHVF->video_block_index = uBlockIndex;
+   pPHVF->video_block_packet_index = iPacketIndex;
+
+   u8* pData = &(packet.packet[0]) + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77);
+   for( int i=0; i<g_iVideoDataLength; i++ )
+      pData[i] = (u8)(uBlockIndex + iPacketIndex + i);
+   g_Trace.push_back(packet);
+}
+
+static bool _trace_packet_order(const type_trace_packet& a, const type_trace_packet& b)
+{
+   if ( a.uTimeMs != b.uTimeMs )
+      return a.uTimeMs < b.uTimeMs;
+   return a.uOrder < b.uOrder;
+}
+
+static void _generate_trace()
+{
+   g_Trace.clear();
+   u64 uTimeMicros = 1000000;
+   for( int b=0; b<g_iBlocks; b++ )
+   {
+      for( int k=0; k<g_iDataPackets + g_iECPackets; k++ )
+      {
+         uTimeMicros += g_iPacketIntervalMicros;
+         if ( (rand() % 100) >= g_iLossPercent )
+         {
+            _add_packet((u32)(uTimeMicros/1000), b, k, false);
+            continue;
+         }
+         // Lost data packets are retransmitted by the vehicle (retransmissions can be lost too)
+         if ( k < g_iDataPackets )
+         if ( (rand() % 100) >= g_iLossPercent )
+            _add_packet((u32)(uTimeMicros/1000) + g_iRetransmissionDelayMs, b, k, true);
+      }
+   }
+   std::stable_sort(g_Trace.begin(), g_Trace.end(), _trace_packet_order);
+}
+
+static bool _save_trace(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "wb");
+   if ( NULL == fd )
+      return false;
+   for( size_t i=0; i<g_Trace.size(); i++ )
+   {
+      u16 uLength = g_Trace[i].packet.size();
+      fwrite(&g_Trace[i].uTimeMs, sizeof(u32), 1, fd);
+      fwrite(&uLength, sizeof(u16), 1, fd);
+      fwrite(&(g_Trace[i].packet[0]), 1, uLength, fd);
+   }
+   fclose(fd);
+   return true;
+}
+
+static bool _load_trace(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return false;
+   g_Trace.clear();
+   while ( true )
+   {
+      type_trace_packet packet;
+      u16 uLength = 0;
+      if ( 1 != fread(&packet.uTimeMs, sizeof(u32), 1, fd) )
+         break;
+      if ( 1 != fread(&uLength, sizeof(u16), 1, fd) )
+         break;
+      if ( (uLength < sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77)) || (uLength > MAX_PACKET_TOTAL_SIZE) )
+         break;
+      packet.uOrder = g_Trace.size();
+      packet.packet.resize(uLength);
+      if ( uLength != fread(&(packet.packet[0]), 1, uLength, fd) )
+         break;
+      g_Trace.push_back(packet);
+   }
+   fclose(fd);
+   return ! g_Trace.empty();
+}
+
+static void _setup_model()
+{
+   loadAllModels();
+   Model* pModel = getCurrentModel();
+   pModel->uVehicleId = BENCH_VEHICLE_ID;
+   pModel->video_params.user_selected_video_link_profile = VIDEO_PROFILE_BEST_PERF;
+   type_video_link_profile* pProfile = &(pModel->video_link_profiles[VIDEO_PROFILE_BEST_PERF]);
+   pProfile->uProfileEncodingFlags = _get_profile_encoding_flags();
+   pProfile->block_packets = g_iDataPackets;
+   pProfile->block_fecs = g_iECPackets;
+   pProfile->video_data_length = g_iVideoDataLength;
+   pProfile->bitrate_fixed_bps = 20000000;
+   pProfile->width = 1280;
+   pProfile->height = 720;
+   pProfile->fps = 60;
+   pProfile->keyframe_ms = 0;
+   g_pCurrentModel = pModel;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szTraceIn = NULL;
+   const char* szTraceOut = NULL;
+   int iRuns = 3;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-b") && i < argc-1 )
+         g_iBlocks = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-d") && i < argc-1 )
+         g_iDataPackets = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-e") && i < argc-1 )
+         g_iECPackets = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-l") && i < argc-1 )
+         g_iLossPercent = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iRetransmissionDelayMs = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-i") && i < argc-1 )
+         g_iPacketIntervalMicros = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-rw") && i < argc-1 )
+         g_iRetransmissionWindowMs = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         iRuns = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-w") && i < argc-1 )
+         szTraceOut = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-r") && i < argc-1 )
+         szTraceIn = argv[++i];
+      else
+      {
+         printf("Usage: %s [-b blocks] [-d data] [-e ec] [-l loss %%] [-t retransmission delay ms] [-i packet interval us] [-rw window ms] [-n runs] [-w trace] [-r trace]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( (g_iDataPackets < 1) || (g_iDataPackets > MAX_DATA_PACKETS_IN_BLOCK) || (g_iECPackets < 0) || (g_iECPackets > MAX_FECS_PACKETS_IN_BLOCK) )
+   {
+      printf("Invalid data/EC scheme.\n");
+      return 1;
+   }
+   if ( iRuns < 1 )
+      iRuns = 1;
+
+   log_init_local_only("TestRxVideoReplayBench");
+   log_disable_stdout();
+   srand(1);
+
+   if ( NULL != szTraceIn )
+   {
+      if ( ! _load_trace(szTraceIn) )
+      {
+         printf("Can't read trace file %s\n", szTraceIn);
+         return 1;
+      }
+      // Use the encoding params of the trace for the model
+      t_packet_header_video_full_77* pPHVF = (t_packet_header_video_full_77*)(&(g_Trace[0].packet[0]) + sizeof(t_packet_header));
+      g_iDataPackets = pPHVF->block_packets;
+      g_iECPackets = pPHVF->block_fecs;
+      g_iVideoDataLength = pPHVF->video_data_length;
+      g_iRetransmissionWindowMs = ((pPHVF->uProfileEncodingFlags & VIDEO_PROFILE_ENCODING_FLAG_MAX_RETRANSMISSION_WINDOW_MASK) >> 8) * 5;
+   }
+   else
+      _generate_trace();
+
+   if ( NULL != szTraceOut )
+   if ( ! _save_trace(szTraceOut) )
+   {
+      printf("Can't write trace file %s\n", szTraceOut);
+      return 1;
+   }
+
+   reset_ControllerSettings();
+   g_pControllerSettings = get_ControllerSettings();
+   // Don't output the video anywhere, only the rx stack processing is measured
+   g_bSearching = true;
+   _setup_model();
+
+   printf("# Rx video replay: %d packets, %d/%d data/EC, %d bytes, retransmission window %d ms\n", (int)g_Trace.size(), g_iDataPackets, g_iECPackets, g_iVideoDataLength, g_iRetransmissionWindowMs);
+   printf("run,ns_per_packet,p50_ns,p99_ns,max_us,max_blocks_in_stack,discarded_segments,discarded_lost_packets,max_packets_in_buffers\n");
+
+   for( int iRun=0; iRun<iRuns; iRun++ )
+   {
+      ProcessorRxVideo* pProcessor = new ProcessorRxVideo(BENCH_VEHICLE_ID, 0);
+      g_TimeNow = g_Trace[0].uTimeMs;
+      pProcessor->init();
+
+      std::vector<u64> samples;
+      samples.reserve(g_Trace.size());
+      u64 uTotalNs = 0;
+      for( size_t i=0; i<g_Trace.size(); i++ )
+      {
+         g_TimeNow = g_Trace[i].uTimeMs;
+         g_uTimeLastReceivedResponseToAMessage = g_TimeNow;
+         u64 uStart = _now_ns();
+         pProcessor->handleReceivedVideoPacket(0, &(g_Trace[i].packet[0]), g_Trace[i].packet.size());
+         u64 uDelta = _now_ns() - uStart;
+         samples.push_back(uDelta);
+         uTotalNs += uDelta;
+      }
+      std::sort(samples.begin(), samples.end());
+
+      shared_mem_video_stream_stats* pStats = pProcessor->getVideoDecodeStats();
+      printf("%d,%.1f,%llu,%llu,%.1f,%d,%u,%u,%d\n", iRun+1, (double)uTotalNs / (double)samples.size(),
+         (unsigned long long)samples[samples.size()/2], (unsigned long long)samples[(samples.size()-1)*99/100],
+         (double)samples[samples.size()-1]/1000.0,
+         pStats->maxBlocksAllowedInBuffers, pStats->total_DiscardedSegments, pStats->total_DiscardedLostPackets, pStats->maxPacketsInBuffers);
+
+      pProcessor->uninit();
+      delete pProcessor;
+   }
+   return 0;
+}
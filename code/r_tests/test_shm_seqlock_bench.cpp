@@ -0,0 +1,198 @@
+/*
+   Shared memory stats blocks benchmark.
+   A writer process publishes a block of the size of the radio stats (each update fills the whole block
+   with the same byte value) and the reader process copies it, as ruby_central does:
+      plain:   memcpy to/from the shared memory (no versioning);
+      seqlock: shared_mem_block_write() / shared_mem_block_read() with the block generation.
+   Two tests:
+      stress: the writer updates the block continuously; reports the torn copies (bytes from two
+              different updates) and the read cost;
+      paced:  the writer updates the block every 10 ms, the reader reads it every 1 ms; reports how
+              many reads copied the block and the average read cost.
+
+   Usage: test_shm_seqlock_bench [-r stress reads] [-t paced test ms]
+*/
+
+#include "../base/base.h"
+#include "../base/shared_mem.h"
+#include "../base/hardware.h"
+
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define BENCH_SHM_NAME "/RUBY_BENCH_SHM_SEQLOCK"
+#define BENCH_BLOCK_SIZE ((int)sizeof(shared_mem_radio_stats))
+
+int g_iStressReads = 2000000;
+int g_iPacedMs = 3000;
+
+static u64 _now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000000LL + (u64)ts.tv_nsec;
+}
+
+static bool _is_torn(u8* pBlock)
+{
+   for( int i=1; i<BENCH_BLOCK_SIZE; i++ )
+      if ( pBlock[i] != pBlock[0] )
+         return true;
+   return false;
+}
+
+// Writer process: runs until killed
+static void _writer(bool bSeqlock, int iIntervalMicros)
+{
+   u8* pBlock = (u8*) open_shared_mem_block(BENCH_SHM_NAME, BENCH_BLOCK_SIZE, 0);
+   if ( NULL == pBlock )
+      exit(1);
+   u8 uSource[BENCH_BLOCK_SIZE];
+   u8 uValue = 0;
+   while ( true )
+   {
+      uValue++;
+      memset(uSource, uValue, BENCH_BLOCK_SIZE);
+      if ( bSeqlock )
+         shared_mem_block_write(pBlock, uSource, BENCH_BLOCK_SIZE);
+      else
+         memcpy(pBlock, uSource, BENCH_BLOCK_SIZE);
+      if ( iIntervalMicros > 0 )
+         hardware_sleep_micros(iIntervalMicros);
+   }
+}
+
+static pid_t _start_writer(bool bSeqlock, int iIntervalMicros)
+{
+   shm_unlink(BENCH_SHM_NAME);
+   fflush(stdout);
+   pid_t pid = fork();
+   if ( 0 == pid )
+      _writer(bSeqlock, iIntervalMicros);
+   return pid;
+}
+
+static void _stop_writer(pid_t pid)
+{
+   kill(pid, SIGKILL);
+   waitpid(pid, NULL, 0);
+   shm_unlink(BENCH_SHM_NAME);
+}
+
+static u8* _open_reader()
+{
+   for( int i=0; i<100; i++ )
+   {
+      u8* pBlock = (u8*) open_shared_mem_block(BENCH_SHM_NAME, BENCH_BLOCK_SIZE, 1);
+      if ( NULL != pBlock )
+         return pBlock;
+      hardware_sleep_ms(5);
+   }
+   printf("Failed to open the shared memory block.\n");
+   exit(-1);
+}
+
+static void _test_stress(bool bSeqlock)
+{
+   pid_t pid = _start_writer(bSeqlock, 0);
+   u8* pBlock = _open_reader();
+   hardware_sleep_ms(50);
+
+   u8 uCopy[BENCH_BLOCK_SIZE];
+   u32 uGeneration = 0;
+   int iTorn = 0;
+   int iFailed = 0;
+   int iCopied = 0;
+   u64 uStart = _now_ns();
+   for( int i=0; i<g_iStressReads; i++ )
+   {
+      if ( bSeqlock )
+      {
+         int iResult = shared_mem_block_read(pBlock, uCopy, BENCH_BLOCK_SIZE, &uGeneration);
+         if ( SHARED_MEM_BLOCK_READ_FAILED == iResult )
+            iFailed++;
+         if ( SHARED_MEM_BLOCK_UPDATED != iResult )
+            continue;
+      }
+      else
+         memcpy(uCopy, pBlock, BENCH_BLOCK_SIZE);
+      iCopied++;
+      if ( _is_torn(uCopy) )
+         iTorn++;
+   }
+   u64 uDuration = _now_ns() - uStart;
+   _stop_writer(pid);
+   close_shared_mem_block(pBlock, BENCH_BLOCK_SIZE);
+
+   printf("   %-7s stress: %d reads, %d copies, %d torn, %d busy, %.1f ns/read\n", bSeqlock ? "seqlock" : "plain",
+      g_iStressReads, iCopied, iTorn, iFailed, (double)uDuration / (double)g_iStressReads);
+}
+
+static void _test_paced(bool bSeqlock)
+{
+   pid_t pid = _start_writer(bSeqlock, 10000);
+   u8* pBlock = _open_reader();
+   hardware_sleep_ms(50);
+
+   u8 uCopy[BENCH_BLOCK_SIZE];
+   u32 uGeneration = 0;
+   int iReads = 0;
+   int iCopied = 0;
+   int iTorn = 0;
+   u64 uReadNs = 0;
+   u64 uEnd = _now_ns() + (u64)g_iPacedMs * 1000000LL;
+   while ( _now_ns() < uEnd )
+   {
+      u64 uStart = _now_ns();
+      bool bCopied = true;
+      if ( bSeqlock )
+         bCopied = (SHARED_MEM_BLOCK_UPDATED == shared_mem_block_read(pBlock, uCopy, BENCH_BLOCK_SIZE, &uGeneration));
+      else
+         memcpy(uCopy, pBlock, BENCH_BLOCK_SIZE);
+      uReadNs += _now_ns() - uStart;
+      iReads++;
+      if ( bCopied )
+      {
+         iCopied++;
+         if ( _is_torn(uCopy) )
+            iTorn++;
+      }
+      hardware_sleep_micros(1000);
+   }
+   _stop_writer(pid);
+   close_shared_mem_block(pBlock, BENCH_BLOCK_SIZE);
+
+   printf("   %-7s paced:  %d reads, %d copies, %d torn, %.1f ns/read\n", bSeqlock ? "seqlock" : "plain",
+      iReads, iCopied, iTorn, (double)uReadNs / (double)iReads);
+}
+
+int main(int argc, char *argv[])
+{
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-r") && i < argc-1 )
+         g_iStressReads = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iPacedMs = atoi(argv[++i]);
+      else
+      {
+         printf("Usage: %s [-r stress reads] [-t paced test ms]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iStressReads < 1000 )
+      g_iStressReads = 1000;
+   if ( g_iPacedMs < 500 )
+      g_iPacedMs = 500;
+
+   log_init_local_only("TestShmSeqlockBench");
+   log_disable_stdout();
+
+   printf("Shared memory block of %d bytes\n", BENCH_BLOCK_SIZE);
+   _test_stress(false);
+   _test_stress(true);
+   _test_paced(false);
+   _test_paced(true);
+   return 0;
+}
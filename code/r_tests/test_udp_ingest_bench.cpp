@@ -0,0 +1,324 @@
+/*
+   Video UDP ingest benchmark.
+   A generator thread sends RTP datagrams (as majestic does) on the loopback interface,
+   at increasing rates; the main thread reads them using:
+      poll_recvmsg: the old majestic video source read (poll, then one recvmsg per datagram, with SO_RXQ_OVFL);
+      batch_N: the UDP batch reader, N datagrams per recvmmsg call.
+   For each reader and rate it reports the datagrams read, the kernel drops (SO_RXQ_OVFL),
+   the syscalls per second, the CPU time of the reading thread and the max sustained rate
+   (at least 99.9% of the datagrams read).
+
+   Usage: test_udp_ingest_bench [-t seconds] [-r max datagrams/sec] [-s datagram size] [-b recv buffer kb] [-p port] [-o out.csv]
+*/
+
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../base/udp_batch_reader.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+
+int g_iTestSeconds = 2;
+int g_iMaxRate = 160000;
+int g_iDatagramSize = 1400;
+int g_iRecvBufferKb = 0;
+int g_iPort = 7800;
+
+volatile int g_iSenderRate = 0;
+volatile int g_iSenderQuit = 0;
+volatile u32 g_uSenderCount = 0;
+volatile u64 g_uSenderEndTime = 0;
+
+int g_iSocketWrite = -1;
+struct sockaddr_in g_Address;
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static u64 _thread_cpu_micros()
+{
+   struct rusage usage;
+   getrusage(RUSAGE_THREAD, &usage);
+   return (u64)usage.ru_utime.tv_sec * 1000000LL + (u64)usage.ru_utime.tv_usec +
+          (u64)usage.ru_stime.tv_sec * 1000000LL + (u64)usage.ru_stime.tv_usec;
+}
+
+// Sends RTP datagrams (12 bytes header, then the payload) in bursts every 1 ms
+
+static void* _thread_rtp_generator(void* pParam)
+{
+   u8 packet[2048];
+   u16 uSeq = 0;
+   u64 uTimeStart = _now_micros();
+   int iCurrentRate = 0;
+   u32 uSentAtRate = 0;
+   memset(packet, 0, sizeof(packet));
+   packet[0] = 0x80;
+   packet[1] = 96;
+
+   while ( ! g_iSenderQuit )
+   {
+      if ( g_iSenderRate != iCurrentRate )
+      {
+         iCurrentRate = g_iSenderRate;
+         uTimeStart = _now_micros();
+         uSentAtRate = 0;
+      }
+      if ( 0 == iCurrentRate )
+      {
+         hardware_sleep_ms(5);
+         continue;
+      }
+      u64 uNow = _now_micros();
+      if ( uNow >= g_uSenderEndTime )
+      {
+         hardware_sleep_ms(1);
+         continue;
+      }
+      u32 uDue = (u32)((uNow - uTimeStart) * (u64)iCurrentRate / 1000000LL);
+      if ( uDue <= uSentAtRate )
+      {
+         hardware_sleep_micros(1000);
+         continue;
+      }
+      while ( uSentAtRate < uDue )
+      {
+         packet[2] = (u8)(uSeq >> 8);
+         packet[3] = (u8)(uSeq & 0xFF);
+         uSeq++;
+         if ( sendto(g_iSocketWrite, packet, g_iDatagramSize, 0, (struct sockaddr*)&g_Address, sizeof(g_Address)) > 0 )
+            __atomic_add_fetch(&g_uSenderCount, 1, __ATOMIC_RELAXED);
+         uSentAtRate++;
+      }
+   }
+   return NULL;
+}
+
+static int _open_read_socket()
+{
+   int iSocket = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( iSocket < 0 )
+      return -1;
+   const int optval = 1;
+   setsockopt(iSocket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+   if ( bind(iSocket, (struct sockaddr*)&g_Address, sizeof(g_Address)) < 0 )
+   {
+      close(iSocket);
+      return -1;
+   }
+   return iSocket;
+}
+
+typedef struct
+{
+   u32 uRead;
+   u32 uKernelDrops;
+   u32 uSyscalls;
+} type_ingest_result;
+
+// Same as the old majestic video source read
+
+static void _run_poll_recvmsg(int iSocket, u64 uTimeEnd, type_ingest_result* pResult)
+{
+   u8 buffer[2048];
+   u8 cmsgbuf[CMSG_SPACE(sizeof(u32))];
+   u32 uLastOverflow = 0;
+   const int optval = 1;
+   setsockopt(iSocket, SOL_SOCKET, SO_RXQ_OVFL, &optval, sizeof(optval));
+   if ( g_iRecvBufferKb > 0 )
+   {
+      int iValue = g_iRecvBufferKb * 1024;
+      if ( 0 != setsockopt(iSocket, SOL_SOCKET, SO_RCVBUFFORCE, &iValue, sizeof(iValue)) )
+         setsockopt(iSocket, SOL_SOCKET, SO_RCVBUF, &iValue, sizeof(iValue));
+   }
+   fcntl(iSocket, F_SETFL, fcntl(iSocket, F_GETFL, 0) | O_NONBLOCK);
+
+   while ( _now_micros() < uTimeEnd )
+   {
+      struct pollfd fds;
+      fds.fd = iSocket;
+      fds.events = POLLIN;
+      fds.revents = 0;
+      pResult->uSyscalls++;
+      if ( poll(&fds, 1, 1) <= 0 )
+         continue;
+      struct iovec iov = { .iov_base = (void*)buffer, .iov_len = sizeof(buffer) };
+      struct msghdr msghdr = { .msg_name = NULL, .msg_namelen = 0, .msg_iov = &iov, .msg_iovlen = 1,
+                               .msg_control = &cmsgbuf, .msg_controllen = sizeof(cmsgbuf), .msg_flags = 0 };
+      memset(cmsgbuf, 0, sizeof(cmsgbuf));
+      pResult->uSyscalls++;
+      if ( recvmsg(iSocket, &msghdr, 0) <= 0 )
+         continue;
+      pResult->uRead++;
+      for( struct cmsghdr* pCMsg = CMSG_FIRSTHDR(&msghdr); NULL != pCMsg; pCMsg = CMSG_NXTHDR(&msghdr, pCMsg) )
+      {
+         if ( (pCMsg->cmsg_level == SOL_SOCKET) && (pCMsg->cmsg_type == SO_RXQ_OVFL) )
+         {
+            u32 uOverflow = 0;
+            memcpy(&uOverflow, CMSG_DATA(pCMsg), sizeof(u32));
+            pResult->uKernelDrops += uOverflow - uLastOverflow;
+            uLastOverflow = uOverflow;
+         }
+      }
+   }
+}
+
+static void _run_batch(int iSocket, int iBatchSize, u64 uTimeEnd, type_ingest_result* pResult)
+{
+   type_udp_batch_reader reader;
+   type_udp_batch_reader_config config;
+   udp_batch_reader_get_default_config(&config);
+   config.iBatchSize = iBatchSize;
+   config.iRecvBufferKb = g_iRecvBufferKb;
+   if ( ! udp_batch_reader_init(&reader, iSocket, &config) )
+      return;
+   while ( _now_micros() < uTimeEnd )
+   {
+      u8* pData = NULL;
+      if ( udp_batch_reader_read(&reader, 1, &pData) > 0 )
+         pResult->uRead++;
+   }
+   pResult->uKernelDrops = reader.stats.uKernelDrops;
+   pResult->uSyscalls = reader.stats.uRecvCalls + reader.stats.uPollCalls;
+   udp_batch_reader_uninit(&reader);
+}
+
+// Returns the read ratio (percent)
+
+static double _run_test(int iBatchSize, int iRate, FILE* fdOut)
+{
+   g_iSenderRate = 0;
+   hardware_sleep_ms(20);
+   int iSocket = _open_read_socket();
+   if ( iSocket < 0 )
+   {
+      printf("Failed to open the read socket on port %d\n", g_iPort);
+      return 0.0;
+   }
+   type_ingest_result result;
+   memset(&result, 0, sizeof(result));
+
+   u32 uSentStart = g_uSenderCount;
+   u64 uTimeStart = _now_micros();
+   g_uSenderEndTime = uTimeStart + (u64)g_iTestSeconds * 1000000LL;
+   g_iSenderRate = iRate;
+   // Keep reading a bit after the generator stopped, for the datagrams still in the socket
+   u64 uTimeEnd = g_uSenderEndTime + 50000;
+   u64 uCPUStart = _thread_cpu_micros();
+   if ( 0 == iBatchSize )
+      _run_poll_recvmsg(iSocket, uTimeEnd, &result);
+   else
+      _run_batch(iSocket, iBatchSize, uTimeEnd, &result);
+   u64 uCPU = _thread_cpu_micros() - uCPUStart;
+   u64 uDuration = _now_micros() - uTimeStart;
+   g_iSenderRate = 0;
+   u32 uSent = g_uSenderCount - uSentStart;
+   close(iSocket);
+
+   double dRead = 0.0;
+   if ( uSent > 0 )
+      dRead = (double)result.uRead * 100.0 / (double)uSent;
+   char szReader[32];
+   if ( 0 == iBatchSize )
+      strcpy(szReader, "poll_recvmsg");
+   else
+      sprintf(szReader, "batch_%d", iBatchSize);
+   fprintf(fdOut, "%s,%d,%u,%u,%.2f,%u,%u,%.2f\n", szReader, iRate, uSent, result.uRead, dRead, result.uKernelDrops,
+      (u32)((u64)result.uSyscalls * 1000000LL / uDuration), (double)uCPU * 100.0 / (double)uDuration);
+   fflush(fdOut);
+   return dRead;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iTestSeconds = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-r") && i < argc-1 )
+         g_iMaxRate = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-s") && i < argc-1 )
+         g_iDatagramSize = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-b") && i < argc-1 )
+         g_iRecvBufferKb = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-p") && i < argc-1 )
+         g_iPort = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-t seconds] [-r max datagrams/sec] [-s datagram size] [-b recv buffer kb] [-p port] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iTestSeconds < 1 )
+      g_iTestSeconds = 1;
+   if ( g_iMaxRate < 5000 )
+      g_iMaxRate = 5000;
+   if ( (g_iDatagramSize < 16) || (g_iDatagramSize > 1472) )
+      g_iDatagramSize = 1400;
+
+   log_init_local_only("TestUDPIngestBench");
+
+   memset(&g_Address, 0, sizeof(g_Address));
+   g_Address.sin_family = AF_INET;
+   g_Address.sin_addr.s_addr = inet_addr("127.0.0.1");
+   g_Address.sin_port = htons(g_iPort);
+   g_iSocketWrite = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( g_iSocketWrite < 0 )
+      return 1;
+
+   pthread_t threadGenerator;
+   if ( 0 != pthread_create(&threadGenerator, NULL, &_thread_rtp_generator, NULL) )
+      return 1;
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   fprintf(fdOut, "# Video UDP ingest benchmark, %d seconds per test, %d bytes datagrams, recv buffer: %d kb (0: default), %d CPU cores\n",
+      g_iTestSeconds, g_iDatagramSize, g_iRecvBufferKb, (int)sysconf(_SC_NPROCESSORS_ONLN));
+   fprintf(fdOut, "reader,datagrams_per_sec,sent,read,read_percent,kernel_drops,syscalls_per_sec,reader_cpu_percent\n");
+
+   static const int s_iBatchSizes[] = { 0, 8, 16, 32 };
+   int iMaxSustained[4] = { 0, 0, 0, 0 };
+   for( int k=0; k<4; k++ )
+   {
+      for( int iRate=5000; iRate<=g_iMaxRate; iRate *= 2 )
+      {
+         double dRead = _run_test(s_iBatchSizes[k], iRate, fdOut);
+         if ( dRead < 99.9 )
+            break;
+         iMaxSustained[k] = iRate;
+      }
+   }
+   fprintf(fdOut, "# Max sustained datagrams/sec (>= 99.9%% read): poll_recvmsg: %d, batch_8: %d, batch_16: %d, batch_32: %d\n",
+      iMaxSustained[0], iMaxSustained[1], iMaxSustained[2], iMaxSustained[3]);
+
+   g_iSenderQuit = 1;
+   pthread_join(threadGenerator, NULL);
+   if ( fdOut != stdout )
+      fclose(fdOut);
+   close(g_iSocketWrite);
+   return 0;
+}
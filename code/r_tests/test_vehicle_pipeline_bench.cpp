@@ -0,0 +1,521 @@
+/*
+   Vehicle video pipeline benchmark.
+   Video UDP datagrams (as from majestic) are read, packetized into video blocks (8 data + 4 EC,
+   EC packets encoded progressively) and sent through a virtual radio interface. A consumer thread
+   reads them back on the station side using the radio rx thread.
+   Two pipeline models are tested at increasing video rates:
+      single: one thread reads the video socket, encodes and sends (the router main loop);
+      pipelined: a capture thread reads the video socket into a packets pool and hands the
+               chunks over a lock free queue (and an eventfd) to the encode thread, which
+               queues the radio packets to the async radio tx thread.
+   For each model and rate it reports the delivered ratio, the glass to air latency (video datagram
+   sent to radio packet received, percentiles), the CPU time of the encode thread and the
+   max sustained rate (at least 99% of the video datagrams delivered).
+
+   Usage: test_vehicle_pipeline_bench [-t seconds] [-r max video packets/sec] [-p base port] [-o out.csv]
+*/
+
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../base/hardware_radio.h"
+#include "../base/hardware_radio_virtual.h"
+#include "../base/event_loop.h"
+#include "../base/packets_pool.h"
+#include "../base/spsc_queue.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+#include "../radio/radio_rx.h"
+#include "../radio/fec.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#define BENCH_DATA_PACKETS 8
+#define BENCH_EC_PACKETS 4
+#define BENCH_BLOCK_SIZE 1000
+#define BENCH_CAPTURE_BUFFERS 256
+#define BENCH_CAPTURE_BUFFER_SIZE 2048
+#define BENCH_EC_FLAG ((u32)0x80000000)
+
+int g_iTestSeconds = 3;
+int g_iMaxVideoPacketsPerSecond = 16000;
+int g_iBasePort = 7700;
+
+volatile int g_iSenderRate = 0;
+volatile int g_iSenderQuit = 0;
+volatile u32 g_uSenderCount = 0;
+
+volatile int g_iConsumerQuit = 0;
+volatile int g_iConsumerCounting = 0;
+volatile u32 g_uReceivedVideoPackets = 0;
+type_latency_histogram g_GlassToAirLatency;
+pthread_mutex_t g_MutexLatency = PTHREAD_MUTEX_INITIALIZER;
+
+int g_iVideoSocketRead = -1;
+int g_iVideoSocketWrite = -1;
+struct sockaddr_in g_VideoAddress;
+
+// Pipelined capture stage
+type_packets_pool g_CapturePool;
+type_spsc_queue g_CaptureQueue;
+int g_iCaptureEventFd = -1;
+volatile int g_iCaptureQuit = 0;
+u32 g_uCaptureDropped = 0;
+
+// Encode stage state
+u8 g_DataBlocks[BENCH_DATA_PACKETS][BENCH_BLOCK_SIZE];
+u8 g_ECBlocks[BENCH_EC_PACKETS][BENCH_BLOCK_SIZE];
+u8* g_pECBlocks[BENCH_EC_PACKETS];
+int g_iBlockPacketIndex = 0;
+u32 g_uStreamPacketIndex = 0;
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static u64 _thread_cpu_micros()
+{
+   struct rusage usage;
+   getrusage(RUSAGE_THREAD, &usage);
+   return (u64)usage.ru_utime.tv_sec * 1000000LL + (u64)usage.ru_utime.tv_usec +
+          (u64)usage.ru_stime.tv_sec * 1000000LL + (u64)usage.ru_stime.tv_usec;
+}
+
+static void* _thread_video_sender(void* pParam)
+{
+   u8 packet[1400];
+   u64 uTimeStart = _now_micros();
+   int iCurrentRate = 0;
+   u32 uSentAtRate = 0;
+   memset(packet, 0, sizeof(packet));
+
+   while ( ! g_iSenderQuit )
+   {
+      if ( g_iSenderRate != iCurrentRate )
+      {
+         iCurrentRate = g_iSenderRate;
+         uTimeStart = _now_micros();
+         uSentAtRate = 0;
+      }
+      if ( 0 == iCurrentRate )
+      {
+         hardware_sleep_ms(5);
+         continue;
+      }
+      u64 uSendTime = uTimeStart + (u64)uSentAtRate * 1000000LL / (u64)iCurrentRate;
+      u64 uNow = _now_micros();
+      if ( uNow < uSendTime )
+      {
+         hardware_sleep_micros((u32)(uSendTime - uNow));
+         continue;
+      }
+      memcpy(packet, &uNow, sizeof(u64));
+      if ( sendto(g_iVideoSocketWrite, packet, sizeof(packet), 0, (struct sockaddr*)&g_VideoAddress, sizeof(g_VideoAddress)) > 0 )
+         __atomic_add_fetch(&g_uSenderCount, 1, __ATOMIC_RELAXED);
+      uSentAtRate++;
+   }
+   return NULL;
+}
+
+// Station side: consumes the radio rx queue and measures the glass to air latency of the video data packets
+
+static void* _thread_consumer(void* pParam)
+{
+   type_received_radio_packet packets[20];
+   while ( ! g_iConsumerQuit )
+   {
+      int iCount = radio_rx_get_received_packets(20, packets);
+      if ( iCount <= 0 )
+      {
+         hardware_sleep_micros(200);
+         continue;
+      }
+      u64 uTimeNow = _now_micros();
+      for( int i=0; i<iCount; i++ )
+      {
+         if ( packets[i].iPacketLength < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77) + sizeof(u64)) )
+            continue;
+         t_packet_header* pPH = (t_packet_header*)packets[i].pPacketData;
+         if ( pPH->stream_packet_idx & BENCH_EC_FLAG )
+            continue;
+         if ( ! g_iConsumerCounting )
+            continue;
+         u64 uTimeSent = 0;
+         memcpy(&uTimeSent, packets[i].pPacketData + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77), sizeof(u64));
+         pthread_mutex_lock(&g_MutexLatency);
+         latency_histogram_add(&g_GlassToAirLatency, (u32)(uTimeNow - uTimeSent));
+         pthread_mutex_unlock(&g_MutexLatency);
+         g_uReceivedVideoPackets++;
+      }
+      radio_rx_release_received_packets();
+   }
+   return NULL;
+}
+
+static bool _open_video_sockets()
+{
+   g_iVideoSocketRead = socket(AF_INET, SOCK_DGRAM, 0);
+   g_iVideoSocketWrite = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( (g_iVideoSocketRead < 0) || (g_iVideoSocketWrite < 0) )
+      return false;
+   int iBufferSize = 1024*1024;
+   setsockopt(g_iVideoSocketRead, SOL_SOCKET, SO_RCVBUF, &iBufferSize, sizeof(iBufferSize));
+   memset(&g_VideoAddress, 0, sizeof(g_VideoAddress));
+   g_VideoAddress.sin_family = AF_INET;
+   g_VideoAddress.sin_addr.s_addr = inet_addr("127.0.0.1");
+   g_VideoAddress.sin_port = htons(g_iBasePort + 100);
+   if ( bind(g_iVideoSocketRead, (struct sockaddr*)&g_VideoAddress, sizeof(g_VideoAddress)) < 0 )
+      return false;
+   fcntl(g_iVideoSocketRead, F_SETFL, fcntl(g_iVideoSocketRead, F_GETFL, 0) | O_NONBLOCK);
+   return true;
+}
+
+// Same as the vehicle video source raw read: poll the socket (iTimeoutMs), then read one datagram
+
+static int _read_video(u8* pBuffer, int iBufferSize, int iTimeoutMs)
+{
+   struct pollfd fds;
+   fds.fd = g_iVideoSocketRead;
+   fds.events = POLLIN;
+   fds.revents = 0;
+   if ( poll(&fds, 1, iTimeoutMs) <= 0 )
+      return 0;
+   int iRead = recv(g_iVideoSocketRead, pBuffer, iBufferSize, MSG_DONTWAIT);
+   if ( iRead < (int)sizeof(u64) )
+      return 0;
+   return iRead;
+}
+
+static void _send_block_packet(u8* pPayload, bool bEC)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   int iLength = sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77) + BENCH_BLOCK_SIZE;
+   t_packet_header PH;
+   radio_packet_init(&PH, PACKET_COMPONENT_VIDEO, PACKET_TYPE_VIDEO_DATA_FULL, STREAM_ID_VIDEO_1);
+   PH.vehicle_id_src = 1;
+   PH.vehicle_id_dest = 0;
+   PH.stream_packet_idx = (g_uStreamPacketIndex++) & (~BENCH_EC_FLAG);
+   if ( bEC )
+      PH.stream_packet_idx |= BENCH_EC_FLAG;
+   PH.total_length = iLength;
+   memcpy(packet, (u8*)&PH, sizeof(t_packet_header));
+   memset(packet + sizeof(t_packet_header), 0, sizeof(t_packet_header_video_full_77));
+   memcpy(packet + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77), pPayload, BENCH_BLOCK_SIZE);
+   int iRawLength = radio_build_new_raw_packet(0, rawPacket, packet, iLength, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+   radio_write_raw_packet(0, rawPacket, iRawLength);
+}
+
+// Encode stage: one video chunk becomes one data packet; the EC packets are computed progressively
+// and sent after the last data packet of the block
+
+static void _encode_and_send(u8* pData, int iLength)
+{
+   u8* pBlock = g_DataBlocks[g_iBlockPacketIndex];
+   if ( iLength > BENCH_BLOCK_SIZE )
+      iLength = BENCH_BLOCK_SIZE;
+   memcpy(pBlock, pData, iLength);
+   if ( iLength < BENCH_BLOCK_SIZE )
+      memset(pBlock + iLength, 0, BENCH_BLOCK_SIZE - iLength);
+   fec_encode_add_block(BENCH_BLOCK_SIZE, pBlock, g_iBlockPacketIndex, g_pECBlocks, BENCH_EC_PACKETS);
+   _send_block_packet(pBlock, false);
+   g_iBlockPacketIndex++;
+   if ( g_iBlockPacketIndex < BENCH_DATA_PACKETS )
+      return;
+   for( int i=0; i<BENCH_EC_PACKETS; i++ )
+      _send_block_packet(g_pECBlocks[i], true);
+   g_iBlockPacketIndex = 0;
+}
+
+static void _run_single(u64 uTimeEnd)
+{
+   u8 buffer[BENCH_CAPTURE_BUFFER_SIZE];
+   while ( _now_micros() < uTimeEnd )
+   {
+      int iRead = _read_video(buffer, sizeof(buffer), 1);
+      if ( iRead <= 0 )
+         continue;
+      radio_tx_batch_begin();
+      _encode_and_send(buffer, iRead);
+      // Consume what is already available, as the router main loop does in one iteration
+      for( int i=0; i<16; i++ )
+      {
+         iRead = _read_video(buffer, sizeof(buffer), 0);
+         if ( iRead <= 0 )
+            break;
+         _encode_and_send(buffer, iRead);
+      }
+      radio_tx_batch_flush(NULL);
+   }
+}
+
+static void* _thread_capture(void* pParam)
+{
+   while ( ! g_iCaptureQuit )
+   {
+      u8* pBuffer = packets_pool_alloc(&g_CapturePool);
+      if ( NULL == pBuffer )
+      {
+         hardware_sleep_micros(500);
+         continue;
+      }
+      int iRead = _read_video(pBuffer + sizeof(int), BENCH_CAPTURE_BUFFER_SIZE - sizeof(int), 20);
+      if ( iRead <= 0 )
+      {
+         packets_pool_release(&g_CapturePool, pBuffer);
+         continue;
+      }
+      memcpy(pBuffer, &iRead, sizeof(int));
+      if ( ! spsc_queue_push(&g_CaptureQueue, pBuffer) )
+      {
+         packets_pool_release(&g_CapturePool, pBuffer);
+         g_uCaptureDropped++;
+         continue;
+      }
+      u64 uValue = 1;
+      if ( write(g_iCaptureEventFd, &uValue, sizeof(uValue)) < 0 ) {}
+   }
+   return NULL;
+}
+
+static void _run_pipelined(u64 uTimeEnd)
+{
+   while ( _now_micros() < uTimeEnd )
+   {
+      struct pollfd fds;
+      fds.fd = g_iCaptureEventFd;
+      fds.events = POLLIN;
+      fds.revents = 0;
+      if ( poll(&fds, 1, 10) <= 0 )
+         continue;
+      event_loop_drain_fd(g_iCaptureEventFd);
+      radio_tx_batch_begin();
+      for( int i=0; i<64; i++ )
+      {
+         u8* pBuffer = (u8*)spsc_queue_pop(&g_CaptureQueue);
+         if ( NULL == pBuffer )
+            break;
+         int iLength = 0;
+         memcpy(&iLength, pBuffer, sizeof(int));
+         _encode_and_send(pBuffer + sizeof(int), iLength);
+         packets_pool_release(&g_CapturePool, pBuffer);
+      }
+      radio_tx_batch_flush(NULL);
+   }
+}
+
+static void _flush_video_socket()
+{
+   u8 buffer[BENCH_CAPTURE_BUFFER_SIZE];
+   while ( _read_video(buffer, sizeof(buffer), 0) > 0 ) {}
+}
+
+// Returns the delivered ratio (percent)
+
+static double _run_test(bool bPipelined, int iRate, FILE* fdOut)
+{
+   pthread_t threadCapture;
+   g_iBlockPacketIndex = 0;
+   g_iSenderRate = 0;
+   hardware_sleep_ms(50);
+   _flush_video_socket();
+
+   if ( bPipelined )
+   {
+      g_iCaptureQuit = 0;
+      g_uCaptureDropped = 0;
+      if ( ! radio_tx_async_start(-1) )
+         return 0.0;
+      radio_tx_async_reset_stats();
+      if ( 0 != pthread_create(&threadCapture, NULL, &_thread_capture, NULL) )
+      {
+         radio_tx_async_stop();
+         return 0.0;
+      }
+   }
+
+   pthread_mutex_lock(&g_MutexLatency);
+   latency_histogram_reset(&g_GlassToAirLatency);
+   pthread_mutex_unlock(&g_MutexLatency);
+   g_uReceivedVideoPackets = 0;
+   g_iConsumerCounting = 1;
+   u32 uSentStart = g_uSenderCount;
+   g_iSenderRate = iRate;
+
+   u64 uTimeStart = _now_micros();
+   u64 uTimeEnd = uTimeStart + (u64)g_iTestSeconds * 1000000LL;
+   u64 uCPUStart = _thread_cpu_micros();
+   if ( bPipelined )
+      _run_pipelined(uTimeEnd);
+   else
+      _run_single(uTimeEnd);
+   u64 uCPU = _thread_cpu_micros() - uCPUStart;
+   u64 uDuration = _now_micros() - uTimeStart;
+   g_iSenderRate = 0;
+   u32 uSent = g_uSenderCount - uSentStart;
+
+   // Let the in flight packets get delivered
+   if ( bPipelined )
+      _run_pipelined(_now_micros() + 100000);
+   else
+      _run_single(_now_micros() + 100000);
+   hardware_sleep_ms(100);
+   g_iConsumerCounting = 0;
+
+   u32 uQueueP99 = 0;
+   if ( bPipelined )
+   {
+      g_iCaptureQuit = 1;
+      pthread_join(threadCapture, NULL);
+      u8* pBuffer = NULL;
+      while ( NULL != (pBuffer = (u8*)spsc_queue_pop(&g_CaptureQueue)) )
+         packets_pool_release(&g_CapturePool, pBuffer);
+      uQueueP99 = latency_histogram_get_percentile(&radio_tx_async_get_stats()->queueLatency, 99);
+      radio_tx_async_stop();
+   }
+
+   double dDelivered = 0.0;
+   if ( uSent > 0 )
+      dDelivered = (double)g_uReceivedVideoPackets * 100.0 / (double)uSent;
+   pthread_mutex_lock(&g_MutexLatency);
+   fprintf(fdOut, "%s,%d,%u,%u,%.2f,%u,%u,%u,%.2f\n", bPipelined?"pipelined":"single", iRate, uSent, g_uReceivedVideoPackets, dDelivered,
+      latency_histogram_get_percentile(&g_GlassToAirLatency, 50), latency_histogram_get_percentile(&g_GlassToAirLatency, 99),
+      uQueueP99, (double)uCPU * 100.0 / (double)uDuration);
+   pthread_mutex_unlock(&g_MutexLatency);
+   fflush(fdOut);
+   return dDelivered;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-t") && i < argc-1 )
+         g_iTestSeconds = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-r") && i < argc-1 )
+         g_iMaxVideoPacketsPerSecond = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-p") && i < argc-1 )
+         g_iBasePort = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-t seconds] [-r max video packets/sec] [-p base port] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iTestSeconds < 1 )
+      g_iTestSeconds = 1;
+   if ( g_iMaxVideoPacketsPerSecond < 500 )
+      g_iMaxVideoPacketsPerSecond = 500;
+
+   log_init_local_only("TestVehiclePipelineBench");
+   fec_init();
+   for( int i=0; i<BENCH_EC_PACKETS; i++ )
+      g_pECBlocks[i] = g_ECBlocks[i];
+
+   type_radio_virtual_config config;
+   hardware_radio_virtual_get_default_config(&config);
+   config.iCount = 1;
+   config.iBasePort = g_iBasePort;
+   config.iSide = VIRTUAL_RADIO_SIDE_VEHICLE;
+   hardware_radio_virtual_set_config(&config);
+   hardware_reset_radio_enumerated_flag();
+   hardware_enumerate_radio_interfaces();
+   radio_init_link_structures();
+   if ( radio_open_interface_for_write(0) < 0 )
+   {
+      printf("Failed to open the virtual radio interface for write.\n");
+      return 1;
+   }
+   config.iSide = VIRTUAL_RADIO_SIDE_STATION;
+   hardware_radio_virtual_set_config(&config);
+   if ( radio_open_interface_for_read(0, RADIO_PORT_ROUTER_DOWNLINK) < 0 )
+   {
+      printf("Failed to open the virtual radio interface for read.\n");
+      return 1;
+   }
+   if ( ! radio_rx_start_rx_thread(NULL, NULL, 0, MODEL_FIRMWARE_TYPE_RUBY) )
+   {
+      printf("Failed to start the radio rx thread.\n");
+      return 1;
+   }
+   if ( ! _open_video_sockets() )
+   {
+      printf("Failed to open the video UDP sockets.\n");
+      return 1;
+   }
+
+   if ( ! packets_pool_init(&g_CapturePool, "capture", BENCH_CAPTURE_BUFFER_SIZE, BENCH_CAPTURE_BUFFERS, 0) )
+      return 1;
+   if ( ! spsc_queue_init(&g_CaptureQueue, BENCH_CAPTURE_BUFFERS) )
+      return 1;
+   g_iCaptureEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if ( g_iCaptureEventFd < 0 )
+      return 1;
+
+   pthread_t threadVideoSender;
+   pthread_t threadConsumer;
+   if ( 0 != pthread_create(&threadVideoSender, NULL, &_thread_video_sender, NULL) )
+      return 1;
+   if ( 0 != pthread_create(&threadConsumer, NULL, &_thread_consumer, NULL) )
+      return 1;
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   fprintf(fdOut, "# Vehicle video pipeline benchmark, %d seconds per test, %d CPU cores\n", g_iTestSeconds, (int)sysconf(_SC_NPROCESSORS_ONLN));
+   fprintf(fdOut, "pipeline,video_packets_per_sec,sent,delivered,delivered_percent,glass_to_air_p50_us_below,glass_to_air_p99_us_below,tx_queue_p99_us_below,encode_thread_cpu_percent\n");
+
+   int iMaxSustained[2] = { 0, 0 };
+   for( int iPipelined=0; iPipelined<2; iPipelined++ )
+   {
+      for( int iRate=1000; iRate<=g_iMaxVideoPacketsPerSecond; iRate *= 2 )
+      {
+         double dDelivered = _run_test(iPipelined?true:false, iRate, fdOut);
+         if ( dDelivered < 99.0 )
+            break;
+         iMaxSustained[iPipelined] = iRate;
+      }
+   }
+   fprintf(fdOut, "# Max sustained video packets/sec (>= 99%% delivered): single: %d, pipelined: %d\n", iMaxSustained[0], iMaxSustained[1]);
+
+   g_iSenderQuit = 1;
+   g_iConsumerQuit = 1;
+   pthread_join(threadVideoSender, NULL);
+   pthread_join(threadConsumer, NULL);
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+
+   close(g_iCaptureEventFd);
+   spsc_queue_uninit(&g_CaptureQueue);
+   packets_pool_uninit(&g_CapturePool);
+   close(g_iVideoSocketRead);
+   close(g_iVideoSocketWrite);
+   radio_rx_stop_rx_thread();
+   radio_close_interface_for_read(0);
+   radio_close_interface_for_write(0);
+   return 0;
+}
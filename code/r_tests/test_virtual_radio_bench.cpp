@@ -0,0 +1,320 @@
+/*
+   Virtual radio link benchmark.
+   Sends radio packets through a virtual radio interface (vehicle side) and
+   receives them back on the same host (controller side), using the regular
+   radiolink tx/rx functions, for a few link profiles (loss, burst loss,
+   latency/jitter, rate cap). Reports per profile: delivered packets, loss,
+   average loss burst, one way latency and goodput, and checks that:
+    - a clean link delivers all the packets, in order, unchanged;
+    - the loss model gives the configured average loss;
+    - two runs with the same seed lose exactly the same packets.
+
+   Usage: test_virtual_radio_bench [-n packets] [-r packets/sec] [-p base port] [-c "loss=5,burst=3,..."] [-o out.csv]
+   (-c runs only the given link profile, see hardware_radio_virtual.h for the parameters)
+*/
+
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../base/hardware_radio.h"
+#include "../base/hardware_radio_virtual.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiolink.h"
+#include "../radio/radioflags.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <math.h>
+
+int g_iPacketsPerTest = 3000;
+int g_iPacketsPerSecond = 2000;
+int g_iBasePort = 7400;
+int g_iPayloadLength = 1024;
+
+typedef struct
+{
+   const char* szName;
+   const char* szConfig;
+} type_link_profile;
+
+typedef struct
+{
+   int iSent;
+   int iReceived;
+   int iOutOfOrder;
+   int iCorrupted;
+   int iLossBursts;
+   double fAvgLatencyUs;
+   double fMaxLatencyUs;
+   double fGoodputMbps;
+   u32 uLossSignature;
+} type_bench_result;
+
+static u64 _now_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u64)ts.tv_sec * 1000000LL + (u64)ts.tv_nsec / 1000LL;
+}
+
+static void _build_packet(u8* pPacket, u32 uIndex)
+{
+   t_packet_header PH;
+   radio_packet_init(&PH, PACKET_COMPONENT_VIDEO, PACKET_TYPE_VIDEO_DATA_FULL, STREAM_ID_VIDEO_1);
+   PH.vehicle_id_src = 1;
+   PH.vehicle_id_dest = 0;
+   PH.stream_packet_idx = uIndex;
+   PH.total_length = g_iPayloadLength;
+   memcpy(pPacket, (u8*)&PH, sizeof(t_packet_header));
+   u64 uTime = _now_micros();
+   memcpy(pPacket + sizeof(t_packet_header), &uTime, sizeof(u64));
+   for( int i=sizeof(t_packet_header)+sizeof(u64); i<g_iPayloadLength; i++ )
+      pPacket[i] = (u8)(uIndex * 7 + i);
+}
+
+static bool _check_packet(u8* pPacket, int iLength, u32 uIndex)
+{
+   if ( iLength != g_iPayloadLength )
+      return false;
+   for( int i=sizeof(t_packet_header)+sizeof(u64); i<g_iPayloadLength; i++ )
+      if ( pPacket[i] != (u8)(uIndex * 7 + i) )
+         return false;
+   return true;
+}
+
+// Reads all the packets ready on the controller side; returns the number of packets read
+
+static int _receive_packets(int iFd, int iTimeoutMicros, type_bench_result* pResult, u32* puNextExpected, u64* puLatencySum, u64* puLastRxTime, u8* pReceivedFlags)
+{
+   fd_set readSet;
+   FD_ZERO(&readSet);
+   FD_SET(iFd, &readSet);
+   struct timeval tv;
+   tv.tv_sec = iTimeoutMicros / 1000000;
+   tv.tv_usec = iTimeoutMicros % 1000000;
+   if ( select(iFd+1, &readSet, NULL, NULL, &tv) <= 0 )
+      return 0;
+
+   int iCount = 0;
+   while ( true )
+   {
+      int iLength = 0;
+      u8* pData = radio_process_wlan_data_in(0, &iLength);
+      if ( NULL == pData )
+         break;
+      u64 uNow = _now_micros();
+      t_packet_header* pPH = (t_packet_header*)pData;
+      u32 uIndex = pPH->stream_packet_idx;
+      iCount++;
+      if ( (uIndex >= (u32)g_iPacketsPerTest) || (! _check_packet(pData, iLength, uIndex)) )
+      {
+         pResult->iCorrupted++;
+         continue;
+      }
+      u64 uSentTime = 0;
+      memcpy(&uSentTime, pData + sizeof(t_packet_header), sizeof(u64));
+      u64 uLatency = uNow - uSentTime;
+      *puLatencySum += uLatency;
+      if ( (double)uLatency > pResult->fMaxLatencyUs )
+         pResult->fMaxLatencyUs = (double)uLatency;
+      if ( uIndex < *puNextExpected )
+         pResult->iOutOfOrder++;
+      *puNextExpected = uIndex + 1;
+      *puLastRxTime = uNow;
+      pReceivedFlags[uIndex] = 1;
+      pResult->iReceived++;
+   }
+   return iCount;
+}
+
+static bool _run_profile(const char* szConfig, type_bench_result* pResult)
+{
+   memset(pResult, 0, sizeof(type_bench_result));
+
+   type_radio_virtual_config config;
+   hardware_radio_virtual_get_default_config(&config);
+   hardware_radio_virtual_parse_config(szConfig, &config);
+   config.iCount = 1;
+   config.iBasePort = g_iBasePort;
+
+   // Both sides in this process: the tx side is opened as the vehicle, the rx side as the controller
+   config.iSide = VIRTUAL_RADIO_SIDE_VEHICLE;
+   hardware_radio_virtual_set_config(&config);
+   hardware_reset_radio_enumerated_flag();
+   hardware_enumerate_radio_interfaces();
+   radio_init_link_structures();
+   if ( radio_open_interface_for_write(0) < 0 )
+      return false;
+   config.iSide = VIRTUAL_RADIO_SIDE_STATION;
+   hardware_radio_virtual_set_config(&config);
+   int iFdRead = radio_open_interface_for_read(0, RADIO_PORT_ROUTER_DOWNLINK);
+   if ( iFdRead < 0 )
+   {
+      radio_close_interface_for_write(0);
+      return false;
+   }
+
+   u8* pReceivedFlags = (u8*) malloc(g_iPacketsPerTest);
+   memset(pReceivedFlags, 0, g_iPacketsPerTest);
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 rawPacket[MAX_PACKET_TOTAL_SIZE];
+   u32 uNextExpected = 0;
+   u64 uLatencySum = 0;
+   u64 uLastRxTime = 0;
+   u64 uTimeStart = _now_micros();
+
+   for( int i=0; i<g_iPacketsPerTest; i++ )
+   {
+      // Keep the send rate (the link simulation drops what does not fit its rate cap/queue)
+      u64 uSendTime = uTimeStart + (u64)i * 1000000LL / (u64)g_iPacketsPerSecond;
+      u64 uNow = _now_micros();
+      while ( uNow < uSendTime )
+      {
+         _receive_packets(iFdRead, (int)(uSendTime - uNow), pResult, &uNextExpected, &uLatencySum, &uLastRxTime, pReceivedFlags);
+         uNow = _now_micros();
+      }
+      _build_packet(packet, i);
+      int iLength = radio_build_new_raw_packet(0, rawPacket, packet, g_iPayloadLength, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+      if ( radio_write_raw_packet(0, rawPacket, iLength) > 0 )
+         pResult->iSent++;
+   }
+
+   // Drain: wait for the frames still in the simulated link
+   int iDrainTimeoutMicros = (int)(config.uLatencyMicros + config.uJitterMicros + config.uMaxQueueMicros) + 50000;
+   while ( _receive_packets(iFdRead, iDrainTimeoutMicros, pResult, &uNextExpected, &uLatencySum, &uLastRxTime, pReceivedFlags) > 0 )
+   {
+   }
+
+   radio_close_interface_for_read(0);
+   radio_close_interface_for_write(0);
+
+   if ( pResult->iReceived > 0 )
+   {
+      pResult->fAvgLatencyUs = (double)uLatencySum / (double)pResult->iReceived;
+      if ( uLastRxTime > uTimeStart )
+         pResult->fGoodputMbps = (double)pResult->iReceived * (double)g_iPayloadLength * 8.0 / (double)(uLastRxTime - uTimeStart);
+   }
+
+   // Loss bursts and a signature of the lost packets (to compare runs)
+   pResult->uLossSignature = 0;
+   for( int i=0; i<g_iPacketsPerTest; i++ )
+   {
+      if ( pReceivedFlags[i] )
+         continue;
+      if ( (0 == i) || pReceivedFlags[i-1] )
+         pResult->iLossBursts++;
+      pResult->uLossSignature = pResult->uLossSignature * 31 + (u32)i + 1;
+   }
+   free(pReceivedFlags);
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* szOutFile = NULL;
+   const char* szCustomConfig = NULL;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-n") && i < argc-1 )
+         g_iPacketsPerTest = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-r") && i < argc-1 )
+         g_iPacketsPerSecond = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-p") && i < argc-1 )
+         g_iBasePort = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-c") && i < argc-1 )
+         szCustomConfig = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-o") && i < argc-1 )
+         szOutFile = argv[++i];
+      else
+      {
+         printf("Usage: %s [-n packets] [-r packets/sec] [-p base port] [-c \"loss=5,burst=3,latency=2000,jitter=500,rate=6000000\"] [-o out.csv]\n", argv[0]);
+         return 0;
+      }
+   }
+   if ( g_iPacketsPerTest < 100 )
+      g_iPacketsPerTest = 100;
+   if ( g_iPacketsPerSecond < 10 )
+      g_iPacketsPerSecond = 10;
+
+   log_init_local_only("TestVirtualRadioBench");
+   log_disable_stdout();
+
+   FILE* fdOut = stdout;
+   if ( NULL != szOutFile )
+   {
+      fdOut = fopen(szOutFile, "w");
+      if ( NULL == fdOut )
+      {
+         printf("Can't create output file %s\n", szOutFile);
+         return 1;
+      }
+   }
+
+   type_link_profile profiles[] = {
+      { "clean", "" },
+      { "loss5", "loss=5,seed=1" },
+      { "burst", "loss=5,burst=4,seed=1" },
+      { "latency", "latency=2000,jitter=500" },
+      { "rate6M", "rate=6000000,queue=20000" },
+      { "mixed", "loss=2,burst=3,latency=5000,jitter=1000,rate=24000000,seed=7" },
+   };
+   int iProfilesCount = sizeof(profiles)/sizeof(profiles[0]);
+   if ( NULL != szCustomConfig )
+   {
+      profiles[0].szName = "custom";
+      profiles[0].szConfig = szCustomConfig;
+      iProfilesCount = 1;
+   }
+
+   fprintf(fdOut, "# Virtual radio link benchmark: %d packets of %d bytes per profile, %d packets/sec\n", g_iPacketsPerTest, g_iPayloadLength, g_iPacketsPerSecond);
+   fprintf(fdOut, "profile,sent,received,loss_pct,avg_loss_burst,avg_latency_us,max_latency_us,goodput_mbps,result\n");
+
+   int iFailed = 0;
+   for( int p=0; p<iProfilesCount; p++ )
+   {
+      type_radio_virtual_config config;
+      hardware_radio_virtual_get_default_config(&config);
+      hardware_radio_virtual_parse_config(profiles[p].szConfig, &config);
+
+      type_bench_result result;
+      if ( ! _run_profile(profiles[p].szConfig, &result) )
+      {
+         printf("Failed to open the virtual radio interfaces (base port %d): %s\n", g_iBasePort, strerror(errno));
+         return 1;
+      }
+      int iLost = g_iPacketsPerTest - result.iReceived;
+      double fLoss = 100.0 * (double)iLost / (double)g_iPacketsPerTest;
+
+      const char* szResult = "ok";
+      if ( (result.iCorrupted > 0) || (result.iOutOfOrder > 0) )
+         szResult = "CORRUPTED";
+      else if ( (0 == strcmp(profiles[p].szName, "clean")) && (iLost > 0) )
+         szResult = "LOST";
+      else if ( (config.iLossPercent > 0) && (0 == config.uRateBPS) && (fabs(fLoss - (double)config.iLossPercent) > 2.0 + (double)config.iLossPercent * 0.4) )
+         szResult = "LOSS_MISMATCH";
+      else if ( (config.iLossPercent > 0) && (0 == config.uRateBPS) )
+      {
+         // Same seed, same traffic: the same packets must be lost
+         type_bench_result result2;
+         if ( (! _run_profile(profiles[p].szConfig, &result2)) || (result2.uLossSignature != result.uLossSignature) )
+            szResult = "NOT_REPRODUCIBLE";
+      }
+      if ( 0 != strcmp(szResult, "ok") )
+         iFailed++;
+
+      fprintf(fdOut, "%s,%d,%d,%.2f,%.2f,%.1f,%.1f,%.2f,%s\n", profiles[p].szName, result.iSent, result.iReceived, fLoss,
+         (result.iLossBursts > 0)?((double)iLost / (double)result.iLossBursts):0.0,
+         result.fAvgLatencyUs, result.fMaxLatencyUs, result.fGoodputMbps, szResult);
+   }
+
+   if ( fdOut != stdout )
+      fclose(fdOut);
+
+   if ( iFailed )
+   {
+      printf("Virtual radio benchmark: %d link profiles failed the checks!\n", iFailed);
+      return 1;
+   }
+   return 0;
+}
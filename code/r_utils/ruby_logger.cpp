@@ -42,6 +42,11 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/stat.h>
+
+#define LOGGER_MAX_MESSAGES_PER_BATCH 200
+#define LOGGER_MAX_FILE_SIZE (2*1024*1024)
+#define LOGGER_MAX_ROTATED_FILES 4
 
 bool g_bQuit = false;
 int s_iCounter = 0;
@@ -110,6 +115,51 @@ int _open_msg_queue()
 }
 
 
+// Shifts the rotated log files (<file>.1 is the newest one) and moves the log file to <file>.1;
+// only the oldest one is removed, once there are LOGGER_MAX_ROTATED_FILES of them.
+// The logger is the only one rotating the log files: the processes logging directly to them just reopen them.
+void _rotate_log_file(const char* szFile)
+{
+   char szFileOld[300];
+   char szFileNew[300];
+   snprintf(szFileOld, sizeof(szFileOld), "%s.%d", szFile, LOGGER_MAX_ROTATED_FILES);
+   unlink(szFileOld);
+   for( int i=LOGGER_MAX_ROTATED_FILES-1; i>0; i-- )
+   {
+      snprintf(szFileOld, sizeof(szFileOld), "%s.%d", szFile, i);
+      snprintf(szFileNew, sizeof(szFileNew), "%s.%d", szFile, i+1);
+      rename(szFileOld, szFileNew);
+   }
+   snprintf(szFileNew, sizeof(szFileNew), "%s.1", szFile);
+   rename(szFile, szFileNew);
+}
+
+// Keeps the log file opened; reopens it if it was removed by some other process
+// and rotates it when it gets too big
+FILE* _open_log_file(FILE* fd, const char* szFile)
+{
+   if ( NULL != fd )
+   {
+      struct stat statFd;
+      struct stat statFile;
+      bool bReopen = false;
+      if ( 0 != fstat(fileno(fd), &statFd) )
+         bReopen = true;
+      else if ( statFd.st_size > LOGGER_MAX_FILE_SIZE )
+      {
+         _rotate_log_file(szFile);
+         bReopen = true;
+      }
+      else if ( (0 != stat(szFile, &statFile)) || (statFile.st_ino != statFd.st_ino) )
+         bReopen = true;
+
+      if ( ! bReopen )
+         return fd;
+      fclose(fd);
+   }
+   return fopen(szFile, "a");
+}
+
 void _log_platform(bool bNewLine)
 {
    #if defined(HW_PLATFORM_OPENIPC_CAMERA)
@@ -175,6 +225,10 @@ int main(int argc, char *argv[])
    strcpy(szFileSoft, FOLDER_LOGS);
    strcat(szFileSoft, LOG_FILE_ERRORS_SOFT);
 
+   FILE* fdLog = NULL;
+   FILE* fdErrors = NULL;
+   FILE* fdSoft = NULL;
+
    while ( !g_bQuit )
    {
       // This is blocking
@@ -196,44 +250,53 @@ int main(int argc, char *argv[])
           else
              continue;
       }
-      logMessage.text[len-1] = 0;
-      //sprintf(szTmp, "len %d", len);
-      //_log_logger_message(szTmp);
-      //_log_logger_message(logMessage.text);
-      //log_line("Received message type: %d, length: %d bytes", logMessage.type, len);
-
-      //if ( logMessage.type == 1 )
-      if ( 1 )
-      {
-         FILE* fd = fopen(szFileLog, "a+");
-         if ( NULL != fd )
-         {
-            fprintf(fd, "%s\n", logMessage.text);
-            fclose(fd);
-         }
-      }
 
-      if ( logMessage.type == 2 )
+      fdLog = _open_log_file(fdLog, szFileLog);
+
+      // Write all the pending messages, then flush the files once
+      int iCount = 0;
+      while ( len > 0 )
       {
-         FILE* fd = fopen(szFileSoft, "a+");
-         if ( NULL != fd )
+         logMessage.text[len-1] = 0;
+         iCount++;
+
+         if ( NULL != fdLog )
+            fprintf(fdLog, "%s\n", logMessage.text);
+
+         if ( logMessage.type == 2 )
          {
-            fprintf(fd, "%s\n", logMessage.text);
-            fclose(fd);
+            fdSoft = _open_log_file(fdSoft, szFileSoft);
+            if ( NULL != fdSoft )
+               fprintf(fdSoft, "%s\n", logMessage.text);
          }
-      }
 
-      if ( logMessage.type == 3 )
-      {
-         FILE* fd = fopen(szFileErrors, "a+");
-         if ( NULL != fd )
+         if ( logMessage.type == 3 )
          {
-            fprintf(fd, "%s\n", logMessage.text);
-            fclose(fd);
+            fdErrors = _open_log_file(fdErrors, szFileErrors);
+            if ( NULL != fdErrors )
+               fprintf(fdErrors, "%s\n", logMessage.text);
          }
+
+         if ( iCount >= LOGGER_MAX_MESSAGES_PER_BATCH )
+            break;
+         len = msgrcv(iLogMsgQueue, &logMessage, MAX_SERVICE_LOG_ENTRY_LENGTH, 0, MSG_NOERROR | IPC_NOWAIT);
       }
+
+      if ( NULL != fdLog )
+         fflush(fdLog);
+      if ( NULL != fdSoft )
+         fflush(fdSoft);
+      if ( NULL != fdErrors )
+         fflush(fdErrors);
    }
 
+   if ( NULL != fdLog )
+      fclose(fdLog);
+   if ( NULL != fdSoft )
+      fclose(fdSoft);
+   if ( NULL != fdErrors )
+      fclose(fdErrors);
+
    if ( iLogMsgQueue >= 0 )
    {
       msgctl(iLogMsgQueue,IPC_RMID,NULL);
@@ -247,6 +247,7 @@ void vehicle_stop_audio_capture(Model* pModel)
 static bool s_bThreadBgAffinitiesStarted = false;
 static int s_iCPUCoresCount = -1;
 static bool s_bAdjustAffinitiesIsVeyeCamera = false;
+static bool s_bAdjustAffinitiesMultiThreadedVideo = false;
 
 static void * _thread_adjust_affinities_vehicle(void *argument)
 {
@@ -281,9 +282,12 @@ static void * _thread_adjust_affinities_vehicle(void *argument)
    }
 
    log_line("%d CPU cores, doing affinity adjustments for processes...", s_iCPUCoresCount);
+   if ( s_bAdjustAffinitiesMultiThreadedVideo )
+      log_line("Multi-threaded video pipeline is enabled, the router pins its own threads.");
    if ( s_iCPUCoresCount > 2 )
    {
-      hw_set_proc_affinity("ruby_rt_vehicle", 1,1);
+      if ( ! s_bAdjustAffinitiesMultiThreadedVideo )
+         hw_set_proc_affinity("ruby_rt_vehicle", 1,1);
       hw_set_proc_affinity("ruby_tx_telemetry", 2,2);
       // To fix
       //hw_set_proc_affinity("ruby_rx_rc", 2,2);
@@ -301,7 +305,8 @@ static void * _thread_adjust_affinities_vehicle(void *argument)
    }
    else
    {
-      hw_set_proc_affinity("ruby_rt_vehicle", 1,1);
+      if ( ! s_bAdjustAffinitiesMultiThreadedVideo )
+         hw_set_proc_affinity("ruby_rt_vehicle", 1,1);
       #if defined (HW_PLATFORM_OPENIPC_CAMERA)
       hw_set_proc_affinity("majestic", 2, s_iCPUCoresCount);
       #endif
@@ -319,8 +324,9 @@ static void * _thread_adjust_affinities_vehicle(void *argument)
 }
 
 
-void vehicle_check_update_processes_affinities(bool bUseThread, bool bVeYe)
+void vehicle_check_update_processes_affinities(bool bUseThread, bool bVeYe, bool bMultiThreadedVideo)
 {
+   s_bAdjustAffinitiesMultiThreadedVideo = bMultiThreadedVideo;
    #if defined (HW_PLATFORM_OPENIPC_CAMERA)
    log_line("Adjusting process affinities for OpenIPC hardware. Use thread: %s", (bUseThread?"Yes":"No"));
    s_bAdjustAffinitiesIsVeyeCamera = false;
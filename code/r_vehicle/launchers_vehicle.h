@@ -18,4 +18,5 @@ void vehicle_stop_tx_router();
 void vehicle_launch_audio_capture(Model* pModel);
 void vehicle_stop_audio_capture(Model* pModel);
 
-void vehicle_check_update_processes_affinities(bool bUseThread, bool bVeYe);
\ No newline at end of file
+// bMultiThreadedVideo: the router pins its video pipeline threads itself, so it's not pinned as a whole
+void vehicle_check_update_processes_affinities(bool bUseThread, bool bVeYe, bool bMultiThreadedVideo);
\ No newline at end of file
@@ -417,6 +417,10 @@ bool _send_packet_to_wifi_radio_interface(int iLocalRadioLinkId, int iRadioInter
          if ( (g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_ENC_DATA) || (g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_ENC_ALL) )
             be = 1;
       }
+      if ( be )
+      if ( g_pCurrentModel->enc_flags & MODEL_ENC_FLAG_AEAD )
+      if ( hppa() )
+         be = RADIO_PACKET_ENCRYPTION_AEAD;
    }
 
 
@@ -433,6 +437,7 @@ bool _send_packet_to_wifi_radio_interface(int iLocalRadioLinkId, int iRadioInter
    }
    
    int totalLength = 0;
+   bool bUseHeaderTemplate = true;
    if ( (s_iPendingFrequencyChangeLinkId >= 0) && (s_uPendingFrequencyChangeTo > 100) && (s_uTimeFrequencyChangeRequest != 0) && (g_TimeNow > s_uTimeFrequencyChangeRequest) && (g_TimeNow > VEHICLE_SWITCH_FREQUENCY_AFTER_MS) && (s_uTimeFrequencyChangeRequest + VEHICLE_SWITCH_FREQUENCY_AFTER_MS >= g_TimeNow) )
    {
       u8 extraData[6];
@@ -445,13 +450,23 @@ bool _send_packet_to_wifi_radio_interface(int iLocalRadioLinkId, int iRadioInter
       extraData[5] = 6;
       //log_line("Sending extra data: %d %d, %d, %d, %d, %d", extraData[5], extraData[4], extraData[3], extraData[2], extraData[1], extraData[0]);
       totalLength = radio_build_new_raw_packet(iLocalRadioLinkId, s_RadioRawPacket, pPacketData, nPacketLength, RADIO_PORT_ROUTER_DOWNLINK, be, 6, &extraData[0]);
+      bUseHeaderTemplate = false;
    }
-   else
+   else if ( be )
+   {
       totalLength = radio_build_new_raw_packet(iLocalRadioLinkId, s_RadioRawPacket, pPacketData, nPacketLength, RADIO_PORT_ROUTER_DOWNLINK, be, 0, NULL);
+      bUseHeaderTemplate = false;
+   }
 
    u32 microT1 = get_current_timestamp_micros();
 
-   if ( radio_write_raw_packet(iRadioInterfaceIndex, s_RadioRawPacket, totalLength) )
+   int iWriteResult = 0;
+   if ( bUseHeaderTemplate )
+      iWriteResult = radio_write_packet_with_header_template(iLocalRadioLinkId, iRadioInterfaceIndex, pPacketData, nPacketLength, RADIO_PORT_ROUTER_DOWNLINK);
+   else
+      iWriteResult = radio_write_raw_packet(iRadioInterfaceIndex, s_RadioRawPacket, totalLength);
+
+   if ( iWriteResult )
    {       
       u32 microT2 = get_current_timestamp_micros();
       if ( microT2 > microT1 )
@@ -865,6 +865,9 @@ void _update_developer_log_data()
          long lSize = ftell(fd);
          if ( -1 == s_lLastLiveLogFileOffset )
             s_lLastLiveLogFileOffset = lSize;
+         // The log file was rotated
+         if ( lSize < s_lLastLiveLogFileOffset )
+            s_lLastLiveLogFileOffset = 0;
 
          while ( lSize - s_lLastLiveLogFileOffset >= 100 )
          {
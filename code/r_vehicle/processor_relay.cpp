@@ -156,8 +156,8 @@ void relay_process_received_radio_packet_from_relayed_vehicle(int iRadioLink, in
 
       if ( pPH->vehicle_id_src != g_pCurrentModel->relay_params.uRelayedVehicleId )
       {
-         pData += pPH->total_length;
-         nLength -= pPH->total_length;
+         pData += iPacketLength;
+         nLength -= iPacketLength;
          
          if ( (NULL != pRxInfoStats) && (g_TimeNow > pRxInfoStats->timeLastLogWrongRxPacket + 2000) )
          {
@@ -210,8 +210,8 @@ void relay_process_received_radio_packet_from_relayed_vehicle(int iRadioLink, in
          if ( pPH->packet_type == PACKET_TYPE_RUBY_PING_CLOCK_REPLY )
             memcpy(pData+sizeof(t_packet_header)+2*sizeof(u8)+sizeof(u32), &s_uLastLocalRadioLinkUsedForPingToRelayedVehicle, sizeof(u8));
       }
-      pData += pPH->total_length;
-      nLength -= pPH->total_length;
+      pData += iPacketLength;
+      nLength -= iPacketLength;
    }
 
    if ( (! bIsFullComposedPacketOkToForward) || (! bPacketContainsDataToForward) )
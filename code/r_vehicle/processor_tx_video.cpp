@@ -37,6 +37,8 @@
 #include "../radio/fec.h"
 #include "../base/camera_utils.h"
 #include "../base/parser_h264.h"
+#include "../base/packets_pool.h"
+#include "../base/retransmissions_index.h"
 #include "../common/string_utils.h"
 #include "shared_vars.h"
 #include "timers.h"
@@ -68,15 +70,16 @@ typedef struct
    u8 block_packets;
    u8 block_fecs;
    int video_data_length;
+   u32 uTimeBlockClosedMicros; // when the last data packet of the block was read, 0 once the last EC packet was sent
    type_tx_packet_info packetsInfo[MAX_TOTAL_PACKETS_IN_BLOCK];
    int iAllocatedPackets = 0;
 }
 type_tx_block_info;
 
 type_tx_block_info s_BlocksTxBuffers[MAX_RXTX_BLOCKS_BUFFER];
+type_packets_pool s_TxVideoPacketsPool;
 int s_iCurrentMaxTxPacketsInAVideoBlock = 0;
 
-u8* p_fec_data_packets[MAX_DATA_PACKETS_IN_BLOCK];
 u8* p_fec_data_fecs[MAX_FECS_PACKETS_IN_BLOCK];
 
 t_packet_header s_CurrentPH;
@@ -88,6 +91,17 @@ bool s_bPendingEncodingSwitch = false;
 u32 sTimeLastFecTimeCalculation = 0;
 u32 sTimeTotalFecTimeMicroSec = 0;
 
+// Interval from a block's last data packet read to its last EC packet sent
+u32 s_uTimeLastBlockToECSentLog = 0;
+u32 s_uBlockToECSentTotalMicros = 0;
+u32 s_uBlockToECSentMaxMicros = 0;
+u32 s_uBlockToECSentCount = 0;
+
+// Encoding scheme block size, while the block being read is closed early at the end of a video frame
+u8 s_uBlockPacketsBeforeFrameEnd = 0;
+u8 s_uBlockECsBeforeFrameEnd = 0;
+u32 s_uCountFrameEndBlocks = 0;
+
 ParserH264 s_ParserH264CameraOutput;
 ParserH264 s_ParserH264RadioOutput;
 
@@ -115,17 +129,9 @@ u32 s_uInjectFaultsCountPacketsDeclined = 0;
 
 #define MAX_HISTORY_RETRANSMISSION_INFO 200
 
-typedef struct
-{
-   u32 video_block_index;
-   u8 video_packet_index;
-   u32 uReceiveTime;
-   u8 uRepeatCount;
-}
-type_retransmissions_history_info;
+// Video blocks in the tx buffers and the segments requested by the controller, indexed by block/packet
+type_retransmissions_index s_RetransmissionsIndex;
 
-type_retransmissions_history_info s_listRetransmissionsSegmentsInfo[MAX_HISTORY_RETRANSMISSION_INFO];
-int s_iCountRetransmissionsSegmentsInfo = 0;
 u32 s_listLastRetransmissionsRequestsTimes[MAX_HISTORY_RETRANSMISSION_INFO];
 int s_iCountLastRetransmissionsRequestsTimes = 0;
 
@@ -472,6 +478,7 @@ void _reset_tx_buffers()
       s_BlocksTxBuffers[i].video_data_length = s_CurrentPHVF.video_data_length;
       s_BlocksTxBuffers[i].block_packets = s_CurrentPHVF.block_packets;
       s_BlocksTxBuffers[i].block_fecs = s_CurrentPHVF.block_fecs;
+      s_BlocksTxBuffers[i].uTimeBlockClosedMicros = 0;
    }
 }
 
@@ -765,7 +772,7 @@ void _send_packet(int bufferIndex, int packetIndex, bool isRetransmitted, bool i
    if ( _inject_recoverable_faults(bufferIndex, pPH->stream_packet_idx, packetIndex, isRetransmitted) )
       return;
 
-   if ( ((s_CurrentPHVF.video_stream_and_type >> 4) & 0x0F) == VIDEO_TYPE_H264 )
+   if ( (((s_CurrentPHVF.video_stream_and_type >> 4) & 0x0F) == VIDEO_TYPE_H264) || (((s_CurrentPHVF.video_stream_and_type >> 4) & 0x0F) == VIDEO_TYPE_H265) )
    if ( (! isRetransmitted) && (! isDuplicationPacket) )
    if ( packetIndex < s_BlocksTxBuffers[bufferIndex].block_packets )
    if ( NULL != g_pCurrentModel )
@@ -774,7 +781,12 @@ void _send_packet(int bufferIndex, int packetIndex, bool isRetransmitted, bool i
    {
       u8* pVideoData = pPacketData + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77);
       
-      bool bStartOfFrameDetected = s_ParserH264RadioOutput.parseData(pVideoData, pPHVF->video_data_length, g_TimeNow);
+      // The last packet of a block closed at a frame end can be shorter
+      int iVideoDataLength = pPH->total_length - sizeof(t_packet_header) - sizeof(t_packet_header_video_full_77);
+      if ( iVideoDataLength > pPHVF->video_data_length )
+         iVideoDataLength = pPHVF->video_data_length;
+      s_ParserH264RadioOutput.setCodec(((s_CurrentPHVF.video_stream_and_type >> 4) & 0x0F) == VIDEO_TYPE_H265);
+      bool bStartOfFrameDetected = s_ParserH264RadioOutput.parseData(pVideoData, iVideoDataLength, g_TimeNow);
       if ( bStartOfFrameDetected )
       {         
          u32 uLastFrameDuration = s_ParserH264RadioOutput.getTimeDurationOfLastCompleteFrame();
@@ -845,6 +857,18 @@ int process_data_tx_video_has_packets_ready_to_send()
    return countReadyToSend;
 }
 
+void _update_block_to_ec_sent_stats(int iBufferIndex)
+{
+   if ( 0 == s_BlocksTxBuffers[iBufferIndex].uTimeBlockClosedMicros )
+      return;
+   u32 uDelta = get_current_timestamp_micros() - s_BlocksTxBuffers[iBufferIndex].uTimeBlockClosedMicros;
+   s_BlocksTxBuffers[iBufferIndex].uTimeBlockClosedMicros = 0;
+   s_uBlockToECSentTotalMicros += uDelta;
+   s_uBlockToECSentCount++;
+   if ( uDelta > s_uBlockToECSentMaxMicros )
+      s_uBlockToECSentMaxMicros = uDelta;
+}
+
 // How many packets backwards to send (from the available ones)
 // Returns the number of packets sent
 
@@ -859,6 +883,9 @@ int process_data_tx_video_send_packets_ready_to_send(int howMany)
    if ( howMany > 5 )
       uMicroTime = get_current_timestamp_micros();
 
+   // Queue all the video packets (data and EC) and write them to each radio interface in one go
+   radio_tx_batch_begin();
+
    for( int i=0; i<howMany; i++ )
    {
       if ( ! ( s_BlocksTxBuffers[s_iCurrentBufferIndexToSend].packetsInfo[s_iCurrentBlockPacketIndexToSend].flags & PACKET_FLAG_READ ) )
@@ -879,6 +906,8 @@ int process_data_tx_video_send_packets_ready_to_send(int howMany)
          {
             for( int k=0; k<s_BlocksTxBuffers[s_iCurrentBufferIndexToSend].block_fecs; k++ )
                _send_packet(s_iCurrentBufferIndexToSend, s_BlocksTxBuffers[s_iCurrentBufferIndexToSend].block_packets + k, false, false, true);
+            if ( s_BlocksTxBuffers[s_iCurrentBufferIndexToSend].block_fecs > 0 )
+               _update_block_to_ec_sent_stats(s_iCurrentBufferIndexToSend);
          }
       }
       else if ( s_BlocksTxBuffers[s_iCurrentBufferIndexToSend].block_fecs > 0 )
@@ -897,7 +926,11 @@ int process_data_tx_video_send_packets_ready_to_send(int howMany)
 
          if ( s_iCurrentBlockPacketIndexToSend < s_BlocksTxBuffers[iPrevBlockToSend].block_fecs )
          if ( s_BlocksTxBuffers[iPrevBlockToSend].packetsInfo[s_BlocksTxBuffers[iPrevBlockToSend].block_packets + s_iCurrentBlockPacketIndexToSend].flags & PACKET_FLAG_READ )
+         {
             _send_packet(iPrevBlockToSend, s_BlocksTxBuffers[iPrevBlockToSend].block_packets + s_iCurrentBlockPacketIndexToSend, false, false, true);
+            if ( s_iCurrentBlockPacketIndexToSend == s_BlocksTxBuffers[iPrevBlockToSend].block_fecs - 1 )
+               _update_block_to_ec_sent_stats(iPrevBlockToSend);
+         }
 
          /*
          int iECSlices = s_BlocksTxBuffers[s_iCurrentBufferIndexToSend].block_fecs/iECPacketsPerSlice + 1;
@@ -926,6 +959,14 @@ int process_data_tx_video_send_packets_ready_to_send(int howMany)
       }
    }
 
+   u32 uBatchTimeMicros[MAX_RADIO_INTERFACES];
+   radio_tx_batch_flush(&uBatchTimeMicros[0]);
+   for( int i=0; i<MAX_RADIO_INTERFACES; i++ )
+   {
+      g_RadioTxTimers.aTmpInterfacesTxTotalTimeMicros[i] += uBatchTimeMicros[i];
+      g_RadioTxTimers.aTmpInterfacesTxVideoTimeMicros[i] += uBatchTimeMicros[i];
+   }
+
    static int sl_iCountSuccessiveOverloads = 0;
    if ( howMany > 5 )
    {
@@ -956,9 +997,42 @@ int process_data_tx_video_send_packets_ready_to_send(int howMany)
 }
 
 
+// Makes the block being read a shorter one, of iDataPackets data packets, as the video frame ended:
+// keeps the block's EC packets count (up to one EC packet per data packet), so that the short block
+// survives as many lost packets as a full one, and updates the headers of the packets already read,
+// so that retransmissions have the final block size too.
+// The encoding scheme block size is restored when the block is closed.
+
+void _shorten_current_read_block(int iDataPackets)
+{
+   int iECPackets = s_CurrentPHVF.block_fecs;
+   if ( iECPackets > iDataPackets )
+      iECPackets = iDataPackets;
+
+   s_uBlockPacketsBeforeFrameEnd = s_CurrentPHVF.block_packets;
+   s_uBlockECsBeforeFrameEnd = s_CurrentPHVF.block_fecs;
+   s_CurrentPHVF.block_packets = (u8)iDataPackets;
+   s_CurrentPHVF.block_fecs = (u8)iECPackets;
+   s_CurrentPHVF.uVideoStatusFlags2 |= VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK;
+
+   s_BlocksTxBuffers[s_currentReadBufferIndex].block_packets = s_CurrentPHVF.block_packets;
+   s_BlocksTxBuffers[s_currentReadBufferIndex].block_fecs = s_CurrentPHVF.block_fecs;
+
+   for( int i=0; i<s_currentReadBlockPacketIndex; i++ )
+   {
+      t_packet_header_video_full_77* pPHVF = (t_packet_header_video_full_77*)(s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[i].pRawData + sizeof(t_packet_header));
+      pPHVF->block_packets = s_CurrentPHVF.block_packets;
+      pPHVF->block_fecs = s_CurrentPHVF.block_fecs;
+      pPHVF->uVideoStatusFlags2 |= VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK;
+   }
+   s_uCountFrameEndBlocks++;
+}
+
+void _close_current_read_block();
+
 // Returns true if a block is complete
 
-bool _onNewCompletePacketReadFromInput()
+bool _onNewCompletePacketReadFromInput(bool bEndOfFrame)
 {
    u32 uTimeDiff = g_TimeNow - g_TimeLastVideoPacketIn;
    g_TimeLastVideoPacketIn = g_TimeNow;
@@ -997,7 +1071,7 @@ bool _onNewCompletePacketReadFromInput()
          s_BlocksTxBuffers[i].iAllocatedPackets = iMaxPackets;
          for( int k=s_iCurrentMaxTxPacketsInAVideoBlock; k<s_BlocksTxBuffers[i].iAllocatedPackets; k++ )
          {
-            s_BlocksTxBuffers[i].packetsInfo[k].pRawData = (u8*) malloc(MAX_PACKET_TOTAL_SIZE);
+            s_BlocksTxBuffers[i].packetsInfo[k].pRawData = packets_pool_alloc(&s_TxVideoPacketsPool);
             if ( NULL == s_BlocksTxBuffers[i].packetsInfo[k].pRawData )
             {
                log_error_and_alarm("[VideoTx] Failed to alocate memory for buffers.");
@@ -1009,9 +1083,14 @@ bool _onNewCompletePacketReadFromInput()
       s_iCurrentMaxTxPacketsInAVideoBlock = iMaxPackets;
    }
 
+   // The frame ends in this packet: it's the last data packet of the block
+   if ( bEndOfFrame )
+      _shorten_current_read_block(s_currentReadBlockPacketIndex+1);
+
    // Save the new packet in the tx buffers
 
    s_BlocksTxBuffers[s_currentReadBufferIndex].video_block_index = s_CurrentPHVF.video_block_index;
+   retransmissions_index_set_block(&s_RetransmissionsIndex, s_CurrentPHVF.video_block_index, s_currentReadBufferIndex);
    s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_currentReadBlockPacketIndex].flags = PACKET_FLAG_READ;
    s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_currentReadBlockPacketIndex].uTimestamp = g_TimeNow;
 
@@ -1044,6 +1123,11 @@ bool _onNewCompletePacketReadFromInput()
    memcpy(pPH, &s_CurrentPH, sizeof(t_packet_header));
    memcpy(pPHVF, &s_CurrentPHVF, sizeof(t_packet_header_video_full_77));
 
+   // Send only the frame data of a partly filled last packet (the debug timestamps are after the full video data)
+   if ( bEndOfFrame )
+   if ( ! (s_CurrentPHVF.uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_HAS_DEBUG_TIMESTAMPS) )
+      pPH->total_length = sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77) + s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_currentReadBlockPacketIndex].currentReadPosition;
+
    if ( s_CurrentPHVF.uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_HAS_DEBUG_TIMESTAMPS )
    {
       static u32 s_uDebugLastAddedPacketTimestamp = 0;
@@ -1053,6 +1137,22 @@ bool _onNewCompletePacketReadFromInput()
       pExtraDataU32[0] = pExtraDataU32[1] - s_uDebugLastAddedPacketTimestamp;
       s_uDebugLastAddedPacketTimestamp = pExtraDataU32[1];
    }
+
+   // Fold the new data packet into the EC packets of the block right away,
+   // so that the EC packets are complete as soon as the last data packet is read
+
+   if ( s_CurrentPHVF.block_fecs > 0 )
+   if ( s_currentReadBlockPacketIndex < s_CurrentPHVF.block_packets )
+   {
+      for( int i=0; i<s_CurrentPHVF.block_fecs; i++ )
+         p_fec_data_fecs[i] = ((u8*)s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_CurrentPHVF.block_packets+i].pRawData) + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77);
+
+      u32 tTemp = get_current_timestamp_micros();
+      fec_encode_add_block(s_BlocksTxBuffers[s_currentReadBufferIndex].video_data_length, pPacketData + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77), s_currentReadBlockPacketIndex, p_fec_data_fecs, s_CurrentPHVF.block_fecs);
+      tTemp = get_current_timestamp_micros() - tTemp;
+      sTimeTotalFecTimeMicroSec += tTemp;
+   }
+
    // Go to next packet in the buffer
 
    s_currentReadBlockPacketIndex++;
@@ -1067,20 +1167,21 @@ bool _onNewCompletePacketReadFromInput()
       return false;
    }      
 
-   // Generate and add EC packets if EC is enabled
+   _close_current_read_block();
+   return true;
+}
 
-   if ( s_CurrentPHVF.block_fecs > 0 )
-   {
-      for( int i=0; i<s_CurrentPHVF.block_packets; i++ )
-         p_fec_data_packets[i] = ((u8*)s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[i].pRawData) + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77);
+// Adds the EC packets of the block being read (all its data packets were read) and moves to the next block
 
-      for( int i=0; i<s_CurrentPHVF.block_fecs; i++ )
-         p_fec_data_fecs[i] = ((u8*)s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_CurrentPHVF.block_packets+i].pRawData) + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77);
+void _close_current_read_block()
+{
+   // Add the EC packets if EC is enabled (their data was already computed as the data packets were read)
 
-      u32 tTemp = get_current_timestamp_micros();
-      fec_encode(s_BlocksTxBuffers[s_currentReadBufferIndex].video_data_length, p_fec_data_packets, s_CurrentPHVF.block_packets, p_fec_data_fecs, s_CurrentPHVF.block_fecs);
-      tTemp = get_current_timestamp_micros() - tTemp;
-      sTimeTotalFecTimeMicroSec += tTemp;
+   if ( s_CurrentPHVF.block_fecs > 0 )
+   {
+      s_BlocksTxBuffers[s_currentReadBufferIndex].uTimeBlockClosedMicros = get_current_timestamp_micros();
+      if ( 0 == s_BlocksTxBuffers[s_currentReadBufferIndex].uTimeBlockClosedMicros )
+         s_BlocksTxBuffers[s_currentReadBufferIndex].uTimeBlockClosedMicros = 1;
 
       for( int i=0; i<s_CurrentPHVF.block_fecs; i++ )
       {
@@ -1098,6 +1199,13 @@ bool _onNewCompletePacketReadFromInput()
       }
    }
 
+   if ( s_CurrentPHVF.uVideoStatusFlags2 & VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK )
+   {
+      s_CurrentPHVF.block_packets = s_uBlockPacketsBeforeFrameEnd;
+      s_CurrentPHVF.block_fecs = s_uBlockECsBeforeFrameEnd;
+      s_CurrentPHVF.uVideoStatusFlags2 &= ~VIDEO_STATUS_FLAGS2_IS_FRAME_END_BLOCK;
+   }
+
    if ( s_bPendingEncodingSwitch )
    {
       //log_line("Applying pending encodings change (starting at video block index %u):", s_CurrentPHVF.video_block_index);
@@ -1135,6 +1243,7 @@ bool _onNewCompletePacketReadFromInput()
    // Reset info on the next video block to send
 
    s_BlocksTxBuffers[s_currentReadBufferIndex].video_block_index = s_CurrentPHVF.video_block_index;
+   retransmissions_index_set_block(&s_RetransmissionsIndex, s_CurrentPHVF.video_block_index, s_currentReadBufferIndex);
    for( int i=0; i<MAX_TOTAL_PACKETS_IN_BLOCK; i++ )
    {
       s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[i].flags = PACKET_FLAG_EMPTY;
@@ -1145,17 +1254,16 @@ bool _onNewCompletePacketReadFromInput()
    s_BlocksTxBuffers[s_currentReadBufferIndex].video_data_length = s_CurrentPHVF.video_data_length;
    s_BlocksTxBuffers[s_currentReadBufferIndex].block_packets = s_CurrentPHVF.block_packets;
    s_BlocksTxBuffers[s_currentReadBufferIndex].block_fecs = s_CurrentPHVF.block_fecs;
+   s_BlocksTxBuffers[s_currentReadBufferIndex].uTimeBlockClosedMicros = 0;
 
    // Reset info on the first packet of next video block to send
    s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[0].currentReadPosition = 0;
 
-   pPacketData = s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[0].pRawData;
-   pPH = (t_packet_header*)pPacketData;
-   pPHVF = (t_packet_header_video_full_77*)(pPacketData + sizeof(t_packet_header));
+   u8* pPacketData = s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[0].pRawData;
+   t_packet_header* pPH = (t_packet_header*)pPacketData;
+   t_packet_header_video_full_77* pPHVF = (t_packet_header_video_full_77*)(pPacketData + sizeof(t_packet_header));
    memcpy(pPH, &s_CurrentPH, sizeof(t_packet_header));
    memcpy(pPHVF, &s_CurrentPHVF, sizeof(t_packet_header_video_full_77));
-
-   return true;
 }
 
 bool process_data_tx_video_init()
@@ -1164,12 +1272,21 @@ bool process_data_tx_video_init()
    s_iCurrentMaxTxPacketsInAVideoBlock = g_pCurrentModel->get_current_max_video_packets_for_all_profiles();
 
    log_line("[VideoTx] Current model max packets needed in a block (data+ec): %d", s_iCurrentMaxTxPacketsInAVideoBlock);
+
+   // Room for all the slots a block can grow to; pages are only touched by the slots actually used.
+   // No huge pages: they save page faults at startup only, but round up the memory used.
+   if ( ! packets_pool_init(&s_TxVideoPacketsPool, "VideoTx", MAX_PACKET_TOTAL_SIZE, MAX_RXTX_BLOCKS_BUFFER*MAX_TOTAL_PACKETS_IN_BLOCK, 0) )
+   {
+      log_error_and_alarm("[VideoTx] Failed to alocate memory for buffers.");
+      return false;
+   }
+
    for( int i=0; i<MAX_RXTX_BLOCKS_BUFFER; i++ )
    {
       s_BlocksTxBuffers[i].iAllocatedPackets = s_iCurrentMaxTxPacketsInAVideoBlock;
       for( int k=0; k<s_BlocksTxBuffers[i].iAllocatedPackets; k++ )
       {
-         s_BlocksTxBuffers[i].packetsInfo[k].pRawData = (u8*) malloc(MAX_PACKET_TOTAL_SIZE);
+         s_BlocksTxBuffers[i].packetsInfo[k].pRawData = packets_pool_alloc(&s_TxVideoPacketsPool);
          if ( NULL == s_BlocksTxBuffers[i].packetsInfo[k].pRawData )
          {
             log_error_and_alarm("[VideoTx] Failed to alocate memory for buffers.");
@@ -1180,8 +1297,9 @@ bool process_data_tx_video_init()
    }
    log_line("[VideoTx] Allocated tx buffers (%d blocks, max %d packets/block).", MAX_RXTX_BLOCKS_BUFFER, s_iCurrentMaxTxPacketsInAVideoBlock);
 
-   s_ParserH264CameraOutput.init(camera_get_active_camera_h264_slices(g_pCurrentModel));
-   s_ParserH264RadioOutput.init(camera_get_active_camera_h264_slices(g_pCurrentModel));
+   bool bH265 = (g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_GENERATE_H265)?true:false;
+   s_ParserH264CameraOutput.init(camera_get_active_camera_h264_slices(g_pCurrentModel), bH265);
+   s_ParserH264RadioOutput.init(camera_get_active_camera_h264_slices(g_pCurrentModel), bH265);
 
 
    s_uCountEncodingChanges = 0;
@@ -1228,6 +1346,8 @@ bool process_data_tx_video_init()
    s_iCurrentBlockPacketIndexToSend = 0;
 
    s_BlocksTxBuffers[0].video_block_index = 0;
+   retransmissions_index_reset(&s_RetransmissionsIndex);
+   retransmissions_index_set_block(&s_RetransmissionsIndex, 0, 0);
    s_BlocksTxBuffers[0].video_data_length = s_CurrentPHVF.video_data_length;
    s_BlocksTxBuffers[0].block_packets = s_CurrentPHVF.block_packets;
    s_BlocksTxBuffers[0].block_fecs = s_CurrentPHVF.block_fecs;
@@ -1285,9 +1405,11 @@ bool process_data_tx_video_uninit()
    for( int i=0; i<MAX_RXTX_BLOCKS_BUFFER; i++ )
    for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
    {
-      free(s_BlocksTxBuffers[i].packetsInfo[k].pRawData);
+      packets_pool_release(&s_TxVideoPacketsPool, s_BlocksTxBuffers[i].packetsInfo[k].pRawData);
       s_BlocksTxBuffers[i].packetsInfo[k].pRawData = NULL;
    }
+   packets_pool_log_stats(&s_TxVideoPacketsPool);
+   packets_pool_uninit(&s_TxVideoPacketsPool);
    return true;
 }
 
@@ -1360,28 +1482,12 @@ void _process_command_resend_packets(u8* pPacketBuffer, u8 packetType)
       pData++;
 
 
-      int iDuplicateSegmentIndex = -1;
-      for( int i=0; i<s_iCountRetransmissionsSegmentsInfo; i++ )
-         if ( (s_listRetransmissionsSegmentsInfo[i].video_block_index == requested_video_block_index) &&
-              (s_listRetransmissionsSegmentsInfo[i].video_packet_index == requested_video_packet_index) )
-         {
-            iDuplicateSegmentIndex = i;
-            break;
-         }
-
-      if ( -1 != iDuplicateSegmentIndex )
-      {
-         s_listRetransmissionsSegmentsInfo[iDuplicateSegmentIndex].uRepeatCount++;
-         g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsRetried++;
-      }
-      else if ( s_iCountRetransmissionsSegmentsInfo < MAX_HISTORY_RETRANSMISSION_INFO )
-      {
-         s_listRetransmissionsSegmentsInfo[s_iCountRetransmissionsSegmentsInfo].video_block_index = requested_video_block_index;
-         s_listRetransmissionsSegmentsInfo[s_iCountRetransmissionsSegmentsInfo].video_packet_index = requested_video_packet_index;
-         s_listRetransmissionsSegmentsInfo[s_iCountRetransmissionsSegmentsInfo].uRepeatCount = 0;
-         s_listRetransmissionsSegmentsInfo[s_iCountRetransmissionsSegmentsInfo].uReceiveTime = g_TimeNow;
+      int bIsNewSegment = 0;
+      type_retransmissions_index_segment* pSegment = retransmissions_index_add_request(&s_RetransmissionsIndex, requested_video_block_index, requested_video_packet_index, g_TimeNow, &bIsNewSegment);
+      if ( bIsNewSegment )
          g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsUnique++;
-      }
+      else if ( NULL != pSegment )
+         g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsRetried++;
       
       if ( requested_retry_count > 1 )
       {
@@ -1393,14 +1499,10 @@ void _process_command_resend_packets(u8* pPacketBuffer, u8 packetType)
       if ( requested_video_block_index > s_CurrentPHVF.video_block_index )
          continue;
 
-      int diff = s_CurrentPHVF.video_block_index-requested_video_block_index;
-      if ( diff >= s_CurrentMaxBlocksInBuffers )
+      int bufferIndex = retransmissions_index_find_block(&s_RetransmissionsIndex, requested_video_block_index);
+      if ( (bufferIndex < 0) || (bufferIndex >= s_CurrentMaxBlocksInBuffers) )
          continue;
 
-      int bufferIndex = s_currentReadBufferIndex - diff;
-      if ( bufferIndex < 0 )
-         bufferIndex += s_CurrentMaxBlocksInBuffers;
-
       if ( s_BlocksTxBuffers[bufferIndex].video_block_index != requested_video_block_index )
          continue;
 
@@ -1411,6 +1513,10 @@ void _process_command_resend_packets(u8* pPacketBuffer, u8 packetType)
            s_BlocksTxBuffers[bufferIndex].packetsInfo[requested_video_packet_index].flags != PACKET_FLAG_SENT )
          continue;
 
+      // Already resent for a previous copy of this request, still in flight
+      if ( ! retransmissions_index_should_resend(&s_RetransmissionsIndex, pSegment, g_TimeNow) )
+         continue;
+
       //log_line("Resending packet [%u/%d]", requested_video_block_index, requested_video_packet_index);
 
       _send_packet(bufferIndex, (int)requested_video_packet_index, true, false, false);
@@ -1487,28 +1593,31 @@ bool process_data_tx_video_loop()
       s_CurrentPHVF.fec_time = 2*sTimeTotalFecTimeMicroSec;
       sTimeTotalFecTimeMicroSec = 0;
 
+      if ( g_TimeNow >= s_uTimeLastBlockToECSentLog + 20000 )
+      {
+         s_uTimeLastBlockToECSentLog = g_TimeNow;
+         if ( s_uBlockToECSentCount > 0 )
+            log_line("[VideoTx] Block end to last EC packet sent: avg %u us, max %u us (%u blocks)", s_uBlockToECSentTotalMicros/s_uBlockToECSentCount, s_uBlockToECSentMaxMicros, s_uBlockToECSentCount);
+         if ( s_uCountFrameEndBlocks > 0 )
+            log_line("[VideoTx] Blocks closed early at a frame end: %u", s_uCountFrameEndBlocks);
+         s_uCountFrameEndBlocks = 0;
+         type_retransmissions_index_stats* pRetrStats = retransmissions_index_get_stats(&s_RetransmissionsIndex);
+         if ( pRetrStats->uSegmentsUnique > 0 )
+            log_line("[VideoTx] Retransmissions index: %u unique segments requested, %u retried, %u resends deduplicated, %u dropped (table full), max probes: %u",
+               pRetrStats->uSegmentsUnique, pRetrStats->uSegmentsRetried, pRetrStats->uResendsDeduplicated, pRetrStats->uSegmentsDropped, pRetrStats->uMaxProbes);
+         memset(pRetrStats, 0, sizeof(type_retransmissions_index_stats));
+         packets_pool_log_stats(&s_TxVideoPacketsPool);
+         s_uBlockToECSentTotalMicros = 0;
+         s_uBlockToECSentMaxMicros = 0;
+         s_uBlockToECSentCount = 0;
+      }
+
       // Update retransmission statistics for the last 5 secs
       // Discard all the info older than 5 secs
 
-      g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsUniqueLast5Sec = s_iCountRetransmissionsSegmentsInfo;
-      g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsRetriedLast5Sec = 0;
-
-      for( int i=s_iCountRetransmissionsSegmentsInfo-1; i>=0; i-- )
-      {
-         if ( (s_listRetransmissionsSegmentsInfo[i].uReceiveTime == 0) || (s_listRetransmissionsSegmentsInfo[i].uReceiveTime+500 < g_TimeNow) )
-         {
-            g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsUniqueLast5Sec = s_iCountRetransmissionsSegmentsInfo - i;
-             
-            // Move segments down
-
-            for( int k=0; k<s_iCountRetransmissionsSegmentsInfo-i-1; k++ )
-               memcpy((u8*)&(s_listRetransmissionsSegmentsInfo[k]), (u8*)&(s_listRetransmissionsSegmentsInfo[k+i+1]), sizeof(type_retransmissions_history_info));
-            s_iCountRetransmissionsSegmentsInfo = s_iCountRetransmissionsSegmentsInfo-i-1;
-            break;
-         }
-         if ( s_listRetransmissionsSegmentsInfo[i].uRepeatCount > 0 )
-            g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsRetriedLast5Sec++;
-      }
+      int iCountSegmentsRetried = 0;
+      g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsUniqueLast5Sec = retransmissions_index_expire(&s_RetransmissionsIndex, g_TimeNow, &iCountSegmentsRetried);
+      g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsRetriedLast5Sec = iCountSegmentsRetried;
 
       g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsUniqueLast5Sec = s_iCountLastRetransmissionsRequestsTimes;
          
@@ -1547,6 +1656,8 @@ void _parse_camera_source_h264_data(u8* pData, int iDataSize)
    if ( ! g_pCurrentModel->hasCamera() )
       return;
 
+   // The codec can be changed while the video is running
+   s_ParserH264CameraOutput.setCodec((g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_GENERATE_H265)?true:false);
    bool bStartOfFrameDetected = s_ParserH264CameraOutput.parseData(pData, iDataSize, g_TimeNow);
    if ( ! bStartOfFrameDetected )
       return;
@@ -1680,12 +1791,42 @@ bool process_data_tx_video_on_new_data(u8* pData, int iDataSize)
       // We have a new complete video packet
       if ( iBytesToCopy == iBytesLeftInCurrentVideoPacket )
       {
-         bCompleteBlock |= _onNewCompletePacketReadFromInput();
+         bCompleteBlock |= _onNewCompletePacketReadFromInput(false);
       }
    }
    return bCompleteBlock;
 }
 
+// Called at the end of each video frame read from the video source. Closes the video block being read,
+// if it's only partly filled, so that the end of the frame (and the EC packets protecting it) is sent now,
+// not when the next frame's data fills the block. Returns true if a block was closed.
+
+bool process_data_tx_video_on_end_of_frame()
+{
+   if ( NULL == g_pCurrentModel )
+      return false;
+   if ( ! (g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_FRAME_ALIGNED_BLOCKS) )
+      return false;
+   if ( s_bPauseVideoPacketsTX || (! relay_current_vehicle_must_send_own_video_feeds()) )
+      return false;
+
+   type_tx_packet_info* pPacketInfo = &(s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_currentReadBlockPacketIndex]);
+   if ( pPacketInfo->currentReadPosition > 0 )
+   {
+      // The EC is computed on the whole packet: zero the part after the frame end
+      u8* pVideoData = pPacketInfo->pRawData + sizeof(t_packet_header) + sizeof(t_packet_header_video_full_77);
+      memset(pVideoData + pPacketInfo->currentReadPosition, 0, s_BlocksTxBuffers[s_currentReadBufferIndex].video_data_length - pPacketInfo->currentReadPosition);
+      return _onNewCompletePacketReadFromInput(true);
+   }
+
+   // The frame ended on a packet boundary (or on a block boundary: nothing to close)
+   if ( 0 == s_currentReadBlockPacketIndex )
+      return false;
+   _shorten_current_read_block(s_currentReadBlockPacketIndex);
+   _close_current_read_block();
+   return true;
+}
+
 void process_data_tx_video_signal_encoding_changed()
 {
    //log_line("TXVideo: Received request to update local encode parameters.");
@@ -1712,7 +1853,6 @@ void process_data_tx_video_reset_retransmissions_history_info()
 {
    memset((u8*)&g_PHTE_Retransmissions, 0, sizeof(g_PHTE_Retransmissions));
 
-   memset((u8*)&s_listRetransmissionsSegmentsInfo, 0, sizeof(type_retransmissions_history_info) * MAX_HISTORY_RETRANSMISSION_INFO);
-   s_iCountRetransmissionsSegmentsInfo = 0;
+   retransmissions_index_reset_segments(&s_RetransmissionsIndex);
    s_iCountLastRetransmissionsRequestsTimes = 0;
 }
\ No newline at end of file
@@ -70,6 +70,7 @@ bool process_data_tx_video_loop();
 u8* process_data_tx_video_get_current_buffer_to_read_pointer();
 int process_data_tx_video_get_current_buffer_to_read_size();
 bool process_data_tx_video_on_new_data(u8* pData, int iDataSize);
+bool process_data_tx_video_on_end_of_frame();
 
 bool process_data_tx_is_on_iframe();
 int process_data_tx_video_has_packets_ready_to_send();
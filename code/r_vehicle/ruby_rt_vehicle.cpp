@@ -64,6 +64,7 @@
 #include "../base/camera_utils.h"
 #include "../base/vehicle_settings.h"
 #include "../base/hardware_radio_serial.h"
+#include "../base/event_loop.h"
 #include "../common/string_utils.h"
 #include "../common/radio_stats.h"
 #include "../common/relay_utils.h"
@@ -98,6 +99,7 @@
 #include "test_link_params.h"
 #include "video_source_csi.h"
 #include "video_source_majestic.h"
+#include "vehicle_pipeline.h"
 
 #define MAX_RECV_UPLINK_HISTORY 12
 #define SEND_ALARM_MAX_COUNT 5
@@ -134,6 +136,29 @@ u32 s_uTimeLastTryReadIPCMessages = 0;
 #define MAX_RADIO_PACKETS_TO_CACHE_LOCALLY 20
 type_received_radio_packet s_ReceivedRadioPacketsBuffer[MAX_RADIO_PACKETS_TO_CACHE_LOCALLY];
 
+// Event driven main loop: wakes up on new radio rx packets (eventfd signaled by the rx thread),
+// on new video data (video source socket/pipe), on IPC messages (timer when the IPC channels can't be waited on)
+// and on the periodic timer.
+// Falls back to the polling main loop if it can't be set up.
+
+#define VEHICLE_TIMER_IPC_MICROS 10000
+#define VEHICLE_TIMER_PERIODIC_MICROS 20000
+#define VEHICLE_LATENCY_LOG_INTERVAL_MS 20000
+// After this many video source wake ups without any video data, the source is polled from the periodic timer until it's reopened
+#define VEHICLE_MAX_EMPTY_VIDEO_READS 50
+#define VEHICLE_MAX_PIPELINE_CHUNKS_PER_LOOP 64
+
+type_event_loop s_VehicleEventLoop;
+bool s_bUseEventLoop = false;
+int s_iEventLoopVideoSource = -1;
+int s_iEventLoopCountEmptyVideoReads = 0;
+bool s_bEventLoopVideoSourcePolled = false;
+int s_iEventLoopPolledVideoFd = -1;
+int s_iCountRadioRxPacketsToProcess = 0;
+type_latency_histogram s_RadioRxDispatchLatency;
+type_latency_histogram s_VideoReadToTxLatency;
+u32 s_uTimeLastLatencyLog = 0;
+
 bool links_set_cards_frequencies_and_params(int iLinkId)
 {
    if ( NULL == g_pCurrentModel )
@@ -404,6 +429,7 @@ void reinit_radio_interfaces()
 
    u32 uTimeStart = get_current_timestamp_ms();
 
+   vehicle_pipeline_stop();
    radio_links_close_rxtx_radio_interfaces();
    if ( g_bQuit )
    {
@@ -1031,7 +1057,7 @@ void _synchronize_shared_mems()
       update_shared_mem_video_info_stats( &g_VideoInfoStatsCameraOutput, g_TimeNow);
 
       if ( NULL != g_pSM_VideoInfoStatsCameraOutput )
-         memcpy((u8*)g_pSM_VideoInfoStatsCameraOutput, (u8*)&g_VideoInfoStatsCameraOutput, sizeof(shared_mem_video_info_stats));
+         shared_mem_block_write(g_pSM_VideoInfoStatsCameraOutput, &g_VideoInfoStatsCameraOutput, sizeof(shared_mem_video_info_stats));
       else
       {
         g_pSM_VideoInfoStatsCameraOutput = shared_mem_video_info_stats_open_for_write();
@@ -1048,7 +1074,7 @@ void _synchronize_shared_mems()
       update_shared_mem_video_info_stats( &g_VideoInfoStatsRadioOut, g_TimeNow);
 
       if ( NULL != g_pSM_VideoInfoStatsRadioOut )
-         memcpy((u8*)g_pSM_VideoInfoStatsRadioOut, (u8*)&g_VideoInfoStatsRadioOut, sizeof(shared_mem_video_info_stats));
+         shared_mem_block_write(g_pSM_VideoInfoStatsRadioOut, &g_VideoInfoStatsRadioOut, sizeof(shared_mem_video_info_stats));
       else
       {
         g_pSM_VideoInfoStatsRadioOut = shared_mem_video_info_stats_radio_out_open_for_write();
@@ -1070,6 +1096,7 @@ void _synchronize_shared_mems()
 
 void cleanUp()
 {
+   vehicle_pipeline_stop();
    radio_links_close_rxtx_radio_interfaces();
 
    if ( NULL != g_pProcessorTxAudio )
@@ -1400,6 +1427,8 @@ bool bDebugNoVideoOutput = false;
 
 
 void _main_loop();
+bool _vehicle_event_loop_init();
+void _vehicle_event_loop_run();
 
 int main(int argc, char *argv[])
 {
@@ -1414,6 +1443,7 @@ int main(int argc, char *argv[])
    }
 
    log_init("Router");
+   log_enable_async();
    log_arguments(argc, argv);
 
    load_VehicleSettings();
@@ -1563,6 +1593,7 @@ int main(int argc, char *argv[])
       radio_set_debug_flag();
    }
    fec_init();
+   log_line("Using FEC kernel: %s", fec_get_kernel_name(fec_get_kernel()));
    packet_utils_init();
 
    if ( NULL != g_pProcessStats )
@@ -1685,9 +1716,6 @@ int main(int argc, char *argv[])
 
    log_line("Start sequence: Done creating audio processor.");
 
-   for( int i=0; i<MAX_RADIO_PACKETS_TO_CACHE_LOCALLY; i++ )
-      s_ReceivedRadioPacketsBuffer[i].pPacketData = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
-
    radio_duplicate_detection_init();
    radio_rx_start_rx_thread(&g_SM_RadioStats, NULL, 0, g_pCurrentModel->getVehicleFirmwareType());
    
@@ -1752,6 +1780,11 @@ int main(int argc, char *argv[])
    // -----------------------------------------------------------
    // Main loop here
    
+   latency_histogram_reset(&s_RadioRxDispatchLatency);
+   latency_histogram_reset(&s_VideoReadToTxLatency);
+   vehicle_pipeline_check_state();
+   s_bUseEventLoop = _vehicle_event_loop_init();
+
    while ( !g_bQuit )
    {
       g_TimeNow = get_current_timestamp_ms();
@@ -1760,11 +1793,18 @@ int main(int argc, char *argv[])
          g_pProcessStats->uLoopCounter++;
          g_pProcessStats->lastActiveTime = g_TimeNow;
       }
-      _main_loop();
+      if ( s_bUseEventLoop )
+         _vehicle_event_loop_run();
+      else
+         _main_loop();
       if ( g_bQuit )
          break;
    }
 
+   if ( s_bUseEventLoop )
+      event_loop_uninit(&s_VehicleEventLoop);
+   vehicle_pipeline_stop();
+
    // End main loop
    //------------------------------------------------------------
 
@@ -1851,135 +1891,204 @@ void _update_main_loop_debug_info()
 extern u8 s_uLastRadioPingId;
 extern u32 s_uLastRadioPingSentTime;
 
-void _main_loop()
+// Main loop stages, shared by the polling and the event driven main loops
+
+// Gets a batch of received radio packets and processes the high priority ones
+// (retransmissions requests, pings). Returns the number of packets in the batch.
+
+int _main_loop_radio_rx_high_priority()
 {
-   // This loop executes at least 1000 times/sec
-   // Processing riorities (highest to lowest):
-   // 1. Retransmissions requests and pings and other high priority radio messages
-   // 2. Read input video/camera streams
-   // 3. Send video to radio
-   // 4. Process other radio-in or IPC messages
-   // 5. Periodic loops (at least 20Hz)
-   // 6. Other minor tasks
- 
-   _update_main_loop_debug_info();
-   
-   int iCountRadioRxPacketsToConsume = 0;
-   int iCountRadioRxPacketsToProcess = 0;
+   int iCountRadioRxPacketsToConsume = radio_rx_has_packets_to_consume();
+   if ( iCountRadioRxPacketsToConsume <= 0 )
+      return 0;
 
-   //---------------------------------------------
-   // Check and process retransmissions and pings and other high priority radio messages
+   if ( iCountRadioRxPacketsToConsume >= MAX_RADIO_PACKETS_TO_CACHE_LOCALLY-2 )
+      iCountRadioRxPacketsToConsume = MAX_RADIO_PACKETS_TO_CACHE_LOCALLY-2;
+
+   int iCountRadioRxPacketsToProcess = radio_rx_get_received_packets(iCountRadioRxPacketsToConsume, s_ReceivedRadioPacketsBuffer);
 
-   iCountRadioRxPacketsToConsume = radio_rx_has_packets_to_consume();
-   if ( iCountRadioRxPacketsToConsume > 0 )
+   // Time the packets waited in the rx queue
+   u32 uTimeNowMicros = get_current_timestamp_micros();
+   for( int i=0; i<iCountRadioRxPacketsToProcess; i++ )
    {
-      if ( iCountRadioRxPacketsToConsume >= MAX_RADIO_PACKETS_TO_CACHE_LOCALLY-2 )
-         iCountRadioRxPacketsToConsume = MAX_RADIO_PACKETS_TO_CACHE_LOCALLY-2;
+      u32 uLatency = uTimeNowMicros - s_ReceivedRadioPacketsBuffer[i].uTimeReceivedMicros;
+      latency_histogram_add(&s_RadioRxDispatchLatency, uLatency);
+      if ( s_bUseEventLoop )
+         event_loop_add_latency_sample(&s_VehicleEventLoop, uLatency);
+   }
 
-      iCountRadioRxPacketsToProcess = radio_rx_get_received_packets(iCountRadioRxPacketsToConsume, s_ReceivedRadioPacketsBuffer);
+   for( int i=0; i<iCountRadioRxPacketsToProcess; i++ )
+   {
+      if ( g_bQuit )
+         break;
+      int iPacketLength = s_ReceivedRadioPacketsBuffer[i].iPacketLength;
+      int iRadioInterfaceIndex = s_ReceivedRadioPacketsBuffer[i].iPacketRxInterface;
+      u8* pPacket = s_ReceivedRadioPacketsBuffer[i].pPacketData;
 
-      for( int i=0; i<iCountRadioRxPacketsToProcess; i++ )
+      t_packet_header* pPH = (t_packet_header*) pPacket;
+
+      if ( radio_packet_type_is_high_priority(pPH->packet_type) )
       {
-         if ( g_bQuit )
-            break;
-         int iPacketLength = s_ReceivedRadioPacketsBuffer[i].iPacketLength;
-         int iRadioInterfaceIndex = s_ReceivedRadioPacketsBuffer[i].iPacketRxInterface;
-         u8* pPacket = s_ReceivedRadioPacketsBuffer[i].pPacketData;
+         process_received_single_radio_packet(iRadioInterfaceIndex, pPacket, iPacketLength);      
+         shared_mem_radio_stats_rx_hist_update(&g_SM_HistoryRxStats, iRadioInterfaceIndex, pPacket, g_TimeNow);
+      }
+   }
+   return iCountRadioRxPacketsToProcess;
+}
 
-         t_packet_header* pPH = (t_packet_header*) pPacket;
+// Reads the video/camera input and sends the video packets ready to send.
+// Returns the number of bytes read from the video source.
 
-         if ( radio_packet_type_is_high_priority(pPH->packet_type) )
-         {
-            process_received_single_radio_packet(iRadioInterfaceIndex, pPacket, iPacketLength);      
-            shared_mem_radio_stats_rx_hist_update(&g_SM_HistoryRxStats, iRadioInterfaceIndex, pPacket, g_TimeNow);
-         }
-      }
+// Sends the video data read from the video source to the video processor and the resulting packets to the radio
+
+void _main_loop_process_video_data(u8* pVideoData, int iReadSize, u32 uTimeReadMicros)
+{
+   if ( bDebugNoVideoOutput )
+      return;
+
+   if ( process_data_tx_video_on_new_data(pVideoData, iReadSize) )
+      s_debugVideoBlocksInCount++;
+   if ( g_pCurrentModel->isActiveCameraOpenIPC() )
+   if ( video_source_majestic_last_read_is_end_of_frame() )
+   if ( process_data_tx_video_on_end_of_frame() )
+      s_debugVideoBlocksInCount++;
+   int videoPacketsReadyToSend = process_data_tx_video_has_packets_ready_to_send();
+   if ( videoPacketsReadyToSend > 0 )
+   {
+      //log_line("DEBUG sent %d video packs", videoPacketsReadyToSend);
+      //if ( videoPacketsReadyToSend > 10 )
+      //   log_line("DEBUG video stall %d", videoPacketsReadyToSend );
+      process_data_tx_video_send_packets_ready_to_send(videoPacketsReadyToSend);
+      u32 uLatency = get_current_timestamp_micros() - uTimeReadMicros;
+      latency_histogram_add(&s_VideoReadToTxLatency, uLatency);
+      if ( vehicle_pipeline_is_running() )
+         vehicle_pipeline_add_encode_latency(uLatency);
    }
+}
 
-   //--------------------------------------------
-   // Video/camera read
+// Encode stage of the multi-threaded video pipeline: processes the video data queued by the capture thread
 
-   if ( g_pCurrentModel->hasCamera() )
+int _main_loop_video_pipelined()
+{
+   if ( s_bUseEventLoop )
+      event_loop_drain_fd(vehicle_pipeline_get_event_fd());
+
+   int iTotalRead = 0;
+   for( int i=0; i<VEHICLE_MAX_PIPELINE_CHUNKS_PER_LOOP; i++ )
    {
-      int iReadSize = 0;
-      u8* pVideoData = NULL;
+      int iLength = 0;
+      u32 uTimeCaptureMicros = 0;
+      u8* pCaptured = vehicle_pipeline_get_captured_data(&iLength, &uTimeCaptureMicros);
+      if ( NULL == pCaptured )
+         break;
 
-      if ( g_pCurrentModel->isActiveCameraCSICompatible() || g_pCurrentModel->isActiveCameraVeye() )
-         pVideoData = video_source_csi_read(&iReadSize);
+      int iReadSize = iLength;
+      u8* pVideoData = pCaptured;
       if ( g_pCurrentModel->isActiveCameraOpenIPC() )
-         pVideoData = video_source_majestic_read(&iReadSize, true);
-
-      /*
-      static int s_iDebugCountConsecutiveVReadTimeouts = 0;
-      if ( s_iDebugCountConsecutiveVReadTimeouts < 4 )
-         log_line("DBG video read %d bytes", iReadSize);
-      if ( (NULL == pVideoData) || (iReadSize <= 0) )
-         s_iDebugCountConsecutiveVReadTimeouts++;
-      else
-         s_iDebugCountConsecutiveVReadTimeouts = 0;
-      */
-
+         pVideoData = video_source_majestic_parse_raw(pCaptured, iLength, &iReadSize);
       if ( (NULL != pVideoData) && (iReadSize > 0) )
-      if ( ! bDebugNoVideoOutput )
-      {
-         if ( process_data_tx_video_on_new_data(pVideoData, iReadSize) )
-            s_debugVideoBlocksInCount++;
-         int videoPacketsReadyToSend = process_data_tx_video_has_packets_ready_to_send();
-         if ( videoPacketsReadyToSend > 0 )
-         if ( ! bDebugNoVideoOutput )
-         {
-            //log_line("DEBUG sent %d video packs", videoPacketsReadyToSend);
-            //if ( videoPacketsReadyToSend > 10 )
-            //   log_line("DEBUG video stall %d", videoPacketsReadyToSend );
-            process_data_tx_video_send_packets_ready_to_send(videoPacketsReadyToSend);
-         }
-      }
+         _main_loop_process_video_data(pVideoData, iReadSize, uTimeCaptureMicros);
+      vehicle_pipeline_release_captured_data(pCaptured);
+      iTotalRead += iLength;
    }
+   return iTotalRead;
+}
 
-   //------------------------------------------
-   // Process all the other radio-in packets
-   
-   // Consume remaining packets cached locally
+int _main_loop_video()
+{
+   if ( ! g_pCurrentModel->hasCamera() )
+      return 0;
+
+   if ( vehicle_pipeline_is_running() )
+      return _main_loop_video_pipelined();
+
+   u32 uTimeStartMicros = get_current_timestamp_micros();
+   int iReadSize = 0;
+   u8* pVideoData = NULL;
+
+   if ( g_pCurrentModel->isActiveCameraCSICompatible() || g_pCurrentModel->isActiveCameraVeye() )
+      pVideoData = video_source_csi_read(&iReadSize);
+   if ( g_pCurrentModel->isActiveCameraOpenIPC() )
+      pVideoData = video_source_majestic_read(&iReadSize, true);
+
+   /*
+   static int s_iDebugCountConsecutiveVReadTimeouts = 0;
+   if ( s_iDebugCountConsecutiveVReadTimeouts < 4 )
+      log_line("DBG video read %d bytes", iReadSize);
+   if ( (NULL == pVideoData) || (iReadSize <= 0) )
+      s_iDebugCountConsecutiveVReadTimeouts++;
+   else
+      s_iDebugCountConsecutiveVReadTimeouts = 0;
+   */
+
+   if ( (NULL == pVideoData) || (iReadSize <= 0) )
+      return 0;
+
+   _main_loop_process_video_data(pVideoData, iReadSize, uTimeStartMicros);
+
+   // Majestic datagrams are read from the socket in batches: process the rest of the batch now,
+   // the socket may not be readable anymore to wake up the event loop for them
+   int iTotalRead = iReadSize;
+   if ( g_pCurrentModel->isActiveCameraOpenIPC() )
+   while ( video_source_majestic_has_pending_data() )
+   {
+      uTimeStartMicros = get_current_timestamp_micros();
+      pVideoData = video_source_majestic_read(&iReadSize, true);
+      if ( NULL == pVideoData )
+         break;
+      if ( iReadSize <= 0 )
+         continue;
+      _main_loop_process_video_data(pVideoData, iReadSize, uTimeStartMicros);
+      iTotalRead += iReadSize;
+   }
+   return iTotalRead;
+}
+
+// Processes the rest of the radio packets (the high priority ones where already processed) and releases them
+
+void _main_loop_radio_rx_other(int iCountRadioRxPacketsToProcess)
+{
+   if ( iCountRadioRxPacketsToProcess <= 0 )
+      return;
 
    u32 uTimeStart = get_current_timestamp_ms();
 
-   if ( iCountRadioRxPacketsToProcess > 0 )
+   for( int i=0; i<iCountRadioRxPacketsToProcess; i++ )
    {
-      for( int i=0; i<iCountRadioRxPacketsToProcess; i++ )
-      {
-         if ( g_bQuit )
-            break;
-         int iPacketLength = s_ReceivedRadioPacketsBuffer[i].iPacketLength;
-         int iRadioInterfaceIndex = s_ReceivedRadioPacketsBuffer[i].iPacketRxInterface;
-         u8* pPacket = s_ReceivedRadioPacketsBuffer[i].pPacketData;
+      if ( g_bQuit )
+         break;
+      int iPacketLength = s_ReceivedRadioPacketsBuffer[i].iPacketLength;
+      int iRadioInterfaceIndex = s_ReceivedRadioPacketsBuffer[i].iPacketRxInterface;
+      u8* pPacket = s_ReceivedRadioPacketsBuffer[i].pPacketData;
 
-         // Skip retransmissions and pings as they where already processed
+      // Skip retransmissions and pings as they where already processed
 
-         t_packet_header* pPH = (t_packet_header*) pPacket;
-         if ( radio_packet_type_is_high_priority(pPH->packet_type) )
-            continue;
-         shared_mem_radio_stats_rx_hist_update(&g_SM_HistoryRxStats, iRadioInterfaceIndex, pPacket, g_TimeNow);
-         process_received_single_radio_packet(iRadioInterfaceIndex, pPacket, iPacketLength);      
-      
+      t_packet_header* pPH = (t_packet_header*) pPacket;
+      if ( radio_packet_type_is_high_priority(pPH->packet_type) )
+         continue;
+      shared_mem_radio_stats_rx_hist_update(&g_SM_HistoryRxStats, iRadioInterfaceIndex, pPacket, g_TimeNow);
+      process_received_single_radio_packet(iRadioInterfaceIndex, pPacket, iPacketLength);      
+   
 
-         u32 uTime = get_current_timestamp_ms();    
-         if ( uTime > uTimeStart + 500 )
-         {
-            log_softerror_and_alarm("Consuming radio rx packets takes too long (%u ms), read ipc messages.", uTime - uTimeStart);
-            uTimeStart = uTime;
-            _read_ipc_pipes(uTime);
-         }
-         if ( (0 != s_uTimeLastTryReadIPCMessages) && (uTime > s_uTimeLastTryReadIPCMessages + 500) )
-         {
-            log_softerror_and_alarm("Too much time since last ipc messages read (%u ms) while consuming radio messages, read ipc messages.", uTime - s_uTimeLastTryReadIPCMessages);
-            uTimeStart = uTime;
-            _read_ipc_pipes(uTime);
-         }
+      u32 uTime = get_current_timestamp_ms();    
+      if ( uTime > uTimeStart + 500 )
+      {
+         log_softerror_and_alarm("Consuming radio rx packets takes too long (%u ms), read ipc messages.", uTime - uTimeStart);
+         uTimeStart = uTime;
+         _read_ipc_pipes(uTime);
+      }
+      if ( (0 != s_uTimeLastTryReadIPCMessages) && (uTime > s_uTimeLastTryReadIPCMessages + 500) )
+      {
+         log_softerror_and_alarm("Too much time since last ipc messages read (%u ms) while consuming radio messages, read ipc messages.", uTime - s_uTimeLastTryReadIPCMessages);
+         uTimeStart = uTime;
+         _read_ipc_pipes(uTime);
       }
    }
+   radio_rx_release_received_packets();
+}
 
-   // Check Radio Rx state
-   if ( iCountRadioRxPacketsToProcess <= 0 )
+void _main_loop_check_link_to_controller()
+{
    if ( (NULL != g_pProcessStats) && (0 != g_pProcessStats->lastRadioRxTime) && (g_TimeNow > TIMEOUT_LINK_TO_CONTROLLER_LOST) && (g_pProcessStats->lastRadioRxTime + TIMEOUT_LINK_TO_CONTROLLER_LOST < g_TimeNow) )
    {
       if ( g_TimeLastReceivedRadioPacketFromController + TIMEOUT_LINK_TO_CONTROLLER_LOST < g_TimeNow )
@@ -2002,36 +2111,37 @@ void _main_loop()
          onEventRelayModeChanged(uOldRelayMode, g_pCurrentModel->relay_params.uCurrentRelayMode, "stop");
       }
    }
+}
 
-   //-------------------------------------------
-   // Process IPCs
-
-   if ( g_CoutersMainLoop.uCounter % 10 ) // execute only 1/10th times
-      return;
-
-   static u32 s_uMainLoopIPCCheckLastTime = 0;
-   if ( g_TimeNow < s_uMainLoopIPCCheckLastTime + 10 )
-      return;
-   g_TimeNow = get_current_timestamp_ms();
-   s_uMainLoopIPCCheckLastTime = g_TimeNow;
-
+void _main_loop_ipc()
+{
    _read_ipc_pipes(g_TimeNow);
    _consume_ipc_messages();
+}
 
-
-   //------------------------------------------
-   // Periodic loops
-
-   if ( g_CoutersMainLoop.uCounter % 20 ) // execute only 1/20th times
+void _log_main_loop_latency_stats()
+{
+   if ( g_TimeNow < s_uTimeLastLatencyLog + VEHICLE_LATENCY_LOG_INTERVAL_MS )
       return;
+   s_uTimeLastLatencyLog = g_TimeNow;
 
-   static u32 s_uMainLoopPeriodicCheckLastTime = 0;
-   if ( g_TimeNow < s_uMainLoopPeriodicCheckLastTime + 20 )
-      return;
-   g_TimeNow = get_current_timestamp_ms();
-   s_uMainLoopPeriodicCheckLastTime = g_TimeNow;
+   log_line("Main loop: %s, video pipeline: %s", s_bUseEventLoop?"event driven":"polling", vehicle_pipeline_is_running()?"multi-threaded":"single thread");
+   latency_histogram_log(&s_RadioRxDispatchLatency, "Radio rx queue to dispatch");
+   latency_histogram_log(&s_VideoReadToTxLatency, "Video read to radio tx");
+   latency_histogram_reset(&s_RadioRxDispatchLatency);
+   latency_histogram_reset(&s_VideoReadToTxLatency);
+   vehicle_pipeline_log_stats();
+   if ( s_bUseEventLoop )
+   {
+      event_loop_log_stats(&s_VehicleEventLoop);
+      event_loop_reset_stats(&s_VehicleEventLoop);
+   }
+}
 
+void _main_loop_periodic()
+{
    process_data_tx_video_loop();
+   vehicle_pipeline_check_state();
 
    if ( g_pCurrentModel->hasCamera() )
    {
@@ -2058,10 +2168,231 @@ void _main_loop()
    if ( NULL != g_pProcessorTxAudio )
       g_pProcessorTxAudio->tryReadAudioInputStream();
 
+   _log_main_loop_latency_stats();
+
    //----------------------------------------------
    // Other stuff
 
    if ( packets_queue_has_packets(&g_QueueRadioPacketsOut) )
       process_and_send_packets();
+}
+
+// Polling main loop
+
+void _main_loop()
+{
+   // This loop executes at least 1000 times/sec
+   // Processing riorities (highest to lowest):
+   // 1. Retransmissions requests and pings and other high priority radio messages
+   // 2. Read input video/camera streams
+   // 3. Send video to radio
+   // 4. Process other radio-in or IPC messages
+   // 5. Periodic loops (at least 20Hz)
+   // 6. Other minor tasks
+ 
+   _update_main_loop_debug_info();
+   
+   //---------------------------------------------
+   // Check and process retransmissions and pings and other high priority radio messages
+
+   int iCountRadioRxPacketsToProcess = _main_loop_radio_rx_high_priority();
+
+   //--------------------------------------------
+   // Video/camera read
+
+   _main_loop_video();
 
+   //------------------------------------------
+   // Process all the other radio-in packets
+   
+   // Consume remaining packets cached locally
+
+   _main_loop_radio_rx_other(iCountRadioRxPacketsToProcess);
+
+   // Check Radio Rx state
+   if ( iCountRadioRxPacketsToProcess <= 0 )
+      _main_loop_check_link_to_controller();
+
+   //-------------------------------------------
+   // Process IPCs
+
+   if ( g_CoutersMainLoop.uCounter % 10 ) // execute only 1/10th times
+      return;
+
+   static u32 s_uMainLoopIPCCheckLastTime = 0;
+   if ( g_TimeNow < s_uMainLoopIPCCheckLastTime + 10 )
+      return;
+   g_TimeNow = get_current_timestamp_ms();
+   s_uMainLoopIPCCheckLastTime = g_TimeNow;
+
+   _main_loop_ipc();
+
+
+   //------------------------------------------
+   // Periodic loops
+
+   if ( g_CoutersMainLoop.uCounter % 20 ) // execute only 1/20th times
+      return;
+
+   static u32 s_uMainLoopPeriodicCheckLastTime = 0;
+   if ( g_TimeNow < s_uMainLoopPeriodicCheckLastTime + 20 )
+      return;
+   g_TimeNow = get_current_timestamp_ms();
+   s_uMainLoopPeriodicCheckLastTime = g_TimeNow;
+
+   _main_loop_periodic();
+}
+
+// Event driven main loop
+// Same stages and priorities as the polling main loop: high priority radio packets,
+// then video read and send, then the other radio packets, IPC and periodic loops.
+
+int _vehicle_get_video_source_fd()
+{
+   if ( (NULL == g_pCurrentModel) || (! g_pCurrentModel->hasCamera()) )
+      return -1;
+   if ( vehicle_pipeline_is_running() )
+      return vehicle_pipeline_get_event_fd();
+   if ( g_pCurrentModel->isActiveCameraCSICompatible() || g_pCurrentModel->isActiveCameraVeye() )
+      return video_source_csi_get_read_fd();
+   if ( g_pCurrentModel->isActiveCameraOpenIPC() )
+      return video_source_majestic_get_read_fd();
+   return -1;
+}
+
+void _vehicle_on_radio_rx_event(void* pContext)
+{
+   event_loop_drain_fd(radio_rx_get_event_fd());
+   if ( s_iCountRadioRxPacketsToProcess > 0 )
+      return;
+   g_TimeNow = get_current_timestamp_ms();
+   s_iCountRadioRxPacketsToProcess = _main_loop_radio_rx_high_priority();
+}
+
+void _vehicle_on_video_event(void* pContext)
+{
+   g_TimeNow = get_current_timestamp_ms();
+   if ( _main_loop_video() > 0 )
+   {
+      s_iEventLoopCountEmptyVideoReads = 0;
+      return;
+   }
+   // Readable but nothing to read (i.e. the pipe writer is gone): stop waiting on it, the periodic timer polls it
+   s_iEventLoopCountEmptyVideoReads++;
+   if ( s_iEventLoopCountEmptyVideoReads >= VEHICLE_MAX_EMPTY_VIDEO_READS )
+   {
+      log_softerror_and_alarm("Video source is ready to read but has no data (%d times). Polling it.", s_iEventLoopCountEmptyVideoReads);
+      s_iEventLoopPolledVideoFd = s_VehicleEventLoop.sources[s_iEventLoopVideoSource].iFd;
+      s_bEventLoopVideoSourcePolled = true;
+      event_loop_set_fd(&s_VehicleEventLoop, s_iEventLoopVideoSource, -1);
+      s_iEventLoopCountEmptyVideoReads = 0;
+   }
+}
+
+void _vehicle_on_ipc_timer(void* pContext)
+{
+   g_TimeNow = get_current_timestamp_ms();
+   _main_loop_ipc();
+}
+
+void _vehicle_on_periodic_timer(void* pContext)
+{
+   g_TimeNow = get_current_timestamp_ms();
+
+   // The video source can be closed and reopened (camera restart, pipe errors): keep the event loop on the current one
+   if ( s_iEventLoopVideoSource >= 0 )
+   {
+      int iFd = _vehicle_get_video_source_fd();
+      if ( s_bEventLoopVideoSourcePolled )
+      {
+         if ( (iFd != s_iEventLoopPolledVideoFd) || (_main_loop_video() > 0) )
+         {
+            s_bEventLoopVideoSourcePolled = false;
+            event_loop_set_fd(&s_VehicleEventLoop, s_iEventLoopVideoSource, iFd);
+         }
+      }
+      else if ( iFd < 0 )
+         _main_loop_video(); // Retries to open the video source
+      else
+         event_loop_set_fd(&s_VehicleEventLoop, s_iEventLoopVideoSource, iFd);
+   }
+
+   if ( s_iCountRadioRxPacketsToProcess <= 0 )
+      _main_loop_check_link_to_controller();
+
+   _main_loop_periodic();
+}
+
+bool _vehicle_event_loop_init()
+{
+   if ( radio_rx_get_event_fd() < 0 )
+   {
+      log_softerror_and_alarm("No radio rx event fd. Using polling main loop.");
+      return false;
+   }
+   if ( ! event_loop_init(&s_VehicleEventLoop) )
+      return false;
+
+   bool bOk = true;
+   s_iEventLoopVideoSource = -1;
+   s_iCountRadioRxPacketsToProcess = 0;
+   if ( event_loop_add_fd(&s_VehicleEventLoop, "radio_rx", radio_rx_get_event_fd(), EVENT_LOOP_PRIORITY_HIGHEST, EVENT_LOOP_FLAG_CUSTOM_LATENCY, _vehicle_on_radio_rx_event, NULL) < 0 )
+      bOk = false;
+   if ( g_pCurrentModel->hasCamera() )
+   {
+      s_iEventLoopVideoSource = event_loop_add_fd(&s_VehicleEventLoop, "video", _vehicle_get_video_source_fd(), EVENT_LOOP_PRIORITY_HIGH, 0, _vehicle_on_video_event, NULL);
+      if ( s_iEventLoopVideoSource < 0 )
+         bOk = false;
+   }
+   // IPC channels are waited on by their doorbell fd; the ones that can't be (message queues, FIFOs) are polled on a timer
+   bool bIPCNeedsTimer = false;
+   int iIPCChannels[3] = { s_fIPCRouterFromCommands, s_fIPCRouterFromTelemetry, s_fIPCRouterFromRC };
+   const char* szIPCNames[3] = { "ipc_commands", "ipc_telemetry", "ipc_rc" };
+   for( int i=0; i<3; i++ )
+   {
+      if ( iIPCChannels[i] < 0 )
+         continue;
+      int iFd = ruby_ipc_get_pollable_fd(iIPCChannels[i]);
+      if ( iFd < 0 )
+         bIPCNeedsTimer = true;
+      else if ( event_loop_add_fd(&s_VehicleEventLoop, szIPCNames[i], iFd, EVENT_LOOP_PRIORITY_NORMAL, 0, _vehicle_on_ipc_timer, NULL) < 0 )
+         bOk = false;
+   }
+   if ( bIPCNeedsTimer )
+   if ( event_loop_add_timer(&s_VehicleEventLoop, "ipc", VEHICLE_TIMER_IPC_MICROS, EVENT_LOOP_PRIORITY_NORMAL, _vehicle_on_ipc_timer, NULL) < 0 )
+      bOk = false;
+   if ( event_loop_add_timer(&s_VehicleEventLoop, "periodic", VEHICLE_TIMER_PERIODIC_MICROS, EVENT_LOOP_PRIORITY_LOW, _vehicle_on_periodic_timer, NULL) < 0 )
+      bOk = false;
+
+   if ( ! bOk )
+   {
+      log_softerror_and_alarm("Failed to setup the event driven main loop. Using polling main loop.");
+      event_loop_uninit(&s_VehicleEventLoop);
+      s_iEventLoopVideoSource = -1;
+      return false;
+   }
+   log_line("Using event driven main loop.");
+   return true;
+}
+
+void _vehicle_event_loop_run()
+{
+   _update_main_loop_debug_info();
+
+   int iTimeoutMs = 100;
+   if ( radio_rx_arm_event_fd() )
+   {
+      // Packets are already waiting: process the high priority ones now, then the other ready sources, without waiting
+      g_TimeNow = get_current_timestamp_ms();
+      s_iCountRadioRxPacketsToProcess = _main_loop_radio_rx_high_priority();
+      iTimeoutMs = 0;
+   }
+   event_loop_run_once(&s_VehicleEventLoop, iTimeoutMs);
+
+   if ( s_iCountRadioRxPacketsToProcess > 0 )
+   {
+      g_TimeNow = get_current_timestamp_ms();
+      _main_loop_radio_rx_other(s_iCountRadioRxPacketsToProcess);
+      s_iCountRadioRxPacketsToProcess = 0;
+   }
 }
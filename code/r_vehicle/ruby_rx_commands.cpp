@@ -35,8 +35,10 @@
 #include "../base/config.h"
 #include "../base/hw_procs.h"
 #include "../base/commands.h"
+#include "../base/command_window.h"
 #include "../base/models.h"
 #include "../base/models_list.h"
+#include "../base/model_sync.h"
 #include "../base/radio_utils.h"
 #include "../base/hardware.h"
 #include "../base/hardware_camera.h"
@@ -79,6 +81,9 @@ u8 lastRecvCommandReplyBuffer[MAX_COMMAND_REPLY_BUFFER];
 int lastRecvCommandReplyBufferLength = 0;
 u32 s_CurrentResponseCounter = 0;
 
+// Commands received through the commands window (from controllers that have more commands in flight)
+static type_command_window_rx s_CommandsWindowRx;
+
 
 int s_fIPCFromRouter = -1;
 int s_fIPCToRouter = -1;
@@ -97,6 +102,7 @@ static u32 s_ZIPParams_uLastRecvCommandNumber = 0;
 static u32 s_ZIPPAarams_uLastRecvCommandTime = 0;
 static u8  s_ZIPParams_Model_Buffer[3048];
 static int s_ZIPParams_Model_BufferLength = 0;
+static int s_ZIPParams_iResponseParam = 1;
 
 static shared_mem_video_link_overwrites s_CurrentVideoLinkOverwrites;
 
@@ -196,6 +202,51 @@ bool _populate_camera_name()
    return bCameraNameUpdated;
 }
 
+// Sets the reply for the get all params command to the changes of the current model file against
+// the version the controller has, if the vehicle still has that version.
+// The current version is kept as a base for the next requests.
+void _build_model_settings_delta(u32 uBaseHash, bool bSmallSegments)
+{
+   static u8 s_uModelFileBuffer[MODEL_SYNC_MAX_FILE_SIZE];
+   static u8 s_uModelBaseBuffer[MODEL_SYNC_MAX_FILE_SIZE];
+
+   char szFile[MAX_FILE_PATH_SIZE];
+   strcpy(szFile, FOLDER_CONFIG);
+   strcat(szFile, FILE_CONFIG_CURRENT_VEHICLE_MODEL);
+   int iLength = model_sync_read_file(szFile, s_uModelFileBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iLength <= 0 )
+   {
+      log_softerror_and_alarm("[ModelSync] Failed to read current vehicle configuration from file: [%s]", szFile);
+      return;
+   }
+   model_sync_save_sent_base(s_uModelFileBuffer, iLength);
+
+   if ( 0 == uBaseHash )
+   {
+      log_line("[ModelSync] Controller has no model settings from this vehicle. Send all model settings.");
+      return;
+   }
+   int iBaseLength = model_sync_load_sent_base(uBaseHash, s_uModelBaseBuffer, MODEL_SYNC_MAX_FILE_SIZE);
+   if ( iBaseLength < 0 )
+   {
+      log_line("[ModelSync] Controller has unknown model settings version %08X. Send all model settings.", uBaseHash);
+      return;
+   }
+
+   int iMaxLength = MODEL_SYNC_MAX_DELTA_SIZE;
+   if ( bSmallSegments )
+      iMaxLength = 150;
+   int iDeltaLength = model_sync_encode_delta(s_uModelBaseBuffer, iBaseLength, s_uModelFileBuffer, iLength, s_ZIPParams_Model_Buffer, iMaxLength);
+   if ( iDeltaLength <= 0 )
+   {
+      log_line("[ModelSync] Model settings changes from version %08X are too large. Send all model settings.", uBaseHash);
+      return;
+   }
+   s_ZIPParams_Model_BufferLength = iDeltaLength;
+   s_ZIPParams_iResponseParam = MODEL_SYNC_RESPONSE_PARAM_DELTA;
+   log_line("[ModelSync] Model settings changes from version %08X: %d bytes (model file: %d bytes).", uBaseHash, iDeltaLength, iLength);
+}
+
 void populate_model_settings_buffer()
 {
    _populate_camera_name();
@@ -507,35 +558,49 @@ void setCommandReplyBufferExtra(u8* pData, int length, u8* pExtra, int extra)
       memcpy(lastRecvCommandReplyBuffer+length, pExtra, extra);
 }
 
- 
-void sendCommandReply(u8 responseFlags, int iResponseExtraParam, int delayMiliSec)
-{
-   if ( lastRecvCommandType & COMMAND_TYPE_FLAG_NO_RESPONSE_NEEDED )
-      return;
-
-   lastRecvCommandResponseFlags = responseFlags;
 
+static void _send_command_response(u16 uOriginCommandType, u32 uOriginCommandCounter, u8 uOriginResendCounter, u8 uResponseFlags, u32 uResponseParam, u8* pReply, int iReplyLength)
+{
    t_packet_header PH;
    t_packet_header_command_response PHCR;
 
    radio_packet_init(&PH, PACKET_COMPONENT_COMMANDS, PACKET_TYPE_COMMAND_RESPONSE, STREAM_ID_DATA);
    PH.vehicle_id_src = g_pCurrentModel->uVehicleId;
    PH.vehicle_id_dest = lastRecvSourceControllerId;
-   PH.total_length = sizeof(t_packet_header)+sizeof(t_packet_header_command_response) + lastRecvCommandReplyBufferLength;
-
+   PH.total_length = sizeof(t_packet_header)+sizeof(t_packet_header_command_response) + iReplyLength;
 
-   PHCR.origin_command_type = lastRecvCommandType;
-   PHCR.origin_command_counter = lastRecvCommandNumber;
-   PHCR.origin_command_resend_counter = lastRecvCommandResendCounter;
-   PHCR.command_response_flags = lastRecvCommandResponseFlags;
-   PHCR.command_response_param = iResponseExtraParam;
+   PHCR.origin_command_type = uOriginCommandType;
+   PHCR.origin_command_counter = uOriginCommandCounter;
+   PHCR.origin_command_resend_counter = uOriginResendCounter;
+   PHCR.command_response_flags = uResponseFlags;
+   PHCR.command_response_param = uResponseParam;
    PHCR.response_counter = s_CurrentResponseCounter;
+
+   // Windowed commands: tell the controller what commands before this one were received
+   if ( uOriginCommandType & COMMAND_TYPE_FLAG_WINDOWED )
+   {
+      PHCR.origin_command_type |= COMMAND_TYPE_FLAG_WINDOW_ACK;
+      PHCR.response_counter = command_window_rx_get_ack_bitmap(&s_CommandsWindowRx, uOriginCommandCounter, g_TimeNow);
+   }
    
    u8 buffer[MAX_PACKET_TOTAL_SIZE];
    memcpy(buffer, (u8*)&PH, sizeof(t_packet_header));
    memcpy(buffer+sizeof(t_packet_header), (u8*)&PHCR, sizeof(t_packet_header_command_response));
-   memcpy(buffer+sizeof(t_packet_header)+sizeof(t_packet_header_command_response), lastRecvCommandReplyBuffer, lastRecvCommandReplyBufferLength);
+   memcpy(buffer+sizeof(t_packet_header)+sizeof(t_packet_header_command_response), pReply, iReplyLength);
    ruby_ipc_channel_send_message(s_fIPCToRouter, buffer, PH.total_length);
+}
+
+void sendCommandReply(u8 responseFlags, int iResponseExtraParam, int delayMiliSec)
+{
+   if ( lastRecvCommandType & COMMAND_TYPE_FLAG_NO_RESPONSE_NEEDED )
+      return;
+
+   lastRecvCommandResponseFlags = responseFlags;
+
+   if ( lastRecvCommandType & COMMAND_TYPE_FLAG_WINDOWED )
+      command_window_rx_set_response(&s_CommandsWindowRx, lastRecvCommandNumber, lastRecvCommandResponseFlags, (u32)iResponseExtraParam, lastRecvCommandReplyBuffer, lastRecvCommandReplyBufferLength);
+
+   _send_command_response(lastRecvCommandType, lastRecvCommandNumber, lastRecvCommandResendCounter, lastRecvCommandResponseFlags, (u32)iResponseExtraParam, lastRecvCommandReplyBuffer, lastRecvCommandReplyBufferLength);
 
    char szBuff[64];
    szBuff[0] = 0;
@@ -2981,6 +3046,15 @@ bool process_command(u8* pBuffer, int length)
       if ( pPHC->command_param & (((u32)0x01)<<6) )
          bSendBackSmallSegments = true;
 
+      t_model_sync_request syncRequest;
+      bool bControllerCanApplyDelta = false;
+      if ( iParamsLength >= (int)sizeof(t_model_sync_request) )
+      {
+         memcpy(&syncRequest, pBuffer + sizeof(t_packet_header) + sizeof(t_packet_header_command), sizeof(t_model_sync_request));
+         if ( syncRequest.uMagic == MODEL_SYNC_REQUEST_MAGIC )
+            bControllerCanApplyDelta = true;
+      }
+
       u32 wifiGuardDelay = ((pPHC->command_param>>16) & 0xFF);
       if ( wifiGuardDelay != ((g_pCurrentModel->uDeveloperFlags >> 8) & 0xFF) )
       {
@@ -3064,6 +3138,14 @@ bool process_command(u8* pBuffer, int length)
       log_line("Current on time: %02d:%02d, current flights: %d", g_pCurrentModel->m_Stats.uCurrentOnTime/60, g_pCurrentModel->m_Stats.uCurrentOnTime%60, g_pCurrentModel->m_Stats.uTotalFlights);
 
       if ( bNewZIPCommand )
+      {
+         s_ZIPParams_Model_BufferLength = 0;
+         s_ZIPParams_iResponseParam = 1;
+         if ( bControllerCanApplyDelta )
+            _build_model_settings_delta(syncRequest.uBaseHash, bSendBackSmallSegments);
+      }
+
+      if ( bNewZIPCommand && (0 == s_ZIPParams_Model_BufferLength) )
       {
          char szComm[256];
          sprintf(szComm, "rm -rf %s/model.tar* 2>/dev/null", FOLDER_RUBY_TEMP);
@@ -3108,10 +3190,14 @@ bool process_command(u8* pBuffer, int length)
       }
 
       setCommandReplyBuffer(s_ZIPParams_Model_Buffer, s_ZIPParams_Model_BufferLength);
-      sendCommandReply(COMMAND_RESPONSE_FLAGS_OK, 1, 20);
-      log_line("Sent back to router all model settings in one single command response. Total compressed size: %d bytes", s_ZIPParams_Model_BufferLength);
+      sendCommandReply(COMMAND_RESPONSE_FLAGS_OK, s_ZIPParams_iResponseParam, 20);
+      if ( s_ZIPParams_iResponseParam == MODEL_SYNC_RESPONSE_PARAM_DELTA )
+         log_line("Sent back to router the model settings changes in one single command response. Total size: %d bytes", s_ZIPParams_Model_BufferLength);
+      else
+         log_line("Sent back to router all model settings in one single command response. Total compressed size: %d bytes", s_ZIPParams_Model_BufferLength);
       
-      if ( bSendBackSmallSegments )
+      // A delta always fits in a small segment
+      if ( bSendBackSmallSegments && (s_ZIPParams_iResponseParam != MODEL_SYNC_RESPONSE_PARAM_DELTA) )
       {
          int iSegmentSize = 150;
          int iPos = 0;
@@ -3570,10 +3656,31 @@ void on_received_command(u8* pBuffer, int length)
       return;
    }
 
+   // Windowed commands: resent commands (the controller did not get the response) are answered with the
+   // response sent the first time, even if newer commands were received since then. They are not processed again.
+
+   if ( pPHC->command_type & COMMAND_TYPE_FLAG_WINDOWED )
+   {
+      type_command_window_rx_entry* pEntry = command_window_rx_find(&s_CommandsWindowRx, pPH->vehicle_id_src, pPHC->command_counter, g_TimeNow);
+      if ( NULL != pEntry )
+      {
+         if ( pEntry->bHasResponse )
+         {
+            log_line_commands("Resending response to windowed command nb.%d, retry count: %d, type: %s", pPHC->command_counter, pPHC->command_resend_counter, commands_get_description(((pPHC->command_type) & COMMAND_TYPE_MASK)));
+            lastRecvSourceControllerId = pPH->vehicle_id_src;
+            _send_command_response(pPHC->command_type, pPHC->command_counter, pPHC->command_resend_counter, pEntry->uResponseFlags, pEntry->uResponseParam, pEntry->uReply, pEntry->iReplyLength);
+            s_CurrentResponseCounter++;
+         }
+         return;
+      }
+      command_window_rx_add(&s_CommandsWindowRx, pPH->vehicle_id_src, pPHC->command_counter, g_TimeNow);
+   }
+
    // Ignore commands that are resent multiple times
    // Respond to same command retry.
    // Except for commands that do not requires a response, those just process them. (COMMAND_ID_SET_OSD_CURRENT_LAYOUT)
 
+   if ( ! (pPHC->command_type & COMMAND_TYPE_FLAG_WINDOWED) )
    if ( (pPHC->command_type & COMMAND_TYPE_MASK) != COMMAND_ID_SET_OSD_CURRENT_LAYOUT )
    if ( pPHC->command_counter == lastRecvCommandNumber )
    if ( (lastRecvCommandTime != 0) && (g_TimeNow >= lastRecvCommandTime) && (g_TimeNow < lastRecvCommandTime+4000) )
@@ -3704,6 +3811,7 @@ int r_start_commands_rx(int argc, char* argv[])
    video_overwrites_init( &s_CurrentVideoLinkOverwrites, g_pCurrentModel );
 
    process_sw_upload_init();
+   command_window_rx_reset(&s_CommandsWindowRx);
 
    s_InfoLastFileUploaded.uLastFileId = MAX_U32;
    s_InfoLastFileUploaded.szFileName[0] = 0;
@@ -3776,6 +3884,8 @@ int r_start_commands_rx(int argc, char* argv[])
                   g_pCurrentModel->relay_params.uCurrentRelayMode = RELAY_MODE_MAIN | RELAY_MODE_IS_RELAY_NODE;
             }
             s_InfoLastFileUploaded.uLastCommandIdForThisFile = 0;
+            // The controller (re)started: its command counters start over
+            command_window_rx_reset(&s_CommandsWindowRx);
          }
 
          if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_LOCAL_CONTROL )
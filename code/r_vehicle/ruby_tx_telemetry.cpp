@@ -131,6 +131,10 @@ t_packet_header_rc_info_downstream* s_pPHDownstreamInfoRC = NULL; // Info to sen
 
 shared_mem_video_info_stats* s_pSM_VideoInfoStats = NULL;
 shared_mem_video_info_stats* s_pSM_VideoInfoStatsRadioOut = NULL;
+shared_mem_video_info_stats s_VideoInfoStatsCopy;
+shared_mem_video_info_stats s_VideoInfoStatsRadioOutCopy;
+u32 s_uVideoInfoStatsGeneration = 0;
+u32 s_uVideoInfoStatsRadioOutGeneration = 0;
 shared_mem_radio_stats_rx_hist* s_pSM_HistoryRxStats = NULL;
 
 static u32 s_uCurrentVideoProfile = MAX_U32;
@@ -1740,9 +1744,13 @@ void _send_telemetry_to_controller()
       sPH.vehicle_id_src = g_pCurrentModel->uVehicleId;
       sPH.total_length = (u16)sizeof(t_packet_header) + 2*(u16)sizeof(shared_mem_video_info_stats);
 
+      // Local copies are refreshed only when the router updated the shared mem blocks
+      shared_mem_block_read(s_pSM_VideoInfoStats, &s_VideoInfoStatsCopy, sizeof(shared_mem_video_info_stats), &s_uVideoInfoStatsGeneration);
+      shared_mem_block_read(s_pSM_VideoInfoStatsRadioOut, &s_VideoInfoStatsRadioOutCopy, sizeof(shared_mem_video_info_stats), &s_uVideoInfoStatsRadioOutGeneration);
+
       memcpy(buffer, &sPH, sizeof(t_packet_header));
-      memcpy(buffer+sizeof(t_packet_header), (u8*)s_pSM_VideoInfoStats, sizeof(shared_mem_video_info_stats));
-      memcpy(buffer+sizeof(t_packet_header) + sizeof(shared_mem_video_info_stats), (u8*)s_pSM_VideoInfoStatsRadioOut, sizeof(shared_mem_video_info_stats));
+      memcpy(buffer+sizeof(t_packet_header), (u8*)&s_VideoInfoStatsCopy, sizeof(shared_mem_video_info_stats));
+      memcpy(buffer+sizeof(t_packet_header) + sizeof(shared_mem_video_info_stats), (u8*)&s_VideoInfoStatsRadioOutCopy, sizeof(shared_mem_video_info_stats));
       
       if ( s_bRouterReady && (! s_bRadioInterfacesReinitIsInProgress) )
       {
@@ -0,0 +1,321 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+        * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/models.h"
+#include "../base/hw_procs.h"
+#include "../base/packets_pool.h"
+#include "../base/spsc_queue.h"
+#include "../base/event_loop.h"
+#include "../radio/radiolink.h"
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "shared_vars.h"
+#include "timers.h"
+#include "video_source_csi.h"
+#include "video_source_majestic.h"
+#include "vehicle_pipeline.h"
+
+#define VEHICLE_PIPELINE_VIDEO_SOURCE_MAJESTIC 1
+#define VEHICLE_PIPELINE_VIDEO_SOURCE_CSI 2
+
+#define VEHICLE_PIPELINE_CAPTURE_BUFFER_SIZE 4096
+#define VEHICLE_PIPELINE_CAPTURE_BUFFERS 256
+#define VEHICLE_PIPELINE_CAPTURE_READ_TIMEOUT_MS 20
+#define VEHICLE_PIPELINE_RETRY_START_INTERVAL_MS 5000
+
+// At the start of each capture pool buffer, followed by the captured data
+typedef struct
+{
+   u32 uTimeCaptureMicros;
+   int iLength;
+   u32 uReserved[2];
+} t_vehicle_pipeline_captured;
+
+static bool s_bVehiclePipelineRunning = false;
+static volatile int s_iVehiclePipelineQuit = 0;
+static int s_iVehiclePipelineVideoSource = 0;
+static int s_iVehiclePipelineCaptureCore = 0;
+static int s_iVehiclePipelineEventFd = -1;
+static u32 s_uVehiclePipelineTimeLastStartFailed = 0;
+static pthread_t s_pThreadVehiclePipelineCapture;
+static type_packets_pool s_VehiclePipelineCapturePool;
+static type_spsc_queue s_VehiclePipelineCaptureQueue;
+
+// Written by the capture thread
+static u32 s_uVehiclePipelineCapturedChunks = 0;
+static u32 s_uVehiclePipelineCapturedBytes = 0;
+static u32 s_uVehiclePipelineDroppedChunks = 0;
+static u32 s_uVehiclePipelineReadErrors = 0;
+// Written by the main thread
+static type_latency_histogram s_VehiclePipelineEncodeLatency;
+
+bool vehicle_pipeline_is_enabled_in_model()
+{
+   if ( (NULL == g_pCurrentModel) || (! g_pCurrentModel->hasCamera()) )
+      return false;
+   if ( ! (g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_MULTITHREADED_PIPELINE) )
+      return false;
+   if ( g_pCurrentModel->isActiveCameraOpenIPC() || g_pCurrentModel->isActiveCameraCSICompatible() || g_pCurrentModel->isActiveCameraVeye() )
+      return true;
+   return false;
+}
+
+void vehicle_pipeline_check_state()
+{
+   if ( g_bReinitializeRadioInProgress )
+      return;
+
+   bool bEnabled = vehicle_pipeline_is_enabled_in_model();
+   if ( (! bEnabled) && s_bVehiclePipelineRunning )
+      vehicle_pipeline_stop();
+
+   if ( bEnabled && (! s_bVehiclePipelineRunning) )
+   if ( (0 == s_uVehiclePipelineTimeLastStartFailed) || (g_TimeNow > s_uVehiclePipelineTimeLastStartFailed + VEHICLE_PIPELINE_RETRY_START_INTERVAL_MS) )
+   {
+      if ( ! vehicle_pipeline_start() )
+         s_uVehiclePipelineTimeLastStartFailed = g_TimeNow;
+      else
+         s_uVehiclePipelineTimeLastStartFailed = 0;
+   }
+}
+
+static void * _thread_vehicle_pipeline_capture(void *argument)
+{
+   log_line("[VideoPipeline] Capture thread started.");
+   if ( s_iVehiclePipelineCaptureCore > 0 )
+      hw_set_current_thread_affinity("[VideoPipeline]", s_iVehiclePipelineCaptureCore, s_iVehiclePipelineCaptureCore);
+
+   while ( ! s_iVehiclePipelineQuit )
+   {
+      u8* pBuffer = packets_pool_alloc(&s_VehiclePipelineCapturePool);
+      if ( NULL == pBuffer )
+      {
+         // Encode stage is behind; the data waits in the video source (socket/pipe) buffers meanwhile
+         hardware_sleep_micros(500);
+         continue;
+      }
+
+      u8* pData = pBuffer + sizeof(t_vehicle_pipeline_captured);
+      int iRead = 0;
+      if ( VEHICLE_PIPELINE_VIDEO_SOURCE_MAJESTIC == s_iVehiclePipelineVideoSource )
+         iRead = video_source_majestic_read_raw(pData, VEHICLE_PIPELINE_CAPTURE_BUFFER_SIZE, VEHICLE_PIPELINE_CAPTURE_READ_TIMEOUT_MS);
+      else
+         iRead = video_source_csi_read_raw(pData, VEHICLE_PIPELINE_CAPTURE_BUFFER_SIZE, VEHICLE_PIPELINE_CAPTURE_READ_TIMEOUT_MS);
+
+      if ( iRead <= 0 )
+      {
+         packets_pool_release(&s_VehiclePipelineCapturePool, pBuffer);
+         if ( iRead < 0 )
+         {
+            s_uVehiclePipelineReadErrors++;
+            hardware_sleep_ms(VEHICLE_PIPELINE_CAPTURE_READ_TIMEOUT_MS);
+         }
+         continue;
+      }
+
+      t_vehicle_pipeline_captured* pCaptured = (t_vehicle_pipeline_captured*)pBuffer;
+      pCaptured->uTimeCaptureMicros = get_current_timestamp_micros();
+      pCaptured->iLength = iRead;
+
+      if ( ! spsc_queue_push(&s_VehiclePipelineCaptureQueue, pBuffer) )
+      {
+         packets_pool_release(&s_VehiclePipelineCapturePool, pBuffer);
+         s_uVehiclePipelineDroppedChunks++;
+         continue;
+      }
+      s_uVehiclePipelineCapturedChunks++;
+      s_uVehiclePipelineCapturedBytes += iRead;
+
+      u64 uValue = 1;
+      if ( sizeof(uValue) != write(s_iVehiclePipelineEventFd, &uValue, sizeof(uValue)) )
+         log_softerror_and_alarm("[VideoPipeline] Failed to signal captured data.");
+   }
+   log_line("[VideoPipeline] Capture thread stopped.");
+   return NULL;
+}
+
+bool vehicle_pipeline_start()
+{
+   if ( s_bVehiclePipelineRunning )
+      return true;
+   if ( (NULL == g_pCurrentModel) || (! g_pCurrentModel->hasCamera()) )
+      return false;
+
+   s_iVehiclePipelineVideoSource = VEHICLE_PIPELINE_VIDEO_SOURCE_CSI;
+   if ( g_pCurrentModel->isActiveCameraOpenIPC() )
+      s_iVehiclePipelineVideoSource = VEHICLE_PIPELINE_VIDEO_SOURCE_MAJESTIC;
+
+   // Encode (main thread) on core 1, capture on core 2, tx on the last core (core 2 on dual core CPUs)
+   int iCPUCores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+   int iTxCore = 0;
+   s_iVehiclePipelineCaptureCore = 0;
+   if ( iCPUCores >= 2 )
+   {
+      s_iVehiclePipelineCaptureCore = 2;
+      iTxCore = (iCPUCores >= 3)?iCPUCores:2;
+   }
+   log_line("[VideoPipeline] Starting (video source: %s, %d CPU cores, capture core: %d, tx core: %d)...",
+      (s_iVehiclePipelineVideoSource == VEHICLE_PIPELINE_VIDEO_SOURCE_MAJESTIC)?"majestic":"CSI", iCPUCores, s_iVehiclePipelineCaptureCore, iTxCore);
+
+   if ( ! packets_pool_init(&s_VehiclePipelineCapturePool, "video_capture", sizeof(t_vehicle_pipeline_captured) + VEHICLE_PIPELINE_CAPTURE_BUFFER_SIZE, VEHICLE_PIPELINE_CAPTURE_BUFFERS, 0) )
+      return false;
+   if ( ! spsc_queue_init(&s_VehiclePipelineCaptureQueue, VEHICLE_PIPELINE_CAPTURE_BUFFERS) )
+   {
+      packets_pool_uninit(&s_VehiclePipelineCapturePool);
+      return false;
+   }
+   s_iVehiclePipelineEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if ( s_iVehiclePipelineEventFd < 0 )
+   {
+      log_softerror_and_alarm("[VideoPipeline] Failed to create eventfd, error: %s", strerror(errno));
+      spsc_queue_uninit(&s_VehiclePipelineCaptureQueue);
+      packets_pool_uninit(&s_VehiclePipelineCapturePool);
+      return false;
+   }
+   if ( ! radio_tx_async_start(iTxCore) )
+   {
+      log_softerror_and_alarm("[VideoPipeline] Failed to start the radio tx thread.");
+      close(s_iVehiclePipelineEventFd);
+      s_iVehiclePipelineEventFd = -1;
+      spsc_queue_uninit(&s_VehiclePipelineCaptureQueue);
+      packets_pool_uninit(&s_VehiclePipelineCapturePool);
+      return false;
+   }
+
+   s_iVehiclePipelineQuit = 0;
+   s_uVehiclePipelineCapturedChunks = 0;
+   s_uVehiclePipelineCapturedBytes = 0;
+   s_uVehiclePipelineDroppedChunks = 0;
+   s_uVehiclePipelineReadErrors = 0;
+   latency_histogram_reset(&s_VehiclePipelineEncodeLatency);
+
+   if ( 0 != pthread_create(&s_pThreadVehiclePipelineCapture, NULL, &_thread_vehicle_pipeline_capture, NULL) )
+   {
+      log_softerror_and_alarm("[VideoPipeline] Failed to create the capture thread.");
+      radio_tx_async_stop();
+      close(s_iVehiclePipelineEventFd);
+      s_iVehiclePipelineEventFd = -1;
+      spsc_queue_uninit(&s_VehiclePipelineCaptureQueue);
+      packets_pool_uninit(&s_VehiclePipelineCapturePool);
+      return false;
+   }
+
+   if ( iCPUCores >= 2 )
+      hw_set_current_thread_affinity("[VideoPipeline] Main thread:", 1, 1);
+
+   s_bVehiclePipelineRunning = true;
+   log_line("[VideoPipeline] Started.");
+   return true;
+}
+
+void vehicle_pipeline_stop()
+{
+   if ( ! s_bVehiclePipelineRunning )
+      return;
+   log_line("[VideoPipeline] Stopping...");
+   s_iVehiclePipelineQuit = 1;
+   pthread_join(s_pThreadVehiclePipelineCapture, NULL);
+   s_bVehiclePipelineRunning = false;
+
+   // Captured data not processed yet is discarded
+   int iDiscarded = 0;
+   u8* pBuffer = NULL;
+   while ( NULL != (pBuffer = (u8*)spsc_queue_pop(&s_VehiclePipelineCaptureQueue)) )
+   {
+      packets_pool_release(&s_VehiclePipelineCapturePool, pBuffer);
+      iDiscarded++;
+   }
+   radio_tx_async_stop();
+
+   close(s_iVehiclePipelineEventFd);
+   s_iVehiclePipelineEventFd = -1;
+   spsc_queue_uninit(&s_VehiclePipelineCaptureQueue);
+   packets_pool_uninit(&s_VehiclePipelineCapturePool);
+   log_line("[VideoPipeline] Stopped. Discarded %d captured video chunks.", iDiscarded);
+}
+
+bool vehicle_pipeline_is_running()
+{
+   return s_bVehiclePipelineRunning;
+}
+
+int vehicle_pipeline_get_event_fd()
+{
+   return s_iVehiclePipelineEventFd;
+}
+
+u8* vehicle_pipeline_get_captured_data(int* piLength, u32* puTimeCaptureMicros)
+{
+   if ( ! s_bVehiclePipelineRunning )
+      return NULL;
+   u8* pBuffer = (u8*) spsc_queue_pop(&s_VehiclePipelineCaptureQueue);
+   if ( NULL == pBuffer )
+      return NULL;
+   t_vehicle_pipeline_captured* pCaptured = (t_vehicle_pipeline_captured*)pBuffer;
+   if ( NULL != piLength )
+      *piLength = pCaptured->iLength;
+   if ( NULL != puTimeCaptureMicros )
+      *puTimeCaptureMicros = pCaptured->uTimeCaptureMicros;
+   return pBuffer + sizeof(t_vehicle_pipeline_captured);
+}
+
+void vehicle_pipeline_release_captured_data(u8* pData)
+{
+   if ( NULL != pData )
+      packets_pool_release(&s_VehiclePipelineCapturePool, pData);
+}
+
+void vehicle_pipeline_add_encode_latency(u32 uMicros)
+{
+   latency_histogram_add(&s_VehiclePipelineEncodeLatency, uMicros);
+}
+
+void vehicle_pipeline_log_stats()
+{
+   if ( ! s_bVehiclePipelineRunning )
+      return;
+
+   log_line("[VideoPipeline] Captured %u chunks (%u bytes), dropped %u chunks, read errors: %u, capture queue max used: %u of %d",
+      s_uVehiclePipelineCapturedChunks, s_uVehiclePipelineCapturedBytes, s_uVehiclePipelineDroppedChunks, s_uVehiclePipelineReadErrors,
+      s_VehiclePipelineCaptureQueue.uMaxUsed, spsc_queue_get_capacity(&s_VehiclePipelineCaptureQueue));
+   latency_histogram_log(&s_VehiclePipelineEncodeLatency, "Video pipeline capture to tx queue");
+   latency_histogram_reset(&s_VehiclePipelineEncodeLatency);
+
+   t_radio_tx_async_stats* pTxStats = radio_tx_async_get_stats();
+   log_line("[VideoPipeline] Radio tx thread: queued %u packets, sent %u, dropped %u, producer waits: %u, wakeups: %u, max queued: %u",
+      pTxStats->uPacketsQueued, pTxStats->uPacketsSent, pTxStats->uPacketsDropped, pTxStats->uProducerWaits, pTxStats->uWakeups, pTxStats->uMaxQueued);
+   latency_histogram_log(&pTxStats->queueLatency, "Video pipeline tx queue to radio");
+   radio_tx_async_reset_stats();
+}
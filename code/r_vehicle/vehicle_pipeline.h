@@ -0,0 +1,27 @@
+#pragma once
+#include "../base/base.h"
+
+// Optional multi-threaded video pipeline (VIDEO_FLAG_MULTITHREADED_PIPELINE), three stages:
+//    capture: a thread reads the video source into pooled buffers and queues them (lock-free, bounded);
+//    encode: the main thread parses, packetizes and EC encodes the captured data (processor_tx_video), as before;
+//    tx: the radio async tx thread writes the radio packets queued by the main thread.
+// Each stage thread is pinned to its own core on multi-core CPUs.
+// While the pipeline runs, the capture thread owns the reads from the video source.
+
+bool vehicle_pipeline_is_enabled_in_model();
+// Starts or stops the pipeline to match the current model settings
+void vehicle_pipeline_check_state();
+bool vehicle_pipeline_start();
+void vehicle_pipeline_stop();
+bool vehicle_pipeline_is_running();
+
+// Signaled when captured data is queued, -1 if the pipeline is not running
+int vehicle_pipeline_get_event_fd();
+// Returns the next captured video data (raw, as read from the video source), NULL if there is none.
+// It must be released after it was processed.
+u8* vehicle_pipeline_get_captured_data(int* piLength, u32* puTimeCaptureMicros);
+void vehicle_pipeline_release_captured_data(u8* pData);
+// Time from capture to the radio packets being queued for tx
+void vehicle_pipeline_add_encode_latency(u32 uMicros);
+
+void vehicle_pipeline_log_stats();
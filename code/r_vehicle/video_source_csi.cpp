@@ -41,6 +41,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <math.h>
+#include <poll.h>
 
 #include "video_source_csi.h"
 #include "packets_utils.h"
@@ -325,12 +326,73 @@ u8* video_source_csi_read(int* piReadSize)
    return s_uInputVideoCSIPipeBuffer;
 }
 
+int video_source_csi_get_read_fd()
+{
+   return s_fInputVideoStreamCSIPipe;
+}
+
+// Waits at most iTimeoutMs for video data and reads it into pBuffer. Reopens the pipe if needed.
+// Returns the number of bytes read, 0 if nothing was read, -1 on error (the pipe is closed).
+
+int video_source_csi_read_raw(u8* pBuffer, int iBufferSize, int iTimeoutMs)
+{
+   if ( (NULL == pBuffer) || (iBufferSize <= 0) )
+      return -1;
+
+   if ( -1 == s_fInputVideoStreamCSIPipe )
+   {
+      if ( s_bInputVideoStreamCSIPipeOpenFailed )
+         video_source_csi_open(s_szInputVideoStreamCSIPipeName);
+      if ( -1 == s_fInputVideoStreamCSIPipe )
+         return -1;
+   }
+
+   struct pollfd fds;
+   fds.fd = s_fInputVideoStreamCSIPipe;
+   fds.events = POLLIN;
+   fds.revents = 0;
+   int iRes = poll(&fds, 1, iTimeoutMs);
+   if ( iRes < 0 )
+   {
+      if ( errno == EINTR )
+         return 0;
+      log_softerror_and_alarm("[VideoSourceCSI] Failed to poll input pipe, error: %s", strerror(errno));
+      return -1;
+   }
+   if ( 0 == iRes )
+      return 0;
+   if ( fds.revents & (POLLERR | POLLNVAL) )
+   {
+      log_softerror_and_alarm("[VideoSourceCSI] Exception on reading input pipe. Closing pipe.");
+      close(s_fInputVideoStreamCSIPipe);
+      s_fInputVideoStreamCSIPipe = -1;
+      return -1;
+   }
+   if ( ! (fds.revents & POLLIN) )
+      return 0;
+
+   int iRead = read(s_fInputVideoStreamCSIPipe, pBuffer, iBufferSize);
+   if ( iRead < 0 )
+   {
+      if ( errno == EAGAIN )
+         return 0;
+      log_error_and_alarm("[VideoSourceCSI] Failed to read from video input pipe, returned code: %d, error: %s. Closing pipe.", iRead, strerror(errno));
+      close(s_fInputVideoStreamCSIPipe);
+      s_fInputVideoStreamCSIPipe = -1;
+      return -1;
+   }
+
+   s_uDebugCSIInputBytes += iRead;
+   s_uDebugCSIInputReads++;
+   return iRead;
+}
+
 void video_source_csi_start_program()
 {
    s_bVideoCSICaptureProgramStarted = true;
 
    vehicle_launch_video_capture_csi(g_pCurrentModel, &(g_SM_VideoLinkStats.overwrites));
-   vehicle_check_update_processes_affinities(true, g_pCurrentModel->isActiveCameraVeye());
+   vehicle_check_update_processes_affinities(true, g_pCurrentModel->isActiveCameraVeye(), (g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_MULTITHREADED_PIPELINE)?true:false);
 
    if ( 0 != pthread_create(&s_pThreadWatchDogVideoCapture, NULL, &_thread_watchdog_video_capture, NULL) )
       log_softerror_and_alarm("[VideoSourceCSI] Failed to create thread for watchdog.");
@@ -904,6 +966,8 @@ void video_source_csi_close() {}
 int video_source_csi_open(const char* szPipeName) {return 0;}
 void video_source_csi_flush_discard() {}
 u8* video_source_csi_read(int* piReadSize) {return NULL;}
+int video_source_csi_get_read_fd() {return -1;}
+int video_source_csi_read_raw(u8* pBuffer, int iBufferSize, int iTimeoutMs) {return -1;}
 void video_source_csi_start_program() {}
 void video_source_csi_stop_program() {}
 bool video_source_csi_is_program_started() {return false;}
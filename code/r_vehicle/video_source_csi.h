@@ -8,6 +8,10 @@ void video_source_csi_flush_discard();
 
 // Returns the buffer and number of bytes read
 u8* video_source_csi_read(int* piReadSize);
+// The pipe the video is read from (to wait on it), -1 if it's not opened
+int video_source_csi_get_read_fd();
+// For reading the video on a separate (capture) thread: waits at most iTimeoutMs, returns the bytes read, -1 on error
+int video_source_csi_read_raw(u8* pBuffer, int iBufferSize, int iTimeoutMs);
 
 void video_source_csi_start_program();
 void video_source_csi_stop_program();
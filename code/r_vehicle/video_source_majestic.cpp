@@ -37,6 +37,8 @@
 #include "../base/ruby_ipc.h"
 #include "../base/parser_h264.h"
 #include "../base/utils.h"
+#include "../base/udp_batch_reader.h"
+#include "../base/vehicle_settings.h"
 #include "../common/string_utils.h"
 #include "../radio/radiopackets2.h"
 
@@ -46,6 +48,7 @@
 #include <sys/socket.h> 
 #include <getopt.h>
 #include <poll.h>
+#include <sys/resource.h>
 
 #include "video_source_majestic.h"
 #include "events.h"
@@ -62,11 +65,18 @@ u32 s_uTimeStartVideoInput = 0;
 
 u8 s_uInputVideoUDPBuffer[MAX_PACKET_TOTAL_SIZE];
 u8 s_uOutputUDPNALFrameSegment[MAX_PACKET_TOTAL_SIZE];
+bool s_bLastParsedUDPIsEndOfFrame = false;
 
 u32 s_uDebugTimeLastUDPVideoInputCheck = 0;
 u32 s_uDebugUDPInputBytes = 0;
 u32 s_uDebugUDPInputReads = 0;
 
+type_udp_batch_reader s_VideoUDPInputReader;
+bool s_bVideoUDPInputReaderInitialized = false;
+u32 s_uVideoUDPInputLastKernelDrops = 0;
+type_udp_batch_reader_stats s_VideoUDPInputLastStats;
+u64 s_uVideoUDPInputLastProcessCPUMicros = 0;
+
 bool s_bRequestedVideoMajesticCaptureUpdate = false;
 u32 s_uRequestedVideoMajesticCaptureUpdateReason = 0;
 bool s_bHasPendingMajesticRealTimeChanges = false;
@@ -104,6 +114,10 @@ void video_source_majestic_init_all_params()
 
 void video_source_majestic_close()
 {
+   if ( s_bVideoUDPInputReaderInitialized )
+      udp_batch_reader_uninit(&s_VideoUDPInputReader);
+   s_bVideoUDPInputReaderInitialized = false;
+
    if ( -1 != s_fInputVideoStreamUDPSocket )
    {
       log_line("[VideoSourceUDP] Closed input UDP socket.");
@@ -134,13 +148,6 @@ int video_source_majestic_open(int iUDPPort)
    if ( 0 != setsockopt(s_fInputVideoStreamUDPSocket, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval , sizeof(optval)) )
        log_softerror_and_alarm("[VideoSourceUDP] Failed to set SO_REUSEADDR: %s", strerror(errno));
 
-   if ( 0 != setsockopt(s_fInputVideoStreamUDPSocket, SOL_SOCKET, SO_RXQ_OVFL, (const void *)&optval , sizeof(optval)) )
-       log_softerror_and_alarm("[VideoSourceUDP] Unable to set SO_RXQ_OVFL: %s", strerror(errno));
-   /*
-   int iRecvSize = MAX_PACKET_TOTAL_SIZE;
-   if( 0 != setsockopt(s_fInputVideoStreamUDPSocket, SOL_SOCKET, SO_RCVBUF, (const void *)&iRecvSize , sizeof(iRecvSize)))
-      log_softerror_and_alarm("[VideoSourceUDP] Unable to set SO_RCVBUF: %s", strerror(errno));
-   */
 
    memset(&server_addr, 0, sizeof(server_addr));
    server_addr.sin_family = AF_INET;
@@ -156,6 +163,29 @@ int video_source_majestic_open(int iUDPPort)
    }
    s_uTimeStartVideoInput = g_TimeNow;
 
+   // Read in batches, SO_RXQ_OVFL and the socket buffer are set by the batch reader
+   VehicleSettings* pVS = get_VehicleSettings();
+   type_udp_batch_reader_config readerConfig;
+   udp_batch_reader_get_default_config(&readerConfig);
+   readerConfig.iBufferSize = MAX_PACKET_TOTAL_SIZE;
+   if ( NULL != pVS )
+   {
+      readerConfig.iBatchSize = pVS->iVideoUDPInputBatchSize;
+      readerConfig.iRecvBufferKb = pVS->iVideoUDPInputRecvBufferKb;
+      readerConfig.iBusyPollMicros = pVS->iVideoUDPInputBusyPollMicros;
+      readerConfig.iGRO = pVS->iVideoUDPInputGRO;
+   }
+   s_bVideoUDPInputReaderInitialized = udp_batch_reader_init(&s_VideoUDPInputReader, s_fInputVideoStreamUDPSocket, &readerConfig);
+   if ( ! s_bVideoUDPInputReaderInitialized )
+   {
+      log_error_and_alarm("[VideoSourceUDP] Failed to initialize the UDP batch reader for video stream.");
+      close(s_fInputVideoStreamUDPSocket);
+      s_fInputVideoStreamUDPSocket = -1;
+      return -1;
+   }
+   s_uVideoUDPInputLastKernelDrops = 0;
+   memset(&s_VideoUDPInputLastStats, 0, sizeof(s_VideoUDPInputLastStats));
+
    log_line("[VideoSourceUDP] Opened read socket on port %d for reading video stream. socket fd = %d", s_iInputVideoStreamUDPPort, s_fInputVideoStreamUDPSocket);
    
    return s_fInputVideoStreamUDPSocket;
@@ -198,20 +228,6 @@ void video_source_majestic_request_update_program(u32 uChangeReason)
    s_uRequestedVideoMajesticCaptureUpdateReason = uChangeReason;
 }
 
-uint32_t extract_udp_rxq_overflow(struct msghdr *msg)
-{
-    struct cmsghdr *cmsg;
-    uint32_t rtn;
-
-    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
-        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
-            memcpy(&rtn, CMSG_DATA(cmsg), sizeof(rtn));
-            return rtn;
-        }
-    }
-    return 0;
-}
-
 void video_source_majestic_set_keyframe_value(float fGOP)
 {
    char szComm[128];
@@ -234,7 +250,9 @@ void video_source_majestic_set_videobitrate_value(u32 uBitrate)
    //hw_execute_bash_command_raw("curl localhost/api/v1/reload", szOutput); 
 }
 
-int _video_source_majestic_try_read_input_udp_data(bool bAsync)
+// Returns the number of bytes read (and sets *ppData to the datagram), 0 if nothing was read, -1 on error
+
+int _video_source_majestic_try_read_input_udp_data(bool bAsync, u8** ppData)
 {
    if ( -1 == s_fInputVideoStreamUDPSocket )
       return -1;
@@ -242,60 +260,12 @@ int _video_source_majestic_try_read_input_udp_data(bool bAsync)
    int nRecvBytes = 0;
    if ( bAsync )
    {
-      static uint8_t cmsgbuf[CMSG_SPACE(sizeof(uint32_t))];
-
-      static int nfds = 1;
-      static struct pollfd fds[2];
-      static bool s_bFirstVideoUDPReadSetup = true;
-
-      if ( s_bFirstVideoUDPReadSetup )
-      {
-         s_bFirstVideoUDPReadSetup = false;
-         memset(fds, '\0', sizeof(fds));
-         if ( fcntl(s_fInputVideoStreamUDPSocket, F_SETFL, fcntl(s_fInputVideoStreamUDPSocket, F_GETFL, 0) | O_NONBLOCK) < 0 )
-            log_softerror_and_alarm("[VideoSourceUDP] Unable to set socket into nonblocked mode: %s", strerror(errno));
-
-         fds[0].fd = s_fInputVideoStreamUDPSocket;
-         fds[0].events = POLLIN;
-
-         log_line("[VideoSourceUDP] Done first time video USD socket setup.");
-      }
-
-      int res = poll(fds, nfds, 1);
-      if ( res < 0 )
-      {
-         log_error_and_alarm("[VideoSourceUDP] Failed to poll UDP socket.");
-         return -1;
-      }
-      if ( 0 == res )
-         return 0;
-
-      if (fds[0].revents & (POLLERR | POLLNVAL))
-      {
-         log_softerror_and_alarm("[VideoSourceUDP] Socket error pooling: %s", strerror(errno));
+      if ( ! s_bVideoUDPInputReaderInitialized )
          return -1;
-      }
-      if ( ! (fds[0].revents & POLLIN) )
-         return 0;
-    
-      struct iovec iov = { .iov_base = (void*)s_uInputVideoUDPBuffer,
-                                            .iov_len = sizeof(s_uInputVideoUDPBuffer) };
-      struct msghdr msghdr = { .msg_name = NULL,
-                               .msg_namelen = 0,
-                               .msg_iov = &iov,
-                               .msg_iovlen = 1,
-                               .msg_control = &cmsgbuf,
-                               .msg_controllen = sizeof(cmsgbuf),
-                               .msg_flags = 0 };
-
-      memset(cmsgbuf, '\0', sizeof(cmsgbuf));
-
-      nRecvBytes = recvmsg(s_fInputVideoStreamUDPSocket, &msghdr, 0);
+      // One recvmmsg call reads a batch of datagrams, the next reads get them without syscalls
+      nRecvBytes = udp_batch_reader_read(&s_VideoUDPInputReader, 1, ppData);
       if ( nRecvBytes < 0 )
-      {
-         log_softerror_and_alarm("[VideoSourceUDP] Failed to recvmsg from UDP socket, error: %s", strerror(errno));
          return -1;
-      }
 
       if ( nRecvBytes > MAX_PACKET_TOTAL_SIZE )
       {
@@ -303,12 +273,11 @@ int _video_source_majestic_try_read_input_udp_data(bool bAsync)
          nRecvBytes = MAX_PACKET_TOTAL_SIZE;
       }
 
-      static uint32_t rxq_overflow = 0;
-      uint32_t cur_rxq_overflow = extract_udp_rxq_overflow(&msghdr);
-      if (cur_rxq_overflow != rxq_overflow)
+      u32 uKernelDrops = s_VideoUDPInputReader.stats.uKernelDrops;
+      if ( uKernelDrops != s_uVideoUDPInputLastKernelDrops )
       {
-          log_softerror_and_alarm("[VideoSourceUDP] UDP rxq overflow: %u packets dropped (from %u to %u)", cur_rxq_overflow - rxq_overflow, rxq_overflow, cur_rxq_overflow);
-          rxq_overflow = cur_rxq_overflow;
+          log_softerror_and_alarm("[VideoSourceUDP] UDP rxq overflow: %u packets dropped (from %u to %u)", uKernelDrops - s_uVideoUDPInputLastKernelDrops, s_uVideoUDPInputLastKernelDrops, uKernelDrops);
+          s_uVideoUDPInputLastKernelDrops = uKernelDrops;
       }
    }
    else
@@ -352,6 +321,7 @@ int _video_source_majestic_try_read_input_udp_data(bool bAsync)
       }
       if ( nRecvBytes == 0 )
          return 0;
+      *ppData = s_uInputVideoUDPBuffer;
    }
    return nRecvBytes;
 }
@@ -370,6 +340,12 @@ int _video_source_majestic_parse_rtp_data(u8* pInputRawData, int iInputBytes)
    if ( (pInputRawData[0] & 0x80) && (pInputRawData[1] & 0x60) )
       iRTPHeaderLength = 12;
 
+   // The RTP marker bit is set on the last packet of each video frame (access unit)
+   s_bLastParsedUDPIsEndOfFrame = false;
+   if ( iRTPHeaderLength > 0 )
+   if ( pInputRawData[1] & 0x80 )
+      s_bLastParsedUDPIsEndOfFrame = true;
+
    // ----------------------------------------------
    // Begin - Check RTP sequence number
    static u16 s_uLastRTLSeqNumberInUDPFrame = 0;
@@ -465,25 +441,122 @@ u8* video_source_majestic_read(int* piReadSize, bool bAsync)
 
    *piReadSize = 0;
 
-   int iRecvBytes = _video_source_majestic_try_read_input_udp_data(bAsync);
-   if ( iRecvBytes <= 0 )
+   u8* pRecvData = NULL;
+   int iRecvBytes = _video_source_majestic_try_read_input_udp_data(bAsync, &pRecvData);
+   if ( (iRecvBytes <= 0) || (NULL == pRecvData) )
       return NULL;
 
    s_uDebugUDPInputBytes += iRecvBytes;
    s_uDebugUDPInputReads++;
 
-   int iOutputBytes = _video_source_majestic_parse_rtp_data(s_uInputVideoUDPBuffer, iRecvBytes);
+   int iOutputBytes = _video_source_majestic_parse_rtp_data(pRecvData, iRecvBytes);
   
    *piReadSize = iOutputBytes;
    return s_uOutputUDPNALFrameSegment;
 }
 
+int video_source_majestic_get_read_fd()
+{
+   return s_fInputVideoStreamUDPSocket;
+}
+
+// Waits at most iTimeoutMs for a datagram and reads it as it is (RTP), into pBuffer.
+// Returns the number of bytes read, 0 if nothing was read, -1 on error.
+
+int video_source_majestic_read_raw(u8* pBuffer, int iBufferSize, int iTimeoutMs)
+{
+   if ( (-1 == s_fInputVideoStreamUDPSocket) || (NULL == pBuffer) || (iBufferSize <= 0) )
+      return -1;
+   if ( ! s_bVideoUDPInputReaderInitialized )
+      return -1;
+
+   u8* pData = NULL;
+   int nRecvBytes = udp_batch_reader_read(&s_VideoUDPInputReader, iTimeoutMs, &pData);
+   if ( (nRecvBytes <= 0) || (NULL == pData) )
+      return nRecvBytes;
+   if ( nRecvBytes > iBufferSize )
+      nRecvBytes = iBufferSize;
+   memcpy(pBuffer, pData, nRecvBytes);
+   return nRecvBytes;
+}
+
+bool video_source_majestic_has_pending_data()
+{
+   if ( ! s_bVideoUDPInputReaderInitialized )
+      return false;
+   return udp_batch_reader_has_pending(&s_VideoUDPInputReader)?true:false;
+}
+
+bool video_source_majestic_last_read_is_end_of_frame()
+{
+   return s_bLastParsedUDPIsEndOfFrame;
+}
+
+type_udp_batch_reader_stats* video_source_majestic_get_input_stats()
+{
+   if ( ! s_bVideoUDPInputReaderInitialized )
+      return NULL;
+   return udp_batch_reader_get_stats(&s_VideoUDPInputReader);
+}
+
+// Parses a datagram read with video_source_majestic_read_raw. Same output as video_source_majestic_read
+
+u8* video_source_majestic_parse_raw(u8* pRawData, int iRawSize, int* piReadSize)
+{
+   if ( NULL == piReadSize )
+      return NULL;
+   *piReadSize = 0;
+   if ( (NULL == pRawData) || (iRawSize <= 0) )
+      return NULL;
+
+   s_uDebugUDPInputBytes += iRawSize;
+   s_uDebugUDPInputReads++;
+
+   *piReadSize = _video_source_majestic_parse_rtp_data(pRawData, iRawSize);
+   return s_uOutputUDPNALFrameSegment;
+}
+
+// Logs the input syscalls, kernel drops and CPU usage since the last call (uIntervalMs ago)
+
+void _video_source_majestic_log_input_stats(u32 uIntervalMs)
+{
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   u64 uProcessCPUMicros = (u64)usage.ru_utime.tv_sec * 1000000LL + (u64)usage.ru_utime.tv_usec +
+          (u64)usage.ru_stime.tv_sec * 1000000LL + (u64)usage.ru_stime.tv_usec;
+   u64 uProcessCPUDelta = uProcessCPUMicros - s_uVideoUDPInputLastProcessCPUMicros;
+   s_uVideoUDPInputLastProcessCPUMicros = uProcessCPUMicros;
+
+   if ( (! s_bVideoUDPInputReaderInitialized) || (0 == uIntervalMs) || (uIntervalMs > 60000) )
+   {
+      if ( s_bVideoUDPInputReaderInitialized )
+         memcpy(&s_VideoUDPInputLastStats, &s_VideoUDPInputReader.stats, sizeof(type_udp_batch_reader_stats));
+      return;
+   }
+   type_udp_batch_reader_stats* pStats = &s_VideoUDPInputReader.stats;
+   u32 uRecvCalls = pStats->uRecvCalls - s_VideoUDPInputLastStats.uRecvCalls;
+   u32 uRecvCallsEmpty = pStats->uRecvCallsEmpty - s_VideoUDPInputLastStats.uRecvCallsEmpty;
+   u32 uPollCalls = pStats->uPollCalls - s_VideoUDPInputLastStats.uPollCalls;
+   u32 uDatagrams = pStats->uDatagrams - s_VideoUDPInputLastStats.uDatagrams;
+   u32 uRecvMicros = pStats->uRecvMicros - s_VideoUDPInputLastStats.uRecvMicros;
+   u32 uBatches = uRecvCalls - uRecvCallsEmpty;
+
+   log_line("[VideoSourceUDP] Input syscalls: %u recvmmsg/sec (%u empty), %u poll/sec, %u datagrams/sec, avg batch: %.1f, max batch: %u, kernel drops: %u (total %u)",
+      uRecvCalls*1000/uIntervalMs, uRecvCallsEmpty*1000/uIntervalMs, uPollCalls*1000/uIntervalMs, uDatagrams*1000/uIntervalMs,
+      (uBatches > 0)?((float)uDatagrams/(float)uBatches):0.0, pStats->uMaxBatch,
+      pStats->uKernelDrops - s_VideoUDPInputLastStats.uKernelDrops, pStats->uKernelDrops);
+   log_line("[VideoSourceUDP] Input CPU: recv syscalls: %.2f%%, router process: %.1f%%",
+      (float)uRecvMicros / (float)uIntervalMs / 10.0, (float)uProcessCPUDelta / (float)uIntervalMs / 10.0);
+   memcpy(&s_VideoUDPInputLastStats, pStats, sizeof(type_udp_batch_reader_stats));
+}
+
 void video_source_majestic_periodic_checks()
 {
    if ( g_TimeNow >= s_uDebugTimeLastUDPVideoInputCheck+10000 )
    {
       log_line("[VideoSourceUDP] Input video data: %u bytes/sec, %u bps, %u reads/sec",
          s_uDebugUDPInputBytes/10, s_uDebugUDPInputBytes/10*8, s_uDebugUDPInputReads/10);
+      _video_source_majestic_log_input_stats(g_TimeNow - s_uDebugTimeLastUDPVideoInputCheck);
       s_uDebugTimeLastUDPVideoInputCheck = g_TimeNow;
       log_line("[VideoSourceUDP] Detected video stream fps: %d, slices: %d", (int)s_ParserH264CameraOutput.getDetectedFPS(), s_ParserH264CameraOutput.getDetectedSlices());
       s_uDebugUDPInputBytes = 0;
@@ -507,7 +580,7 @@ void video_source_majestic_periodic_checks()
 
          log_softerror_and_alarm("[VideoSourceUDP] majestic is not running. starting it.");
          video_source_majestic_start_capture_program();
-         vehicle_check_update_processes_affinities(false, false);
+         vehicle_check_update_processes_affinities(false, false, (g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_MULTITHREADED_PIPELINE)?true:false);
       }
    }
 
@@ -585,7 +658,7 @@ void video_source_majestic_periodic_checks()
          video_source_majestic_stop_capture_program();
          hardware_sleep_ms(50);
          video_source_majestic_start_capture_program();
-         vehicle_check_update_processes_affinities(false, false);
+         vehicle_check_update_processes_affinities(false, false, (g_pCurrentModel->video_params.uVideoExtraFlags & VIDEO_FLAG_MULTITHREADED_PIPELINE)?true:false);
       }
       s_uRequestedVideoMajesticCaptureUpdateReason = 0;
    }
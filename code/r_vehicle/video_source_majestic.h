@@ -1,6 +1,7 @@
 #pragma once
 #include "../base/base.h"
 #include "../base/models.h"
+#include "../base/udp_batch_reader.h"
 
 void video_source_majestic_init_all_params();
 void video_source_majestic_close();
@@ -15,5 +16,18 @@ void video_source_majestic_set_videobitrate_value(u32 uBitrate);
 
 // Returns the buffer and number of bytes read
 u8* video_source_majestic_read(int* piReadSize, bool bAsync);
+// The UDP socket the video is read from (to wait on it), -1 if it's not opened
+int video_source_majestic_get_read_fd();
+
+// For reading the video on a separate (capture) thread: read_raw only reads the datagram,
+// parse_raw is then called (on the main thread) to get the same output as video_source_majestic_read
+int video_source_majestic_read_raw(u8* pBuffer, int iBufferSize, int iTimeoutMs);
+u8* video_source_majestic_parse_raw(u8* pRawData, int iRawSize, int* piReadSize);
+// The datagrams are read from the socket in batches: true if there are datagrams read and not returned yet
+bool video_source_majestic_has_pending_data();
+// True if the last datagram read/parsed was the last one of a video frame (RTP marker bit)
+bool video_source_majestic_last_read_is_end_of_frame();
+// Input syscalls and kernel drop counters, NULL if the socket is not opened
+type_udp_batch_reader_stats* video_source_majestic_get_input_stats();
 
 void video_source_majestic_periodic_checks();
@@ -77,10 +77,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <assert.h>
 #include "fec.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define FEC_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define FEC_HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+#endif
+#endif
+
 /*
  * stuff used for testing purposes only
  */
@@ -432,10 +449,6 @@ addmul1(gf *dst1, gf *src1, gf c, int sz)
 # define addmul1 slow_addmul1
 #endif
 
-static void addmul(gf *dst, gf *src, gf c, int sz) {
-    // fprintf(stderr, "Dst=%p Src=%p, gf=%02x sz=%d\n", dst, src, c, sz);
-    if (c != 0) addmul1(dst, src, c, sz);
-}
 
 /*
  * mul() computes dst[] = c * src[]
@@ -558,9 +571,382 @@ mul1(gf *dst1, gf *src1, gf c, int sz)
 # define mul1 slow_mul1
 #endif
 
+/*
+ * Split-nibble multiplication tables: c * x == lo[c][x & 0x0f] ^ hi[c][x >> 4]
+ * because multiplication by a constant is linear over GF(2). Each row is
+ * 16 bytes, which is exactly one byte-shuffle table for SSSE3/AVX2/NEON.
+ */
+static gf gf_mul_lo[(GF_SIZE + 1)*16] __attribute__((aligned (16)));
+static gf gf_mul_hi[(GF_SIZE + 1)*16] __attribute__((aligned (16)));
+
+static void
+init_nibble_tables(void)
+{
+    int c, x;
+    for (c=0; c< GF_SIZE+1; c++)
+	for (x=0; x< 16; x++) {
+	    gf_mul_lo[(c<<4)+x] = gf_mul(c, x);
+	    gf_mul_hi[(c<<4)+x] = gf_mul(c, (x<<4));
+	}
+}
+
+/*
+ * Portable kernels: same table lookups as slow_addmul1/slow_mul1, but the
+ * source and destination are read and written 8 bytes at a time. Bytes are
+ * extracted and reinserted at the same bit offsets, so this is independent
+ * of the machine endianness.
+ */
+#define GF_MULC_WORD64(w) \
+	( (uint64_t)__gf_mulc_[(w) & 0xff] \
+	| ((uint64_t)__gf_mulc_[((w) >> 8) & 0xff] << 8) \
+	| ((uint64_t)__gf_mulc_[((w) >> 16) & 0xff] << 16) \
+	| ((uint64_t)__gf_mulc_[((w) >> 24) & 0xff] << 24) \
+	| ((uint64_t)__gf_mulc_[((w) >> 32) & 0xff] << 32) \
+	| ((uint64_t)__gf_mulc_[((w) >> 40) & 0xff] << 40) \
+	| ((uint64_t)__gf_mulc_[((w) >> 48) & 0xff] << 48) \
+	| ((uint64_t)__gf_mulc_[((w) >> 56) & 0xff] << 56) )
+
+static void
+word64_addmul1(gf *dst, gf *src, gf c, int sz)
+{
+    USE_GF_MULC ;
+    uint64_t s, d;
+    int i = 0;
+
+    GF_MULC0(c) ;
+    for (; i + 8 <= sz; i += 8) {
+	memcpy(&s, src + i, 8);
+	memcpy(&d, dst + i, 8);
+	d ^= GF_MULC_WORD64(s);
+	memcpy(dst + i, &d, 8);
+    }
+    for (; i < sz; i++)
+	GF_ADDMULC( dst[i] , src[i] );
+}
+
+static void
+word64_mul1(gf *dst, gf *src, gf c, int sz)
+{
+    USE_GF_MULC ;
+    uint64_t s, d;
+    int i = 0;
+
+    GF_MULC0(c) ;
+    for (; i + 8 <= sz; i += 8) {
+	memcpy(&s, src + i, 8);
+	d = GF_MULC_WORD64(s);
+	memcpy(dst + i, &d, 8);
+    }
+    for (; i < sz; i++)
+	GF_MULC( dst[i] , src[i] );
+}
+
+/*
+ * The SIMD kernels finish a block whose size is not a multiple of the vector
+ * width by running one more vector over a zero padded copy of the tail. Going
+ * back to the byte loop for the last few bytes stalls on store forwarding
+ * right after the wide stores, and costs more than the tail itself.
+ */
+
+#ifdef FEC_HAVE_X86_KERNELS
+
+__attribute__((target("ssse3")))
+static inline __m128i
+ssse3_mul16(__m128i tlo, __m128i thi, __m128i s)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    return _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+			 _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+}
+
+__attribute__((target("ssse3")))
+static inline void
+ssse3_addmul_tail(gf *dst, gf *src, __m128i tlo, __m128i thi, int sz)
+{
+    gf ts[16], td[16];
+    memset(ts, 0, sizeof(ts));
+    memset(td, 0, sizeof(td));
+    memcpy(ts, src, sz);
+    memcpy(td, dst, sz);
+    __m128i p = ssse3_mul16(tlo, thi, _mm_loadu_si128((const __m128i*)ts));
+    _mm_storeu_si128((__m128i*)td, _mm_xor_si128(_mm_loadu_si128((const __m128i*)td), p));
+    memcpy(dst, td, sz);
+}
+
+__attribute__((target("ssse3")))
+static inline void
+ssse3_mul_tail(gf *dst, gf *src, __m128i tlo, __m128i thi, int sz)
+{
+    gf ts[16];
+    memset(ts, 0, sizeof(ts));
+    memcpy(ts, src, sz);
+    _mm_storeu_si128((__m128i*)ts, ssse3_mul16(tlo, thi, _mm_loadu_si128((const __m128i*)ts)));
+    memcpy(dst, ts, sz);
+}
+
+__attribute__((target("ssse3")))
+static void
+ssse3_addmul1(gf *dst, gf *src, gf c, int sz)
+{
+    const __m128i tlo = _mm_load_si128((const __m128i*)&gf_mul_lo[c<<4]);
+    const __m128i thi = _mm_load_si128((const __m128i*)&gf_mul_hi[c<<4]);
+    int i = 0;
+
+    for (; i + 16 <= sz; i += 16) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+	__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+	_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, ssse3_mul16(tlo, thi, s)));
+    }
+    if (i < sz)
+	ssse3_addmul_tail(dst + i, src + i, tlo, thi, sz - i);
+}
+
+__attribute__((target("ssse3")))
+static void
+ssse3_mul1(gf *dst, gf *src, gf c, int sz)
+{
+    const __m128i tlo = _mm_load_si128((const __m128i*)&gf_mul_lo[c<<4]);
+    const __m128i thi = _mm_load_si128((const __m128i*)&gf_mul_hi[c<<4]);
+    int i = 0;
+
+    for (; i + 16 <= sz; i += 16) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+	_mm_storeu_si128((__m128i*)(dst + i), ssse3_mul16(tlo, thi, s));
+    }
+    if (i < sz)
+	ssse3_mul_tail(dst + i, src + i, tlo, thi, sz - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+avx2_mul32(__m256i tlo, __m256i thi, __m256i s)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    return _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask)),
+			    _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+}
+
+/* The 16 byte steps and tails below are inlined, so they are VEX encoded too */
+__attribute__((target("avx2")))
+static void
+avx2_addmul1(gf *dst, gf *src, gf c, int sz)
+{
+    const __m128i tlo128 = _mm_load_si128((const __m128i*)&gf_mul_lo[c<<4]);
+    const __m128i thi128 = _mm_load_si128((const __m128i*)&gf_mul_hi[c<<4]);
+    const __m256i tlo = _mm256_broadcastsi128_si256(tlo128);
+    const __m256i thi = _mm256_broadcastsi128_si256(thi128);
+    int i = 0;
+
+    for (; i + 32 <= sz; i += 32) {
+	__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+	__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+	_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, avx2_mul32(tlo, thi, s)));
+    }
+    if (i + 16 <= sz) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+	__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+	_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, ssse3_mul16(tlo128, thi128, s)));
+	i += 16;
+    }
+    if (i < sz)
+	ssse3_addmul_tail(dst + i, src + i, tlo128, thi128, sz - i);
+}
+
+__attribute__((target("avx2")))
+static void
+avx2_mul1(gf *dst, gf *src, gf c, int sz)
+{
+    const __m128i tlo128 = _mm_load_si128((const __m128i*)&gf_mul_lo[c<<4]);
+    const __m128i thi128 = _mm_load_si128((const __m128i*)&gf_mul_hi[c<<4]);
+    const __m256i tlo = _mm256_broadcastsi128_si256(tlo128);
+    const __m256i thi = _mm256_broadcastsi128_si256(thi128);
+    int i = 0;
+
+    for (; i + 32 <= sz; i += 32) {
+	__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+	_mm256_storeu_si256((__m256i*)(dst + i), avx2_mul32(tlo, thi, s));
+    }
+    if (i + 16 <= sz) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+	_mm_storeu_si128((__m128i*)(dst + i), ssse3_mul16(tlo128, thi128, s));
+	i += 16;
+    }
+    if (i < sz)
+	ssse3_mul_tail(dst + i, src + i, tlo128, thi128, sz - i);
+}
+
+#endif /* FEC_HAVE_X86_KERNELS */
+
+#ifdef FEC_HAVE_NEON_KERNELS
+
+static inline uint8x16_t
+neon_lookup16(uint8x16_t tbl, uint8x16_t idx)
+{
+#if defined(__aarch64__)
+    return vqtbl1q_u8(tbl, idx);
+#else
+    uint8x8x2_t t;
+    t.val[0] = vget_low_u8(tbl);
+    t.val[1] = vget_high_u8(tbl);
+    return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+#endif
+}
+
+static inline uint8x16_t
+neon_mul16(uint8x16_t tlo, uint8x16_t thi, uint8x16_t s)
+{
+    return veorq_u8(neon_lookup16(tlo, vandq_u8(s, vdupq_n_u8(0x0f))),
+		    neon_lookup16(thi, vshrq_n_u8(s, 4)));
+}
+
+static void
+neon_addmul1(gf *dst, gf *src, gf c, int sz)
+{
+    const uint8x16_t tlo = vld1q_u8(&gf_mul_lo[c<<4]);
+    const uint8x16_t thi = vld1q_u8(&gf_mul_hi[c<<4]);
+    int i = 0;
+
+    for (; i + 16 <= sz; i += 16) {
+	uint8x16_t s = vld1q_u8(src + i);
+	uint8x16_t d = vld1q_u8(dst + i);
+	vst1q_u8(dst + i, veorq_u8(d, neon_mul16(tlo, thi, s)));
+    }
+    if (i < sz) {
+	gf ts[16], td[16];
+	memset(ts, 0, sizeof(ts));
+	memset(td, 0, sizeof(td));
+	memcpy(ts, src + i, sz - i);
+	memcpy(td, dst + i, sz - i);
+	vst1q_u8(td, veorq_u8(vld1q_u8(td), neon_mul16(tlo, thi, vld1q_u8(ts))));
+	memcpy(dst + i, td, sz - i);
+    }
+}
+
+static void
+neon_mul1(gf *dst, gf *src, gf c, int sz)
+{
+    const uint8x16_t tlo = vld1q_u8(&gf_mul_lo[c<<4]);
+    const uint8x16_t thi = vld1q_u8(&gf_mul_hi[c<<4]);
+    int i = 0;
+
+    for (; i + 16 <= sz; i += 16) {
+	uint8x16_t s = vld1q_u8(src + i);
+	vst1q_u8(dst + i, neon_mul16(tlo, thi, s));
+    }
+    if (i < sz) {
+	gf ts[16];
+	memset(ts, 0, sizeof(ts));
+	memcpy(ts, src + i, sz - i);
+	vst1q_u8(ts, neon_mul16(tlo, thi, vld1q_u8(ts)));
+	memcpy(dst + i, ts, sz - i);
+    }
+}
+
+#endif /* FEC_HAVE_NEON_KERNELS */
+
+/*
+ * Kernel dispatch. The active kernels are chosen once by fec_init() from
+ * the CPU features; every kernel produces byte-identical output.
+ */
+typedef void (*gf_kernel_fn)(gf *dst, gf *src, gf c, int sz);
+
+static gf_kernel_fn addmul1_fn = addmul1;
+static gf_kernel_fn mul1_fn = mul1;
+static int fec_kernel = FEC_KERNEL_SCALAR;
+
+static void addmul(gf *dst, gf *src, gf c, int sz) {
+    // fprintf(stderr, "Dst=%p Src=%p, gf=%02x sz=%d\n", dst, src, c, sz);
+    if (c != 0) addmul1_fn(dst, src, c, sz);
+}
+
 static inline void mul(gf *dst, gf *src, gf c, int sz) {
     /*fprintf(stderr, "%p = %02x * %p\n", dst, c, src);*/
-    if (c != 0) mul1(dst, src, c, sz); else memset(dst, 0, sz);
+    if (c != 0) mul1_fn(dst, src, c, sz); else memset(dst, 0, sz);
+}
+
+int fec_is_kernel_supported(int kernel)
+{
+    switch (kernel) {
+    case FEC_KERNEL_SCALAR:
+    case FEC_KERNEL_WORD64:
+	return 1;
+#ifdef FEC_HAVE_X86_KERNELS
+    case FEC_KERNEL_SSSE3:
+	return __builtin_cpu_supports("ssse3") ? 1 : 0;
+    case FEC_KERNEL_AVX2:
+	return __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+#ifdef FEC_HAVE_NEON_KERNELS
+    case FEC_KERNEL_NEON:
+#if defined(__aarch64__)
+	return 1;
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_NEON) ? 1 : 0;
+#endif
+#endif
+    default:
+	return 0;
+    }
+}
+
+int fec_select_kernel(int kernel)
+{
+    if (kernel == FEC_KERNEL_AUTO) {
+	if (fec_is_kernel_supported(FEC_KERNEL_AVX2))
+	    kernel = FEC_KERNEL_AVX2;
+	else if (fec_is_kernel_supported(FEC_KERNEL_SSSE3))
+	    kernel = FEC_KERNEL_SSSE3;
+	else if (fec_is_kernel_supported(FEC_KERNEL_NEON))
+	    kernel = FEC_KERNEL_NEON;
+	else
+	    kernel = FEC_KERNEL_WORD64;
+    }
+    if (!fec_is_kernel_supported(kernel))
+	return 0;
+
+    switch (kernel) {
+    case FEC_KERNEL_SCALAR:
+	addmul1_fn = addmul1; mul1_fn = mul1;
+	break;
+    case FEC_KERNEL_WORD64:
+	addmul1_fn = word64_addmul1; mul1_fn = word64_mul1;
+	break;
+#ifdef FEC_HAVE_X86_KERNELS
+    case FEC_KERNEL_SSSE3:
+	addmul1_fn = ssse3_addmul1; mul1_fn = ssse3_mul1;
+	break;
+    case FEC_KERNEL_AVX2:
+	addmul1_fn = avx2_addmul1; mul1_fn = avx2_mul1;
+	break;
+#endif
+#ifdef FEC_HAVE_NEON_KERNELS
+    case FEC_KERNEL_NEON:
+	addmul1_fn = neon_addmul1; mul1_fn = neon_mul1;
+	break;
+#endif
+    default:
+	return 0;
+    }
+    fec_kernel = kernel;
+    return 1;
+}
+
+int fec_get_kernel(void)
+{
+    return fec_kernel;
+}
+
+const char* fec_get_kernel_name(int kernel)
+{
+    switch (kernel) {
+    case FEC_KERNEL_AUTO:   return "auto";
+    case FEC_KERNEL_SCALAR: return "scalar";
+    case FEC_KERNEL_WORD64: return "word64";
+    case FEC_KERNEL_SSSE3:  return "ssse3";
+    case FEC_KERNEL_AVX2:   return "avx2";
+    case FEC_KERNEL_NEON:   return "neon";
+    }
+    return "unknown";
 }
 
 /*
@@ -701,8 +1087,10 @@ void fec_init(void)
     DDB(fprintf(stderr, "generate_gf took %ldus\n", ticks[0]);)
 	TICK(ticks[0]);
     init_mul_table();
+    init_nibble_tables();
     TOCK(ticks[0]);
     DDB(fprintf(stderr, "init_mul_table took %ldus\n", ticks[0]);)
+    fec_select_kernel(FEC_KERNEL_AUTO);
 	fec_initialized = 1 ;
 }
 
@@ -830,6 +1218,30 @@ void fec_encode(unsigned int blockSize,
     }
 }
 
+void fec_encode_add_block(unsigned int blockSize,
+		unsigned char *data_block,
+		unsigned int blockNo,
+		unsigned char **fec_blocks,
+		unsigned int nrFecBlocks)
+{
+    unsigned int row;
+
+    assert(fec_initialized);
+    assert(blockNo < 128);
+    assert(nrFecBlocks <= 128);
+
+    if(!blockNo) {
+	for(row=0; row < nrFecBlocks; row++)
+	    mul(fec_blocks[row], data_block, inverse[128 ^ row], blockSize);
+	return;
+    }
+
+    for(row=0; row < nrFecBlocks; row++)
+	addmul(fec_blocks[row], data_block,
+	       inverse[row ^ (128 + blockNo)],
+	       blockSize);
+}
+
 /**
  * Reduce the system by substracting all received data blocks from FEC blocks
  * This will allow to resolve the system by inverting a much smaller matrix
@@ -12,12 +12,41 @@ typedef struct fec_parms *fec_code_t;
  */
 void fec_init(void);
 
+/*
+ * GF(2^8) multiply kernels. fec_init() selects the fastest one supported
+ * by the CPU (FEC_KERNEL_AUTO); all kernels give byte-identical results.
+ */
+#define FEC_KERNEL_AUTO   0
+#define FEC_KERNEL_SCALAR 1
+#define FEC_KERNEL_WORD64 2
+#define FEC_KERNEL_SSSE3  3
+#define FEC_KERNEL_AVX2   4
+#define FEC_KERNEL_NEON   5
+#define FEC_KERNEL_COUNT  6
+
+int fec_is_kernel_supported(int kernel);
+int fec_select_kernel(int kernel); /* returns 0 if not supported on this CPU */
+int fec_get_kernel(void);
+const char* fec_get_kernel_name(int kernel);
+
 void fec_encode(unsigned int blockSize,
 		unsigned char **data_blocks,
 		unsigned int nrDataBlocks,
 		unsigned char **fec_blocks,
 		unsigned int nrFecBlocks);
 
+/*
+ * Progressive encoding: folds one data block (blockNo, in order, starting
+ * from 0) into the fec blocks. After all the data blocks of a stripe were
+ * added, the fec blocks are byte-identical to the fec_encode() output.
+ * Block 0 initializes the fec blocks, so they need no clearing.
+ */
+void fec_encode_add_block(unsigned int blockSize,
+		unsigned char *data_block,
+		unsigned int blockNo,
+		unsigned char **fec_blocks,
+		unsigned int nrFecBlocks);
+
 void fec_decode(unsigned int blockSize,
 		unsigned char **data_blocks,
 		unsigned int nr_data_blocks,
@@ -33,7 +33,9 @@
 #include "../base/encr.h"
 #include "../base/config_hw.h"
 #include "../base/hw_procs.h"
+#include "../base/packets_pool.h"
 #include <pthread.h>
+#include <sys/eventfd.h>
 #include "../common/radio_stats.h"
 #include "../common/string_utils.h"
 #include "radio_rx.h"
@@ -51,6 +53,48 @@ int s_iLastSetCustomRxThreadPriority = DEFAULT_PRIORITY_THREAD_RADIO_RX;
 
 t_radio_rx_state s_RadioRxState;
 
+// Single producer (rx thread), single consumer (router main thread) queue of received packets.
+// Each index is written by one side only and lives on its own cache line. Slots between
+// uConsumeIndex and uProduceIndex belong to the consumer; the rest belong to the rx thread.
+// One slot is always kept empty to tell a full queue from an empty one.
+
+#define RADIO_RX_CACHE_LINE 64
+
+// Slot buffers come from a packets pool. On top of the buffers of the queue slots, the pool has
+// enough spare buffers for a consumer to keep a full video blocks stack referenced (see radio_rx_ref_packet_buffer).
+// Only the used buffers get touched, so the spare ones cost address space, not memory (no huge pages for this reason).
+#define RADIO_RX_POOL_SPARE_BUFFERS (MAX_RXTX_BLOCKS_BUFFER * MAX_TOTAL_PACKETS_IN_BLOCK)
+
+typedef struct
+{
+   volatile u32 uProduceIndex __attribute__((aligned(RADIO_RX_CACHE_LINE)));
+   volatile u32 uConsumeIndex __attribute__((aligned(RADIO_RX_CACHE_LINE)));
+   u32 uHandedOutCount; // Packets given to the consumer and not yet released
+   type_received_radio_packet packets[MAX_RX_PACKETS_QUEUE] __attribute__((aligned(RADIO_RX_CACHE_LINE)));
+} t_radio_rx_queue;
+
+static t_radio_rx_queue s_RadioRxQueue;
+static type_packets_pool s_RadioRxPacketsPool;
+
+// Consumer wake up: signaled only when the consumer armed it (it's about to wait), not for each packet
+static int s_iRadioRxEventFd = -1;
+static volatile int s_iRadioRxEventArmed = 0;
+
+static inline u32 _radio_rx_queue_next(u32 uIndex)
+{
+   uIndex++;
+   if ( uIndex >= MAX_RX_PACKETS_QUEUE )
+      uIndex = 0;
+   return uIndex;
+}
+
+static inline int _radio_rx_queue_count(u32 uProduce, u32 uConsume)
+{
+   if ( uProduce >= uConsume )
+      return (int)(uProduce - uConsume);
+   return (int)(MAX_RX_PACKETS_QUEUE - uConsume + uProduce);
+}
+
 pthread_t s_pThreadRadioRx;
 pthread_mutex_t s_pThreadRadioRxMutex;
 shared_mem_radio_stats* s_pSMRadioStats = NULL;
@@ -212,57 +256,65 @@ void _radio_rx_add_packet_to_rx_queue(u8* pPacket, int iLength, int iRadioInterf
 {
    if ( (NULL == pPacket) || (iLength <= 0) || s_iRadioRxMarkedForQuit )
       return;
+   if ( iLength > MAX_PACKET_TOTAL_SIZE )
+      iLength = MAX_PACKET_TOTAL_SIZE;
 
-   // Add the packet to the queue
-   s_RadioRxState.iPacketsRxInterface[s_RadioRxState.iCurrentRxPacketIndex] = iRadioInterface;
-   s_RadioRxState.iPacketsAreShort[s_RadioRxState.iCurrentRxPacketIndex] = 0;
-   s_RadioRxState.iPacketsLengths[s_RadioRxState.iCurrentRxPacketIndex] = iLength;
-   memcpy(s_RadioRxState.pPacketsBuffers[s_RadioRxState.iCurrentRxPacketIndex], pPacket, iLength);
-   
+   u32 uProduce = s_RadioRxQueue.uProduceIndex;
+   u32 uNext = _radio_rx_queue_next(uProduce);
+   u32 uConsume = __atomic_load_n(&s_RadioRxQueue.uConsumeIndex, __ATOMIC_ACQUIRE);
 
-   int iPacketsInQueue = 0;
-   if ( s_RadioRxState.iCurrentRxPacketIndex > s_RadioRxState.iCurrentRxPacketToConsume )
-      iPacketsInQueue = s_RadioRxState.iCurrentRxPacketIndex - s_RadioRxState.iCurrentRxPacketToConsume;
-   else if ( s_RadioRxState.iCurrentRxPacketIndex < s_RadioRxState.iCurrentRxPacketToConsume )
-      iPacketsInQueue = MAX_RX_PACKETS_QUEUE - s_RadioRxState.iCurrentRxPacketToConsume + s_RadioRxState.iCurrentRxPacketIndex;
-   
-   if ( iPacketsInQueue > s_RadioRxState.iMaxPacketsInQueueLastMinute )
-      s_RadioRxState.iMaxPacketsInQueueLastMinute = iPacketsInQueue;
-   if ( iPacketsInQueue > s_RadioRxState.iMaxPacketsInQueue )
-      s_RadioRxState.iMaxPacketsInQueue = iPacketsInQueue;
-
-   u32 uTimeStartTryLock = get_current_timestamp_ms();
-   int iLock = -1;
-   while ( (iLock != 0 ) && (get_current_timestamp_ms() <= uTimeStartTryLock+5) )
+   if ( uNext == uConsume )
    {
-      iLock = pthread_mutex_trylock(&s_pThreadRadioRxMutex);
-      hardware_sleep_micros(100);
+      // No more room. The slots still waiting to be consumed belong to the consumer, so drop the new packet.
+      s_RadioRxState.uTotalPacketsDroppedQueueFull++;
+      if ( (s_RadioRxState.uTotalPacketsDroppedQueueFull % 50) == 1 )
+         log_softerror_and_alarm("[RadioRxThread] No more room in rx queue. Discarding received packets (%u discarded so far). Max messages in queue: %d, last 10 sec: %d.", s_RadioRxState.uTotalPacketsDroppedQueueFull, s_RadioRxState.iMaxPacketsInQueue, s_RadioRxState.iMaxPacketsInQueueLastMinute);
+      return;
    }
 
-   if ( iLock != 0 )
-      log_softerror_and_alarm("[RadioRxThread] Doing unguarded rx buffers manipulation");
-   
-   s_RadioRxState.iCurrentRxPacketIndex++;
-   if ( s_RadioRxState.iCurrentRxPacketIndex >= MAX_RX_PACKETS_QUEUE )
-      s_RadioRxState.iCurrentRxPacketIndex = 0;
+   type_received_radio_packet* pSlot = &s_RadioRxQueue.packets[uProduce];
 
-   if ( s_RadioRxState.iCurrentRxPacketIndex == s_RadioRxState.iCurrentRxPacketToConsume )
+   // The consumer kept a reference to the previous packet in this slot? Then move the slot to a new buffer.
+   if ( packets_pool_get_ref_count(&s_RadioRxPacketsPool, pSlot->pPacketData) > 1 )
    {
-      // No more room. Must skip few pending processing packets
-      log_softerror_and_alarm("[RadioRxThread] No more room in rx buffers. Discarding some unprocessed messages. Max messages in queue: %d, last 10 sec: %d.", s_RadioRxState.iMaxPacketsInQueue, s_RadioRxState.iMaxPacketsInQueueLastMinute);
-      if ( iLock != 0 )
+      u8* pNewBuffer = packets_pool_alloc(&s_RadioRxPacketsPool);
+      if ( NULL == pNewBuffer )
       {
-         iLock = pthread_mutex_lock(&s_pThreadRadioRxMutex);
-      }
-      for( int i=0; i<3; i++ )
-      {
-         s_RadioRxState.iCurrentRxPacketToConsume++;
-         if ( s_RadioRxState.iCurrentRxPacketToConsume >= MAX_RX_PACKETS_QUEUE )
-            s_RadioRxState.iCurrentRxPacketToConsume = 0;
+         s_RadioRxState.uTotalPacketsDroppedQueueFull++;
+         if ( (s_RadioRxState.uTotalPacketsDroppedQueueFull % 50) == 1 )
+            log_softerror_and_alarm("[RadioRxThread] No more free rx packets buffers. Discarding received packets (%u discarded so far).", s_RadioRxState.uTotalPacketsDroppedQueueFull);
+         return;
       }
+      packets_pool_release(&s_RadioRxPacketsPool, pSlot->pPacketData);
+      pSlot->pPacketData = pNewBuffer;
+   }
+   memcpy(pSlot->pPacketData, pPacket, iLength);
+   pSlot->iPacketLength = iLength;
+   pSlot->iPacketIsShort = 0;
+   pSlot->iPacketRxInterface = iRadioInterface;
+   pSlot->uTimeReceivedMicros = get_current_timestamp_micros();
+
+   // Publish the slot content before the new index
+   __atomic_store_n(&s_RadioRxQueue.uProduceIndex, uNext, __ATOMIC_RELEASE);
+   s_RadioRxState.uTotalPacketsAddedToQueue++;
+
+   // Index store must be visible before reading the armed flag (the consumer does the reverse)
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   if ( s_iRadioRxEventFd >= 0 )
+   if ( __atomic_exchange_n(&s_iRadioRxEventArmed, 0, __ATOMIC_ACQ_REL) )
+   {
+      u64 uValue = 1;
+      if ( sizeof(uValue) != write(s_iRadioRxEventFd, &uValue, sizeof(uValue)) )
+         log_softerror_and_alarm("[RadioRxThread] Failed to signal rx event fd, error: %d", errno);
    }
-   if ( 0 == iLock )
-      pthread_mutex_unlock(&s_pThreadRadioRxMutex);
+
+   int iPacketsInQueue = _radio_rx_queue_count(uNext, uConsume);
+   if ( iPacketsInQueue > s_RadioRxState.iMaxPacketsInQueueLastMinute )
+      s_RadioRxState.iMaxPacketsInQueueLastMinute = iPacketsInQueue;
+   if ( iPacketsInQueue > s_RadioRxState.iMaxPacketsInQueue )
+      s_RadioRxState.iMaxPacketsInQueue = iPacketsInQueue;
+   if ( iPacketsInQueue > s_RadioRxState.iMaxPacketsInQueueEver )
+      s_RadioRxState.iMaxPacketsInQueueEver = iPacketsInQueue;
 
    s_uRadioRxLastTimeQueue += get_current_timestamp_ms() - s_uRadioRxTimeNow;
 }
@@ -561,18 +613,19 @@ int _radio_rx_parse_received_wifi_radio_data(int iInterfaceIndex)
             continue;
          }
 
-         if ( (iPacketLength != pPH->total_length) || (pPH->total_length >= MAX_PACKET_TOTAL_SIZE) )
+         // Decrypted AEAD packets are shorter than what they used in the buffer (the trailer)
+         if ( (iPacketLength < pPH->total_length) || (iPacketLength > pPH->total_length + ENCR_AEAD_OVERHEAD) || (pPH->total_length >= MAX_PACKET_TOTAL_SIZE) )
          {
             log_softerror_and_alarm("[RadioRxThread] Received broken packet (computed size: %d). Packet size: %d bytes, type: %s", iPacketLength, pPH->total_length, str_get_packet_type(pPH->packet_type));
             iDataIsOk = 0;
-            pData += pPH->total_length;
-            iLength -= pPH->total_length; 
+            pData += iPacketLength;
+            iLength -= iPacketLength; 
             continue;
          }
          _radio_rx_check_add_packet_to_rx_queue(pData, pPH->total_length, iInterfaceIndex);
 
-         pData += pPH->total_length;
-         iLength -= pPH->total_length;
+         pData += iPacketLength;
+         iLength -= iPacketLength;
       }
 
       s_uRadioRxTimeNow = get_current_timestamp_ms();
@@ -637,8 +690,10 @@ void _radio_rx_update_stats(u32 uTimeNow)
    {
       s_RadioRxState.uTimeLastMinute = uTimeNow;
       s_iCounterRadioRxStatsUpdate2++;
-      log_line("[RadioRxThread] Max packets in queue: %d. Max packets in queue in last 10 sec: %d.",
-         s_RadioRxState.iMaxPacketsInQueue, s_RadioRxState.iMaxPacketsInQueueLastMinute);
+      log_line("[RadioRxThread] Max packets in queue: %d. Max packets in queue in last 10 sec: %d. Max ever: %d of %d. Queued: %u, dropped (queue full): %u.",
+         s_RadioRxState.iMaxPacketsInQueue, s_RadioRxState.iMaxPacketsInQueueLastMinute,
+         s_RadioRxState.iMaxPacketsInQueueEver, MAX_RX_PACKETS_QUEUE-1,
+         s_RadioRxState.uTotalPacketsAddedToQueue, s_RadioRxState.uTotalPacketsDroppedQueueFull);
       s_RadioRxState.iMaxPacketsInQueueLastMinute = 0;
 
       radio_duplicate_detection_log_info();
@@ -816,22 +871,36 @@ int radio_rx_start_rx_thread(shared_mem_radio_stats* pSMRadioStats, shared_mem_r
 
    s_iRadioRxAllInterfacesPaused = 0;
 
-   for( int i=0; i<MAX_RX_PACKETS_QUEUE; i++ )
+   if ( s_iRadioRxEventFd < 0 )
+   {
+      s_iRadioRxEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if ( s_iRadioRxEventFd < 0 )
+         log_softerror_and_alarm("[RadioRx] Failed to create rx event fd, error: %d (%s)", errno, strerror(errno));
+   }
+
+   // The pool is kept for the lifetime of the process: the consumer can still hold buffers from it
+   if ( ! packets_pool_is_initialized(&s_RadioRxPacketsPool) )
    {
-      s_RadioRxState.iPacketsLengths[i] = 0;
-      s_RadioRxState.iPacketsAreShort[i] = 0;
-      s_RadioRxState.pPacketsBuffers[i] = (u8*) malloc(MAX_PACKET_TOTAL_SIZE);
-      if ( NULL == s_RadioRxState.pPacketsBuffers[i] )
+      if ( ! packets_pool_init(&s_RadioRxPacketsPool, "RadioRx", MAX_PACKET_TOTAL_SIZE, MAX_RX_PACKETS_QUEUE + RADIO_RX_POOL_SPARE_BUFFERS, 0) )
       {
          log_error_and_alarm("[RadioRx] Failed to allocate rx packets buffers!");
          return 0;
       }
+      for( int i=0; i<MAX_RX_PACKETS_QUEUE; i++ )
+         s_RadioRxQueue.packets[i].pPacketData = packets_pool_alloc(&s_RadioRxPacketsPool);
+      log_line("[RadioRx] Allocated buffers for %d rx packets.", MAX_RX_PACKETS_QUEUE);
    }
 
-   log_line("[RadioRx] Allocated %u bytes for %d rx packets.", MAX_RX_PACKETS_QUEUE * MAX_PACKET_TOTAL_SIZE, MAX_RX_PACKETS_QUEUE);
+   for( int i=0; i<MAX_RX_PACKETS_QUEUE; i++ )
+   {
+      s_RadioRxQueue.packets[i].iPacketLength = 0;
+      s_RadioRxQueue.packets[i].iPacketIsShort = 0;
+      s_RadioRxQueue.packets[i].iPacketRxInterface = 0;
+   }
 
-   s_RadioRxState.iCurrentRxPacketToConsume = 0;
-   s_RadioRxState.iCurrentRxPacketIndex = 0;
+   s_RadioRxQueue.uProduceIndex = 0;
+   s_RadioRxQueue.uConsumeIndex = 0;
+   s_RadioRxQueue.uHandedOutCount = 0;
 
    s_RadioRxState.uTimeLastStatsUpdate = get_current_timestamp_ms();
    
@@ -854,7 +923,9 @@ int radio_rx_start_rx_thread(shared_mem_radio_stats* pSMRadioStats, shared_mem_r
    s_RadioRxState.uTimeLastMinute = get_current_timestamp_ms();
    s_RadioRxState.iMaxPacketsInQueue = 0;
    s_RadioRxState.iMaxPacketsInQueueLastMinute = 0;
-
+   s_RadioRxState.iMaxPacketsInQueueEver = 0;
+   s_RadioRxState.uTotalPacketsAddedToQueue = 0;
+   s_RadioRxState.uTotalPacketsDroppedQueueFull = 0;
    
    s_RadioRxState.uMaxLoopTime = 0;
 
@@ -1013,7 +1084,9 @@ int radio_rx_detect_firmware_type_from_packet(u8* pPacketBuffer, int nPacketLeng
       t_packet_header* pPH = (t_packet_header*)pPacketBuffer;
       if ( pPH->total_length > nPacketLength )
       {
+         // AEAD packets have the CRC computed on the encrypted packet
          if ( pPH->packet_flags & PACKET_FLAGS_BIT_HAS_ENCRYPTION )
+         if ( ! (pPH->packet_flags_extended & PACKET_FLAGS_EXTENDED_BIT_ENCRYPTION_AEAD) )
          {
             int dx = sizeof(t_packet_header) - sizeof(u32) - sizeof(u32);
             int l = nPacketLength-dx;
@@ -1095,30 +1168,24 @@ t_radio_rx_state* radio_rx_get_state()
    return &s_RadioRxState;
 }
 
+// Consumer side functions. Must be called only from the thread that consumes the rx queue.
+
 int radio_rx_has_retransmissions_requests_to_consume()
 {
    if ( 0 == s_iRadioRxInitialized )
       return 0;
-   if ( s_RadioRxState.iCurrentRxPacketIndex == s_RadioRxState.iCurrentRxPacketToConsume )
-      return 0;
 
+   u32 uConsume = s_RadioRxQueue.uConsumeIndex;
+   u32 uProduce = __atomic_load_n(&s_RadioRxQueue.uProduceIndex, __ATOMIC_ACQUIRE);
    int iCount = 0;
-   int iBottom = 0;
-   int iTop = 0;
-   //pthread_mutex_lock(&s_pThreadRadioRxMutex);
-   iBottom = s_RadioRxState.iCurrentRxPacketToConsume;
-   iTop = s_RadioRxState.iCurrentRxPacketIndex;
-   //pthread_mutex_unlock(&s_pThreadRadioRxMutex);
-
-   while ( iBottom != iTop )
+
+   while ( uConsume != uProduce )
    {
-      t_packet_header* pPH = (t_packet_header*) s_RadioRxState.pPacketsBuffers[iBottom];
+      t_packet_header* pPH = (t_packet_header*) s_RadioRxQueue.packets[uConsume].pPacketData;
       if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_VIDEO )
       if ( (pPH->packet_type == PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS) || (pPH->packet_type == PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS2) )
          iCount++;
-      iBottom++;
-      if ( iBottom >= MAX_RX_PACKETS_QUEUE )
-         iBottom++;
+      uConsume = _radio_rx_queue_next(uConsume);
    }
    return iCount;
 }
@@ -1127,23 +1194,9 @@ int radio_rx_has_packets_to_consume()
 {
    if ( 0 == s_iRadioRxInitialized )
       return 0;
-   if ( s_RadioRxState.iCurrentRxPacketIndex == s_RadioRxState.iCurrentRxPacketToConsume )
-      return 0;
 
-   int iCount = 0;
-   int iBottom = 0;
-   int iTop = 0;
-   //pthread_mutex_lock(&s_pThreadRadioRxMutex);
-   iBottom = s_RadioRxState.iCurrentRxPacketToConsume;
-   iTop = s_RadioRxState.iCurrentRxPacketIndex;
-   //pthread_mutex_unlock(&s_pThreadRadioRxMutex);
-
-   if ( iBottom < iTop )
-      iCount = iTop - iBottom;
-   else
-      iCount = MAX_RX_PACKETS_QUEUE - iBottom + iTop;
-   
-   return iCount;
+   u32 uProduce = __atomic_load_n(&s_RadioRxQueue.uProduceIndex, __ATOMIC_ACQUIRE);
+   return _radio_rx_queue_count(uProduce, s_RadioRxQueue.uConsumeIndex) - (int)s_RadioRxQueue.uHandedOutCount;
 }
 
 u8* radio_rx_get_next_received_packet(int* pLength, int* pIsShortPacket, int* pRadioInterfaceIndex)
@@ -1157,26 +1210,24 @@ u8* radio_rx_get_next_received_packet(int* pLength, int* pIsShortPacket, int* pR
 
    if ( 0 == s_iRadioRxInitialized )
       return NULL;
-   if ( s_RadioRxState.iCurrentRxPacketIndex == s_RadioRxState.iCurrentRxPacketToConsume )
-      return NULL;
 
-   pthread_mutex_lock(&s_pThreadRadioRxMutex);
+   radio_rx_release_received_packets();
 
+   u32 uConsume = s_RadioRxQueue.uConsumeIndex;
+   if ( uConsume == __atomic_load_n(&s_RadioRxQueue.uProduceIndex, __ATOMIC_ACQUIRE) )
+      return NULL;
+
+   type_received_radio_packet* pSlot = &s_RadioRxQueue.packets[uConsume];
    if ( NULL != pLength )
-      *pLength = s_RadioRxState.iPacketsLengths[s_RadioRxState.iCurrentRxPacketToConsume];
+      *pLength = pSlot->iPacketLength;
    if ( NULL != pIsShortPacket )
-      *pIsShortPacket = s_RadioRxState.iPacketsAreShort[s_RadioRxState.iCurrentRxPacketToConsume];
+      *pIsShortPacket = pSlot->iPacketIsShort;
    if ( NULL != pRadioInterfaceIndex )
-      *pRadioInterfaceIndex = s_RadioRxState.iPacketsRxInterface[s_RadioRxState.iCurrentRxPacketToConsume];
-
-   memcpy( s_tmpLastProcessedRadioRxPacket, s_RadioRxState.pPacketsBuffers[s_RadioRxState.iCurrentRxPacketToConsume], s_RadioRxState.iPacketsLengths[s_RadioRxState.iCurrentRxPacketToConsume]);
+      *pRadioInterfaceIndex = pSlot->iPacketRxInterface;
 
-   s_RadioRxState.iCurrentRxPacketToConsume++;
-   if ( s_RadioRxState.iCurrentRxPacketToConsume >= MAX_RX_PACKETS_QUEUE )
-      s_RadioRxState.iCurrentRxPacketToConsume = 0;
-
-   pthread_mutex_unlock(&s_pThreadRadioRxMutex);
+   memcpy(s_tmpLastProcessedRadioRxPacket, pSlot->pPacketData, pSlot->iPacketLength);
 
+   __atomic_store_n(&s_RadioRxQueue.uConsumeIndex, _radio_rx_queue_next(uConsume), __ATOMIC_RELEASE);
    return s_tmpLastProcessedRadioRxPacket;
 }
 
@@ -1187,33 +1238,68 @@ int radio_rx_get_received_packets(int iCount, type_received_radio_packet* pOutpu
 
    if ( 0 == s_iRadioRxInitialized )
       return 0;
-   if ( s_RadioRxState.iCurrentRxPacketIndex == s_RadioRxState.iCurrentRxPacketToConsume )
-      return 0;
 
-   int iRead = 0;
+   // Previous batch was not released by the caller? Then it's not used anymore.
+   radio_rx_release_received_packets();
 
-   pthread_mutex_lock(&s_pThreadRadioRxMutex);
+   u32 uIndex = s_RadioRxQueue.uConsumeIndex;
+   u32 uProduce = __atomic_load_n(&s_RadioRxQueue.uProduceIndex, __ATOMIC_ACQUIRE);
+   int iRead = 0;
 
-   for( int i=0; i<iCount; i++ )
+   while ( (iRead < iCount) && (uIndex != uProduce) )
    {
-      pOutputArray[i].iPacketLength = s_RadioRxState.iPacketsLengths[s_RadioRxState.iCurrentRxPacketToConsume];
-      pOutputArray[i].iPacketIsShort = s_RadioRxState.iPacketsAreShort[s_RadioRxState.iCurrentRxPacketToConsume];
-      pOutputArray[i].iPacketRxInterface = s_RadioRxState.iPacketsRxInterface[s_RadioRxState.iCurrentRxPacketToConsume];
-      memcpy( pOutputArray[i].pPacketData, s_RadioRxState.pPacketsBuffers[s_RadioRxState.iCurrentRxPacketToConsume], s_RadioRxState.iPacketsLengths[s_RadioRxState.iCurrentRxPacketToConsume]);
+      pOutputArray[iRead] = s_RadioRxQueue.packets[uIndex];
+      uIndex = _radio_rx_queue_next(uIndex);
+      iRead++;
+   }
+   s_RadioRxQueue.uHandedOutCount = iRead;
+   return iRead;
+}
+
+void radio_rx_release_received_packets()
+{
+   if ( 0 == s_RadioRxQueue.uHandedOutCount )
+      return;
 
-      s_RadioRxState.iCurrentRxPacketToConsume++;
-      if ( s_RadioRxState.iCurrentRxPacketToConsume >= MAX_RX_PACKETS_QUEUE )
-         s_RadioRxState.iCurrentRxPacketToConsume = 0;
+   u32 uConsume = s_RadioRxQueue.uConsumeIndex;
+   for( u32 i=0; i<s_RadioRxQueue.uHandedOutCount; i++ )
+      uConsume = _radio_rx_queue_next(uConsume);
+   s_RadioRxQueue.uHandedOutCount = 0;
 
-      iRead++;
+   // Consumer is done with the slots; give them back to the rx thread
+   __atomic_store_n(&s_RadioRxQueue.uConsumeIndex, uConsume, __ATOMIC_RELEASE);
+}
 
-      if ( s_RadioRxState.iCurrentRxPacketIndex == s_RadioRxState.iCurrentRxPacketToConsume )
-         break;
-   }
+int radio_rx_get_event_fd()
+{
+   return s_iRadioRxEventFd;
+}
 
-   pthread_mutex_unlock(&s_pThreadRadioRxMutex);
+int radio_rx_arm_event_fd()
+{
+   __atomic_store_n(&s_iRadioRxEventArmed, 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   if ( s_RadioRxQueue.uConsumeIndex != __atomic_load_n(&s_RadioRxQueue.uProduceIndex, __ATOMIC_ACQUIRE) )
+      return 1;
+   return 0;
+}
 
-   return iRead;
+u8* radio_rx_ref_packet_buffer(u8* pPointer)
+{
+   // Keep enough free buffers for the rx thread to move each queue slot to a new buffer once
+   if ( packets_pool_get_free_count(&s_RadioRxPacketsPool) <= MAX_RX_PACKETS_QUEUE )
+      return NULL;
+   return packets_pool_ref(&s_RadioRxPacketsPool, pPointer);
+}
+
+void radio_rx_release_packet_buffer(u8* pPointer)
+{
+   packets_pool_release(&s_RadioRxPacketsPool, pPointer);
+}
+
+void radio_rx_log_packets_pool_stats()
+{
+   packets_pool_log_stats(&s_RadioRxPacketsPool);
 }
 
 u32 radio_rx_get_and_reset_max_loop_time()
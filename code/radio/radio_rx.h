@@ -27,13 +27,6 @@ typedef struct
 
 typedef struct
 {
-   u8* pPacketsBuffers[MAX_RX_PACKETS_QUEUE];
-   int iPacketsLengths[MAX_RX_PACKETS_QUEUE];
-   int iPacketsAreShort[MAX_RX_PACKETS_QUEUE];
-   int iPacketsRxInterface[MAX_RX_PACKETS_QUEUE];
-   int iCurrentRxPacketIndex; // Where next packet will be added
-   int iCurrentRxPacketToConsume; // Where the first packet to read/consume is
-
    int iRadioInterfacesBroken[MAX_RADIO_INTERFACES];
    int iRadioInterfacesRxTimeouts[MAX_RADIO_INTERFACES];
    int iRadioInterfacesRxBadPackets[MAX_RADIO_INTERFACES];
@@ -46,6 +39,9 @@ typedef struct
    u32 uTimeLastMinute;
    int iMaxPacketsInQueue;
    int iMaxPacketsInQueueLastMinute;
+   int iMaxPacketsInQueueEver; // High water mark since rx thread start
+   u32 uTotalPacketsAddedToQueue;
+   u32 uTotalPacketsDroppedQueueFull;
 } __attribute__((packed)) t_radio_rx_state;
 
 typedef struct
@@ -54,6 +50,7 @@ typedef struct
    int iPacketLength;
    int iPacketIsShort;
    int iPacketRxInterface;
+   u32 uTimeReceivedMicros; // when the rx thread added it to the rx queue
 } __attribute__((packed)) type_received_radio_packet;
 
 #ifdef __cplusplus
@@ -84,7 +81,24 @@ t_radio_rx_state* radio_rx_get_state();
 int radio_rx_has_retransmissions_requests_to_consume();
 int radio_rx_has_packets_to_consume();
 u8* radio_rx_get_next_received_packet(int* pLength, int* pIsShortPacket, int* pRadioInterfaceIndex);
+// Zero copy: pPacketData of each output entry points into the rx queue.
+// The packets stay owned by the caller (and valid) until radio_rx_release_received_packets() is called.
 int radio_rx_get_received_packets(int iCount, type_received_radio_packet* pOutputArray);
+void radio_rx_release_received_packets();
+// The rx queue buffers come from a packets pool. A consumer can keep a received packet past
+// radio_rx_release_received_packets() by taking a reference to its buffer (pPointer can point anywhere
+// inside the packet); the rx thread then moves that queue slot to a new buffer.
+// Returns the buffer start, or NULL if pPointer is not an rx queue buffer or there are not enough
+// spare buffers left (the caller must copy the data then).
+u8* radio_rx_ref_packet_buffer(u8* pPointer);
+void radio_rx_release_packet_buffer(u8* pPointer);
+void radio_rx_log_packets_pool_stats();
+
+// Event driven consumers: the rx thread signals this eventfd when it adds packets to an empty rx queue
+// after the consumer armed it. Arm it before waiting on the fd; if it returns 1 there are packets already,
+// don't wait. Drain the fd (read it) once woken up.
+int radio_rx_get_event_fd();
+int radio_rx_arm_event_fd();
 
 u32 radio_rx_get_and_reset_max_loop_time();
 u32 radio_rx_get_and_reset_max_loop_time_read();
@@ -0,0 +1,247 @@
+/*
+    Ruby Licence
+    Copyright (c) 2024 Petru Soroaga petrusoroaga@yahoo.com
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Copyright info and developer info must be preserved as is in the user
+        interface, additions could be made to that info.
+        * Neither the name of the organization nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+        * Military use is not permited.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Julien Verneuil BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+#include "radio_rx_mmap.h"
+
+void radio_rx_mmap_init(t_radio_rx_mmap* pRing)
+{
+   if ( NULL == pRing )
+      return;
+   memset(pRing, 0, sizeof(t_radio_rx_mmap));
+   pRing->iSocket = -1;
+}
+
+int radio_rx_mmap_get_link_type(const char* szInterfaceName)
+{
+   if ( (NULL == szInterfaceName) || (0 == szInterfaceName[0]) )
+      return -1;
+
+   int iSocket = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( iSocket < 0 )
+      return -1;
+
+   struct ifreq ifr;
+   memset(&ifr, 0, sizeof(ifr));
+   strncpy(ifr.ifr_name, szInterfaceName, IFNAMSIZ-1);
+   int iLinkType = -1;
+   if ( ioctl(iSocket, SIOCGIFHWADDR, &ifr) >= 0 )
+      iLinkType = ifr.ifr_hwaddr.sa_family;
+   close(iSocket);
+   return iLinkType;
+}
+
+int radio_rx_mmap_is_open(t_radio_rx_mmap* pRing)
+{
+   if ( (NULL == pRing) || (pRing->iSocket < 0) || (NULL == pRing->pMemory) )
+      return 0;
+   return 1;
+}
+
+int radio_rx_mmap_open(t_radio_rx_mmap* pRing, const char* szInterfaceName, struct sock_fprog* pFilter)
+{
+   if ( (NULL == pRing) || (NULL == szInterfaceName) || (0 == szInterfaceName[0]) )
+      return -1;
+
+   radio_rx_mmap_init(pRing);
+
+   // Open the socket with no protocol so that nothing is queued before the filter and the ring are set up
+   pRing->iSocket = socket(AF_PACKET, SOCK_RAW, 0);
+   if ( pRing->iSocket < 0 )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] Failed to create packet socket for [%s], error: %d (%s)", szInterfaceName, errno, strerror(errno));
+      pRing->iSocket = -1;
+      return -1;
+   }
+
+   struct ifreq ifr;
+   memset(&ifr, 0, sizeof(ifr));
+   strncpy(ifr.ifr_name, szInterfaceName, IFNAMSIZ-1);
+   if ( ioctl(pRing->iSocket, SIOCGIFINDEX, &ifr) < 0 )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] Failed to get interface index for [%s], error: %d (%s)", szInterfaceName, errno, strerror(errno));
+      radio_rx_mmap_close(pRing);
+      return -1;
+   }
+   int iIfIndex = ifr.ifr_ifindex;
+
+   if ( ioctl(pRing->iSocket, SIOCGIFHWADDR, &ifr) < 0 )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] Failed to get interface link type for [%s], error: %d (%s)", szInterfaceName, errno, strerror(errno));
+      radio_rx_mmap_close(pRing);
+      return -1;
+   }
+   pRing->iLinkType = ifr.ifr_hwaddr.sa_family;
+
+   int iVersion = TPACKET_V3;
+   if ( 0 != setsockopt(pRing->iSocket, SOL_PACKET, PACKET_VERSION, &iVersion, sizeof(iVersion)) )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] TPACKET_V3 is not supported on this system, error: %d (%s)", errno, strerror(errno));
+      radio_rx_mmap_close(pRing);
+      return -1;
+   }
+
+   if ( NULL != pFilter )
+   if ( 0 != setsockopt(pRing->iSocket, SOL_SOCKET, SO_ATTACH_FILTER, pFilter, sizeof(struct sock_fprog)) )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] Failed to attach filter to [%s], error: %d (%s)", szInterfaceName, errno, strerror(errno));
+      radio_rx_mmap_close(pRing);
+      return -1;
+   }
+
+   struct tpacket_req3 req;
+   memset(&req, 0, sizeof(req));
+   req.tp_block_size = RADIO_RX_MMAP_BLOCK_SIZE;
+   req.tp_block_nr = RADIO_RX_MMAP_BLOCKS_COUNT;
+   req.tp_frame_size = RADIO_RX_MMAP_FRAME_SIZE;
+   req.tp_frame_nr = (RADIO_RX_MMAP_BLOCK_SIZE / RADIO_RX_MMAP_FRAME_SIZE) * RADIO_RX_MMAP_BLOCKS_COUNT;
+   req.tp_retire_blk_tov = RADIO_RX_MMAP_BLOCK_TIMEOUT_MS;
+   req.tp_sizeof_priv = 0;
+   req.tp_feature_req_word = 0;
+
+   if ( 0 != setsockopt(pRing->iSocket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] Failed to setup rx ring for [%s], error: %d (%s)", szInterfaceName, errno, strerror(errno));
+      radio_rx_mmap_close(pRing);
+      return -1;
+   }
+
+   pRing->uBlockSize = req.tp_block_size;
+   pRing->uBlocksCount = req.tp_block_nr;
+   pRing->uMemorySize = req.tp_block_size * req.tp_block_nr;
+   pRing->pMemory = (u8*) mmap(NULL, pRing->uMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED, pRing->iSocket, 0);
+   if ( MAP_FAILED == pRing->pMemory )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] Failed to map rx ring for [%s] (%u bytes), error: %d (%s)", szInterfaceName, pRing->uMemorySize, errno, strerror(errno));
+      pRing->pMemory = NULL;
+      radio_rx_mmap_close(pRing);
+      return -1;
+   }
+
+   struct sockaddr_ll ll_addr;
+   memset(&ll_addr, 0, sizeof(ll_addr));
+   ll_addr.sll_family = AF_PACKET;
+   ll_addr.sll_protocol = htons(ETH_P_ALL);
+   ll_addr.sll_ifindex = iIfIndex;
+   if ( 0 != bind(pRing->iSocket, (struct sockaddr*)&ll_addr, sizeof(ll_addr)) )
+   {
+      log_softerror_and_alarm("[RadioRxMmap] Failed to bind packet socket to [%s], error: %d (%s)", szInterfaceName, errno, strerror(errno));
+      radio_rx_mmap_close(pRing);
+      return -1;
+   }
+
+   log_line("[RadioRxMmap] Opened rx ring on [%s] (link type %d): %u blocks of %u bytes, fd: %d",
+      szInterfaceName, pRing->iLinkType, pRing->uBlocksCount, pRing->uBlockSize, pRing->iSocket);
+   return pRing->iSocket;
+}
+
+void radio_rx_mmap_close(t_radio_rx_mmap* pRing)
+{
+   if ( NULL == pRing )
+      return;
+   if ( NULL != pRing->pMemory )
+      munmap(pRing->pMemory, pRing->uMemorySize);
+   if ( pRing->iSocket >= 0 )
+      close(pRing->iSocket);
+   pRing->pMemory = NULL;
+   pRing->iSocket = -1;
+   pRing->iBlockInUse = 0;
+   pRing->uFramesLeftInBlock = 0;
+   pRing->pNextFrame = NULL;
+}
+
+u8* radio_rx_mmap_next_frame(t_radio_rx_mmap* pRing, int* piFrameLength, int* piOriginalLength)
+{
+   if ( NULL != piFrameLength )
+      *piFrameLength = 0;
+   if ( NULL != piOriginalLength )
+      *piOriginalLength = 0;
+   if ( ! radio_rx_mmap_is_open(pRing) )
+      return NULL;
+
+   while ( 1 )
+   {
+      struct tpacket_block_desc* pBlock = (struct tpacket_block_desc*)(pRing->pMemory + pRing->uCurrentBlock * pRing->uBlockSize);
+
+      if ( pRing->iBlockInUse )
+      {
+         if ( pRing->uFramesLeftInBlock > 0 )
+            break;
+
+         // Done with all the frames in this block (the last one returned is not used anymore), give it back
+         __atomic_store_n(&pBlock->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+         pRing->iBlockInUse = 0;
+         pRing->uCurrentBlock++;
+         if ( pRing->uCurrentBlock >= pRing->uBlocksCount )
+            pRing->uCurrentBlock = 0;
+         continue;
+      }
+
+      if ( 0 == (__atomic_load_n(&pBlock->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) )
+         return NULL;
+
+      pRing->iBlockInUse = 1;
+      pRing->uFramesLeftInBlock = pBlock->hdr.bh1.num_pkts;
+      pRing->pNextFrame = ((u8*)pBlock) + pBlock->hdr.bh1.offset_to_first_pkt;
+      pRing->uTotalBlocks++;
+   }
+
+   struct tpacket3_hdr* pFrame = (struct tpacket3_hdr*) pRing->pNextFrame;
+   pRing->pNextFrame += pFrame->tp_next_offset;
+   pRing->uFramesLeftInBlock--;
+   pRing->uTotalFrames++;
+
+   if ( NULL != piFrameLength )
+      *piFrameLength = pFrame->tp_snaplen;
+   if ( NULL != piOriginalLength )
+      *piOriginalLength = pFrame->tp_len;
+   return ((u8*)pFrame) + pFrame->tp_mac;
+}
+
+u32 radio_rx_mmap_get_dropped_count(t_radio_rx_mmap* pRing)
+{
+   if ( ! radio_rx_mmap_is_open(pRing) )
+      return 0;
+
+   // Kernel resets the counters on each read
+   struct tpacket_stats_v3 stats;
+   socklen_t iLen = sizeof(stats);
+   memset(&stats, 0, sizeof(stats));
+   if ( 0 == getsockopt(pRing->iSocket, SOL_PACKET, PACKET_STATISTICS, &stats, &iLen) )
+      pRing->uTotalDropped += stats.tp_drops;
+   return pRing->uTotalDropped;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include <linux/filter.h>
+
+// Memory mapped AF_PACKET (TPACKET_V3) receive ring for monitor mode interfaces.
+// The kernel fills whole blocks of frames; the reader walks all the frames in a block
+// and gives the block back to the kernel only when moving on to the next one.
+
+#if defined (HW_PLATFORM_RASPBERRY) || defined (HW_PLATFORM_RADXA_ZERO3)
+#define RADIO_RX_MMAP_BLOCK_SIZE (1<<16)
+#define RADIO_RX_MMAP_BLOCKS_COUNT 16
+#else
+#define RADIO_RX_MMAP_BLOCK_SIZE (1<<15)
+#define RADIO_RX_MMAP_BLOCKS_COUNT 8
+#endif
+#define RADIO_RX_MMAP_FRAME_SIZE 2048
+// Max time (ms) the kernel keeps a partially filled block before handing it to the reader
+#define RADIO_RX_MMAP_BLOCK_TIMEOUT_MS 1
+
+typedef struct
+{
+   int iSocket;
+   int iLinkType; // ARPHRD_* of the interface
+   u8* pMemory;
+   u32 uMemorySize;
+   u32 uBlockSize;
+   u32 uBlocksCount;
+   u32 uCurrentBlock;
+   u32 uFramesLeftInBlock;
+   u8* pNextFrame;
+   int iBlockInUse; // current block is owned by us and must be returned to the kernel
+
+   u32 uTotalBlocks;
+   u32 uTotalFrames;
+   u32 uTotalDropped; // as reported by the kernel (PACKET_STATISTICS)
+} t_radio_rx_mmap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void radio_rx_mmap_init(t_radio_rx_mmap* pRing);
+
+// Returns the ARPHRD_* link type of the interface or -1 on failure
+int radio_rx_mmap_get_link_type(const char* szInterfaceName);
+
+// Returns the socket fd (to be used with select/poll) or -1 on failure.
+// pFilter is optional (classic BPF program attached to the socket before the ring starts receiving).
+int radio_rx_mmap_open(t_radio_rx_mmap* pRing, const char* szInterfaceName, struct sock_fprog* pFilter);
+void radio_rx_mmap_close(t_radio_rx_mmap* pRing);
+int radio_rx_mmap_is_open(t_radio_rx_mmap* pRing);
+
+// Returns the next received frame, or NULL if there are no more ready frames.
+// The returned pointer is valid until the next call to radio_rx_mmap_next_frame or close.
+u8* radio_rx_mmap_next_frame(t_radio_rx_mmap* pRing, int* piFrameLength, int* piOriginalLength);
+
+// Updates and returns the total number of frames dropped by the kernel because the ring was full
+u32 radio_rx_mmap_get_dropped_count(t_radio_rx_mmap* pRing);
+
+#ifdef __cplusplus
+}
+#endif
@@ -29,18 +29,27 @@
     SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <netpacket/packet.h>
 #include <net/if.h>
 #include <netinet/ether.h>
 #include <string.h>
 #include <getopt.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "../base/base.h"
 #include "../base/encr.h"
 #include "../base/hardware.h"
 #include "../base/hardware_radio_serial.h"
+#include "../base/hardware_radio_virtual.h"
 #include "../base/hw_procs.h"
+#include "../base/packets_pool.h"
+#include "../base/spsc_queue.h"
 #include "../common/string_utils.h"
 #include "radiotap.h"
 #include <time.h>
@@ -48,6 +57,8 @@
 #include "radiolink.h"
 #include "radiopackets2.h"
 #include "radio_rx.h"
+#include "radio_rx_mmap.h"
+#include <net/if_arp.h>
 
 //#define DEBUG_PACKET_RECEIVED
 //#define DEBUG_PACKET_SENT
@@ -55,6 +66,73 @@
 int s_bRadioDebugFlag = 0;
 int s_iUsePCAPForTx = DEFAULT_USE_PPCAP_FOR_TX;
 int s_iBypassSocketBuffers = DEFAULT_BYPASS_SOCKET_BUFFERS;
+int s_iUseMmapRingForRx = DEFAULT_USE_MMAP_RING_FOR_RX;
+t_radio_rx_mmap s_RadioRxMmapRings[MAX_RADIO_INTERFACES];
+
+typedef struct
+{
+   u8* pBuffer; // RADIO_TX_BATCH_MAX_PACKETS slots of MAX_PACKET_TOTAL_SIZE bytes, allocated on first use
+   u8* pPackets[RADIO_TX_BATCH_MAX_PACKETS];
+   int iLengths[RADIO_TX_BATCH_MAX_PACKETS];
+   int iCount;
+} t_radio_tx_batch;
+
+int s_iRadioTxBatchActive = 0;
+t_radio_tx_batch s_RadioTxBatches[MAX_RADIO_INTERFACES];
+t_radio_tx_batch_stats s_RadioTxBatchStats[MAX_RADIO_INTERFACES];
+
+// Async tx: each queued packet is a pool buffer, this header followed by the packet (radio headers included)
+typedef struct
+{
+   int iInterfaceIndex;
+   int iLength;
+   u32 uTimeQueuedMicros;
+   u32 uReserved;
+} t_radio_tx_async_packet;
+
+#define RADIO_TX_ASYNC_QUEUE_SIZE 512
+#define RADIO_TX_ASYNC_MAX_WAIT_MICROS 20000
+
+typedef struct
+{
+   int iRunning;
+   volatile int iQuit;
+   int iCPUCore;
+   int iEventFd;
+   pthread_t threadTx;
+   pthread_t threadProducer;
+   type_packets_pool pool;
+   type_spsc_queue queue;
+   volatile u32 uCountQueued; // written by the producer
+   volatile u32 uCountDone; // written by the tx thread
+   volatile u32 uTxTimeMicros[MAX_RADIO_INTERFACES]; // since the last batch flush
+   t_radio_tx_async_stats stats;
+} t_radio_tx_async;
+
+t_radio_tx_async s_RadioTxAsync;
+
+// Prebuilt radiotap + IEEE headers, per radio interface, for the last few datarate/flags/port combinations used.
+// A template is rebuilt only when its key changes; per packet only the IEEE seq number is patched.
+#define RADIO_TX_HEADER_TEMPLATES_PER_INTERFACE 4
+#define RADIO_TX_HEADER_TEMPLATE_MAX_LENGTH 48
+
+typedef struct
+{
+   int iValid;
+   int iDataRate;
+   u32 uFrameFlags;
+   int iPort;
+   u32 uRadiotapGeneration;
+   int iRadiotapLength;
+   int iIEEELength;
+   int iLength;
+   u8 uHeader[RADIO_TX_HEADER_TEMPLATE_MAX_LENGTH];
+} t_radio_tx_header_template;
+
+t_radio_tx_header_template s_RadioTxHeaderTemplates[MAX_RADIO_INTERFACES][RADIO_TX_HEADER_TEMPLATES_PER_INTERFACE];
+int s_iRadioTxHeaderTemplatesNextSlot[MAX_RADIO_INTERFACES];
+u32 s_uRadiotapHeaderGeneration = 0; // incremented when radiotap bytes not derived from the datarate alone change
+u8 s_uRadioTxComposeBuffer[MAX_PACKET_TOTAL_SIZE];
 int s_iRadioInterfacesBroken = 0;
 int s_iRadioLastReadErrorCode = RADIO_READ_ERROR_NO_ERROR;
 int s_iVehicleBehindMilisec = 0;
@@ -151,7 +229,13 @@ void radio_init_link_structures()
    radio_packets_short_init();
 
    for( int i=0; i<MAX_RADIO_INTERFACES; i++ )
+   {
       s_uNextRadioPacketIndexes[i] = 0;
+      s_RadioTxBatches[i].iCount = 0;
+      memset(&s_RadioTxBatchStats[i], 0, sizeof(t_radio_tx_batch_stats));
+      radio_invalidate_tx_header_templates(i);
+   }
+   s_iRadioTxBatchActive = 0;
 
    radio_reset_packets_default_frequencies(0);
 
@@ -189,6 +273,16 @@ void radio_init_link_structures()
 
 void radio_link_cleanup()
 {
+   radio_tx_async_stop();
+   for( int i=0; i<MAX_RADIO_INTERFACES; i++ )
+   {
+      if ( NULL != s_RadioTxBatches[i].pBuffer )
+         free(s_RadioTxBatches[i].pBuffer);
+      s_RadioTxBatches[i].pBuffer = NULL;
+      s_RadioTxBatches[i].iCount = 0;
+   }
+   s_iRadioTxBatchActive = 0;
+
    if ( s_iMutexRadioSyncRxTxThreadsInitialized )
    {
       pthread_mutex_destroy(&s_pMutexRadioSyncRxTxThreads);
@@ -290,6 +384,20 @@ void radio_set_use_pcap_for_tx(int iEnablePCAPTx)
       log_line("[Radio] Set using sockets for radio tx");
 }
 
+void radio_set_use_mmap_ring_for_rx(int iEnableMmapRing)
+{
+   s_iUseMmapRingForRx = iEnableMmapRing;
+   if ( s_iUseMmapRingForRx )
+      log_line("[Radio] Set using memory mapped ring (TPACKET_V3) for radio rx");
+   else
+      log_line("[Radio] Set using ppcap for radio rx");
+}
+
+int radio_get_use_mmap_ring_for_rx()
+{
+   return s_iUseMmapRingForRx;
+}
+
 void radio_set_bypass_socket_buffers(int iBypass)
 {
    s_iBypassSocketBuffers = iBypass;
@@ -501,6 +609,8 @@ void radio_set_frames_flags(u32 frameFlags)
          if ( sRadioFrameFlags & RADIO_FLAG_STBC_VEHICLE )
             mcs_flags = mcs_flags | IEEE80211_RADIOTAP_MCS_STBC_1 << IEEE80211_RADIOTAP_MCS_STBC_SHIFT;       
       }
+      if ( (s_uRadiotapHeaderMCS[10] != mcs_known) || (s_uRadiotapHeaderMCS[11] != mcs_flags) )
+         s_uRadiotapHeaderGeneration++;
       s_uRadiotapHeaderMCS[10] = mcs_known;
       s_uRadiotapHeaderMCS[11] = mcs_flags;
       s_uRadiotapHeaderMCS[12] = (uint8_t)mcsRate;
@@ -523,6 +633,52 @@ int radio_get_last_read_error_code()
    return s_iRadioLastReadErrorCode; 
 }
 
+// Returns the read fd or -1 if the memory mapped ring can't be used on this interface
+
+int _radio_open_interface_for_read_mmap(radio_hw_info_t* pRadioHWInfo, int interfaceIndex, char* szFilter, char* szFilterPrism)
+{
+   struct bpf_program bpfprogram;
+   int iLinkType = radio_rx_mmap_get_link_type(pRadioHWInfo->szName);
+   int iDLT = 0;
+   char* szProgram = NULL;
+
+   if ( iLinkType == ARPHRD_IEEE80211_RADIOTAP )
+   {
+      iDLT = DLT_IEEE802_11_RADIO;
+      szProgram = szFilter;
+   }
+   else if ( iLinkType == ARPHRD_IEEE80211_PRISM )
+   {
+      iDLT = DLT_PRISM_HEADER;
+      szProgram = szFilterPrism;
+   }
+   else
+   {
+      log_softerror_and_alarm("Unsupported link type (%d) for memory mapped rx on [%s]", iLinkType, pRadioHWInfo->szName);
+      return -1;
+   }
+
+   // Use pcap only to compile the same filter as the pcap rx path, then attach it to the packet socket
+   pcap_t* pDeadPcap = pcap_open_dead(iDLT, MAX_PACKET_LENGTH_PCAP);
+   if ( NULL == pDeadPcap )
+      return -1;
+   if ( pcap_compile(pDeadPcap, &bpfprogram, szProgram, 1, PCAP_NETMASK_UNKNOWN) == -1 )
+   {
+      log_softerror_and_alarm("ERROR: compiling program for interface [%s]: %s", pRadioHWInfo->szName, pcap_geterr(pDeadPcap));
+      pcap_close(pDeadPcap);
+      return -1;
+   }
+
+   struct sock_fprog filter;
+   filter.len = bpfprogram.bf_len;
+   filter.filter = (struct sock_filter*) bpfprogram.bf_insns;
+
+   int iFd = radio_rx_mmap_open(&s_RadioRxMmapRings[interfaceIndex], pRadioHWInfo->szName, &filter);
+   pcap_freecode(&bpfprogram);
+   pcap_close(pDeadPcap);
+   return iFd;
+}
+
 int _radio_open_interface_for_read_with_filter(int interfaceIndex, char* szFilter, char* szFilterPrism)
 {
    s_iRadioInterfacesBroken = 0;
@@ -551,9 +707,39 @@ int _radio_open_interface_for_read_with_filter(int interfaceIndex, char* szFilte
    }
 
    pRadioHWInfo->openedForRead = 0;
+   pRadioHWInfo->monitor_interface_read.ppcap = NULL;
    pRadioHWInfo->monitor_interface_read.selectable_fd = -1;
    pRadioHWInfo->monitor_interface_read.iErrorCount = 0;
 
+   if ( hardware_radio_is_virtual_radio(pRadioHWInfo) )
+   {
+      // The port filter is applied on read (see _radio_read_virtual_frame)
+      int iFd = hardware_radio_virtual_open_for_read(interfaceIndex);
+      if ( iFd < 0 )
+         return -1;
+      pRadioHWInfo->monitor_interface_read.selectable_fd = iFd;
+      pRadioHWInfo->monitor_interface_read.radioInfo.nDbm = hardware_radio_virtual_get_config()->iDbm;
+      pRadioHWInfo->monitor_interface_read.radioInfo.nDbmNoise = -127;
+      pRadioHWInfo->openedForRead = 1;
+      log_line("Opened virtual radio interface %d (%s) for reading on %s. Returned fd=%d", interfaceIndex+1, pRadioHWInfo->szName, str_format_frequency(pRadioHWInfo->uCurrentFrequencyKhz), iFd);
+      return iFd;
+   }
+
+   if ( s_iUseMmapRingForRx )
+   {
+      int iFd = _radio_open_interface_for_read_mmap(pRadioHWInfo, interfaceIndex, szFilter, szFilterPrism);
+      if ( iFd >= 0 )
+      {
+         pRadioHWInfo->monitor_interface_read.selectable_fd = iFd;
+         pRadioHWInfo->monitor_interface_read.radioInfo.nDbm = -127;
+         pRadioHWInfo->monitor_interface_read.radioInfo.nDbmNoise = -127;
+         pRadioHWInfo->openedForRead = 1;
+         log_line("Opened radio interface %d (%s) for reading (memory mapped ring) on %s, filter: [%s]. Returned fd=%d", interfaceIndex+1, pRadioHWInfo->szName, str_format_frequency(pRadioHWInfo->uCurrentFrequencyKhz), szFilter, iFd);
+         return iFd;
+      }
+      log_softerror_and_alarm("Failed to open radio interface %d (%s) for reading using memory mapped ring. Fallback to ppcap.", interfaceIndex+1, pRadioHWInfo->szName);
+   }
+
    szErrbuf[0] = '\0';
    //pRadioHWInfo->monitor_interface_read.ppcap = pcap_open_live(pRadioHWInfo->szName, 4096, 1, 1, szErrbuf);
    pRadioHWInfo->monitor_interface_read.ppcap = pcap_create(pRadioHWInfo->szName, szErrbuf);
@@ -673,7 +859,14 @@ int radio_open_interface_for_write(int interfaceIndex)
    pRadioHWInfo->monitor_interface_write.selectable_fd = -1;
    pRadioHWInfo->monitor_interface_write.iErrorCount = 0;
 
-   if ( s_iUsePCAPForTx )
+   if ( hardware_radio_is_virtual_radio(pRadioHWInfo) )
+   {
+      pRadioHWInfo->monitor_interface_write.ppcap = NULL;
+      pRadioHWInfo->monitor_interface_write.selectable_fd = hardware_radio_virtual_open_for_write(interfaceIndex);
+      if ( pRadioHWInfo->monitor_interface_write.selectable_fd < 0 )
+         return -1;
+   }
+   else if ( s_iUsePCAPForTx )
    {
       log_line("Using ppcap for tx packets.");
       char errbuf[PCAP_ERRBUF_SIZE];
@@ -777,7 +970,20 @@ void radio_close_interface_for_read(int interfaceIndex)
 
    radio_rx_pause_interface(interfaceIndex, "Close radio interface");
    
-   if ( NULL != pRadioHWInfo->monitor_interface_read.ppcap )
+   if ( hardware_radio_is_virtual_radio(pRadioHWInfo) && pRadioHWInfo->openedForRead )
+   {
+      log_line("Closed virtual radio interface %d [%s] that was used for read, selectable read fd was: %d", interfaceIndex+1, pRadioHWInfo->szName, pRadioHWInfo->monitor_interface_read.selectable_fd);
+      hardware_radio_virtual_close_for_read(interfaceIndex);
+   }
+   else if ( radio_rx_mmap_is_open(&s_RadioRxMmapRings[interfaceIndex]) )
+   {
+      t_radio_rx_mmap* pRing = &s_RadioRxMmapRings[interfaceIndex];
+      log_line("Closed radio interface %d [%s] that was used for read (memory mapped ring), selectable read fd was: %d. Received %u frames in %u blocks, kernel dropped %u frames.",
+         interfaceIndex+1, pRadioHWInfo->szName, pRadioHWInfo->monitor_interface_read.selectable_fd,
+         pRing->uTotalFrames, pRing->uTotalBlocks, radio_rx_mmap_get_dropped_count(pRing));
+      radio_rx_mmap_close(pRing);
+   }
+   else if ( NULL != pRadioHWInfo->monitor_interface_read.ppcap )
    {
       log_line("Closed radio interface %d [%s] that was used for read, selectable read fd was: %d, ppcap was: %d", interfaceIndex+1, pRadioHWInfo->szName, pRadioHWInfo->monitor_interface_read.selectable_fd, pRadioHWInfo->monitor_interface_read.ppcap);
       pcap_close(pRadioHWInfo->monitor_interface_read.ppcap);
@@ -804,6 +1010,8 @@ void radio_close_interfaces_for_read()
    log_line("Closed all radio interfaces used for read (in pcap mode).");
 }
 
+static void _radio_tx_async_wait_sent();
+
 void radio_close_interface_for_write(int interfaceIndex)
 {
    radio_hw_info_t* pRadioHWInfo = hardware_get_radio_info(interfaceIndex);
@@ -813,9 +1021,13 @@ void radio_close_interface_for_write(int interfaceIndex)
       return;
    }
 
+   _radio_tx_async_wait_sent();
+
    log_line("Closed radio interface %d (%s) that was used for write. Selectable write fd was: %d, ppcap was: %d", interfaceIndex+1, pRadioHWInfo->szName, pRadioHWInfo->monitor_interface_write.selectable_fd, pRadioHWInfo->monitor_interface_write.ppcap);
 
-   if ( s_iUsePCAPForTx )
+   if ( hardware_radio_is_virtual_radio(pRadioHWInfo) )
+      hardware_radio_virtual_close_for_write(interfaceIndex);
+   else if ( s_iUsePCAPForTx )
    {
       if ( NULL != pRadioHWInfo->monitor_interface_write.ppcap )
          pcap_close(pRadioHWInfo->monitor_interface_write.ppcap);
@@ -830,6 +1042,11 @@ void radio_close_interface_for_write(int interfaceIndex)
          log_line("Radio interface %d was not opened for write.", interfaceIndex+1);
    }
 
+   if ( s_RadioTxBatches[interfaceIndex].iCount > 0 )
+      log_line("Discarded %d radio packets queued for batch send on radio interface %d.", s_RadioTxBatches[interfaceIndex].iCount, interfaceIndex+1);
+   s_RadioTxBatches[interfaceIndex].iCount = 0;
+   radio_invalidate_tx_header_templates(interfaceIndex);
+
    pRadioHWInfo->monitor_interface_write.ppcap = NULL;
    pRadioHWInfo->monitor_interface_write.selectable_fd = -1;
    pRadioHWInfo->monitor_interface_write.iErrorCount = 0;
@@ -837,6 +1054,37 @@ void radio_close_interface_for_write(int interfaceIndex)
 }
 
 
+// Virtual radio interfaces get all the frames sent to them; apply the same filter as the one used on the monitor interfaces.
+// Returns the next frame for the opened port or NULL if there are no more frames.
+
+static u8* _radio_read_virtual_frame(int interfaceNumber, radio_hw_info_t* pRadioHWInfo, int* piLength)
+{
+   int iPortEncoded = _radio_encode_port(pRadioHWInfo->monitor_interface_read.nPort);
+   while ( 1 )
+   {
+      int iLength = hardware_radio_virtual_read(interfaceNumber, sPayloadBufferRead, sizeof(sPayloadBufferRead));
+      if ( iLength <= 0 )
+      {
+         if ( iLength < 0 )
+            s_iRadioLastReadErrorCode = RADIO_READ_ERROR_READ_ERROR;
+         return NULL;
+      }
+      if ( iLength < 4 )
+         continue;
+      int iRadiotapLength = sPayloadBufferRead[2] | (((int)sPayloadBufferRead[3]) << 8);
+      if ( iLength < iRadiotapLength + (int)sizeof(s_uIEEEHeaderData) )
+         continue;
+      u8* pIEEE = sPayloadBufferRead + iRadiotapLength;
+      if ( (pIEEE[0] != 0x08) || (pIEEE[1] != 0x01) || (0 != memcmp(pIEEE + 10, s_uIEEEHeaderData + 10, 4)) )
+         continue;
+      if ( pIEEE[4] != (u8)iPortEncoded )
+         continue;
+      *piLength = iLength;
+      return sPayloadBufferRead;
+   }
+   return NULL;
+}
+
 u8* radio_process_wlan_data_in(int interfaceNumber, int* outPacketLength)
 {
    radio_hw_info_t* pRadioHWInfo = hardware_get_radio_info(interfaceNumber);
@@ -925,9 +1173,33 @@ u8* radio_process_wlan_data_in(int interfaceNumber, int* outPacketLength)
    */
    struct pcap_pkthdr pcapHeader;
    ppcapPacketHeader = &pcapHeader;
-   pRadioPayload = (u8*) pcap_next(pRadioHWInfo->monitor_interface_read.ppcap, ppcapPacketHeader); 
+
+   if ( radio_rx_mmap_is_open(&s_RadioRxMmapRings[interfaceNumber]) )
+   {
+      // Walks all the frames the kernel already placed in the ring; returns NULL once the ring is drained
+      int iCapLength = 0;
+      int iOrigLength = 0;
+      pRadioPayload = radio_rx_mmap_next_frame(&s_RadioRxMmapRings[interfaceNumber], &iCapLength, &iOrigLength);
+      ppcapPacketHeader->caplen = iCapLength;
+      ppcapPacketHeader->len = iCapLength;
+   }
+   else if ( hardware_radio_is_virtual_radio(pRadioHWInfo) )
+   {
+      int iFrameLength = 0;
+      pRadioPayload = _radio_read_virtual_frame(interfaceNumber, pRadioHWInfo, &iFrameLength);
+      ppcapPacketHeader->caplen = iFrameLength;
+      ppcapPacketHeader->len = iFrameLength;
+   }
+   else
+      pRadioPayload = (u8*) pcap_next(pRadioHWInfo->monitor_interface_read.ppcap, ppcapPacketHeader); 
    if ( NULL == pRadioPayload )
+   {
+      #ifdef FEATURE_RADIO_SYNCHRONIZE_RXTX_THREADS
+      if ( 1 == s_iMutexRadioSyncRxTxThreadsInitialized )
+         pthread_mutex_unlock(&s_pMutexRadioSyncRxTxThreads);
+      #endif
       return NULL;
+   }
    //memcpy(sPayloadBufferRead, pRadioPayload, ppcapPacketHeader->caplen);
    #ifdef DEBUG_PACKET_RECEIVED
    log_line("RX Buffer: caplen: %d bytes, len: %d", ppcapPacketHeader->caplen, ppcapPacketHeader->len);
@@ -1031,6 +1303,58 @@ u8* radio_process_wlan_data_in(int interfaceNumber, int* outPacketLength)
    return pRadioPayload;
 }
 
+// AEAD packets: the CRC is of the encrypted packet (checked first, cheap reject of corrupted frames),
+// then the tag is verified and the packet decrypted in place (see radio_build_new_raw_packet).
+// On success the packet is rewritten as a plain packet, so that any later check of it (CRC, processing) passes.
+
+static int _packet_process_and_check_aead(u8* pPacketBuffer, int* pbCRCOk)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacketBuffer;
+   int iOnAirLength = pPH->total_length;
+   int dx = sizeof(t_packet_header) - sizeof(u32) - sizeof(u32);
+
+   if ( iOnAirLength < dx + ENCR_AEAD_OVERHEAD )
+   {
+      s_iLastProcessingErrorCode = RADIO_PROCESSING_ERROR_CODE_PACKET_RECEIVED_TOO_SMALL;
+      return 0;
+   }
+
+   u32 uCRC = 0;
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      uCRC = base_compute_crc32(pPacketBuffer+sizeof(u32), sizeof(t_packet_header)-sizeof(u32));
+   else
+      uCRC = base_compute_crc32(pPacketBuffer+sizeof(u32), iOnAirLength-sizeof(u32));
+
+   if ( (uCRC & 0x00FFFFFF) != (pPH->uCRC & 0x00FFFFFF) )
+   {
+      s_iLastProcessingErrorCode = RADIO_PROCESSING_ERROR_CODE_INVALID_CRC_RECEIVED;
+      return 0;
+   }
+
+   int iPlainLength = iOnAirLength - ENCR_AEAD_OVERHEAD;
+   if ( ! dppa(pPacketBuffer + sizeof(u32), dx - sizeof(u32), pPacketBuffer + dx, iPlainLength - dx, pPH->stream_packet_idx, pPacketBuffer + iPlainLength) )
+   {
+      s_iLastProcessingErrorCode = RADIO_PROCESSING_ERROR_CODE_AUTHENTICATION_FAILED;
+      #ifdef DEBUG_PACKET_RECEIVED
+      log_line("Received packet failed authentication, packet length: %d bytes", iOnAirLength);
+      #endif
+      return 0;
+   }
+
+   pPH->packet_flags &= ~PACKET_FLAGS_BIT_HAS_ENCRYPTION;
+   pPH->packet_flags_extended &= ~PACKET_FLAGS_EXTENDED_BIT_ENCRYPTION_AEAD;
+   pPH->total_length = iPlainLength;
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      radio_packet_compute_crc(pPacketBuffer, sizeof(t_packet_header));
+   else
+      radio_packet_compute_crc(pPacketBuffer, iPlainLength);
+
+   if ( NULL != pbCRCOk )
+      *pbCRCOk = 1;
+   s_iLastProcessingErrorCode = RADIO_PROCESSING_ERROR_NO_ERROR;
+   return iOnAirLength;
+}
+
 // returns 0 for failure, total length of packet for success
 
 int packet_process_and_check(int interfaceNb, u8* pPacketBuffer, int iBufferLength, int* pbCRCOk)
@@ -1073,6 +1397,10 @@ int packet_process_and_check(int interfaceNb, u8* pPacketBuffer, int iBufferLeng
       return 0;
    }
 
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HAS_ENCRYPTION )
+   if ( pPH->packet_flags_extended & PACKET_FLAGS_EXTENDED_BIT_ENCRYPTION_AEAD )
+      return _packet_process_and_check_aead(pPacketBuffer, pbCRCOk);
+
    if ( pPH->packet_flags & PACKET_FLAGS_BIT_HAS_ENCRYPTION )
    {
       #ifdef DEBUG_PACKET_RECEIVED
@@ -1129,85 +1457,62 @@ u32 radio_get_next_radio_link_packet_index(int iLocalRadioLinkId)
    return uRadioLinkPacketIndex;
 }
 
-int radio_build_new_raw_packet(int iLocalRadioLinkId, u8* pRawPacket, u8* pPacketData, int nInputLength, int portNb, int bEncrypt, int iExtraData, u8* pExtraData)
-{
-   int totalRadioLength = 0;
+// Writes the radiotap and IEEE headers for the current datarate, frames flags and the given port.
+// Returns the total headers length.
 
+static int _radio_compose_tx_headers(u8* pOutput, int portNb, int* piRadiotapLength, int* piIEEELength)
+{
    s_uIEEEHeaderData_short[4] = _radio_encode_port(portNb);
    s_uIEEEHeaderData[4] = _radio_encode_port(portNb);
    s_uIEEEHeaderRTS[4] = _radio_encode_port(portNb);
-   s_uIEEEHeaderData[22] = uIEEEE80211SeqNb & 0xff;
-   s_uIEEEHeaderData[23] = (uIEEEE80211SeqNb >> 8) & 0xff;
-   uIEEEE80211SeqNb += 16;
-   
+
+   u8* pRadiotap = s_uRadiotapHeaderLegacy;
+   int iRadiotapLength = sizeof(s_uRadiotapHeaderLegacy);
    if ( (sRadioFrameFlags & RADIO_FLAGS_MCS_MASK) || (sRadioDataRate_bps < 0) )
    {
-      memcpy(pRawPacket, s_uRadiotapHeaderMCS, sizeof(s_uRadiotapHeaderMCS));
-      pRawPacket += sizeof(s_uRadiotapHeaderMCS);
-      totalRadioLength += sizeof(s_uRadiotapHeaderMCS);
-      s_uLastPacketSentRadioTapHeaderLength = sizeof(s_uRadiotapHeaderMCS);
-   }
-   else
-   {
-      memcpy(pRawPacket, s_uRadiotapHeaderLegacy, sizeof(s_uRadiotapHeaderLegacy));
-      pRawPacket += sizeof(s_uRadiotapHeaderLegacy);
-      totalRadioLength += sizeof(s_uRadiotapHeaderLegacy);
-      s_uLastPacketSentRadioTapHeaderLength = sizeof(s_uRadiotapHeaderLegacy);
+      pRadiotap = s_uRadiotapHeaderMCS;
+      iRadiotapLength = sizeof(s_uRadiotapHeaderMCS);
    }
 
-   if ( sRadioFrameFlags & RADIO_FLAGS_FRAME_TYPE_DATA )
-   {
-      memcpy(pRawPacket, s_uIEEEHeaderData, sizeof (s_uIEEEHeaderData));
-      pRawPacket += sizeof(s_uIEEEHeaderData);
-      totalRadioLength += sizeof(s_uIEEEHeaderData);
-      s_uLastPacketSentIEEEHeaderLength = sizeof(s_uIEEEHeaderData);
-   }
-   else if ( sRadioFrameFlags & RADIO_FLAGS_FRAME_TYPE_RTS )
-   {   
-      memcpy(pRawPacket, s_uIEEEHeaderRTS, sizeof (s_uIEEEHeaderRTS));
-      pRawPacket += sizeof(s_uIEEEHeaderRTS);
-      totalRadioLength += sizeof(s_uIEEEHeaderRTS);
-      s_uLastPacketSentIEEEHeaderLength = sizeof(s_uIEEEHeaderRTS);
-   }	
-   else if ( sRadioFrameFlags & RADIO_FLAGS_FRAME_TYPE_DATA_SHORT )
-   {
-      memcpy(pRawPacket, s_uIEEEHeaderData_short, sizeof (s_uIEEEHeaderData_short));
-      pRawPacket += sizeof(s_uIEEEHeaderData_short);
-      totalRadioLength += sizeof(s_uIEEEHeaderData_short);
-      s_uLastPacketSentIEEEHeaderLength = sizeof(s_uIEEEHeaderData_short);
-   }
-   else
+   u8* pIEEE = s_uIEEEHeaderData;
+   int iIEEELength = sizeof(s_uIEEEHeaderData);
+   if ( ! (sRadioFrameFlags & RADIO_FLAGS_FRAME_TYPE_DATA) )
    {
-      memcpy(pRawPacket, s_uIEEEHeaderData, sizeof (s_uIEEEHeaderData));
-      pRawPacket += sizeof(s_uIEEEHeaderData);
-      totalRadioLength += sizeof(s_uIEEEHeaderData);
-      s_uLastPacketSentIEEEHeaderLength = sizeof(s_uIEEEHeaderData);
+      if ( sRadioFrameFlags & RADIO_FLAGS_FRAME_TYPE_RTS )
+      {
+         pIEEE = s_uIEEEHeaderRTS;
+         iIEEELength = sizeof(s_uIEEEHeaderRTS);
+      }
+      else if ( sRadioFrameFlags & RADIO_FLAGS_FRAME_TYPE_DATA_SHORT )
+      {
+         pIEEE = s_uIEEEHeaderData_short;
+         iIEEELength = sizeof(s_uIEEEHeaderData_short);
+      }
    }
-   
-   memcpy(pRawPacket, pPacketData, nInputLength);
-   totalRadioLength += nInputLength;
 
-   if ( s_bRadioDebugFlag )
-      memcpy(s_uLastPacketBuilt, pPacketData, nInputLength);
+   memcpy(pOutput, pRadiotap, iRadiotapLength);
+   memcpy(pOutput + iRadiotapLength, pIEEE, iIEEELength);
 
-   if ( (0 < iExtraData) && (NULL != pExtraData) )
-   {
-      memcpy(pRawPacket+nInputLength, pExtraData, iExtraData);
-      totalRadioLength += iExtraData;
-   }
+   s_uLastPacketSentRadioTapHeaderLength = iRadiotapLength;
+   s_uLastPacketSentIEEEHeaderLength = iIEEELength;
+   if ( NULL != piRadiotapLength )
+      *piRadiotapLength = iRadiotapLength;
+   if ( NULL != piIEEELength )
+      *piIEEELength = iIEEELength;
+   return iRadiotapLength + iIEEELength;
+}
 
-   #ifdef DEBUG_PACKET_SENT
-   log_line("Building a composed packet of total size: %d, extra data: %d", nInputLength + iExtraData, iExtraData);
-   #endif
+// Sets the radio link packet index, computes the CRC and encrypts (if requested), in place, all the packets chained in the buffer.
+// Extra data (if any) must already be appended after the last packet.
 
+static void _radio_finalize_packets(int iLocalRadioLinkId, u8* pPacketData, int nInputLength, int bEncrypt, int iExtraData)
+{
    if ( (iLocalRadioLinkId < 0) || (iLocalRadioLinkId >= MAX_RADIO_INTERFACES) )
       iLocalRadioLinkId = 0;
    u16 uRadioLinkPacketIndex = radio_get_next_radio_link_packet_index(iLocalRadioLinkId);
 
-   // Compute CRC/encrypt all packets in this buffer
-
    int nLength = nInputLength;
-   u8* pData = pRawPacket;
+   u8* pData = pPacketData;
 
    int nPCount = 0;
    while ( nLength > 0 )
@@ -1219,7 +1524,7 @@ int radio_build_new_raw_packet(int iLocalRadioLinkId, u8* pRawPacket, u8* pPacke
       // Last packet in the chain? Add the extra data if present
       if ( nLength == nPacketLength )
       {
-         if ( 0 < iExtraData && NULL != pExtraData )
+         if ( 0 < iExtraData )
          {
             #ifdef DEBUG_PACKET_SENT
             log_line("Adding extra data at the end: %d len", iExtraData);
@@ -1252,12 +1557,179 @@ int radio_build_new_raw_packet(int iLocalRadioLinkId, u8* pRawPacket, u8* pPacke
       nLength -= nPacketLength;
       pData += nPacketLength;
    }
+}
+
+// Copies the chained packets (and the extra data, appended to the last one) to pOutput, each one followed by its
+// AEAD trailer (explicit nonce + tag). The packets header stays in clear (authenticated), the rest is encrypted
+// (same region as the XOR encryption). The CRC is computed on the encrypted packet.
+// Returns the total output length or 0 if the packets do not fit in a radio frame.
+
+static int _radio_compose_aead_packets(int iLocalRadioLinkId, u8* pOutput, int iMaxOutputLength, u8* pPacketData, int nInputLength, u8* pExtraData, int iExtraData)
+{
+   if ( (iLocalRadioLinkId < 0) || (iLocalRadioLinkId >= MAX_RADIO_INTERFACES) )
+      iLocalRadioLinkId = 0;
+   u16 uRadioLinkPacketIndex = radio_get_next_radio_link_packet_index(iLocalRadioLinkId);
+   int dx = sizeof(t_packet_header) - sizeof(u32) - sizeof(u32);
+
+   int nLength = nInputLength;
+   int iOutputLength = 0;
+   while ( nLength > 0 )
+   {
+      t_packet_header* pPHSource = (t_packet_header*)pPacketData;
+      int nPacketLength = pPHSource->total_length;
+      int iExtra = (nLength == nPacketLength)?iExtraData:0;
+      if ( (nPacketLength < (int)sizeof(t_packet_header)) || (nPacketLength > nLength) ||
+           (iOutputLength + nPacketLength + iExtra + ENCR_AEAD_OVERHEAD > iMaxOutputLength) )
+      {
+         log_softerror_and_alarm("Can't encrypt radio packet (type: %s, length: %d, composed length: %d): does not fit in a radio frame.", str_get_packet_type(pPHSource->packet_type), nPacketLength, nInputLength);
+         return 0;
+      }
+
+      u8* pData = pOutput + iOutputLength;
+      t_packet_header* pPH = (t_packet_header*)pData;
+      memcpy(pData, pPacketData, nPacketLength);
+      if ( iExtra > 0 )
+      {
+         memcpy(pData + nPacketLength, pExtraData, iExtra);
+         pPH->total_length += iExtra;
+         pPH->packet_flags |= PACKET_FLAGS_BIT_EXTRA_DATA;
+      }
+      int iPlainLength = pPH->total_length;
+      pPH->radio_link_packet_index = uRadioLinkPacketIndex;
+      pPH->packet_flags |= PACKET_FLAGS_BIT_HAS_ENCRYPTION;
+      pPH->packet_flags_extended |= PACKET_FLAGS_EXTENDED_BIT_ENCRYPTION_AEAD;
+      pPH->total_length = iPlainLength + ENCR_AEAD_OVERHEAD;
+
+      if ( ! eppa(pData + sizeof(u32), dx - sizeof(u32), pData + dx, iPlainLength - dx, pPH->stream_packet_idx, pData + iPlainLength) )
+      {
+         log_softerror_and_alarm("Failed to encrypt radio packet (type: %s), no encryption key.", str_get_packet_type(pPH->packet_type));
+         return 0;
+      }
+
+      if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+         radio_packet_compute_crc(pData, sizeof(t_packet_header));
+      else
+         radio_packet_compute_crc(pData, pPH->total_length);
+
+      iOutputLength += pPH->total_length;
+      nLength -= nPacketLength;
+      pPacketData += nPacketLength;
+   }
+   return iOutputLength;
+}
+
+int radio_build_new_raw_packet(int iLocalRadioLinkId, u8* pRawPacket, u8* pPacketData, int nInputLength, int portNb, int bEncrypt, int iExtraData, u8* pExtraData)
+{
+   s_uIEEEHeaderData[22] = uIEEEE80211SeqNb & 0xff;
+   s_uIEEEHeaderData[23] = (uIEEEE80211SeqNb >> 8) & 0xff;
+   uIEEEE80211SeqNb += 16;
+
+   int totalRadioLength = _radio_compose_tx_headers(pRawPacket, portNb, NULL, NULL);
+   pRawPacket += totalRadioLength;
+
+   if ( bEncrypt == RADIO_PACKET_ENCRYPTION_AEAD )
+   {
+      if ( s_bRadioDebugFlag )
+         memcpy(s_uLastPacketBuilt, pPacketData, nInputLength);
+      if ( (iExtraData <= 0) || (NULL == pExtraData) )
+         iExtraData = 0;
+      int iLength = _radio_compose_aead_packets(iLocalRadioLinkId, pRawPacket, MAX_PACKET_TOTAL_SIZE - totalRadioLength, pPacketData, nInputLength, pExtraData, iExtraData);
+      if ( iLength <= 0 )
+         return 0;
+      return totalRadioLength + iLength;
+   }
+   
+   memcpy(pRawPacket, pPacketData, nInputLength);
+   totalRadioLength += nInputLength;
+
+   if ( s_bRadioDebugFlag )
+      memcpy(s_uLastPacketBuilt, pPacketData, nInputLength);
+
+   if ( (0 < iExtraData) && (NULL != pExtraData) )
+   {
+      memcpy(pRawPacket+nInputLength, pExtraData, iExtraData);
+      totalRadioLength += iExtraData;
+   }
+   else
+      iExtraData = 0;
+
+   #ifdef DEBUG_PACKET_SENT
+   log_line("Building a composed packet of total size: %d, extra data: %d", nInputLength + iExtraData, iExtraData);
+   #endif
+
+   // Compute CRC/encrypt all packets in this buffer
+   _radio_finalize_packets(iLocalRadioLinkId, pRawPacket, nInputLength, bEncrypt, iExtraData);
 
    return totalRadioLength;
 }
 
+void radio_prepare_packets_for_tx(int iLocalRadioLinkId, u8* pPacketData, int nPacketLength)
+{
+   if ( (NULL == pPacketData) || (nPacketLength <= 0) )
+      return;
+   _radio_finalize_packets(iLocalRadioLinkId, pPacketData, nPacketLength, 0, 0);
+}
 
-int radio_write_raw_packet(int interfaceIndex, u8* pData, int dataLength)
+int radio_get_tx_header_template(int interfaceIndex, int portNb, u8** ppHeader)
+{
+   if ( (interfaceIndex < 0) || (interfaceIndex >= MAX_RADIO_INTERFACES) || (NULL == ppHeader) )
+      return 0;
+
+   t_radio_tx_header_template* pTemplate = NULL;
+   for( int i=0; i<RADIO_TX_HEADER_TEMPLATES_PER_INTERFACE; i++ )
+   {
+      t_radio_tx_header_template* pTmp = &s_RadioTxHeaderTemplates[interfaceIndex][i];
+      if ( pTmp->iValid && (pTmp->iDataRate == sRadioDataRate_bps) && (pTmp->uFrameFlags == sRadioFrameFlags) )
+      if ( (pTmp->iPort == portNb) && (pTmp->uRadiotapGeneration == s_uRadiotapHeaderGeneration) )
+      {
+         pTemplate = pTmp;
+         break;
+      }
+   }
+
+   if ( NULL == pTemplate )
+   {
+      pTemplate = &s_RadioTxHeaderTemplates[interfaceIndex][s_iRadioTxHeaderTemplatesNextSlot[interfaceIndex]];
+      s_iRadioTxHeaderTemplatesNextSlot[interfaceIndex] = (s_iRadioTxHeaderTemplatesNextSlot[interfaceIndex] + 1) % RADIO_TX_HEADER_TEMPLATES_PER_INTERFACE;
+      pTemplate->iLength = _radio_compose_tx_headers(pTemplate->uHeader, portNb, &pTemplate->iRadiotapLength, &pTemplate->iIEEELength);
+      pTemplate->iDataRate = sRadioDataRate_bps;
+      pTemplate->uFrameFlags = sRadioFrameFlags;
+      pTemplate->iPort = portNb;
+      pTemplate->uRadiotapGeneration = s_uRadiotapHeaderGeneration;
+      pTemplate->iValid = 1;
+      s_RadioTxBatchStats[interfaceIndex].uHeaderTemplatesBuilt++;
+   }
+   else
+   {
+      s_uLastPacketSentRadioTapHeaderLength = pTemplate->iRadiotapLength;
+      s_uLastPacketSentIEEEHeaderLength = pTemplate->iIEEELength;
+   }
+
+   // Only the full data frame header has a seq number
+   if ( pTemplate->iIEEELength == (int)sizeof(s_uIEEEHeaderData) )
+   {
+      pTemplate->uHeader[pTemplate->iRadiotapLength + 22] = uIEEEE80211SeqNb & 0xff;
+      pTemplate->uHeader[pTemplate->iRadiotapLength + 23] = (uIEEEE80211SeqNb >> 8) & 0xff;
+   }
+   uIEEEE80211SeqNb += 16;
+
+   *ppHeader = pTemplate->uHeader;
+   return pTemplate->iLength;
+}
+
+void radio_invalidate_tx_header_templates(int interfaceIndex)
+{
+   if ( (interfaceIndex < 0) || (interfaceIndex >= MAX_RADIO_INTERFACES) )
+      return;
+   for( int i=0; i<RADIO_TX_HEADER_TEMPLATES_PER_INTERFACE; i++ )
+      s_RadioTxHeaderTemplates[interfaceIndex][i].iValid = 0;
+   s_iRadioTxHeaderTemplatesNextSlot[interfaceIndex] = 0;
+}
+
+// Sends iCount radio packets, each one made of an optional header (pHeaders can be NULL) and the data.
+// Returns the number of packets sent (in order, from the start of the list)
+
+static int _radio_write_raw_packets(int interfaceIndex, u8** pHeaders, int* piHeaderLengths, u8** pPackets, int* piLengths, int iCount)
 {
    radio_hw_info_t* pRadioHWInfo = hardware_get_radio_info(interfaceIndex);
    if ( NULL == pRadioHWInfo || ( 0 == pRadioHWInfo->openedForWrite) || (pRadioHWInfo->monitor_interface_write.selectable_fd < 0 ) )
@@ -1266,92 +1738,561 @@ int radio_write_raw_packet(int interfaceIndex, u8* pData, int dataLength)
       return 0;
    }
 
-   if ( (NULL == pData) || (dataLength <= 0) )
+   if ( (NULL == pPackets) || (NULL == piLengths) || (iCount <= 0) )
    {
       log_softerror_and_alarm("RadioError: Tried to send an empty radio message.");
       return 0;
    }
 
-   if ( s_bRadioDebugFlag )
+   #ifdef FEATURE_RADIO_SYNCHRONIZE_RXTX_THREADS
+   if ( 1 == s_iMutexRadioSyncRxTxThreadsInitialized )
+      pthread_mutex_lock(&s_pMutexRadioSyncRxTxThreads);
+   #endif
+
+   u32 uTimeStart = get_current_timestamp_micros();
+   int iSent = 0;
+
+   if ( hardware_radio_is_virtual_radio(pRadioHWInfo) )
    {
-      t_packet_header* pPH = (t_packet_header*)&s_uLastPacketBuilt[0];
-      if ( pPH->packet_type == PACKET_TYPE_RUBY_PING_CLOCK )
+      for( iSent=0; iSent<iCount; iSent++ )
       {
-         s_uLastRadioPingSentTime = get_current_timestamp_ms();
-         s_uLastRadioPingId = s_uLastPacketBuilt[sizeof(t_packet_header)];
-         //log_line("DEBUG sent PING, id: %d", s_uLastRadioPingId);
+         if ( ! hardware_radio_virtual_write(interfaceIndex, (NULL != pHeaders)?pHeaders[iSent]:NULL, (NULL != pHeaders)?piHeaderLengths[iSent]:0, pPackets[iSent], piLengths[iSent]) )
+         {
+            log_softerror_and_alarm("RadioError: Failed to send radio message on virtual radio interface %d (%d bytes).", interfaceIndex+1, piLengths[iSent]);
+            break;
+         }
+      }
+   }
+   else if ( s_iUsePCAPForTx )
+   {
+      // No batch or scatter-gather call in pcap, inject one by one
+      for( iSent=0; iSent<iCount; iSent++ )
+      {
+         u8* pFrame = pPackets[iSent];
+         int iFrameLength = piLengths[iSent];
+         if ( NULL != pHeaders )
+         {
+            if ( piHeaderLengths[iSent] + piLengths[iSent] > MAX_PACKET_TOTAL_SIZE )
+            {
+               log_softerror_and_alarm("RadioError: Radio message too big to send (%d bytes).", piHeaderLengths[iSent] + piLengths[iSent]);
+               break;
+            }
+            memcpy(s_uRadioTxComposeBuffer, pHeaders[iSent], piHeaderLengths[iSent]);
+            memcpy(s_uRadioTxComposeBuffer + piHeaderLengths[iSent], pPackets[iSent], piLengths[iSent]);
+            pFrame = s_uRadioTxComposeBuffer;
+            iFrameLength += piHeaderLengths[iSent];
+         }
+         int len = pcap_inject(pRadioHWInfo->monitor_interface_write.ppcap, pFrame, iFrameLength);
+         if ( len < iFrameLength )
+         {
+            log_softerror_and_alarm("RadioError: tx ppcap failed to send radio message (%d bytes sent of %d bytes).", len, iFrameLength);
+            break;
+         }
       }
+   }
+   else
+   {
+      struct mmsghdr msgs[RADIO_TX_BATCH_MAX_PACKETS];
+      struct iovec iovecs[2*RADIO_TX_BATCH_MAX_PACKETS];
+      int iRetries = 0;
 
-      if ( pPH->packet_type == PACKET_TYPE_RUBY_PING_CLOCK_REPLY )
+      while ( iSent < iCount )
       {
-         u8 uPingId = s_uLastPacketBuilt[sizeof(t_packet_header)];
-         //if ( uPingId == s_uLastRadioPingId )
-         //   log_line("DEBUG send matching ping reply id %d, delta time: %u ms", uPingId, get_current_timestamp_ms() - s_uLastRadioPingSentTime);
-         //else
-         //   log_line("DEBUG send ping reply %d", uPingId);
+         int iChunk = iCount - iSent;
+         if ( iChunk > RADIO_TX_BATCH_MAX_PACKETS )
+            iChunk = RADIO_TX_BATCH_MAX_PACKETS;
+         memset(msgs, 0, iChunk * sizeof(struct mmsghdr));
+         for( int i=0; i<iChunk; i++ )
+         {
+            struct iovec* pIOV = &iovecs[2*i];
+            msgs[i].msg_hdr.msg_iov = pIOV;
+            msgs[i].msg_hdr.msg_iovlen = 0;
+            if ( NULL != pHeaders )
+            {
+               pIOV->iov_base = pHeaders[iSent+i];
+               pIOV->iov_len = piHeaderLengths[iSent+i];
+               pIOV++;
+               msgs[i].msg_hdr.msg_iovlen++;
+            }
+            pIOV->iov_base = pPackets[iSent+i];
+            pIOV->iov_len = piLengths[iSent+i];
+            msgs[i].msg_hdr.msg_iovlen++;
+         }
+         int iRes = sendmmsg(pRadioHWInfo->monitor_interface_write.selectable_fd, msgs, iChunk, 0);
+         if ( iRes > 0 )
+         {
+            for( int i=0; i<iRes; i++ )
+            {
+               int iFrameLength = piLengths[iSent+i];
+               if ( NULL != pHeaders )
+                  iFrameLength += piHeaderLengths[iSent+i];
+               if ( (int)msgs[i].msg_len < iFrameLength )
+                  log_softerror_and_alarm("RadioError: Partial radio message sent on radio interface %d (%d bytes sent of %d bytes).", interfaceIndex+1, (int)msgs[i].msg_len, iFrameLength);
+            }
+            iSent += iRes;
+            continue;
+         }
+         // Kernel queue full? Retry once, then give up on the rest of the batch
+         if ( (iRes < 0) && ((errno == ENOBUFS) || (errno == EAGAIN)) && (0 == iRetries) )
+         {
+            iRetries++;
+            continue;
+         }
+         log_softerror_and_alarm("RadioError: Failed to send radio messages on radio interface %d, fd=%d (%d of %d sent), error: %d (%s).",
+           interfaceIndex+1, pRadioHWInfo->monitor_interface_write.selectable_fd, iSent, iCount, errno, strerror(errno));
+         break;
       }
    }
 
+   u32 uTime = get_current_timestamp_micros() - uTimeStart;
+
+   s_uPacketsSentUsingCurrent_RadioRate += iSent;
+   s_uPacketsSentUsingCurrent_RadioFlags += iSent;
+
+   if ( iSent < iCount )
+      pRadioHWInfo->monitor_interface_write.iErrorCount++;
+   else
+      pRadioHWInfo->monitor_interface_write.iErrorCount = 0;
+
+   t_radio_tx_batch_stats* pStats = &s_RadioTxBatchStats[interfaceIndex];
+   pStats->uBatchesSent++;
+   pStats->uPacketsSent += iSent;
+   pStats->uPacketsFailed += iCount - iSent;
+   pStats->uLastBatchPackets = iCount;
+   pStats->uLastBatchTimeMicros = uTime;
+   pStats->uTotalBatchTimeMicros += uTime;
+   if ( uTime > pStats->uMaxBatchTimeMicros )
+      pStats->uMaxBatchTimeMicros = uTime;
+   if ( (u32)iCount > pStats->uMaxBatchPackets )
+      pStats->uMaxBatchPackets = iCount;
+
    #ifdef FEATURE_RADIO_SYNCHRONIZE_RXTX_THREADS
    if ( 1 == s_iMutexRadioSyncRxTxThreadsInitialized )
-      pthread_mutex_lock(&s_pMutexRadioSyncRxTxThreads);
+      pthread_mutex_unlock(&s_pMutexRadioSyncRxTxThreads);
    #endif
 
-   s_uPacketsSentUsingCurrent_RadioRate++;
-   s_uPacketsSentUsingCurrent_RadioFlags++;
+   #ifdef DEBUG_PACKET_SENT
+   if ( NULL == pHeaders )
+   for( int i=0; i<iSent; i++ )
+   if ( piLengths[i] <= 96 )
+   {
+      log_line("Sent buffer over the radio (%d bytes [%d headers, %d data]):", piLengths[i], s_uLastPacketSentRadioTapHeaderLength + s_uLastPacketSentIEEEHeaderLength, piLengths[i] - s_uLastPacketSentRadioTapHeaderLength - s_uLastPacketSentIEEEHeaderLength);
+      log_buffer5(pPackets[i], piLengths[i], s_uLastPacketSentRadioTapHeaderLength, s_uLastPacketSentIEEEHeaderLength, 10,6,8 ); // 24 is size of Ruby packet header
+   }
+   #endif
 
-   int len = 0;
+   return iSent;
+}
 
-   if ( s_iUsePCAPForTx )
+// Returns the number of packets sent (in order, from the start of the list)
+
+int radio_write_raw_packets(int interfaceIndex, u8** pPackets, int* piLengths, int iCount)
+{
+   return _radio_write_raw_packets(interfaceIndex, NULL, NULL, pPackets, piLengths, iCount);
+}
+
+static void _radio_check_debug_ping_sent()
+{
+   if ( ! s_bRadioDebugFlag )
+      return;
+
+   t_packet_header* pPH = (t_packet_header*)&s_uLastPacketBuilt[0];
+   if ( pPH->packet_type == PACKET_TYPE_RUBY_PING_CLOCK )
+   {
+      s_uLastRadioPingSentTime = get_current_timestamp_ms();
+      s_uLastRadioPingId = s_uLastPacketBuilt[sizeof(t_packet_header)];
+      //log_line("DEBUG sent PING, id: %d", s_uLastRadioPingId);
+   }
+
+   if ( pPH->packet_type == PACKET_TYPE_RUBY_PING_CLOCK_REPLY )
+   {
+      u8 uPingId = s_uLastPacketBuilt[sizeof(t_packet_header)];
+      //if ( uPingId == s_uLastRadioPingId )
+      //   log_line("DEBUG send matching ping reply id %d, delta time: %u ms", uPingId, get_current_timestamp_ms() - s_uLastRadioPingSentTime);
+      //else
+      //   log_line("DEBUG send ping reply %d", uPingId);
+   }
+}
+
+// Inside a batch: copies the packet (optional header + data) to the interface's batch queue, it will be sent on radio_tx_batch_flush
+// Returns 1 if queued, 0 if it was not queued (must be sent now), -1 for invalid interface
+
+static int _radio_tx_batch_queue(int interfaceIndex, u8* pHeader, int iHeaderLength, u8* pData, int iDataLength)
+{
+   if ( (! s_iRadioTxBatchActive) || (iHeaderLength + iDataLength > MAX_PACKET_TOTAL_SIZE) || (interfaceIndex < 0) || (interfaceIndex >= MAX_RADIO_INTERFACES) )
+      return 0;
+
+   radio_hw_info_t* pRadioHWInfo = hardware_get_radio_info(interfaceIndex);
+   if ( NULL == pRadioHWInfo || ( 0 == pRadioHWInfo->openedForWrite) || (pRadioHWInfo->monitor_interface_write.selectable_fd < 0 ) )
+   {
+      log_softerror_and_alarm("RadioError: Tried to write a radio message to an invalid interface (%d).", interfaceIndex+1);
+      return -1;
+   }
+   t_radio_tx_batch* pBatch = &s_RadioTxBatches[interfaceIndex];
+   if ( NULL == pBatch->pBuffer )
+   {
+      pBatch->pBuffer = (u8*) malloc(RADIO_TX_BATCH_MAX_PACKETS * MAX_PACKET_TOTAL_SIZE);
+      if ( NULL == pBatch->pBuffer )
+         log_softerror_and_alarm("RadioError: Failed to allocate tx batch buffer for radio interface %d.", interfaceIndex+1);
+      pBatch->iCount = 0;
+   }
+   if ( NULL == pBatch->pBuffer )
+      return 0;
+
+   if ( pBatch->iCount >= RADIO_TX_BATCH_MAX_PACKETS )
+   {
+      radio_write_raw_packets(interfaceIndex, pBatch->pPackets, pBatch->iLengths, pBatch->iCount);
+      pBatch->iCount = 0;
+   }
+   u8* pSlot = pBatch->pBuffer + pBatch->iCount * MAX_PACKET_TOTAL_SIZE;
+   pBatch->pPackets[pBatch->iCount] = pSlot;
+   pBatch->iLengths[pBatch->iCount] = iHeaderLength + iDataLength;
+   if ( iHeaderLength > 0 )
+      memcpy(pSlot, pHeader, iHeaderLength);
+   memcpy(pSlot + iHeaderLength, pData, iDataLength);
+   pBatch->iCount++;
+   return 1;
+}
+
+static void _radio_tx_async_wake()
+{
+   u64 uValue = 1;
+   if ( sizeof(uValue) != write(s_RadioTxAsync.iEventFd, &uValue, sizeof(uValue)) )
+      log_softerror_and_alarm("RadioError: Failed to wake up the async tx thread.");
+}
+
+// Copies the packet (optional header + data) to the async tx queue.
+// Returns 1 if queued, 0 if it was not queued (async tx not used by this thread, must be sent now), -1 if it was dropped
+
+static int _radio_tx_async_queue(int interfaceIndex, u8* pHeader, int iHeaderLength, u8* pData, int iDataLength)
+{
+   if ( (! s_RadioTxAsync.iRunning) || (iHeaderLength + iDataLength > MAX_PACKET_TOTAL_SIZE) )
+      return 0;
+   if ( ! pthread_equal(pthread_self(), s_RadioTxAsync.threadProducer) )
+      return 0;
+
+   // Tx queue full: the radio can't keep up, wait for the tx thread (same as waiting for a blocking send)
+   u8* pBuffer = packets_pool_alloc(&s_RadioTxAsync.pool);
+   u32 uWaitMicros = 0;
+   while ( (NULL == pBuffer) && (uWaitMicros < RADIO_TX_ASYNC_MAX_WAIT_MICROS) )
    {
-      len = pcap_inject(pRadioHWInfo->monitor_interface_write.ppcap, pData, dataLength);
-      if ( len < dataLength )
+      if ( 0 == uWaitMicros )
       {
-         log_softerror_and_alarm("RadioError: tx ppcap failed to send radio message (%d bytes sent of %d bytes).", len, dataLength);
-         pRadioHWInfo->monitor_interface_write.iErrorCount++;
-         #ifdef FEATURE_RADIO_SYNCHRONIZE_RXTX_THREADS
-         if ( 1 == s_iMutexRadioSyncRxTxThreadsInitialized )
-            pthread_mutex_unlock(&s_pMutexRadioSyncRxTxThreads);
-         #endif
-         return 0;
+         s_RadioTxAsync.stats.uProducerWaits++;
+         _radio_tx_async_wake();
       }
-      else
-         pRadioHWInfo->monitor_interface_write.iErrorCount = 0;
+      hardware_sleep_micros(200);
+      uWaitMicros += 200;
+      pBuffer = packets_pool_alloc(&s_RadioTxAsync.pool);
    }
-   else
+   if ( NULL == pBuffer )
+   {
+      s_RadioTxAsync.stats.uPacketsDropped++;
+      return -1;
+   }
+
+   t_radio_tx_async_packet* pPacket = (t_radio_tx_async_packet*)pBuffer;
+   pPacket->iInterfaceIndex = interfaceIndex;
+   pPacket->iLength = iHeaderLength + iDataLength;
+   pPacket->uTimeQueuedMicros = get_current_timestamp_micros();
+   u8* pDest = pBuffer + sizeof(t_radio_tx_async_packet);
+   if ( iHeaderLength > 0 )
+      memcpy(pDest, pHeader, iHeaderLength);
+   memcpy(pDest + iHeaderLength, pData, iDataLength);
+
+   // Pool and queue have the same size, so there is room in the queue if a buffer was allocated
+   if ( ! spsc_queue_push(&s_RadioTxAsync.queue, pBuffer) )
    {
-      len = write(pRadioHWInfo->monitor_interface_write.selectable_fd, pData, dataLength);
-      if ( len < dataLength )
+      packets_pool_release(&s_RadioTxAsync.pool, pBuffer);
+      s_RadioTxAsync.stats.uPacketsDropped++;
+      return -1;
+   }
+   __atomic_store_n(&s_RadioTxAsync.uCountQueued, s_RadioTxAsync.uCountQueued + 1, __ATOMIC_RELEASE);
+   s_RadioTxAsync.stats.uPacketsQueued++;
+   if ( (u32)spsc_queue_get_count(&s_RadioTxAsync.queue) > s_RadioTxAsync.stats.uMaxQueued )
+      s_RadioTxAsync.stats.uMaxQueued = spsc_queue_get_count(&s_RadioTxAsync.queue);
+
+   // Inside a batch the tx thread is woken up on flush, so it sends the whole batch at once
+   if ( ! s_iRadioTxBatchActive )
+      _radio_tx_async_wake();
+   return 1;
+}
+
+int radio_write_raw_packet(int interfaceIndex, u8* pData, int dataLength)
+{
+   if ( (NULL == pData) || (dataLength <= 0) )
+   {
+      log_softerror_and_alarm("RadioError: Tried to send an empty radio message.");
+      return 0;
+   }
+
+   _radio_check_debug_ping_sent();
+
+   int iQueued = _radio_tx_async_queue(interfaceIndex, NULL, 0, pData, dataLength);
+   if ( 0 == iQueued )
+      iQueued = _radio_tx_batch_queue(interfaceIndex, NULL, 0, pData, dataLength);
+   if ( iQueued < 0 )
+      return 0;
+   if ( iQueued > 0 )
+      return 1;
+
+   if ( 1 != radio_write_raw_packets(interfaceIndex, &pData, &dataLength, 1) )
+      return 0;
+   return 1;
+}
+
+int radio_write_packet_with_header_template(int iLocalRadioLinkId, int interfaceIndex, u8* pPacketData, int nPacketLength, int portNb)
+{
+   if ( (NULL == pPacketData) || (nPacketLength <= 0) )
+   {
+      log_softerror_and_alarm("RadioError: Tried to send an empty radio message.");
+      return 0;
+   }
+   if ( (interfaceIndex < 0) || (interfaceIndex >= MAX_RADIO_INTERFACES) )
+   {
+      log_softerror_and_alarm("RadioError: Tried to write a radio message to an invalid interface (%d).", interfaceIndex+1);
+      return 0;
+   }
+
+   if ( s_bRadioDebugFlag && (nPacketLength <= MAX_PACKET_TOTAL_SIZE) )
+      memcpy(s_uLastPacketBuilt, pPacketData, nPacketLength);
+   _radio_check_debug_ping_sent();
+
+   radio_prepare_packets_for_tx(iLocalRadioLinkId, pPacketData, nPacketLength);
+
+   u8* pHeader = NULL;
+   int iHeaderLength = radio_get_tx_header_template(interfaceIndex, portNb, &pHeader);
+
+   int iQueued = _radio_tx_async_queue(interfaceIndex, pHeader, iHeaderLength, pPacketData, nPacketLength);
+   if ( 0 == iQueued )
+      iQueued = _radio_tx_batch_queue(interfaceIndex, pHeader, iHeaderLength, pPacketData, nPacketLength);
+   if ( iQueued < 0 )
+      return 0;
+   if ( iQueued > 0 )
+      return 1;
+
+   if ( 1 != _radio_write_raw_packets(interfaceIndex, &pHeader, &iHeaderLength, &pPacketData, &nPacketLength, 1) )
+      return 0;
+   return 1;
+}
+
+void radio_tx_batch_begin()
+{
+   s_iRadioTxBatchActive = 1;
+}
+
+int radio_tx_batch_is_active()
+{
+   return s_iRadioTxBatchActive;
+}
+
+int radio_tx_batch_flush(u32* puTimeMicrosPerInterface)
+{
+   int iTotalSent = 0;
+   s_iRadioTxBatchActive = 0;
+   if ( s_RadioTxAsync.iRunning && pthread_equal(pthread_self(), s_RadioTxAsync.threadProducer) )
+   {
+      _radio_tx_async_wake();
+      for( int i=0; i<MAX_RADIO_INTERFACES; i++ )
       {
-         log_softerror_and_alarm("RadioError: Failed to send radio message on radio interface %d, fd=%d (%d bytes sent of %d bytes).",
-           interfaceIndex+1, pRadioHWInfo->monitor_interface_write.selectable_fd, len, dataLength);
-         pRadioHWInfo->monitor_interface_write.iErrorCount++;
-         #ifdef FEATURE_RADIO_SYNCHRONIZE_RXTX_THREADS
-         if ( 1 == s_iMutexRadioSyncRxTxThreadsInitialized )
-            pthread_mutex_unlock(&s_pMutexRadioSyncRxTxThreads);
-         #endif
-         return 0;
+         u32 uTime = __atomic_exchange_n(&s_RadioTxAsync.uTxTimeMicros[i], 0, __ATOMIC_ACQ_REL);
+         if ( NULL != puTimeMicrosPerInterface )
+            puTimeMicrosPerInterface[i] = uTime;
       }
-      else
-         pRadioHWInfo->monitor_interface_write.iErrorCount = 0;
+      return 0;
    }
+   for( int i=0; i<MAX_RADIO_INTERFACES; i++ )
+   {
+      if ( NULL != puTimeMicrosPerInterface )
+         puTimeMicrosPerInterface[i] = 0;
+      if ( s_RadioTxBatches[i].iCount <= 0 )
+         continue;
+      iTotalSent += radio_write_raw_packets(i, s_RadioTxBatches[i].pPackets, s_RadioTxBatches[i].iLengths, s_RadioTxBatches[i].iCount);
+      s_RadioTxBatches[i].iCount = 0;
+      if ( NULL != puTimeMicrosPerInterface )
+         puTimeMicrosPerInterface[i] = s_RadioTxBatchStats[i].uLastBatchTimeMicros;
+   }
+   return iTotalSent;
+}
 
-   #ifdef FEATURE_RADIO_SYNCHRONIZE_RXTX_THREADS
-   if ( 1 == s_iMutexRadioSyncRxTxThreadsInitialized )
-      pthread_mutex_unlock(&s_pMutexRadioSyncRxTxThreads);
-   #endif
+t_radio_tx_batch_stats* radio_tx_get_batch_stats(int interfaceIndex)
+{
+   if ( (interfaceIndex < 0) || (interfaceIndex >= MAX_RADIO_INTERFACES) )
+      return NULL;
+   return &s_RadioTxBatchStats[interfaceIndex];
+}
 
-   #ifdef DEBUG_PACKET_SENT
-   if ( dataLength <= 96 )
+// Sends all the packets in the async tx queue; consecutive packets for the same interface go in one batch.
+// Returns the number of packets taken from the queue.
+
+static int _radio_tx_async_send_queued()
+{
+   u8* pBuffers[RADIO_TX_BATCH_MAX_PACKETS];
+   u8* pPackets[RADIO_TX_BATCH_MAX_PACKETS];
+   int iLengths[RADIO_TX_BATCH_MAX_PACKETS];
+   int iTotal = 0;
+   u8* pNext = (u8*) spsc_queue_pop(&s_RadioTxAsync.queue);
+
+   while ( NULL != pNext )
    {
-      log_line("Sent buffer over the radio (%d bytes [%d headers, %d data]):", dataLength, s_uLastPacketSentRadioTapHeaderLength + s_uLastPacketSentIEEEHeaderLength, dataLength - s_uLastPacketSentRadioTapHeaderLength - s_uLastPacketSentIEEEHeaderLength);
-      log_buffer5(pData, dataLength, s_uLastPacketSentRadioTapHeaderLength, s_uLastPacketSentIEEEHeaderLength, 10,6,8 ); // 24 is size of Ruby packet header
+      int iInterfaceIndex = ((t_radio_tx_async_packet*)pNext)->iInterfaceIndex;
+      int iCount = 0;
+      while ( (NULL != pNext) && (iCount < RADIO_TX_BATCH_MAX_PACKETS) && (((t_radio_tx_async_packet*)pNext)->iInterfaceIndex == iInterfaceIndex) )
+      {
+         pBuffers[iCount] = pNext;
+         pPackets[iCount] = pNext + sizeof(t_radio_tx_async_packet);
+         iLengths[iCount] = ((t_radio_tx_async_packet*)pNext)->iLength;
+         iCount++;
+         pNext = (u8*) spsc_queue_pop(&s_RadioTxAsync.queue);
+      }
+
+      u32 uTimeStart = get_current_timestamp_micros();
+      int iSent = radio_write_raw_packets(iInterfaceIndex, pPackets, iLengths, iCount);
+      u32 uTimeNow = get_current_timestamp_micros();
+      if ( (iInterfaceIndex >= 0) && (iInterfaceIndex < MAX_RADIO_INTERFACES) )
+         __atomic_add_fetch(&s_RadioTxAsync.uTxTimeMicros[iInterfaceIndex], uTimeNow - uTimeStart, __ATOMIC_RELAXED);
+
+      for( int i=0; i<iCount; i++ )
+      {
+         latency_histogram_add(&s_RadioTxAsync.stats.queueLatency, uTimeNow - ((t_radio_tx_async_packet*)pBuffers[i])->uTimeQueuedMicros);
+         packets_pool_release(&s_RadioTxAsync.pool, pBuffers[i]);
+      }
+      s_RadioTxAsync.stats.uPacketsSent += iSent;
+      iTotal += iCount;
+      __atomic_store_n(&s_RadioTxAsync.uCountDone, s_RadioTxAsync.uCountDone + iCount, __ATOMIC_RELEASE);
    }
-   #endif
+   return iTotal;
+}
+
+static void * _thread_radio_tx_async(void *argument)
+{
+   log_line("[RadioTxAsync] Started.");
+   if ( s_RadioTxAsync.iCPUCore > 0 )
+      hw_set_current_thread_affinity("[RadioTxAsync]", s_RadioTxAsync.iCPUCore, s_RadioTxAsync.iCPUCore);
 
+   struct pollfd fds;
+   fds.fd = s_RadioTxAsync.iEventFd;
+   fds.events = POLLIN;
+
+   while ( ! s_RadioTxAsync.iQuit )
+   {
+      fds.revents = 0;
+      int iRes = poll(&fds, 1, 100);
+      if ( iRes < 0 )
+      {
+         if ( errno == EINTR )
+            continue;
+         log_softerror_and_alarm("[RadioTxAsync] Failed to wait for tx packets, error: %d (%s)", errno, strerror(errno));
+         break;
+      }
+      if ( iRes > 0 )
+      {
+         u64 uValue = 0;
+         if ( sizeof(uValue) == read(s_RadioTxAsync.iEventFd, &uValue, sizeof(uValue)) )
+            s_RadioTxAsync.stats.uWakeups++;
+      }
+      _radio_tx_async_send_queued();
+   }
+   _radio_tx_async_send_queued();
+   log_line("[RadioTxAsync] Stopped.");
+   return NULL;
+}
+
+int radio_tx_async_start(int iCPUCore)
+{
+   if ( s_RadioTxAsync.iRunning )
+      return 1;
+
+   memset(&s_RadioTxAsync, 0, sizeof(s_RadioTxAsync));
+   s_RadioTxAsync.iEventFd = -1;
+   s_RadioTxAsync.iCPUCore = iCPUCore;
+   latency_histogram_reset(&s_RadioTxAsync.stats.queueLatency);
+
+   if ( ! packets_pool_init(&s_RadioTxAsync.pool, "radio_tx_async", sizeof(t_radio_tx_async_packet) + MAX_PACKET_TOTAL_SIZE, RADIO_TX_ASYNC_QUEUE_SIZE, 0) )
+      return 0;
+   if ( ! spsc_queue_init(&s_RadioTxAsync.queue, RADIO_TX_ASYNC_QUEUE_SIZE) )
+   {
+      packets_pool_uninit(&s_RadioTxAsync.pool);
+      return 0;
+   }
+   s_RadioTxAsync.iEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if ( s_RadioTxAsync.iEventFd < 0 )
+   {
+      log_softerror_and_alarm("[RadioTxAsync] Failed to create eventfd, error: %d (%s)", errno, strerror(errno));
+      spsc_queue_uninit(&s_RadioTxAsync.queue);
+      packets_pool_uninit(&s_RadioTxAsync.pool);
+      return 0;
+   }
+   if ( 0 != pthread_create(&s_RadioTxAsync.threadTx, NULL, &_thread_radio_tx_async, NULL) )
+   {
+      log_softerror_and_alarm("[RadioTxAsync] Failed to create the tx thread.");
+      close(s_RadioTxAsync.iEventFd);
+      s_RadioTxAsync.iEventFd = -1;
+      spsc_queue_uninit(&s_RadioTxAsync.queue);
+      packets_pool_uninit(&s_RadioTxAsync.pool);
+      return 0;
+   }
+   s_RadioTxAsync.threadProducer = pthread_self();
+   s_RadioTxAsync.iRunning = 1;
+   log_line("[RadioTxAsync] Started async radio tx (%d packets queue, tx thread core: %d).", RADIO_TX_ASYNC_QUEUE_SIZE, iCPUCore);
    return 1;
 }
 
+// Waits (a bit) for the tx thread to send everything queued so far
+
+static void _radio_tx_async_wait_sent()
+{
+   if ( ! s_RadioTxAsync.iRunning )
+      return;
+   _radio_tx_async_wake();
+   for( int i=0; i<100; i++ )
+   {
+      if ( __atomic_load_n(&s_RadioTxAsync.uCountDone, __ATOMIC_ACQUIRE) == s_RadioTxAsync.uCountQueued )
+         return;
+      hardware_sleep_micros(500);
+   }
+   log_softerror_and_alarm("[RadioTxAsync] Timed out waiting for the queued packets to be sent.");
+}
+
+void radio_tx_async_stop()
+{
+   if ( ! s_RadioTxAsync.iRunning )
+      return;
+   _radio_tx_async_wait_sent();
+   s_RadioTxAsync.iQuit = 1;
+   _radio_tx_async_wake();
+   pthread_join(s_RadioTxAsync.threadTx, NULL);
+   s_RadioTxAsync.iRunning = 0;
+
+   log_line("[RadioTxAsync] Stopped async radio tx. Queued %u packets, sent %u, dropped %u, max queued: %u",
+      s_RadioTxAsync.stats.uPacketsQueued, s_RadioTxAsync.stats.uPacketsSent, s_RadioTxAsync.stats.uPacketsDropped, s_RadioTxAsync.stats.uMaxQueued);
+   close(s_RadioTxAsync.iEventFd);
+   s_RadioTxAsync.iEventFd = -1;
+   spsc_queue_uninit(&s_RadioTxAsync.queue);
+   packets_pool_uninit(&s_RadioTxAsync.pool);
+}
+
+int radio_tx_async_is_running()
+{
+   return s_RadioTxAsync.iRunning;
+}
+
+t_radio_tx_async_stats* radio_tx_async_get_stats()
+{
+   return &s_RadioTxAsync.stats;
+}
+
+void radio_tx_async_reset_stats()
+{
+   s_RadioTxAsync.stats.uPacketsQueued = 0;
+   s_RadioTxAsync.stats.uPacketsSent = 0;
+   s_RadioTxAsync.stats.uPacketsDropped = 0;
+   s_RadioTxAsync.stats.uProducerWaits = 0;
+   s_RadioTxAsync.stats.uWakeups = 0;
+   s_RadioTxAsync.stats.uMaxQueued = 0;
+   latency_histogram_reset(&s_RadioTxAsync.stats.queueLatency);
+}
+
 
 // Returns the number of bytes written or -1 for error, -2 for write error
 
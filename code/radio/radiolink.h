@@ -13,6 +13,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/base.h"
 #include "../base/hardware.h"
 #include "../base/shared_mem.h"
+#include "../base/event_loop.h"
 #include "radioflags.h"
 #include "radiotap.h"
 #include "radiopackets2.h"
@@ -24,9 +25,42 @@ Code written by: Petru Soroaga, 2021-2023
 #define RADIO_PROCESSING_ERROR_NO_ERROR 0x00
 #define RADIO_PROCESSING_ERROR_CODE_INVALID_CRC_RECEIVED 0x01
 #define RADIO_PROCESSING_ERROR_CODE_PACKET_RECEIVED_TOO_SMALL 0x02
+#define RADIO_PROCESSING_ERROR_CODE_AUTHENTICATION_FAILED 0x03
 #define RADIO_PROCESSING_ERROR_INVALID_PARAMETERS 0x0E
 #define RADIO_PROCESSING_ERROR_INVALID_RECEIVED_PACKET 0x0F
 
+// Values for the bEncrypt param of radio_build_new_raw_packet
+#define RADIO_PACKET_ENCRYPTION_NONE 0
+#define RADIO_PACKET_ENCRYPTION_XOR 1
+#define RADIO_PACKET_ENCRYPTION_AEAD 2
+
+// Max radio packets queued per radio interface for a single batched send (a full video block with EC packets)
+#define RADIO_TX_BATCH_MAX_PACKETS MAX_TOTAL_PACKETS_IN_BLOCK
+
+typedef struct
+{
+   u32 uBatchesSent;
+   u32 uPacketsSent;
+   u32 uPacketsFailed;
+   u32 uLastBatchPackets;
+   u32 uMaxBatchPackets;
+   u32 uLastBatchTimeMicros;
+   u32 uMaxBatchTimeMicros;
+   u32 uTotalBatchTimeMicros;
+   u32 uHeaderTemplatesBuilt;
+} t_radio_tx_batch_stats;
+
+typedef struct
+{
+   u32 uPacketsQueued;
+   u32 uPacketsSent;
+   u32 uPacketsDropped; // tx queue still full after waiting for the tx thread
+   u32 uProducerWaits; // times the producer had to wait for free room in the tx queue
+   u32 uWakeups;
+   u32 uMaxQueued;
+   type_latency_histogram queueLatency; // time from queued to written to the radio interface
+} t_radio_tx_async_stats;
+
 #define RADIO_READ_ERROR_NO_ERROR 0
 #define RADIO_READ_ERROR_TIMEDOUT 1
 #define RADIO_READ_ERROR_INTERFACE_BROKEN 2
@@ -45,6 +79,10 @@ void radio_set_link_clock_delta(int iVehicleBehindMilisec);
 int  radio_get_link_clock_delta();
 void radio_set_use_pcap_for_tx(int iEnablePCAPTx);
 void radio_set_bypass_socket_buffers(int iBypass);
+// Use a memory mapped AF_PACKET ring (TPACKET_V3) instead of pcap for reading 2.4/5.8 radio interfaces.
+// Takes effect on the next radio_open_interface_for_read; falls back to pcap if the ring can't be set up.
+void radio_set_use_mmap_ring_for_rx(int iEnableMmapRing);
+int radio_get_use_mmap_ring_for_rx();
 int radio_set_out_datarate(int rate_bps); // positive: classic in bps, negative: MCS; returns 1 if it was changed
 void radio_set_frames_flags(u32 frameFlags); // frame type, MSC Flags
 u32 radio_get_received_frames_type();
@@ -66,13 +104,46 @@ void radio_close_interface_for_write(int interfaceIndex);
 u8* radio_process_wlan_data_in(int interfaceNumber, int* outPacketLength);
 int radio_get_last_read_error_code();
 
-// returns 0 for failure, total length of packet for success
+// returns 0 for failure, total length of packet for success.
+// ChaCha20-Poly1305 packets are authenticated and decrypted in place: the header is rewritten as for a plain packet
+// (no encryption flags, total_length without the AEAD trailer, CRC of the plain packet) and the returned length is
+// the length the packet had in the buffer (including the trailer), so callers step to the next chained packet with it.
 int packet_process_and_check(int interfaceNb, u8* pPacketBuffer, int iBufferLength, int* pbCRCOk);
 int get_last_processing_error_code();
 
 u32 radio_get_next_radio_link_packet_index(int iLocalRadioLinkId);
 int radio_build_new_raw_packet(int iLocalRadioLinkId, u8* pRawPacket, u8* pPacketData, int nInputLength, int portNb, int bEncrypt, int iExtraData, u8* pExtraData);
 int radio_write_raw_packet(int interfaceIndex, u8* pData, int dataLength);
+// Sends multiple raw radio packets with a single syscall (sendmmsg) when possible. Returns the number of packets sent.
+int radio_write_raw_packets(int interfaceIndex, u8** pPackets, int* piLengths, int iCount);
+
+// Zero copy tx path: the radiotap + IEEE headers come from a per interface template (rebuilt only when the
+// datarate, frames flags or port change) and are sent together with the packet data using scatter-gather io.
+// The packets in pPacketData are finalized in place (radio link index, CRC). No encryption or extra data
+// on this path, use radio_build_new_raw_packet + radio_write_raw_packet for those.
+void radio_prepare_packets_for_tx(int iLocalRadioLinkId, u8* pPacketData, int nPacketLength);
+// Returns the headers length; the returned header is valid until the next call for the same interface
+int radio_get_tx_header_template(int interfaceIndex, int portNb, u8** ppHeader);
+void radio_invalidate_tx_header_templates(int interfaceIndex);
+int radio_write_packet_with_header_template(int iLocalRadioLinkId, int interfaceIndex, u8* pPacketData, int nPacketLength, int portNb);
+
+// Between begin and flush, radio_write_raw_packet only queues the packets (per radio interface);
+// flush sends each interface's queue as one batch. Optionally returns the time spent on each interface.
+void radio_tx_batch_begin();
+int radio_tx_batch_is_active();
+int radio_tx_batch_flush(u32* puTimeMicrosPerInterface);
+t_radio_tx_batch_stats* radio_tx_get_batch_stats(int interfaceIndex);
+
+// Async tx: after start, the packets written by the calling thread (directly or in a batch) are copied to
+// a bounded lock-free queue and written to the radio interfaces by a separate tx thread, in the same order.
+// Batch flush wakes up the tx thread, returns 0 and the tx times measured by the tx thread since the previous flush.
+// Writes from other threads are sent right away, as before. iCPUCore: core to pin the tx thread to (1 based), 0 for none.
+int radio_tx_async_start(int iCPUCore);
+// Waits for the queued packets to be sent, then stops the tx thread
+void radio_tx_async_stop();
+int radio_tx_async_is_running();
+t_radio_tx_async_stats* radio_tx_async_get_stats();
+void radio_tx_async_reset_stats();
 int radio_write_serial_packet(int interfaceIndex, u8* pData, int dataLength, u32 uTimeNow);
 int radio_write_sik_packet(int interfaceIndex, u8* pData, int dataLength, u32 uTimeNow);
 
@@ -65,6 +65,8 @@ Code written by: Petru Soroaga, 2021-2023
 #define PACKET_FLAGS_EXTENDED_BIT_SEND_ON_HIGH_CAPACITY_LINK_ONLY  (((u16)1)<<8)
 #define PACKET_FLAGS_EXTENDED_BIT_SEND_ON_LOW_CAPACITY_LINK_ONLY  (((u16)1)<<9)
 #define PACKET_FLAGS_EXTENDED_BIT_REQUIRE_ACK  (((u16)1)<<10)
+// Set with PACKET_FLAGS_BIT_HAS_ENCRYPTION: ChaCha20-Poly1305 encrypted, total_length includes the AEAD trailer (nonce + tag)
+#define PACKET_FLAGS_EXTENDED_BIT_ENCRYPTION_AEAD  (((u16)1)<<11)
 
 
 #define PACKET_COMPONENT_LOCAL_CONTROL 0 // Used only internally, to exchange data between processes
@@ -170,6 +172,9 @@ typedef struct
       //                  u32 - local timestamp sent to video output;
       //    bit 1  - 0/1: is this video packet part of a I-frame
       //    bit 2  - 1: is on lower video bitrate
+      //    bit 3  - 1: the video block was closed early, at the end of a video frame: block_packets and block_fecs
+      //                are the final (smaller) counts for this block; the last data packet can be shorter
+      //                than video_data_length (the rest of it is zero for the EC)
 
    u16 video_width;
    u16 video_height;
@@ -240,6 +245,11 @@ typedef struct
 
 
 #define COMMAND_TYPE_FLAG_NO_RESPONSE_NEEDED ( (u16) (((u16)0x01)<<15) )
+// Command sent through the commands window (more commands in flight, see base/command_window.h)
+#define COMMAND_TYPE_FLAG_WINDOWED ( (u16) (((u16)0x01)<<14) )
+// Set by the vehicle in the origin_command_type of the responses to windowed commands:
+// the response_counter is the selective ack bitmap of the commands before this one
+#define COMMAND_TYPE_FLAG_WINDOW_ACK ( (u16) (((u16)0x01)<<13) )
 #define COMMAND_TYPE_MASK ( (u16) (0x07FF) )
 
 //----------------------------------------------